@@ -86,7 +86,7 @@ http {
     }
 
     server {
-        listen       8443 ssl;
+        listen       8443 ssl http2;
 	server_name  localhost;
 
 	ssl_certificate      ${CERTDIR}/server.pem;
@@ -153,13 +153,21 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -F                     Print the file name, packet number and reply code.\n");
 	fprintf(stderr, "  -h                     Print usage help information.\n");
 	fprintf(stderr, "  -i <id>                Set request id to 'id'.  Values may be 0..255\n");
+	fprintf(stderr, "  -L <pps>[,poisson]     Generate load.  Send 'pps' requests/s on a fixed schedule, regardless of\n");
+	fprintf(stderr, "                         replies, and print latency percentiles.  Gaps between requests are constant,\n");
+	fprintf(stderr, "                         or exponentially distributed if ',poisson' is given.\n");
+	fprintf(stderr, "  -L max                 Generate load as fast as the server replies, keeping '-p' requests\n");
+	fprintf(stderr, "                         outstanding per thread.  Measures the maximum throughput.\n");
 	fprintf(stderr, "  -n <num>               Send N requests/s\n");
+	fprintf(stderr, "  -o <sockets>           Number of source ports for each load generation thread (default 1).\n");
 	fprintf(stderr, "  -p <num>               Send 'num' packets from a file in parallel.\n");
 	fprintf(stderr, "  -P <proto>             Use proto (tcp or udp) for transport.\n");
 	fprintf(stderr, "  -r <retries>           If timeout, retry sending the packet 'retries' times.\n");
 	fprintf(stderr, "  -s                     Print out summary information of auth results.\n");
 	fprintf(stderr, "  -S <file>              read secret from file, not command line.\n");
 	fprintf(stderr, "  -t <timeout>           Wait 'timeout' seconds before retrying (may be a floating point number).\n");
+	fprintf(stderr, "  -T <threads>           Number of load generation threads (default 1).\n");
+	fprintf(stderr, "  -u <duration>          Generate load for 'duration' seconds (default 10).\n");
 	fprintf(stderr, "  -v                     Show program version information.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
@@ -232,6 +240,49 @@ static int mschapv1_encode(fr_radius_packet_t *packet, fr_pair_list_t *list,
 }
 
 
+/*
+ *	In load generation mode, requests are re-encoded for every
+ *	packet, but the pairs aren't touched.  So any password which
+ *	depends on the Request Authenticator has to be encoded once,
+ *	here, using its own challenge.
+ */
+static void radclient_load_prepare(rc_request_t *request)
+{
+	fr_pair_t *vp;
+
+	if (!request->password) return;
+
+	if ((vp = fr_pair_find_by_da_idx(&request->request_pairs, attr_user_password, 0)) != NULL) {
+		/*
+		 *	Encrypted by the encoder, with each packet's
+		 *	Request Authenticator.
+		 */
+		fr_pair_value_strdup(vp, request->password->vp_strvalue, false);
+
+	} else if ((vp = fr_pair_find_by_da_idx(&request->request_pairs, attr_chap_password, 0)) != NULL) {
+		uint8_t		buffer[17];
+		fr_pair_t	*challenge;
+
+		challenge = fr_pair_find_by_da_idx(&request->request_pairs, attr_chap_challenge, 0);
+		if (!challenge || (challenge->vp_length != RADIUS_AUTH_VECTOR_LENGTH)) {
+			uint8_t vector[RADIUS_AUTH_VECTOR_LENGTH];
+
+			fr_rand_buffer(vector, sizeof(vector));
+			MEM(pair_update_request(&challenge, attr_chap_challenge) >= 0);
+			fr_pair_value_memdup(challenge, vector, sizeof(vector), false);
+		}
+
+		fr_radius_encode_chap_password(buffer,
+					       fr_rand() & 0xff, challenge->vp_octets,
+					       request->password->vp_strvalue,
+					       request->password->vp_length);
+		fr_pair_value_memdup(vp, buffer, sizeof(buffer), false);
+
+	} else if (fr_pair_find_by_da_idx(&request->request_pairs, attr_ms_chap_password, 0) != NULL) {
+		mschapv1_encode(request->packet, &request->request_pairs, request->password->vp_strvalue);
+	}
+}
+
 static int getport(char const *name)
 {
 	struct servent *svp;
@@ -1107,12 +1158,18 @@ int main(int argc, char **argv)
 	int		do_summary = false;
 	int		persec = 0;
 	int		parallel = 1;
+	bool		load_max = false;
 	rc_request_t	*this;
 	int		force_af = AF_UNSPEC;
 #ifndef NDEBUG
 	TALLOC_CTX	*autofree;
 #endif
 	fr_rb_tree_t	*filename_tree = NULL;
+	rc_load_conf_t	load = {
+				.threads = 1,
+				.sockets = 1,
+				.duration = fr_time_delta_wrap((int64_t)10 * NSEC)
+			};
 
 	/*
 	 *	It's easier having two sets of flags to set the
@@ -1152,7 +1209,7 @@ int main(int argc, char **argv)
 	default_log.fd = STDOUT_FILENO;
 	default_log.print_level = false;
 
-	while ((c = getopt(argc, argv, "46c:C:d:D:f:Fhi:n:p:P:r:sS:t:vx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "46c:C:d:D:f:Fhi:L:n:o:p:P:r:sS:t:T:u:vx")) != -1) switch (c) {
 		case '4':
 			force_af = AF_INET;
 			break;
@@ -1222,11 +1279,40 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'L':
+		{
+			char *p;
+			unsigned long rate;
+
+			if (strcmp(optarg, "max") == 0) {
+				load_max = true;
+				break;
+			}
+
+			rate = strtoul(optarg, &p, 10);
+			if ((rate == 0) || (rate > UINT32_MAX)) usage();
+
+			if (*p == ',') {
+				if (strcmp(p + 1, "poisson") != 0) usage();
+				load.poisson = true;
+			} else if (*p) {
+				usage();
+			}
+			load.rate = rate;
+		}
+			break;
+
 		case 'n':
 			persec = atoi(optarg);
 			if (persec <= 0) usage();
 			break;
 
+		case 'o':
+			if (!isdigit((int) *optarg)) usage();
+			load.sockets = atoi(optarg);
+			if ((load.sockets == 0) || (load.sockets > 1024)) usage();
+			break;
+
 			/*
 			 *	Note that sending MANY requests in
 			 *	parallel can over-run the kernel
@@ -1296,6 +1382,20 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'T':
+			if (!isdigit((int) *optarg)) usage();
+			load.threads = atoi(optarg);
+			if ((load.threads == 0) || (load.threads > 256)) usage();
+			break;
+
+		case 'u':
+			if (fr_time_delta_from_str(&load.duration, optarg, strlen(optarg), FR_TIME_RES_SEC) < 0) {
+				fr_perror("Failed parsing duration");
+				fr_exit_now(EXIT_FAILURE);
+			}
+			if (!fr_time_delta_ispos(load.duration)) usage();
+			break;
+
 		case 'v':
 			fr_debug_lvl = 1;
 			DEBUG("%s", radclient_version);
@@ -1317,6 +1417,25 @@ int main(int argc, char **argv)
 		ERROR("Insufficient arguments");
 		usage();
 	}
+
+	/*
+	 *	In closed loop load generation, the number of
+	 *	requests in flight is set by -p, and they all
+	 *	need an ID.
+	 */
+	if (load_max) {
+		if ((unsigned int)parallel > (load.sockets * 256)) {
+			ERROR("Can't keep %d requests outstanding with %u sockets, increase -o", parallel, load.sockets);
+			fr_exit_now(EXIT_FAILURE);
+		}
+		load.rate = 0;
+		load.window = parallel;
+	}
+
+	if (((load.rate > 0) || load.window) && (ipproto == IPPROTO_TCP)) {
+		ERROR("Load generation (-L) is only supported over UDP");
+		fr_exit_now(EXIT_FAILURE);
+	}
 	/*
 	 *	Mismatch between the binary and the libraries it depends on
 	 */
@@ -1479,6 +1598,21 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/*
+	 *	Send the packets on a schedule, or as fast as
+	 *	the server replies.
+	 */
+	if ((load.rate > 0) || load.window) {
+		for (this = request_head; this != NULL; this = this->next) radclient_load_prepare(this);
+
+		load.timeout = timeout;
+		load.secret = secret;
+		load.client_ipaddr = client_ipaddr;
+
+		if (rc_load_run(&load, request_head, &stats) < 0) ret = EXIT_FAILURE;
+		goto finish;
+	}
+
 	/*
 	 *	Walk over the packets to send, until
 	 *	we're all done.
@@ -1612,6 +1746,7 @@ int main(int argc, char **argv)
 		}
 	} while (!done);
 
+finish:
 	talloc_free(filename_tree);
 
 	fr_packet_list_free(packet_list);
@@ -92,6 +92,27 @@ struct rc_request {
 	char const		*name;		//!< Test name (as specified in the request).
 };
 
+/** Configuration for load generation mode
+ *
+ */
+typedef struct {
+	uint32_t		rate;		//!< Requests per second, across all threads.
+	unsigned int		window;		//!< Send as fast as replies arrive, keeping this many
+						///< requests outstanding per thread.  Used instead of rate.
+	bool			poisson;	//!< Use exponentially distributed gaps between requests.
+	unsigned int		threads;	//!< Number of sender threads.
+	unsigned int		sockets;	//!< Number of source ports per thread.
+	fr_time_delta_t		duration;	//!< How long to send requests for.
+	fr_time_delta_t		timeout;	//!< How long to wait for a reply.
+	char const		*secret;	//!< Shared secret.  Must be talloced.
+	fr_ipaddr_t		client_ipaddr;	//!< Address to send requests from.
+} rc_load_conf_t;
+
+/*
+ *	radclient_load.c
+ */
+int rc_load_run(rc_load_conf_t const *conf, rc_request_t *head, rc_stats_t *stats) CC_HINT(nonnull);
+
 #ifdef __cplusplus
 }
 #endif
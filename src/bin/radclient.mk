@@ -1,5 +1,5 @@
 TARGET		:= radclient$(E)
-SOURCES		:= radclient.c ${top_srcdir}/src/modules/rlm_mschap/smbdes.c \
+SOURCES		:= radclient.c radclient_load.c ${top_srcdir}/src/modules/rlm_mschap/smbdes.c \
 		   ${top_srcdir}/src/modules/rlm_mschap/mschap.c
 
 TGT_PREREQS	:= libfreeradius-radius$(L)
@@ -0,0 +1,806 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file src/bin/radclient_load.c
+ * @brief Load generator for radclient
+ *
+ * The normal radclient loop is closed: it sends a fixed number of packets
+ * in parallel, and only sends more when replies arrive.  When the server
+ * slows down, so does the client, and the latency it measures is much
+ * lower than what a real NAS would see (coordinated omission).
+ *
+ * In load mode, packets are sent on a fixed schedule, regardless of
+ * whether replies have been received.  The gaps between packets are
+ * either constant, or exponentially distributed (Poisson arrivals).
+ * Latency is measured from the time a packet was *scheduled* to be sent,
+ * so any delay in the client itself is included in the results.
+ *
+ * An open loop can't measure how much load the server can handle, as
+ * the throughput is whatever rate was asked for, until the server
+ * starts losing packets.  So there's also a closed loop mode, where
+ * each thread keeps a fixed number of requests outstanding, and sends
+ * a new one as soon as a reply arrives (or a request times out).  The
+ * throughput is then the maximum the server can sustain with that many
+ * requests in flight.
+ *
+ * Each sender thread has its own event list, its own set of unconnected
+ * UDP sockets (each giving 256 IDs), its own timer wheel for timeouts and
+ * its own latency histogram.  Nothing is shared between threads while
+ * the test runs.  The histograms and counters are merged once all the
+ * threads have finished.
+ *
+ * Packets are not retransmitted.  A packet with no reply after the
+ * timeout is counted as lost, and its ID is released.  If all the IDs
+ * are in use when a packet is due, the packet is counted as skipped.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/timer_wheel.h>
+#include <freeradius-devel/radius/radius.h>
+
+#include <math.h>
+#include <pthread.h>
+
+#include "radclient.h"
+
+/*
+ *	Latencies are recorded in nanoseconds, from 1us to 1 minute,
+ *	with three significant figures.
+ */
+#define RC_LOAD_HIST_LOWEST	1000
+#define RC_LOAD_HIST_HIGHEST	((uint64_t)60 * NSEC)
+#define RC_LOAD_HIST_SIG_FIGS	3
+
+/*
+ *	Maximum number of packets we send from one timer callback,
+ *	so that we still read replies when we fall behind.
+ */
+#define RC_LOAD_SEND_BURST	256
+
+typedef struct rc_load_thread_s rc_load_thread_t;
+typedef struct rc_load_socket_s rc_load_socket_t;
+
+/** A packet we send, in the form we can send it quickly
+ *
+ */
+typedef struct {
+	fr_radius_packet_code_t	code;			//!< Of the request.
+	fr_radius_packet_code_t	filter_code;		//!< Expected code of the response.
+
+	fr_ipaddr_t		dst_ipaddr;		//!< Where to send the request.
+	uint16_t		dst_port;
+
+	fr_pair_list_t		pairs;			//!< This thread's copy of the request pairs.
+
+	uint8_t			*data;			//!< Pre-encoded packet, for packets whose
+							///< authenticator is derived from their contents.
+							///< NULL if the packet has to be encoded each time.
+	size_t			data_len;
+} rc_load_template_t;
+
+/** An outstanding request
+ *
+ */
+typedef struct {
+	rc_load_socket_t	*sock;			//!< Socket the request was sent on.
+	rc_load_template_t const *tmpl;			//!< Request we sent.
+
+	fr_time_t		intended;		//!< When the request was scheduled to be sent.
+	uint8_t			original[RADIUS_HEADER_LENGTH];	//!< Header of the request, for verifying replies.
+
+	fr_timer_wheel_entry_t	te;			//!< Timeout.
+	bool			in_use;
+} rc_load_pending_t;
+
+struct rc_load_socket_s {
+	int			fd;
+	rc_load_thread_t	*thread;		//!< Thread which owns the socket.
+
+	uint8_t			free_ids[256];		//!< Ring of free IDs, so that IDs are
+							///< reused as late as possible.
+	uint8_t			free_head;		//!< First free ID in the ring.
+	unsigned int		num_free;		//!< Number of free IDs.
+
+	rc_load_pending_t	pending[256];		//!< Outstanding requests, indexed by ID.
+};
+
+/** Per-thread counters
+ *
+ */
+typedef struct {
+	uint64_t		sent;			//!< Requests sent.
+	uint64_t		received;		//!< Valid replies received.
+	uint64_t		accepted;		//!< Replies which were accepts or ACKs.
+	uint64_t		rejected;		//!< Replies which were rejects or NAKs.
+	uint64_t		passed;			//!< Replies with the expected code.
+	uint64_t		failed;			//!< Replies with an unexpected code.
+	uint64_t		lost;			//!< Requests with no reply before the timeout.
+	uint64_t		skipped;		//!< Requests which weren't sent, as no IDs were free.
+	uint64_t		bad;			//!< Replies which were malformed, unexpected,
+							///< or failed verification.
+	uint64_t		errors;			//!< Requests which couldn't be encoded or sent.
+} rc_load_stats_t;
+
+struct rc_load_thread_s {
+	rc_load_conf_t const	*conf;
+	unsigned int		num;			//!< Thread number, for errors.
+
+	pthread_t		pthread;
+	bool			running;		//!< Whether the thread was started.
+
+	fr_event_list_t		*el;
+	fr_event_timer_t const	*ev;			//!< Next send.
+	fr_timer_wheel_t	*tw;			//!< Request timeouts.
+
+	rc_load_socket_t	*sockets;
+	unsigned int		num_sockets;
+	unsigned int		next_socket;		//!< Next socket to try for an ID.
+	unsigned int		outstanding;		//!< Requests waiting for a reply.
+
+	rc_load_template_t	*templates;
+	unsigned int		num_templates;
+	unsigned int		next_template;		//!< Next request to send.
+
+	fr_time_delta_t		interval;		//!< Mean gap between requests sent by this thread.
+	fr_fast_rand_t		rand;			//!< For Poisson gaps, and request authenticators.
+	fr_time_t		next;			//!< When the next request is scheduled.
+	fr_time_t		end;			//!< When to stop sending.
+	fr_time_t		finished;		//!< When the last reply arrived, or timed out.
+
+	fr_histogram_t		*hist;			//!< Latency of replies.
+	rc_load_stats_t		stats;
+
+	uint8_t			buffer[MAX_PACKET_LEN];	//!< For encoding and receiving packets.
+};
+
+/** Return the gap between this request and the next one
+ *
+ */
+static inline fr_time_delta_t rc_load_gap(rc_load_thread_t *thread)
+{
+	double u;
+
+	if (!thread->conf->poisson) return thread->interval;
+
+	/*
+	 *	Inverse transform sampling of the exponential
+	 *	distribution.  u is in (0, 1], so log(u) is finite.
+	 */
+	u = ((double)fr_fast_rand(&thread->rand) + 1.0) / 4294967296.0;
+
+	return fr_time_delta_wrap((int64_t)(-log(u) * (double)fr_time_delta_unwrap(thread->interval)));
+}
+
+/** Stop the thread's event loop if there's nothing left to do
+ *
+ */
+static inline void rc_load_check_done(rc_load_thread_t *thread, fr_time_t now)
+{
+	if (thread->ev || (thread->outstanding > 0)) return;
+
+	thread->finished = now;
+	fr_event_loop_exit(thread->el, 1);
+}
+
+/** Release the ID used by a request
+ *
+ */
+static inline void rc_load_pending_release(rc_load_pending_t *pending)
+{
+	rc_load_socket_t	*sock = pending->sock;
+	uint8_t			id = pending - sock->pending;
+
+	fr_assert(pending->in_use);
+
+	if (fr_timer_wheel_entry_armed(&pending->te)) fr_timer_wheel_delete(&pending->te);
+
+	pending->in_use = false;
+	sock->free_ids[(uint8_t)(sock->free_head + sock->num_free)] = id;
+	sock->num_free++;
+	sock->thread->outstanding--;
+}
+
+/** Find a socket with a free ID, and allocate it
+ *
+ */
+static rc_load_pending_t *rc_load_pending_alloc(rc_load_thread_t *thread)
+{
+	unsigned int i;
+
+	for (i = 0; i < thread->num_sockets; i++) {
+		rc_load_socket_t	*sock = &thread->sockets[thread->next_socket];
+		rc_load_pending_t	*pending;
+
+		/*
+		 *	Spread requests across the sockets, so that
+		 *	receive side scaling in the server has
+		 *	something to work with.
+		 */
+		thread->next_socket++;
+		if (thread->next_socket == thread->num_sockets) thread->next_socket = 0;
+
+		if (sock->num_free == 0) continue;
+
+		pending = &sock->pending[sock->free_ids[sock->free_head++]];
+		sock->num_free--;
+
+		fr_assert(!pending->in_use);
+		pending->in_use = true;
+		thread->outstanding++;
+
+		return pending;
+	}
+
+	return NULL;
+}
+
+static inline void rc_load_refill(rc_load_thread_t *thread, fr_time_t now);
+
+static void rc_load_timeout(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	rc_load_pending_t	*pending = uctx;
+	rc_load_thread_t	*thread = pending->sock->thread;
+
+	thread->stats.lost++;
+	rc_load_pending_release(pending);
+
+	rc_load_refill(thread, now);
+	rc_load_check_done(thread, now);
+}
+
+/** Encode and send one request
+ *
+ * @param[in] thread	sending the request.
+ * @param[in] intended	when the request was scheduled to be sent.
+ * @param[in] now	the current time.
+ */
+static void rc_load_send_one(rc_load_thread_t *thread, fr_time_t intended, fr_time_t now)
+{
+	rc_load_template_t		*tmpl;
+	rc_load_pending_t		*pending;
+	uint8_t				*packet;
+	ssize_t				packet_len;
+	uint8_t				id;
+	struct sockaddr_storage		dst;
+	socklen_t			dst_len;
+
+	pending = rc_load_pending_alloc(thread);
+	if (!pending) {
+		thread->stats.skipped++;
+		return;
+	}
+	id = pending - pending->sock->pending;
+
+	tmpl = &thread->templates[thread->next_template++];
+	if (thread->next_template == thread->num_templates) thread->next_template = 0;
+
+	if (tmpl->data) {
+		/*
+		 *	The packet is the same every time, apart
+		 *	from the ID and the authenticator.
+		 */
+		packet = tmpl->data;
+		packet_len = tmpl->data_len;
+		packet[1] = id;
+	} else {
+		uint32_t *vector;
+
+		packet = thread->buffer;
+		vector = (uint32_t *)(packet + 4);
+		vector[0] = fr_fast_rand(&thread->rand);
+		vector[1] = fr_fast_rand(&thread->rand);
+		vector[2] = fr_fast_rand(&thread->rand);
+		vector[3] = fr_fast_rand(&thread->rand);
+
+		packet_len = fr_radius_encode(packet, sizeof(thread->buffer), NULL,
+					      thread->conf->secret, talloc_array_length(thread->conf->secret) - 1,
+					      tmpl->code, id, &tmpl->pairs);
+		if (packet_len < 0) {
+		error:
+			thread->stats.errors++;
+			rc_load_pending_release(pending);
+			return;
+		}
+	}
+
+	if (fr_radius_sign(packet, NULL, (uint8_t const *)thread->conf->secret,
+			   talloc_array_length(thread->conf->secret) - 1) < 0) goto error;
+
+	if (fr_ipaddr_to_sockaddr(&dst, &dst_len, &tmpl->dst_ipaddr, tmpl->dst_port) < 0) goto error;
+
+	if (sendto(pending->sock->fd, packet, packet_len, 0, (struct sockaddr *)&dst, dst_len) < 0) goto error;
+
+	pending->tmpl = tmpl;
+	pending->intended = intended;
+	memcpy(pending->original, packet, sizeof(pending->original));
+
+	if (fr_timer_wheel_insert(thread->tw, &pending->te, fr_time_add(now, thread->conf->timeout),
+				  rc_load_timeout, pending) < 0) goto error;
+
+	thread->stats.sent++;
+}
+
+/** Top up the outstanding requests in closed loop mode
+ *
+ * Each call sends at most one window's worth of requests, so that
+ * we don't spin if requests can't be sent.
+ */
+static inline void rc_load_refill(rc_load_thread_t *thread, fr_time_t now)
+{
+	unsigned int i, num;
+
+	if (!thread->conf->window || fr_time_gteq(now, thread->end)) return;
+	if (thread->outstanding >= thread->conf->window) return;
+
+	num = thread->conf->window - thread->outstanding;
+	for (i = 0; i < num; i++) rc_load_send_one(thread, now, now);
+}
+
+/** Send all the requests which are due
+ *
+ */
+static void rc_load_send(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	rc_load_thread_t	*thread = uctx;
+	unsigned int		i;
+
+	thread->ev = NULL;
+
+	/*
+	 *	In closed loop mode this fires once, to send the
+	 *	first window of requests.  After that, requests
+	 *	are sent as replies arrive.
+	 */
+	if (thread->conf->window) {
+		rc_load_refill(thread, now);
+		rc_load_check_done(thread, now);
+		return;
+	}
+
+	for (i = 0; i < RC_LOAD_SEND_BURST; i++) {
+		if (fr_time_gteq(thread->next, thread->end)) {
+			rc_load_check_done(thread, now);
+			return;
+		}
+
+		if (fr_time_gt(thread->next, now)) break;
+
+		rc_load_send_one(thread, thread->next, now);
+		thread->next = fr_time_add(thread->next, rc_load_gap(thread));
+	}
+
+	/*
+	 *	If we're behind, this fires on the next pass of
+	 *	the event loop, after any replies are read.
+	 */
+	if (fr_event_timer_at(thread, el, &thread->ev, thread->next, rc_load_send, thread) < 0) {
+		fr_perror("radclient: Thread %u failed inserting send timer", thread->num);
+		thread->end = thread->next;
+		rc_load_check_done(thread, now);
+	}
+}
+
+/** Read all the replies waiting on a socket
+ *
+ */
+static void rc_load_recv(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rc_load_socket_t	*sock = uctx;
+	rc_load_thread_t	*thread = sock->thread;
+	uint8_t			*packet = thread->buffer;
+	fr_time_t		now;
+
+	for (;;) {
+		ssize_t			slen;
+		size_t			packet_len;
+		rc_load_pending_t	*pending;
+		uint8_t			code;
+
+		slen = recv(fd, packet, sizeof(thread->buffer), 0);
+		if (slen < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) break;
+
+			thread->stats.bad++;
+			break;
+		}
+
+		now = fr_time();
+
+		packet_len = slen;
+		if (!fr_radius_ok(packet, &packet_len, RADIUS_MAX_ATTRIBUTES, false, NULL)) {
+			thread->stats.bad++;
+			continue;
+		}
+
+		pending = &sock->pending[packet[1]];
+		if (!pending->in_use) {
+			thread->stats.bad++;
+			continue;
+		}
+
+		if (fr_radius_verify(packet, pending->original, (uint8_t const *)thread->conf->secret,
+				     talloc_array_length(thread->conf->secret) - 1, false) < 0) {
+			thread->stats.bad++;
+			continue;
+		}
+
+		fr_histogram_record(thread->hist, fr_time_delta_unwrap(fr_time_sub(now, pending->intended)));
+		thread->stats.received++;
+
+		code = packet[0];
+		switch (code) {
+		case FR_RADIUS_CODE_ACCESS_ACCEPT:
+		case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
+		case FR_RADIUS_CODE_COA_ACK:
+		case FR_RADIUS_CODE_DISCONNECT_ACK:
+			thread->stats.accepted++;
+			break;
+
+		case FR_RADIUS_CODE_ACCESS_CHALLENGE:
+			break;
+
+		default:
+			thread->stats.rejected++;
+			break;
+		}
+
+		if ((pending->tmpl->filter_code == FR_RADIUS_CODE_UNDEFINED) || (code == pending->tmpl->filter_code)) {
+			thread->stats.passed++;
+		} else {
+			thread->stats.failed++;
+		}
+
+		rc_load_pending_release(pending);
+		rc_load_refill(thread, now);
+		rc_load_check_done(thread, now);
+	}
+}
+
+static void rc_load_socket_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				 int fd_errno, void *uctx)
+{
+	rc_load_socket_t *sock = uctx;
+
+	fr_perror("radclient: Thread %u socket error: %s", sock->thread->num, fr_syserror(fd_errno));
+	sock->thread->stats.errors++;
+}
+
+static void *rc_load_thread(void *arg)
+{
+	rc_load_thread_t	*thread = arg;
+	unsigned int		i;
+
+	thread->el = fr_event_list_alloc(thread, NULL, NULL);
+	if (!thread->el) {
+	error:
+		fr_perror("radclient: Thread %u failed initialising", thread->num);
+		thread->stats.errors++;
+		return NULL;
+	}
+
+	/*
+	 *	Timeouts don't need to be precise, so a wheel with
+	 *	1ms ticks saves an event list operation per request.
+	 */
+	thread->tw = fr_timer_wheel_alloc(thread, thread->el, fr_time_delta_from_msec(1), 1024);
+	if (!thread->tw) goto error;
+
+	for (i = 0; i < thread->num_sockets; i++) {
+		if (fr_event_fd_insert(thread, thread->el, thread->sockets[i].fd,
+				       rc_load_recv, NULL, rc_load_socket_error, &thread->sockets[i]) < 0) goto error;
+	}
+
+	if (fr_event_timer_at(thread, thread->el, &thread->ev, thread->next, rc_load_send, thread) < 0) goto error;
+
+	fr_event_loop(thread->el);
+
+	/*
+	 *	Close the sockets while we still own the event list.
+	 */
+	for (i = 0; i < thread->num_sockets; i++) {
+		fr_event_fd_delete(thread->el, thread->sockets[i].fd, FR_EVENT_FILTER_IO);
+	}
+
+	return NULL;
+}
+
+static int _rc_load_thread_free(rc_load_thread_t *thread)
+{
+	unsigned int i;
+
+	for (i = 0; i < thread->num_sockets; i++) {
+		if (thread->sockets[i].fd >= 0) close(thread->sockets[i].fd);
+	}
+
+	return 0;
+}
+
+/** Set up a thread's sockets and requests
+ *
+ * Runs in the main thread, as the request pairs are shared.
+ */
+static int rc_load_thread_init(rc_load_thread_t *thread, rc_request_t *head)
+{
+	rc_request_t	*request;
+	unsigned int	i, j;
+
+	MEM(thread->sockets = talloc_zero_array(thread, rc_load_socket_t, thread->num_sockets));
+	for (i = 0; i < thread->num_sockets; i++) thread->sockets[i].fd = -1;
+	talloc_set_destructor(thread, _rc_load_thread_free);
+
+	for (i = 0; i < thread->num_sockets; i++) {
+		rc_load_socket_t	*sock = &thread->sockets[i];
+		uint16_t		port = 0;
+		int			size = 4 * 1024 * 1024;
+
+		sock->fd = fr_socket_server_udp(&thread->conf->client_ipaddr, &port, NULL, true);
+		if (sock->fd < 0) {
+			fr_perror("radclient: Error opening socket");
+			return -1;
+		}
+
+		if (fr_socket_bind(sock->fd, &thread->conf->client_ipaddr, &port, NULL) < 0) {
+			fr_perror("radclient: Error binding socket");
+			return -1;
+		}
+
+		/*
+		 *	Bursts of replies can easily overflow the
+		 *	default buffer.  It's not an error if we
+		 *	can't increase it.
+		 */
+		(void) setsockopt(sock->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+		sock->thread = thread;
+		sock->num_free = 256;
+		for (j = 0; j < 256; j++) {
+			sock->free_ids[j] = j;
+			sock->pending[j].sock = sock;
+		}
+	}
+
+	for (request = head; request; request = request->next) thread->num_templates++;
+
+	MEM(thread->templates = talloc_zero_array(thread, rc_load_template_t, thread->num_templates));
+	for (request = head, i = 0; request; request = request->next, i++) {
+		rc_load_template_t	*tmpl = &thread->templates[i];
+		ssize_t			slen;
+
+		tmpl->code = request->packet->code;
+		tmpl->filter_code = request->filter_code;
+		tmpl->dst_ipaddr = request->packet->socket.inet.dst_ipaddr;
+		tmpl->dst_port = request->packet->socket.inet.dst_port;
+
+		fr_pair_list_init(&tmpl->pairs);
+		if (fr_pair_list_copy(thread, &tmpl->pairs, &request->request_list) < 0) {
+			fr_perror("radclient: Failed copying request");
+			return -1;
+		}
+
+		/*
+		 *	Access-Request and Status-Server packets
+		 *	need a new random authenticator each time,
+		 *	and the passwords have to be encrypted
+		 *	with it.  Everything else can be encoded
+		 *	once, and re-signed after changing the ID.
+		 */
+		if ((tmpl->code == FR_RADIUS_CODE_ACCESS_REQUEST) ||
+		    (tmpl->code == FR_RADIUS_CODE_STATUS_SERVER)) continue;
+
+		slen = fr_radius_encode(thread->buffer, sizeof(thread->buffer), NULL,
+					thread->conf->secret, talloc_array_length(thread->conf->secret) - 1,
+					tmpl->code, 0, &tmpl->pairs);
+		if (slen < 0) {
+			fr_perror("radclient: Failed encoding request %" PRIu64, request->num);
+			return -1;
+		}
+
+		MEM(tmpl->data = talloc_memdup(thread, thread->buffer, slen));
+		tmpl->data_len = slen;
+	}
+
+	thread->hist = fr_histogram_alloc(thread, RC_LOAD_HIST_LOWEST, RC_LOAD_HIST_HIGHEST, RC_LOAD_HIST_SIG_FIGS);
+	if (!thread->hist) {
+		fr_perror("radclient");
+		return -1;
+	}
+
+	thread->rand.a = fr_rand();
+	thread->rand.b = fr_rand();
+
+	return 0;
+}
+
+static inline double rc_load_msec(uint64_t nsec)
+{
+	return (double)nsec / 1000000.0;
+}
+
+/** Send requests at a fixed rate, or as fast as the server replies, and print a summary of the results
+ *
+ * The requests in the list are sent in order, by every thread,
+ * repeating the list as needed.
+ *
+ * @param[in] conf	rate, duration, etc.
+ * @param[in] head	of the list of requests to send.
+ * @param[out] stats	to add the results to.
+ * @return
+ *	- 0 if the test ran (whether or not any replies were received).
+ *	- -1 if the test couldn't be started.
+ */
+int rc_load_run(rc_load_conf_t const *conf, rc_request_t *head, rc_stats_t *stats)
+{
+	rc_load_thread_t	**threads;
+	rc_load_stats_t		total = {};
+	fr_histogram_t		*hist;
+	fr_time_t		start, finished;
+	fr_time_delta_t		interval;
+	double			elapsed;
+	unsigned int		i;
+	int			rcode, ret = -1;
+	bool			failed = false;
+	static double const	percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+
+	fr_assert((conf->rate > 0) || (conf->window > 0));
+	fr_assert(conf->threads > 0);
+
+	MEM(threads = talloc_zero_array(NULL, rc_load_thread_t *, conf->threads));
+	MEM(hist = fr_histogram_alloc(threads, RC_LOAD_HIST_LOWEST, RC_LOAD_HIST_HIGHEST, RC_LOAD_HIST_SIG_FIGS));
+
+	/*
+	 *	Each thread sends an equal share of the total rate.
+	 */
+	if (conf->rate > 0) {
+		interval = fr_time_delta_wrap((NSEC * (int64_t)conf->threads) / conf->rate);
+		if (!fr_time_delta_ispos(interval)) interval = fr_time_delta_wrap(1);
+	} else {
+		interval = fr_time_delta_wrap(0);
+	}
+
+	/*
+	 *	Threads are their own talloc roots, so they can
+	 *	allocate memory without locking.
+	 */
+	for (i = 0; i < conf->threads; i++) {
+		MEM(threads[i] = talloc_zero(NULL, rc_load_thread_t));
+		threads[i]->conf = conf;
+		threads[i]->num = i;
+		threads[i]->num_sockets = conf->sockets;
+		threads[i]->interval = interval;
+
+		if (rc_load_thread_init(threads[i], head) < 0) goto done;
+	}
+
+	/*
+	 *	Start slightly in the future so all the threads are
+	 *	running, and stagger the threads so their requests
+	 *	are interleaved.
+	 */
+	start = fr_time_add(fr_time(), fr_time_delta_from_msec(10));
+	for (i = 0; i < conf->threads; i++) {
+		rc_load_thread_t *thread = threads[i];
+
+		thread->next = fr_time_add(start, fr_time_delta_wrap((fr_time_delta_unwrap(interval) * i) / conf->threads));
+		thread->end = fr_time_add(start, conf->duration);
+
+		rcode = pthread_create(&thread->pthread, NULL, rc_load_thread, thread);
+		if (rcode != 0) {
+			fr_perror("radclient: Failed creating thread: %s", fr_syserror(rcode));
+			failed = true;
+			break;
+		}
+		thread->running = true;
+	}
+
+	/*
+	 *	Any threads which did start run to completion, and
+	 *	must be joined before they're freed.
+	 */
+	finished = start;
+	for (i = 0; i < conf->threads; i++) {
+		rc_load_thread_t *thread = threads[i];
+
+		if (!thread->running) continue;
+
+		pthread_join(thread->pthread, NULL);
+
+		total.sent += thread->stats.sent;
+		total.received += thread->stats.received;
+		total.accepted += thread->stats.accepted;
+		total.rejected += thread->stats.rejected;
+		total.passed += thread->stats.passed;
+		total.failed += thread->stats.failed;
+		total.lost += thread->stats.lost;
+		total.skipped += thread->stats.skipped;
+		total.bad += thread->stats.bad;
+		total.errors += thread->stats.errors;
+
+		(void) fr_histogram_merge(hist, thread->hist);
+
+		if (fr_time_gt(thread->finished, finished)) finished = thread->finished;
+	}
+	if (failed) goto done;
+
+	elapsed = fr_time_delta_unwrap(fr_time_sub(finished, start)) / (double)NSEC;
+	if (elapsed <= 0) elapsed = 1;
+
+	printf("Load summary:\n");
+	if (conf->window) {
+		printf("\tOffered rate  : max (%u outstanding per thread)\n", conf->window);
+	} else {
+		printf("\tOffered rate  : %u/s (%s)\n", conf->rate, conf->poisson ? "poisson" : "constant");
+	}
+	printf("\tThreads       : %u x %u sockets\n"
+	       "\tElapsed       : %.3fs\n"
+	       "\tSent          : %" PRIu64 " (%.0f/s)\n"
+	       "\tReceived      : %" PRIu64 " (%.0f/s)\n"
+	       "\tAccepted      : %" PRIu64 "\n"
+	       "\tRejected      : %" PRIu64 "\n"
+	       "\tLost          : %" PRIu64 "\n"
+	       "\tSkipped       : %" PRIu64 "\n"
+	       "\tBad replies   : %" PRIu64 "\n"
+	       "\tSend errors   : %" PRIu64 "\n",
+	       conf->threads, conf->sockets,
+	       elapsed,
+	       total.sent, total.sent / elapsed,
+	       total.received, total.received / elapsed,
+	       total.accepted,
+	       total.rejected,
+	       total.lost,
+	       total.skipped,
+	       total.bad,
+	       total.errors);
+
+	if (fr_histogram_count(hist) > 0) {
+		printf("Latency (ms):\n"
+		       "\tmin           : %.3f\n"
+		       "\tmean          : %.3f\n",
+		       rc_load_msec(fr_histogram_min(hist)),
+		       fr_histogram_mean(hist) / 1000000.0);
+
+		for (i = 0; i < NUM_ELEMENTS(percentiles); i++) {
+			printf("\tp%-12g : %.3f\n", percentiles[i],
+			       rc_load_msec(fr_histogram_percentile(hist, percentiles[i])));
+		}
+
+		printf("\tmax           : %.3f\n", rc_load_msec(fr_histogram_max(hist)));
+	}
+
+	stats->accepted += total.accepted;
+	stats->rejected += total.rejected;
+	stats->lost += total.lost;
+	stats->passed += total.passed;
+	stats->failed += total.failed;
+
+	ret = 0;
+
+done:
+	for (i = 0; i < conf->threads; i++) talloc_free(threads[i]);
+	talloc_free(threads);
+
+	return ret;
+}
@@ -42,6 +42,7 @@ RCSID("$Id$")
 
 static fr_dict_t *dicts[255];
 static bool print_values = false;
+static bool write_snapshots = false;
 static fr_dict_t **dict_end = dicts;
 
 DIAG_OFF(unused-macros)
@@ -57,6 +58,7 @@ static void usage(void)
 	fprintf(stderr, "  -V               Write out all attribute values.\n");
 	fprintf(stderr, "  -D <dictdir>     Set main dictionary directory (defaults to " DICTDIR ").\n");
 	fprintf(stderr, "  -p <protocol>    Set protocol by name\n");
+	fprintf(stderr, "  -S               Write precompiled snapshots of the protocol dictionaries.\n");
 	fprintf(stderr, "  -x               Debugging mode.\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Very simple interface to extract attribute definitions from FreeRADIUS dictionaries\n");
@@ -127,6 +129,14 @@ static int load_dicts(char const *dict_dir, char const *protocol)
 				if (fr_dict_protocol_afrom_file(dict_end, dp->d_name, NULL, __FILE__) < 0) {
 					goto error;
 				}
+
+				if (write_snapshots) {
+					INFO("Writing snapshot: %s/%s", file_str, FR_DICT_SNAPSHOT_FILE);
+					if (fr_dict_snapshot_write(*dict_end, file_str) < 0) {
+						dict_end++;
+						goto error;
+					}
+				}
 				dict_end++;
 			}
 
@@ -246,6 +256,7 @@ int main(int argc, char *argv[])
 	bool			export = false;
 	bool			file_export = false;
 	char const		*protocol = NULL;
+	fr_dict_gctx_t		*gctx;
 
 	TALLOC_CTX		*autofree;
 
@@ -267,7 +278,7 @@ int main(int argc, char *argv[])
 
 	fr_debug_lvl = 1;
 
-	while ((c = getopt(argc, argv, "fED:p:Vxh")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "fED:p:SVxh")) != -1) switch (c) {
 		case 'f':
 			file_export = true;
 			break;
@@ -284,6 +295,10 @@ int main(int argc, char *argv[])
 			protocol = optarg;
 			break;
 
+		case 'S':
+			write_snapshots = true;
+			break;
+
 		case 'V':
 			print_values = true;
 			break;
@@ -311,12 +326,19 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
-	if (!fr_dict_global_ctx_init(NULL, true, dict_dir)) {
+	gctx = fr_dict_global_ctx_init(NULL, true, dict_dir);
+	if (!gctx) {
 		fr_perror("radict");
 		ret = 1;
 		goto finish;
 	}
 
+	/*
+	 *	Snapshots must be written from the text
+	 *	dictionaries, not from older snapshots.
+	 */
+	if (write_snapshots) fr_dict_global_ctx_snapshot(gctx, false);
+
 	INFO("Loading dictionary: %s/%s", dict_dir, FR_DICTIONARY_FILE);
 
 	if (fr_dict_internal_afrom_file(dict_end++, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) {
@@ -337,6 +359,8 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
+	if (write_snapshots) found = true;
+
 	if (file_export) {
 		fr_dict_t	**dict_p = dicts;
 
@@ -41,6 +41,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/tls/base.h>
 #include <freeradius-devel/tls/log.h>
+#include <freeradius-devel/tls/offload.h>
 
 #include <freeradius-devel/unlang/base.h>
 
@@ -138,6 +139,8 @@ static int thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el, UNUSED void
 #ifdef WITH_TLS
 	if (fr_openssl_thread_init(main_config->openssl_async_pool_init,
 				   main_config->openssl_async_pool_max) < 0) return -1;
+
+	if (fr_tls_offload_thread_init(ctx, el) < 0) return -1;
 #endif
 	return 0;
 }
@@ -828,6 +831,24 @@ int main(int argc, char *argv[])
 			el = main_loop_event_list();
 		}
 
+#ifdef WITH_TLS
+		if (config->openssl_crypto_threads) {
+			WARN("thread.openssl_crypto_threads is experimental, and should not be used in production");
+		}
+
+		/*
+		 *	Crypto threads must be running before the
+		 *	workers start, so the workers can register
+		 *	with them.
+		 */
+		if (fr_tls_offload_pool_start(config->openssl_crypto_threads,
+					      config->openssl_async_pool_init,
+					      config->openssl_async_pool_max) < 0) {
+			PERROR("Failed starting crypto threads");
+			EXIT_WITH_FAILURE;
+		}
+#endif
+
 		sc = fr_schedule_create(NULL, el, &default_log, fr_debug_lvl,
 					thread_instantiate, thread_detach, schedule);
 		if (!sc) {
@@ -1052,6 +1073,14 @@ cleanup:
 	 */
 	(void) fr_schedule_destroy(&sc);
 
+#ifdef WITH_TLS
+	/*
+	 *	The workers have exited, so nothing can
+	 *	be using the crypto threads.
+	 */
+	fr_tls_offload_pool_stop();
+#endif
+
 	/*
 	 *	Ensure all thread local memory is cleaned up
 	 *	before we start cleaning up global resources.
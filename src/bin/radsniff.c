@@ -859,6 +859,17 @@ static void rs_stats_process(fr_event_list_t *el, fr_time_t now_t, void *ctx)
 
 	stats->intervals++;
 
+	if (this->fanout) {
+		rs_fanout_stats_merge(stats, this->fanout);
+
+		if (rs_fanout_check_drop(this->fanout) < 0) {
+			ERROR("Muting stats for the next %i milliseconds", conf->stats.timeout);
+
+			rs_tv_add_ms(&now, conf->stats.timeout, &stats->quiet);
+			goto clear;
+		}
+	}
+
 	for (in_p = this->in;
 	     in_p;
 	     in_p = in_p->next) {
@@ -919,7 +930,7 @@ clear:
 /** Update latency statistics for request/response and forwarded packets
  *
  */
-static void rs_stats_update_latency(rs_latency_t *stats, struct timeval *latency)
+void rs_stats_update_latency(rs_latency_t *stats, struct timeval *latency)
 {
 	double lint;
 
@@ -936,8 +947,8 @@ static void rs_stats_update_latency(rs_latency_t *stats, struct timeval *latency
 
 }
 
-static int rs_install_stats_processor(rs_stats_t *stats, fr_event_list_t *el,
-				      fr_pcap_t *in, struct timeval *now, bool live)
+static int rs_install_stats_processor(rs_stats_t *stats, fr_event_list_t *el, fr_pcap_t *in,
+				      rs_fanout_t *fanout, struct timeval *now, bool live)
 {
 	static fr_event_timer_t	const *event;
 	static rs_update_t	update;
@@ -947,6 +958,7 @@ static int rs_install_stats_processor(rs_stats_t *stats, fr_event_list_t *el,
 	update.list = el;
 	update.stats = stats;
 	update.in = in;
+	update.fanout = fanout;
 
 	switch (conf->stats.out) {
 	default:
@@ -1970,7 +1982,7 @@ static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *c
 			 *	of the first packet in the trace.
 			 */
 			if (conf->stats.interval && !stats_started) {
-				rs_install_stats_processor(event->stats, el, NULL, &header->ts, false);
+				rs_install_stats_processor(event->stats, el, NULL, event->fanout, &header->ts, false);
 				stats_started = true;
 			}
 
@@ -1979,6 +1991,11 @@ static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *c
 			} while (fr_event_timer_run(el, &now) == 1);
 			count++;
 
+			if (event->fanout) {
+				rs_fanout_replay(event->fanout, event->in->link_layer, header, data);
+				continue;
+			}
+
 			rs_packet_process(count, event, header, data);
 		}
 		return;
@@ -2266,6 +2283,10 @@ static NEVER_RETURNS void usage(int status)
 	fprintf(output, "  -R <filter>           RADIUS attribute response filter.\n");
 	fprintf(output, "  -s <secret>           RADIUS secret.\n");
 	fprintf(output, "  -S                    Write PCAP data to stdout.\n");
+	fprintf(output, "  -t <threads>          Capture and correlate packets using <threads> (1-%u) threads.\n",
+		RS_FANOUT_MAX_WORKERS);
+	fprintf(output, "                        Only statistics are produced (requires -W).  Live capture\n");
+	fprintf(output, "                        uses AF_PACKET fanout, and is only available on Linux.\n");
 	fprintf(output, "  -v                    Show program version information and exit.\n");
 	fprintf(output, "  -w <file>             Write output packets to file.\n");
 	fprintf(output, "  -x                    Print more debugging information.\n");
@@ -2291,6 +2312,7 @@ int main(int argc, char *argv[])
 	fr_pcap_t		*in = NULL, *in_p;
 	fr_pcap_t		**in_head = &in;
 	fr_pcap_t		*out = NULL;
+	rs_fanout_t		*fanout = NULL;
 
 	int			ret = EXIT_SUCCESS;				/* Exit status */
 
@@ -2352,7 +2374,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:Z:")) != -1) {
+	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qr:R:s:St:vw:xXW:T:P:N:O:Z:")) != -1) {
 		switch (c) {
 		case 'a':
 		{
@@ -2541,6 +2563,22 @@ int main(int argc, char *argv[])
 			break;
 		}
 
+		case 't':
+		{
+			char		*end;
+			unsigned long	num;
+
+			errno = 0;
+			num = strtoul(optarg, &end, 10);
+			if ((errno != 0) || (end == optarg) || (*end != '\0') || (optarg[0] == '-') ||
+			    (num == 0) || (num > RS_FANOUT_MAX_WORKERS)) {
+				ERROR("Number of capture threads must be between 1 and %u", RS_FANOUT_MAX_WORKERS);
+				usage(64);
+			}
+			conf->fanout_workers = (unsigned int)num;
+		}
+			break;
+
 		case 'T':
 			conf->stats.timeout = atoi(optarg);
 			if (conf->stats.timeout <= 0) {
@@ -2605,6 +2643,23 @@ int main(int argc, char *argv[])
 		usage(64);
 	}
 
+	/*
+	 *	The multi-threaded engine only correlates packets,
+	 *	it can't filter, print, or write them out.
+	 */
+	if (conf->fanout_workers) {
+		if (!conf->stats.interval) {
+			ERROR("Multi-threaded capture (-t) requires a statistics interval (-W)");
+			usage(64);
+		}
+
+		if (conf->filter_request || conf->filter_response || conf->list_attributes ||
+		    conf->link_attributes || conf->to_file || conf->to_stdout || conf->to_output_dir) {
+			ERROR("Multi-threaded capture (-t) can't be used with -r, -R, -l, -L, -w, -S or -Z");
+			usage(64);
+		}
+	}
+
 	/* Reading from file overrides stdin */
 	if (conf->from_stdin && (conf->from_file || conf->from_dev)) {
 		conf->from_stdin = false;
@@ -2906,6 +2961,21 @@ int main(int argc, char *argv[])
 	}
 #endif
 
+	if (conf->fanout_workers) {
+		if (conf->from_auto) {
+			ERROR("Multi-threaded capture (-t) requires an interface (-i)");
+			ret = 64;
+			goto finish;
+		}
+
+		fanout = rs_fanout_alloc(conf, conf, conf->fanout_workers);
+		if (!fanout) {
+			fr_perror("radsniff");
+			ret = 64;
+			goto finish;
+		}
+	}
+
 	/*
 	 *	This actually opens the capture interfaces/files (we just allocated the memory earlier)
 	 */
@@ -2916,6 +2986,22 @@ int main(int argc, char *argv[])
 		for (in_p = in;
 		     in_p;
 		     in_p = in_p->next) {
+			/*
+			 *	Interfaces are read by the multi-threaded
+			 *	engine instead of libpcap.
+			 */
+			if (fanout && (in_p->type == PCAP_INTERFACE_IN)) {
+				if (rs_fanout_open(fanout, in_p->name, conf->pcap_filter, conf->pcap_filter_vlan) < 0) {
+					fr_perror("Failed opening capture sockets (%s)", in_p->name);
+					goto finish;
+				}
+				in_p->link_layer = rs_fanout_link_layer(fanout);
+
+				*tmp_p = in_p;
+				tmp_p = &(in_p->next);
+				continue;
+			}
+
 			in_p->promiscuous = conf->promiscuous;
 			in_p->buffer_pkts = conf->buffer_pkts;
 			if (fr_pcap_open(in_p) < 0) {
@@ -3035,7 +3121,7 @@ int main(int argc, char *argv[])
 		 */
 		if (conf->stats.interval && conf->from_dev) {
 			now = fr_time_to_timeval(fr_time());
-			rs_install_stats_processor(stats, events, in, &now, false);
+			rs_install_stats_processor(stats, events, fanout ? NULL : in, fanout, &now, false);
 		}
 
 		/*
@@ -3051,6 +3137,12 @@ int main(int argc, char *argv[])
 			event->in = in_p;
 			event->out = out;
 			event->stats = stats;
+			event->fanout = fanout;
+
+			if (fanout && (in_p->type == PCAP_INTERFACE_IN)) {
+				talloc_free(event);
+				continue;
+			}
 
 			/*
 			 *	kevent() doesn't indicate that the
@@ -3079,7 +3171,7 @@ int main(int argc, char *argv[])
 	/*
 	 *	If we just have the pipe, then exit.
 	 */
-	if (fr_event_list_num_fds(events) == 1) goto finish;
+	if ((fr_event_list_num_fds(events) == 1) && !(fanout && conf->from_dev)) goto finish;
 
 
 	/*
@@ -3099,6 +3191,16 @@ int main(int argc, char *argv[])
 #ifdef SIGQUIT
 	fr_set_signal(SIGQUIT, rs_signal_self);
 #endif
+	/*
+	 *	Start the capture threads after daemonizing,
+	 *	as threads don't survive fork().
+	 */
+	if (fanout && conf->from_dev && (rs_fanout_start(fanout) < 0)) {
+		fr_perror("radsniff");
+		ret = EXIT_FAILURE;
+		goto finish;
+	}
+
 	DEBUG2("Entering event loop");
 
 	fr_event_loop(events);	/* Enter the main event loop */
@@ -44,6 +44,7 @@ RCSIDH(radsniff_h, "$Id$")
 #define RS_RETRANSMIT_MAX	5		//!< Maximum number of times we expect to see a packet retransmitted
 #define RS_MAX_ATTRS		50		//!< Maximum number of attributes we can filter on.
 #define RS_SOCKET_REOPEN_DELAY  5000		//!< How long we delay re-opening a collectd socket.
+#define RS_FANOUT_MAX_WORKERS	256		//!< Maximum number of multi-threaded capture threads.
 
 /*
  *	Logging macros
@@ -88,6 +89,8 @@ typedef enum {
 
 typedef struct rs rs_t;
 
+typedef struct rs_fanout_s rs_fanout_t;
+
 #ifdef HAVE_COLLECTDC_H
 typedef struct rs_stats_tmpl rs_stats_tmpl_t;
 typedef struct rs_stats_value_tmpl rs_stats_value_tmpl_t;
@@ -228,6 +231,7 @@ typedef struct {
 	fr_pcap_t		*out;			//!< Where to write output.
 
 	rs_stats_t		*stats;			//!< Where to write stats.
+	rs_fanout_t		*fanout;		//!< Multi-threaded capture engine, if we're using one.
 } rs_event_t;
 
 typedef struct rs_update rs_update_t;
@@ -252,6 +256,8 @@ struct rs_update {
 
 	fr_pcap_t			*in;			//!< Linked list of PCAP handles to check for drops.
 	rs_stats_t			*stats;			//!< Stats to process.
+	rs_fanout_t			*fanout;		//!< Multi-threaded capture engine to merge
+								//!< stats from.
 	rs_stats_print_header_cb_t	head;			//!< Print header.
 	rs_stats_print_cb_t		body;			//!< Print body.
 };
@@ -304,6 +310,7 @@ struct rs {
 
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
 	uint64_t		limit;			//!< Maximum number of packets to capture
+	unsigned int		fanout_workers;		//!< Capture with this many threads, only producing stats.
 
 	struct {
 		int			interval;		//!< Time between stats updates in seconds.
@@ -319,6 +326,19 @@ struct rs {
 	} stats;
 };
 
+void rs_stats_update_latency(rs_latency_t *stats, struct timeval *latency);
+
+/*
+ *	radsniff_fanout.c - Multi-threaded capture
+ */
+rs_fanout_t *rs_fanout_alloc(TALLOC_CTX *ctx, rs_t const *conf, unsigned int num_workers);
+int rs_fanout_open(rs_fanout_t *fo, char const *ifname, char const *filter, char const *filter_vlan);
+int rs_fanout_link_layer(rs_fanout_t const *fo);
+int rs_fanout_start(rs_fanout_t *fo);
+void rs_fanout_replay(rs_fanout_t *fo, int link_layer, struct pcap_pkthdr const *header, uint8_t const *data);
+void rs_fanout_stats_merge(rs_stats_t *stats, rs_fanout_t *fo);
+int rs_fanout_check_drop(rs_fanout_t *fo);
+
 #ifdef HAVE_COLLECTDC_H
 
 /** Callback for processing stats values.
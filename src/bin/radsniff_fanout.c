@@ -0,0 +1,895 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file radsniff_fanout.c
+ * @brief Multi-threaded capture engine for radsniff latency statistics
+ *
+ * The normal capture path reads packets with libpcap on a single thread,
+ * and fully decodes every packet so that it can be filtered and printed.
+ * That's fine for debugging, but drops packets well before line rate.
+ *
+ * This engine only produces statistics.  On Linux, each worker thread
+ * opens its own AF_PACKET socket with a TPACKET_V3 ring, and all the
+ * sockets join one PACKET_FANOUT_HASH group.  The kernel's flow hash is
+ * symmetric, so a request and its response are always delivered to the
+ * same worker, and each worker can correlate packets using its own table,
+ * without any locking between workers.
+ *
+ * Workers only decode the IP, UDP and RADIUS headers.  Requests are
+ * keyed on the NAS address/port, server address/port and RADIUS ID.
+ * Statistics are accumulated per worker and merged into the main stats
+ * structure by the stats interval timer.
+ *
+ * Packets read from pcap files are dispatched to the same per-worker
+ * tables on the main thread, using the same flow hash, so replays are
+ * deterministic.
+ *
+ * Unlike the normal path, requests are removed as soon as they're
+ * answered, so retransmitted responses are counted as unlinked.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/net.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include "radsniff.h"
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+#  include <linux/if_packet.h>
+#  include <linux/if_ether.h>
+#  include <linux/filter.h>
+#  include <net/if.h>
+#  include <poll.h>
+#  include <sys/mman.h>
+#  include <sys/socket.h>
+#  if defined(TPACKET3_HDRLEN) && defined(PACKET_FANOUT)
+#    define RS_FANOUT_RING
+#  endif
+#endif
+
+#define RS_FANOUT_MAX_PENDING	65536		//!< Maximum outstanding requests per worker.
+#define RS_FANOUT_BLOCK_SIZE	(1 << 20)	//!< Size of a block in the TPACKET_V3 ring.
+#define RS_FANOUT_BLOCKS	32		//!< Default number of blocks in the ring.
+#define RS_FANOUT_FRAME_SIZE	2048		//!< Nominal frame size (only used to size the ring).
+#define RS_FANOUT_BLOCK_TIMEOUT	10		//!< Milliseconds before the kernel retires a partial block.
+
+/** Identifies an exchange, independent of the direction of the packet
+ *
+ */
+typedef struct CC_HINT(__packed__) {
+	uint8_t			client[16];		//!< Address of the NAS.  IPv4 addresses are v4 mapped.
+	uint8_t			server[16];		//!< Address of the server.
+	uint16_t		client_port;		//!< Port of the NAS.
+	uint16_t		server_port;		//!< Port of the server.
+	uint8_t			id;			//!< RADIUS ID.  Must be the last field.
+} rs_fanout_key_t;
+
+/** The fields of a packet we need
+ *
+ */
+typedef struct {
+	rs_fanout_key_t		key;
+	uint32_t		flow_hash;		//!< Hash of the key, without the ID.
+	uint8_t			code;			//!< RADIUS packet code.
+	bool			request;		//!< Whether the packet is a request.
+	uint8_t const		*vector;		//!< Authenticator.
+	int64_t			when;			//!< When the packet was captured (ns since epoch).
+} rs_fanout_packet_t;
+
+typedef struct rs_fanout_entry_s rs_fanout_entry_t;
+
+/** An outstanding request
+ *
+ */
+struct rs_fanout_entry_s {
+	rs_fanout_key_t		key;
+	uint32_t		hash;			//!< Hash of the key.
+	uint8_t			code;			//!< Request code.
+	uint8_t			vector[RADIUS_AUTH_VECTOR_LENGTH];	//!< To distinguish retransmissions
+									//!< from ID re-use.
+	unsigned int		rtx;			//!< Number of times the request was retransmitted.
+
+	int64_t			first;			//!< When the request was first seen.
+	int64_t			last;			//!< When the request was last seen.
+
+	rs_fanout_entry_t	*next;			//!< Next entry in the hash bucket.
+	fr_dlist_t		entry;			//!< Entry in the age or free list.
+};
+
+typedef struct {
+	rs_fanout_t		*fo;			//!< Engine we belong to.
+	unsigned int		id;			//!< Worker number.
+
+	pthread_t		thread;			//!< Capture thread.
+	bool			running;		//!< Whether the thread was started.
+
+	int			fd;			//!< AF_PACKET socket.  -1 if not capturing.
+	uint8_t			*ring;			//!< Mapped TPACKET_V3 ring.
+	unsigned int		block;			//!< Next block to read.
+
+	rs_fanout_entry_t	**buckets;		//!< Hash table of outstanding requests.
+	uint32_t		mask;			//!< Number of buckets - 1.
+	rs_fanout_entry_t	*entries;		//!< Preallocated entries.
+	fr_dlist_head_t		age;			//!< Outstanding requests, oldest first.
+	fr_dlist_head_t		free;			//!< Unused entries.
+
+	pthread_mutex_t		mutex;			//!< Protects the counters.
+	uint64_t		evicted;		//!< Requests discarded because the table was full.
+	rs_latency_t		exchange[FR_RADIUS_CODE_MAX + 1];	//!< Counters for the current interval.
+} rs_fanout_worker_t;
+
+struct rs_fanout_s {
+	rs_t const		*conf;			//!< radsniff configuration.
+	int64_t			timeout;		//!< How long to wait for a response (ns).
+
+	unsigned int		num_workers;		//!< Number of workers.
+	rs_fanout_worker_t	*workers;		//!< Array of workers.
+
+	char const		*ifname;		//!< Interface we're capturing on.
+	int			link_layer;		//!< Of the interface we're capturing on.
+	size_t			block_size;		//!< Size of a ring block.
+	unsigned int		num_blocks;		//!< Number of blocks in each ring.
+
+	atomic_bool		stop;			//!< Signal the workers to exit.
+};
+
+/** Whether a packet code is a request, i.e. something we expect a response to
+ *
+ */
+static inline bool rs_fanout_code_is_request(uint8_t code)
+{
+	switch (code) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/** Decode the headers of a captured packet
+ *
+ * @param[out] pkt		Where to write the packet fields.
+ * @param[in] link_layer	of the capture.
+ * @param[in] data		Start of the link layer header.
+ * @param[in] len		Captured length.
+ * @return
+ *	- 0 if this is a RADIUS packet we can use.
+ *	- -1 if the packet should be ignored.
+ */
+static int rs_fanout_decode(rs_fanout_packet_t *pkt, int link_layer, uint8_t const *data, size_t len)
+{
+	uint8_t const		*p = data, *end = data + len;
+	uint8_t const		*src, *dst;
+	size_t			addr_len;
+	ssize_t			slen;
+	udp_header_t const	*udp;
+	radius_packet_t const	*radius;
+	size_t			radius_len;
+
+	slen = fr_pcap_link_layer_offset(data, len, link_layer);
+	if (slen < 0) return -1;
+	p += slen;
+
+	if ((end - p) < 1) return -1;
+
+	switch ((p[0] & 0xf0) >> 4) {
+	case 4:
+	{
+		ip_header_t const *ip = (ip_header_t const *)p;
+
+		if ((size_t)(end - p) < sizeof(*ip)) return -1;
+		if (ip->ip_p != IPPROTO_UDP) return -1;
+		if (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK)) return -1;	/* Fragments */
+
+		src = (uint8_t const *)&ip->ip_src;
+		dst = (uint8_t const *)&ip->ip_dst;
+		addr_len = sizeof(ip->ip_src);
+		p += IP_HL(ip);
+	}
+		break;
+
+	case 6:
+	{
+		ip_header6_t const *ip6 = (ip_header6_t const *)p;
+
+		if ((size_t)(end - p) < sizeof(*ip6)) return -1;
+		if (ip6->ip_next != IPPROTO_UDP) return -1;		/* Extension headers aren't supported */
+
+		src = (uint8_t const *)&ip6->ip_src;
+		dst = (uint8_t const *)&ip6->ip_dst;
+		addr_len = sizeof(ip6->ip_src);
+		p += sizeof(*ip6);
+	}
+		break;
+
+	default:
+		return -1;
+	}
+
+	if ((size_t)(end - p) < (sizeof(udp_header_t) + RADIUS_HEADER_LENGTH)) return -1;
+
+	udp = (udp_header_t const *)p;
+	p += sizeof(udp_header_t);
+
+	radius = (radius_packet_t const *)p;
+	radius_len = (radius->length[0] << 8) | radius->length[1];
+	if ((radius->code == 0) || (radius->code > FR_RADIUS_CODE_MAX)) return -1;
+	if (radius_len < RADIUS_HEADER_LENGTH) return -1;
+
+	memset(&pkt->key, 0, sizeof(pkt->key));
+	pkt->code = radius->code;
+	pkt->request = rs_fanout_code_is_request(radius->code);
+	pkt->vector = radius->vector;
+	pkt->key.id = radius->id;
+
+	/*
+	 *	The key is always NAS -> server, so that
+	 *	requests and responses produce the same key.
+	 */
+	if (addr_len == 4) {
+		pkt->key.client[10] = pkt->key.client[11] = 0xff;
+		pkt->key.server[10] = pkt->key.server[11] = 0xff;
+	}
+
+	if (pkt->request) {
+		memcpy(pkt->key.client + (16 - addr_len), src, addr_len);
+		memcpy(pkt->key.server + (16 - addr_len), dst, addr_len);
+		pkt->key.client_port = udp->src;
+		pkt->key.server_port = udp->dst;
+	} else {
+		memcpy(pkt->key.client + (16 - addr_len), dst, addr_len);
+		memcpy(pkt->key.server + (16 - addr_len), src, addr_len);
+		pkt->key.client_port = udp->dst;
+		pkt->key.server_port = udp->src;
+	}
+
+	pkt->flow_hash = fr_hash(&pkt->key, offsetof(rs_fanout_key_t, id));
+
+	return 0;
+}
+
+/** Find an outstanding request
+ *
+ */
+static inline rs_fanout_entry_t *rs_fanout_find(rs_fanout_worker_t *w, rs_fanout_key_t const *key, uint32_t hash)
+{
+	rs_fanout_entry_t *e;
+
+	for (e = w->buckets[hash & w->mask]; e; e = e->next) {
+		if ((e->hash == hash) && (memcmp(&e->key, key, sizeof(*key)) == 0)) return e;
+	}
+
+	return NULL;
+}
+
+/** Remove a request from the table, and update the retransmission counters
+ *
+ */
+static void rs_fanout_done(rs_fanout_worker_t *w, rs_fanout_entry_t *e)
+{
+	rs_fanout_entry_t **p;
+
+	for (p = &w->buckets[e->hash & w->mask]; *p; p = &(*p)->next) {
+		if (*p != e) continue;
+
+		*p = e->next;
+		break;
+	}
+	e->next = NULL;
+
+	if (e->rtx) w->exchange[e->code].interval.rt_total[(e->rtx > RS_RETRANSMIT_MAX) ? RS_RETRANSMIT_MAX : e->rtx]++;
+
+	fr_dlist_remove(&w->age, e);
+	fr_dlist_insert_head(&w->free, e);
+}
+
+/** Count requests which haven't been answered within the timeout as lost
+ *
+ */
+static void rs_fanout_expire(rs_fanout_worker_t *w, int64_t now)
+{
+	rs_fanout_entry_t *e;
+
+	while ((e = fr_dlist_head(&w->age))) {
+		if ((e->last + w->fo->timeout) > now) break;
+
+		w->exchange[e->code].interval.lost_total++;
+		rs_fanout_done(w, e);
+	}
+}
+
+/** Update the latency counters for one exchange
+ *
+ */
+static inline void rs_fanout_latency(rs_latency_t *stats, int64_t latency)
+{
+	struct timeval tv = fr_time_delta_to_timeval(fr_time_delta_wrap(latency));
+
+	rs_stats_update_latency(stats, &tv);
+}
+
+/** Process one packet
+ *
+ * The worker's mutex must be held.
+ */
+static void rs_fanout_worker_process(rs_fanout_worker_t *w, rs_fanout_packet_t const *pkt)
+{
+	rs_fanout_entry_t	*e;
+	uint32_t		hash = fr_hash_update(&pkt->key.id, sizeof(pkt->key.id), pkt->flow_hash);
+
+	w->exchange[pkt->code].interval.received_total++;
+
+	e = rs_fanout_find(w, &pkt->key, hash);
+
+	if (!pkt->request) {
+		if (!e) {
+			w->exchange[pkt->code].interval.unlinked_total++;
+			return;
+		}
+
+		/*
+		 *	As with the normal path, update both the request
+		 *	and response types, so that CoA and Disconnect
+		 *	latency covers both ACKs and NAKs.
+		 */
+		rs_fanout_latency(&w->exchange[pkt->code], pkt->when - e->first);
+		rs_fanout_latency(&w->exchange[e->code], pkt->when - e->first);
+		rs_fanout_done(w, e);
+		return;
+	}
+
+	if (e) {
+		/*
+		 *	Same packet, it's a retransmission.
+		 */
+		if ((e->code == pkt->code) && (memcmp(e->vector, pkt->vector, sizeof(e->vector)) == 0)) {
+			e->rtx++;
+			e->last = pkt->when;
+			fr_dlist_remove(&w->age, e);
+			fr_dlist_insert_tail(&w->age, e);
+			return;
+		}
+
+		/*
+		 *	ID was re-used before we saw a response.
+		 */
+		w->exchange[pkt->code].interval.reused_total++;
+		rs_fanout_done(w, e);
+	}
+
+	e = fr_dlist_pop_head(&w->free);
+	if (!e) {
+		e = fr_dlist_head(&w->age);
+		w->exchange[e->code].interval.lost_total++;
+		w->evicted++;
+		rs_fanout_done(w, e);
+		e = fr_dlist_pop_head(&w->free);
+	}
+
+	memcpy(&e->key, &pkt->key, sizeof(e->key));
+	memcpy(e->vector, pkt->vector, sizeof(e->vector));
+	e->hash = hash;
+	e->code = pkt->code;
+	e->rtx = 0;
+	e->first = e->last = pkt->when;
+
+	e->next = w->buckets[hash & w->mask];
+	w->buckets[hash & w->mask] = e;
+	fr_dlist_insert_tail(&w->age, e);
+}
+
+#ifdef RS_FANOUT_RING
+/** Read blocks from the ring until told to stop
+ *
+ */
+static void *rs_fanout_worker_thread(void *uctx)
+{
+	rs_fanout_worker_t	*w = uctx;
+	rs_fanout_t		*fo = w->fo;
+	struct pollfd		pfd = { .fd = w->fd, .events = POLLIN | POLLERR };
+
+	while (!atomic_load_explicit(&fo->stop, memory_order_relaxed)) {
+		struct tpacket_block_desc	*bd;
+		struct tpacket3_hdr		*hdr;
+		rs_fanout_packet_t		pkt;
+		unsigned int			i, num;
+		int64_t				last = 0;
+
+		bd = (struct tpacket_block_desc *)(w->ring + ((size_t)w->block * fo->block_size));
+
+		/*
+		 *	Nothing to read, wait for the kernel to retire
+		 *	a block, and expire any outstanding requests.
+		 */
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+			struct timespec ts;
+
+			(void) poll(&pfd, 1, 100);
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			pthread_mutex_lock(&w->mutex);
+			rs_fanout_expire(w, ((int64_t)ts.tv_sec * NSEC) + ts.tv_nsec);
+			pthread_mutex_unlock(&w->mutex);
+			continue;
+		}
+
+		num = bd->hdr.bh1.num_pkts;
+		hdr = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+
+		/*
+		 *	Only take the lock once per block.
+		 */
+		pthread_mutex_lock(&w->mutex);
+		for (i = 0; i < num; i++) {
+			if (rs_fanout_decode(&pkt, fo->link_layer, (uint8_t *)hdr + hdr->tp_mac, hdr->tp_snaplen) == 0) {
+				pkt.when = last = ((int64_t)hdr->tp_sec * NSEC) + hdr->tp_nsec;
+				rs_fanout_worker_process(w, &pkt);
+			}
+			hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+		}
+		if (last) rs_fanout_expire(w, last);
+		pthread_mutex_unlock(&w->mutex);
+
+		/*
+		 *	Hand the block back to the kernel.
+		 */
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		w->block = (w->block + 1) % fo->num_blocks;
+	}
+
+	return NULL;
+}
+
+/** Compile a pcap filter and attach it to an AF_PACKET socket
+ *
+ */
+static int rs_fanout_filter(int fd, int link_layer, char const *expression)
+{
+	pcap_t			*dead;
+	struct bpf_program	prog;
+	struct sock_fprog	fprog;
+	int			ret;
+
+	dead = pcap_open_dead(link_layer, SNAPLEN);
+	if (!dead) {
+		fr_strerror_const("Failed allocating pcap handle for filter");
+		return -1;
+	}
+
+	if (pcap_compile(dead, &prog, expression, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+		fr_strerror_printf("Failed compiling filter \"%s\": %s", expression, pcap_geterr(dead));
+		pcap_close(dead);
+		return -1;
+	}
+	pcap_close(dead);
+
+	fprog.len = prog.bf_len;
+	fprog.filter = (struct sock_filter *)prog.bf_insns;
+
+	ret = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+	pcap_freecode(&prog);
+	if (ret < 0) {
+		fr_strerror_printf("Failed attaching filter: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Open the AF_PACKET socket and ring for a worker, and join the fanout group
+ *
+ */
+static int rs_fanout_worker_open(rs_fanout_worker_t *w, int ifindex, int group,
+				 char const *filter, char const *filter_vlan)
+{
+	rs_fanout_t		*fo = w->fo;
+	int			version = TPACKET_V3;
+	int			fanout = group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	struct tpacket_req3	req;
+	struct sockaddr_ll	ll;
+
+	w->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (w->fd < 0) {
+		fr_strerror_printf("Failed opening AF_PACKET socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (setsockopt(w->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		fr_strerror_printf("Failed setting TPACKET_V3: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = fo->block_size;
+	req.tp_block_nr = fo->num_blocks;
+	req.tp_frame_size = RS_FANOUT_FRAME_SIZE;
+	req.tp_frame_nr = (fo->block_size * fo->num_blocks) / RS_FANOUT_FRAME_SIZE;
+	req.tp_retire_blk_tov = RS_FANOUT_BLOCK_TIMEOUT;
+
+	if (setsockopt(w->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		fr_strerror_printf("Failed allocating capture ring: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	w->ring = mmap(NULL, fo->block_size * fo->num_blocks, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+	if (w->ring == MAP_FAILED) {
+		w->ring = NULL;
+		fr_strerror_printf("Failed mapping capture ring: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Filter before binding, so we never see unwanted packets.
+	 *	As with the pcap path, not all link layers support
+	 *	VLAN tags, so fall back to the plain filter.
+	 */
+	if (filter &&
+	    (!filter_vlan || (rs_fanout_filter(w->fd, fo->link_layer, filter_vlan) < 0)) &&
+	    (rs_fanout_filter(w->fd, fo->link_layer, filter) < 0)) return -1;
+
+	memset(&ll, 0, sizeof(ll));
+	ll.sll_family = AF_PACKET;
+	ll.sll_protocol = htons(ETH_P_ALL);
+	ll.sll_ifindex = ifindex;
+
+	if (bind(w->fd, (struct sockaddr *)&ll, sizeof(ll)) < 0) {
+		fr_strerror_printf("Failed binding to %s: %s", fo->ifname, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fo->conf->promiscuous) {
+		struct packet_mreq mr;
+
+		memset(&mr, 0, sizeof(mr));
+		mr.mr_ifindex = ifindex;
+		mr.mr_type = PACKET_MR_PROMISC;
+
+		if (setsockopt(w->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0) {
+			fr_strerror_printf("Failed enabling promiscuous mode on %s: %s", fo->ifname, fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	if (setsockopt(w->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+		fr_strerror_printf("Failed joining fanout group: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+static int _rs_fanout_free(rs_fanout_t *fo)
+{
+	unsigned int i;
+
+	atomic_store(&fo->stop, true);
+
+	for (i = 0; i < fo->num_workers; i++) {
+		rs_fanout_worker_t *w = &fo->workers[i];
+
+		if (w->running) pthread_join(w->thread, NULL);
+#ifdef RS_FANOUT_RING
+		if (w->ring) munmap(w->ring, fo->block_size * fo->num_blocks);
+#endif
+		if (w->fd >= 0) close(w->fd);
+		pthread_mutex_destroy(&w->mutex);
+	}
+
+	return 0;
+}
+
+/** Allocate the capture engine
+ *
+ * @param[in] ctx		to allocate the engine in.
+ * @param[in] conf		radsniff configuration.
+ * @param[in] num_workers	number of workers (and threads, when capturing live).
+ * @return
+ *	- The engine.
+ *	- NULL on error.
+ */
+rs_fanout_t *rs_fanout_alloc(TALLOC_CTX *ctx, rs_t const *conf, unsigned int num_workers)
+{
+	rs_fanout_t	*fo;
+	unsigned int	i, j;
+
+	if ((num_workers == 0) || (num_workers > 1024)) {
+		fr_strerror_const("Number of capture threads must be between 1 and 1024");
+		return NULL;
+	}
+
+	MEM(fo = talloc_zero(ctx, rs_fanout_t));
+	MEM(fo->workers = talloc_zero_array(fo, rs_fanout_worker_t, num_workers));
+	fo->conf = conf;
+	fo->num_workers = num_workers;
+	fo->timeout = (int64_t)conf->stats.timeout * (NSEC / 1000);
+	fo->link_layer = -1;
+	atomic_init(&fo->stop, false);
+
+	for (i = 0; i < num_workers; i++) {
+		rs_fanout_worker_t *w = &fo->workers[i];
+
+		w->fo = fo;
+		w->id = i;
+		w->fd = -1;
+		pthread_mutex_init(&w->mutex, NULL);
+
+		/*
+		 *	Twice as many buckets as entries keeps the
+		 *	chains short.
+		 */
+		w->mask = (RS_FANOUT_MAX_PENDING * 2) - 1;
+		MEM(w->buckets = talloc_zero_array(fo->workers, rs_fanout_entry_t *, RS_FANOUT_MAX_PENDING * 2));
+		MEM(w->entries = talloc_zero_array(fo->workers, rs_fanout_entry_t, RS_FANOUT_MAX_PENDING));
+
+		fr_dlist_init(&w->age, rs_fanout_entry_t, entry);
+		fr_dlist_init(&w->free, rs_fanout_entry_t, entry);
+		for (j = 0; j < RS_FANOUT_MAX_PENDING; j++) fr_dlist_insert_tail(&w->free, &w->entries[j]);
+	}
+	talloc_set_destructor(fo, _rs_fanout_free);
+
+	return fo;
+}
+
+/** Open capture sockets on an interface
+ *
+ * Only one interface is supported.  The sockets aren't read until
+ * #rs_fanout_start is called.
+ *
+ * @param[in] fo		to open sockets for.
+ * @param[in] ifname		interface to capture on.
+ * @param[in] filter		pcap filter expression.  May be NULL.
+ * @param[in] filter_vlan	variant of the filter for links which support VLAN tags.  May be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rs_fanout_open(rs_fanout_t *fo, char const *ifname, char const *filter, char const *filter_vlan)
+{
+#ifdef RS_FANOUT_RING
+	unsigned int	i;
+	int		ifindex;
+	int		group = getpid() & 0xffff;
+	size_t		total;
+
+	if (fo->ifname) {
+		fr_strerror_printf("Multi-threaded capture is limited to a single interface, already capturing on %s",
+				   fo->ifname);
+		return -1;
+	}
+
+	ifindex = if_nametoindex(ifname);
+	if (ifindex == 0) {
+		fr_strerror_printf("Unknown interface %s: %s", ifname, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	SOCK_RAW sockets return frames with whatever link
+	 *	layer header the interface uses, which is what
+	 *	libpcap reports for the interface.  The exception is
+	 *	the cooked (SLL) header, which libpcap constructs
+	 *	itself, so we can't decode those frames.
+	 */
+	{
+		char	errbuf[PCAP_ERRBUF_SIZE];
+		pcap_t	*handle;
+
+		handle = pcap_open_live(ifname, 0, 0, 0, errbuf);
+		if (!handle) {
+			fr_strerror_printf("Failed determining link layer of %s: %s", ifname, errbuf);
+			return -1;
+		}
+		fo->link_layer = pcap_datalink(handle);
+		pcap_close(handle);
+	}
+
+	if (!fr_pcap_link_layer_supported(fo->link_layer) || (fo->link_layer == DLT_LINUX_SLL)) {
+		fr_strerror_printf("Datalink type %s of %s is not supported by multi-threaded capture",
+				   pcap_datalink_val_to_name(fo->link_layer), ifname);
+		return -1;
+	}
+
+	fo->ifname = talloc_strdup(fo, ifname);
+
+	/*
+	 *	Size the ring from the pcap buffer size if it was
+	 *	specified.
+	 */
+	fo->block_size = RS_FANOUT_BLOCK_SIZE;
+	fo->num_blocks = RS_FANOUT_BLOCKS;
+	if (fo->conf->buffer_pkts > 0) {
+		total = (size_t)fo->conf->buffer_pkts * SNAPLEN;
+		fo->num_blocks = (total + fo->block_size - 1) / fo->block_size;
+		if (fo->num_blocks < 2) fo->num_blocks = 2;
+	}
+
+	for (i = 0; i < fo->num_workers; i++) {
+		if (rs_fanout_worker_open(&fo->workers[i], ifindex, group, filter, filter_vlan) < 0) return -1;
+	}
+
+	return 0;
+#else
+	fr_strerror_const("Multi-threaded capture requires AF_PACKET TPACKET_V3 support, "
+			  "which is not available on this platform");
+	return -1;
+#endif
+}
+
+/** Return the link layer of the interface we're capturing on
+ *
+ * @param[in] fo	to return the link layer for.
+ * @return a DLT_* value, or -1 if no interface has been opened.
+ */
+int rs_fanout_link_layer(rs_fanout_t const *fo)
+{
+	return fo->link_layer;
+}
+
+/** Start a capture thread for each worker
+ *
+ * @param[in] fo	to start.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rs_fanout_start(rs_fanout_t *fo)
+{
+#ifdef RS_FANOUT_RING
+	unsigned int	i;
+	int		ret;
+
+	for (i = 0; i < fo->num_workers; i++) {
+		rs_fanout_worker_t *w = &fo->workers[i];
+
+		ret = pthread_create(&w->thread, NULL, rs_fanout_worker_thread, w);
+		if (ret != 0) {
+			fr_strerror_printf("Failed creating capture thread: %s", fr_syserror(ret));
+			return -1;
+		}
+		w->running = true;
+	}
+
+	DEBUG("Capturing on %s with %u threads", fo->ifname, fo->num_workers);
+
+	return 0;
+#else
+	fr_strerror_const("Multi-threaded capture is not available on this platform");
+	return -1;
+#endif
+}
+
+/** Process a packet read from a pcap file
+ *
+ * The packet is dispatched to a worker's table using the flow hash,
+ * so results are the same regardless of ordering between workers.
+ *
+ * @param[in] fo		to dispatch the packet to.
+ * @param[in] link_layer	of the capture file.
+ * @param[in] header		pcap header.
+ * @param[in] data		packet data.
+ */
+void rs_fanout_replay(rs_fanout_t *fo, int link_layer, struct pcap_pkthdr const *header, uint8_t const *data)
+{
+	rs_fanout_packet_t	pkt;
+	rs_fanout_worker_t	*w;
+
+	if (rs_fanout_decode(&pkt, link_layer, data, header->caplen) < 0) return;
+
+	pkt.when = ((int64_t)header->ts.tv_sec * NSEC) + ((int64_t)header->ts.tv_usec * 1000);
+
+	w = &fo->workers[pkt.flow_hash % fo->num_workers];
+
+	pthread_mutex_lock(&w->mutex);
+	rs_fanout_expire(w, pkt.when);
+	rs_fanout_worker_process(w, &pkt);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+/** Merge the counters from all workers into the main stats, and reset them
+ *
+ * @param[in] stats	to merge into.
+ * @param[in] fo	to merge counters from.
+ */
+void rs_fanout_stats_merge(rs_stats_t *stats, rs_fanout_t *fo)
+{
+	unsigned int	i, code, j;
+	uint64_t	evicted = 0;
+
+	for (i = 0; i < fo->num_workers; i++) {
+		rs_fanout_worker_t *w = &fo->workers[i];
+
+		pthread_mutex_lock(&w->mutex);
+		for (code = 1; code <= FR_RADIUS_CODE_MAX; code++) {
+			rs_latency_t	*src = &w->exchange[code];
+			rs_latency_t	*dst = &stats->exchange[code];
+
+			if (!src->interval.received_total && !src->interval.lost_total) continue;
+
+			dst->interval.received_total += src->interval.received_total;
+			dst->interval.linked_total += src->interval.linked_total;
+			dst->interval.unlinked_total += src->interval.unlinked_total;
+			dst->interval.reused_total += src->interval.reused_total;
+			dst->interval.lost_total += src->interval.lost_total;
+			for (j = 0; j <= RS_RETRANSMIT_MAX; j++) dst->interval.rt_total[j] += src->interval.rt_total[j];
+
+			dst->interval.latency_total += src->interval.latency_total;
+			if (src->interval.latency_high > dst->interval.latency_high) {
+				dst->interval.latency_high = src->interval.latency_high;
+			}
+			if (src->interval.latency_low &&
+			    (!dst->interval.latency_low || (src->interval.latency_low < dst->interval.latency_low))) {
+				dst->interval.latency_low = src->interval.latency_low;
+			}
+
+			memset(&src->interval, 0, sizeof(src->interval));
+		}
+		evicted += w->evicted;
+		w->evicted = 0;
+		pthread_mutex_unlock(&w->mutex);
+	}
+
+	if (evicted) ERROR("Request table full, %" PRIu64 " requests were discarded and counted as lost", evicted);
+}
+
+/** Check whether any of the capture sockets dropped packets
+ *
+ * @param[in] fo	to check.
+ * @return
+ *	- 0 if no packets were dropped since the last call.
+ *	- -1 if packets were dropped.
+ */
+int rs_fanout_check_drop(rs_fanout_t *fo)
+{
+#ifdef RS_FANOUT_RING
+	unsigned int	i;
+	uint64_t	drops = 0;
+
+	for (i = 0; i < fo->num_workers; i++) {
+		struct tpacket_stats_v3	st;
+		socklen_t		len = sizeof(st);
+
+		if (fo->workers[i].fd < 0) continue;
+
+		/*
+		 *	The kernel resets the counters when they're read.
+		 */
+		if (getsockopt(fo->workers[i].fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) continue;
+		drops += st.tp_drops;
+	}
+
+	if (drops > 0) {
+		ERROR("%s dropped %" PRIu64 " packets: Buffer exhaustion", fo->ifname, drops);
+		return -1;
+	}
+#endif
+
+	return 0;
+}
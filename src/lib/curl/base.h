@@ -91,8 +91,29 @@ typedef struct {
 	fr_event_timer_t const	*ev;			//!< Multi-Handle timer.
 	uint64_t		transfers;		//!< How many transfers are current in progress.
 	CURLM			*mandle;		//!< The multi handle.
+	bool			multiplex;		//!< Whether transfers should wait for, and be multiplexed
+							///< over, existing connections.
+
+	uint64_t		completed;		//!< How many transfers have completed (streams).
+	uint64_t		connections;		//!< How many new connections were opened for those
+							///< transfers.  The difference between completed and
+							///< connections is the number of transfers that
+							///< reused a cached connection.
 } fr_curl_handle_t;
 
+/** Connection reuse and multiplexing configuration for a multi-handle
+ *
+ */
+typedef struct {
+	bool			multiplex;		//!< Run multiple transfers over a single connection.
+							///< HTTP/2 only.
+	uint32_t		max_host_connections;	//!< Maximum number of connections to a single host.
+							///< 0 means unlimited.
+	uint32_t		max_concurrent_streams;	//!< Maximum number of streams per HTTP/2 connection.
+	uint32_t		max_cached_connections;	//!< Size of the multi-handle's connection cache.
+							///< 0 means use libcurl's default.
+} fr_curl_conn_config_t;
+
 /** Structure representing an individual request being passed to curl for processing
  *
  */
@@ -125,7 +146,7 @@ int			fr_curl_io_request_enqueue(fr_curl_handle_t *mhandle,
 
 fr_curl_io_request_t	*fr_curl_io_request_alloc(TALLOC_CTX *ctx);
 
-fr_curl_handle_t	*fr_curl_io_init(TALLOC_CTX *ctx, fr_event_list_t *el, bool multiplex);
+fr_curl_handle_t	*fr_curl_io_init(TALLOC_CTX *ctx, fr_event_list_t *el, fr_curl_conn_config_t const *conn_conf);
 
 int			fr_curl_response_certinfo(request_t *request, fr_curl_io_request_t *randle);
 
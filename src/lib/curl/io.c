@@ -76,6 +76,26 @@ static inline void _fr_curl_io_demux(fr_curl_handle_t *mhandle, CURLM *mandle)
 
 			REQUEST_VERIFY(request);
 
+			/*
+			 *	Record whether this transfer needed a new
+			 *	connection, or was able to use one from the
+			 *	multi-handle's connection cache.  With HTTP/2
+			 *	multiplexing, many transfers (streams) should
+			 *	share a small number of connections.
+			 */
+			{
+				long	num_connects = 0;
+
+				mhandle->completed++;
+				if (curl_easy_getinfo(candle, CURLINFO_NUM_CONNECTS, &num_connects) == CURLE_OK) {
+					mhandle->connections += num_connects;
+				}
+
+				RDEBUG3("Transfer %s connection.  Multi-handle has completed %" PRIu64 " transfer(s) "
+					"using %" PRIu64 " connection(s)", num_connects ? "opened a new" : "reused an existing",
+					mhandle->completed, mhandle->connections);
+			}
+
 			/*
 			 *	If the request failed, say why...
 			 */
@@ -480,6 +500,18 @@ int fr_curl_io_request_enqueue(fr_curl_handle_t *mhandle, request_t *request, fr
 		return -1;
 	}
 
+#if CURL_AT_LEAST_VERSION(7,43,0)
+	/*
+	 *	If we're multiplexing, prefer waiting for an
+	 *	existing (or pending) connection to the same
+	 *	host to confirm it can multiplex, instead of
+	 *	racing to open a new TCP+TLS connection for
+	 *	every transfer added before the first handshake
+	 *	completes.
+	 */
+	if (mhandle->multiplex) FR_CURL_REQUEST_SET_OPTION(CURLOPT_PIPEWAIT, 1L);
+#endif
+
 	/*
 	 *	Increment here, else the debug output looks
 	 *	messed up is curl_multi_add_handle triggers
@@ -538,21 +570,23 @@ static int _mhandle_free(fr_curl_handle_t *mhandle)
 }
 
 /** Performs the libcurl initialisation of the thread
+ *
+ * The multi-handle owns the connection cache, so all easy handles added to it
+ * share connections.  With multiplexing enabled, concurrent transfers to the
+ * same host are sent as streams over a single HTTP/2 connection.
  *
  * @param[in] ctx		to alloc handle in.
  * @param[in] el		to initial.
- * @param[in] multiplex		Run multiple requests over the same connection simultaneously.
- *				HTTP/2 only.
+ * @param[in] conn_conf		Connection reuse and multiplexing limits.
+ *				May be NULL, in which case libcurl's defaults
+ *				are used and multiplexing is disabled.
  * @return
  *	- 0 on success.
  *	- -1 on error.
  */
 fr_curl_handle_t *fr_curl_io_init(TALLOC_CTX *ctx,
 				   fr_event_list_t *el,
-#ifndef CURLPIPE_MULTIPLEX
-				   UNUSED
-#endif
-				   bool multiplex)
+				   fr_curl_conn_config_t const *conn_conf)
 {
 	CURLMcode		ret;
 	CURLM			*mandle;
@@ -583,8 +617,25 @@ fr_curl_handle_t *fr_curl_io_init(TALLOC_CTX *ctx,
 	SET_MOPTION(mandle, CURLMOPT_SOCKETFUNCTION, _fr_curl_io_event_modify);
 	SET_MOPTION(mandle, CURLMOPT_SOCKETDATA, mhandle);
 
+	if (!conn_conf) return mhandle;
+
 #ifdef CURLPIPE_MULTIPLEX
-	SET_MOPTION(mandle, CURLMOPT_PIPELINING, multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+	mhandle->multiplex = conn_conf->multiplex;
+	SET_MOPTION(mandle, CURLMOPT_PIPELINING, conn_conf->multiplex ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+#endif
+
+	if (conn_conf->max_host_connections) {
+		SET_MOPTION(mandle, CURLMOPT_MAX_HOST_CONNECTIONS, (long)conn_conf->max_host_connections);
+	}
+
+	if (conn_conf->max_cached_connections) {
+		SET_MOPTION(mandle, CURLMOPT_MAXCONNECTS, (long)conn_conf->max_cached_connections);
+	}
+
+#if CURL_AT_LEAST_VERSION(7,67,0)
+	if (conn_conf->max_concurrent_streams) {
+		SET_MOPTION(mandle, CURLMOPT_MAX_CONCURRENT_STREAMS, (long)conn_conf->max_concurrent_streams);
+	}
 #endif
 
 	return mhandle;
@@ -34,6 +34,7 @@ RCSIDH(sim_h, "$Id$")
 #include <openssl/evp.h>
 #include <freeradius-devel/eap/compose.h>
 #include <freeradius-devel/eap/types.h>
+#include <freeradius-devel/server/cf_parse.h>
 
 #include "id.h"
 
@@ -228,6 +229,18 @@ typedef struct {
 	uint8_t		emsk[64];				//!< Derived extended master session key.
 } fr_aka_sim_keys_t;
 
+/** Configuration for the per-thread pool of pre-generated vectors
+ *
+ * When vectors are generated locally from a Ki, each worker thread keeps
+ * a batch of unused vectors for recently seen subscribers.  Generating
+ * vectors in batches lets the AES operations for all of them be pipelined.
+ */
+typedef struct {
+	uint32_t	max_subscribers;			//!< Maximum number of subscribers each thread holds
+								///< vectors for.  0 disables the pool.
+	uint32_t	batch_size;				//!< Number of vectors to generate at once.
+} fr_aka_sim_vector_pool_conf_t;
+
 /** Encoder/decoder ctx
  *
  */
@@ -317,14 +330,18 @@ void		fr_aka_sim_crypto_keys_log(request_t *request, fr_aka_sim_keys_t *keys);
 /*
  *	vector.c
  */
+extern CONF_PARSER const fr_aka_sim_vector_pool_config[];
+
 int		fr_aka_sim_vector_gsm_from_attrs(request_t *request, fr_pair_list_t *vps,
 						 int idx,
 						 fr_aka_sim_keys_t *keys,
-						 fr_aka_sim_vector_src_t *src);
+						 fr_aka_sim_vector_src_t *src,
+						 fr_aka_sim_vector_pool_conf_t const *pool_conf);
 
 int		fr_aka_sim_vector_umts_from_attrs(request_t *request, fr_pair_list_t *vps,
 						  fr_aka_sim_keys_t *keys,
-						  fr_aka_sim_vector_src_t *src);
+						  fr_aka_sim_vector_src_t *src,
+						  fr_aka_sim_vector_pool_conf_t const *pool_conf);
 
 int		fr_aka_sim_vector_gsm_umts_kdf_0_reauth_from_attrs(request_t *request, fr_pair_list_t *vps,
 								   fr_aka_sim_keys_t *keys);
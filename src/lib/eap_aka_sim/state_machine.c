@@ -2358,6 +2358,7 @@ STATE(aka_challenge)
  */
 RESUME(send_aka_challenge_request)
 {
+	eap_aka_sim_process_conf_t	*inst = talloc_get_type_abort(mctx->inst->data, eap_aka_sim_process_conf_t);
 	eap_aka_sim_session_t	*eap_aka_sim_session = talloc_get_type_abort(mctx->rctx, eap_aka_sim_session_t);
 	fr_pair_t		*vp;
 	fr_aka_sim_vector_src_t	src = AKA_SIM_VECTOR_SRC_AUTO;
@@ -2413,7 +2414,7 @@ RESUME(send_aka_challenge_request)
 	 *	them using COMP128-* or Milenage.
 	 */
 	if (fr_aka_sim_vector_umts_from_attrs(request, &request->control_pairs,
-					      &eap_aka_sim_session->keys, &src) != 0) {
+					      &eap_aka_sim_session->keys, &src, &inst->vector_pool) != 0) {
 	    	REDEBUG("Failed retrieving UMTS vectors");
 		goto failure;
 	}
@@ -2661,6 +2662,7 @@ STATE(sim_challenge)
  */
 RESUME(send_sim_challenge_request)
 {
+	eap_aka_sim_process_conf_t	*inst = talloc_get_type_abort(mctx->inst->data, eap_aka_sim_process_conf_t);
 	eap_aka_sim_session_t	*eap_aka_sim_session = talloc_get_type_abort(mctx->rctx, eap_aka_sim_session_t);
 
 	fr_pair_t		*vp;
@@ -2686,11 +2688,11 @@ RESUME(send_sim_challenge_request)
 
 	RDEBUG2("Acquiring GSM vector(s)");
 	if ((fr_aka_sim_vector_gsm_from_attrs(request, &request->control_pairs, 0,
-					      &eap_aka_sim_session->keys, &src) != 0) ||
+					      &eap_aka_sim_session->keys, &src, &inst->vector_pool) != 0) ||
 	    (fr_aka_sim_vector_gsm_from_attrs(request, &request->control_pairs, 1,
-	    				      &eap_aka_sim_session->keys, &src) != 0) ||
+	    				      &eap_aka_sim_session->keys, &src, &inst->vector_pool) != 0) ||
 	    (fr_aka_sim_vector_gsm_from_attrs(request, &request->control_pairs, 2,
-	    				      &eap_aka_sim_session->keys, &src) != 0)) {
+	    				      &eap_aka_sim_session->keys, &src, &inst->vector_pool) != 0)) {
 	    	REDEBUG("Failed retrieving SIM vectors");
 		RETURN_MODULE_FAIL;
 	}
@@ -204,6 +204,9 @@ typedef struct {
 									///< EVP_sha1() for EAP-AKA, EVP_sha256()
 									///< for EAP-AKA'.
 
+	fr_aka_sim_vector_pool_conf_t	vector_pool;			//!< Pre-generation of vectors derived
+									///< from a Ki.
+
 	eap_aka_sim_actions_t		actions;			//!< Pre-compiled virtual server sections.
 } eap_aka_sim_process_conf_t;
 
@@ -34,6 +34,9 @@ RCSID("$Id$")
 #include <freeradius-devel/sim/comp128.h>
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.sim.h>
 #include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 
 #include "base.h"
 #include "attrs.h"
@@ -76,13 +79,331 @@ static int vector_opc_from_op(request_t *request, uint8_t const **out, uint8_t o
 	return 1;
 }
 
-static int vector_gsm_from_ki(request_t *request, fr_pair_list_t *vps, int idx, fr_aka_sim_keys_t *keys)
+#define VECTOR_POOL_BATCH_MAX	64
+
+CONF_PARSER const fr_aka_sim_vector_pool_config[] = {
+	{ FR_CONF_OFFSET("max_subscribers", FR_TYPE_UINT32, fr_aka_sim_vector_pool_conf_t, max_subscribers), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, fr_aka_sim_vector_pool_conf_t, batch_size), .dflt = "16" },
+
+	CONF_PARSER_TERMINATOR
+};
+
+/** Pre-generated vectors for one subscriber
+ *
+ * GSM vectors from COMP128-1/2/3 are stored as complete triplets.  Vectors
+ * from Milenage (including COMP128-4) are stored as the output of f2-f5,
+ * which only depends on Ki, OPc and RAND.  They're completed when they're
+ * used, so the SQN and AMF can change between authentications.
+ *
+ * Every vector is handed out once, then wiped.
+ *
+ * The first batch for a subscriber is a single vector, and each batch
+ * after that is twice the size of the last, up to the configured
+ * batch_size.  Subscribers which are only seen once cost no more than
+ * they would without the pool, and only subscribers which keep coming
+ * back get large batches.
+ */
+typedef struct {
+	uint8_t			key[sizeof(uint32_t) + MILENAGE_KI_SIZE + MILENAGE_OPC_SIZE];	//!< Algorithm, Ki and OPc.
+	fr_dlist_t		entry;				//!< Entry in the thread's LRU list.
+
+	fr_aka_sim_vector_gsm_t	*gsm;				//!< Pre-generated COMP128-1/2/3 triplets.
+	milenage_precomp_t	*milenage;			//!< Pre-generated Milenage f2-f5 output.
+	uint32_t		size;				//!< Size of the vector array.
+	uint32_t		num;				//!< Number of unused vectors.
+	uint32_t		batch;				//!< Size of the last batch generated.
+} vector_pool_entry_t;
+
+typedef struct {
+	fr_hash_table_t		*ht;				//!< Entries by key.
+	fr_dlist_head_t		lru;				//!< Most recently used at the head.
+} vector_pool_t;
+
+static _Thread_local vector_pool_t *vector_pool;
+
+static uint32_t vector_pool_entry_hash(void const *data)
+{
+	vector_pool_entry_t const *entry = data;
+
+	return fr_hash(entry->key, sizeof(entry->key));
+}
+
+static int8_t vector_pool_entry_cmp(void const *one, void const *two)
+{
+	vector_pool_entry_t const	*a = one, *b = two;
+	int				ret;
+
+	ret = memcmp(a->key, b->key, sizeof(a->key));
+	return CMP(ret, 0);
+}
+
+static int _vector_pool_entry_free(vector_pool_entry_t *entry)
+{
+	if (entry->gsm) memset(entry->gsm, 0, sizeof(*entry->gsm) * entry->size);
+	if (entry->milenage) memset(entry->milenage, 0, sizeof(*entry->milenage) * entry->size);
+	memset(entry->key, 0, sizeof(entry->key));
+
+	return 0;
+}
+
+static int _vector_pool_free(void *uctx)
+{
+	vector_pool_t *pool = talloc_get_type_abort(uctx, vector_pool_t);
+
+	vector_pool = NULL;
+
+	return talloc_free(pool);
+}
+
+/** Find the pre-generated vectors for a subscriber, creating an entry if needed
+ *
+ * @param[in] pool_conf	Pool configuration.
+ * @param[in] version	Algorithm the vectors are generated with.
+ * @param[in] ki	Subscriber key.
+ * @param[in] opc	Derived operator code, or NULL if the algorithm doesn't use one.
+ * @return The entry for the subscriber.  The entry may be empty.
+ */
+static vector_pool_entry_t *vector_pool_entry(fr_aka_sim_vector_pool_conf_t const *pool_conf, uint32_t version,
+					      uint8_t const ki[MILENAGE_KI_SIZE], uint8_t const *opc)
+{
+	vector_pool_t		*pool = vector_pool;
+	vector_pool_entry_t	find = {}, *entry;
+
+	if (!pool) {
+		MEM(pool = talloc_zero(NULL, vector_pool_t));
+		MEM(pool->ht = fr_hash_table_alloc(pool, vector_pool_entry_hash, vector_pool_entry_cmp, NULL));
+		fr_dlist_talloc_init(&pool->lru, vector_pool_entry_t, entry);
+		fr_atexit_thread_local(vector_pool, _vector_pool_free, pool);
+	}
+
+	memcpy(find.key, &version, sizeof(version));
+	memcpy(find.key + sizeof(version), ki, MILENAGE_KI_SIZE);
+	if (opc) memcpy(find.key + sizeof(version) + MILENAGE_KI_SIZE, opc, MILENAGE_OPC_SIZE);
+
+	entry = fr_hash_table_find(pool->ht, &find);
+	memset(find.key, 0, sizeof(find.key));
+	if (entry) {
+		fr_dlist_remove(&pool->lru, entry);
+		fr_dlist_insert_head(&pool->lru, entry);
+		return entry;
+	}
+
+	/*
+	 *	Make room by discarding the vectors of the
+	 *	subscriber we've seen least recently.
+	 */
+	while (fr_dlist_num_elements(&pool->lru) >= pool_conf->max_subscribers) {
+		vector_pool_entry_t *old = fr_dlist_tail(&pool->lru);
+
+		fr_dlist_remove(&pool->lru, old);
+		fr_hash_table_delete(pool->ht, old);
+		talloc_free(old);
+	}
+
+	MEM(entry = talloc_zero(pool, vector_pool_entry_t));
+	talloc_set_destructor(entry, _vector_pool_entry_free);
+	memcpy(entry->key, &version, sizeof(version));
+	memcpy(entry->key + sizeof(version), ki, MILENAGE_KI_SIZE);
+	if (opc) memcpy(entry->key + sizeof(version) + MILENAGE_KI_SIZE, opc, MILENAGE_OPC_SIZE);
+
+	if (!fr_hash_table_insert(pool->ht, entry)) {
+		talloc_free(entry);
+		return NULL;
+	}
+	fr_dlist_insert_head(&pool->lru, entry);
+
+	return entry;
+}
+
+/** Generate a random challenge for a pre-generated vector
+ *
+ */
+static inline void vector_pool_rand(uint8_t rand[MILENAGE_RAND_SIZE])
+{
+	unsigned int i;
+
+	for (i = 0; i < MILENAGE_RAND_SIZE; i += sizeof(uint32_t)) {
+		uint32_t r = fr_rand();
+		memcpy(&rand[i], &r, sizeof(r));
+	}
+}
+
+/** Return the size of the next batch for a pool entry
+ *
+ * Doubles the size of the last batch, up to the configured batch_size.
+ */
+static uint32_t vector_pool_batch_next(vector_pool_entry_t *entry, fr_aka_sim_vector_pool_conf_t const *pool_conf)
+{
+	uint32_t max = pool_conf->batch_size;
+
+	if (max < 1) max = 1;
+	if (max > VECTOR_POOL_BATCH_MAX) max = VECTOR_POOL_BATCH_MAX;
+
+	entry->batch = entry->batch ? (entry->batch * 2) : 1;
+	if (entry->batch > max) entry->batch = max;
+
+	return entry->batch;
+}
+
+/** Generate a batch of Milenage f2-f5 outputs for a pool entry
+ *
+ */
+static int vector_pool_milenage_refill(request_t *request, vector_pool_entry_t *entry,
+				       fr_aka_sim_vector_pool_conf_t const *pool_conf,
+				       uint8_t const opc[MILENAGE_OPC_SIZE], uint8_t const ki[MILENAGE_KI_SIZE])
+{
+	uint32_t batch, i;
+
+	batch = vector_pool_batch_next(entry, pool_conf);
+
+	/*
+	 *	All the old vectors have been used, and
+	 *	wiped, so there's nothing to copy.
+	 */
+	if (entry->size < batch) {
+		talloc_free(entry->milenage);
+		MEM(entry->milenage = talloc_zero_array(entry, milenage_precomp_t, batch));
+		entry->size = batch;
+	}
+
+	for (i = 0; i < batch; i++) vector_pool_rand(entry->milenage[i].rand);
+
+	if (milenage_f2345_batch(entry->milenage, batch, opc, ki) < 0) {
+		RPEDEBUG2("Failed pre-generating Milenage vectors");
+		return -1;
+	}
+	entry->num = batch;
+
+	RDEBUG3("Pre-generated %u Milenage vectors", entry->num);
+
+	return 0;
+}
+
+/** Get a GSM triplet from the calling thread's pool, generating a new batch if needed
+ *
+ * @param[in] request		The current request.
+ * @param[out] out		Where to write the triplet.
+ * @param[in] pool_conf		Pool configuration.
+ * @param[in] version		Algorithm to use.
+ * @param[in] ki		Subscriber key.
+ * @param[in] opc		Derived operator code.  Only used for COMP128-4.
+ * @return
+ *	- 1 the pool is disabled, or can't provide vectors for this algorithm.
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int vector_pool_gsm(request_t *request, fr_aka_sim_vector_gsm_t *out,
+			   fr_aka_sim_vector_pool_conf_t const *pool_conf, uint32_t version,
+			   uint8_t const ki[MILENAGE_KI_SIZE], uint8_t const *opc)
+{
+	vector_pool_entry_t	*entry;
+	uint32_t		batch, i;
+
+	if (!pool_conf || !pool_conf->max_subscribers) return 1;
+
+	switch (version) {
+	case FR_SIM_ALGO_VERSION_VALUE_COMP128_1:
+	case FR_SIM_ALGO_VERSION_VALUE_COMP128_2:
+	case FR_SIM_ALGO_VERSION_VALUE_COMP128_3:
+	case FR_SIM_ALGO_VERSION_VALUE_COMP128_4:
+		break;
+
+	default:
+		return 1;
+	}
+
+	entry = vector_pool_entry(pool_conf, version, ki, opc);
+	if (!entry) return 1;
+
+	if (version == FR_SIM_ALGO_VERSION_VALUE_COMP128_4) {
+		milenage_precomp_t *vec;
+
+		if ((entry->num == 0) && (vector_pool_milenage_refill(request, entry, pool_conf, opc, ki) < 0)) return -1;
+
+		vec = &entry->milenage[--entry->num];
+		memcpy(out->rand, vec->rand, sizeof(out->rand));
+		milenage_gsm_from_umts(out->sres, out->kc, vec->ik, vec->ck, vec->res);
+		memset(vec, 0, sizeof(*vec));
+
+		return 0;
+	}
+
+	/*
+	 *	COMP128 is table driven and has no AES
+	 *	to pipeline, but generating the batch
+	 *	here still moves the work ahead of the
+	 *	authentications which use it.
+	 */
+	if (entry->num == 0) {
+		batch = vector_pool_batch_next(entry, pool_conf);
+		if (entry->size < batch) {
+			talloc_free(entry->gsm);
+			MEM(entry->gsm = talloc_zero_array(entry, fr_aka_sim_vector_gsm_t, batch));
+			entry->size = batch;
+		}
+
+		for (i = 0; i < batch; i++) {
+			fr_aka_sim_vector_gsm_t *vec = &entry->gsm[i];
+
+			vector_pool_rand(vec->rand);
+			if (version == FR_SIM_ALGO_VERSION_VALUE_COMP128_1) {
+				comp128v1(vec->sres, vec->kc, ki, vec->rand);
+			} else {
+				comp128v23(vec->sres, vec->kc, ki, vec->rand,
+					   (version == FR_SIM_ALGO_VERSION_VALUE_COMP128_2));
+			}
+		}
+		entry->num = batch;
+
+		RDEBUG3("Pre-generated %u GSM triplets", entry->num);
+	}
+
+	memcpy(out, &entry->gsm[--entry->num], sizeof(*out));
+	memset(&entry->gsm[entry->num], 0, sizeof(*out));
+
+	return 0;
+}
+
+/** Get Milenage f2-f5 output from the calling thread's pool, generating a new batch if needed
+ *
+ * @param[in] request		The current request.
+ * @param[out] out		Where to write the precomputed vector.
+ * @param[in] pool_conf		Pool configuration.
+ * @param[in] ki		Subscriber key.
+ * @param[in] opc		Derived operator code.
+ * @return
+ *	- 1 the pool is disabled.
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int vector_pool_milenage(request_t *request, milenage_precomp_t *out,
+				fr_aka_sim_vector_pool_conf_t const *pool_conf,
+				uint8_t const ki[MILENAGE_KI_SIZE], uint8_t const opc[MILENAGE_OPC_SIZE])
+{
+	vector_pool_entry_t	*entry;
+
+	if (!pool_conf || !pool_conf->max_subscribers) return 1;
+
+	entry = vector_pool_entry(pool_conf, FR_SIM_ALGO_VERSION_VALUE_MILENAGE, ki, opc);
+	if (!entry) return 1;
+
+	if ((entry->num == 0) && (vector_pool_milenage_refill(request, entry, pool_conf, opc, ki) < 0)) return -1;
+
+	memcpy(out, &entry->milenage[--entry->num], sizeof(*out));
+	memset(&entry->milenage[entry->num], 0, sizeof(*out));
+
+	return 0;
+}
+
+static int vector_gsm_from_ki(request_t *request, fr_pair_list_t *vps, int idx, fr_aka_sim_keys_t *keys,
+			      fr_aka_sim_vector_pool_conf_t const *pool_conf)
 {
 	fr_pair_t	*ki_vp, *version_vp;
 	uint8_t		opc_buff[MILENAGE_OPC_SIZE];
 	uint8_t	const	*opc_p = NULL;
 	uint32_t	version;
 	unsigned int	i;
+	int		ret;
 
 	/*
 	 *	Generate a new RAND value, and derive Kc and SRES from Ki
@@ -121,6 +442,16 @@ static int vector_gsm_from_ki(request_t *request, fr_pair_list_t *vps, int idx,
 		}
 	}
 
+	/*
+	 *	Use a pre-generated triplet if the pool is enabled
+	 */
+	ret = vector_pool_gsm(request, &keys->gsm.vector[idx], pool_conf, version, ki_vp->vp_octets, opc_p);
+	if (ret < 0) {
+		RPEDEBUG2("Failed deriving GSM triplet");
+		return -1;
+	}
+	if (ret == 0) goto done;
+
 	for (i = 0; i < AKA_SIM_VECTOR_GSM_RAND_SIZE; i += sizeof(uint32_t)) {
 		uint32_t rand = fr_rand();
 		memcpy(&keys->gsm.vector[idx].rand[i], &rand, sizeof(rand));
@@ -164,6 +495,7 @@ static int vector_gsm_from_ki(request_t *request, fr_pair_list_t *vps, int idx,
 		return -1;
 	}
 
+done:
 	/*
 	 *	Store for completeness...
 	 */
@@ -322,13 +654,16 @@ static int vector_gsm_from_quintuplets(request_t *request, fr_pair_list_t *vps,
  * @param[in] src		Forces triplets to be retrieved from a particular src
  *				and ensures if multiple triplets are being retrieved
  *				that they all come from the same src.
+ * @param[in] pool_conf		Pool of pre-generated vectors to use when generating
+ *				triplets from a Ki.  May be NULL.
  * @return
  *	- 1	Vector could not be retrieved from the specified src.
  *	- 0	Vector was retrieved OK and written to the specified index.
  *	- -1	Error retrieving vector from the specified src.
  */
 int fr_aka_sim_vector_gsm_from_attrs(request_t *request, fr_pair_list_t *vps,
-				     int idx, fr_aka_sim_keys_t *keys, fr_aka_sim_vector_src_t *src)
+				     int idx, fr_aka_sim_keys_t *keys, fr_aka_sim_vector_src_t *src,
+				     fr_aka_sim_vector_pool_conf_t const *pool_conf)
 {
 	int		ret;
 
@@ -338,7 +673,7 @@ int fr_aka_sim_vector_gsm_from_attrs(request_t *request, fr_pair_list_t *vps,
 	switch (*src) {
 	default:
 	case AKA_SIM_VECTOR_SRC_KI:
-		ret = vector_gsm_from_ki(request, vps, idx, keys);
+		ret = vector_gsm_from_ki(request, vps, idx, keys, pool_conf);
 		if (ret == 0) {
 			*src = AKA_SIM_VECTOR_SRC_KI;
 			break;
@@ -393,7 +728,8 @@ int fr_aka_sim_vector_gsm_from_attrs(request_t *request, fr_pair_list_t *vps,
 	return 0;
 }
 
-static int vector_umts_from_ki(request_t *request, fr_pair_list_t *vps, fr_aka_sim_keys_t *keys)
+static int vector_umts_from_ki(request_t *request, fr_pair_list_t *vps, fr_aka_sim_keys_t *keys,
+			       fr_aka_sim_vector_pool_conf_t const *pool_conf)
 {
 	fr_pair_t	*ki_vp, *amf_vp, *sqn_vp, *version_vp;
 
@@ -482,6 +818,8 @@ static int vector_umts_from_ki(request_t *request, fr_pair_list_t *vps, fr_aka_s
 		uint8_t		sqn_buff[MILENAGE_SQN_SIZE];
 		uint8_t 	opc_buff[MILENAGE_OPC_SIZE];
 		uint8_t	const	*opc_p;
+		milenage_precomp_t	precomp;
+		int		ret;
 
 		if (vector_opc_from_op(request, &opc_p, opc_buff, vps, ki_vp->vp_octets) < 0) return -1;
 
@@ -503,16 +841,39 @@ static int vector_umts_from_ki(request_t *request, fr_pair_list_t *vps, fr_aka_s
 				 "AMF          :");
 		REXDENT();
 
-		if (milenage_umts_generate(keys->umts.vector.autn,
-					   keys->umts.vector.ik,
-					   keys->umts.vector.ck,
-					   keys->umts.vector.ak,
-					   keys->umts.vector.xres,
-					   opc_p,
-					   amf_buff,
-					   ki_vp->vp_octets,
-					   keys->sqn,
-					   keys->umts.vector.rand) < 0) {
+		/*
+		 *	Use pre-generated f2-f5 output if the pool
+		 *	is enabled, only f1 depends on SQN and AMF.
+		 */
+		ret = vector_pool_milenage(request, &precomp, pool_conf, ki_vp->vp_octets, opc_p);
+		if (ret < 0) {
+			RPEDEBUG2("Failed deriving UMTS Quintuplet");
+			return -1;
+		}
+		if (ret == 0) {
+			memcpy(keys->umts.vector.rand, precomp.rand, sizeof(keys->umts.vector.rand));
+			memcpy(keys->umts.vector.ik, precomp.ik, sizeof(keys->umts.vector.ik));
+			memcpy(keys->umts.vector.ck, precomp.ck, sizeof(keys->umts.vector.ck));
+			memcpy(keys->umts.vector.ak, precomp.ak, sizeof(keys->umts.vector.ak));
+			memcpy(keys->umts.vector.xres, precomp.res, sizeof(precomp.res));
+
+			ret = milenage_umts_from_precomp(keys->umts.vector.autn, &precomp,
+							 opc_p, amf_buff, ki_vp->vp_octets, keys->sqn);
+			memset(&precomp, 0, sizeof(precomp));
+			if (ret < 0) {
+				RPEDEBUG2("Failed deriving UMTS Quintuplet");
+				return -1;
+			}
+		} else if (milenage_umts_generate(keys->umts.vector.autn,
+						  keys->umts.vector.ik,
+						  keys->umts.vector.ck,
+						  keys->umts.vector.ak,
+						  keys->umts.vector.xres,
+						  opc_p,
+						  amf_buff,
+						  ki_vp->vp_octets,
+						  keys->sqn,
+						  keys->umts.vector.rand) < 0) {
 			RPEDEBUG2("Failed deriving UMTS Quintuplet");
 			return -1;
 		}
@@ -746,6 +1107,8 @@ static int vector_umts_from_quintuplets(request_t *request, fr_pair_list_t *vps,
  * @param vps			List to hunt for triplets in.
  * @param keys			UMTS keys.
  * @param src			Forces quintuplets to be retrieved from a particular src.
+ * @param pool_conf		Pool of pre-generated vectors to use when generating
+ *				quintuplets from a Ki.  May be NULL.
  *
  * @return
  *	- 1	Vector could not be retrieved from the specified src.
@@ -753,7 +1116,8 @@ static int vector_umts_from_quintuplets(request_t *request, fr_pair_list_t *vps,
  *	- -1	Error retrieving vector from the specified src.
  */
 int fr_aka_sim_vector_umts_from_attrs(request_t *request, fr_pair_list_t *vps,
-				      fr_aka_sim_keys_t *keys, fr_aka_sim_vector_src_t *src)
+				      fr_aka_sim_keys_t *keys, fr_aka_sim_vector_src_t *src,
+				      fr_aka_sim_vector_pool_conf_t const *pool_conf)
 {
 	int		ret;
 
@@ -762,7 +1126,7 @@ int fr_aka_sim_vector_umts_from_attrs(request_t *request, fr_pair_list_t *vps,
 	switch (*src) {
 	default:
 	case AKA_SIM_VECTOR_SRC_KI:
-		ret = vector_umts_from_ki(request, vps, keys);
+		ret = vector_umts_from_ki(request, vps, keys, pool_conf);
 		if (ret == 0) {
 			*src = AKA_SIM_VECTOR_SRC_KI;
 			break;
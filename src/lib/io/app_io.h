@@ -39,6 +39,8 @@ typedef struct {
 	size_t				default_message_size;	//!< Usually maximum message size
 	size_t				default_reply_size;	//!< same for replies
 	bool				track_duplicates;	//!< track duplicate packets
+	bool				any_network;		//!< Listeners may be placed in any network
+								//!< thread, not just the first one.
 
 	fr_io_open_t			open;		//!< Open a new socket for listening, or accept/connect a new
 							//!< connection.
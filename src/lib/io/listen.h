@@ -41,6 +41,7 @@ struct fr_listen {
 
 	bool			connected;		//!< is this for a connected socket?
 	bool			track_duplicates;	//!< do we track duplicate packets?
+	bool			any_network;		//!< may be placed in any network thread.
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
 };
@@ -62,17 +62,28 @@ typedef enum {
 	FR_LOAD_STATE_DRAINING,
 } fr_load_state_t;
 
+/*
+ *	Don't run the timer more than this many times a second.  At
+ *	higher rates, we send more packets each time it fires.
+ */
+#define LOAD_MAX_TICKS (10000)
+
 struct fr_load_s {
 	fr_load_state_t		state;
 	fr_event_list_t		*el;
 	fr_load_config_t const *config;
 	fr_load_callback_t	callback;
+	fr_load_step_callback_t	step_callback;		//!< decides the rate for the next step
 	void			*uctx;
 
 	fr_load_stats_t		stats;			//!< sending statistics
 	fr_time_t		step_start;		//!< when the current step started
 	fr_time_t		step_end;		//!< when the current step will end
 	int			step_received;
+	int			step_sent;
+	uint64_t		step_skipped;
+	unsigned int		step_number;
+	fr_histogram_t		*hist;			//!< response times for the current step
 
 	uint32_t		pps;
 	fr_time_delta_t		delta;			//!< between packets
@@ -96,6 +107,15 @@ fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_loa
 	if (!config->milliseconds) config->milliseconds = 1000;
 	if (!config->parallel) config->parallel = 1;
 
+	/*
+	 *	1us to 1 minute, to 3 significant figures.
+	 */
+	l->hist = fr_histogram_alloc(l, 1000, (uint64_t) 60 * NSEC, 3);
+	if (!l->hist) {
+		talloc_free(l);
+		return NULL;
+	}
+
 	l->el = el;
 	l->config = config;
 	l->callback = callback;
@@ -104,6 +124,74 @@ fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_loa
 	return l;
 }
 
+/** Set the callback which decides the rate for each step
+ *
+ * Without a step callback, the rate is increased by "step" until it
+ * reaches "max_pps".
+ */
+void fr_load_generator_step_callback_set(fr_load_t *l, fr_load_step_callback_t step_callback)
+{
+	l->step_callback = step_callback;
+}
+
+/** Change the packet rate.
+ *
+ */
+static void load_rate_set(fr_load_t *l, uint32_t pps)
+{
+	l->pps = pps;
+	l->stats.pps = pps;
+
+	/*
+	 *	Send "parallel" packets each time the timer fires,
+	 *	unless that would mean running the timer too often.
+	 */
+	l->count = l->config->parallel;
+	if (l->count < (pps / LOAD_MAX_TICKS)) l->count = pps / LOAD_MAX_TICKS;
+
+	l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->count), fr_time_delta_wrap(l->pps));
+}
+
+/** Decide the rate for the next step.
+ *
+ * @return
+ *	- true if "pps" has been set.  0 means "stop".
+ *	- false if we should keep sending at the current rate, and ask again later.
+ */
+static bool load_step_next(fr_load_t *l, uint32_t *pps)
+{
+	fr_load_step_t	step;
+	int		rcode;
+
+	if (!l->step_callback) {
+		*pps = l->pps + l->config->step;
+
+		/*
+		 *	Stop at max PPS, if it's set.  Otherwise
+		 *	continue without limit.
+		 */
+		if (l->config->max_pps && (*pps > l->config->max_pps)) *pps = 0;
+		return true;
+	}
+
+	step = (fr_load_step_t) {
+		.number = l->step_number,
+		.pps = l->pps,
+		.start = l->step_start,
+		.end = l->step_end,
+		.sent = l->stats.sent - l->step_sent,
+		.received = l->stats.received - l->step_received,
+		.skipped = l->step_skipped,
+		.hist = l->hist,
+	};
+
+	rcode = l->step_callback(&step, pps, l->uctx);
+	if (rcode == 0) return false;
+	if (rcode < 0) *pps = 0;
+
+	return true;
+}
+
 /** Send one or more packets.
  *
  */
@@ -131,6 +219,7 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	fr_load_t *l = uctx;
 	fr_time_delta_t delta;
 	int count;
+	uint64_t limit;
 
 	/*
 	 *	Keep track of the overall maximum backlog for the
@@ -143,24 +232,33 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	 *	If we're done this step, go to the next one.
 	 */
 	if (fr_time_gteq(l->next, l->step_end)) {
-		l->step_start = l->next;
-		l->step_end = fr_time_add(l->next, l->config->duration);
-		l->step_received = l->stats.received;
-		l->pps += l->config->step;
-		l->stats.pps = l->pps;
-		l->stats.skipped = 0;
-		l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->config->parallel), fr_time_delta_wrap(l->pps));
+		uint32_t pps;
 
 		/*
-		 *	Stop at max PPS, if it's set.  Otherwise
-		 *	continue without limit.
+		 *	If the next rate hasn't been decided yet,
+		 *	keep sending at the current rate.
 		 */
-		if (l->config->max_pps && (l->pps > l->config->max_pps)) {
+		if (!load_step_next(l, &pps)) goto send;
+
+		if (!pps) {
 			l->state = FR_LOAD_STATE_DRAINING;
 			return;
 		}
+
+		l->step_start = l->next;
+		l->step_end = fr_time_add(l->next, l->config->duration);
+		l->step_received = l->stats.received;
+		l->step_sent = l->stats.sent;
+		l->step_skipped = 0;
+		l->step_number++;
+		l->stats.skipped = 0;
+		fr_histogram_reset(l->hist);
+
+		load_rate_set(l, pps);
 	}
 
+send:
+
 	/*
 	 *	We don't have "pps" packets in the backlog, go send
 	 *	some more.  We scale the backlog by 1000 milliseconds
@@ -171,18 +269,22 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 	 *	milliseconds of backlog, then keep sending.
 	 *	Otherwise, switch to a gated mode where we only send
 	 *	new packets once a reply comes in.
+	 *
+	 *	At high rates pps * milliseconds doesn't fit in 32
+	 *	bits, so all of the arithmetic is done in 64 bits.
 	 */
-	if (((uint32_t) l->stats.backlog * 1000) < (l->pps * l->config->milliseconds)) {
+	limit = (uint64_t) l->pps * l->config->milliseconds;
+	if (((uint64_t) l->stats.backlog * 1000) < limit) {
 		l->state = FR_LOAD_STATE_SENDING;
 		l->stats.blocked = false;
-		count = l->config->parallel;
+		count = l->count;
 		l->stats.skipped = 0;
 
 		/*
 		 *	Limit "count" so that it doesn't over-run backlog.
 		 */
-		if (((uint32_t) ((count + l->stats.backlog) * 1000)) > (l->pps * l->config->milliseconds)) {
-			count = (count + l->stats.backlog) - ((l->pps * l->config->milliseconds) / 1000);
+		if ((((uint64_t) count + l->stats.backlog) * 1000) > limit) {
+			count = (limit / 1000) - l->stats.backlog;
 		}
 
 	} else {
@@ -198,6 +300,7 @@ static void load_timer(fr_event_list_t *el, fr_time_t now, void *uctx)
 		l->stats.blocked = true;
 		count = 0;
 		l->stats.skipped += l->count;
+		l->step_skipped += l->count;
 	}
 
 	/*
@@ -233,11 +336,13 @@ int fr_load_generator_start(fr_load_t *l)
 	l->step_start = l->stats.start;
 	l->step_end = fr_time_add(l->step_start, l->config->duration);
 
-	l->pps = l->config->start_pps;
-	l->stats.pps = l->pps;
-	l->count = l->config->parallel;
+	l->step_received = l->stats.received;
+	l->step_sent = l->stats.sent;
+	l->step_skipped = 0;
+	l->step_number = 1;
+	fr_histogram_reset(l->hist);
 
-	l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->config->parallel), fr_time_delta_wrap(l->pps));
+	load_rate_set(l, l->config->start_pps);
 	l->next = fr_time_add(l->step_start, l->delta);
 
 	load_timer(l->el, l->step_start, l);
@@ -277,6 +382,7 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 	l->stats.rtt = RTT(l->stats.rtt, t);
 
 	l->stats.received++;
+	fr_histogram_record(l->hist, fr_time_delta_unwrap(t));
 
 	/*
 	 *	t is in nanoseconds.
@@ -388,3 +494,82 @@ fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l)
 {
 	return &l->stats;
 }
+
+static double load_percentile(fr_load_config_t const *config)
+{
+	return (config->percentile > 0) ? config->percentile : 99;
+}
+
+/** Check whether a step met the latency SLO.
+ *
+ *  A step fails if the backlog filled up, if replies were lost, or
+ *  if the response time at "percentile" is above "latency_slo".
+ */
+bool fr_load_step_ok(fr_load_config_t const *config, fr_load_step_t const *step)
+{
+	if (!step->received || step->skipped) return false;
+
+	/*
+	 *	Replies to packets sent at the end of one step will
+	 *	arrive in the next one, so allow for some slop.
+	 */
+	if ((step->received * 100) < (step->sent * 99)) return false;
+
+	if (!fr_time_delta_ispos(config->latency_slo)) return true;
+
+	return fr_histogram_percentile(step->hist, load_percentile(config)) <=
+		(uint64_t) fr_time_delta_unwrap(config->latency_slo);
+}
+
+/** Decide the rate for the next step of a search
+ *
+ * @param[in] s		search state, initialised to zero.
+ * @param[in] config	load configuration.  "start_pps" is the first rate
+ *			tested, and the search ramps up by "step" until a
+ *			step fails.
+ * @param[in] step	results of the step which just ended.
+ * @return
+ *	- The rate for the next step.
+ *	- 0 if the search has finished.  "s->good" is then the
+ *	  highest rate which met the SLO.
+ */
+uint32_t fr_load_search_next(fr_load_search_t *s, fr_load_config_t const *config, fr_load_step_t const *step)
+{
+	uint32_t resolution = config->resolution ? config->resolution : 1;
+	uint32_t next;
+
+	if (s->done) return 0;
+
+	if (fr_load_step_ok(config, step)) {
+		if (step->pps > s->good) {
+			s->good = step->pps;
+			s->good_latency = fr_histogram_percentile(step->hist, load_percentile(config));
+		}
+
+	} else if (!s->bad || (step->pps < s->bad)) {
+		s->bad = step->pps;
+	}
+
+	/*
+	 *	Nothing has failed yet, keep ramping up.
+	 */
+	if (!s->bad) {
+		if (config->max_pps && (s->good >= config->max_pps)) goto done;
+
+		next = step->pps + config->step;
+		if (config->max_pps && (next > config->max_pps)) next = config->max_pps;
+		return next;
+	}
+
+	/*
+	 *	Binary search between the highest rate which met the
+	 *	SLO, and the lowest one which didn't.
+	 */
+	if (s->bad <= (s->good + resolution)) goto done;
+
+	return s->good + ((s->bad - s->good) / 2);
+
+done:
+	s->done = true;
+	return 0;
+}
@@ -26,6 +26,7 @@
 RCSIDH(load_h, "$Id$")
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
 #include <freeradius-devel/util/talloc.h>
 
 /** Load generation configuration.
@@ -68,6 +69,10 @@ RCSIDH(load_h, "$Id$")
  *  "duration" seconds, even if the maximum backlog is currently
  *  reached.  This increase has the effect of also increasing the
  *  maximum backlog.
+ *
+ *  If "latency_slo" is set, the application can instead search for
+ *  the highest rate where the "percentile" response time is below
+ *  the SLO.  See fr_load_search_next().
  */
 typedef struct {
 	uint32_t       	start_pps;	//!< start PPS
@@ -76,6 +81,10 @@ typedef struct {
 	uint32_t	step;		//!< how much to increase each load test by
 	uint32_t	parallel;	//!< how many packets in parallel to send
 	uint32_t	milliseconds;	//!< how many milliseconds of backlog to top out at
+
+	fr_time_delta_t	latency_slo;	//!< maximum response time at "percentile", 0 for "step only".
+	double		percentile;	//!< which response time to compare with the SLO, e.g. 99.
+	uint32_t	resolution;	//!< stop searching when we know the maximum rate to within this many PPS.
 } fr_load_config_t;
 
 typedef struct {
@@ -97,6 +106,33 @@ typedef struct {
 
 typedef struct fr_load_s fr_load_t;
 
+/** Statistics for one step of the load test
+ *
+ */
+typedef struct {
+	unsigned int	number;		//!< step number, starting at 1
+	uint32_t	pps;		//!< offered packets/s
+	fr_time_t	start;		//!< when the step started
+	fr_time_t	end;		//!< when the step ended
+	uint64_t	sent;		//!< packets sent during the step
+	uint64_t	received;	//!< replies received during the step
+	uint64_t	skipped;	//!< packets we didn't send because the backlog was full
+	fr_histogram_t	*hist;		//!< response times of the replies received during the step
+} fr_load_step_t;
+
+/** State for finding the highest rate which meets the latency SLO
+ *
+ *  The search ramps up by "step" until a step fails the SLO, and then
+ *  does a binary search between the last good rate and the first bad
+ *  one.
+ */
+typedef struct {
+	uint32_t	good;		//!< highest rate which met the SLO, 0 for none.
+	uint64_t	good_latency;	//!< response time at "percentile" for the "good" rate.
+	uint32_t	bad;		//!< lowest rate which failed the SLO, 0 for none.
+	bool		done;		//!< whether the search has finished
+} fr_load_search_t;
+
 /** Whether or not the application should continue.
  *
  */
@@ -108,9 +144,27 @@ typedef enum {
 
 typedef int (*fr_load_callback_t)(fr_time_t now, void *uctx);
 
+/** Called when a step ends, to decide the rate for the next step
+ *
+ * The callback is called on every timer tick until it returns a
+ * decision.  Until then, the generator keeps sending at the current
+ * rate.
+ *
+ * @param[in] step	statistics for the step which just ended.
+ * @param[out] pps	rate for the next step, 0 to stop.
+ * @param[in] uctx	as passed to fr_load_generator_create().
+ * @return
+ *	- 1 if "pps" has been set.
+ *	- 0 if the decision hasn't been made yet.
+ *	- <0 on error, which stops the generator.
+ */
+typedef int (*fr_load_step_callback_t)(fr_load_step_t const *step, uint32_t *pps, void *uctx);
+
 fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_load_config_t *config,
 				    fr_load_callback_t callback, void *uctx) CC_HINT(nonnull(2,3,4));
 
+void fr_load_generator_step_callback_set(fr_load_t *l, fr_load_step_callback_t step_callback) CC_HINT(nonnull(1));
+
 int fr_load_generator_start(fr_load_t *l) CC_HINT(nonnull);
 
 int fr_load_generator_stop(fr_load_t *l) CC_HINT(nonnull);
@@ -120,3 +174,8 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen);
 
 fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l) CC_HINT(nonnull);
+
+bool fr_load_step_ok(fr_load_config_t const *config, fr_load_step_t const *step) CC_HINT(nonnull);
+
+uint32_t fr_load_search_next(fr_load_search_t *s, fr_load_config_t const *config,
+			     fr_load_step_t const *step) CC_HINT(nonnull);
@@ -0,0 +1,222 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the load generator's search for the maximum rate
+ *
+ * @file src/lib/io/load_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "load.h"
+
+/*
+ *	1us to 1 minute, in nanoseconds.
+ */
+#define HIST_LOWEST	1000
+#define HIST_HIGHEST	((uint64_t)60 * NSEC)
+
+/** Fill in the results of a step
+ *
+ * @param[out] step	to fill in.
+ * @param[in] pps	rate the step was run at.
+ * @param[in] received	percentage of the packets sent which had replies.
+ * @param[in] latency	of every reply, in nanoseconds.
+ */
+static void load_step_set(fr_load_step_t *step, uint32_t pps, unsigned int received, uint64_t latency)
+{
+	step->number++;
+	step->pps = pps;
+	step->sent = (uint64_t) pps * 10;
+	step->received = (step->sent * received) / 100;
+	step->skipped = 0;
+
+	fr_histogram_reset(step->hist);
+	if (step->received) fr_histogram_record_n(step->hist, latency, step->received);
+}
+
+/** Run a search against a server which can handle up to "capacity" packets/s
+ *
+ * Above capacity, the server either loses replies, or is slower than the SLO.
+ *
+ * @return the number of steps run.
+ */
+static unsigned int load_search_run(fr_load_search_t *s, fr_load_config_t const *config, uint32_t capacity, bool slow)
+{
+	fr_load_step_t	step = {};
+	uint32_t	pps = config->start_pps;
+
+	step.hist = fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 3);
+	TEST_ASSERT(step.hist != NULL);
+
+	while (pps) {
+		TEST_ASSERT(step.number < 1000);
+		if (config->max_pps) TEST_CHECK(pps <= config->max_pps);
+
+		if (pps <= capacity) {
+			load_step_set(&step, pps, 100, 100 * 1000);
+		} else if (slow) {
+			load_step_set(&step, pps, 100, 50 * 1000 * 1000);
+		} else {
+			load_step_set(&step, pps, 90, 100 * 1000);
+		}
+
+		pps = fr_load_search_next(s, config, &step);
+	}
+
+	talloc_free(step.hist);
+
+	return step.number;
+}
+
+static void test_load_step_ok(void)
+{
+	fr_load_config_t	config = { .latency_slo = fr_time_delta_from_msec(10), .percentile = 99 };
+	fr_load_step_t		step = {};
+
+	step.hist = fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 3);
+	TEST_ASSERT(step.hist != NULL);
+
+	TEST_CASE("All replies received, within the SLO");
+	load_step_set(&step, 1000, 100, 1000 * 1000);
+	TEST_CHECK(fr_load_step_ok(&config, &step));
+
+	TEST_CASE("A few replies for the end of the step arrive late");
+	load_step_set(&step, 1000, 99, 1000 * 1000);
+	TEST_CHECK(fr_load_step_ok(&config, &step));
+
+	TEST_CASE("Replies were lost");
+	load_step_set(&step, 1000, 90, 1000 * 1000);
+	TEST_CHECK(!fr_load_step_ok(&config, &step));
+
+	TEST_CASE("No replies at all");
+	load_step_set(&step, 1000, 0, 1000 * 1000);
+	TEST_CHECK(!fr_load_step_ok(&config, &step));
+
+	TEST_CASE("The backlog filled up");
+	load_step_set(&step, 1000, 100, 1000 * 1000);
+	step.skipped = 1;
+	TEST_CHECK(!fr_load_step_ok(&config, &step));
+
+	TEST_CASE("Slower than the SLO");
+	load_step_set(&step, 1000, 100, 20 * 1000 * 1000);
+	TEST_CHECK(!fr_load_step_ok(&config, &step));
+
+	TEST_CASE("Without an SLO, latency doesn't matter");
+	config.latency_slo = fr_time_delta_wrap(0);
+	TEST_CHECK(fr_load_step_ok(&config, &step));
+
+	talloc_free(step.hist);
+}
+
+static void test_load_search_lost(void)
+{
+	fr_load_config_t	config = { .start_pps = 1000, .step = 1000, .resolution = 10 };
+	fr_load_search_t	s = {};
+
+	load_search_run(&s, &config, 4321, false);
+
+	TEST_CHECK(s.done);
+	TEST_CHECK(s.good <= 4321);
+	TEST_MSG("Expected at most 4321, got %u", s.good);
+	TEST_CHECK(s.good + config.resolution >= 4321);
+	TEST_MSG("Expected at least %u, got %u", 4321 - config.resolution, s.good);
+	TEST_CHECK(s.bad > 4321);
+	TEST_CHECK(s.bad <= s.good + config.resolution);
+}
+
+static void test_load_search_slo(void)
+{
+	fr_load_config_t	config = { .start_pps = 1000, .step = 5000, .resolution = 100,
+					   .latency_slo = fr_time_delta_from_msec(10), .percentile = 99 };
+	fr_load_search_t	s = {};
+
+	load_search_run(&s, &config, 27000, true);
+
+	TEST_CHECK(s.done);
+	TEST_CHECK(s.good <= 27000);
+	TEST_CHECK(s.good + config.resolution >= 27000);
+	TEST_MSG("Expected about 27000, got %u", s.good);
+
+	TEST_CASE("The latency at the best rate is recorded");
+	TEST_CHECK(s.good_latency >= 99 * 1000);
+	TEST_CHECK(s.good_latency <= 101 * 1000);
+	TEST_MSG("Expected about 100us, got %" PRIu64 "ns", s.good_latency);
+}
+
+static void test_load_search_max_pps(void)
+{
+	fr_load_config_t	config = { .start_pps = 1000, .step = 3000, .max_pps = 8000, .resolution = 10 };
+	fr_load_search_t	s = {};
+
+	TEST_CASE("The search stops at max_pps, even if the server can do more");
+	load_search_run(&s, &config, 100000, false);
+
+	TEST_CHECK(s.done);
+	TEST_CHECK(s.good == 8000);
+	TEST_MSG("Expected 8000, got %u", s.good);
+	TEST_CHECK(s.bad == 0);
+}
+
+static void test_load_search_high_rate(void)
+{
+	fr_load_config_t	config = { .start_pps = 1000000, .step = 1000000, .max_pps = 10000000,
+					   .resolution = 1000 };
+	fr_load_search_t	s = {};
+
+	TEST_CASE("Rates of millions of packets/s don't overflow");
+	load_search_run(&s, &config, 7654321, false);
+
+	TEST_CHECK(s.done);
+	TEST_CHECK(s.good <= 7654321);
+	TEST_CHECK(s.good + config.resolution >= 7654321);
+	TEST_MSG("Expected about 7654321, got %u", s.good);
+}
+
+static void test_load_search_none(void)
+{
+	fr_load_config_t	config = { .start_pps = 1000, .step = 1000, .resolution = 50 };
+	fr_load_search_t	s = {};
+	fr_load_step_t		step = {};
+
+	TEST_CASE("If even the slowest rate fails, the search ends with no good rate");
+	load_search_run(&s, &config, 0, false);
+
+	TEST_CHECK(s.done);
+	TEST_CHECK(s.good == 0);
+	TEST_CHECK(s.bad <= config.resolution);
+
+	TEST_CASE("Once the search is done, it stays done");
+	step.hist = fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 3);
+	TEST_ASSERT(step.hist != NULL);
+	load_step_set(&step, 1000, 100, 100 * 1000);
+	TEST_CHECK(fr_load_search_next(&s, &config, &step) == 0);
+	talloc_free(step.hist);
+}
+
+TEST_LIST = {
+	{ "load_step_ok",		test_load_step_ok },
+	{ "load_search_lost",		test_load_search_lost },
+	{ "load_search_slo",		test_load_search_slo },
+	{ "load_search_max_pps",	test_load_search_max_pps },
+	{ "load_search_high_rate",	test_load_search_high_rate },
+	{ "load_search_none",		test_load_search_none },
+
+	{ NULL }
+};
@@ -0,0 +1,6 @@
+TARGET		:= load_tests$(E)
+SOURCES		:= load_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-io$(L)
@@ -130,25 +130,77 @@ struct fr_io_connection_s {
 	dl_module_inst_t   		*dl_inst;	//!< for submodule
 
 	bool				dead;		//!< roundabout way to get the network side to close a socket
-	bool				paused;		//!< event filter doesn't like resuming something that isn't paused
+	bool				paused;		//!< reading paused until the client is defined
+	bool				blocked;	//!< reading paused because of max_outstanding
+	uint32_t			outstanding;	//!< packets being processed which haven't been replied to
 	fr_event_list_t			*el;		//!< event list for this connection
 	fr_network_t			*nr;		//!< network for this connection
 };
 
-static fr_event_update_t pause_read[] = {
-	FR_EVENT_SUSPEND(fr_event_io_func_t, read),
-	{ 0 }
-};
+/** Count a packet against the connection's max_outstanding
+ *
+ * Once the limit is reached, we stop reading from the socket.  TCP
+ * flow control then pushes back on the client.  Packets which are
+ * already in the read buffer are still processed, so the limit may
+ * be exceeded by a few packets.
+ */
+static void connection_outstanding_add(fr_io_connection_t *connection, fr_io_track_t *track)
+{
+	fr_io_instance_t const *inst = connection->client->inst;
 
-static fr_event_update_t resume_read[] = {
-	FR_EVENT_RESUME(fr_event_io_func_t, read),
-	{ 0 }
-};
+	if (track->outstanding) return;
+
+	track->outstanding = true;
+	connection->outstanding++;
+
+	if (connection->blocked || (connection->outstanding < inst->max_outstanding)) return;
+
+	DEBUG2("proto_%s - connection %s has %u outstanding packets, pausing reads",
+	       inst->app_io->common.name, connection->name, connection->outstanding);
+
+	connection->blocked = true;
+	fr_network_listen_pause(connection->nr, connection->listen);
+}
+
+/** Remove a packet from the connection's outstanding count
+ *
+ * Resumes reading from the socket if we're now below the limit, unless
+ * the connection is being closed.
+ *
+ * @param[in] track	which has been replied to, or discarded.
+ */
+static void connection_outstanding_done(fr_io_track_t *track)
+{
+	fr_io_connection_t	*connection = track->client->connection;
+	fr_io_instance_t const	*inst = track->client->inst;
+
+	if (!track->outstanding) return;
+
+	track->outstanding = false;
+
+	fr_assert(connection != NULL);
+	fr_assert(connection->outstanding > 0);
+	connection->outstanding--;
+
+	if (!connection->blocked || connection->dead ||
+	    (connection->outstanding >= inst->max_outstanding)) return;
+
+	DEBUG2("proto_%s - connection %s has %u outstanding packets, resuming reads",
+	       inst->app_io->common.name, connection->name, connection->outstanding);
+
+	connection->blocked = false;
+	fr_network_listen_resume(connection->nr, connection->listen);
+}
 
 static int track_free(fr_io_track_t *track)
 {
 	if (track->ev) (void) fr_event_timer_delete(&track->ev);
 
+	/*
+	 *	The packet was dropped before it was processed.
+	 */
+	connection_outstanding_done(track);
+
 	talloc_free_children(track);
 
 	fr_assert(track->client->packets > 0);
@@ -1338,9 +1390,7 @@ do_read:
 			fr_assert(!connection->paused);
 
 			connection->paused = true;
-			(void) fr_event_filter_update(connection->el,
-						      child->fd,
-						      FR_EVENT_FILTER_IO, pause_read);
+			fr_network_listen_pause(connection->nr, connection->listen);
 		}
 	}
 
@@ -1673,6 +1723,17 @@ have_client:
 			client->ready_to_delete = false;
 		}
 
+		/*
+		 *	Limit the number of packets from this
+		 *	connection which are processed at the same
+		 *	time.  Replies are sent as soon as they're
+		 *	ready, so one slow request doesn't hold up
+		 *	the others.
+		 */
+		if (connection && inst->max_outstanding && (client->state == PR_CLIENT_CONNECTED)) {
+			connection_outstanding_add(connection, track);
+		}
+
 		/*
 		 *	Return the packet.
 		 */
@@ -2179,6 +2240,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 		ssize_t packet_len;
 
 		track->finished = true;
+		connection_outstanding_done(track);
 
 		/*
 		 *	The request later received a conflicting
@@ -2430,13 +2492,13 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, fr_time_t request_ti
 		 *	If we were paused. resume reading from the
 		 *	connection.
 		 *
-		 *	Note that the event list doesn't like resuming
-		 *	a connection that isn't paused.  It just sets
-		 *	the read function to NULL.
+		 *	The network counts the reasons for pausing a
+		 *	socket, so this doesn't undo a pause for
+		 *	max_outstanding, or for blocked workers.
 		 */
 		if (connection->paused) {
-			(void) fr_event_filter_update(el, child->fd,
-						      FR_EVENT_FILTER_IO, resume_read);
+			connection->paused = false;
+			fr_network_listen_resume(connection->nr, connection->listen);
 		}
 
 		goto finish;
@@ -2552,6 +2614,7 @@ static int mod_close(fr_listen_t *li)
 	 *	it.
 	 */
 	DEBUG("Closing connection %s", connection->name);
+	connection->dead = true;	/* don't resume reading when the tracking entries are freed */
 	if (connection->client->pending) {
 		TALLOC_FREE(connection->client->pending); /* for any pending packets */
 	}
@@ -2974,6 +3037,7 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->thread_instance = thread;
 	li->app_io_instance = inst;
 	li->track_duplicates = inst->app_io->track_duplicates;
+	li->any_network = inst->app_io->any_network;
 
 	/*
 	 *	The child listener points to the *actual* IO path.
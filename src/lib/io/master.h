@@ -49,6 +49,7 @@ typedef struct fr_io_track_s {
 	bool				discard;	//!< whether or not we discard the packet
 	bool				do_not_respond;	//!< don't respond
 	bool				finished;	//!< are we finished the request?
+	bool				outstanding;	//!< counted against the connection's max_outstanding
 
 	/*
 	 *	We can't set the "process" function here, because a
@@ -82,6 +83,8 @@ typedef struct {
 	uint32_t			max_connections;		//!< maximum number of connections to allow
 	uint32_t			max_clients;			//!< maximum number of dynamic clients to allow
 	uint32_t			max_pending_packets;		//!< maximum number of pending packets
+	uint32_t			max_outstanding;		//!< maximum number of packets being processed
+									///< for one connection.  0 for no limit.
 
 	fr_time_delta_t			cleanup_delay;			//!< for Access-Request packets
 	fr_time_delta_t			idle_timeout;			//!< for dynamic clients
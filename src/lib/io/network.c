@@ -82,6 +82,7 @@ typedef struct {
 
 	bool			dead;			//!< is it dead?
 	bool			blocked;		//!< is it blocked?
+	unsigned int		paused;			//!< number of reasons reading is paused
 
 	size_t			outstanding;		//!< number of outstanding packets sent to the worker
 	fr_listen_t		*listen;		//!< I/O ctx and functions.
@@ -405,12 +406,88 @@ int fr_network_listen_inject(fr_network_t *nr, fr_listen_t *li, uint8_t const *p
 	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_INJECT, &my_inject, sizeof(my_inject));
 }
 
+static fr_event_update_t const pause_read[] = {
+	FR_EVENT_SUSPEND(fr_event_io_func_t, read),
+	{ 0 }
+};
+
+static fr_event_update_t const resume_read[] = {
+	FR_EVENT_RESUME(fr_event_io_func_t, read),
+	{ 0 }
+};
+
+/** Stop reading from a socket
+ *
+ * Reads can be paused for more than one reason at the same time, e.g.
+ * all of the workers are blocked, and the listener has too many packets
+ * outstanding.  The event filter only remembers one suspended callback,
+ * so suspending twice would lose it.  Instead, we count the reasons, and
+ * only update the filter when the first one is added.
+ */
+static void fr_network_socket_pause(fr_network_socket_t *s)
+{
+	if (s->paused++ > 0) return;
+
+	(void) fr_event_filter_update(s->nr->el, s->listen->fd, FR_EVENT_FILTER_IO, pause_read);
+}
+
+/** Remove one reason for not reading from a socket
+ *
+ * Reading resumes when there are no reasons left.
+ */
+static void fr_network_socket_resume(fr_network_socket_t *s)
+{
+	fr_assert(s->paused > 0);
+	if (!s->paused || (--s->paused > 0)) return;
+
+	(void) fr_event_filter_update(s->nr->el, s->listen->fd, FR_EVENT_FILTER_IO, resume_read);
+}
+
+/** Pause reading from a listener
+ *
+ * Each call must be balanced by a call to fr_network_listen_resume().
+ * This function must be called from the network thread which owns the
+ * listener.
+ *
+ * @param nr	the network
+ * @param li	the listener to pause
+ */
+void fr_network_listen_pause(fr_network_t *nr, fr_listen_t *li)
+{
+	fr_network_socket_t *s;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+	(void) talloc_get_type_abort_const(li, fr_listen_t);
+
+	s = fr_rb_find(nr->sockets, &(fr_network_socket_t){ .listen = li });
+	if (!s) return;
+
+	fr_network_socket_pause(s);
+}
+
+/** Resume reading from a listener
+ *
+ * Reading only resumes once every fr_network_listen_pause() has been
+ * matched by a resume, and the network isn't suspended.
+ *
+ * @param nr	the network
+ * @param li	the listener to resume
+ */
+void fr_network_listen_resume(fr_network_t *nr, fr_listen_t *li)
+{
+	fr_network_socket_t *s;
+
+	(void) talloc_get_type_abort(nr, fr_network_t);
+	(void) talloc_get_type_abort_const(li, fr_listen_t);
+
+	s = fr_rb_find(nr->sockets, &(fr_network_socket_t){ .listen = li });
+	if (!s) return;
+
+	fr_network_socket_resume(s);
+}
+
 static void fr_network_suspend(fr_network_t *nr)
 {
-	static fr_event_update_t pause_read[] = {
-		FR_EVENT_SUSPEND(fr_event_io_func_t, read),
-		{ 0 }
-	};
 	fr_rb_iter_inorder_t	iter;
 	fr_network_socket_t		*socket;
 
@@ -419,17 +496,13 @@ static void fr_network_suspend(fr_network_t *nr)
 	for (socket = fr_rb_iter_init_inorder(&iter, nr->sockets);
 	     socket;
 	     socket = fr_rb_iter_next_inorder(&iter)) {
-		fr_event_filter_update(socket->nr->el, socket->listen->fd, FR_EVENT_FILTER_IO, pause_read);
+		fr_network_socket_pause(socket);
 	}
 	nr->suspended = true;
 }
 
 static void fr_network_unsuspend(fr_network_t *nr)
 {
-	static fr_event_update_t resume_read[] = {
-		FR_EVENT_RESUME(fr_event_io_func_t, read),
-		{ 0 }
-	};
 	fr_rb_iter_inorder_t	iter;
 	fr_network_socket_t		*socket;
 
@@ -438,7 +511,7 @@ static void fr_network_unsuspend(fr_network_t *nr)
 	for (socket = fr_rb_iter_init_inorder(&iter, nr->sockets);
 	     socket;
 	     socket = fr_rb_iter_next_inorder(&iter)) {
-		fr_event_filter_update(socket->nr->el, socket->listen->fd, FR_EVENT_FILTER_IO, resume_read);
+		fr_network_socket_resume(socket);
 	}
 	nr->suspended = false;
 }
@@ -1251,6 +1324,12 @@ static int fr_network_listen_add_self(fr_network_t *nr, fr_listen_t *listen)
 	 */
 	(void) fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, pause_write);
 
+	/*
+	 *	All of the workers are blocked.  Don't read from the
+	 *	new socket until fr_network_unsuspend() is called.
+	 */
+	if (nr->suspended) fr_network_socket_pause(s);
+
 	/*
 	 *	Add the listener before calling the app_io, so that
 	 *	the app_io can find the listener which we're adding
@@ -56,6 +56,10 @@ int		fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnul
 
 void		fr_network_listen_read(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
 
+void		fr_network_listen_pause(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
+
+void		fr_network_listen_resume(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
+
 void		fr_network_listen_write(fr_network_t *nr, fr_listen_t *li, uint8_t const *packet, size_t packet_len,
 					void *packet_ctx, fr_time_t request_time) CC_HINT(nonnull);
 
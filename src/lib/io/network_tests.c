@@ -0,0 +1,252 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for pausing and resuming reads on network sockets
+ *
+ * @file src/lib/io/network_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "network.c"
+
+#include <sys/socket.h>
+
+typedef struct {
+	fr_event_list_t		*el;
+	fr_network_t		*nr;
+	fr_listen_t		*li;
+	int			peer;		//!< other end of the listener's socket
+} test_ctx_t;
+
+static int	test_reads;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	if (fr_time_start() < 0) {
+		fr_perror("network_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+static int test_open(UNUSED fr_listen_t *li)
+{
+	return 0;
+}
+
+/** Drain the socket, and count the read
+ *
+ */
+static ssize_t test_read(fr_listen_t *li, UNUSED void **packet_ctx, UNUSED fr_time_t *recv_time,
+			 uint8_t *buffer, size_t buffer_len, UNUSED size_t *leftover,
+			 UNUSED uint32_t *priority, UNUSED bool *is_dup)
+{
+	while (recv(li->fd, buffer, buffer_len, MSG_DONTWAIT) > 0);
+
+	test_reads++;
+
+	return 0;
+}
+
+static int test_close(fr_listen_t *li)
+{
+	close(li->fd);
+
+	return 0;
+}
+
+static fr_app_io_t const test_app_io = {
+	.common = {
+		.name = "test"
+	},
+	.default_message_size = 4096,
+	.open = test_open,
+	.read = test_read,
+	.close = test_close
+};
+
+static fr_listen_t *test_listen_alloc(test_ctx_t *t)
+{
+	fr_listen_t	*li;
+	int		sv[2];
+
+	TEST_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	TEST_ASSERT(fr_nonblock(sv[0]) >= 0);
+
+	li = talloc_zero(t->el, fr_listen_t);
+	TEST_ASSERT(li != NULL);
+
+	li->fd = sv[0];
+	li->name = "test";
+	li->app_io = &test_app_io;
+	li->default_message_size = test_app_io.default_message_size;
+	li->num_messages = 8;
+
+	t->peer = sv[1];
+
+	return li;
+}
+
+static void test_setup(test_ctx_t *t, bool add)
+{
+	memset(t, 0, sizeof(*t));
+
+	t->el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_ASSERT(t->el != NULL);
+
+	t->nr = fr_network_create(t->el, t->el, "test", &default_log, L_DBG_LVL_OFF, NULL);
+	TEST_ASSERT(t->nr != NULL);
+
+	t->li = test_listen_alloc(t);
+	if (add) TEST_ASSERT(fr_network_listen_add_self(t->nr, t->li) == 0);
+}
+
+static void test_teardown(test_ctx_t *t)
+{
+	close(t->peer);
+	talloc_free(t->nr);
+	talloc_free(t->el);
+}
+
+/** Send a byte to the listener, and see if the network reads it
+ *
+ */
+static bool test_readable(test_ctx_t *t)
+{
+	int	before = test_reads;
+	int	i;
+
+	TEST_ASSERT(write(t->peer, "x", 1) == 1);
+
+	for (i = 0; i < 3; i++) {
+		if (fr_event_corral(t->el, fr_time(), false) > 0) fr_event_service(t->el);
+	}
+
+	return (test_reads > before);
+}
+
+/** Reads are only resumed once every pause has been undone
+ *
+ * This is what a TCP connection does when it reaches max_outstanding
+ * while the client is still pending.
+ */
+static void test_pause_nested(void)
+{
+	test_ctx_t	t;
+
+	test_setup(&t, true);
+
+	TEST_CHECK(test_readable(&t));
+
+	fr_network_listen_pause(t.nr, t.li);
+	TEST_CHECK(!test_readable(&t));
+
+	fr_network_listen_pause(t.nr, t.li);
+	TEST_CHECK(!test_readable(&t));
+
+	fr_network_listen_resume(t.nr, t.li);
+	TEST_CHECK(!test_readable(&t));
+	TEST_MSG("Reading resumed with one pause outstanding");
+
+	fr_network_listen_resume(t.nr, t.li);
+	TEST_CHECK(test_readable(&t));
+	TEST_MSG("Reading didn't resume, the read callback was lost");
+
+	test_teardown(&t);
+}
+
+/** Blocked workers, and a listener at its limit
+ *
+ */
+static void test_pause_suspend(void)
+{
+	test_ctx_t	t;
+
+	test_setup(&t, true);
+
+	/*
+	 *	Limit reached, then all workers block.  The limit is
+	 *	cleared first.
+	 */
+	fr_network_listen_pause(t.nr, t.li);
+	fr_network_suspend(t.nr);
+	TEST_CHECK(!test_readable(&t));
+
+	fr_network_listen_resume(t.nr, t.li);
+	TEST_CHECK(!test_readable(&t));
+	TEST_MSG("Reading resumed while the network is suspended");
+
+	fr_network_unsuspend(t.nr);
+	TEST_CHECK(test_readable(&t));
+
+	/*
+	 *	All workers block, then the limit is reached.  The
+	 *	workers unblock first.
+	 */
+	fr_network_suspend(t.nr);
+	fr_network_listen_pause(t.nr, t.li);
+	TEST_CHECK(!test_readable(&t));
+
+	fr_network_unsuspend(t.nr);
+	TEST_CHECK(!test_readable(&t));
+	TEST_MSG("Reading resumed while the listener is at its limit");
+
+	fr_network_listen_resume(t.nr, t.li);
+	TEST_CHECK(test_readable(&t));
+
+	test_teardown(&t);
+}
+
+/** Sockets added while the network is suspended aren't read until it's unsuspended
+ *
+ */
+static void test_pause_add_suspended(void)
+{
+	test_ctx_t	t;
+
+	test_setup(&t, false);
+
+	fr_network_suspend(t.nr);
+	TEST_CHECK(fr_network_listen_add_self(t.nr, t.li) == 0);
+	TEST_CHECK(!test_readable(&t));
+
+	fr_network_unsuspend(t.nr);
+	TEST_CHECK(test_readable(&t));
+
+	test_teardown(&t);
+}
+
+TEST_LIST = {
+	{ "pause_nested",		test_pause_nested },
+	{ "pause_suspend",		test_pause_suspend },
+	{ "pause_add_suspended",	test_pause_add_suspended },
+
+	{ NULL }
+};
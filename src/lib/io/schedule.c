@@ -28,6 +28,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/autoconf.h>
 
+#include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/rb.h>
@@ -143,6 +144,7 @@ struct fr_schedule_s {
 
 	fr_dlist_head_t	workers;		//!< list of workers
 	fr_dlist_head_t	networks;		//!< list of networks
+	fr_schedule_network_t *next_network;	//!< where the next "any_network" listener goes
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
@@ -834,10 +836,22 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 		fr_schedule_network_t *sn;
 
 		/*
-		 *	@todo - round robin it among the listeners?
+		 *	Listeners which don't mind which network
+		 *	thread they're in (e.g. load generators) are
+		 *	round robined among the network threads.
+		 *	Everything else goes in the first one.
+		 *
+		 *	@todo - round robin all of the listeners?
 		 *	or maybe add it to the same parent thread?
 		 */
-		sn = fr_dlist_head(&sc->networks);
+		if (li->any_network) {
+			sn = sc->next_network;
+			if (!sn) sn = fr_dlist_head(&sc->networks);
+
+			sc->next_network = fr_dlist_next(&sc->networks, sn);
+		} else {
+			sn = fr_dlist_head(&sc->networks);
+		}
 		nr = sn->nr;
 	}
 
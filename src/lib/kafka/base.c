@@ -29,14 +29,6 @@
 #include <freeradius-devel/util/sbuff.h>
 #include <freeradius-devel/util/size.h>
 
-typedef struct {
-	rd_kafka_conf_t		*conf;
-} fr_kafka_conf_t;
-
-typedef struct {
-	rd_kafka_topic_conf_t	*conf;
-} fr_kafka_topic_conf_t;
-
 typedef struct {
 	fr_table_ptr_sorted_t	*mapping;		//!< Mapping table between string constant.
 
@@ -69,7 +61,12 @@ fr_kafka_conf_t *kafka_conf_from_cs(CONF_SECTION *cs)
 	CONF_DATA const	*cd;
 	fr_kafka_conf_t	*kc;
 
-	cd = cf_data_find(cs, fr_kafka_conf_t, "conf");
+	/*
+	 *	Items in subsections (tls, sasl etc...) must
+	 *	set properties in the same configuration
+	 *	handle as the top level items.
+	 */
+	cd = cf_data_find_in_parent(cs, fr_kafka_conf_t, "conf");
 	if (cd) {
 		kc = cf_data_value(cd);
 	} else {
@@ -112,6 +109,50 @@ fr_kafka_topic_conf_t *kafka_topic_conf_from_cs(CONF_SECTION *cs)
 	return ktc;
 }
 
+/** Return the kafka configuration handle for a section
+ *
+ * @param[in] cs	which was parsed with #kafka_base_producer_config
+ *			or #kafka_base_consumer_config.
+ * @return
+ *	- The configuration handle.  Callers should use rd_kafka_conf_dup()
+ *	  if they need a handle they can pass to rd_kafka_new().
+ *	- NULL if no kafka configuration was parsed.
+ */
+fr_kafka_conf_t const *fr_kafka_conf_find(CONF_SECTION *cs)
+{
+	CONF_DATA const *cd;
+
+	cd = cf_data_find(cs, fr_kafka_conf_t, "conf");
+	if (!cd) return NULL;
+
+	return cf_data_value(cd);
+}
+
+/** Return the configuration handle for a topic
+ *
+ * @param[in] cs	which was parsed with #kafka_base_producer_config.
+ * @param[in] topic	to find configuration for.
+ * @return
+ *	- The topic configuration handle.
+ *	- NULL if the topic has no specific configuration.
+ */
+fr_kafka_topic_conf_t const *fr_kafka_topic_conf_find(CONF_SECTION *cs, char const *topic)
+{
+	CONF_SECTION	*topics, *topic_cs;
+	CONF_DATA const *cd;
+
+	topics = cf_section_find(cs, "topic", NULL);
+	if (!topics) return NULL;
+
+	topic_cs = cf_section_find(topics, topic, NULL);
+	if (!topic_cs) return NULL;
+
+	cd = cf_data_find(topic_cs, fr_kafka_topic_conf_t, "conf");
+	if (!cd) return NULL;
+
+	return cf_data_value(cd);
+}
+
 /** Perform any conversions necessary to map kafka defaults to our values
  *
  * @param[out] out	Where to write the pair.
@@ -1162,12 +1203,26 @@ CONF_PARSER const kafka_base_producer_config[] = {
 	{ FR_CONF_FUNC("batch_size", FR_TYPE_SIZE, kafka_config_parse, kafka_config_dflt),
 	  .uctx = &(fr_kafka_conf_ctx_t){ .property = "batch.size" }},
 
+	/*
+	 *	Maximum number of messages batched in one MessageSet
+	 */
+	{ FR_CONF_FUNC("batch_max_messages", FR_TYPE_UINT32, kafka_config_parse, kafka_config_dflt),
+	  .uctx = &(fr_kafka_conf_ctx_t){ .property = "batch.num.messages" }},
+
 	/*
 	 *	Delay in milliseconds to wait to assign new sticky partitions for each topic
 	 */
 	{ FR_CONF_FUNC("sticky_partition_delay", FR_TYPE_TIME_DELTA, kafka_config_parse, kafka_config_dflt),
 	  .uctx = &(fr_kafka_conf_ctx_t){ .property = "sticky.partitioning.linger.ms" }},
 
+	/*
+	 *	Use librdkafka's built-in mock cluster with this many
+	 *	brokers, instead of the brokers listed in "server".
+	 *	Only useful for testing.
+	 */
+	{ FR_CONF_FUNC("mock_brokers", FR_TYPE_UINT32, kafka_config_parse, kafka_config_dflt),
+	  .uctx = &(fr_kafka_conf_ctx_t){ .property = "test.mock.num.brokers", .empty_default = true }},
+
 	{ FR_CONF_SUBSECTION_GLOBAL("topic", FR_TYPE_MULTI, kafka_base_producer_topics_config) }, \
 
 	CONF_PARSER_TERMINATOR
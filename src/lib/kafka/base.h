@@ -42,9 +42,21 @@ DIAG_ON(documentation-deprecated-sync)
 extern "C" {
 #endif
 
+typedef struct {
+	rd_kafka_conf_t		*conf;
+} fr_kafka_conf_t;
+
+typedef struct {
+	rd_kafka_topic_conf_t	*conf;
+} fr_kafka_topic_conf_t;
+
 extern CONF_PARSER const kafka_base_consumer_config[];
 extern CONF_PARSER const kafka_base_producer_config[];
 
+fr_kafka_conf_t const		*fr_kafka_conf_find(CONF_SECTION *cs);
+
+fr_kafka_topic_conf_t const	*fr_kafka_topic_conf_find(CONF_SECTION *cs, char const *topic);
+
 #ifdef __cplusplus
 }
 #endif
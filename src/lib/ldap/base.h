@@ -771,6 +771,58 @@ int		fr_ldap_edir_get_password(LDAP *ld, char const *dn, char *password, size_t
 char const	*fr_ldap_edir_errstr(int code);
 
 
+/*
+ *	replica.c - Local copy of entries maintained by LDAP sync
+ */
+#define FR_LDAP_REPLICA_UUID_LEN	16
+
+typedef struct fr_ldap_replica_s fr_ldap_replica_t;
+typedef struct fr_ldap_replica_entry_s fr_ldap_replica_entry_t;
+
+fr_ldap_replica_t	*fr_ldap_replica_acquire(TALLOC_CTX *ctx, char const *name);
+
+int		fr_ldap_replica_source(fr_ldap_replica_t *replica, char const *key_attr, char const * const *attrs,
+				       char const *file, fr_time_delta_t persist_interval);
+
+int		fr_ldap_replica_require(fr_ldap_replica_t *replica, char const *key_attr, char const * const *attrs);
+
+bool		fr_ldap_replica_ready(fr_ldap_replica_t const *replica);
+
+void		fr_ldap_replica_refresh_start(fr_ldap_replica_t *replica, bool full);
+
+void		fr_ldap_replica_refresh_done(fr_ldap_replica_t *replica, bool sweep);
+
+int		fr_ldap_replica_update(fr_ldap_replica_t *replica, uint8_t const uuid[static FR_LDAP_REPLICA_UUID_LEN],
+				       LDAP *handle, LDAPMessage *msg);
+
+void		fr_ldap_replica_present(fr_ldap_replica_t *replica, uint8_t const uuid[static FR_LDAP_REPLICA_UUID_LEN]);
+
+void		fr_ldap_replica_delete(fr_ldap_replica_t *replica, uint8_t const uuid[static FR_LDAP_REPLICA_UUID_LEN]);
+
+void		fr_ldap_replica_cookie_set(fr_ldap_replica_t *replica, uint8_t const *cookie);
+
+uint8_t		*fr_ldap_replica_cookie(TALLOC_CTX *ctx, fr_ldap_replica_t const *replica);
+
+int		fr_ldap_replica_persist(fr_ldap_replica_t *replica);
+
+int		fr_ldap_replica_load(fr_ldap_replica_t *replica);
+
+fr_ldap_replica_entry_t const *fr_ldap_replica_find(fr_ldap_replica_t *replica, char const *key);
+
+fr_ldap_replica_entry_t const *fr_ldap_replica_find_by_dn(fr_ldap_replica_t *replica, char const *dn);
+
+void		fr_ldap_replica_entry_release(fr_ldap_replica_entry_t const *entry);
+
+char const	*fr_ldap_replica_entry_dn(fr_ldap_replica_entry_t const *entry);
+
+bool		fr_ldap_replica_has_attr(fr_ldap_replica_t const *replica, char const *attr);
+
+int		fr_ldap_replica_entry_values(struct berval ***out, fr_ldap_replica_t const *replica,
+					     fr_ldap_replica_entry_t const *entry, char const *attr);
+
+int		fr_ldap_replica_entry_match(fr_ldap_replica_t const *replica, fr_ldap_replica_entry_t const *entry,
+					    char const *base_dn, int scope, char const *filter);
+
 /*
  *	map.c - Attribute mapping code.
  */
@@ -784,6 +836,10 @@ int		fr_ldap_map_expand(fr_ldap_map_exp_t *expanded, request_t *request, map_lis
 int		fr_ldap_map_do(request_t *request, LDAP *handle,
 			       char const *valuepair_attr, fr_ldap_map_exp_t const *expanded, LDAPMessage *entry);
 
+int		fr_ldap_replica_map_do(request_t *request, fr_ldap_replica_t const *replica,
+				       char const *valuepair_attr, fr_ldap_map_exp_t const *expanded,
+				       fr_ldap_replica_entry_t const *entry);
+
 /*
  *	sasl_s.c - SASL synchronous bind functions
  */
@@ -860,6 +916,8 @@ bool		fr_ldap_util_is_dn(char const *in, size_t inlen);
 
 size_t		fr_ldap_util_normalise_dn(char *out, char const *in);
 
+bool		fr_ldap_util_dn_in_scope(char const *dn, char const *base_dn, int scope);
+
 char		*fr_ldap_berval_to_string(TALLOC_CTX *ctx, struct berval const *in);
 
 uint8_t		*fr_ldap_berval_to_bin(TALLOC_CTX *ctx, struct berval const *in);
@@ -890,3 +948,6 @@ fr_slen_t	fr_ldap_filter_parse(TALLOC_CTX *ctx, fr_dlist_head_t **root, fr_sbuff
 		filter_attr_check_t attr_check, void *uctx);
 
 bool		fr_ldap_filter_eval(fr_dlist_head_t *root, fr_ldap_connection_t *conn, LDAPMessage *msg);
+
+bool		fr_ldap_filter_eval_replica(fr_dlist_head_t *root, fr_ldap_replica_t const *replica,
+					    fr_ldap_replica_entry_t const *entry);
@@ -146,9 +146,10 @@ static fr_slen_t ldap_filter_parse_filter(ldap_filter_t *node, fr_sbuff_t *sbuff
 
 	/*
 	 *	Check for the attribute needed for the filter using the
-	 *	provided callback.
+	 *	provided callback.  If it can't be used, the filter can't
+	 *	be evaluated.
 	 */
-	if (attr_check) attr_check(node->attr, uctx);
+	if (attr_check && (attr_check(node->attr, uctx) < 0)) return fr_sbuff_error(sbuff);
 
 	/*
 	 *	If the attribute name is followed by ':' there is an
@@ -224,9 +225,34 @@ static fr_slen_t ldap_filter_parse_filter(ldap_filter_t *node, fr_sbuff_t *sbuff
 	MEM(node->value = fr_value_box_alloc_null(node));
 
 	switch (node->op) {
+	/*
+	 *	Special characters in values are escaped as \<hex><hex>,
+	 *	and we compare with unescaped attribute values.
+	 */
 	case LDAP_FILTER_OP_EQ:
-	case LDAP_FILTER_OP_PRESENT:
+	{
+		char	unescaped[FILTER_VALUE_MAX_LEN];
+
+		len = fr_ldap_unescape_func(NULL, unescaped, sizeof(unescaped), val_buffer, NULL);
+		if (fr_value_box_bstrndup(node, node->value, NULL, unescaped, len, false) < 0) {
+			fr_strerror_const("Failed parsing value for filter");
+			return fr_sbuff_error(sbuff);
+		}
+	}
+		break;
+
+	/*
+	 *	An escaped '*' would be treated as a wildcard, and
+	 *	match values it shouldn't.
+	 */
 	case LDAP_FILTER_OP_SUBSTR:
+		if (memchr(val_buffer, '\\', len)) {
+			fr_strerror_const("Escaped characters in substring filters are not supported");
+			return fr_sbuff_error(sbuff);
+		}
+		FALL_THROUGH;
+
+	case LDAP_FILTER_OP_PRESENT:
 		if (fr_value_box_bstrndup(node, node->value, NULL, val_buffer, len, false) < 0) {
 			fr_strerror_const("Failed parsing value for filter");
 			return fr_sbuff_error(sbuff);
@@ -335,6 +361,7 @@ static fr_slen_t ldap_filter_parse_node(ldap_filter_t *node, fr_sbuff_t *sbuff,
  * @param[in,out] root		where to allocate the root of the parsed filter.
  * @param[in] filter		to parse.
  * @param[in] attr_check	callback to check if required attributes are in the query.
+ *				If it returns < 0, parsing fails.
  * @param[in] uctx		passed to attribute check callback.
  * @return
  *	- number of bytes parsed on success
@@ -362,19 +389,29 @@ fr_slen_t fr_ldap_filter_parse(TALLOC_CTX *ctx, fr_dlist_head_t **root, fr_sbuff
 	return ret;
 }
 
-static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *conn, LDAPMessage *msg, int depth);
+/** Where the values of attributes being filtered come from
+ *
+ */
+typedef struct {
+	fr_ldap_connection_t		*conn;		//!< LDAP connection msg was returned on.
+	LDAPMessage			*msg;		//!< Entry returned by a search.
+
+	fr_ldap_replica_t const		*replica;	//!< Replica entry belongs to.
+	fr_ldap_replica_entry_t const	*entry;		//!< Copy of an entry held in a replica.
+} ldap_filter_src_t;
+
+static bool ldap_filter_node_eval(ldap_filter_t *node, ldap_filter_src_t const *src, int depth);
 
 /** Evaluate a group of LDAP filters
  *
  * Groups have a logical operator of &, | or !
  *
  * @param[in] group	to evaluate.
- * @param[in] conn	LDAP connection the message being filtered was returned on
- * @param[in] msg	to filter
+ * @param[in] src	of the values being filtered.
  * @param[in] depth	to indent debug messages, reflecting group nesting
  * @return true or false result of the group evaluation
  */
-static bool ldap_filter_group_eval(ldap_filter_t *group, fr_ldap_connection_t *conn, LDAPMessage *msg, int depth)
+static bool ldap_filter_group_eval(ldap_filter_t *group, ldap_filter_src_t const *src, int depth)
 {
 	ldap_filter_t	*node = NULL;
 	bool		filter_state = false;
@@ -384,10 +421,10 @@ static bool ldap_filter_group_eval(ldap_filter_t *group, fr_ldap_connection_t *c
 	while ((node = fr_dlist_next(&group->children, node))) {
 		switch (node->filter_type) {
 		case LDAP_FILTER_GROUP:
-			filter_state = ldap_filter_group_eval(node, conn, msg, depth);
+			filter_state = ldap_filter_group_eval(node, src, depth);
 			break;
 		case LDAP_FILTER_NODE:
-			filter_state = ldap_filter_node_eval(node, conn, msg, depth);
+			filter_state = ldap_filter_node_eval(node, src, depth);
 			break;
 		}
 
@@ -414,15 +451,36 @@ static bool ldap_filter_group_eval(ldap_filter_t *group, fr_ldap_connection_t *c
 	DEBUG3("%*s  Evaluating attribute \"%s\", value \"%pV\"", depth, "", node->attr, &value_box); \
 }
 
+/** Retrieve the values of an attribute from the message or replica entry being filtered
+ *
+ */
+static struct berval **ldap_filter_values(ldap_filter_src_t const *src, char const *attr)
+{
+	struct berval	**values;
+
+	if (src->msg) return ldap_get_values_len(src->conn->handle, src->msg, attr);
+
+	/*
+	 *	Filters evaluated against a replica entry are parsed
+	 *	with an attr_check which rejects attributes the replica
+	 *	doesn't copy, so this can't fail.
+	 */
+	if (fr_ldap_replica_entry_values(&values, src->replica, src->entry, attr) < 0) {
+		fr_assert(0);
+		return NULL;
+	}
+
+	return values;
+}
+
 /** Evaluate a single LDAP filter node
  *
  * @param[in] node	to evaluate.
- * @param[in] conn	LDAP connection the message being filtered was returned on.
- * @param[in] msg	to filter.
+ * @param[in] src	of the values being filtered.
  * @param[in] depth	to indent debug messages, reflecting group nesting.
  * @return true or false result of the node evaluation.
  */
-static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *conn, LDAPMessage *msg, int depth)
+static bool ldap_filter_node_eval(ldap_filter_t *node, ldap_filter_src_t const *src, int depth)
 {
 	struct berval	**values;
 	int		count, i;
@@ -430,11 +488,11 @@ static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *con
 
 	switch (node->filter_type) {
 	case LDAP_FILTER_GROUP:
-		return ldap_filter_group_eval(node, conn, msg, depth);
+		return ldap_filter_group_eval(node, src, depth);
 
 	case LDAP_FILTER_NODE:
 		DEBUG3("%*sEvaluating LDAP filter (%s)", depth, "", node->orig);
-		values = ldap_get_values_len(conn->handle, msg, node->attr);
+		values = ldap_filter_values(src, node->attr);
 		count = ldap_count_values_len(values);
 
 		switch (node->op) {
@@ -565,7 +623,10 @@ static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *con
 
 		}
 
-		ldap_value_free_len(values);
+		/*
+		 *	Values from a replica belong to the entry
+		 */
+		if (src->msg) ldap_value_free_len(values);
 	}
 
 	DEBUG3("%*sLDAP filter returns %s", depth, "", (filter_state ? "TRUE" : "FALSE"));
@@ -581,5 +642,26 @@ static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *con
  * @return true or false result of the node evaluation.
  */
 bool fr_ldap_filter_eval(fr_dlist_head_t *root, fr_ldap_connection_t *conn, LDAPMessage *msg) {
-	return ldap_filter_node_eval(fr_dlist_head(root), conn, msg, 0);
+	ldap_filter_src_t	src = { .conn = conn, .msg = msg };
+
+	return ldap_filter_node_eval(fr_dlist_head(root), &src, 0);
+}
+
+/** Evaluate an LDAP filter against an entry held in a replica
+ *
+ * @note The filter must have been parsed with an attr_check which rejects
+ *	attributes the replica doesn't copy.  Otherwise a test for an attribute
+ *	which isn't copied would behave as if the entry didn't have it.
+ *
+ * @param[in] root	of the LDAP filter to evaluate.
+ * @param[in] replica	the entry belongs to.
+ * @param[in] entry	to filter.
+ * @return true or false result of the node evaluation.
+ */
+bool fr_ldap_filter_eval_replica(fr_dlist_head_t *root, fr_ldap_replica_t const *replica,
+				 fr_ldap_replica_entry_t const *entry)
+{
+	ldap_filter_src_t	src = { .replica = replica, .entry = entry };
+
+	return ldap_filter_node_eval(fr_dlist_head(root), &src, 0);
 }
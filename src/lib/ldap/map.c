@@ -300,6 +300,55 @@ int fr_ldap_map_expand(fr_ldap_map_exp_t *expanded, request_t *request, map_list
 }
 
 
+/** Parse values of the valuepair attribute and add them to the request
+ *
+ * Each value is a complete attribute definition, specifying a list,
+ * operator and value.
+ *
+ * @param[in] request		Current request.
+ * @param[in] valuepair_attr	the values were retrieved from.
+ * @param[in] values		to parse.  May be NULL.
+ * @return Number of values successfully applied.
+ */
+static int ldap_map_valuepairs(request_t *request, char const *valuepair_attr, struct berval **values)
+{
+	int	count, i;
+	int	applied = 0;
+
+	count = ldap_count_values_len(values);
+
+	for (i = 0; i < count; i++) {
+		map_t	*attr;
+		char		*value;
+
+		tmpl_rules_t parse_rules = {
+			.attr = {
+				.dict_def = request->dict,
+				.prefix = TMPL_ATTR_REF_PREFIX_AUTO
+			}
+		};
+
+		value = fr_ldap_berval_to_string(request, values[i]);
+		RDEBUG3("Parsing attribute string '%s'", value);
+		if (map_afrom_attr_str(request, &attr, value,
+				       &parse_rules, &parse_rules) < 0) {
+			RPWDEBUG("Failed parsing '%s' value \"%s\" as valuepair, skipping...",
+				 valuepair_attr, value);
+			talloc_free(value);
+			continue;
+		}
+		if (map_to_request(request, attr, map_to_vp, NULL) < 0) {
+			RWDEBUG("Failed adding \"%s\" to request, skipping...", value);
+		} else {
+			applied++;
+		}
+		talloc_free(attr);
+		talloc_free(value);
+	}
+
+	return applied;
+}
+
 /** Convert attribute map into valuepairs
  *
  * Use the attribute map built earlier to convert LDAP values into valuepairs and insert them into whichever
@@ -371,40 +420,73 @@ int fr_ldap_map_do(request_t *request, LDAP *handle,
 	 */
 	if (valuepair_attr) {
 		struct berval	**values;
-		int		count, i;
 
 		values = ldap_get_values_len(handle, entry, valuepair_attr);
-		count = ldap_count_values_len(values);
+		applied += ldap_map_valuepairs(request, valuepair_attr, values);
+		ldap_value_free_len(values);
+	}
 
-		for (i = 0; i < count; i++) {
-			map_t	*attr;
-			char		*value;
+	return applied;
+}
 
-			tmpl_rules_t parse_rules = {
-				.attr = {
-					.dict_def = request->dict,
-					.prefix = TMPL_ATTR_REF_PREFIX_AUTO
-				}
-			};
+/** Convert attribute map into valuepairs using an entry from a replica
+ *
+ * Performs exactly the same job as #fr_ldap_map_do, but the values come from a copy
+ * of the entry held in a replica, instead of the result of a search.
+ *
+ * @param[in] request		Current request.
+ * @param[in] replica		the entry belongs to.
+ * @param[in] valuepair_attr	Treat attribute with this name as holding complete AVP definitions.
+ * @param[in] expanded		attributes (rhs of map).
+ * @param[in] entry		to retrieve attributes from.
+ * @return
+ *	- Number of maps successfully applied.
+ *	- -1 on failure.
+ */
+int fr_ldap_replica_map_do(request_t *request, fr_ldap_replica_t const *replica,
+			   char const *valuepair_attr, fr_ldap_map_exp_t const *expanded,
+			   fr_ldap_replica_entry_t const *entry)
+{
+	map_t const		*map = NULL;
+	unsigned int		total = 0;
+	int			applied = 0;	/* How many maps have been applied to the current request */
 
-			value = fr_ldap_berval_to_string(request, values[i]);
-			RDEBUG3("Parsing attribute string '%s'", value);
-			if (map_afrom_attr_str(request, &attr, value,
-					       &parse_rules, &parse_rules) < 0) {
-				RPWDEBUG("Failed parsing '%s' value \"%s\" as valuepair, skipping...",
-					 valuepair_attr, value);
-				talloc_free(value);
-				continue;
-			}
-			if (map_to_request(request, attr, map_to_vp, NULL) < 0) {
-				RWDEBUG("Failed adding \"%s\" to request, skipping...", value);
-			} else {
-				applied++;
-			}
-			talloc_free(attr);
-			talloc_free(value);
+	fr_ldap_result_t	result;
+	char const		*name;
+
+	while ((map = map_list_next(expanded->maps, map))) {
+		name = expanded->attrs[total++];
+
+		/*
+		 *	Values are owned by the entry, so
+		 *	they mustn't be freed.
+		 *
+		 *	Attribute names expanded at runtime can't
+		 *	be checked when the module's instantiated.
+		 */
+		if (fr_ldap_replica_entry_values(&result.values, replica, entry, name) < 0) {
+			RPEDEBUG("Failed retrieving values for map \"%s\"", map->lhs->name);
+			return -1;
 		}
-		ldap_value_free_len(values);
+		if (!result.values) {
+			RDEBUG3("Attribute \"%s\" not found in replica entry", name);
+			continue;
+		}
+		result.count = ldap_count_values_len(result.values);
+
+		if (map_to_request(request, map, fr_ldap_map_getvalue, &result) == -1) return -1;	/* Fail */
+
+		applied++;
+	}
+
+	if (valuepair_attr) {
+		struct berval	**values;
+
+		if (fr_ldap_replica_entry_values(&values, replica, entry, valuepair_attr) < 0) {
+			RPEDEBUG("Failed retrieving valuepair attribute");
+			return -1;
+		}
+		applied += ldap_map_valuepairs(request, valuepair_attr, values);
 	}
 
 	return applied;
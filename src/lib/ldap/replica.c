@@ -0,0 +1,1216 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file src/lib/ldap/replica.c
+ * @brief Local copy of directory entries, maintained from LDAP sync notifications.
+ *
+ * A replica holds selected attributes of the entries matched by one
+ * proto_ldap_sync search.  The listener applies every add, modify,
+ * present and delete notification it receives, and modules look
+ * entries up by DN, or by the value of a key attribute such as uid,
+ * without sending a search to the directory.
+ *
+ * Replicas are found by name, so the listener and any number of
+ * module instances share the same copy.  Lookups take a read lock,
+ * and return a reference to the entry, so an entry which is modified
+ * or deleted while a request is using it stays valid until the request
+ * releases it.
+ *
+ * A replica can be written to a snapshot file along with the sync
+ * cookie describing its contents.  On startup the snapshot is mapped
+ * and loaded, and the sync resumes from the cookie, so the server
+ * only needs to fetch the changes made while it was stopped.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#include <freeradius-devel/ldap/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define REPLICA_MAGIC		"FRLDAPR1"	//!< Start (and end) of a snapshot file.
+#define REPLICA_MAGIC_LEN	(sizeof(REPLICA_MAGIC) - 1)
+
+/** A copy of a directory entry
+ *
+ */
+struct fr_ldap_replica_entry_s {
+	uint8_t			uuid[FR_LDAP_REPLICA_UUID_LEN];	//!< entryUUID of the entry.
+	char			*dn;			//!< Normalised DN of the entry.
+	char			*key;			//!< First value of the key attribute, or NULL.
+
+	uint64_t		generation;		//!< Refresh the entry was last seen in.
+	atomic_uint_fast32_t	ref;			//!< One for the indexes, plus one per reader.
+
+	size_t			num_attrs;		//!< Number of elements in values.
+	struct berval		**values[];		//!< NULL terminated values of each replicated attribute,
+							///< in the same order as the replica's attrs.
+};
+
+struct fr_ldap_replica_s {
+	fr_dlist_t		entry;			//!< Entry in the list of replicas.
+	char const		*name;			//!< Name modules use to find the replica.
+	unsigned int		refs;			//!< Number of users.  Protected by replica_mutex.
+
+	pthread_rwlock_t	lock;			//!< Protects the indexes.
+	fr_hash_table_t		*by_uuid;		//!< All entries.
+	fr_hash_table_t		*by_dn;			//!< All entries.
+	fr_hash_table_t		*by_key;		//!< Entries with a key.
+
+	/*
+	 *	Set by the sync which maintains the replica.
+	 */
+	bool			sourced;		//!< Whether a sync maintains the replica.
+	char const		*key_attr;		//!< Attribute entries are indexed by.
+	char const		**attrs;		//!< Attributes copied from each entry.
+	size_t			num_attrs;		//!< Number of elements in attrs.
+	char const		*file;			//!< Snapshot file.  May be NULL.
+	fr_time_delta_t		persist_interval;	//!< Minimum time between snapshots.
+
+	/*
+	 *	Set by the modules which look entries up.
+	 */
+	char const		*required_key;		//!< Key attribute modules look entries up by.
+	char const		**required;		//!< Attributes modules need the sync to copy.
+
+	/*
+	 *	Only accessed by the sync.
+	 */
+	uint8_t			*cookie;		//!< Cookie describing the current contents.
+	uint64_t		generation;		//!< Incremented at the start of each refresh.
+	fr_time_t		persisted;		//!< When the last snapshot was written.
+	bool			dirty;			//!< Changed since the last snapshot.
+	bool			refreshing;		//!< A refresh is in progress.
+	bool			full_refresh;		//!< Current refresh started without a cookie.
+	bool			presented;		//!< Current refresh marked entries as present.
+
+	atomic_bool		ready;			//!< Contents are complete, either because a
+							///< refresh finished, or a snapshot was loaded.
+};
+
+static pthread_mutex_t	replica_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t	replica_list;
+
+/** Talloc'd handle that releases a replica reference when freed
+ *
+ */
+typedef struct {
+	fr_ldap_replica_t	*replica;
+} fr_ldap_replica_ref_t;
+
+static uint32_t replica_uuid_hash(void const *data)
+{
+	fr_ldap_replica_entry_t const *entry = data;
+
+	return fr_hash(entry->uuid, sizeof(entry->uuid));
+}
+
+static int8_t replica_uuid_cmp(void const *one, void const *two)
+{
+	fr_ldap_replica_entry_t const *a = one, *b = two;
+
+	return CMP(memcmp(a->uuid, b->uuid, sizeof(a->uuid)), 0);
+}
+
+static uint32_t replica_dn_hash(void const *data)
+{
+	fr_ldap_replica_entry_t const *entry = data;
+
+	return fr_hash_case_string(entry->dn);
+}
+
+static int8_t replica_dn_cmp(void const *one, void const *two)
+{
+	fr_ldap_replica_entry_t const *a = one, *b = two;
+
+	return CMP(strcasecmp(a->dn, b->dn), 0);
+}
+
+static uint32_t replica_key_hash(void const *data)
+{
+	fr_ldap_replica_entry_t const *entry = data;
+
+	return fr_hash_case_string(entry->key);
+}
+
+static int8_t replica_key_cmp(void const *one, void const *two)
+{
+	fr_ldap_replica_entry_t const *a = one, *b = two;
+
+	return CMP(strcasecmp(a->key, b->key), 0);
+}
+
+/** Allocate an entry with space for the values of each replicated attribute
+ *
+ */
+static fr_ldap_replica_entry_t *replica_entry_alloc(fr_ldap_replica_t const *replica, uint8_t const *uuid)
+{
+	fr_ldap_replica_entry_t	*entry;
+
+	entry = talloc_zero_size(NULL, sizeof(*entry) + (sizeof(entry->values[0]) * replica->num_attrs));
+	if (!entry) return NULL;
+	talloc_set_name_const(entry, "fr_ldap_replica_entry_t");
+
+	memcpy(entry->uuid, uuid, sizeof(entry->uuid));
+	entry->num_attrs = replica->num_attrs;
+	entry->generation = replica->generation;
+	atomic_init(&entry->ref, 1);
+
+	return entry;
+}
+
+/** Add a value to one of an entry's attributes
+ *
+ */
+static int replica_entry_value_add(fr_ldap_replica_entry_t *entry, size_t attr, uint8_t const *value, size_t len)
+{
+	struct berval	**values = entry->values[attr];
+	struct berval	*bv;
+	size_t		count = values ? talloc_array_length(values) - 1 : 0;
+
+	values = talloc_realloc(entry, values, struct berval *, count + 2);
+	if (!values) return -1;
+	entry->values[attr] = values;
+
+	bv = values[count] = talloc_zero(values, struct berval);
+	if (!bv) return -1;
+	values[count + 1] = NULL;
+
+	/*
+	 *	Terminate the value, so that it can be
+	 *	used as a string without copying.
+	 */
+	bv->bv_val = talloc_array(bv, char, len + 1);
+	if (!bv->bv_val) return -1;
+	if (len) memcpy(bv->bv_val, value, len);
+	bv->bv_val[len] = '\0';
+	bv->bv_len = len;
+
+	return 0;
+}
+
+/** Set the key of an entry from the value of the key attribute
+ *
+ */
+static int replica_entry_key_set(fr_ldap_replica_t const *replica, fr_ldap_replica_entry_t *entry)
+{
+	size_t i;
+
+	for (i = 0; i < replica->num_attrs; i++) {
+		if (strcasecmp(replica->attrs[i], replica->key_attr) != 0) continue;
+		if (!entry->values[i]) return 0;
+
+		entry->key = talloc_bstrndup(entry, entry->values[i][0]->bv_val, entry->values[i][0]->bv_len);
+		if (!entry->key) return -1;
+		return 0;
+	}
+
+	return 0;
+}
+
+static void replica_entry_release(fr_ldap_replica_entry_t *entry)
+{
+	if (atomic_fetch_sub_explicit(&entry->ref, 1, memory_order_acq_rel) == 1) talloc_free(entry);
+}
+
+/** Remove an entry from all the indexes
+ *
+ * @note Must be called with the write lock held.
+ */
+static void replica_entry_unlink(fr_ldap_replica_t *replica, fr_ldap_replica_entry_t *entry)
+{
+	fr_hash_table_remove(replica->by_uuid, entry);
+
+	/*
+	 *	Only remove the DN and key entries if they
+	 *	point to this entry, and not to another entry
+	 *	with the same value.
+	 */
+	if (fr_hash_table_find(replica->by_dn, entry) == entry) fr_hash_table_remove(replica->by_dn, entry);
+	if (entry->key && (fr_hash_table_find(replica->by_key, entry) == entry)) {
+		fr_hash_table_remove(replica->by_key, entry);
+	}
+
+	replica_entry_release(entry);
+}
+
+/** Add an entry to all the indexes, replacing any entry with the same UUID
+ *
+ * @note Must be called with the write lock held.
+ */
+static int replica_entry_link(fr_ldap_replica_t *replica, fr_ldap_replica_entry_t *entry)
+{
+	fr_ldap_replica_entry_t	*old;
+
+	old = fr_hash_table_find(replica->by_uuid, entry);
+	if (old) replica_entry_unlink(replica, old);
+
+	if (!fr_hash_table_insert(replica->by_uuid, entry)) return -1;
+
+	old = NULL;
+	if (fr_hash_table_replace((void **)&old, replica->by_dn, entry) < 0) {
+		fr_hash_table_remove(replica->by_uuid, entry);
+		return -1;
+	}
+
+	if (entry->key) {
+		old = NULL;
+		if (fr_hash_table_replace((void **)&old, replica->by_key, entry) < 0) {
+			fr_hash_table_remove(replica->by_uuid, entry);
+			fr_hash_table_remove(replica->by_dn, entry);
+			return -1;
+		}
+		if (old) {
+			WARN("Replica \"%s\" - Entries \"%s\" and \"%s\" both have %s \"%s\", using \"%s\"",
+			     replica->name, old->dn, entry->dn, replica->key_attr, entry->key, entry->dn);
+		}
+	}
+
+	return 0;
+}
+
+static int _replica_free(fr_ldap_replica_t *replica)
+{
+	fr_ldap_replica_entry_t	*entry;
+	fr_hash_iter_t		iter;
+
+	if (replica->dirty && !replica->refreshing) (void) fr_ldap_replica_persist(replica);
+
+	for (entry = fr_hash_table_iter_init(replica->by_uuid, &iter);
+	     entry;
+	     entry = fr_hash_table_iter_next(replica->by_uuid, &iter)) replica_entry_release(entry);
+
+	pthread_rwlock_destroy(&replica->lock);
+
+	return 0;
+}
+
+static int _replica_ref_free(fr_ldap_replica_ref_t *ref)
+{
+	fr_ldap_replica_t *replica = ref->replica;
+
+	pthread_mutex_lock(&replica_mutex);
+	if (--replica->refs == 0) {
+		fr_dlist_remove(&replica_list, replica);
+		talloc_free(replica);
+	}
+	pthread_mutex_unlock(&replica_mutex);
+
+	return 0;
+}
+
+/** Find or create a replica
+ *
+ * The replica is shared by everything which acquires the same name, and is freed
+ * when the last of the ctxs passed to this function is freed.
+ *
+ * @param[in] ctx	The reference to the replica is bound to.
+ * @param[in] name	of the replica.
+ * @return
+ *	- The replica.
+ *	- NULL on error.
+ */
+fr_ldap_replica_t *fr_ldap_replica_acquire(TALLOC_CTX *ctx, char const *name)
+{
+	fr_ldap_replica_t	*replica = NULL;
+	fr_ldap_replica_ref_t	*ref;
+
+	ref = talloc_zero(ctx, fr_ldap_replica_ref_t);
+	if (!ref) return NULL;
+
+	pthread_mutex_lock(&replica_mutex);
+	if (!fr_dlist_initialised(&replica_list)) fr_dlist_talloc_init(&replica_list, fr_ldap_replica_t, entry);
+
+	while ((replica = fr_dlist_next(&replica_list, replica))) {
+		if (strcmp(replica->name, name) == 0) break;
+	}
+
+	if (!replica) {
+		replica = talloc_zero(NULL, fr_ldap_replica_t);
+		if (!replica) {
+		error:
+			pthread_mutex_unlock(&replica_mutex);
+			talloc_free(replica);
+			talloc_free(ref);
+			return NULL;
+		}
+
+		replica->name = talloc_typed_strdup(replica, name);
+		replica->by_uuid = fr_hash_table_alloc(replica, replica_uuid_hash, replica_uuid_cmp, NULL);
+		replica->by_dn = fr_hash_table_alloc(replica, replica_dn_hash, replica_dn_cmp, NULL);
+		replica->by_key = fr_hash_table_alloc(replica, replica_key_hash, replica_key_cmp, NULL);
+		if (!replica->name || !replica->by_uuid || !replica->by_dn || !replica->by_key) goto error;
+
+		if (pthread_rwlock_init(&replica->lock, NULL) != 0) {
+			fr_strerror_printf("Failed initialising replica lock: %s", fr_syserror(errno));
+			goto error;
+		}
+		talloc_set_destructor(replica, _replica_free);
+		atomic_init(&replica->ready, false);
+
+		fr_dlist_insert_tail(&replica_list, replica);
+	}
+	replica->refs++;
+	pthread_mutex_unlock(&replica_mutex);
+
+	ref->replica = replica;
+	talloc_set_destructor(ref, _replica_ref_free);
+
+	return replica;
+}
+
+/** Check that a sync copies everything the modules using a replica need
+ *
+ * @param[in] replica	being checked.
+ * @param[in] need_key	Key attribute the modules need.  May be NULL.
+ * @param[in] need	Attributes the modules need.  May be NULL.
+ * @param[in] num_need	Number of elements in need.
+ * @param[in] key_attr	Key attribute of the sync.
+ * @param[in] attrs	NULL terminated array of attributes the sync copies.
+ * @return
+ *	- 0 if the sync copies everything.
+ *	- -1 if it doesn't.
+ */
+static int replica_attrs_check(fr_ldap_replica_t const *replica, char const *need_key,
+			       char const * const *need, size_t num_need,
+			       char const *key_attr, char const * const *attrs)
+{
+	size_t i, j;
+
+	if (need_key && (strcasecmp(need_key, key_attr) != 0)) {
+		fr_strerror_printf("Replica \"%s\" must use \"%s\" as its key attribute, not \"%s\"",
+				   replica->name, need_key, key_attr);
+		return -1;
+	}
+
+	for (i = 0; i < num_need; i++) {
+		for (j = 0; attrs[j]; j++) if (strcasecmp(attrs[j], need[i]) == 0) break;
+		if (attrs[j]) continue;
+
+		fr_strerror_printf("Replica \"%s\" does not copy attribute \"%s\".  "
+				   "It must be listed in the 'attrs' of the sync maintaining the replica",
+				   replica->name, need[i]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Set the attributes the sync maintaining the replica will copy
+ *
+ * Only one sync may maintain a replica.  If the sync doesn't copy an attribute
+ * registered with #fr_ldap_replica_require, it's an error.
+ *
+ * @param[in] replica		to configure.
+ * @param[in] key_attr		Attribute entries are looked up by.  Must be one of attrs.
+ * @param[in] attrs		NULL terminated array of attributes to copy from each entry.
+ * @param[in] file		to persist the replica to.  May be NULL.
+ * @param[in] persist_interval	Minimum time between writes of the snapshot file.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_replica_source(fr_ldap_replica_t *replica, char const *key_attr, char const * const *attrs,
+			   char const *file, fr_time_delta_t persist_interval)
+{
+	size_t	i;
+	bool	found = false;
+
+	if (replica->sourced) {
+		fr_strerror_printf("Replica \"%s\" is already maintained by another sync", replica->name);
+		return -1;
+	}
+
+	if (!attrs || !attrs[0]) {
+		fr_strerror_printf("Replica \"%s\" requires the sync to list its 'attrs'", replica->name);
+		return -1;
+	}
+
+	for (i = 0; attrs[i]; i++) {
+		/*
+		 *	Entries only hold the attributes which
+		 *	are named, so wildcards copy nothing.
+		 */
+		if ((strcmp(attrs[i], "*") == 0) || (strcmp(attrs[i], "+") == 0)) {
+			fr_strerror_printf("Replica \"%s\" requires the sync's 'attrs' to name each attribute, "
+					   "not \"%s\"", replica->name, attrs[i]);
+			return -1;
+		}
+		if (strcasecmp(attrs[i], key_attr) == 0) found = true;
+	}
+	if (!found) {
+		fr_strerror_printf("Replica \"%s\" key attribute \"%s\" must be listed in the sync's 'attrs'",
+				   replica->name, key_attr);
+		return -1;
+	}
+
+	if (replica_attrs_check(replica, replica->required_key,
+				replica->required, talloc_array_length(replica->required),
+				key_attr, attrs) < 0) return -1;
+
+	replica->num_attrs = i;
+	MEM(replica->attrs = talloc_array(replica, char const *, i + 1));
+	for (i = 0; attrs[i]; i++) MEM(replica->attrs[i] = talloc_typed_strdup(replica->attrs, attrs[i]));
+	replica->attrs[i] = NULL;
+
+	MEM(replica->key_attr = talloc_typed_strdup(replica, key_attr));
+	if (file) MEM(replica->file = talloc_typed_strdup(replica, file));
+	replica->persist_interval = persist_interval;
+	replica->sourced = true;
+
+	return 0;
+}
+
+/** Register attributes a module needs the replica to copy
+ *
+ * A module which uses values from the replica must call this for every attribute
+ * it would have retrieved from the directory.  If an attribute isn't copied, the
+ * module would behave as if the user had no values for it, which may grant access
+ * which should have been denied.  So whichever of the module and the sync is
+ * instantiated second fails, and the server doesn't start.
+ *
+ * @param[in] replica	the module uses.
+ * @param[in] key_attr	the module expects entries to be looked up by.  May be NULL
+ *			if the module doesn't care.
+ * @param[in] attrs	NULL terminated array of attributes the module needs.  May be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the sync maintaining the replica doesn't copy the attributes, or
+ *	  another module needs a different key attribute.
+ */
+int fr_ldap_replica_require(fr_ldap_replica_t *replica, char const *key_attr, char const * const *attrs)
+{
+	size_t	i, num = 0, have;
+
+	if (attrs) while (attrs[num]) num++;
+
+	if (key_attr && replica->required_key && (strcasecmp(key_attr, replica->required_key) != 0)) {
+		fr_strerror_printf("Replica \"%s\" is already used with key attribute \"%s\", not \"%s\"",
+				   replica->name, replica->required_key, key_attr);
+		return -1;
+	}
+
+	if (replica->sourced &&
+	    (replica_attrs_check(replica, key_attr, attrs, num, replica->key_attr, replica->attrs) < 0)) return -1;
+
+	if (key_attr && !replica->required_key) MEM(replica->required_key = talloc_typed_strdup(replica, key_attr));
+
+	if (!num) return 0;
+
+	have = talloc_array_length(replica->required);
+	MEM(replica->required = talloc_realloc(replica, replica->required, char const *, have + num));
+	for (i = 0; i < num; i++) {
+		MEM(replica->required[have + i] = talloc_typed_strdup(replica->required, attrs[i]));
+	}
+
+	return 0;
+}
+
+/** Whether the replica holds a complete copy of the entries matched by the sync
+ *
+ * Until the first refresh completes, or a snapshot is loaded, lookups which don't
+ * find an entry don't mean that the entry doesn't exist.
+ */
+bool fr_ldap_replica_ready(fr_ldap_replica_t const *replica)
+{
+	return atomic_load_explicit(&replica->ready, memory_order_acquire);
+}
+
+/** Record that a refresh is starting
+ *
+ * Entries which aren't added, modified, or marked present by the refresh
+ * can be removed by #fr_ldap_replica_refresh_done.
+ *
+ * @param[in] replica	the refresh is for.
+ * @param[in] full	If true, the sync was started without a cookie, so the server
+ *			will send every entry, and any we don't receive should be removed.
+ */
+void fr_ldap_replica_refresh_start(fr_ldap_replica_t *replica, bool full)
+{
+	pthread_rwlock_wrlock(&replica->lock);
+	replica->generation++;
+	replica->refreshing = true;
+	replica->full_refresh = full;
+	replica->presented = false;
+	pthread_rwlock_unlock(&replica->lock);
+}
+
+/** Record that a refresh has completed
+ *
+ * @param[in] replica	the refresh was for.
+ * @param[in] sweep	If true, the refresh used the present phase, so remove any entries
+ *			the server didn't send.  Entries are also removed after a full refresh,
+ *			or if any entries were marked present.
+ */
+void fr_ldap_replica_refresh_done(fr_ldap_replica_t *replica, bool sweep)
+{
+	fr_ldap_replica_entry_t	**entries = NULL;
+	int			num, i;
+	unsigned int		removed = 0;
+
+	pthread_rwlock_wrlock(&replica->lock);
+	if (sweep || replica->full_refresh || replica->presented) {
+		num = fr_hash_table_flatten(NULL, (void ***)&entries, replica->by_uuid);
+		for (i = 0; i < num; i++) {
+			if (entries[i]->generation == replica->generation) continue;
+
+			replica_entry_unlink(replica, entries[i]);
+			removed++;
+		}
+		talloc_free(entries);
+		if (removed) replica->dirty = true;
+	}
+	replica->refreshing = false;
+	replica->full_refresh = false;
+	replica->presented = false;
+	num = fr_hash_table_num_elements(replica->by_uuid);
+	pthread_rwlock_unlock(&replica->lock);
+
+	INFO("Replica \"%s\" - Refresh complete, %i entries (%u removed)", replica->name, num, removed);
+
+	atomic_store_explicit(&replica->ready, true, memory_order_release);
+
+	(void) fr_ldap_replica_persist(replica);
+}
+
+/** Add or replace an entry
+ *
+ * @param[in] replica	to update.
+ * @param[in] uuid	entryUUID of the entry.
+ * @param[in] handle	the message was received on.
+ * @param[in] msg	containing the entry.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_replica_update(fr_ldap_replica_t *replica, uint8_t const uuid[static FR_LDAP_REPLICA_UUID_LEN],
+			   LDAP *handle, LDAPMessage *msg)
+{
+	fr_ldap_replica_entry_t	*entry;
+	char			*dn;
+	size_t			i;
+	int			ret;
+
+	entry = replica_entry_alloc(replica, uuid);
+	if (!entry) {
+	oom:
+		fr_strerror_const("Out of memory");
+	error:
+		talloc_free(entry);
+		return -1;
+	}
+
+	dn = ldap_get_dn(handle, msg);
+	if (!dn) {
+		fr_strerror_const("Entry has no DN");
+		goto error;
+	}
+	entry->dn = talloc_typed_strdup(entry, dn);
+	ldap_memfree(dn);
+	if (!entry->dn) goto oom;
+	fr_ldap_util_normalise_dn(entry->dn, entry->dn);
+
+	for (i = 0; i < replica->num_attrs; i++) {
+		struct berval	**values;
+		int		j;
+
+		values = ldap_get_values_len(handle, msg, replica->attrs[i]);
+		if (!values) continue;
+
+		for (j = 0; values[j]; j++) {
+			if (replica_entry_value_add(entry, i, (uint8_t const *)values[j]->bv_val, values[j]->bv_len) < 0) {
+				ldap_value_free_len(values);
+				goto oom;
+			}
+		}
+		ldap_value_free_len(values);
+	}
+	if (replica_entry_key_set(replica, entry) < 0) goto oom;
+
+	pthread_rwlock_wrlock(&replica->lock);
+	ret = replica_entry_link(replica, entry);
+	if (ret == 0) replica->dirty = true;
+	pthread_rwlock_unlock(&replica->lock);
+	if (ret < 0) {
+		fr_strerror_const("Failed indexing entry");
+		goto error;
+	}
+
+	DEBUG3("Replica \"%s\" - Updated \"%s\"", replica->name, entry->dn);
+
+	return 0;
+}
+
+/** Mark an entry as present in the current refresh
+ *
+ */
+void fr_ldap_replica_present(fr_ldap_replica_t *replica, uint8_t const uuid[static FR_LDAP_REPLICA_UUID_LEN])
+{
+	fr_ldap_replica_entry_t	find, *entry;
+
+	memcpy(find.uuid, uuid, sizeof(find.uuid));
+
+	pthread_rwlock_wrlock(&replica->lock);
+	entry = fr_hash_table_find(replica->by_uuid, &find);
+	if (entry) entry->generation = replica->generation;
+	replica->presented = true;
+	pthread_rwlock_unlock(&replica->lock);
+
+	if (!entry) DEBUG2("Replica \"%s\" - Entry marked present, but we have no copy of it", replica->name);
+}
+
+/** Remove an entry
+ *
+ */
+void fr_ldap_replica_delete(fr_ldap_replica_t *replica, uint8_t const uuid[static FR_LDAP_REPLICA_UUID_LEN])
+{
+	fr_ldap_replica_entry_t	find, *entry;
+
+	memcpy(find.uuid, uuid, sizeof(find.uuid));
+
+	pthread_rwlock_wrlock(&replica->lock);
+	entry = fr_hash_table_find(replica->by_uuid, &find);
+	if (entry) {
+		DEBUG3("Replica \"%s\" - Deleted \"%s\"", replica->name, entry->dn);
+		replica_entry_unlink(replica, entry);
+		replica->dirty = true;
+	}
+	pthread_rwlock_unlock(&replica->lock);
+}
+
+/** Record the cookie describing the replica's current contents
+ *
+ * Writes a snapshot if one hasn't been written in the last persist_interval.
+ *
+ * @param[in] replica	to set the cookie for.
+ * @param[in] cookie	from the server.  Length is talloc_array_length(cookie).
+ */
+void fr_ldap_replica_cookie_set(fr_ldap_replica_t *replica, uint8_t const *cookie)
+{
+	talloc_free(replica->cookie);
+	MEM(replica->cookie = talloc_memdup(replica, cookie, talloc_array_length(cookie)));
+	replica->dirty = true;
+
+	/*
+	 *	Entries the refresh will remove are still
+	 *	present, so wait until it completes.
+	 */
+	if (!replica->file || replica->refreshing) return;
+	if (fr_time_delta_lt(fr_time_sub(fr_time(), replica->persisted), replica->persist_interval)) return;
+
+	(void) fr_ldap_replica_persist(replica);
+}
+
+/** Return a copy of the cookie describing the replica's current contents
+ *
+ * @param[in] ctx	to allocate the cookie in.
+ * @param[in] replica	to retrieve the cookie for.
+ * @return
+ *	- The cookie.
+ *	- NULL if the replica has no cookie.
+ */
+uint8_t *fr_ldap_replica_cookie(TALLOC_CTX *ctx, fr_ldap_replica_t const *replica)
+{
+	if (!replica->cookie) return NULL;
+
+	return talloc_memdup(ctx, replica->cookie, talloc_array_length(replica->cookie));
+}
+
+static int replica_write_data(FILE *fp, void const *data, size_t len)
+{
+	uint8_t	hdr[sizeof(uint32_t)];
+
+	fr_nbo_from_uint32(hdr, (uint32_t)len);
+	if (fwrite(hdr, sizeof(hdr), 1, fp) != 1) return -1;
+	if (len && (fwrite(data, len, 1, fp) != 1)) return -1;
+
+	return 0;
+}
+
+/** Write the replica to its snapshot file
+ *
+ * The snapshot is written to a temporary file, which is renamed over the
+ * previous snapshot, so a snapshot always matches the cookie stored in it.
+ *
+ * All numbers are in network byte order.  The layout is:
+ *
+ @verbatim
+   magic, key attribute, number of attributes, attribute names, cookie,
+   number of entries, and for each entry:
+     uuid, dn, and for each attribute: number of values, values
+   magic
+ @endverbatim
+ *
+ * Strings and values are written as a 32bit length, followed by the data.
+ *
+ * @param[in] replica	to write.
+ * @return
+ *	- 0 on success (or if the replica has no file, or no cookie).
+ *	- -1 on failure.
+ */
+int fr_ldap_replica_persist(fr_ldap_replica_t *replica)
+{
+	char			*tmp;
+	int			fd;
+	FILE			*fp;
+	fr_ldap_replica_entry_t	*entry;
+	fr_hash_iter_t		iter;
+	uint8_t			num[sizeof(uint64_t)];
+	size_t			i, j;
+
+	/*
+	 *	Without a cookie a snapshot is no use, as
+	 *	we'd still need to fetch every entry.
+	 */
+	if (!replica->file || !replica->cookie) return 0;
+
+	MEM(tmp = talloc_typed_asprintf(NULL, "%s.tmp", replica->file));
+	/*
+	 *	The snapshot may contain passwords, so
+	 *	only we get to read it.
+	 */
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	fp = (fd >= 0) ? fdopen(fd, "w") : NULL;
+	if (!fp) {
+		ERROR("Replica \"%s\" - Failed opening \"%s\": %s", replica->name, tmp, fr_syserror(errno));
+		if (fd >= 0) close(fd);
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if (fwrite(REPLICA_MAGIC, REPLICA_MAGIC_LEN, 1, fp) != 1) goto error;
+	if (replica_write_data(fp, replica->key_attr, strlen(replica->key_attr)) < 0) goto error;
+
+	fr_nbo_from_uint32(num, (uint32_t)replica->num_attrs);
+	if (fwrite(num, sizeof(uint32_t), 1, fp) != 1) goto error;
+	for (i = 0; i < replica->num_attrs; i++) {
+		if (replica_write_data(fp, replica->attrs[i], strlen(replica->attrs[i])) < 0) goto error;
+	}
+	if (replica_write_data(fp, replica->cookie, talloc_array_length(replica->cookie)) < 0) goto error;
+
+	/*
+	 *	Only the sync modifies the replica, and
+	 *	that's who calls us, so a read lock is
+	 *	enough.  It lets lookups continue while
+	 *	the snapshot is written.
+	 */
+	pthread_rwlock_rdlock(&replica->lock);
+	fr_nbo_from_uint64(num, fr_hash_table_num_elements(replica->by_uuid));
+	if (fwrite(num, sizeof(uint64_t), 1, fp) != 1) {
+	error_unlock:
+		pthread_rwlock_unlock(&replica->lock);
+		goto error;
+	}
+
+	for (entry = fr_hash_table_iter_init(replica->by_uuid, &iter);
+	     entry;
+	     entry = fr_hash_table_iter_next(replica->by_uuid, &iter)) {
+		if (fwrite(entry->uuid, sizeof(entry->uuid), 1, fp) != 1) goto error_unlock;
+		if (replica_write_data(fp, entry->dn, strlen(entry->dn)) < 0) goto error_unlock;
+
+		for (i = 0; i < entry->num_attrs; i++) {
+			size_t count = entry->values[i] ? talloc_array_length(entry->values[i]) - 1 : 0;
+
+			fr_nbo_from_uint32(num, (uint32_t)count);
+			if (fwrite(num, sizeof(uint32_t), 1, fp) != 1) goto error_unlock;
+
+			for (j = 0; j < count; j++) {
+				if (replica_write_data(fp, entry->values[i][j]->bv_val,
+						       entry->values[i][j]->bv_len) < 0) goto error_unlock;
+			}
+		}
+	}
+	pthread_rwlock_unlock(&replica->lock);
+
+	if (fwrite(REPLICA_MAGIC, REPLICA_MAGIC_LEN, 1, fp) != 1) goto error;
+
+	if ((fflush(fp) != 0) || (fsync(fileno(fp)) < 0)) {
+	error:
+		ERROR("Replica \"%s\" - Failed writing \"%s\": %s", replica->name, tmp, fr_syserror(errno));
+		fclose(fp);
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+	fclose(fp);
+
+	if (rename(tmp, replica->file) < 0) {
+		ERROR("Replica \"%s\" - Failed renaming \"%s\" to \"%s\": %s",
+		      replica->name, tmp, replica->file, fr_syserror(errno));
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+	talloc_free(tmp);
+
+	replica->persisted = fr_time();
+	replica->dirty = false;
+
+	DEBUG2("Replica \"%s\" - Wrote snapshot \"%s\"", replica->name, replica->file);
+
+	return 0;
+}
+
+/** Read a length prefixed string or value from a snapshot
+ *
+ */
+static int replica_read_data(uint8_t const **out, size_t *out_len, fr_dbuff_t *dbuff)
+{
+	uint32_t len;
+
+	if (fr_dbuff_out(&len, dbuff) < 0) return -1;
+	if (fr_dbuff_remaining(dbuff) < len) return -1;
+
+	*out = fr_dbuff_current(dbuff);
+	*out_len = len;
+	fr_dbuff_advance(dbuff, len);
+
+	return 0;
+}
+
+/** Check a string in a snapshot matches the configuration
+ *
+ */
+static bool replica_read_match(fr_dbuff_t *dbuff, char const *expected)
+{
+	uint8_t const	*p;
+	size_t		len;
+
+	if (replica_read_data(&p, &len, dbuff) < 0) return false;
+
+	return (len == strlen(expected)) && (strncasecmp((char const *)p, expected, len) == 0);
+}
+
+/** Load the replica from its snapshot file
+ *
+ * If the snapshot was written with a different key attribute, or different
+ * attributes, it's ignored, and the sync fetches all the entries again.
+ *
+ * @param[in] replica	to load.  Must have been configured with #fr_ldap_replica_source.
+ * @return
+ *	- 1 if the snapshot was loaded.
+ *	- 0 if there was no usable snapshot.
+ *	- -1 on failure.
+ */
+int fr_ldap_replica_load(fr_ldap_replica_t *replica)
+{
+	int			fd;
+	struct stat		st;
+	uint8_t			*map;
+	fr_dbuff_t		dbuff;
+	uint8_t const		*p;
+	size_t			len;
+	uint32_t		num_attrs;
+	uint64_t		num_entries, e;
+	uint8_t			*cookie = NULL;
+	fr_ldap_replica_entry_t	*entry = NULL;
+	int			ret = 0;
+
+	if (!replica->file) return 0;
+
+	fd = open(replica->file, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT) return 0;
+
+		ERROR("Replica \"%s\" - Failed opening \"%s\": %s", replica->name, replica->file, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		ERROR("Replica \"%s\" - Failed reading \"%s\": %s", replica->name, replica->file, fr_syserror(errno));
+		close(fd);
+		return -1;
+	}
+
+	if ((size_t)st.st_size < (REPLICA_MAGIC_LEN * 2)) {
+	invalid:
+		WARN("Replica \"%s\" - Ignoring invalid snapshot \"%s\"", replica->name, replica->file);
+		ret = 0;
+		goto finish;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		ERROR("Replica \"%s\" - Failed mapping \"%s\": %s", replica->name, replica->file, fr_syserror(errno));
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	fd = -1;
+
+	fr_dbuff_init(&dbuff, map, (size_t)st.st_size);
+
+	if ((memcmp(map, REPLICA_MAGIC, REPLICA_MAGIC_LEN) != 0) ||
+	    (memcmp(map + st.st_size - REPLICA_MAGIC_LEN, REPLICA_MAGIC, REPLICA_MAGIC_LEN) != 0)) {
+	invalid_unmap:
+		munmap(map, st.st_size);
+		talloc_free(entry);
+		talloc_free(cookie);
+		goto invalid;
+	}
+	fr_dbuff_advance(&dbuff, REPLICA_MAGIC_LEN);
+
+	if (!replica_read_match(&dbuff, replica->key_attr)) {
+	mismatch:
+		INFO("Replica \"%s\" - Snapshot \"%s\" was written with different attributes, ignoring it",
+		     replica->name, replica->file);
+		munmap(map, st.st_size);
+		talloc_free(cookie);
+		return 0;
+	}
+	if (fr_dbuff_out(&num_attrs, &dbuff) < 0) goto invalid_unmap;
+	if (num_attrs != replica->num_attrs) goto mismatch;
+	for (len = 0; len < num_attrs; len++) if (!replica_read_match(&dbuff, replica->attrs[len])) goto mismatch;
+
+	if (replica_read_data(&p, &len, &dbuff) < 0) goto invalid_unmap;
+	MEM(cookie = talloc_memdup(replica, p, len));
+
+	if (fr_dbuff_out(&num_entries, &dbuff) < 0) goto invalid_unmap;
+
+	pthread_rwlock_wrlock(&replica->lock);
+	for (e = 0; e < num_entries; e++) {
+		size_t i;
+
+		if (fr_dbuff_remaining(&dbuff) < FR_LDAP_REPLICA_UUID_LEN) {
+		invalid_unlock:
+			pthread_rwlock_unlock(&replica->lock);
+			goto invalid_unmap;
+		}
+
+		MEM(entry = replica_entry_alloc(replica, fr_dbuff_current(&dbuff)));
+		fr_dbuff_advance(&dbuff, FR_LDAP_REPLICA_UUID_LEN);
+
+		if (replica_read_data(&p, &len, &dbuff) < 0) goto invalid_unlock;
+		MEM(entry->dn = talloc_bstrndup(entry, (char const *)p, len));
+
+		for (i = 0; i < num_attrs; i++) {
+			uint32_t count, j;
+
+			if (fr_dbuff_out(&count, &dbuff) < 0) goto invalid_unlock;
+			for (j = 0; j < count; j++) {
+				if (replica_read_data(&p, &len, &dbuff) < 0) goto invalid_unlock;
+				MEM(replica_entry_value_add(entry, i, p, len) == 0);
+			}
+		}
+		MEM(replica_entry_key_set(replica, entry) == 0);
+
+		if (replica_entry_link(replica, entry) < 0) goto invalid_unlock;
+		entry = NULL;
+	}
+	ret = fr_hash_table_num_elements(replica->by_uuid);
+	pthread_rwlock_unlock(&replica->lock);
+
+	if (fr_dbuff_remaining(&dbuff) != REPLICA_MAGIC_LEN) goto invalid_unmap;
+
+	munmap(map, st.st_size);
+
+	INFO("Replica \"%s\" - Loaded %i entries from \"%s\"", replica->name, ret, replica->file);
+
+	talloc_free(replica->cookie);
+	replica->cookie = cookie;
+	replica->persisted = fr_time();
+	atomic_store_explicit(&replica->ready, true, memory_order_release);
+
+	return 1;
+
+finish:
+	if (fd >= 0) close(fd);
+	return ret;
+}
+
+/** Look up an entry by the value of the replica's key attribute
+ *
+ * @param[in] replica	to search.
+ * @param[in] key	to find.  Compared case insensitively.
+ * @return
+ *	- The entry.  Must be released with #fr_ldap_replica_entry_release.
+ *	- NULL if no entry has that key.
+ */
+fr_ldap_replica_entry_t const *fr_ldap_replica_find(fr_ldap_replica_t *replica, char const *key)
+{
+	fr_ldap_replica_entry_t	find = { .key = UNCONST(char *, key) }, *entry;
+
+	pthread_rwlock_rdlock(&replica->lock);
+	entry = fr_hash_table_find(replica->by_key, &find);
+	if (entry) atomic_fetch_add_explicit(&entry->ref, 1, memory_order_relaxed);
+	pthread_rwlock_unlock(&replica->lock);
+
+	return entry;
+}
+
+/** Look up an entry by DN
+ *
+ * @param[in] replica	to search.
+ * @param[in] dn	to find.
+ * @return
+ *	- The entry.  Must be released with #fr_ldap_replica_entry_release.
+ *	- NULL if no entry has that DN.
+ */
+fr_ldap_replica_entry_t const *fr_ldap_replica_find_by_dn(fr_ldap_replica_t *replica, char const *dn)
+{
+	fr_ldap_replica_entry_t	find = { 0 }, *entry;
+	char			*normalised;
+
+	MEM(normalised = talloc_typed_strdup(NULL, dn));
+	fr_ldap_util_normalise_dn(normalised, normalised);
+	find.dn = normalised;
+
+	pthread_rwlock_rdlock(&replica->lock);
+	entry = fr_hash_table_find(replica->by_dn, &find);
+	if (entry) atomic_fetch_add_explicit(&entry->ref, 1, memory_order_relaxed);
+	pthread_rwlock_unlock(&replica->lock);
+
+	talloc_free(normalised);
+
+	return entry;
+}
+
+/** Release an entry returned by one of the find functions
+ *
+ */
+void fr_ldap_replica_entry_release(fr_ldap_replica_entry_t const *entry)
+{
+	replica_entry_release(UNCONST(fr_ldap_replica_entry_t *, entry));
+}
+
+/** Return the DN of an entry
+ *
+ */
+char const *fr_ldap_replica_entry_dn(fr_ldap_replica_entry_t const *entry)
+{
+	return entry->dn;
+}
+
+/** Whether the replica copies an attribute
+ *
+ */
+bool fr_ldap_replica_has_attr(fr_ldap_replica_t const *replica, char const *attr)
+{
+	size_t i;
+
+	for (i = 0; i < replica->num_attrs; i++) {
+		if (strcasecmp(replica->attrs[i], attr) == 0) return true;
+	}
+
+	return false;
+}
+
+/** Return the values of one of an entry's attributes
+ *
+ * An attribute the replica doesn't copy is an error, and not the same as an entry
+ * without any values for the attribute, as the entry in the directory may have them.
+ *
+ * @param[out] out	NULL terminated array of values.  Owned by the entry, must not
+ *			be freed.  NULL if the entry has no values for the attribute.
+ * @param[in] replica	the entry belongs to.
+ * @param[in] entry	to return values from.
+ * @param[in] attr	to return values for.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the replica doesn't copy the attribute.
+ */
+int fr_ldap_replica_entry_values(struct berval ***out, fr_ldap_replica_t const *replica,
+				 fr_ldap_replica_entry_t const *entry, char const *attr)
+{
+	size_t i;
+
+	for (i = 0; i < entry->num_attrs; i++) {
+		if (strcasecmp(replica->attrs[i], attr) != 0) continue;
+
+		*out = entry->values[i];
+		return 0;
+	}
+
+	*out = NULL;
+	fr_strerror_printf("Replica \"%s\" does not copy attribute \"%s\"", replica->name, attr);
+
+	return -1;
+}
+
+static int replica_filter_attr_check(char const *attr, void *uctx)
+{
+	fr_ldap_replica_t const *replica = talloc_get_type_abort_const(uctx, fr_ldap_replica_t);
+
+	if (fr_ldap_replica_has_attr(replica, attr)) return 0;
+
+	fr_strerror_printf("Replica \"%s\" does not copy attribute \"%s\"", replica->name, attr);
+
+	return -1;
+}
+
+/** Check whether an entry would be returned by a search
+ *
+ * Lets a lookup in the replica apply the same restrictions as the search it
+ * replaces.  The replica holds everything the sync matched, which may include
+ * entries outside of the module's base DN, or which don't match its filter.
+ *
+ * @param[in] replica	the entry belongs to.
+ * @param[in] entry	to check.
+ * @param[in] base_dn	of the search.
+ * @param[in] scope	of the search, one of the LDAP_SCOPE_* values.
+ * @param[in] filter	of the search.  May be NULL.
+ * @return
+ *	- 1 if the entry would be returned.
+ *	- 0 if it wouldn't.
+ *	- -1 if the filter is invalid, or uses attributes the replica doesn't copy,
+ *	  so the search must be sent to the directory.
+ */
+int fr_ldap_replica_entry_match(fr_ldap_replica_t const *replica, fr_ldap_replica_entry_t const *entry,
+				char const *base_dn, int scope, char const *filter)
+{
+	char		*normalised;
+	bool		in_scope;
+	fr_dlist_head_t	*root;
+	bool		match;
+
+	MEM(normalised = talloc_typed_strdup(NULL, base_dn));
+	fr_ldap_util_normalise_dn(normalised, normalised);
+	in_scope = fr_ldap_util_dn_in_scope(entry->dn, normalised, scope);
+	talloc_free(normalised);
+
+	if (!in_scope) return 0;
+	if (!filter) return 1;
+
+	if (fr_ldap_filter_parse(NULL, &root, &FR_SBUFF_IN(filter, strlen(filter)),
+				 replica_filter_attr_check, UNCONST(fr_ldap_replica_t *, replica)) < 0) {
+		fr_strerror_printf_push("Can't evaluate filter \"%s\"", filter);
+		return -1;
+	}
+
+	match = fr_ldap_filter_eval_replica(root, replica, entry);
+	talloc_free(root);
+
+	return match ? 1 : 0;
+}
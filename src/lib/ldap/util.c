@@ -482,6 +482,77 @@ size_t fr_ldap_common_dn(char const *full, char const *part)
 	return f_len - p_len;
 }
 
+/** Check whether a DN would be returned by a search with the given base and scope
+ *
+ * Both DNs should have been normalised with #fr_ldap_util_normalise_dn.
+ *
+ * @param[in] dn	to check.
+ * @param[in] base_dn	of the search.  An empty string is the root of the directory.
+ * @param[in] scope	of the search, one of the LDAP_SCOPE_* values.
+ * @return
+ *	- true if the DN is within the scope of the search.
+ *	- false if it isn't.
+ */
+bool fr_ldap_util_dn_in_scope(char const *dn, char const *base_dn, int scope)
+{
+	size_t		dn_len = strlen(dn), base_len = strlen(base_dn);
+	size_t		rdn_len;
+	char const	*p;
+	bool		escaped = false;
+
+	/*
+	 *	The DN is the base
+	 */
+	if ((dn_len == base_len) && (strcasecmp(dn, base_dn) == 0)) {
+		return (scope == LDAP_SCOPE_BASE) || (scope == LDAP_SCOPE_SUB);
+	}
+	if (scope == LDAP_SCOPE_BASE) return false;
+
+	/*
+	 *	Otherwise it must end in ",<base_dn>", unless
+	 *	the base is the root, which everything is below.
+	 */
+	if (base_len) {
+		if (dn_len <= (base_len + 1)) return false;
+
+		rdn_len = dn_len - base_len - 1;
+		if ((dn[rdn_len] != ',') || (strcasecmp(dn + rdn_len + 1, base_dn) != 0)) return false;
+
+		/*
+		 *	The comma mustn't be escaped
+		 */
+		for (p = dn + rdn_len; (p > dn) && (p[-1] == '\\'); p--) escaped = !escaped;
+		if (escaped) return false;
+	} else {
+		if (!dn_len) return false;
+		rdn_len = dn_len;
+	}
+
+	switch (scope) {
+	case LDAP_SCOPE_ONE:
+		/*
+		 *	Only one RDN between the DN and the base
+		 */
+		for (p = dn; p < (dn + rdn_len); p++) {
+			if (*p == '\\') {
+				if (p[1]) p++;
+				continue;
+			}
+			if (*p == ',') return false;
+		}
+		return true;
+
+	case LDAP_SCOPE_SUB:
+#ifdef LDAP_SCOPE_CHILDREN
+	case LDAP_SCOPE_CHILDREN:
+#endif
+		return true;
+
+	default:
+		return false;
+	}
+}
+
 /** Combine and expand filters
  *
  * @param request Current request.
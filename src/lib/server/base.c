@@ -28,6 +28,19 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
 
+/** Log how long a startup phase took, and start timing the next one
+ *
+ * @param[in] name	of the phase which has just completed.
+ * @param[in,out] start	when the phase started.  Updated to the current time.
+ */
+static void server_init_phase_done(char const *name, fr_time_t *start)
+{
+	fr_time_t now = fr_time();
+
+	DEBUG2("Startup phase \"%s\" took %pVs", name, fr_box_time_delta(fr_time_sub(now, *start)));
+	*start = now;
+}
+
 /** Initialize src/lib/server/
  *
  *  This is just so that the callers don't need to call a million functions.
@@ -39,6 +52,8 @@ RCSID("$Id$")
  */
 int server_init(CONF_SECTION *cs)
 {
+	fr_time_t	init_start = fr_time(), start = init_start;
+
 	/*
 	 *	Load dictionary attributes used
 	 *	for requests.
@@ -59,6 +74,7 @@ int server_init(CONF_SECTION *cs)
 	 *	Set up dictionaries and attributes for password comparisons
 	 */
 	if (password_init() < 0) return -1;
+	server_init_phase_done("global init", &start);
 
 	/*
 	 *	Initialize Auth-Type, etc. in the virtual servers
@@ -66,6 +82,7 @@ int server_init(CONF_SECTION *cs)
 	 *	to be defined.
 	 */
 	if (virtual_servers_bootstrap(cs) < 0) return -1;
+	server_init_phase_done("virtual server bootstrap", &start);
 
 	/*
 	 *	Bootstrap the modules.  This links to them, and runs
@@ -74,21 +91,28 @@ int server_init(CONF_SECTION *cs)
 	 *	After this step, all dynamic attributes, xlats, etc. are defined.
 	 */
 	if (modules_rlm_bootstrap(cs) < 0) return -1;
+	server_init_phase_done("module bootstrap", &start);
 
 	/*
 	 *	And then load the virtual servers.
 	 */
 	if (virtual_servers_instantiate() < 0) return -1;
+	server_init_phase_done("virtual server instantiation", &start);
 
 	/*
-	 *	Instantiate the modules
+	 *	Instantiate the modules.  This also waits for
+	 *	connection pools to open their initial connections.
 	 */
 	if (modules_rlm_instantiate() < 0) return -1;
+	server_init_phase_done("module instantiation", &start);
 
 	/*
 	 *	Call xlat instantiation functions (after the xlats have been compiled)
 	 */
 	if (xlat_instantiate() < 0) return -1;
+	server_init_phase_done("xlat instantiation", &start);
+
+	INFO("Server initialisation took %pVs", fr_box_time_delta(fr_time_sub(start, init_start)));
 
 	return 0;
 }
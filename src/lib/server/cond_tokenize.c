@@ -550,6 +550,11 @@ static int cond_normalise(TALLOC_CTX *ctx, fr_token_t lhs_type, fr_cond_t **c_ou
 			}
 		}
 
+		/*
+		 *	!(true) --> false, and !(false) --> true
+		 */
+		if ((c->type == COND_TYPE_TRUE) || (c->type == COND_TYPE_FALSE)) goto check_true;
+
 		/*
 		 *	No further optimizations are possible, so we
 		 *	just check for and/or short-circuit.
@@ -169,6 +169,7 @@ static const CONF_PARSER thread_config[] = {
 #ifdef WITH_TLS
 	{ FR_CONF_OFFSET("openssl_async_pool_init", FR_TYPE_SIZE, main_config_t, openssl_async_pool_init), .dflt = "64" },
 	{ FR_CONF_OFFSET("openssl_async_pool_max", FR_TYPE_SIZE, main_config_t, openssl_async_pool_max), .dflt = "1024" },
+	{ FR_CONF_OFFSET("openssl_crypto_threads", FR_TYPE_UINT32, main_config_t, openssl_crypto_threads), .dflt = "0" },
 #endif
 
 	CONF_PARSER_TERMINATOR
@@ -376,7 +377,12 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	/*
+	 *	Only listeners which can run in any network thread
+	 *	(i.e. load generators) use the extra threads.
+	 */
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <=, 64);
 
 	memcpy(out, &value, sizeof(value));
 
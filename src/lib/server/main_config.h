@@ -120,6 +120,9 @@ struct main_config_s {
 
 	size_t		openssl_async_pool_max;		//!< Tuning option to set the maximum number of requests
 							///< in the async ctx pool.
+
+	uint32_t	openssl_crypto_threads;		//!< Number of threads to run TLS handshake rounds on.
+							///< If 0, handshakes are run by the workers.
 #endif
 
 	fr_dict_t	*dict;				//!< Main dictionary.
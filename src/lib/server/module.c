@@ -698,6 +698,8 @@ int module_instantiate(module_instance_t *instance)
 	 *	Call the instantiate method, if any.
 	 */
 	if (mi->module->instantiate) {
+		fr_time_t start;
+
 		cf_log_debug(cs, "Instantiating %s_%s \"%s\"",
 			     fr_table_str_by_value(dl_module_type_prefix, mi->dl_inst->module->type, "<INVALID>"),
 			     mi->dl_inst->module->common->name,
@@ -706,11 +708,16 @@ int module_instantiate(module_instance_t *instance)
 		/*
 		 *	Call the module's instantiation routine.
 		 */
+		start = fr_time();
 		if (mi->module->instantiate(MODULE_INST_CTX(mi->dl_inst)) < 0) {
 			cf_log_err(mi->dl_inst->conf, "Instantiation failed for module \"%s\"", mi->name);
 
 			return -1;
 		}
+		mi->instantiate_time = fr_time_sub(fr_time(), start);
+
+		cf_log_debug(cs, "Instantiated %s \"%s\" in %pVs",
+			     mi->dl_inst->module->common->name, mi->name, fr_box_time_delta(mi->instantiate_time));
 	}
 	mi->state = MODULE_INSTANCE_INSTANTIATED;
 
@@ -771,17 +778,20 @@ int module_bootstrap(module_instance_t *mi)
 	 *	submodules.
 	 */
 	if (mi->module->bootstrap) {
-		CONF_SECTION *cs = mi->dl_inst->conf;
+		CONF_SECTION	*cs = mi->dl_inst->conf;
+		fr_time_t	start;
 
 		cf_log_debug(cs, "Bootstrapping %s_%s \"%s\"",
 			     fr_table_str_by_value(dl_module_type_prefix, mi->dl_inst->module->type, "<INVALID>"),
 			     mi->dl_inst->module->common->name,
 			     mi->name);
 
+		start = fr_time();
 		if (mi->module->bootstrap(MODULE_INST_CTX(mi->dl_inst)) < 0) {
 			cf_log_err(cs, "Bootstrap failed for module \"%s\"", mi->name);
 			return -1;
 		}
+		mi->bootstrap_time = fr_time_sub(fr_time(), start);
 	}
 	mi->state = MODULE_INSTANCE_BOOTSTRAPPED;
 
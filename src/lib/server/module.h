@@ -188,6 +188,9 @@ struct module_instance_s {
 
 	module_instance_state_t		state;		//!< What's been done with this module so far.
 
+	fr_time_delta_t			bootstrap_time;	//!< How long the module's bootstrap callback took.
+	fr_time_delta_t			instantiate_time; //!< How long the module's instantiate callback took.
+
 	/** @name Return code overrides
 	 * @{
  	 */
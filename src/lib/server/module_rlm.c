@@ -329,10 +329,13 @@ fr_pool_t *module_rlm_connection_pool_init(CONF_SECTION *module,
 
 		fr_pool_enable_triggers(pool, trigger_prefix, trigger_args);
 
-		if (fr_pool_start(pool) < 0) {
-			ERROR("%s: Starting initial connections failed", log_prefix);
-			return NULL;
-		}
+		/*
+		 *	The initial connections are opened in the
+		 *	background, while other modules are being
+		 *	instantiated.  modules_rlm_instantiate()
+		 *	waits for them to complete.
+		 */
+		fr_pool_start_async(pool);
 
 		DEBUG4("%s: Adding pool reference %p to config item \"%s.pool\"", log_prefix, pool, parent_name(cs));
 		cf_data_add(cs, pool, NULL, false);
@@ -987,7 +990,25 @@ int modules_rlm_thread_instantiate(TALLOC_CTX *ctx, fr_event_list_t *el)
  */
 int modules_rlm_instantiate(void)
 {
-	return modules_instantiate(rlm_modules);
+	int		ret;
+	fr_time_t	start;
+
+	ret = modules_instantiate(rlm_modules);
+
+	/*
+	 *	Always wait for connection pools, even on error,
+	 *	so that they're not freed while their initial
+	 *	connections are still being opened.
+	 */
+	start = fr_time();
+	if (fr_pool_start_wait_all() < 0) {
+		ERROR("Starting initial connections for one or more connection pools failed");
+		return -1;
+	}
+	DEBUG2("Waited %pVs for connection pools to open their initial connections",
+	       fr_box_time_delta(fr_time_sub(fr_time(), start)));
+
+	return ret;
 }
 
 /** Bootstrap modules and virtual modules
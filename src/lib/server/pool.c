@@ -85,6 +85,10 @@ struct fr_pool_s {
 	int		ref;			//!< Reference counter to prevent connection
 						//!< pool being freed multiple times.
 	uint32_t	start;			//!< Number of initial connections.
+	uint32_t	start_concurrency;	//!< Maximum number of initial connections to open
+						//!< at the same time.
+	bool		start_concurrency_is_set;	//!< Whether start_concurrency was configured.
+						//!< If not, the pending window is used.
 	uint32_t	min;			//!< Minimum number of concurrent connections to keep open.
 	uint32_t	max;			//!< Maximum number of concurrent connections to allow.
 	uint32_t	max_pending;		//!< Max number of pending connections to allow.
@@ -145,10 +149,24 @@ struct fr_pool_s {
 	fr_pool_reconnect_t	reconnect;	//!< Called during connection pool reconnect.
 
 	fr_pool_state_t	state;			//!< Stats and state of the connection pool.
+
+	fr_dlist_t	starting_entry;		//!< Entry in the list of pools opening initial connections.
+	pthread_t	*start_threads;		//!< Threads opening the initial connections.
+	uint32_t	start_spawned;		//!< Initial connections which have been attempted.
+	bool		start_failed;		//!< One of the initial connections couldn't be opened.
 };
 
+/** Pools whose initial connections are still being opened
+ *
+ * Pools can be started from any thread, e.g. when a redis cluster
+ * adds a node, so the list is protected by a mutex.
+ */
+static fr_dlist_head_t pools_starting;
+static pthread_mutex_t pools_starting_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static const CONF_PARSER pool_config[] = {
 	{ FR_CONF_OFFSET("start", FR_TYPE_UINT32, fr_pool_t, start), .dflt = "5" },
+	{ FR_CONF_OFFSET_IS_SET("start_concurrency", FR_TYPE_UINT32, fr_pool_t, start_concurrency) },
 	{ FR_CONF_OFFSET("min", FR_TYPE_UINT32, fr_pool_t, min), .dflt = "5" },
 	{ FR_CONF_OFFSET("max", FR_TYPE_UINT32, fr_pool_t, max), .dflt = "10" },
 	{ FR_CONF_OFFSET("max_pending", FR_TYPE_UINT32, fr_pool_t, max_pending), .dflt = "0" },
@@ -1054,6 +1072,13 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	/* coverity[missing_unlock] */
 	pool->pending_window = (pool->max_pending > 0) ? pool->max_pending : pool->max;
 
+	if (!pool->start_concurrency_is_set) {
+		pool->start_concurrency = pool->pending_window;
+	} else if (pool->start_concurrency == 0) {
+		cf_log_err(cs, "Cannot set 'start_concurrency' to zero");
+		goto error;
+	}
+
 	if (pool->min > pool->max) {
 		cf_log_err(cs, "Cannot set 'min' to more than 'max'");
 		goto error;
@@ -1092,37 +1117,215 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	return pool;
 }
 
-int fr_pool_start(fr_pool_t *pool)
+/** Open initial connections until we've attempted 'start' of them, or one fails
+ *
+ * Multiple threads may run this concurrently for the same pool.
+ */
+static void *pool_start_spawn(void *uctx)
 {
-	uint32_t		i;
-	fr_pool_connection_t 	*this;
+	fr_pool_t *pool = uctx;
 
-	/*
-	 *	Don't spawn any connections
-	 */
-	if (check_config) return 0;
+	for (;;) {
+		pthread_mutex_lock(&pool->mutex);
+		if (pool->start_failed || (pool->start_spawned >= pool->start)) {
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+		pool->start_spawned++;
+		pthread_mutex_unlock(&pool->mutex);
 
-	/*
-	 *	Create all of the connections, unless the admin says
-	 *	not to.
-	 */
-	for (i = 0; i < pool->start; i++) {
 		/*
 		 *	Call time() once for each spawn attempt as there
 		 *	could be a significant delay.
 		 */
-		this = connection_spawn(pool, NULL, fr_time(), false, true);
-		if (!this) {
-			ERROR("Failed spawning initial connections");
-			return -1;
+		if (!connection_spawn(pool, NULL, fr_time(), false, true)) {
+			pthread_mutex_lock(&pool->mutex);
+			pool->start_failed = true;
+			pthread_mutex_unlock(&pool->mutex);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/** Start the threads which open the initial connections for a pool
+ *
+ * If there's only one connection to open at a time, or no threads could
+ * be created, the connections are opened by the calling thread, before
+ * this function returns.
+ */
+static void pool_start_threads(fr_pool_t *pool)
+{
+	uint32_t	i, num_threads;
+
+	pool->start_spawned = 0;
+	pool->start_failed = false;
+
+	num_threads = pool->start_concurrency;
+	if (num_threads > pool->start) num_threads = pool->start;
+
+	/*
+	 *	Only one connection at a time, there's no point
+	 *	in using a separate thread.
+	 */
+	if (num_threads <= 1) {
+		(void) pool_start_spawn(pool);
+		return;
+	}
+
+	MEM(pool->start_threads = talloc_zero_array(pool, pthread_t, num_threads));
+	for (i = 0; i < num_threads; i++) {
+		int ret;
+
+		ret = pthread_create(&pool->start_threads[i], NULL, pool_start_spawn, pool);
+		if (ret != 0) {
+			WARN("Failed creating thread to open connections: %s", fr_syserror(ret));
+			break;
 		}
 	}
 
+	/*
+	 *	Couldn't create any threads, open the
+	 *	connections one at a time instead.
+	 */
+	if (i == 0) {
+		TALLOC_FREE(pool->start_threads);
+		(void) pool_start_spawn(pool);
+		return;
+	}
+
+	/*
+	 *	Only join the threads we created.
+	 */
+	if (i < num_threads) MEM(pool->start_threads = talloc_realloc(pool, pool->start_threads, pthread_t, i));
+
+	DEBUG2("Opening %u initial connections using %u threads", pool->start, i);
+}
+
+/** Wait for the threads opening the initial connections, and check the result
+ *
+ * @note Will call the 'start' trigger.
+ */
+static int pool_start_join(fr_pool_t *pool)
+{
+	size_t i;
+
+	for (i = 0; i < talloc_array_length(pool->start_threads); i++) {
+		(void) pthread_join(pool->start_threads[i], NULL);
+	}
+	TALLOC_FREE(pool->start_threads);
+
+	if (pool->start_failed) {
+		ERROR("Failed spawning initial connections");
+		return -1;
+	}
+
 	fr_pool_trigger_exec(pool, "start");
 
 	return 0;
 }
 
+/** Start opening the initial connections for a pool
+ *
+ * Connections are opened by up to 'start_concurrency' threads, so that
+ * slow connection setup for one connection doesn't delay the others.
+ * The caller can continue with other work (e.g. instantiating other
+ * modules), and must then call #fr_pool_start_wait or
+ * #fr_pool_start_wait_all to find out whether all of the initial
+ * connections were opened.
+ *
+ * @param[in] pool	to open connections for.
+ */
+void fr_pool_start_async(fr_pool_t *pool)
+{
+	/*
+	 *	Don't spawn any connections
+	 */
+	if (check_config || (pool->start == 0)) return;
+
+	pthread_mutex_lock(&pools_starting_mutex);
+	if (!fr_dlist_initialised(&pools_starting)) fr_dlist_init(&pools_starting, fr_pool_t, starting_entry);
+	if (fr_dlist_entry_in_list(&pool->starting_entry)) {
+		pthread_mutex_unlock(&pools_starting_mutex);
+		return;
+	}
+	fr_dlist_insert_tail(&pools_starting, pool);
+	pthread_mutex_unlock(&pools_starting_mutex);
+
+	pool_start_threads(pool);
+}
+
+/** Wait for the initial connections for a pool to be opened
+ *
+ * @note Will call the 'start' trigger.
+ *
+ * @param[in] pool	to wait for.
+ * @return
+ *	- 0 on success, or if #fr_pool_start_async was not called for this pool.
+ *	- -1 if one of the initial connections couldn't be opened.
+ */
+int fr_pool_start_wait(fr_pool_t *pool)
+{
+	pthread_mutex_lock(&pools_starting_mutex);
+	if (!fr_dlist_initialised(&pools_starting) || !fr_dlist_entry_in_list(&pool->starting_entry)) {
+		pthread_mutex_unlock(&pools_starting_mutex);
+		return 0;
+	}
+	fr_dlist_remove(&pools_starting, pool);
+	pthread_mutex_unlock(&pools_starting_mutex);
+
+	return pool_start_join(pool);
+}
+
+/** Wait for the initial connections for all pools to be opened
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if any pool couldn't open all its initial connections.
+ */
+int fr_pool_start_wait_all(void)
+{
+	fr_pool_t	*pool;
+	int		ret = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&pools_starting_mutex);
+		pool = fr_dlist_initialised(&pools_starting) ? fr_dlist_pop_head(&pools_starting) : NULL;
+		pthread_mutex_unlock(&pools_starting_mutex);
+
+		if (!pool) break;
+
+		if (pool_start_join(pool) < 0) ret = -1;
+	}
+
+	return ret;
+}
+
+/** Open the initial connections for a pool, and wait for them to be opened
+ *
+ * The pool isn't added to the list of pools being started, so this can
+ * be called from any thread, independently of #fr_pool_start_wait_all.
+ *
+ * @note Will call the 'start' trigger.
+ *
+ * @param[in] pool	to open connections for.
+ * @return
+ *	- 0 on success.
+ *	- -1 if one of the initial connections couldn't be opened.
+ */
+int fr_pool_start(fr_pool_t *pool)
+{
+	/*
+	 *	Don't spawn any connections
+	 */
+	if (check_config) return 0;
+
+	pool_start_threads(pool);
+
+	return pool_start_join(pool);
+}
+
 /** Allocate a new pool using an existing one as a template
  *
  * @param[in] ctx	to allocate new pool in.
@@ -1322,6 +1525,12 @@ void fr_pool_free(fr_pool_t *pool)
 
 	DEBUG2("Removing connection pool");
 
+	/*
+	 *	Don't free the pool out from under threads
+	 *	which are still opening initial connections.
+	 */
+	(void) fr_pool_start_wait(pool);
+
 	pthread_mutex_lock(&pool->mutex);
 
 	/*
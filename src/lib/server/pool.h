@@ -136,6 +136,12 @@ fr_pool_t	*fr_pool_init(TALLOC_CTX *ctx,
 			      char const *log_prefix);
 int		fr_pool_start(fr_pool_t *pool);
 
+void		fr_pool_start_async(fr_pool_t *pool);
+
+int		fr_pool_start_wait(fr_pool_t *pool);
+
+int		fr_pool_start_wait_all(void);
+
 fr_pool_t	*fr_pool_copy(TALLOC_CTX *ctx, fr_pool_t *pool, void *opaque);
 
 
@@ -570,6 +570,9 @@ struct tmpl_s {
 	tmpl_rules_t	_CONST		rules;	//!< The rules that were used when creating the tmpl.
 						///< These are useful for multiple resolution passes as
 						///< they ensure the correct parsing rules are applied.
+
+	fr_value_box_cast_t _CONST	cast_func;	//!< Function for the cast, selected by #tmpl_cast_set
+							///< when the source type is known.  May be NULL.
 };
 
 /** Describes the current extents of a pair tree in relation to the tree described by a tmpl_t
@@ -1022,7 +1022,8 @@ int tmpl_value_list_insert_tail(fr_value_box_list_t *list, fr_value_box_t *box,
 		return 0;
 	}
 
-	if (fr_value_box_cast_in_place(box, box, tmpl_rules_cast(vpt), tmpl_rules_enumv(vpt)) < 0) return -1;
+	if (fr_value_box_cast_in_place_with(box, box, vpt->cast_func ? vpt->cast_func : fr_value_box_cast,
+					    tmpl_rules_cast(vpt), tmpl_rules_enumv(vpt)) < 0) return -1;
 
 	fr_dlist_insert_tail(list, box);
 	return 0;
@@ -3209,6 +3209,7 @@ tmpl_t *tmpl_copy(TALLOC_CTX *ctx, tmpl_t const *in)
 
 	MEM(vpt = tmpl_alloc(ctx, in->type, in->quote, in->name, in->len));
 	vpt->rules = in->rules;
+	vpt->cast_func = in->cast_func;
 
 	/*
 	 *	Copy over the unescaped data
@@ -3327,7 +3328,7 @@ ssize_t tmpl_cast_from_substr(tmpl_rules_t *rules, fr_sbuff_t *in)
  */
 int tmpl_cast_set(tmpl_t *vpt, fr_type_t dst_type)
 {
-	fr_type_t src_type;
+	fr_type_t src_type = FR_TYPE_STRING;
 
 	switch (dst_type) {
 	default:
@@ -3387,6 +3388,7 @@ int tmpl_cast_set(tmpl_t *vpt, fr_type_t dst_type)
 	check_types:
 		if (src_type == dst_type) {
 			tmpl_rules_cast(vpt) = FR_TYPE_NULL;
+			vpt->cast_func = NULL;
 			return 0;
 		}
 
@@ -3401,6 +3403,12 @@ int tmpl_cast_set(tmpl_t *vpt, fr_type_t dst_type)
 
 done:
 	vpt->rules.cast = dst_type;
+
+	/*
+	 *	Look up the cast function now, so we don't have to
+	 *	at run-time.  xlats and execs produce strings.
+	 */
+	vpt->cast_func = fr_type_is_null(dst_type) ? NULL : fr_value_box_cast_select(dst_type, src_type);
 	return 0;
 }
 
@@ -1,10 +1,3 @@
-ifneq "$(OPENSSL_LIBS)" ""
-TARGET		:= libfreeradius-sim$(L)
-endif
-
-SOURCES	:= \
-	comp128.c \
-	milenage.c \
-	ts_34_108.c
-
-TGT_PREREQS	:= libfreeradius-util$(L)
+SUBMAKEFILES := \
+	libfreeradius-sim.mk \
+	milenage_tests.mk
@@ -61,45 +61,73 @@ static inline int aes_128_encrypt_block(EVP_CIPHER_CTX *evp_ctx,
 	return 0;
 }
 
-/** milenage_f1 - Milenage f1 and f1* algorithms
+/** Encrypt multiple blocks with an already keyed AES-128-ECB context
+ *
+ * Passing all the blocks in a single update lets OpenSSL's AES-NI/VAES
+ * ECB implementation keep several blocks in flight at once, instead of
+ * waiting for the result of each block before starting the next.
+ *
+ * @param[in] evp_ctx	keyed with #aes_128_ecb_init.
+ * @param[in] in	blocks to encrypt.
+ * @param[out] out	where to write the encrypted blocks.  May be the same as in.
+ * @param[in] num	Number of 16 byte blocks.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static inline int aes_128_encrypt_blocks(EVP_CIPHER_CTX *evp_ctx,
+					 uint8_t const *in, uint8_t *out, size_t num)
+{
+	int len = 0;
+
+	if (unlikely(EVP_EncryptUpdate(evp_ctx, out, &len, in, (int)(num * 16)) != 1) ||
+	    unlikely((size_t)len != (num * 16))) {
+		fr_tls_log_strerror_printf("Failed encrypting data");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Key an AES-128-ECB context for use with #aes_128_encrypt_blocks
+ *
+ */
+static inline int aes_128_ecb_init(EVP_CIPHER_CTX *evp_ctx, uint8_t const key[16])
+{
+	if (unlikely(EVP_EncryptInit_ex(evp_ctx, EVP_aes_128_ecb(), NULL, key, NULL) != 1)) {
+		fr_tls_log_strerror_printf("Failed initialising AES-128-ECB context");
+		return -1;
+	}
+	EVP_CIPHER_CTX_set_padding(evp_ctx, 0);
+
+	return 0;
+}
+
+/** Milenage f1 and f1* from a precomputed TEMP value
  *
+ * @param[out] mac_a	Buffer for MAC-A = 64-bit network authentication code, or NULL
+ * @param[out] mac_s	Buffer for MAC-S = 64-bit resync authentication code, or NULL
+ * @param[in] evp_ctx	to use for encryption.
  * @param[in] opc	128-bit value derived from OP and K.
  * @param[in] k		128-bit subscriber key.
- * @param[in] rand	128-bit random challenge.
+ * @param[in] temp	E_K(RAND XOR OP_C).
  * @param[in] sqn	48-bit sequence number.
  * @param[in] amf	16-bit authentication management field.
- * @param[out] mac_a	Buffer for MAC-A = 64-bit network authentication code, or NULL
- * @param[out] mac_s	Buffer for MAC-S = 64-bit resync authentication code, or NULL
  * @return
  *	- 0 on success.
  *	- -1 on failure.
  */
-static int milenage_f1(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
-		       uint8_t mac_s[MILENAGE_MAC_S_SIZE],
-		       uint8_t const opc[MILENAGE_OPC_SIZE],
-		       uint8_t const k[MILENAGE_KI_SIZE],
-		       uint8_t const rand[MILENAGE_RAND_SIZE],
-		       uint8_t const sqn[MILENAGE_SQN_SIZE],
-		       uint8_t const amf[MILENAGE_AMF_SIZE])
+static int milenage_f1_from_temp(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
+				 uint8_t mac_s[MILENAGE_MAC_S_SIZE],
+				 EVP_CIPHER_CTX *evp_ctx,
+				 uint8_t const opc[MILENAGE_OPC_SIZE],
+				 uint8_t const k[MILENAGE_KI_SIZE],
+				 uint8_t const temp[16],
+				 uint8_t const sqn[MILENAGE_SQN_SIZE],
+				 uint8_t const amf[MILENAGE_AMF_SIZE])
 {
 	uint8_t		tmp1[16], tmp2[16], tmp3[16];
 	int		i;
-	EVP_CIPHER_CTX	*evp_ctx;
-
-	/* tmp1 = TEMP = E_K(RAND XOR OP_C) */
-	for (i = 0; i < 16; i++) tmp1[i] = rand[i] ^ opc[i];
-
-	evp_ctx = EVP_CIPHER_CTX_new();
-	if (!evp_ctx) {
-		fr_tls_log_strerror_printf("Failed allocating EVP context");
-		return -1;
-	}
-
- 	if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp1) < 0) {
- 	error:
-		EVP_CIPHER_CTX_free(evp_ctx);
-		return -1;
- 	}
 
 	/* tmp2 = IN1 = SQN || AMF || SQN || AMF */
 	memcpy(tmp2, sqn, 6);
@@ -116,22 +144,65 @@ static int milenage_f1(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
 	/*
 	 *  XOR with TEMP = E_K(RAND XOR OP_C)
 	 */
-	for (i = 0; i < 16; i++) tmp3[i] ^= tmp1[i];
+	for (i = 0; i < 16; i++) tmp3[i] ^= temp[i];
 	/* XOR with c1 (= ..00, i.e., NOP) */
 
 	/*
 	 *	f1 || f1* = E_K(tmp3) XOR OP_c
 	 */
- 	if (aes_128_encrypt_block(evp_ctx, k, tmp3, tmp1) < 0) goto error; /* Reuses existing key */
+	if (aes_128_encrypt_block(evp_ctx, k, tmp3, tmp1) < 0) return -1;
 
 	for (i = 0; i < 16; i++) tmp1[i] ^= opc[i];
 
 	if (mac_a) memcpy(mac_a, tmp1, 8);	/* f1 */
 	if (mac_s) memcpy(mac_s, tmp1 + 8, 8);	/* f1* */
 
+	return 0;
+}
+
+/** milenage_f1 - Milenage f1 and f1* algorithms
+ *
+ * @param[in] opc	128-bit value derived from OP and K.
+ * @param[in] k		128-bit subscriber key.
+ * @param[in] rand	128-bit random challenge.
+ * @param[in] sqn	48-bit sequence number.
+ * @param[in] amf	16-bit authentication management field.
+ * @param[out] mac_a	Buffer for MAC-A = 64-bit network authentication code, or NULL
+ * @param[out] mac_s	Buffer for MAC-S = 64-bit resync authentication code, or NULL
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int milenage_f1(uint8_t mac_a[MILENAGE_MAC_A_SIZE],
+		       uint8_t mac_s[MILENAGE_MAC_S_SIZE],
+		       uint8_t const opc[MILENAGE_OPC_SIZE],
+		       uint8_t const k[MILENAGE_KI_SIZE],
+		       uint8_t const rand[MILENAGE_RAND_SIZE],
+		       uint8_t const sqn[MILENAGE_SQN_SIZE],
+		       uint8_t const amf[MILENAGE_AMF_SIZE])
+{
+	uint8_t		tmp1[16];
+	int		i, ret;
+	EVP_CIPHER_CTX	*evp_ctx;
+
+	/* tmp1 = TEMP = E_K(RAND XOR OP_C) */
+	for (i = 0; i < 16; i++) tmp1[i] = rand[i] ^ opc[i];
+
+	evp_ctx = EVP_CIPHER_CTX_new();
+	if (!evp_ctx) {
+		fr_tls_log_strerror_printf("Failed allocating EVP context");
+		return -1;
+	}
+
+	if (aes_128_encrypt_block(evp_ctx, k, tmp1, tmp1) < 0) {
+		EVP_CIPHER_CTX_free(evp_ctx);
+		return -1;
+	}
+
+	ret = milenage_f1_from_temp(mac_a, mac_s, evp_ctx, opc, k, tmp1, sqn, amf);
 	EVP_CIPHER_CTX_free(evp_ctx);
 
-	return 0;
+	return ret;
 }
 
 /** milenage_f2345 - Milenage f2, f3, f4, f5, f5* algorithms
@@ -230,6 +301,162 @@ static int milenage_f2345(uint8_t res[MILENAGE_RES_SIZE],
 	return 0;
 }
 
+/** Number of vectors processed per pass of #milenage_f2345_batch
+ *
+ * Bounds the amount of stack used for block buffers.
+ */
+#define MILENAGE_BATCH_CHUNK	32
+
+/** Run f2, f3, f4 and f5 for many RAND values under the same Ki
+ *
+ * The cipher context is keyed once, and the blocks for all vectors in the
+ * batch are passed to OpenSSL together.  First E_K(RAND XOR OPc) is computed
+ * for every vector, then the three blocks for f2/f5, f3 and f4 of every vector.
+ * This gives the AES-NI/VAES ECB implementation enough independent blocks to
+ * keep its pipeline full, instead of one block and a key schedule per call.
+ *
+ * f1 depends on SQN and AMF and is run later by #milenage_umts_from_precomp,
+ * which only needs one more block per vector.
+ *
+ * @param[in,out] vec	Array of vectors.  The rand field of each must be
+ *			populated, all other fields are written.
+ * @param[in] num	Number of vectors in the array.
+ * @param[in] opc	128-bit operator variant algorithm configuration field (encr.).
+ * @param[in] ki	128-bit subscriber key.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int milenage_f2345_batch(milenage_precomp_t vec[], size_t num,
+			 uint8_t const opc[MILENAGE_OPC_SIZE],
+			 uint8_t const ki[MILENAGE_KI_SIZE])
+{
+	uint8_t		blocks[MILENAGE_BATCH_CHUNK * 3][16];
+	uint8_t		tmp[16];
+	EVP_CIPHER_CTX	*evp_ctx;
+	size_t		base, n, i;
+	int		j, ret = -1;
+
+	evp_ctx = EVP_CIPHER_CTX_new();
+	if (!evp_ctx) {
+		fr_tls_log_strerror_printf("Failed allocating EVP context");
+		return -1;
+	}
+	if (aes_128_ecb_init(evp_ctx, ki) < 0) goto finish;
+
+	for (base = 0; base < num; base += n) {
+		milenage_precomp_t *v = &vec[base];
+
+		n = num - base;
+		if (n > MILENAGE_BATCH_CHUNK) n = MILENAGE_BATCH_CHUNK;
+
+		/* TEMP = E_K(RAND XOR OP_C) */
+		for (i = 0; i < n; i++) for (j = 0; j < 16; j++) blocks[i][j] = v[i].rand[j] ^ opc[j];
+
+		if (aes_128_encrypt_blocks(evp_ctx, blocks[0], blocks[0], n) < 0) goto finish;
+
+		/*
+		 *	Copy TEMP out before the blocks are
+		 *	reused for the next stage.
+		 */
+		for (i = 0; i < n; i++) memcpy(v[i].temp, blocks[i], sizeof(v[i].temp));
+
+		/*
+		 *	Same rotations and constants as milenage_f2345
+		 *	but written into consecutive blocks.
+		 */
+		for (i = 0; i < n; i++) {
+			uint8_t *f25 = blocks[(i * 3)], *f3 = blocks[(i * 3) + 1], *f4 = blocks[(i * 3) + 2];
+
+			for (j = 0; j < 16; j++) tmp[j] = v[i].temp[j] ^ opc[j];
+
+			/* f2 and f5, rotate by r2 (= 0, i.e., NOP) */
+			memcpy(f25, tmp, 16);
+			f25[15] ^= 1; /* XOR c2 (= ..01) */
+
+			/* f3, rotate by r3 = 0x20 = 4 bytes */
+			for (j = 0; j < 16; j++) f3[(j + 12) % 16] = tmp[j];
+			f3[15] ^= 2; /* XOR c3 (= ..02) */
+
+			/* f4, rotate by r4 = 0x40 = 8 bytes */
+			for (j = 0; j < 16; j++) f4[(j + 8) % 16] = tmp[j];
+			f4[15] ^= 4; /* XOR c4 (= ..04) */
+		}
+
+		if (aes_128_encrypt_blocks(evp_ctx, blocks[0], blocks[0], n * 3) < 0) goto finish;
+
+		for (i = 0; i < n; i++) {
+			uint8_t *f25 = blocks[(i * 3)], *f3 = blocks[(i * 3) + 1], *f4 = blocks[(i * 3) + 2];
+
+			for (j = 0; j < 16; j++) {
+				f25[j] ^= opc[j];
+				v[i].ck[j] = f3[j] ^ opc[j];
+				v[i].ik[j] = f4[j] ^ opc[j];
+			}
+			memcpy(v[i].res, f25 + 8, sizeof(v[i].res));	/* f2 */
+			memcpy(v[i].ak, f25, sizeof(v[i].ak));		/* f5 */
+		}
+	}
+	ret = 0;
+
+finish:
+	memset(blocks, 0, sizeof(blocks));
+	memset(tmp, 0, sizeof(tmp));
+	EVP_CIPHER_CTX_free(evp_ctx);
+
+	return ret;
+}
+
+/** Complete a UMTS quintuplet from the output of #milenage_f2345_batch
+ *
+ * Runs f1 for the given SQN and AMF, and builds AUTN.  RES, CK, IK and AK
+ * are taken directly from the precomputed vector.
+ *
+ * @param[out] autn	Buffer for AUTN = 128-bit authentication token.
+ * @param[in] vec	Precomputed vector, must have been generated with the same
+ *			opc and ki.
+ * @param[in] opc	128-bit operator variant algorithm configuration field (encr.).
+ * @param[in] amf	16-bit authentication management field.
+ * @param[in] ki	128-bit subscriber key.
+ * @param[in] sqn	48-bit sequence number (host byte order).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int milenage_umts_from_precomp(uint8_t autn[MILENAGE_AUTN_SIZE],
+			       milenage_precomp_t const *vec,
+			       uint8_t const opc[MILENAGE_OPC_SIZE],
+			       uint8_t const amf[MILENAGE_AMF_SIZE],
+			       uint8_t const ki[MILENAGE_KI_SIZE],
+			       uint64_t sqn)
+{
+	uint8_t		mac_a[MILENAGE_MAC_A_SIZE];
+	uint8_t		sqn_buff[MILENAGE_SQN_SIZE];
+	uint8_t		*p = autn;
+	EVP_CIPHER_CTX	*evp_ctx;
+	size_t		i;
+	int		ret;
+
+	evp_ctx = EVP_CIPHER_CTX_new();
+	if (!evp_ctx) {
+		fr_tls_log_strerror_printf("Failed allocating EVP context");
+		return -1;
+	}
+	ret = milenage_f1_from_temp(mac_a, NULL, evp_ctx, opc, ki, vec->temp, uint48_to_buff(sqn_buff, sqn), amf);
+	EVP_CIPHER_CTX_free(evp_ctx);
+	if (ret < 0) return -1;
+
+	/*
+	 *	AUTN = (SQN ^ AK) || AMF || MAC_A
+	 */
+	for (i = 0; i < sizeof(sqn_buff); i++) *p++ = sqn_buff[i] ^ vec->ak[i];
+	memcpy(p, amf, MILENAGE_AMF_SIZE);
+	p += MILENAGE_AMF_SIZE;
+	memcpy(p, mac_a, sizeof(mac_a));
+
+	return 0;
+}
+
 /** Derive OPc from OP and Ki
  *
  * @param[out] opc	The derived Operator Code used as an input to other Milenage
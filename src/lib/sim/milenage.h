@@ -19,6 +19,7 @@
  * @copyright 2006-2007 (j@w1.fi)
  */
 #include <stddef.h>
+#include <stdint.h>
 
 /*
  *	Inputs
@@ -46,6 +47,20 @@
 #define MILENAGE_SRES_SIZE	4
 #define MILENAGE_KC_SIZE	8
 
+/** Output of f2-f5 for one RAND, from which quintuplets and triplets are completed
+ *
+ * Everything here depends only on Ki, OPc and RAND, so it can be generated
+ * in bulk before the SQN and AMF of a particular authentication are known.
+ */
+typedef struct {
+	uint8_t		rand[MILENAGE_RAND_SIZE];	//!< Random challenge.  Input to #milenage_f2345_batch.
+	uint8_t		temp[16];			//!< E_K(RAND XOR OPc), the input to f1.
+	uint8_t		res[MILENAGE_RES_SIZE];		//!< f2.
+	uint8_t		ck[MILENAGE_CK_SIZE];		//!< f3.
+	uint8_t		ik[MILENAGE_IK_SIZE];		//!< f4.
+	uint8_t		ak[MILENAGE_AK_SIZE];		//!< f5.
+} milenage_precomp_t;
+
 int	milenage_opc_generate(uint8_t opc[MILENAGE_OPC_SIZE],
 			      uint8_t const op[MILENAGE_OP_SIZE],
 			      uint8_t const ki[MILENAGE_KI_SIZE]);
@@ -61,6 +76,17 @@ int	milenage_umts_generate(uint8_t autn[MILENAGE_AUTN_SIZE],
 			       uint64_t sqn,
 			       uint8_t const rand[MILENAGE_RAND_SIZE]);
 
+int	milenage_f2345_batch(milenage_precomp_t vec[], size_t num,
+			     uint8_t const opc[MILENAGE_OPC_SIZE],
+			     uint8_t const ki[MILENAGE_KI_SIZE]);
+
+int	milenage_umts_from_precomp(uint8_t autn[MILENAGE_AUTN_SIZE],
+				   milenage_precomp_t const *vec,
+				   uint8_t const opc[MILENAGE_OPC_SIZE],
+				   uint8_t const amf[MILENAGE_AMF_SIZE],
+				   uint8_t const ki[MILENAGE_KI_SIZE],
+				   uint64_t sqn);
+
 int	milenage_auts(uint64_t *sqn,
 		      uint8_t const opc[MILENAGE_OPC_SIZE],
 		      uint8_t const ki[MILENAGE_KI_SIZE],
@@ -0,0 +1,179 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for batch generation of Milenage vectors
+ *
+ * @file src/lib/sim/milenage_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/time.h>
+
+#include "milenage.c"
+
+static uint8_t const test_ki[]	= { 0x46, 0x5b, 0x5c, 0xe8, 0xb1, 0x99, 0xb4, 0x9f,
+				    0xaa, 0x5f, 0x0a, 0x2e, 0xe2, 0x38, 0xa6, 0xbc };
+static uint8_t const test_opc[]	= { 0xcd, 0x63, 0xcb, 0x71, 0x95, 0x4a, 0x9f, 0x4e,
+				    0x48, 0xa5, 0x99, 0x4e, 0x37, 0xa0, 0x2b, 0xaf };
+static uint8_t const test_amf[]	= { 0xb9, 0xb9 };
+
+/** Fill the RAND of each vector with a different, predictable, value
+ *
+ */
+static void test_rand_fill(milenage_precomp_t vec[], size_t num)
+{
+	size_t i, j;
+
+	memset(vec, 0, sizeof(*vec) * num);
+
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < sizeof(vec[i].rand); j++) vec[i].rand[j] = (uint8_t)((i * 31) + (j * 7));
+	}
+}
+
+/** Quintuplets generated in bulk must match those generated one at a time
+ *
+ */
+static void test_batch_umts(void)
+{
+	milenage_precomp_t	vec[MILENAGE_BATCH_CHUNK + 5];	/* Exercise a partial second pass */
+	uint64_t		sqn = 0xff9bb4d0b607;
+	size_t			i;
+
+	test_rand_fill(vec, NUM_ELEMENTS(vec));
+	TEST_ASSERT(milenage_f2345_batch(vec, NUM_ELEMENTS(vec), test_opc, test_ki) == 0);
+
+	for (i = 0; i < NUM_ELEMENTS(vec); i++) {
+		uint8_t autn[MILENAGE_AUTN_SIZE], ik[MILENAGE_IK_SIZE], ck[MILENAGE_CK_SIZE];
+		uint8_t ak[MILENAGE_AK_SIZE], res[MILENAGE_RES_SIZE];
+		uint8_t autn_batch[MILENAGE_AUTN_SIZE];
+
+		TEST_CASE("Single shot and batch generation produce the same quintuplet");
+		TEST_CHECK(milenage_umts_generate(autn, ik, ck, ak, res, test_opc, test_amf, test_ki,
+						  sqn + i, vec[i].rand) == 0);
+		TEST_CHECK(milenage_umts_from_precomp(autn_batch, &vec[i], test_opc, test_amf, test_ki, sqn + i) == 0);
+
+		TEST_CHECK(memcmp(autn_batch, autn, sizeof(autn)) == 0);
+		TEST_MSG("AUTN of vector %zu differs", i);
+		TEST_CHECK(memcmp(vec[i].ik, ik, sizeof(ik)) == 0);
+		TEST_MSG("IK of vector %zu differs", i);
+		TEST_CHECK(memcmp(vec[i].ck, ck, sizeof(ck)) == 0);
+		TEST_MSG("CK of vector %zu differs", i);
+		TEST_CHECK(memcmp(vec[i].ak, ak, sizeof(ak)) == 0);
+		TEST_MSG("AK of vector %zu differs", i);
+		TEST_CHECK(memcmp(vec[i].res, res, sizeof(res)) == 0);
+		TEST_MSG("RES of vector %zu differs", i);
+	}
+}
+
+/** COMP128-4 triplets generated in bulk must match those generated one at a time
+ *
+ */
+static void test_batch_gsm(void)
+{
+	milenage_precomp_t	vec[MILENAGE_BATCH_CHUNK + 5];
+	size_t			i;
+
+	test_rand_fill(vec, NUM_ELEMENTS(vec));
+	TEST_ASSERT(milenage_f2345_batch(vec, NUM_ELEMENTS(vec), test_opc, test_ki) == 0);
+
+	for (i = 0; i < NUM_ELEMENTS(vec); i++) {
+		uint8_t sres[MILENAGE_SRES_SIZE], kc[MILENAGE_KC_SIZE];
+		uint8_t sres_batch[MILENAGE_SRES_SIZE], kc_batch[MILENAGE_KC_SIZE];
+
+		TEST_CASE("Single shot and batch generation produce the same triplet");
+		TEST_CHECK(milenage_gsm_generate(sres, kc, test_opc, test_ki, vec[i].rand) == 0);
+		milenage_gsm_from_umts(sres_batch, kc_batch, vec[i].ik, vec[i].ck, vec[i].res);
+
+		TEST_CHECK(memcmp(sres_batch, sres, sizeof(sres)) == 0);
+		TEST_MSG("SRES of vector %zu differs", i);
+		TEST_CHECK(memcmp(kc_batch, kc, sizeof(kc)) == 0);
+		TEST_MSG("Kc of vector %zu differs", i);
+	}
+}
+
+/** A batch of one, as generated for a subscriber the pool hasn't seen before
+ *
+ */
+static void test_batch_single(void)
+{
+	milenage_precomp_t	vec[1];
+	uint8_t			autn[MILENAGE_AUTN_SIZE], ik[MILENAGE_IK_SIZE], ck[MILENAGE_CK_SIZE];
+	uint8_t			ak[MILENAGE_AK_SIZE], res[MILENAGE_RES_SIZE];
+	uint8_t			autn_batch[MILENAGE_AUTN_SIZE];
+
+	test_rand_fill(vec, NUM_ELEMENTS(vec));
+	TEST_ASSERT(milenage_f2345_batch(vec, NUM_ELEMENTS(vec), test_opc, test_ki) == 0);
+
+	TEST_CHECK(milenage_umts_generate(autn, ik, ck, ak, res, test_opc, test_amf, test_ki, 1, vec[0].rand) == 0);
+	TEST_CHECK(milenage_umts_from_precomp(autn_batch, &vec[0], test_opc, test_amf, test_ki, 1) == 0);
+
+	TEST_CHECK(memcmp(autn_batch, autn, sizeof(autn)) == 0);
+	TEST_CHECK(memcmp(vec[0].res, res, sizeof(res)) == 0);
+}
+
+/** Compare vectors/s for single shot and batch generation
+ *
+ */
+static void test_batch_speed(void)
+{
+	milenage_precomp_t	vec[MILENAGE_BATCH_CHUNK];
+	uint8_t			autn[MILENAGE_AUTN_SIZE], ik[MILENAGE_IK_SIZE], ck[MILENAGE_CK_SIZE];
+	uint8_t			ak[MILENAGE_AK_SIZE], res[MILENAGE_RES_SIZE];
+	int			reps = 2000;
+	int			i;
+	size_t			j;
+	fr_time_t		start;
+	fr_time_delta_t		single, batch;
+
+	test_rand_fill(vec, NUM_ELEMENTS(vec));
+
+	start = fr_time();
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < NUM_ELEMENTS(vec); j++) {
+			if (milenage_umts_generate(autn, ik, ck, ak, res,
+						   test_opc, test_amf, test_ki, (uint64_t)i, vec[j].rand) < 0) TEST_CHECK(0);
+		}
+	}
+	single = fr_time_sub(fr_time(), start);
+
+	start = fr_time();
+	for (i = 0; i < reps; i++) {
+		if (milenage_f2345_batch(vec, NUM_ELEMENTS(vec), test_opc, test_ki) < 0) TEST_CHECK(0);
+		for (j = 0; j < NUM_ELEMENTS(vec); j++) {
+			if (milenage_umts_from_precomp(autn, &vec[j], test_opc, test_amf, test_ki, (uint64_t)i) < 0) {
+				TEST_CHECK(0);
+			}
+		}
+	}
+	batch = fr_time_sub(fr_time(), start);
+
+	TEST_MSG_ALWAYS("vectors=%zu", reps * NUM_ELEMENTS(vec));
+	TEST_MSG_ALWAYS("single_per_sec=%0.0lf",
+			(reps * NUM_ELEMENTS(vec)) / (fr_time_delta_unwrap(single) / (double)NSEC));
+	TEST_MSG_ALWAYS("batch_per_sec=%0.0lf",
+			(reps * NUM_ELEMENTS(vec)) / (fr_time_delta_unwrap(batch) / (double)NSEC));
+}
+
+TEST_LIST = {
+	{ "batch_umts",		test_batch_umts },
+	{ "batch_gsm",		test_batch_gsm },
+	{ "batch_single",	test_batch_single },
+	{ "batch_speed",	test_batch_speed },
+
+	{ NULL }
+};
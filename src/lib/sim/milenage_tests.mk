@@ -0,0 +1,9 @@
+ifneq ($(OPENSSL_LIBS),)
+TARGET		:= milenage_tests$(E)
+endif
+
+SOURCES		:= milenage_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L) libfreeradius-tls$(L)
@@ -222,12 +222,14 @@ static int tls_cache_app_data_set(request_t *request, SSL_SESSION *sess)
 	return 0;
 }
 
-static int tls_cache_app_data_get(request_t *request, SSL_SESSION *sess)
+static int tls_cache_app_data_get(request_t *request, fr_tls_session_t *tls_session, SSL_SESSION *sess)
 {
 	uint8_t			*data;
 	size_t			data_len;
 	fr_dbuff_t		dbuff;
 	fr_pair_list_t		tmp;
+	fr_pair_list_t		*state_pairs;
+	TALLOC_CTX		*state_ctx;
 
 	/*
 	 *	Extract the session-state list from the ticket.
@@ -239,6 +241,8 @@ static int tls_cache_app_data_get(request_t *request, SSL_SESSION *sess)
 		return -1;
 	}
 
+	state_pairs = fr_tls_session_state_pairs(&state_ctx, tls_session, request);
+
 	fr_pair_list_init(&tmp);
 	fr_dbuff_init(&dbuff, data, data_len);
 
@@ -251,7 +255,7 @@ static int tls_cache_app_data_get(request_t *request, SSL_SESSION *sess)
 	 *	or disallow session resumption.
 	 */
 	while (fr_dbuff_remaining(&dbuff) > 0) {
-		if (fr_internal_decode_pair_dbuff(request->session_state_ctx, &tmp,
+		if (fr_internal_decode_pair_dbuff(state_ctx, &tmp,
 					    	  fr_dict_root(request->dict), &dbuff, NULL) < 0) {
 			SESSION_ID(sess_id, sess);
 
@@ -270,7 +274,7 @@ static int tls_cache_app_data_get(request_t *request, SSL_SESSION *sess)
 		REXDENT();
 	}
 
-	fr_pair_list_append(&request->session_state_pairs, &tmp);
+	fr_pair_list_append(state_pairs, &tmp);
 
 	return 0;
 }
@@ -283,6 +287,7 @@ static void tls_cache_delete_request(SSL_SESSION *sess)
 {
 	fr_tls_session_t	*tls_session;
 	fr_tls_cache_t		*tls_cache;
+	fr_tls_conf_t		*conf;
 	request_t		*request;
 
 	tls_session = talloc_get_type_abort(SSL_SESSION_get_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION), fr_tls_session_t);
@@ -310,6 +315,22 @@ static void tls_cache_delete_request(SSL_SESSION *sess)
 
 	RDEBUG3("Session ID %pV - Requested session clear", fr_box_octets_buffer(tls_cache->clear.id));
 
+	/*
+	 *	Removing the session from the in-memory
+	 *	store doesn't need to yield, so do it now.
+	 */
+	conf = fr_tls_session_conf(tls_session->ssl);
+	if (conf->cache.store) {
+		fr_tls_cache_store_remove(conf->cache.store,
+					  tls_cache->clear.id, talloc_array_length(tls_cache->clear.id));
+
+		if (!conf->cache.session_sections) {
+			TALLOC_FREE(tls_cache->clear.id);
+			if (tls_session->session == sess) tls_session->session = NULL;
+			return;
+		}
+	}
+
 	tls_cache->clear.state = FR_TLS_CACHE_CLEAR_REQUESTED;
 
 	/*
@@ -344,6 +365,7 @@ static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSE
 {
 	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
 	fr_tls_cache_t		*tls_cache = tls_session->cache;
+	fr_tls_conf_t		*conf;
 	fr_pair_t		*vp;
 	uint8_t const		*q, **p;
 	SSL_SESSION		*sess;
@@ -390,12 +412,79 @@ static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSE
 	 */
 	SSL_SESSION_set_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION, fr_tls_session(tls_session->ssl));
 
+	/*
+	 *	Populate the in-memory store so the next
+	 *	lookup for this session doesn't need to
+	 *	call the virtual server.
+	 */
+	conf = fr_tls_session_conf(tls_session->ssl);
+	if (conf->cache.store) {
+		(void) fr_tls_cache_store_insert(conf->cache.store, tls_cache->load.id,
+						 talloc_array_length(tls_cache->load.id),
+						 vp->vp_octets, vp->vp_length,
+						 fr_unix_time_from_sec(SSL_SESSION_get_time(sess) +
+								       SSL_SESSION_get_timeout(sess)));
+	}
+
 	tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
 	tls_cache->load.sess = sess;	/* This is consumed in tls_cache_load_cb */
 
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
+/** Retrieve a session from the shared in-memory store
+ *
+ * @param[in] request		The current request.
+ * @param[in] conf		TLS configuration.
+ * @param[in] tls_session	The current TLS session.
+ * @param[in] key		Session ID to load.
+ * @param[in] key_len		Length of the session ID.
+ * @return
+ *	- The deserialized session.
+ *	- NULL if no session was found, or it couldn't be deserialized.
+ */
+static SSL_SESSION *tls_cache_memory_load(request_t *request, fr_tls_conf_t *conf, fr_tls_session_t *tls_session,
+					 uint8_t const *key, size_t key_len)
+{
+	uint8_t			*data;
+	uint8_t const		*q, **p;
+	SSL_SESSION		*sess;
+
+	data = fr_tls_cache_store_find(NULL, conf->cache.store, key, key_len);
+	if (!data) return NULL;
+
+	q = data;	/* openssl will mutate q, so we can't use data directly */
+	p = (unsigned char const **)&q;
+
+	sess = d2i_SSL_SESSION(NULL, p, talloc_array_length(data));
+	if (!sess) {
+		fr_tls_log_error(request, "Failed loading session from in-memory store");
+		talloc_free(data);
+
+		/*
+		 *	Don't try it again
+		 */
+		fr_tls_cache_store_remove(conf->cache.store, key, key_len);
+		return NULL;
+	}
+
+	if (RDEBUG_ENABLED3) {
+		SESSION_ID(sess_id, sess);
+
+		RDEBUG3("Session ID %pV - Read %zu bytes of data from in-memory store.  "
+			"Session de-serialized successfully", &sess_id, talloc_array_length(data));
+		SSL_SESSION_print(fr_tls_request_log_bio(request, L_DBG, L_DBG_LVL_3), sess);
+	}
+	talloc_free(data);
+
+	/*
+	 *	So the session can be found in tls_cache_delete_cb.
+	 */
+	SSL_SESSION_set_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION, tls_session);
+
+	return sess;
+}
+
 /** Push a `session load { ... }` call into the current request, using a subrequest
  *
  * @param[in] request		The current request.
@@ -470,6 +559,10 @@ static unlang_action_t tls_cache_store_result(UNUSED rlm_rcode_t *p_result, UNUS
 }
 
 /** Push a `session store { ... }` call into the current request, using a subrequest
+ *
+ * If the shared in-memory store is enabled the session is added to it
+ * first.  The subrequest is only pushed if the virtual server has
+ * `session { ... }` sections.
  *
  * @param[in] request		The current request.
  * @param[in] conf		TLS configuration.
@@ -511,29 +604,6 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	 */
 	if (tls_cache_app_data_set(request, sess) < 0) return UNLANG_ACTION_FAIL;
 
-	MEM(child = unlang_subrequest_alloc(request, dict_tls));
-	request = child;
-
-	/*
-	 *	Setup the child request for storing
-	 *	session resumption data.
-	 */
-	MEM(pair_prepend_request(&vp, attr_tls_packet_type) >= 0);
-	vp->vp_uint32 = enum_tls_packet_type_store_session->vb_uint32;
-
-	/*
-	 *	Add the session identifier we're trying
-	 *	to store.
-	 */
-	MEM(pair_update_request(&vp, attr_tls_session_id) >= 0);
-	fr_pair_value_memdup_buffer_shallow(vp, fr_tls_cache_id(vp, sess), true);
-
-	/*
-	 *	How long the session has to live
-	 */
-	MEM(pair_update_request(&vp, attr_tls_session_ttl) >= 0);
-	vp->vp_time_delta = fr_time_sub(expires, now);
-
 	/*
 	 *	Serialize the session
 	 */
@@ -548,12 +618,10 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 			 "required buffer length", &id);
 	error:
 		tls_cache_store_state_reset(request, tls_cache);
-		talloc_free(child);
 		return UNLANG_ACTION_FAIL;
 	}
 
-	MEM(pair_update_request(&vp, attr_tls_session_data) >= 0);
-	MEM(data = talloc_array(vp, uint8_t, len));
+	MEM(data = talloc_array(NULL, uint8_t, len));
 
 	/* openssl mutates &p */
 	p = data;
@@ -567,6 +635,59 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 		talloc_free(data);
 		goto error;
 	}
+
+	/*
+	 *	Add the session to the shared in-memory
+	 *	store.  This doesn't need to yield.
+	 */
+	if (conf->cache.store) {
+		fr_value_box_t	id;
+		fr_tls_cache_id_to_box_shallow(&id, sess);
+
+		if (fr_tls_cache_store_insert(conf->cache.store, id.vb_octets, id.vb_length, data, len,
+					      fr_unix_time_from_sec(SSL_SESSION_get_time(sess) +
+								    SSL_SESSION_get_timeout(sess))) < 0) {
+			RWDEBUG("Session ID %pV - Failed adding session to in-memory store", &id);
+		} else {
+			RDEBUG3("Session ID %pV - Added session to in-memory store", &id);
+		}
+
+		/*
+		 *	Nothing more to do
+		 */
+		if (!conf->cache.session_sections) {
+			talloc_free(data);
+			tls_cache_store_state_reset(request, tls_cache);
+			tls_cache->store.state = FR_TLS_CACHE_STORE_PERSISTED;	/* Avoid spurious clear calls */
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+	}
+
+	MEM(child = unlang_subrequest_alloc(request, dict_tls));
+	request = child;
+
+	/*
+	 *	Setup the child request for storing
+	 *	session resumption data.
+	 */
+	MEM(pair_prepend_request(&vp, attr_tls_packet_type) >= 0);
+	vp->vp_uint32 = enum_tls_packet_type_store_session->vb_uint32;
+
+	/*
+	 *	Add the session identifier we're trying
+	 *	to store.
+	 */
+	MEM(pair_update_request(&vp, attr_tls_session_id) >= 0);
+	fr_pair_value_memdup_buffer_shallow(vp, fr_tls_cache_id(vp, sess), true);
+
+	/*
+	 *	How long the session has to live
+	 */
+	MEM(pair_update_request(&vp, attr_tls_session_ttl) >= 0);
+	vp->vp_time_delta = fr_time_sub(expires, now);
+
+	MEM(pair_update_request(&vp, attr_tls_session_data) >= 0);
+	talloc_steal(vp, data);
 	fr_pair_value_memdup_buffer_shallow(vp, data, true);
 
 	/*
@@ -574,7 +695,11 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	 *      the TLS virtual server.
 	 */
 	ua = fr_tls_call_push(child, tls_cache_store_result, conf, tls_session);
-	if (ua < 0) goto error;
+	if (ua < 0) {
+		tls_cache_store_state_reset(request, tls_cache);
+		talloc_free(child);
+		return UNLANG_ACTION_FAIL;
+	}
 
 	return ua;
 }
@@ -771,11 +896,13 @@ static SSL_SESSION *tls_cache_load_cb(SSL *ssl,
 {
 	fr_tls_session_t	*tls_session;
 	fr_tls_cache_t		*tls_cache;
+	fr_tls_conf_t		*conf;
 	request_t		*request;
 
 	tls_session = fr_tls_session(ssl);
 	request = fr_tls_session_request(tls_session->ssl);
 	tls_cache = tls_session->cache;
+	conf = fr_tls_session_conf(tls_session->ssl);
 
 	/*
 	 *	Request was cancelled, don't return any session and hopefully
@@ -806,6 +933,29 @@ again:
 	case FR_TLS_CACHE_LOAD_INIT:
 		fr_assert(!tls_cache->load.id);
 
+		/*
+		 *	Check the shared in-memory store first.
+		 *	This doesn't need to yield, so on a hit
+		 *	we can move straight to validating the
+		 *	session.
+		 */
+		if (conf->cache.store) {
+			tls_cache->load.sess = tls_cache_memory_load(request, conf, tls_session, key, key_len);
+			if (tls_cache->load.sess) {
+				MEM(tls_cache->load.id = talloc_typed_memdup(tls_cache, (uint8_t const *)key, key_len));
+				tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
+				goto again;
+			}
+
+			/*
+			 *	Nowhere else to look
+			 */
+			if (!conf->cache.session_sections) {
+				RDEBUG3("Session ID %pV - Not found", fr_box_octets(key, key_len));
+				return NULL;
+			}
+		}
+
 		tls_cache->load.state = FR_TLS_CACHE_LOAD_REQUESTED;
 		MEM(tls_cache->load.id = talloc_typed_memdup(tls_cache, (uint8_t const *)key, key_len));
 
@@ -868,7 +1018,7 @@ again:
 		 *	peer's certificate chain, and so isn't reliable
 		 *	for performing re-validation.
 		 */
-		if (tls_cache_app_data_get(request, tls_cache->load.sess) < 0) {
+		if (tls_cache_app_data_get(request, tls_session, tls_cache->load.sess) < 0) {
 			REDEBUG("Denying session resumption via session-id");
 		verify_error:
 			/*
@@ -1292,7 +1442,7 @@ static SSL_TICKET_RETURN tls_cache_session_ticket_app_data_get(SSL *ssl, SSL_SES
 	 *	peer's certificate chain, and so isn't reliable
 	 *	for performing re-validation.
 	 */
-	if (tls_cache_app_data_get(request, sess) < 0) {
+	if (tls_cache_app_data_get(request, tls_session, sess) < 0) {
 		REDEBUG("Denying session resumption via session-ticket");
 		return SSL_TICKET_RETURN_IGNORE_RENEW;
 	}
@@ -0,0 +1,597 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/cache_store.c
+ * @brief In-memory store for stateful session-resumption data, shared by all workers.
+ *
+ * Each worker has its own SSL_CTX, so OpenSSL's internal session cache
+ * can't be used to resume a session which was established by a different
+ * worker.  Without this store the only option is to call the
+ * `session { load / store / clear }` sections of the TLS virtual server,
+ * which is flexible, but expensive for what's usually a simple key/value
+ * lookup.
+ *
+ * The store is split into #FR_TLS_CACHE_STORE_STRIPES partitions, each
+ * with its own mutex, hash table and LRU list.  The partition is selected
+ * by hashing the session ID, so workers resuming different sessions rarely
+ * contend for the same lock.
+ *
+ * Entries are expired lazily, either when they're looked up, or when
+ * they reach the tail of the LRU list during an insert.  If the partition
+ * is full the least recently used entry is evicted.
+ *
+ * If a filename is provided, the contents of the store are read when it's
+ * allocated, and written out again when it's freed, so that sessions
+ * can be resumed across server restarts.  The file isn't touched when
+ * we're only checking the configuration.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls"
+
+#include <freeradius-devel/server/cf_parse.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include "cache_store.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/** Identifies a session store file
+ *
+ */
+#define CACHE_STORE_MAGIC	"FRTLSC01"
+#define CACHE_STORE_MAGIC_LEN	(sizeof(CACHE_STORE_MAGIC) - 1)
+
+/** ID length, data length, expiry time
+ *
+ */
+#define CACHE_STORE_HDR_LEN	(sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint64_t))
+
+/** Session data for a single session ID
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the stripe's LRU list.
+	fr_unix_time_t		expires;	//!< When the session can no longer be resumed.
+	uint8_t const		*id;		//!< Session ID.
+	size_t			id_len;		//!< Length of the session ID.
+	uint8_t			*data;		//!< DER encoded SSL_SESSION.
+} tls_cache_store_entry_t;
+
+/** A single, independently locked, partition of the store
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects everything in the stripe.
+	TALLOC_CTX		*ctx;		//!< Entries are allocated from here.
+	fr_hash_table_t		*ht;		//!< Entries indexed by session ID.
+	fr_dlist_head_t		lru;		//!< Most recently used at the head.
+	uint32_t		max_entries;	//!< Maximum entries in this stripe.
+
+	fr_tls_cache_store_stats_t stats;	//!< Counters for this stripe.
+} tls_cache_store_stripe_t;
+
+struct fr_tls_cache_store_s {
+	char const		*name;		//!< Used for logging and radmin.
+	char const		*filename;	//!< Where to persist the sessions, may be NULL.
+
+	tls_cache_store_stripe_t stripe[FR_TLS_CACHE_STORE_STRIPES];
+};
+
+static uint32_t tls_cache_store_entry_hash(void const *data)
+{
+	tls_cache_store_entry_t const *entry = data;
+
+	return fr_hash(entry->id, entry->id_len);
+}
+
+static int8_t tls_cache_store_entry_cmp(void const *one, void const *two)
+{
+	tls_cache_store_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->id_len, b->id_len);
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->id, b->id, a->id_len);
+	return CMP(ret, 0);
+}
+
+static inline CC_HINT(always_inline)
+tls_cache_store_stripe_t *tls_cache_store_stripe(fr_tls_cache_store_t *store, uint8_t const *id, size_t id_len)
+{
+	return &store->stripe[fr_hash(id, id_len) & (FR_TLS_CACHE_STORE_STRIPES - 1)];
+}
+
+/** Unlink an entry from its stripe and free it
+ *
+ * @note Stripe must be locked.
+ */
+static inline CC_HINT(always_inline)
+void tls_cache_store_entry_free(tls_cache_store_stripe_t *stripe, tls_cache_store_entry_t *entry)
+{
+	fr_hash_table_remove(stripe->ht, entry);
+	fr_dlist_remove(&stripe->lru, entry);
+	talloc_free(entry);
+}
+
+/** Add an entry to a stripe, replacing any existing entry with the same ID
+ *
+ * @note Stripe must be locked.
+ */
+static int tls_cache_store_stripe_insert(tls_cache_store_stripe_t *stripe,
+					 uint8_t const *id, size_t id_len,
+					 uint8_t const *data, size_t data_len,
+					 fr_unix_time_t expires, fr_unix_time_t now)
+{
+	tls_cache_store_entry_t *entry, *old;
+
+	old = fr_hash_table_find(stripe->ht, &(tls_cache_store_entry_t){ .id = id, .id_len = id_len });
+	if (old) tls_cache_store_entry_free(stripe, old);
+
+	/*
+	 *	Prune any expired entries from the tail,
+	 *	then evict until there's space for the
+	 *	new one.
+	 */
+	while ((old = fr_dlist_tail(&stripe->lru))) {
+		if (fr_unix_time_lteq(old->expires, now)) {
+			stripe->stats.expired++;
+		} else if (fr_dlist_num_elements(&stripe->lru) >= stripe->max_entries) {
+			stripe->stats.evictions++;
+		} else {
+			break;
+		}
+		tls_cache_store_entry_free(stripe, old);
+	}
+
+	MEM(entry = talloc(stripe->ctx, tls_cache_store_entry_t));
+	*entry = (tls_cache_store_entry_t){
+		.expires = expires,
+		.id_len = id_len
+	};
+	MEM(entry->id = talloc_memdup(entry, id, id_len));
+	MEM(entry->data = talloc_memdup(entry, data, data_len));
+
+	if (!fr_hash_table_insert(stripe->ht, entry)) {
+		talloc_free(entry);
+		return -1;
+	}
+	fr_dlist_insert_head(&stripe->lru, entry);
+	stripe->stats.inserts++;
+
+	return 0;
+}
+
+/** Add session data to the store
+ *
+ * @param[in] store	to add the session to.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ * @param[in] data	DER encoded session.
+ * @param[in] data_len	Length of the DER encoded session.
+ * @param[in] expires	When the session can no longer be resumed.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_tls_cache_store_insert(fr_tls_cache_store_t *store,
+			      uint8_t const *id, size_t id_len,
+			      uint8_t const *data, size_t data_len, fr_unix_time_t expires)
+{
+	tls_cache_store_stripe_t	*stripe = tls_cache_store_stripe(store, id, id_len);
+	int				ret;
+
+	pthread_mutex_lock(&stripe->mutex);
+	ret = tls_cache_store_stripe_insert(stripe, id, id_len, data, data_len,
+					    expires, fr_time_to_unix_time(fr_time()));
+	pthread_mutex_unlock(&stripe->mutex);
+
+	return ret;
+}
+
+/** Retrieve a copy of the session data for an ID
+ *
+ * @param[in] ctx	to allocate the copy in.
+ * @param[in] store	to search.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ * @return
+ *	- A copy of the DER encoded session.
+ *	- NULL if no valid session was found.
+ */
+uint8_t *fr_tls_cache_store_find(TALLOC_CTX *ctx, fr_tls_cache_store_t *store, uint8_t const *id, size_t id_len)
+{
+	tls_cache_store_stripe_t	*stripe = tls_cache_store_stripe(store, id, id_len);
+	tls_cache_store_entry_t		*entry;
+	uint8_t				*data = NULL;
+
+	pthread_mutex_lock(&stripe->mutex);
+	stripe->stats.lookups++;
+
+	entry = fr_hash_table_find(stripe->ht, &(tls_cache_store_entry_t){ .id = id, .id_len = id_len });
+	if (!entry) {
+		stripe->stats.misses++;
+		goto done;
+	}
+
+	if (fr_unix_time_lteq(entry->expires, fr_time_to_unix_time(fr_time()))) {
+		stripe->stats.expired++;
+		stripe->stats.misses++;
+		tls_cache_store_entry_free(stripe, entry);
+		goto done;
+	}
+
+	/*
+	 *	Move to the head of the LRU list
+	 */
+	fr_dlist_remove(&stripe->lru, entry);
+	fr_dlist_insert_head(&stripe->lru, entry);
+
+	MEM(data = talloc_memdup(ctx, entry->data, talloc_array_length(entry->data)));
+	talloc_set_type(data, uint8_t);
+	stripe->stats.hits++;
+
+done:
+	pthread_mutex_unlock(&stripe->mutex);
+
+	return data;
+}
+
+/** Remove the session data for an ID
+ *
+ * @param[in] store	to remove the session from.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ */
+void fr_tls_cache_store_remove(fr_tls_cache_store_t *store, uint8_t const *id, size_t id_len)
+{
+	tls_cache_store_stripe_t	*stripe = tls_cache_store_stripe(store, id, id_len);
+	tls_cache_store_entry_t		*entry;
+
+	pthread_mutex_lock(&stripe->mutex);
+	entry = fr_hash_table_find(stripe->ht, &(tls_cache_store_entry_t){ .id = id, .id_len = id_len });
+	if (entry) {
+		stripe->stats.removes++;
+		tls_cache_store_entry_free(stripe, entry);
+	}
+	pthread_mutex_unlock(&stripe->mutex);
+}
+
+/** Sum the counters from all stripes
+ *
+ * @param[out] stats	Where to write the totals.
+ * @param[in] store	to retrieve stats for.
+ */
+void fr_tls_cache_store_stats(fr_tls_cache_store_stats_t *stats, fr_tls_cache_store_t *store)
+{
+	size_t i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < FR_TLS_CACHE_STORE_STRIPES; i++) {
+		tls_cache_store_stripe_t *stripe = &store->stripe[i];
+
+		pthread_mutex_lock(&stripe->mutex);
+		stats->lookups += stripe->stats.lookups;
+		stats->hits += stripe->stats.hits;
+		stats->misses += stripe->stats.misses;
+		stats->expired += stripe->stats.expired;
+		stats->inserts += stripe->stats.inserts;
+		stats->evictions += stripe->stats.evictions;
+		stats->removes += stripe->stats.removes;
+		stats->entries += fr_dlist_num_elements(&stripe->lru);
+		pthread_mutex_unlock(&stripe->mutex);
+	}
+}
+
+/** Write all unexpired sessions to the store's file
+ *
+ * The file is written to a temporary location, and then renamed
+ * over the original, so a crash won't leave a partial file.
+ *
+ * @param[in] store	to persist.
+ * @return
+ *	- 0 on success, or if there's no filename.
+ *	- -1 on failure.
+ */
+int fr_tls_cache_store_persist(fr_tls_cache_store_t *store)
+{
+	FILE			*fp;
+	int			fd;
+	char			*tmp;
+	size_t			i;
+	uint64_t		written = 0;
+	fr_unix_time_t		now = fr_time_to_unix_time(fr_time());
+
+	if (!store->filename) return 0;
+
+	MEM(tmp = talloc_asprintf(NULL, "%s.tmp", store->filename));
+
+	/*
+	 *	The file contains master secrets, so
+	 *	only we should be able to read it.
+	 */
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+	fp = (fd < 0) ? NULL : fdopen(fd, "w");
+	if (!fp) {
+		ERROR("Session cache \"%s\" - Failed opening %s: %s", store->name, tmp, fr_syserror(errno));
+		if (fd >= 0) close(fd);
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if (fwrite(CACHE_STORE_MAGIC, CACHE_STORE_MAGIC_LEN, 1, fp) != 1) {
+	error:
+		ERROR("Session cache \"%s\" - Failed writing %s: %s", store->name, tmp, fr_syserror(errno));
+		fclose(fp);
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+
+	for (i = 0; i < FR_TLS_CACHE_STORE_STRIPES; i++) {
+		tls_cache_store_stripe_t	*stripe = &store->stripe[i];
+		tls_cache_store_entry_t		*entry = NULL;
+
+		pthread_mutex_lock(&stripe->mutex);
+		while ((entry = fr_dlist_next(&stripe->lru, entry))) {
+			uint8_t hdr[CACHE_STORE_HDR_LEN];
+
+			if (fr_unix_time_lteq(entry->expires, now)) continue;
+
+			fr_nbo_from_uint16(hdr, entry->id_len);
+			fr_nbo_from_uint32(hdr + 2, talloc_array_length(entry->data));
+			fr_nbo_from_uint64(hdr + 6, fr_unix_time_unwrap(entry->expires));
+
+			if ((fwrite(hdr, sizeof(hdr), 1, fp) != 1) ||
+			    (fwrite(entry->id, entry->id_len, 1, fp) != 1) ||
+			    (fwrite(entry->data, talloc_array_length(entry->data), 1, fp) != 1)) {
+				pthread_mutex_unlock(&stripe->mutex);
+				goto error;
+			}
+			written++;
+		}
+		pthread_mutex_unlock(&stripe->mutex);
+	}
+
+	if (fclose(fp) != 0) {
+		ERROR("Session cache \"%s\" - Failed writing %s: %s", store->name, tmp, fr_syserror(errno));
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if (rename(tmp, store->filename) < 0) {
+		ERROR("Session cache \"%s\" - Failed renaming %s to %s: %s",
+		      store->name, tmp, store->filename, fr_syserror(errno));
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+	talloc_free(tmp);
+
+	DEBUG2("Session cache \"%s\" - Wrote %" PRIu64 " sessions to %s", store->name, written, store->filename);
+
+	return 0;
+}
+
+/** Read sessions from the store's file
+ *
+ * Expired sessions are skipped.  A truncated file is not an error, we
+ * just keep whatever we managed to read.
+ */
+static int tls_cache_store_load(fr_tls_cache_store_t *store)
+{
+	FILE		*fp;
+	uint8_t		magic[CACHE_STORE_MAGIC_LEN];
+	uint8_t		hdr[CACHE_STORE_HDR_LEN];
+	uint8_t		*buff = NULL;
+	uint64_t	loaded = 0;
+	fr_unix_time_t	now = fr_time_to_unix_time(fr_time());
+
+	fp = fopen(store->filename, "r");
+	if (!fp) {
+		if (errno == ENOENT) return 0;
+
+		ERROR("Session cache \"%s\" - Failed opening %s: %s", store->name, store->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if ((fread(magic, sizeof(magic), 1, fp) != 1) || (memcmp(magic, CACHE_STORE_MAGIC, sizeof(magic)) != 0)) {
+		ERROR("Session cache \"%s\" - %s is not a session cache file", store->name, store->filename);
+		fclose(fp);
+		return -1;
+	}
+
+	while (fread(hdr, sizeof(hdr), 1, fp) == 1) {
+		size_t				id_len = fr_nbo_to_uint16(hdr);
+		size_t				data_len = fr_nbo_to_uint32(hdr + 2);
+		fr_unix_time_t			expires = fr_unix_time_wrap(fr_nbo_to_uint64(hdr + 6));
+		tls_cache_store_stripe_t	*stripe;
+
+		/*
+		 *	Sanity check, sessions are
+		 *	limited to 64K by OpenSSL.
+		 */
+		if ((id_len == 0) || (data_len == 0) || (data_len > UINT16_MAX)) {
+			WARN("Session cache \"%s\" - Invalid entry in %s, ignoring remaining data",
+			     store->name, store->filename);
+			break;
+		}
+
+		MEM(buff = talloc_realloc(NULL, buff, uint8_t, id_len + data_len));
+		if (fread(buff, id_len + data_len, 1, fp) != 1) {
+			WARN("Session cache \"%s\" - Truncated entry in %s, ignoring remaining data",
+			     store->name, store->filename);
+			break;
+		}
+
+		if (fr_unix_time_lteq(expires, now)) continue;
+
+		stripe = tls_cache_store_stripe(store, buff, id_len);
+		pthread_mutex_lock(&stripe->mutex);
+		if (tls_cache_store_stripe_insert(stripe, buff, id_len, buff + id_len, data_len, expires, now) == 0) {
+			loaded++;
+		}
+		pthread_mutex_unlock(&stripe->mutex);
+	}
+	talloc_free(buff);
+	fclose(fp);
+
+	/*
+	 *	Don't count restored sessions as inserts
+	 */
+	{
+		size_t i;
+
+		for (i = 0; i < FR_TLS_CACHE_STORE_STRIPES; i++) store->stripe[i].stats.inserts = 0;
+	}
+
+	INFO("Session cache \"%s\" - Loaded %" PRIu64 " sessions from %s", store->name, loaded, store->filename);
+
+	return 0;
+}
+
+static int cmd_stats_tls_session_cache(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_tls_cache_store_t		*store = talloc_get_type_abort(ctx, fr_tls_cache_store_t);
+	fr_tls_cache_store_stats_t	stats;
+
+	fr_tls_cache_store_stats(&stats, store);
+
+	fprintf(fp, "entries\t\t\t%" PRIu64 "\n", stats.entries);
+	fprintf(fp, "lookups\t\t\t%" PRIu64 "\n", stats.lookups);
+	fprintf(fp, "hits\t\t\t%" PRIu64 "\n", stats.hits);
+	fprintf(fp, "misses\t\t\t%" PRIu64 "\n", stats.misses);
+	fprintf(fp, "hit_rate\t\t%.2f\n", stats.lookups ? (stats.hits * 100.0) / stats.lookups : 0.0);
+	fprintf(fp, "expired\t\t\t%" PRIu64 "\n", stats.expired);
+	fprintf(fp, "inserts\t\t\t%" PRIu64 "\n", stats.inserts);
+	fprintf(fp, "evictions\t\t%" PRIu64 "\n", stats.evictions);
+	fprintf(fp, "removes\t\t\t%" PRIu64 "\n", stats.removes);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_tls_session_cache_table[] = {
+	{
+		.parent = "stats",
+		.name = "tls",
+		.help = "Statistics for TLS session caches.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats tls",
+		.add_name = true,
+		.name = "self",
+		.func = cmd_stats_tls_session_cache,
+		.help = "Show statistics for a TLS session cache.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+static int _tls_cache_store_free(fr_tls_cache_store_t *store)
+{
+	fr_tls_cache_store_stats_t	stats;
+	size_t				i;
+
+	(void) fr_tls_cache_store_persist(store);
+
+	fr_tls_cache_store_stats(&stats, store);
+	DEBUG2("Session cache \"%s\" - %" PRIu64 " lookups, %" PRIu64 " hits (%.2f%%)",
+	       store->name, stats.lookups, stats.hits,
+	       stats.lookups ? (stats.hits * 100.0) / stats.lookups : 0.0);
+
+	for (i = 0; i < FR_TLS_CACHE_STORE_STRIPES; i++) pthread_mutex_destroy(&store->stripe[i].mutex);
+
+	return 0;
+}
+
+/** Allocate a new session store
+ *
+ * @param[in] ctx		to allocate the store in.
+ * @param[in] name		of the store, used for logging, and as the name of the
+ *				`stats tls <name>` radmin command.
+ * @param[in] max_entries	Maximum number of sessions to hold.  This is divided
+ *				evenly between the stripes, so is approximate.
+ * @param[in] filename		Where to persist sessions, may be NULL.  Ignored if
+ *				#check_config is set.
+ * @return
+ *	- A new store on success.
+ *	- NULL on failure.
+ */
+fr_tls_cache_store_t *fr_tls_cache_store_alloc(TALLOC_CTX *ctx, char const *name,
+					       uint32_t max_entries, char const *filename)
+{
+	fr_tls_cache_store_t	*store;
+	size_t			i;
+
+	fr_assert(max_entries > 0);
+
+	MEM(store = talloc_zero(ctx, fr_tls_cache_store_t));
+	MEM(store->name = talloc_strdup(store, name));
+
+	/*
+	 *	Don't read, or overwrite, the sessions of a
+	 *	running server when we're only checking the
+	 *	configuration.
+	 */
+	if (filename && !check_config) MEM(store->filename = talloc_strdup(store, filename));
+
+	for (i = 0; i < FR_TLS_CACHE_STORE_STRIPES; i++) {
+		tls_cache_store_stripe_t *stripe = &store->stripe[i];
+
+		pthread_mutex_init(&stripe->mutex, NULL);
+		MEM(stripe->ctx = talloc_new(store));
+		MEM(stripe->ht = fr_hash_table_alloc(stripe->ctx, tls_cache_store_entry_hash,
+						     tls_cache_store_entry_cmp, NULL));
+		fr_dlist_init(&stripe->lru, tls_cache_store_entry_t, entry);
+		stripe->max_entries = ROUND_UP_DIV(max_entries, FR_TLS_CACHE_STORE_STRIPES);
+	}
+	talloc_set_destructor(store, _tls_cache_store_free);
+
+	if (store->filename && (tls_cache_store_load(store) < 0)) {
+		talloc_set_destructor(store, NULL);
+		for (i = 0; i < FR_TLS_CACHE_STORE_STRIPES; i++) pthread_mutex_destroy(&store->stripe[i].mutex);
+		talloc_free(store);
+		return NULL;
+	}
+
+	if (fr_command_register_hook(NULL, store->name, store, cmd_tls_session_cache_table) < 0) {
+		PWARN("Session cache \"%s\" - Failed registering radmin commands", store->name);
+	}
+
+	return store;
+}
+#endif /* WITH_TLS */
@@ -0,0 +1,76 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifdef WITH_TLS
+/**
+ * $Id$
+ *
+ * @file lib/tls/cache_store.h
+ * @brief In-memory store for stateful session-resumption data, shared by all workers.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSIDH(cache_store_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Number of independently locked partitions in the store
+ *
+ * Must be a power of two.
+ */
+#define FR_TLS_CACHE_STORE_STRIPES	64
+
+typedef struct fr_tls_cache_store_s fr_tls_cache_store_t;
+
+/** Counters for a session store
+ *
+ */
+typedef struct {
+	uint64_t	lookups;			//!< Number of times OpenSSL asked for a session.
+	uint64_t	hits;				//!< Lookups which found a valid session.
+	uint64_t	misses;				//!< Lookups which found nothing.
+	uint64_t	expired;			//!< Lookups, or inserts, which found an expired session.
+	uint64_t	inserts;			//!< New sessions added to the store.
+	uint64_t	evictions;			//!< Sessions removed to stay under max_entries.
+	uint64_t	removes;			//!< Sessions removed at the request of OpenSSL.
+	uint64_t	entries;			//!< Sessions currently in the store.
+} fr_tls_cache_store_stats_t;
+
+fr_tls_cache_store_t	*fr_tls_cache_store_alloc(TALLOC_CTX *ctx, char const *name,
+						  uint32_t max_entries, char const *filename);
+
+int			fr_tls_cache_store_insert(fr_tls_cache_store_t *store,
+						  uint8_t const *id, size_t id_len,
+						  uint8_t const *data, size_t data_len, fr_unix_time_t expires);
+
+uint8_t			*fr_tls_cache_store_find(TALLOC_CTX *ctx, fr_tls_cache_store_t *store,
+						 uint8_t const *id, size_t id_len);
+
+void			fr_tls_cache_store_remove(fr_tls_cache_store_t *store, uint8_t const *id, size_t id_len);
+
+int			fr_tls_cache_store_persist(fr_tls_cache_store_t *store);
+
+void			fr_tls_cache_store_stats(fr_tls_cache_store_stats_t *stats, fr_tls_cache_store_t *store);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* WITH_TLS */
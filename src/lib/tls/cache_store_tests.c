@@ -0,0 +1,298 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the in-memory TLS session store
+ *
+ * @file src/lib/tls/cache_store_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/server/cf_parse.h>
+#include <freeradius-devel/util/hash.h>
+
+#include "cache_store.h"
+
+#include <sys/stat.h>
+
+static TALLOC_CTX	*autofree;
+static char		*test_dir;
+static char		*test_file;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("cache_store_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_time_start() < 0) goto error;
+}
+
+static void test_dir_alloc(void)
+{
+	test_dir = talloc_strdup(autofree, "/tmp/cache_store_tests.XXXXXX");
+	TEST_ASSERT(mkdtemp(test_dir) != NULL);
+
+	test_file = talloc_asprintf(autofree, "%s/sessions", test_dir);
+}
+
+static void test_dir_free(void)
+{
+	char *cmd;
+
+	cmd = talloc_asprintf(autofree, "rm -rf %s", test_dir);
+	TEST_CHECK(system(cmd) == 0);
+	talloc_free(cmd);
+}
+
+static fr_unix_time_t test_expires(int64_t sec)
+{
+	return fr_unix_time_add(fr_time_to_unix_time(fr_time()), fr_time_delta_from_sec(sec));
+}
+
+/** Check a session is in the store, and has the expected data
+ *
+ */
+static bool test_found(fr_tls_cache_store_t *store, char const *id, char const *data)
+{
+	uint8_t	*found;
+	bool	ret;
+
+	found = fr_tls_cache_store_find(NULL, store, (uint8_t const *)id, strlen(id));
+	if (!found) return false;
+
+	ret = (talloc_array_length(found) == strlen(data)) && (memcmp(found, data, strlen(data)) == 0);
+	talloc_free(found);
+
+	return ret;
+}
+
+static int test_insert(fr_tls_cache_store_t *store, char const *id, char const *data, fr_unix_time_t expires)
+{
+	return fr_tls_cache_store_insert(store, (uint8_t const *)id, strlen(id),
+					 (uint8_t const *)data, strlen(data), expires);
+}
+
+/** Find session IDs which hash to the same stripe
+ *
+ */
+static void test_same_stripe(char ids[][16], size_t num)
+{
+	size_t		i, found = 0;
+	uint32_t	stripe = 0;
+
+	for (i = 0; found < num; i++) {
+		char id[16];
+
+		snprintf(id, sizeof(id), "id%zu", i);
+		if (found && ((fr_hash(id, strlen(id)) & (FR_TLS_CACHE_STORE_STRIPES - 1)) != stripe)) continue;
+
+		stripe = fr_hash(id, strlen(id)) & (FR_TLS_CACHE_STORE_STRIPES - 1);
+		strlcpy(ids[found++], id, sizeof(ids[0]));
+	}
+}
+
+static void test_insert_find(void)
+{
+	fr_tls_cache_store_t		*store;
+	fr_tls_cache_store_stats_t	stats;
+
+	store = fr_tls_cache_store_alloc(autofree, "test_insert_find", 1024, NULL);
+	TEST_ASSERT(store != NULL);
+
+	TEST_CHECK(test_insert(store, "one", "data1", test_expires(60)) == 0);
+
+	TEST_CASE("Sessions are found by ID");
+	TEST_CHECK(test_found(store, "one", "data1"));
+	TEST_CHECK(!test_found(store, "two", "data1"));
+
+	TEST_CASE("Inserting the same ID replaces the session");
+	TEST_CHECK(test_insert(store, "one", "data2", test_expires(60)) == 0);
+	TEST_CHECK(test_found(store, "one", "data2"));
+
+	TEST_CASE("Removed sessions can't be found");
+	fr_tls_cache_store_remove(store, (uint8_t const *)"one", 3);
+	TEST_CHECK(!test_found(store, "one", "data2"));
+
+	fr_tls_cache_store_stats(&stats, store);
+	TEST_CHECK(stats.lookups == 4);
+	TEST_CHECK(stats.hits == 2);
+	TEST_CHECK(stats.misses == 2);
+	TEST_CHECK(stats.inserts == 2);
+	TEST_CHECK(stats.removes == 1);
+	TEST_CHECK(stats.entries == 0);
+
+	talloc_free(store);
+}
+
+static void test_expiry(void)
+{
+	fr_tls_cache_store_t		*store;
+	fr_tls_cache_store_stats_t	stats;
+	char				ids[2][16];
+
+	store = fr_tls_cache_store_alloc(autofree, "test_expiry", 1024, NULL);
+	TEST_ASSERT(store != NULL);
+
+	TEST_CASE("Expired sessions aren't returned");
+	TEST_CHECK(test_insert(store, "old", "data", test_expires(-1)) == 0);
+	TEST_CHECK(!test_found(store, "old", "data"));
+
+	fr_tls_cache_store_stats(&stats, store);
+	TEST_CHECK(stats.expired == 1);
+	TEST_CHECK(stats.misses == 1);
+	TEST_CHECK(stats.entries == 0);
+
+	TEST_CASE("Expired sessions are pruned when inserting");
+	test_same_stripe(ids, NUM_ELEMENTS(ids));
+	TEST_CHECK(test_insert(store, ids[0], "data", test_expires(-1)) == 0);
+	TEST_CHECK(test_insert(store, ids[1], "data", test_expires(60)) == 0);
+
+	fr_tls_cache_store_stats(&stats, store);
+	TEST_CHECK(stats.expired == 2);
+	TEST_CHECK(stats.evictions == 0);
+	TEST_CHECK(stats.entries == 1);
+	TEST_CHECK(test_found(store, ids[1], "data"));
+
+	talloc_free(store);
+}
+
+static void test_lru(void)
+{
+	fr_tls_cache_store_t		*store;
+	fr_tls_cache_store_stats_t	stats;
+	char				ids[3][16];
+
+	/*
+	 *	Two entries per stripe
+	 */
+	store = fr_tls_cache_store_alloc(autofree, "test_lru", FR_TLS_CACHE_STORE_STRIPES * 2, NULL);
+	TEST_ASSERT(store != NULL);
+
+	test_same_stripe(ids, NUM_ELEMENTS(ids));
+
+	TEST_CHECK(test_insert(store, ids[0], "data0", test_expires(60)) == 0);
+	TEST_CHECK(test_insert(store, ids[1], "data1", test_expires(60)) == 0);
+
+	/*
+	 *	Makes ids[1] the least recently used
+	 */
+	TEST_CHECK(test_found(store, ids[0], "data0"));
+
+	TEST_CASE("The least recently used session is evicted when the stripe is full");
+	TEST_CHECK(test_insert(store, ids[2], "data2", test_expires(60)) == 0);
+	TEST_CHECK(test_found(store, ids[0], "data0"));
+	TEST_CHECK(!test_found(store, ids[1], "data1"));
+	TEST_CHECK(test_found(store, ids[2], "data2"));
+
+	fr_tls_cache_store_stats(&stats, store);
+	TEST_CHECK(stats.evictions == 1);
+	TEST_CHECK(stats.entries == 2);
+
+	talloc_free(store);
+}
+
+static void test_persist(void)
+{
+	fr_tls_cache_store_t		*store;
+	fr_tls_cache_store_stats_t	stats;
+	struct stat			buf;
+
+	test_dir_alloc();
+
+	store = fr_tls_cache_store_alloc(autofree, "test_persist", 1024, test_file);
+	TEST_ASSERT(store != NULL);
+
+	TEST_CHECK(test_insert(store, "one", "data1", test_expires(60)) == 0);
+	TEST_CHECK(test_insert(store, "two", "data2", test_expires(60)) == 0);
+	TEST_CHECK(test_insert(store, "old", "data3", test_expires(-1)) == 0);
+
+	TEST_CASE("Sessions are written when the store is freed");
+	talloc_free(store);
+	TEST_ASSERT(stat(test_file, &buf) == 0);
+
+	TEST_CASE("Only we can read the file");
+	TEST_CHECK((buf.st_mode & 0777) == 0600);
+
+	TEST_CASE("Unexpired sessions are restored");
+	store = fr_tls_cache_store_alloc(autofree, "test_persist_load", 1024, test_file);
+	TEST_ASSERT(store != NULL);
+
+	fr_tls_cache_store_stats(&stats, store);
+	TEST_CHECK(stats.entries == 2);
+	TEST_CHECK(stats.inserts == 0);
+
+	TEST_CHECK(test_found(store, "one", "data1"));
+	TEST_CHECK(test_found(store, "two", "data2"));
+	TEST_CHECK(!test_found(store, "old", "data3"));
+
+	TEST_CASE("The file isn't read or written when checking the configuration");
+	fr_tls_cache_store_remove(store, (uint8_t const *)"one", 3);
+	talloc_free(store);
+
+	check_config = true;
+	store = fr_tls_cache_store_alloc(autofree, "test_persist_check", 1024, test_file);
+	TEST_ASSERT(store != NULL);
+
+	fr_tls_cache_store_stats(&stats, store);
+	TEST_CHECK(stats.entries == 0);
+
+	TEST_CHECK(test_insert(store, "three", "data4", test_expires(60)) == 0);
+	talloc_free(store);
+	check_config = false;
+
+	store = fr_tls_cache_store_alloc(autofree, "test_persist_reload", 1024, test_file);
+	TEST_ASSERT(store != NULL);
+
+	TEST_CHECK(!test_found(store, "one", "data1"));
+	TEST_CHECK(test_found(store, "two", "data2"));
+	TEST_CHECK(!test_found(store, "three", "data4"));
+
+	talloc_free(store);
+
+	test_dir_free();
+}
+
+TEST_LIST = {
+	{ "insert_find",	test_insert_find },
+	{ "expiry",		test_expiry },
+	{ "lru",		test_lru },
+	{ "persist",		test_persist },
+
+	{ NULL }
+};
@@ -0,0 +1,8 @@
+ifneq ($(OPENSSL_LIBS),)
+TARGET		:= cache_store_tests$(E)
+endif
+
+SOURCES		:= cache_store_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L) libfreeradius-tls$(L)
@@ -97,11 +97,13 @@ static CONF_PARSER tls_cache_config[] = {
 
 	{ FR_CONF_OFFSET("session_ticket_key", FR_TYPE_OCTETS, fr_tls_cache_conf_t, session_ticket_key) },
 
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, fr_tls_cache_conf_t, max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("persist_file", FR_TYPE_FILE_OUTPUT, fr_tls_cache_conf_t, persist_file) },
+
 	/*
 	 *	Deprecated
 	 */
 	{ FR_CONF_DEPRECATED("enable", FR_TYPE_BOOL, fr_tls_cache_conf_t, NULL) },
-	{ FR_CONF_DEPRECATED("max_entries", FR_TYPE_UINT32, fr_tls_cache_conf_t, NULL) },
 	{ FR_CONF_DEPRECATED("persist_dir", FR_TYPE_STRING, fr_tls_cache_conf_t, NULL) },
 
 	CONF_PARSER_TERMINATOR
@@ -398,15 +400,26 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 	 *	Ensure our virtual server contains the
 	 *      correct sections for the specified
 	 *      cache mode.
+	 *
+	 *	If the shared in-memory store is enabled
+	 *	the sections are optional, and are only
+	 *	called if they're all present.
 	 */
+	conf->cache.session_sections = conf->virtual_server &&
+				       cf_section_find(conf->virtual_server, "load", "session") &&
+				       cf_section_find(conf->virtual_server, "store", "session") &&
+				       cf_section_find(conf->virtual_server, "clear", "session");
+
 	switch (conf->cache.mode) {
 	case FR_TLS_CACHE_DISABLED:
 	case FR_TLS_CACHE_STATELESS:
 		break;
 
 	case FR_TLS_CACHE_STATEFUL:
+		if (conf->cache.max_entries > 0) goto check_version;
+
 		if (!conf->virtual_server) {
-			ERROR("A virtual_server must be set when cache.mode = \"stateful\"");
+			ERROR("A virtual_server must be set when cache.mode = \"stateful\" and cache.max_entries = 0");
 			goto error;
 		}
 
@@ -428,6 +441,7 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 			goto error;
 		}
 
+	check_version:
 		if (conf->tls_min_version >= (float)1.3) {
 			ERROR("cache.mode = \"stateful\" is not supported with tls_min_version >= 1.3");
 			goto error;
@@ -435,8 +449,10 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 		break;
 
 	case FR_TLS_CACHE_AUTO:
+		if (conf->cache.max_entries > 0) goto check_version_auto;
+
 		if (!conf->virtual_server) {
-			WARN("A virtual_server must be provided for stateful caching. "
+			WARN("A virtual_server, or cache.max_entries > 0, must be provided for stateful caching. "
 			     "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"");
 		cache_stateless:
 			conf->cache.mode = FR_TLS_CACHE_STATELESS;
@@ -461,6 +477,7 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 			goto cache_stateless;
 		}
 
+	check_version_auto:
 		if (conf->tls_min_version >= (float)1.3) {
 			ERROR("stateful session-resumption is not supported with tls_min_version >= 1.3. "
 			      "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"");
@@ -469,6 +486,18 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 		break;
 	}
 
+	/*
+	 *	Allocate the in-memory store shared by all
+	 *	the thread specific SSL_CTXs.
+	 */
+	if ((conf->cache.mode & FR_TLS_CACHE_STATEFUL) && (conf->cache.max_entries > 0)) {
+		char const *name = cf_section_name2(cs);
+
+		conf->cache.store = fr_tls_cache_store_alloc(conf, name ? name : cf_section_name1(cs),
+							     conf->cache.max_entries, conf->cache.persist_file);
+		if (!conf->cache.store) goto error;
+	}
+
 	/*
 	 *	Generate random, ephemeral, session-ticket keys.
 	 */
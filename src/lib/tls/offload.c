@@ -0,0 +1,667 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/offload.c
+ * @brief Run expensive TLS operations on a dedicated pool of crypto threads.
+ *
+ * Private key operations and certificate chain validation happen inside
+ * SSL_read() when it's advancing a handshake.  With large RSA keys each
+ * of those can take several milliseconds, and while they're running the
+ * worker can't process any other requests.
+ *
+ * When the crypto pool is enabled, the worker passes the operation to
+ * one of the crypto threads and yields the request.  The crypto thread
+ * runs the operation, adds it to the worker's completion list, and
+ * writes to a pipe watched by the worker's event loop.  The worker then
+ * marks the request as runnable.
+ *
+ * While an operation is in progress, the crypto thread has exclusive
+ * use of the TLS session, and the worker must not touch it until the
+ * operation has completed, or has been cancelled with
+ * #fr_tls_offload_cancel.  The crypto thread may read the request (to
+ * log messages), but must not modify it.  Anything it produces for the
+ * request is kept in the TLS session until the worker picks it up.
+ * Debug builds check this when each operation completes.
+ *
+ * Each operation handle is pinned to a single crypto thread.  OpenSSL
+ * async jobs started on one thread can't be resumed on another, and
+ * the callbacks in cache.c and verify.c pause the job so that the
+ * worker can run the load/verify sections.  Resuming the handshake
+ * must therefore happen on the same crypto thread that started it.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls"
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/tls/base.h>
+#include <freeradius-devel/tls/log.h>
+#include <freeradius-devel/tls/offload.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include <pthread.h>
+
+typedef enum {
+	FR_TLS_OFFLOAD_IDLE = 0,			//!< Owned by the worker.
+	FR_TLS_OFFLOAD_QUEUED,				//!< Waiting for the crypto thread.
+	FR_TLS_OFFLOAD_RUNNING,				//!< Being run by the crypto thread.
+	FR_TLS_OFFLOAD_DONE				//!< Complete, waiting for the worker to resume the request.
+} fr_tls_offload_state_t;
+
+typedef struct fr_tls_offload_worker_s fr_tls_offload_worker_t;
+
+/** A crypto thread
+ *
+ */
+typedef struct {
+	pthread_t		pthread_id;		//!< Of the crypto thread.
+	unsigned int		id;			//!< Used in log messages.
+
+	pthread_mutex_t		mutex;			//!< Protects the queue, and the state of queued operations.
+	pthread_cond_t		work;			//!< Signalled when an operation is queued.
+	pthread_cond_t		done;			//!< Broadcast when an operation completes.
+
+	fr_dlist_head_t		queue;			//!< Of operations waiting to run.
+	bool			stop;			//!< Exit once the queue is empty.
+	bool			running;		//!< Whether pthread_id is valid.
+} fr_tls_offload_thread_t;
+
+/** Worker side of the crypto pool
+ *
+ */
+struct fr_tls_offload_worker_s {
+	fr_event_list_t		*el;			//!< Watching the read end of the pipe.
+	int			fd[2];			//!< Written to by crypto threads when the completion
+							///< list goes from empty to non-empty.
+
+	pthread_mutex_t		mutex;			//!< Protects the completion list.
+	fr_dlist_head_t		complete;		//!< Of operations which have completed.
+};
+
+/** An operation which may be run on a crypto thread
+ *
+ * There's one of these per TLS session, and only one operation
+ * can be in progress at a time.
+ */
+struct fr_tls_offload_s {
+	fr_dlist_t		entry;			//!< In the crypto thread's queue, or the worker's
+							///< completion list.
+	_Atomic(fr_tls_offload_state_t)	state;		//!< Where the operation is.
+
+	fr_tls_offload_thread_t	*thread;		//!< Crypto thread this handle is pinned to.
+	fr_tls_offload_worker_t	*worker;		//!< To notify when the operation is complete.
+	bool			sync;			//!< Worker is blocked waiting for the operation.
+
+	request_t		*request;		//!< The operation is being performed for.
+	fr_tls_offload_func_t	func;			//!< To run.
+	void			*uctx;			//!< Passed to func.
+
+#ifndef NDEBUG
+	size_t			request_blocks;		//!< In the request when the operation was queued.
+	size_t			state_blocks;		//!< In &session-state when the operation was queued.
+#endif
+};
+
+/** The crypto threads
+ *
+ */
+typedef struct {
+	fr_tls_offload_thread_t	*threads;		//!< Array of crypto threads.
+	uint32_t		num;			//!< How many crypto threads there are.
+	_Atomic(uint32_t)	next;			//!< Used to assign operations to threads.
+
+	size_t			async_pool_size_init;	//!< Passed to fr_openssl_thread_init().
+	size_t			async_pool_size_max;	//!< Passed to fr_openssl_thread_init().
+} fr_tls_offload_pool_t;
+
+static fr_tls_offload_pool_t		*offload_pool;
+
+/** Worker data for the current thread, NULL if the pool isn't running
+ */
+static _Thread_local fr_tls_offload_worker_t	*offload_worker;
+
+/** Whether the current thread is a crypto thread
+ */
+static _Thread_local bool			offload_in_thread;
+
+/** Add an operation to a worker's completion list
+ *
+ * The caller must hold the crypto thread's mutex.
+ */
+static void offload_complete(fr_tls_offload_t *op)
+{
+	fr_tls_offload_worker_t	*worker = op->worker;
+	bool			notify;
+
+	pthread_mutex_lock(&worker->mutex);
+	notify = (fr_dlist_num_elements(&worker->complete) == 0);
+	fr_dlist_insert_tail(&worker->complete, op);
+	atomic_store(&op->state, FR_TLS_OFFLOAD_DONE);
+	pthread_mutex_unlock(&worker->mutex);
+
+	/*
+	 *	If the list wasn't empty, the worker
+	 *	already has a notification pending.
+	 *
+	 *	EAGAIN means the pipe is full, in which
+	 *	case there are notifications pending too.
+	 */
+	if (notify && (write(worker->fd[1], "1", 1) < 0) && (errno != EAGAIN)) {
+		ERROR("Crypto thread failed notifying worker: %s", fr_syserror(errno));
+	}
+}
+
+/** Run queued operations
+ *
+ */
+static void *offload_thread(void *arg)
+{
+	fr_tls_offload_thread_t	*thread = arg;
+	fr_tls_offload_t	*op;
+
+	offload_in_thread = true;
+
+	/*
+	 *	Async jobs are started from this thread, so
+	 *	it needs its own pool of them.
+	 */
+	if (fr_openssl_thread_init(offload_pool->async_pool_size_init, offload_pool->async_pool_size_max) < 0) {
+		PERROR("Crypto thread %u failed initialising OpenSSL", thread->id);
+	}
+
+	DEBUG2("Crypto thread %u started", thread->id);
+
+	pthread_mutex_lock(&thread->mutex);
+	for (;;) {
+		while (!(op = fr_dlist_pop_head(&thread->queue))) {
+			if (thread->stop) goto done;
+			pthread_cond_wait(&thread->work, &thread->mutex);
+		}
+
+		atomic_store(&op->state, FR_TLS_OFFLOAD_RUNNING);
+		pthread_mutex_unlock(&thread->mutex);
+
+		op->func(op->request, op->uctx);
+
+		pthread_mutex_lock(&thread->mutex);
+		if (op->sync) {
+			atomic_store(&op->state, FR_TLS_OFFLOAD_IDLE);
+		} else {
+			offload_complete(op);
+		}
+		pthread_cond_broadcast(&thread->done);
+	}
+
+done:
+	pthread_mutex_unlock(&thread->mutex);
+
+	DEBUG2("Crypto thread %u exiting", thread->id);
+
+	return NULL;
+}
+
+/** Start the crypto threads
+ *
+ * Should be called once, before the workers are started.
+ *
+ * @param[in] num			Number of crypto threads.  If 0, no threads
+ *					are started, and all operations are run by
+ *					the workers.
+ * @param[in] async_pool_size_init	The initial number of async contexts each
+ *					crypto thread keeps in its pool.
+ * @param[in] async_pool_size_max	The maximum number of async contexts each
+ *					crypto thread keeps in its pool.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_tls_offload_pool_start(uint32_t num, size_t async_pool_size_init, size_t async_pool_size_max)
+{
+	uint32_t i;
+
+	if (!num) return 0;
+
+	if (offload_pool) {
+		fr_strerror_const("Crypto threads already started");
+		return -1;
+	}
+
+	if (num > FR_TLS_OFFLOAD_MAX_THREADS) {
+		fr_strerror_printf("Too many crypto threads (%u), maximum is %u", num, FR_TLS_OFFLOAD_MAX_THREADS);
+		return -1;
+	}
+
+	MEM(offload_pool = talloc_zero(NULL, fr_tls_offload_pool_t));
+	MEM(offload_pool->threads = talloc_zero_array(offload_pool, fr_tls_offload_thread_t, num));
+	offload_pool->async_pool_size_init = async_pool_size_init;
+	offload_pool->async_pool_size_max = async_pool_size_max;
+
+	for (i = 0; i < num; i++) {
+		fr_tls_offload_thread_t *thread = &offload_pool->threads[i];
+		int ret;
+
+		thread->id = i;
+		pthread_mutex_init(&thread->mutex, NULL);
+		pthread_cond_init(&thread->work, NULL);
+		pthread_cond_init(&thread->done, NULL);
+		fr_dlist_init(&thread->queue, fr_tls_offload_t, entry);
+
+		/*
+		 *	Count the thread before creating it, so
+		 *	that fr_tls_offload_pool_stop() cleans up
+		 *	the mutexes if creation fails.
+		 */
+		offload_pool->num++;
+
+		ret = pthread_create(&thread->pthread_id, NULL, offload_thread, thread);
+		if (ret != 0) {
+			fr_strerror_printf("Failed creating crypto thread: %s", fr_syserror(ret));
+			fr_tls_offload_pool_stop();
+			return -1;
+		}
+		thread->running = true;
+	}
+
+	INFO("Started %u crypto thread(s) for TLS handshakes", num);
+
+	return 0;
+}
+
+/** Stop the crypto threads
+ *
+ * Should be called after the workers have exited.  Any queued
+ * operations are run before the threads exit, and their requests
+ * are resumed as usual if the worker is still running.  Once the
+ * pool has stopped, #fr_tls_offload_push fails, and handles can
+ * still be cancelled and freed.
+ */
+void fr_tls_offload_pool_stop(void)
+{
+	uint32_t i;
+
+	if (!offload_pool) return;
+
+	for (i = 0; i < offload_pool->num; i++) {
+		fr_tls_offload_thread_t *thread = &offload_pool->threads[i];
+
+		pthread_mutex_lock(&thread->mutex);
+		thread->stop = true;
+		pthread_cond_signal(&thread->work);
+		pthread_mutex_unlock(&thread->mutex);
+	}
+
+	for (i = 0; i < offload_pool->num; i++) {
+		fr_tls_offload_thread_t *thread = &offload_pool->threads[i];
+
+		if (thread->running) pthread_join(thread->pthread_id, NULL);
+
+		pthread_cond_destroy(&thread->done);
+		pthread_cond_destroy(&thread->work);
+		pthread_mutex_destroy(&thread->mutex);
+	}
+
+	TALLOC_FREE(offload_pool);
+}
+
+#ifndef NDEBUG
+/** Count the memory blocks belonging to a request
+ *
+ */
+static void offload_request_blocks(size_t *request_blocks, size_t *state_blocks, request_t *request)
+{
+	*request_blocks = talloc_total_blocks(request);
+	*state_blocks = request->session_state_ctx ? talloc_total_blocks(request->session_state_ctx) : 0;
+}
+
+/** Check the crypto thread didn't allocate or free anything in the request
+ *
+ */
+static void offload_request_verify(fr_tls_offload_t *op)
+{
+	size_t request_blocks, state_blocks;
+
+	offload_request_blocks(&request_blocks, &state_blocks, op->request);
+
+	fr_assert_msg(request_blocks == op->request_blocks,
+		      "Crypto thread modified request, blocks were %zu, now %zu",
+		      op->request_blocks, request_blocks);
+	fr_assert_msg(state_blocks == op->state_blocks,
+		      "Crypto thread modified &session-state, blocks were %zu, now %zu",
+		      op->state_blocks, state_blocks);
+}
+#else
+#  define offload_request_verify(_op)
+#endif
+
+/** Resume requests whose operations have completed
+ *
+ */
+static void _offload_worker_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_tls_offload_worker_t	*worker = talloc_get_type_abort(uctx, fr_tls_offload_worker_t);
+	fr_dlist_head_t		complete;
+	fr_tls_offload_t	*op;
+	uint8_t			buffer[64];
+
+	/*
+	 *	Drain the pipe before taking the list, so
+	 *	that we don't miss notifications for
+	 *	operations which complete while we're
+	 *	running.
+	 */
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+
+	fr_dlist_init(&complete, fr_tls_offload_t, entry);
+
+	pthread_mutex_lock(&worker->mutex);
+	fr_dlist_move(&complete, &worker->complete);
+	pthread_mutex_unlock(&worker->mutex);
+
+	while ((op = fr_dlist_pop_head(&complete))) {
+		atomic_store(&op->state, FR_TLS_OFFLOAD_IDLE);
+		offload_request_verify(op);
+		unlang_interpret_mark_runnable(op->request);
+	}
+}
+
+static void _offload_worker_error(fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, UNUSED void *uctx)
+{
+	ERROR("Failed reading from crypto thread notification pipe: %s", fr_syserror(fd_errno));
+
+	(void) fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+}
+
+static int _offload_worker_free(fr_tls_offload_worker_t *worker)
+{
+	if (worker->fd[0] >= 0) {
+		(void) fr_event_fd_delete(worker->el, worker->fd[0], FR_EVENT_FILTER_IO);
+		close(worker->fd[0]);
+		close(worker->fd[1]);
+	}
+
+	fr_assert(fr_dlist_num_elements(&worker->complete) == 0);
+	pthread_mutex_destroy(&worker->mutex);
+
+	if (offload_worker == worker) offload_worker = NULL;
+
+	return 0;
+}
+
+/** Allow the current worker thread to pass operations to the crypto threads
+ *
+ * Does nothing if there are no crypto threads.
+ *
+ * @param[in] ctx	to allocate the worker data in.  Should be freed
+ *			when the worker exits.
+ * @param[in] el	the worker's event list.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_tls_offload_thread_init(TALLOC_CTX *ctx, fr_event_list_t *el)
+{
+	fr_tls_offload_worker_t *worker;
+
+	if (!offload_pool || offload_worker) return 0;
+
+	MEM(worker = talloc_zero(ctx, fr_tls_offload_worker_t));
+	worker->el = el;
+	worker->fd[0] = worker->fd[1] = -1;
+	pthread_mutex_init(&worker->mutex, NULL);
+	fr_dlist_init(&worker->complete, fr_tls_offload_t, entry);
+	talloc_set_destructor(worker, _offload_worker_free);
+
+	if (pipe(worker->fd) < 0) {
+		fr_strerror_printf("Failed creating crypto thread notification pipe: %s", fr_syserror(errno));
+		worker->fd[0] = worker->fd[1] = -1;
+	error:
+		talloc_free(worker);
+		return -1;
+	}
+
+	if ((fr_nonblock(worker->fd[0]) < 0) || (fr_nonblock(worker->fd[1]) < 0)) goto error;
+
+	if (fr_event_fd_insert(worker, el, worker->fd[0],
+			       _offload_worker_read,
+			       NULL,
+			       _offload_worker_error,
+			       worker) < 0) {
+		fr_strerror_const_push("Failed adding crypto thread notification pipe to event loop");
+		close(worker->fd[0]);
+		close(worker->fd[1]);
+		worker->fd[0] = worker->fd[1] = -1;
+		goto error;
+	}
+
+	offload_worker = worker;
+
+	return 0;
+}
+
+/** Whether operations should be passed to the crypto threads
+ *
+ * @return true if the current thread has crypto threads available.
+ */
+bool fr_tls_offload_enabled(void)
+{
+	return (offload_pool && offload_worker);
+}
+
+/** Whether the current thread is a crypto thread
+ *
+ * Code called from an operation uses this to avoid modifying the request.
+ *
+ * @return true if called from a crypto thread.
+ */
+bool fr_tls_offload_in_thread(void)
+{
+	return offload_in_thread;
+}
+
+static int _offload_free(fr_tls_offload_t *op)
+{
+	fr_tls_offload_cancel(op);
+
+	return 0;
+}
+
+/** Allocate a handle for running operations on a crypto thread
+ *
+ * Handles are assigned to crypto threads round robin.
+ *
+ * @param[in] ctx	to allocate the handle in.  Usually the TLS session.
+ * @return
+ *	- A new handle.
+ *	- NULL if the crypto threads aren't running.
+ */
+fr_tls_offload_t *fr_tls_offload_alloc(TALLOC_CTX *ctx)
+{
+	fr_tls_offload_t *op;
+
+	if (!offload_pool) return NULL;
+
+	MEM(op = talloc_zero(ctx, fr_tls_offload_t));
+	fr_dlist_entry_init(&op->entry);
+	atomic_init(&op->state, FR_TLS_OFFLOAD_IDLE);
+	op->thread = &offload_pool->threads[atomic_fetch_add_explicit(&offload_pool->next, 1,
+								      memory_order_relaxed) % offload_pool->num];
+	talloc_set_destructor(op, _offload_free);
+
+	return op;
+}
+
+/** Queue an operation to run on the handle's crypto thread
+ *
+ * Once the operation completes, the request will be marked as runnable.
+ * The caller should yield the request after this function returns.
+ *
+ * @param[in] op	handle to use.  Must not have an operation in progress.
+ * @param[in] request	to resume once the operation is complete.
+ * @param[in] func	to run on the crypto thread.
+ * @param[in] uctx	to pass to func.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the crypto threads aren't available.
+ */
+int fr_tls_offload_push(fr_tls_offload_t *op, request_t *request, fr_tls_offload_func_t func, void *uctx)
+{
+	fr_tls_offload_thread_t *thread;
+
+	fr_assert(atomic_load(&op->state) == FR_TLS_OFFLOAD_IDLE);
+
+	if (unlikely(!fr_tls_offload_enabled())) {
+		fr_strerror_const("Crypto threads are not available in this thread");
+		return -1;
+	}
+
+	thread = op->thread;
+	op->worker = offload_worker;
+	op->sync = false;
+	op->request = request;
+	op->func = func;
+	op->uctx = uctx;
+#ifndef NDEBUG
+	offload_request_blocks(&op->request_blocks, &op->state_blocks, request);
+#endif
+
+	pthread_mutex_lock(&thread->mutex);
+	if (unlikely(thread->stop)) {
+		pthread_mutex_unlock(&thread->mutex);
+		fr_strerror_const("Crypto threads are stopping");
+		return -1;
+	}
+	atomic_store(&op->state, FR_TLS_OFFLOAD_QUEUED);
+	fr_dlist_insert_tail(&thread->queue, op);
+	pthread_cond_signal(&thread->work);
+	pthread_mutex_unlock(&thread->mutex);
+
+	return 0;
+}
+
+/** Run an operation on the handle's crypto thread, and wait for it to complete
+ *
+ * This blocks the worker, and should only be used where the request
+ * can't yield, i.e. when it's being cancelled.  Any operation in
+ * progress is cancelled first.
+ *
+ * @param[in] op	handle to use.  If NULL, or the crypto threads have
+ *			been stopped, func is called directly.
+ * @param[in] request	the operation is being performed for.
+ * @param[in] func	to run on the crypto thread.
+ * @param[in] uctx	to pass to func.
+ */
+void fr_tls_offload_run(fr_tls_offload_t *op, request_t *request, fr_tls_offload_func_t func, void *uctx)
+{
+	fr_tls_offload_thread_t *thread;
+
+	if (op) fr_tls_offload_cancel(op);
+
+	if (!op || !offload_pool) {
+		func(request, uctx);
+		return;
+	}
+
+	thread = op->thread;
+	op->worker = NULL;
+	op->sync = true;
+	op->request = request;
+	op->func = func;
+	op->uctx = uctx;
+
+	pthread_mutex_lock(&thread->mutex);
+	atomic_store(&op->state, FR_TLS_OFFLOAD_QUEUED);
+	fr_dlist_insert_tail(&thread->queue, op);
+	pthread_cond_signal(&thread->work);
+	while (atomic_load(&op->state) != FR_TLS_OFFLOAD_IDLE) pthread_cond_wait(&thread->done, &thread->mutex);
+	pthread_mutex_unlock(&thread->mutex);
+
+	op->sync = false;
+}
+
+/** Stop an operation from running, or wait for it to finish
+ *
+ * On return the handle is idle, and the worker has exclusive use of
+ * the request again.  If the operation was already running, the
+ * worker blocks until the crypto thread has finished with it.
+ *
+ * @param[in] op	to cancel.
+ */
+void fr_tls_offload_cancel(fr_tls_offload_t *op)
+{
+	fr_tls_offload_thread_t *thread = op->thread;
+
+	switch (atomic_load(&op->state)) {
+	/*
+	 *	Only the worker moves operations back to
+	 *	idle, so if it's idle here, it's not
+	 *	going to change.
+	 */
+	case FR_TLS_OFFLOAD_IDLE:
+		return;
+
+	/*
+	 *	The crypto thread is done with it, and may
+	 *	have exited, so leave its mutex alone.
+	 */
+	case FR_TLS_OFFLOAD_DONE:
+		break;
+
+	case FR_TLS_OFFLOAD_QUEUED:
+	case FR_TLS_OFFLOAD_RUNNING:
+		pthread_mutex_lock(&thread->mutex);
+		if (atomic_load(&op->state) == FR_TLS_OFFLOAD_QUEUED) {
+			fr_dlist_remove(&thread->queue, op);
+			atomic_store(&op->state, FR_TLS_OFFLOAD_IDLE);
+			pthread_mutex_unlock(&thread->mutex);
+			return;
+		}
+
+		while (atomic_load(&op->state) == FR_TLS_OFFLOAD_RUNNING) {
+			pthread_cond_wait(&thread->done, &thread->mutex);
+		}
+		pthread_mutex_unlock(&thread->mutex);
+
+		/*
+		 *	Synchronous operations go straight
+		 *	back to idle.
+		 */
+		if (atomic_load(&op->state) == FR_TLS_OFFLOAD_IDLE) return;
+		break;
+	}
+
+	pthread_mutex_lock(&op->worker->mutex);
+	fr_dlist_remove(&op->worker->complete, op);
+	pthread_mutex_unlock(&op->worker->mutex);
+	atomic_store(&op->state, FR_TLS_OFFLOAD_IDLE);
+}
+#endif /* WITH_TLS */
@@ -0,0 +1,75 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifdef WITH_TLS
+/**
+ * $Id$
+ *
+ * @file lib/tls/offload.h
+ * @brief Run expensive TLS operations on a dedicated pool of crypto threads.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSIDH(offload_h, "$Id$")
+
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/talloc.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of crypto threads
+ *
+ */
+#define FR_TLS_OFFLOAD_MAX_THREADS	256
+
+typedef struct fr_tls_offload_s fr_tls_offload_t;
+
+/** Function run on a crypto thread
+ *
+ * @param[in] request	the operation is being performed for.  Must not
+ *			be modified by anything other than the function
+ *			until the operation has completed.
+ * @param[in] uctx	passed to #fr_tls_offload_push or #fr_tls_offload_run.
+ */
+typedef void (*fr_tls_offload_func_t)(request_t *request, void *uctx);
+
+int			fr_tls_offload_pool_start(uint32_t num, size_t async_pool_size_init, size_t async_pool_size_max);
+
+void			fr_tls_offload_pool_stop(void);
+
+int			fr_tls_offload_thread_init(TALLOC_CTX *ctx, fr_event_list_t *el);
+
+bool			fr_tls_offload_enabled(void);
+
+bool			fr_tls_offload_in_thread(void);
+
+fr_tls_offload_t	*fr_tls_offload_alloc(TALLOC_CTX *ctx);
+
+int			fr_tls_offload_push(fr_tls_offload_t *op, request_t *request,
+					    fr_tls_offload_func_t func, void *uctx);
+
+void			fr_tls_offload_run(fr_tls_offload_t *op, request_t *request,
+					   fr_tls_offload_func_t func, void *uctx);
+
+void			fr_tls_offload_cancel(fr_tls_offload_t *op);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* WITH_TLS */
@@ -0,0 +1,365 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for running TLS operations on crypto threads
+ *
+ * @file src/lib/tls/offload_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/tls/base.h>
+#include <freeradius-devel/tls/offload.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/unlang/function.h>
+#include <freeradius-devel/unlang/interpret.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+static TALLOC_CTX	*autofree;
+
+/** State shared between the test and the crypto threads
+ *
+ */
+typedef struct {
+	fr_tls_offload_t	*op;
+	_Atomic(bool)		started;	//!< func has started running.
+	_Atomic(unsigned int)	ran;		//!< How many times func has run.
+	bool			in_thread;	//!< fr_tls_offload_in_thread() when func ran.
+	pthread_t		thread;		//!< func ran on.
+	unsigned int		delay;		//!< Before func returns, in microseconds.
+	bool			resumed;	//!< Request was resumed after the operation.
+} test_op_t;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("offload_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_time_start() < 0) goto error;
+
+	if (!fr_dict_global_ctx_init(autofree, false, "share/dictionary")) goto error;
+
+	if (request_global_init() < 0) goto error;
+
+	if (unlang_init_global() < 0) goto error;
+
+	if (fr_openssl_init() < 0) goto error;
+}
+
+static void test_offload_func(UNUSED request_t *request, void *uctx)
+{
+	test_op_t *t = uctx;
+
+	atomic_store(&t->started, true);
+	t->in_thread = fr_tls_offload_in_thread();
+	t->thread = pthread_self();
+	if (t->delay) usleep(t->delay);
+
+	atomic_fetch_add(&t->ran, 1);
+}
+
+static fr_event_list_t *test_worker_alloc(uint32_t num)
+{
+	fr_event_list_t *el;
+
+	TEST_CHECK(fr_tls_offload_pool_start(num, 0, 0) == 0);
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	TEST_CHECK(el != NULL);
+
+	TEST_CHECK(fr_tls_offload_thread_init(el, el) == 0);
+	TEST_CHECK(fr_tls_offload_enabled());
+
+	return el;
+}
+
+/** Wait for a crypto thread to pick up an operation
+ *
+ */
+static void test_wait_started(test_op_t *t)
+{
+	while (!atomic_load(&t->started)) usleep(100);
+}
+
+/** Service the event list until there's nothing left to do
+ *
+ */
+static void test_worker_drain(fr_event_list_t *el)
+{
+	while (fr_event_corral(el, fr_time(), false) > 0) fr_event_service(el);
+}
+
+static unlang_action_t test_offload_push(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+					 request_t *request, void *uctx)
+{
+	test_op_t *t = uctx;
+
+	TEST_CHECK(fr_tls_offload_push(t->op, request, test_offload_func, t) == 0);
+
+	return UNLANG_ACTION_YIELD;
+}
+
+static unlang_action_t test_offload_resume(rlm_rcode_t *p_result, UNUSED int *priority,
+					   UNUSED request_t *request, void *uctx)
+{
+	test_op_t *t = uctx;
+
+	TEST_CHECK(atomic_load(&t->ran) == 1);
+	t->resumed = true;
+
+	RETURN_MODULE_OK;
+}
+
+static void test_push_complete(void)
+{
+	fr_event_list_t	*el;
+	request_t	*request;
+	TALLOC_CTX	*session;
+	test_op_t	t = { .delay = 1000 };
+
+	el = test_worker_alloc(2);
+
+	request = request_local_alloc_external(autofree, NULL);
+
+	/*
+	 *	Handles belong to the TLS session, as they do in
+	 *	the server.  Freeing one from the request would
+	 *	look like the crypto thread had modified it.
+	 */
+	session = talloc_new(autofree);
+	t.op = fr_tls_offload_alloc(session);
+	TEST_CHECK(t.op != NULL);
+
+	/*
+	 *	Debug builds also assert, when the request is
+	 *	resumed, that the crypto thread didn't allocate
+	 *	or free anything in the request.
+	 */
+	TEST_CASE("Operation runs on a crypto thread, and the request is resumed");
+	TEST_CHECK(unlang_function_push(request, test_offload_push, test_offload_resume,
+					NULL, UNLANG_TOP_FRAME, &t) == UNLANG_ACTION_PUSHED_CHILD);
+	TEST_CHECK(unlang_interpret_synchronous(el, request) == RLM_MODULE_OK);
+
+	TEST_CHECK(atomic_load(&t.ran) == 1);
+	TEST_CHECK(t.resumed);
+	TEST_CHECK(t.in_thread);
+	TEST_CHECK(!pthread_equal(t.thread, pthread_self()));
+	TEST_CHECK(!fr_tls_offload_in_thread());
+
+	talloc_free(session);
+	talloc_free(request);
+	talloc_free(el);
+	fr_tls_offload_pool_stop();
+}
+
+static void test_cancel(void)
+{
+	fr_event_list_t	*el;
+	request_t	*request;
+	TALLOC_CTX	*session;
+	test_op_t	running = { .delay = 100000 }, queued = { 0 };
+
+	/*
+	 *	One thread, so the second operation has
+	 *	to wait for the first.
+	 */
+	el = test_worker_alloc(1);
+
+	request = request_local_alloc_external(autofree, NULL);
+	session = talloc_new(autofree);
+	running.op = fr_tls_offload_alloc(session);
+	queued.op = fr_tls_offload_alloc(session);
+
+	TEST_CHECK(fr_tls_offload_push(running.op, request, test_offload_func, &running) == 0);
+	test_wait_started(&running);
+	TEST_CHECK(fr_tls_offload_push(queued.op, request, test_offload_func, &queued) == 0);
+
+	TEST_CASE("Cancelling a queued operation stops it from running");
+	fr_tls_offload_cancel(queued.op);
+
+	TEST_CASE("Cancelling a running operation waits for it to finish");
+	fr_tls_offload_cancel(running.op);
+	TEST_CHECK(atomic_load(&running.ran) == 1);
+	TEST_CHECK(atomic_load(&queued.ran) == 0);
+
+	TEST_CASE("Cancelling a completed operation discards the completion");
+	TEST_CHECK(fr_tls_offload_push(queued.op, request, test_offload_func, &queued) == 0);
+	test_wait_started(&queued);
+	usleep(10000);
+	fr_tls_offload_cancel(queued.op);
+	TEST_CHECK(atomic_load(&queued.ran) == 1);
+	test_worker_drain(el);
+
+	TEST_CASE("Freeing a handle cancels its operation");
+	atomic_store(&running.started, false);
+	TEST_CHECK(fr_tls_offload_push(running.op, request, test_offload_func, &running) == 0);
+	test_wait_started(&running);
+	talloc_free(running.op);
+	TEST_CHECK(atomic_load(&running.ran) == 2);
+
+	talloc_free(session);
+	talloc_free(request);
+	talloc_free(el);
+	fr_tls_offload_pool_stop();
+}
+
+static void test_run(void)
+{
+	fr_event_list_t	*el;
+	request_t	*request;
+	TALLOC_CTX	*session;
+	test_op_t	t = { 0 };
+
+	el = test_worker_alloc(1);
+
+	request = request_local_alloc_external(autofree, NULL);
+	session = talloc_new(autofree);
+	t.op = fr_tls_offload_alloc(session);
+
+	TEST_CASE("Synchronous operations run on the crypto thread");
+	fr_tls_offload_run(t.op, request, test_offload_func, &t);
+	TEST_CHECK(atomic_load(&t.ran) == 1);
+	TEST_CHECK(t.in_thread);
+
+	TEST_CASE("A NULL handle runs the operation in the worker");
+	fr_tls_offload_run(NULL, request, test_offload_func, &t);
+	TEST_CHECK(atomic_load(&t.ran) == 2);
+	TEST_CHECK(!t.in_thread);
+
+	talloc_free(session);
+	talloc_free(request);
+	talloc_free(el);
+	fr_tls_offload_pool_stop();
+}
+
+/** Operations in flight when the pool is stopped
+ *
+ */
+typedef struct {
+	test_op_t		t[8];
+	bool			resumed;
+} test_pool_t;
+
+static unlang_action_t test_pool_stop_push(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+					   request_t *request, void *uctx)
+{
+	test_pool_t	*pool = uctx;
+	size_t		i;
+
+	for (i = 0; i < NUM_ELEMENTS(pool->t); i++) {
+		TEST_CHECK(fr_tls_offload_push(pool->t[i].op, request, test_offload_func, &pool->t[i]) == 0);
+	}
+
+	TEST_CASE("Stopping the pool runs operations which are in flight");
+	fr_tls_offload_pool_stop();
+	for (i = 0; i < NUM_ELEMENTS(pool->t); i++) {
+		TEST_CHECK(atomic_load(&pool->t[i].ran) == 1);
+		TEST_MSG("Operation %zu ran %u times", i, atomic_load(&pool->t[i].ran));
+	}
+
+	TEST_CASE("Handles for completed operations can be freed");
+	for (i = 0; i < NUM_ELEMENTS(pool->t) / 2; i++) TALLOC_FREE(pool->t[i].op);
+
+	return UNLANG_ACTION_YIELD;
+}
+
+static unlang_action_t test_pool_stop_resume(rlm_rcode_t *p_result, UNUSED int *priority,
+					     UNUSED request_t *request, void *uctx)
+{
+	test_pool_t *pool = uctx;
+
+	pool->resumed = true;
+
+	RETURN_MODULE_OK;
+}
+
+static void test_pool_stop(void)
+{
+	fr_event_list_t	*el;
+	request_t	*request;
+	TALLOC_CTX	*session;
+	test_pool_t	pool = { 0 };
+	size_t		i;
+
+	el = test_worker_alloc(2);
+
+	request = request_local_alloc_external(autofree, NULL);
+	session = talloc_new(autofree);
+	for (i = 0; i < NUM_ELEMENTS(pool.t); i++) {
+		pool.t[i].delay = 10000;
+		pool.t[i].op = fr_tls_offload_alloc(session);
+	}
+
+	TEST_CHECK(unlang_function_push(request, test_pool_stop_push, test_pool_stop_resume,
+					NULL, UNLANG_TOP_FRAME, &pool) == UNLANG_ACTION_PUSHED_CHILD);
+
+	TEST_CASE("Remaining completions resume the request");
+	TEST_CHECK(unlang_interpret_synchronous(el, request) == RLM_MODULE_OK);
+	TEST_CHECK(pool.resumed);
+
+	TEST_CASE("Operations can't be queued once the pool has stopped");
+	i = NUM_ELEMENTS(pool.t) - 1;
+	TEST_CHECK(!fr_tls_offload_enabled());
+	TEST_CHECK(fr_tls_offload_push(pool.t[i].op, request, test_offload_func, &pool.t[i]) < 0);
+	TEST_CHECK(fr_tls_offload_alloc(session) == NULL);
+
+	TEST_CASE("Synchronous operations are run in the worker");
+	fr_tls_offload_run(pool.t[i].op, request, test_offload_func, &pool.t[i]);
+	TEST_CHECK(atomic_load(&pool.t[i].ran) == 2);
+	TEST_CHECK(!pool.t[i].in_thread);
+
+	talloc_free(session);
+	talloc_free(request);
+	talloc_free(el);
+}
+
+TEST_LIST = {
+	{ "push_complete",	test_push_complete },
+	{ "cancel",		test_cancel },
+	{ "run",		test_run },
+	{ "pool_stop",		test_pool_stop },
+
+	{ NULL }
+};
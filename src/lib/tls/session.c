@@ -1276,6 +1276,28 @@ static unlang_action_t tls_session_async_handshake_done_round(UNUSED rlm_rcode_t
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
+/** Drive a paused async job to completion
+ *
+ * Must run on the thread which started the job, which is the crypto
+ * thread the session is pinned to if the handshake is being offloaded.
+ *
+ * @param[in] request	being cancelled.
+ * @param[in] uctx	the #fr_tls_session_t to drain.
+ */
+static void tls_session_async_handshake_drain(UNUSED request_t *request, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	int			ret;
+
+	if (tls_session->last_err != SSL_ERROR_WANT_ASYNC) return;
+
+	do {
+		ERR_clear_error();
+		ret = SSL_read(tls_session->ssl, tls_session->clean_out.data + tls_session->clean_out.used,
+			       sizeof(tls_session->clean_out.data) - tls_session->clean_out.used);
+	} while (SSL_get_error(tls_session->ssl, ret) == SSL_ERROR_WANT_ASYNC);
+}
+
 /** Try very hard to get the SSL * into a consistent state where it's not yielded
  *
  * ...because if it's yielded, we'll probably leak thread contexts and all kinds of memory.
@@ -1284,10 +1306,9 @@ static unlang_action_t tls_session_async_handshake_done_round(UNUSED rlm_rcode_t
  * @param[in] action	we're being signalled with.
  * @param[in] uctx	the SSL * to cancell.
  */
-static void tls_session_async_handshake_signal(UNUSED request_t *request, fr_state_signal_t action, void *uctx)
+static void tls_session_async_handshake_signal(request_t *request, fr_state_signal_t action, void *uctx)
 {
 	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
-	int			ret;
 
 	if (action != FR_SIGNAL_CANCEL) return;
 
@@ -1298,21 +1319,28 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, fr_sta
 	 */
 
 	/*
-	 *	If SSL_get_error returns SSL_ERROR_WANT_ASYNC
-	 *	it means we're yielded in the middle of a
-	 *      callback.
+	 *	If last_err is SSL_ERROR_WANT_ASYNC it means
+	 *	we're yielded in the middle of a callback.
 	 *
 	 *	Keep calling SSL_read() in a loop until we
 	 *	no longer get SSL_ERROR_WANT_ASYNC, then
 	 *	shut it down so it's in a consistent state.
 	 *
+	 *	If the handshake is being offloaded, this
+	 *	first waits for any round in progress on the
+	 *	crypto thread, and then blocks the worker
+	 *	whilst the crypto thread drains the job.
+	 *
 	 *	It'll get freed later when the request is
 	 *	freed.
 	 */
-	for (ret = tls_session->last_ret;
-	     SSL_get_error(tls_session->ssl, ret) == SSL_ERROR_WANT_ASYNC;
-	     ret = SSL_read(tls_session->ssl, tls_session->clean_out.data + tls_session->clean_out.used,
-        		    sizeof(tls_session->clean_out.data) - tls_session->clean_out.used));
+	fr_tls_offload_run(tls_session->offload, request, tls_session_async_handshake_drain, tls_session);
+
+	/*
+	 *	The request is going away, so there's nowhere
+	 *	for these to go.
+	 */
+	fr_pair_list_free(&tls_session->offload_state_pairs);
 
 	/*
 	 *	Unbind the cancelled request from the SSL *
@@ -1322,23 +1350,26 @@ static void tls_session_async_handshake_signal(UNUSED request_t *request, fr_sta
 
 /** Call SSL_read() to continue the TLS state machine
  *
- * This function may be called multiple times, once after every asynchronous request.
+ * If crypto threads are enabled, this runs on the crypto thread
+ * the session is pinned to, so that private key operations and
+ * certificate chain validation don't block the worker.
+ *
+ * The result is left in tls_session->last_ret and tls_session->last_err.
+ * Any errors are logged here, as the OpenSSL error queue is thread local.
  *
- * @param[in,out] p_result	UNUSED.
- * @param[out] priority		UNUSED
  * @param[in] request		The current request.
  * @param[in] uctx		#fr_tls_session_t to continue.
- * @return
- *	- UNLANG_ACTION_CALCULATE_RESULT - We're done with this round.
- *	- UNLANG_ACTION_PUSHED_CHILD - Need to perform more asynchronous actions.
  */
-static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, int *priority,
-							request_t *request, void *uctx)
+static void tls_session_async_handshake_read(request_t *request, void *uctx)
 {
 	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
-	int			err;
 
-	RDEBUG3("(re-)entered state %s", __FUNCTION__);
+	/*
+	 *	The crypto threads run rounds for many
+	 *	sessions, don't let stale errors from
+	 *	another one mask the result of this one.
+	 */
+	ERR_clear_error();
 
 	/*
 	 *	Magic/More magic? Although SSL_read is normally
@@ -1365,19 +1396,8 @@ static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, i
 					 sizeof(tls_session->clean_out.data) - tls_session->clean_out.used);
 	tls_session->can_pause = false;
 	if (tls_session->last_ret > 0) {
-		tls_session->clean_out.used += tls_session->last_ret;
-
-		/*
-		 *	Round successful, and we don't need to do any
-		 *	further processing.
-		 */
-		tls_session->result = FR_TLS_RESULT_SUCCESS;
-	finish:
-		/*
-		 *	Was bound by caller
-		 */
-		fr_tls_session_request_unbind(tls_session->ssl);
-		return UNLANG_ACTION_CALCULATE_RESULT;
+		tls_session->last_err = SSL_ERROR_NONE;
+		return;
 	}
 
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
@@ -1416,6 +1436,81 @@ DIAG_ON(used-but-marked-unused)
 	}
 #endif
 
+	tls_session->last_err = SSL_get_error(tls_session->ssl, tls_session->last_ret);
+	switch (tls_session->last_err) {
+	case SSL_ERROR_WANT_ASYNC:
+	case SSL_ERROR_WANT_ASYNC_JOB:
+		break;
+
+	default:
+		/*
+		 *	Returns 0 if we can continue processing the handshake
+		 *	Returns -1 if we encountered a fatal error.
+		 */
+		if (fr_tls_log_io_error(request,
+					tls_session->last_err, "SSL_read (%s)", __FUNCTION__) < 0) {
+			tls_session->result = FR_TLS_RESULT_ERROR;
+		}
+		break;
+	}
+}
+
+static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, int *priority,
+							request_t *request, void *uctx);
+
+/** Move &session-state pairs created on a crypto thread into the request
+ *
+ * @param[in] request		The current request.
+ * @param[in] tls_session	holding the pairs.
+ */
+static void tls_session_offload_state_merge(request_t *request, fr_tls_session_t *tls_session)
+{
+	fr_pair_t *vp;
+
+	while ((vp = fr_pair_list_head(&tls_session->offload_state_pairs))) {
+		fr_pair_remove(&tls_session->offload_state_pairs, vp);
+		MEM(fr_pair_steal_append(request->session_state_ctx, &request->session_state_pairs, vp) == 0);
+	}
+}
+
+/** Act on the result of calling SSL_read()
+ *
+ * @param[in,out] p_result	UNUSED.
+ * @param[out] priority		UNUSED
+ * @param[in] request		The current request.
+ * @param[in] uctx		#fr_tls_session_t to continue.
+ * @return
+ *	- UNLANG_ACTION_CALCULATE_RESULT - We're done with this round.
+ *	- UNLANG_ACTION_PUSHED_CHILD - Need to perform more asynchronous actions.
+ */
+static unlang_action_t tls_session_async_handshake_process(rlm_rcode_t *p_result, int *priority,
+							   request_t *request, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+
+	RDEBUG3("entered state %s", __FUNCTION__);
+
+	/*
+	 *	Before anything looks for them in &session-state.
+	 */
+	tls_session_offload_state_merge(request, tls_session);
+
+	if (tls_session->last_ret > 0) {
+		tls_session->clean_out.used += tls_session->last_ret;
+
+		/*
+		 *	Round successful, and we don't need to do any
+		 *	further processing.
+		 */
+		tls_session->result = FR_TLS_RESULT_SUCCESS;
+	finish:
+		/*
+		 *	Was bound by caller
+		 */
+		fr_tls_session_request_unbind(tls_session->ssl);
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
 	/*
 	 *	Deal with asynchronous requests from OpenSSL.
 	 *      These aren't actually errors, they're the
@@ -1423,7 +1518,7 @@ DIAG_ON(used-but-marked-unused)
 	 *	it'd like to perform the operation
 	 *	asynchronously.
 	 */
-	switch (err = SSL_get_error(tls_session->ssl, tls_session->last_ret)) {
+	switch (tls_session->last_err) {
 	case SSL_ERROR_WANT_ASYNC:	/* Certification validation or cache loads */
 	{
 		unlang_action_t ua;
@@ -1477,15 +1572,66 @@ DIAG_ON(used-but-marked-unused)
 
 	default:
 		/*
-		 *	Returns 0 if we can continue processing the handshake
-		 *	Returns -1 if we encountered a fatal error.
+		 *	Fatal errors were logged by
+		 *	tls_session_async_handshake_read.
 		 */
-		if (fr_tls_log_io_error(request,
-					err, "SSL_read (%s)", __FUNCTION__) < 0) goto error;
+		if (tls_session->result == FR_TLS_RESULT_ERROR) goto finish;
 		return tls_session_async_handshake_done_round(p_result, priority, request, uctx);
 	}
 }
 
+/** Call SSL_read() to continue the TLS state machine
+ *
+ * This function may be called multiple times, once after every asynchronous request.
+ *
+ * If crypto threads are enabled, the call to SSL_read() is passed to
+ * one of them, and the request yields until it's complete.
+ *
+ * @param[in,out] p_result	UNUSED.
+ * @param[out] priority		UNUSED
+ * @param[in] request		The current request.
+ * @param[in] uctx		#fr_tls_session_t to continue.
+ * @return
+ *	- UNLANG_ACTION_CALCULATE_RESULT - We're done with this round.
+ *	- UNLANG_ACTION_PUSHED_CHILD - Need to perform more asynchronous actions.
+ *	- UNLANG_ACTION_YIELD - Waiting for a crypto thread.
+ */
+static unlang_action_t tls_session_async_handshake_cont(rlm_rcode_t *p_result, int *priority,
+							request_t *request, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+
+	RDEBUG3("(re-)entered state %s", __FUNCTION__);
+
+	if (fr_tls_offload_enabled()) {
+		if (!tls_session->offload) MEM(tls_session->offload = fr_tls_offload_alloc(tls_session));
+
+		if (unlikely(fr_tls_offload_push(tls_session->offload, request,
+						 tls_session_async_handshake_read, tls_session) < 0)) {
+			RPWARN("Running handshake round in worker");
+			goto in_worker;
+		}
+
+		/*
+		 *	Pick up where we left off once the
+		 *	crypto thread is done.
+		 */
+		if (unlikely(unlang_function_repeat_set(request, tls_session_async_handshake_process) < 0)) {
+			fr_tls_offload_cancel(tls_session->offload);
+			tls_session->result = FR_TLS_RESULT_ERROR;
+			fr_tls_session_request_unbind(tls_session->ssl);
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+
+		return UNLANG_ACTION_YIELD;
+	}
+
+in_worker:
+	tls_session_async_handshake_read(request, tls_session);
+
+	return tls_session_async_handshake_process(p_result, priority, request, uctx);
+}
+
 /** Ingest data for another handshake round
  *
  * Advance the TLS handshake by feeding OpenSSL data from dirty_in,
@@ -1584,6 +1730,12 @@ unlang_action_t fr_tls_session_async_handshake_push(request_t *request, fr_tls_s
  */
 static int _fr_tls_session_free(fr_tls_session_t *session)
 {
+	/*
+	 *	Make sure a crypto thread isn't still using
+	 *	the SSL *.
+	 */
+	if (session->offload) fr_tls_offload_cancel(session->offload);
+
 	if (session->ssl) {
 		SSL_set_quiet_shutdown(session->ssl, 1);
 		SSL_shutdown(session->ssl);
@@ -1631,6 +1783,7 @@ fr_tls_session_t *fr_tls_session_alloc_client(TALLOC_CTX *ctx, SSL_CTX *ssl_ctx)
 	MEM(tls_session = talloc_zero(ctx, fr_tls_session_t));
 	talloc_set_destructor(tls_session, _fr_tls_session_free);
 	fr_pair_list_init(&tls_session->extra_pairs);
+	fr_pair_list_init(&tls_session->offload_state_pairs);
 
 	tls_session->ssl = SSL_new(ssl_ctx);
 	if (!tls_session->ssl) {
@@ -1709,6 +1862,7 @@ fr_tls_session_t *fr_tls_session_alloc_server(TALLOC_CTX *ctx, SSL_CTX *ssl_ctx,
 		return NULL;
 	}
 	fr_pair_list_init(&tls_session->extra_pairs);
+	fr_pair_list_init(&tls_session->offload_state_pairs);
 
 	session_init(tls_session);
 	tls_session->ctx = ssl_ctx;
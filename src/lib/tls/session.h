@@ -35,6 +35,7 @@ typedef struct fr_tls_session_s fr_tls_session_t;
 #include "cache.h"
 #include "conf.h"
 #include "index.h"
+#include "offload.h"
 #include "verify.h"
 
 #ifdef __cplusplus
@@ -115,6 +116,9 @@ struct fr_tls_session_s {
 	fr_tls_record_t 	dirty_in;			//!< Encrypted data to decrypt.
 	fr_tls_record_t 	dirty_out;			//!< Encrypted data that's been decrypted.
 	int			last_ret;			//!< Last result returned by SSL_read().
+	int			last_err;			//!< SSL_get_error() for last_ret.  Recorded by the
+								///< thread which called SSL_read(), as the OpenSSL
+								///< error queue is thread local.
 
 	void 			(*record_init)(fr_tls_record_t *buf);
 	void 			(*record_close)(fr_tls_record_t *buf);
@@ -136,6 +140,8 @@ struct fr_tls_session_s {
 	bool			client_cert_ok;			//!< whether or not the client certificate was validated
 	bool			can_pause;			//!< If true, it's ok to pause the request
 								///< using the OpenSSL async API.
+	fr_tls_offload_t	*offload;			//!< For running handshake rounds on a crypto thread.
+								///< Allocated on first use.
 
 	uint8_t			alerts_sent;
 	bool			pending_alert;
@@ -144,6 +150,10 @@ struct fr_tls_session_s {
 
 	fr_pair_list_t		extra_pairs;			//!< Pairs to add to cache and certificate validation
 								///< calls.  These will be duplicated for every call.
+
+	fr_pair_list_t		offload_state_pairs;		//!< &session-state pairs created on a crypto thread.
+								///< Moved into the request by the worker once the
+								///< handshake round completes.
 };
 
 /** Return the tls config associated with a tls_session
@@ -281,6 +291,27 @@ void fr_tls_session_extra_pair_add_shallow(fr_tls_session_t *tls_session, fr_pai
 	fr_pair_append(&tls_session->extra_pairs, vp);
 }
 
+/** Return the list that &session-state pairs should be added to
+ *
+ * Crypto threads must not modify the request, so pairs created there
+ * are kept in the TLS session until the handshake round completes.
+ *
+ * @param[out] ctx		to allocate the pairs in.
+ * @param[in] tls_session	the pairs are being created for.
+ * @param[in] request		the pairs are being created for.
+ * @return the list to add the pairs to.
+ */
+static inline CC_HINT(nonnull)
+fr_pair_list_t *fr_tls_session_state_pairs(TALLOC_CTX **ctx, fr_tls_session_t *tls_session, request_t *request)
+{
+	if (fr_tls_offload_in_thread()) {
+		*ctx = tls_session;
+		return &tls_session->offload_state_pairs;
+	}
+
+	*ctx = request->session_state_ctx;
+	return &request->session_state_pairs;
+}
 
 int 		fr_tls_session_password_cb(char *buf, int num, int rwflag, void *userdata);
 
@@ -141,6 +141,9 @@ int fr_tls_verify_cert_cb(int ok, X509_STORE_CTX *x509_ctx)
 
 	request_t		*request;
 	fr_pair_t		*container = NULL;
+	fr_pair_list_t		*state_pairs;
+	TALLOC_CTX		*state_ctx;
+	int			idx;
 
 	cert = X509_STORE_CTX_get_current_cert(x509_ctx);
 	err = X509_STORE_CTX_get_error(x509_ctx);
@@ -221,8 +224,20 @@ int fr_tls_verify_cert_cb(int ok, X509_STORE_CTX *x509_ctx)
 		}
 	}
 
-	if (verify_applies(conf->verify.attribute_mode, depth, untrusted) &&
-	    (!(container = fr_pair_find_by_da_idx(&request->session_state_pairs, attr_tls_certificate, depth)) ||
+	/*
+	 *	On a crypto thread the containers are built in the
+	 *	TLS session, and appended to &session-state once the
+	 *	round completes.  Their indexes therefore start after
+	 *	the ones already in the request.
+	 */
+	state_pairs = fr_tls_session_state_pairs(&state_ctx, tls_session, request);
+	idx = depth;
+	if (state_pairs != &request->session_state_pairs) {
+		idx -= (int)fr_pair_count_by_da(&request->session_state_pairs, attr_tls_certificate);
+	}
+
+	if (verify_applies(conf->verify.attribute_mode, depth, untrusted) && (idx >= 0) &&
+	    (!(container = fr_pair_find_by_da_idx(state_pairs, attr_tls_certificate, idx)) ||
 	     fr_pair_list_empty(&container->vp_group))) {
 	     	if (!container) {
 	    	     	unsigned int i;
@@ -235,11 +250,11 @@ int fr_tls_verify_cert_cb(int ok, X509_STORE_CTX *x509_ctx)
 			 *      TLS-Certificate container TLVs so the TLS-Certificate
 			 *	indexes match the attribute depth.
 			 */
-			for (i = fr_pair_count_by_da(&request->session_state_pairs, attr_tls_certificate);
-			     i <= (unsigned int)depth;
+			for (i = fr_pair_count_by_da(state_pairs, attr_tls_certificate);
+			     i <= (unsigned int)idx;
 			     i++) {
-				MEM(container = fr_pair_afrom_da(request->session_state_ctx, attr_tls_certificate));
-				fr_pair_append(&request->session_state_pairs, container);
+				MEM(container = fr_pair_afrom_da(state_ctx, attr_tls_certificate));
+				fr_pair_append(state_pairs, container);
 			}
 	     	}
 
@@ -260,7 +275,7 @@ int fr_tls_verify_cert_cb(int ok, X509_STORE_CTX *x509_ctx)
 		 */
 		if (fr_tls_session_pairs_from_x509_cert(&container->vp_group, container,
 							request, cert) < 0) {
-			fr_pair_delete_by_da(&request->session_state_pairs, attr_tls_certificate);
+			fr_pair_delete_by_da(state_pairs, attr_tls_certificate);
 			my_ok = 0;
 			goto done;
 		}
@@ -81,14 +81,26 @@ static char const * const comp2str[] = {
 	"post-auth"
 };
 
+/** Counters for compile time optimisations
+ *
+ * Shared by all of the compile contexts for one section.
+ */
+typedef struct {
+	unsigned int		conds_folded;		//!< Conditions which were found to be constant.
+	unsigned int		sections_removed;	//!< "if", "elsif" and "else" sections which can never run.
+} unlang_compile_stats_t;
+
 typedef struct {
 	rlm_components_t	component;
 	char const		*section_name1;
 	char const		*section_name2;
 	unlang_actions_t	actions;
 	tmpl_rules_t const	*rules;
+	unlang_compile_stats_t	*stats;			//!< Where to record what was optimised.
 } unlang_compile_t;
 
+#define COMPILE_STATS_INC(_ctx, _field) do { if ((_ctx)->stats) (_ctx)->stats->_field++; } while (0)
+
 /*
  *	When we switch to a new unlang ctx, we use the new component
  *	name and number, but we use the CURRENT actions.
@@ -2140,6 +2152,43 @@ static bool compile_action_subsection(unlang_t *c, CONF_SECTION *cs, CONF_SECTIO
 }
 
 
+/** Precompute where each "if" and "elsif" continues when its condition is true
+ *
+ * When an "if" is taken, the interpreter has to skip any "elsif" and
+ * "else" sections which follow it.  Rather than walking the chain for
+ * every request, record the first instruction after the chain in each
+ * "if" and "elsif".
+ *
+ * @param[in] g		whose children have all been compiled.
+ */
+static void compile_if_chains(unlang_group_t *g)
+{
+	unlang_t	*p, *q, *chain;
+
+	/*
+	 *	The chain starts at the first child, not the first
+	 *	"if".  When an "if" with a constant false condition
+	 *	is removed, the group may start with an "elsif" or
+	 *	"else", and they still need to skip the rest of
+	 *	the chain.
+	 */
+	for (p = chain = g->children; ; p = p->next) {
+		if (p && ((p->type == UNLANG_TYPE_ELSIF) || (p->type == UNLANG_TYPE_ELSE))) continue;
+
+		/*
+		 *	"p" ends the chain which started at "chain".
+		 */
+		for (q = chain; q && (q != p); q = q->next) {
+			if ((q->type != UNLANG_TYPE_IF) && (q->type != UNLANG_TYPE_ELSIF)) continue;
+
+			unlang_group_to_cond(unlang_generic_to_group(q))->taken_next = p;
+		}
+
+		if (!p) break;
+		chain = p;
+	}
+}
+
 static unlang_t *compile_children(unlang_group_t *g, unlang_compile_t *unlang_ctx)
 {
 	CONF_ITEM	*ci = NULL;
@@ -2223,6 +2272,7 @@ static unlang_t *compile_children(unlang_group_t *g, unlang_compile_t *unlang_ct
 					cf_log_debug_prefix(ci, "Skipping contents of '%s' due to previous "
 							    "'%s' being always being taken.",
 							    name, skip_else);
+					COMPILE_STATS_INC(unlang_ctx, sections_removed);
 					continue;
 				}
 			}
@@ -2297,8 +2347,15 @@ static unlang_t *compile_children(unlang_group_t *g, unlang_compile_t *unlang_ct
 		 *	conditions.
 		 */
 		switch (single->type) {
-		case UNLANG_TYPE_ELSIF:
 		case UNLANG_TYPE_IF:
+			/*
+			 *	A new "if" starts a new chain, which
+			 *	isn't affected by the previous one.
+			 */
+			skip_else = NULL;
+			FALL_THROUGH;
+
+		case UNLANG_TYPE_ELSIF:
 			was_if = true;
 			{
 				unlang_group_t	*f;
@@ -2320,6 +2377,7 @@ static unlang_t *compile_children(unlang_group_t *g, unlang_compile_t *unlang_ct
 					 *	the unlang tree.
 					 */
 					talloc_free(single);
+					COMPILE_STATS_INC(unlang_ctx, sections_removed);
 					continue;
 
 				default:
@@ -2363,6 +2421,8 @@ static unlang_t *compile_children(unlang_group_t *g, unlang_compile_t *unlang_ct
 	 */
 	compile_action_defaults(c, unlang_ctx);
 
+	compile_if_chains(g);
+
 	return c;
 }
 
@@ -3029,6 +3089,88 @@ static unlang_t *compile_tmpl(unlang_t *parent,
 	return c;
 }
 
+/** Fold comparisons which have become constant after pass2 fixups
+ *
+ * At parse time, comparisons between two literals are evaluated, and
+ * "true" and "false" are propagated through "&&" and "||".  But many
+ * operands are only resolved in pass2 (enumeration values of
+ * dynamically defined attributes, literals which are cast to the type
+ * of the other operand, etc.)
+ *
+ * Any comparison where both operands are now data is evaluated, and
+ * replaced with "true" or "false".  If the whole condition is then
+ * constant, it's replaced with a single "true" or "false" node.
+ *
+ * @param[in] cond	to fold.
+ * @return the number of comparisons which were folded, plus one if the
+ *	whole condition was collapsed to "true" or "false".
+ */
+static unsigned int compile_cond_fold(fr_cond_t *cond)
+{
+	fr_cond_iter_t	iter;
+	fr_cond_t	*leaf;
+	bool		constant = true;
+	unsigned int	folded = 0;
+
+	for (leaf = fr_cond_iter_init(&iter, cond);
+	     leaf;
+	     leaf = fr_cond_iter_next(&iter)) {
+		map_t	*map;
+		bool	value;
+
+		switch (leaf->type) {
+		case COND_TYPE_TRUE:
+		case COND_TYPE_FALSE:
+		case COND_TYPE_AND:
+		case COND_TYPE_OR:
+			continue;
+
+		case COND_TYPE_MAP:
+			break;
+
+		default:
+			constant = false;
+			continue;
+		}
+
+		map = leaf->data.map;
+		if ((leaf->pass2_fixup != PASS2_FIXUP_NONE) ||
+		    !tmpl_is_data(map->lhs) || !tmpl_is_data(map->rhs)) {
+			constant = false;
+			continue;
+		}
+
+		/*
+		 *	Evaluate the comparison on its own, without
+		 *	the rest of the condition.
+		 */
+		value = cond_eval(NULL, RLM_MODULE_NOOP, &(fr_cond_t){ .type = COND_TYPE_MAP, .data.map = map });
+		if (leaf->negate) value = !value;
+
+		TALLOC_FREE(leaf->data.map);
+		leaf->type = value ? COND_TYPE_TRUE : COND_TYPE_FALSE;
+		leaf->negate = false;
+		folded++;
+	}
+
+	if (!constant) return folded;
+
+	/*
+	 *	Every leaf is now "true" or "false", so the condition
+	 *	can be evaluated without a request.  This also catches
+	 *	constant leaves which the parser left inside of "!(...)".
+	 */
+	if (!cond->next && !cond->negate &&
+	    ((cond->type == COND_TYPE_TRUE) || (cond->type == COND_TYPE_FALSE))) return folded;
+
+	folded++;
+	cond->type = cond_eval(NULL, RLM_MODULE_NOOP, cond) ? COND_TYPE_TRUE : COND_TYPE_FALSE;
+	cond->negate = false;
+	cond->next = NULL;
+
+	return folded;
+}
+
 static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
 				       unlang_ext_t const *ext)
 {
@@ -3066,16 +3208,7 @@ static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlan
 	is_truthy = xlat_is_truthy(head, &value);
 #endif
 
-	if (cond->type == COND_TYPE_FALSE) {
-		cf_log_debug_prefix(cs, "Skipping contents of '%s' as it is always 'false'",
-				    unlang_ops[ext->type].name);
-
-		c = compile_section(parent, unlang_ctx, cs, ext);
-		talloc_free(c);
-
-		c = compile_empty(parent, unlang_ctx, cs, ext);
-
-	} else {
+	if (cond->type != COND_TYPE_FALSE) {
 		fr_cond_iter_t	iter;
 		fr_cond_t	*leaf;
 
@@ -3105,8 +3238,33 @@ static unlang_t *compile_if_subsection(unlang_t *parent, unlang_compile_t *unlan
 			}
 		}
 
+		/*
+		 *	Attribute references, enumeration values and
+		 *	casts have now been resolved, so more of the
+		 *	condition may be constant than at parse time.
+		 */
+		if (compile_cond_fold(cond) > 0) {
+			COMPILE_STATS_INC(unlang_ctx, conds_folded);
+
+			if (cond->type == COND_TYPE_TRUE) {
+				cf_log_debug_prefix(cs, "Condition for '%s' is always 'true'",
+						    unlang_ops[ext->type].name);
+			}
+		}
+
 		fr_cond_async_update(cond);
+	}
+
+	if (cond->type == COND_TYPE_FALSE) {
+		cf_log_debug_prefix(cs, "Skipping contents of '%s' as it is always 'false'",
+				    unlang_ops[ext->type].name);
+
+		c = compile_section(parent, unlang_ctx, cs, ext);
+		talloc_free(c);
+
+		c = compile_empty(parent, unlang_ctx, cs, ext);
 
+	} else {
 		c = compile_section(parent, unlang_ctx, cs, ext);
 	}
 	if (!c) return NULL;
@@ -4323,13 +4481,43 @@ fail:
 	return NULL;
 }
 
+/** Count the configuration items in a section, and all of its subsections
+ *
+ */
+static unsigned int compile_count_items(CONF_SECTION const *cs)
+{
+	CONF_ITEM	*ci = NULL;
+	unsigned int	count = 0;
+
+	while ((ci = cf_item_next(cs, ci))) {
+		if (cf_item_is_section(ci)) {
+			count += 1 + compile_count_items(cf_item_to_section(ci));
+			continue;
+		}
+
+		if (cf_item_is_pair(ci)) count++;
+	}
+
+	return count;
+}
+
+/*
+ *	Estimated talloc headers and bytes needed to compile one
+ *	configuration item.  Includes the instruction itself, and
+ *	its tmpls, conditions, maps, and xlats.
+ */
+#define UNLANG_POOL_ITEM_HEADERS	8
+#define UNLANG_POOL_ITEM_LEN		512
+
 int unlang_compile(CONF_SECTION *cs, rlm_components_t component, tmpl_rules_t const *rules, void **instruction)
 {
 	unlang_t			*c;
 	tmpl_rules_t			my_rules;
 	char const			*name1, *name2;
 	CONF_DATA const			*cd;
-	static unlang_ext_t const 	group_ext = {
+	unsigned int			num_items;
+	unlang_compile_stats_t		stats = { 0 };
+	unlang_ext_t			group_ext = {
 						.type = UNLANG_TYPE_GROUP,
 						.len = sizeof(unlang_group_t),
 						.type_name = "unlang_group_t",
@@ -4360,17 +4548,36 @@ int unlang_compile(CONF_SECTION *cs, rlm_components_t component, tmpl_rules_t co
 		rules = &my_rules;
 	}
 
+	/*
+	 *	Allocate the top level group as a pool large enough
+	 *	to hold the entire compiled section.  Everything
+	 *	beneath it is then allocated from the pool, in the
+	 *	order it's compiled.  The instructions for a section
+	 *	are contiguous in memory, and are laid out in roughly
+	 *	the order they're executed, instead of being scattered
+	 *	over the heap.
+	 */
+	num_items = compile_count_items(cs);
+	group_ext.pool_headers = num_items * UNLANG_POOL_ITEM_HEADERS;
+	group_ext.pool_len = num_items * UNLANG_POOL_ITEM_LEN;
+
 	c = compile_section(NULL,
 			    &(unlang_compile_t){
 				.component = component,
 				.section_name1 = cf_section_name1(cs),
 				.section_name2 = cf_section_name2(cs),
 				.actions = default_actions[component],
-				.rules = rules
+				.rules = rules,
+				.stats = &stats
 			    },
 			    cs, &group_ext);
 	if (!c) return -1;
 
+	if (stats.conds_folded || stats.sections_removed) {
+		cf_log_debug(cs, "Optimised %s %s {...} - folded %u constant conditions, removed %u unreachable sections",
+			     name1, name2, stats.conds_folded, stats.sections_removed);
+	}
+
 	if (DEBUG_ENABLED4) unlang_dump(c, 2);
 
 	/*
@@ -27,6 +27,21 @@ RCSID("$Id$")
 #include "condition_priv.h"
 #include "group_priv.h"
 
+/** Skip the else / elsif chain after a taken "if" or "elsif"
+ *
+ * The first instruction after the chain is found at compile time, so
+ * this is a single pointer load, no matter how long the chain is.
+ *
+ * If the frame has no next instruction (i.e. the "if" was pushed on its
+ * own), then there's nothing to skip.
+ */
+static inline CC_HINT(always_inline) void unlang_if_taken(unlang_stack_frame_t *frame)
+{
+	unlang_cond_t *gext = unlang_group_to_cond(unlang_generic_to_group(frame->instruction));
+
+	if (frame->next) frame->next = gext->taken_next;
+}
+
 #ifdef WITH_XLAT_COND
 typedef struct {
 	fr_value_box_list_t	out;				//!< Head of the result of a nested
@@ -60,11 +75,7 @@ static unlang_action_t unlang_if_resume(rlm_rcode_t *p_result, request_t *reques
 	 *	Tell the main interpreter to skip over the else /
 	 *	elsif blocks, as this "if" condition was taken.
 	 */
-	while (frame->next &&
-	       ((frame->next->type == UNLANG_TYPE_ELSE) ||
-		(frame->next->type == UNLANG_TYPE_ELSIF))) {
-		frame->next = frame->next->next;
-	}
+	unlang_if_taken(frame);
 
 	/*
 	 *	We took the "if".  Go recurse into its' children.
@@ -93,11 +104,7 @@ static unlang_action_t unlang_if(rlm_rcode_t *p_result, request_t *request, unla
          *      Tell the main interpreter to skip over the else /
          *      elsif blocks, as this "if" condition was taken.
          */
-        while (frame->next &&
-               ((frame->next->type == UNLANG_TYPE_ELSE) ||
-                (frame->next->type == UNLANG_TYPE_ELSIF))) {
-                frame->next = frame->next->next;
-        }
+        unlang_if_taken(frame);
 
         /*
          *      We took the "if".  Go recurse into its' children.
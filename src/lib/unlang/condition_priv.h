@@ -35,6 +35,10 @@ typedef struct {
 	xlat_exp_head_t	*head;
 	bool		is_truthy;
 	bool		value;
+
+	unlang_t	*taken_next;	//!< Where execution continues if the condition is true,
+					///< i.e. the first instruction after the else / elsif chain.
+					///< Set by compile_children().
 } unlang_cond_t;
 
 /** Cast a group structure to the cond keyword extension
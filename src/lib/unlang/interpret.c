@@ -226,6 +226,7 @@ unlang_frame_action_t result_calculate(request_t *request, unlang_stack_frame_t
 {
 	unlang_t const	*instruction = frame->instruction;
 	unlang_stack_t	*stack = request->stack;
+	int		action;
 
 	RDEBUG4("** [%i] %s - have (%s %d) module returned (%s %d)",
 		stack->depth, __FUNCTION__,
@@ -239,10 +240,18 @@ unlang_frame_action_t result_calculate(request_t *request, unlang_stack_frame_t
 	 */
 	if (*result == RLM_MODULE_NOT_SET) return UNLANG_FRAME_ACTION_NEXT;
 
+	action = instruction->actions.actions[*result];
+
+	/*
+	 *	Priorities are always positive, so the special
+	 *	actions can all be checked for with one comparison.
+	 */
+	if (likely(action >= 0)) goto finalize;
+
 	/*
 	 *	The child's action says return.  Do so.
 	 */
-	if (instruction->actions.actions[*result] == MOD_ACTION_RETURN) {
+	if (action == MOD_ACTION_RETURN) {
 		if (*priority < 0) *priority = 0;
 
 		RDEBUG4("** [%i] %s - action says to return with (%s %d)",
@@ -258,7 +267,7 @@ unlang_frame_action_t result_calculate(request_t *request, unlang_stack_frame_t
 	 *	If "reject", break out of the loop and return
 	 *	reject.
 	 */
-	if (instruction->actions.actions[*result] == MOD_ACTION_REJECT) {
+	if (action == MOD_ACTION_REJECT) {
 		if (*priority < 0) *priority = 0;
 
 		RDEBUG4("** [%i] %s - action says to return with (%s %d)",
@@ -273,7 +282,7 @@ unlang_frame_action_t result_calculate(request_t *request, unlang_stack_frame_t
 	/*
 	 *	The instruction says it should be retried from the beginning.
 	 */
-	if (instruction->actions.actions[*result] == MOD_ACTION_RETRY) {
+	if (action == MOD_ACTION_RETRY) {
 		unlang_retry_t *retry = frame->retry;
 
 		RDEBUG4("** [%i] %s - action says to retry with",
@@ -438,6 +447,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 	 */
 	while (frame->instruction) {
 		unlang_t const		*instruction = frame->instruction;
+		unlang_op_t const	*op = &unlang_ops[instruction->type];
 		unlang_action_t		ua = UNLANG_ACTION_UNWIND;
 		unlang_frame_action_t	fa;
 
@@ -474,7 +484,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 			return UNLANG_FRAME_ACTION_POP;
 		}
 
-		if (!is_repeatable(frame) && (unlang_ops[instruction->type].debug_braces)) {
+		if (!is_repeatable(frame) && (op->debug_braces)) {
 			RDEBUG2("%s {", instruction->debug_name);
 			RINDENT();
 		}
@@ -482,8 +492,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		/*
 		 *	Execute an operation
 		 */
-		RDEBUG4("** [%i] %s >> %s", stack->depth, __FUNCTION__,
-			unlang_ops[instruction->type].name);
+		RDEBUG4("** [%i] %s >> %s", stack->depth, __FUNCTION__, op->name);
 
 		fr_assert(frame->process != NULL);
 
@@ -579,7 +588,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		 *	the section rcode and priority.
 		 */
 		case UNLANG_ACTION_CALCULATE_RESULT:
-			if (unlang_ops[instruction->type].debug_braces) {
+			if (op->debug_braces) {
 				REXDENT();
 
 				/*
@@ -607,7 +616,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 				return UNLANG_FRAME_ACTION_POP;
 
 			case UNLANG_FRAME_ACTION_RETRY:
-				if (unlang_ops[instruction->type].debug_braces) {
+				if (op->debug_braces) {
 					REXDENT();
 					RDEBUG2("} # retrying the same section");
 				}
@@ -623,7 +632,7 @@ unlang_frame_action_t frame_eval(request_t *request, unlang_stack_frame_t *frame
 		 *	Execute the next instruction in this frame
 		 */
 		case UNLANG_ACTION_EXECUTE_NEXT:
-			if ((ua == UNLANG_ACTION_EXECUTE_NEXT) && unlang_ops[instruction->type].debug_braces) {
+			if ((ua == UNLANG_ACTION_EXECUTE_NEXT) && op->debug_braces) {
 				REXDENT();
 				RDEBUG2("}");
 			}
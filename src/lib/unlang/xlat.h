@@ -205,6 +205,16 @@ typedef void (*fr_unlang_xlat_fd_event_t)(xlat_ctx_t const *xctx, request_t *req
 typedef xlat_action_t (*xlat_func_t)(TALLOC_CTX *ctx, fr_dcursor_t *out,
 				     xlat_ctx_t const *xctx, request_t *request, fr_value_box_list_t *in);
 
+/** Decide whether a call to a memoised xlat function can use, or record, a previous result
+ *
+ * @param[in] request		The current request.
+ * @param[in] args		Processed arguments to the call.
+ * @return
+ *	- true if the result can be memoised.
+ *	- false if the function must always be called, e.g. an SQL query which modifies data.
+ */
+typedef bool (*xlat_memoise_t)(request_t *request, fr_value_box_list_t const *args);
+
 /** A callback when the request gets a fr_state_signal_t.
  *
  * @note The callback is automatically removed on unlang_interpret_mark_runnable().
@@ -337,6 +347,10 @@ int		xlat_func_args(xlat_t *xlat, xlat_arg_parser_t const args[]) CC_HINT(nonnul
 
 int		xlat_func_mono(xlat_t *xlat, xlat_arg_parser_t const *arg) CC_HINT(nonnull);
 
+void		xlat_func_memoise(xlat_t *xlat, xlat_memoise_t check) CC_HINT(nonnull(1));
+
+void		xlat_func_memo_stats(uint64_t *hits, uint64_t *misses, xlat_t const *xlat) CC_HINT(nonnull);
+
 bool		xlat_is_truthy(xlat_exp_head_t const *head, bool *out);
 
 /** Set a callback for global instantiation of xlat functions
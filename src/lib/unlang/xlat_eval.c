@@ -1046,10 +1046,12 @@ xlat_action_t xlat_frame_eval_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 	case XLAT_ACTION_DONE:
 		fr_dcursor_next(out);		/* Wind to the start of this functions output */
+		if (exp->call.func->memoise) xlat_memo_done(request, exp, out->dlist, fr_dcursor_current(out));
 		RDEBUG2("   --> %pV", fr_dcursor_current(out));
 		break;
 
 	case XLAT_ACTION_FAIL:
+		if (exp->call.func->memoise) xlat_memo_cancel(request, exp);
 		break;
 	}
 
@@ -1119,6 +1121,19 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		}
 
 		VALUE_BOX_TALLOC_LIST_VERIFY(result);
+
+		/*
+		 *	The same call was made earlier in this
+		 *	request, use its result.
+		 */
+		if (node->call.func->memoise && xlat_memo_find(ctx, out, request, node, result)) {
+			if (RDEBUG_ENABLED2) xlat_debug_log_expansion(request, *in, &result_copy);
+			fr_dlist_talloc_free(&result_copy);
+			fr_dcursor_next(out);
+			xlat_debug_log_result(request, fr_dcursor_current(out));
+			break;
+		}
+
 		xa = node->call.func->func(ctx, out,
 					   XLAT_CTX(node->call.inst->data, t->data, t->mctx, NULL),
 					   request, result);
@@ -1129,6 +1144,7 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 		switch (xa) {
 		case XLAT_ACTION_FAIL:
+			if (node->call.func->memoise) xlat_memo_cancel(request, node);
 			return xa;
 
 		case XLAT_ACTION_PUSH_CHILD:
@@ -1145,6 +1161,7 @@ xlat_action_t xlat_frame_eval_repeat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 
 		case XLAT_ACTION_DONE:				/* Process the result */
 			fr_dcursor_next(out);
+			if (node->call.func->memoise) xlat_memo_done(request, node, out->dlist, fr_dcursor_current(out));
 			xlat_debug_log_result(request, fr_dcursor_current(out));
 			break;
 		}
@@ -1405,7 +1422,10 @@ xlat_action_t xlat_frame_eval(TALLOC_CTX *ctx, fr_dcursor_t *out, xlat_exp_head_
 					 *	output type.
 					 */
 					if (!fr_dlist_next(&result, vb)) {
-						if (fr_value_box_cast_in_place(vb, vb, cast, NULL) < 0) goto fail;
+						if (fr_value_box_cast_in_place_with(vb, vb,
+										    node->vpt->cast_func ?
+										    node->vpt->cast_func : fr_value_box_cast,
+										    cast, NULL) < 0) goto fail;
 
 					} else {
 						ssize_t slen, vlen;
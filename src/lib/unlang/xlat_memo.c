@@ -0,0 +1,373 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file xlat_memo.c
+ * @brief Per-request memoisation of xlat function results
+ *
+ * Functions which have opted in with #xlat_func_memoise have their
+ * results recorded, keyed on the function and the values of its
+ * (processed) arguments.  If the function is called again during the
+ * same request, with the same arguments, the recorded result is
+ * returned instead of calling the function.
+ *
+ * As the key contains the expanded arguments, changing an attribute
+ * referenced in the arguments results in a different key.  The only
+ * state which isn't captured is whatever the function itself reads,
+ * e.g. the contents of a database.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/request_data.h>
+#include <freeradius-devel/unlang/xlat_priv.h>
+#include <freeradius-devel/util/rb.h>
+
+typedef struct {
+	fr_rb_node_t		node;		//!< Entry in the tree of results.
+	fr_dlist_t		entry;		//!< Entry in the list of calls still running.
+
+	xlat_t const		*func;		//!< Function which was called.
+	xlat_exp_t const	*exp;		//!< Call which hasn't returned yet.
+
+	fr_value_box_list_t const *key;		//!< Arguments to compare.  Points to args,
+						///< or to the caller's list when searching.
+	fr_value_box_list_t	args;		//!< Arguments the function was called with.
+	unsigned int		num_args;	//!< Number of top level arguments.
+
+	fr_value_box_list_t	result;		//!< What the function returned.
+} xlat_memo_entry_t;
+
+typedef struct {
+	fr_rb_tree_t		*tree;		//!< Results, indexed by function and arguments.
+	fr_dlist_head_t		pending;	//!< Calls which haven't returned yet.
+} xlat_memo_t;
+
+/*
+ *	Unique pointer for the request data.
+ */
+static int const xlat_memo_id = 0;
+
+/** Compare two argument lists, descending into groups
+ *
+ */
+static int8_t xlat_memo_args_cmp(fr_value_box_list_t const *a, fr_value_box_list_t const *b)
+{
+	fr_value_box_t const	*va, *vb;
+	int8_t			ret;
+
+	for (va = fr_dlist_head(a), vb = fr_dlist_head(b);
+	     va && vb;
+	     va = fr_dlist_next(a, va), vb = fr_dlist_next(b, vb)) {
+		ret = CMP(va->type, vb->type);
+		if (ret != 0) return ret;
+
+		switch (va->type) {
+		case FR_TYPE_NULL:
+			continue;
+
+		case FR_TYPE_GROUP:
+			ret = xlat_memo_args_cmp(&va->vb_group, &vb->vb_group);
+			break;
+
+		default:
+			ret = fr_value_box_cmp(va, vb);
+			break;
+		}
+		if (ret != 0) return ret;
+	}
+
+	return CMP(va != NULL, vb != NULL);
+}
+
+static int8_t xlat_memo_cmp(void const *one, void const *two)
+{
+	xlat_memo_entry_t const	*a = one, *b = two;
+	int8_t			ret;
+
+	ret = CMP(a->func, b->func);
+	if (ret != 0) return ret;
+
+	ret = CMP(a->num_args, b->num_args);
+	if (ret != 0) return ret;
+
+	return xlat_memo_args_cmp(a->key, b->key);
+}
+
+static int _xlat_memo_free(xlat_memo_t *memo)
+{
+	xlat_memo_entry_t *e;
+
+	/*
+	 *	Entries in the pending list aren't in the tree.
+	 */
+	while ((e = fr_dlist_pop_head(&memo->pending))) talloc_free(e);
+
+	return 0;
+}
+
+/** Find the memo for a request, optionally creating it
+ *
+ */
+static xlat_memo_t *xlat_memo_get(request_t *request, bool create)
+{
+	xlat_memo_t *memo;
+
+	memo = request_data_reference(request, &xlat_memo_id, 0);
+	if (memo || !create) return memo;
+
+	MEM(memo = talloc_zero(NULL, xlat_memo_t));
+	MEM(memo->tree = fr_rb_inline_talloc_alloc(memo, xlat_memo_entry_t, node, xlat_memo_cmp, NULL));
+	fr_dlist_talloc_init(&memo->pending, xlat_memo_entry_t, entry);
+	talloc_set_destructor(memo, _xlat_memo_free);
+
+	if (request_data_talloc_add(request, &xlat_memo_id, 0, xlat_memo_t, memo, true, true, false) < 0) {
+		talloc_free(memo);
+		return NULL;
+	}
+
+	return memo;
+}
+
+/** Return a previous result for a call, or record that the call is being made
+ *
+ * Must only be called for functions which have memoisation enabled.
+ *
+ * If there's no previous result, the caller must call the function, and
+ * then #xlat_memo_done or #xlat_memo_cancel, depending on whether the
+ * function succeeded.
+ *
+ * @param[in] ctx	to allocate copies of the result in.
+ * @param[out] out	where to append a copy of the result.
+ * @param[in] request	the current request.
+ * @param[in] exp	call being evaluated.
+ * @param[in] args	processed arguments to the call.
+ * @return
+ *	- true if a previous result was appended to out.
+ *	- false if the function needs to be called.
+ */
+bool xlat_memo_find(TALLOC_CTX *ctx, fr_dcursor_t *out,
+		    request_t *request, xlat_exp_t const *exp, fr_value_box_list_t const *args)
+{
+	xlat_t const		*func = exp->call.func;
+	xlat_memo_t		*memo;
+	xlat_memo_entry_t	*e, find = { .func = func, .key = args, .num_args = fr_dlist_num_elements(args) };
+	fr_value_box_t		*vb;
+
+	if (func->memoise_check && !func->memoise_check(request, args)) return false;
+
+	memo = xlat_memo_get(request, true);
+	if (!memo) return false;
+
+	e = fr_rb_find(memo->tree, &find);
+	if (e) {
+		fr_value_box_list_t copy;
+
+		fr_value_box_list_init(&copy);
+		if (fr_value_box_list_acopy(ctx, &copy, &e->result) < 0) goto miss;
+
+		while ((vb = fr_dlist_pop_head(&copy))) fr_dcursor_append(out, vb);
+
+		atomic_fetch_add_explicit(&func->memo_stats->hits, 1, memory_order_relaxed);
+
+		RDEBUG2("Using memoised result of %s()", func->name);
+		return true;
+	}
+
+miss:
+	atomic_fetch_add_explicit(&func->memo_stats->misses, 1, memory_order_relaxed);
+
+	MEM(e = talloc_zero(memo, xlat_memo_entry_t));
+	e->func = func;
+	e->exp = exp;
+	e->num_args = find.num_args;
+	e->key = &e->args;
+	fr_value_box_list_init(&e->args);
+	fr_value_box_list_init(&e->result);
+
+	if (fr_value_box_list_acopy(e, &e->args, args) < 0) {
+		talloc_free(e);
+		return false;
+	}
+
+	fr_dlist_insert_head(&memo->pending, e);
+
+	return false;
+}
+
+/** Find the pending entry for a call, and remove it from the pending list
+ *
+ */
+static xlat_memo_entry_t *xlat_memo_pending_pop(xlat_memo_t **memo_out, request_t *request, xlat_exp_t const *exp)
+{
+	xlat_memo_t		*memo;
+	xlat_memo_entry_t	*e = NULL;
+
+	memo = xlat_memo_get(request, false);
+	if (!memo) return NULL;
+
+	while ((e = fr_dlist_next(&memo->pending, e))) {
+		if (e->exp != exp) continue;
+
+		fr_dlist_remove(&memo->pending, e);
+		e->exp = NULL;
+		*memo_out = memo;
+
+		return e;
+	}
+
+	return NULL;
+}
+
+/** Record the result of a call
+ *
+ * Does nothing if #xlat_memo_find wasn't called for this call.
+ *
+ * @param[in] request	the current request.
+ * @param[in] exp	call which completed.
+ * @param[in] out	the list the function wrote its result to.
+ * @param[in] first	the first box the function added to out.
+ *			NULL if the function didn't produce any output.
+ */
+void xlat_memo_done(request_t *request, xlat_exp_t const *exp, fr_value_box_list_t const *out,
+		    fr_value_box_t const *first)
+{
+	xlat_memo_t		*memo;
+	xlat_memo_entry_t	*e, *old;
+	fr_value_box_t const	*vb;
+
+	e = xlat_memo_pending_pop(&memo, request, exp);
+	if (!e) return;
+
+	for (vb = first; vb; vb = fr_dlist_next(out, vb)) {
+		fr_value_box_t *copy;
+
+		MEM(copy = fr_value_box_alloc_null(e));
+		if (fr_value_box_copy(copy, copy, vb) < 0) {
+			talloc_free(e);
+			return;
+		}
+		fr_dlist_insert_tail(&e->result, copy);
+	}
+
+	/*
+	 *	The same call may have been made in parallel.
+	 *	The most recent result wins.
+	 */
+	old = fr_rb_find(memo->tree, e);
+	if (old) {
+		fr_rb_remove(memo->tree, old);
+		talloc_free(old);
+	}
+
+	if (!fr_rb_insert(memo->tree, e)) talloc_free(e);
+}
+
+/** Discard the record of a call which failed
+ *
+ * @param[in] request	the current request.
+ * @param[in] exp	call which failed.
+ */
+void xlat_memo_cancel(request_t *request, xlat_exp_t const *exp)
+{
+	xlat_memo_t *memo;
+
+	talloc_free(xlat_memo_pending_pop(&memo, request, exp));
+}
+
+static int cmd_stats_xlat_memo(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	xlat_t const	*x = talloc_get_type_abort_const(ctx, xlat_t);
+	uint64_t	hits, misses;
+
+	xlat_func_memo_stats(&hits, &misses, x);
+
+	fprintf(fp, "hits\t\t\t%" PRIu64 "\n", hits);
+	fprintf(fp, "misses\t\t\t%" PRIu64 "\n", misses);
+	fprintf(fp, "hit_rate\t\t%.2f\n", (hits + misses) ? (hits * 100.0) / (hits + misses) : 0.0);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_xlat_memo_table[] = {
+	{
+		.parent = "stats",
+		.name = "xlat",
+		.help = "Statistics for memoised xlat functions.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats xlat",
+		.add_name = true,
+		.name = "self",
+		.func = cmd_stats_xlat_memo,
+		.help = "Show how often the memoised results of an xlat function were used.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Enable memoisation for an xlat function
+ *
+ * The result of every call is recorded for the lifetime of the request,
+ * keyed on the arguments of the call.  Only functions which return the
+ * same output for the same input (e.g. read only database queries)
+ * should be memoised.
+ *
+ * The counters are available with the `stats xlat <name>` radmin command.
+ *
+ * @param[in] x		to enable memoisation for.
+ * @param[in] check	Optional callback to decide whether an individual
+ *			call can be memoised.  May be NULL.
+ */
+void xlat_func_memoise(xlat_t *x, xlat_memoise_t check)
+{
+	if (!x->memo_stats) {
+		MEM(x->memo_stats = talloc_zero(x, xlat_memo_stats_t));
+
+		if (fr_command_register_hook(NULL, x->name, x, cmd_xlat_memo_table) < 0) {
+			PWARN("Failed registering radmin commands for xlat \"%s\"", x->name);
+		}
+	}
+
+	x->memoise = true;
+	x->memoise_check = check;
+}
+
+/** Return how often memoised results were used for an xlat function
+ *
+ * @param[out] hits	Calls which used a previous result.
+ * @param[out] misses	Calls where the function had to be called.
+ * @param[in] x		to return counters for.
+ */
+void xlat_func_memo_stats(uint64_t *hits, uint64_t *misses, xlat_t const *x)
+{
+	if (!x->memo_stats) {
+		*hits = *misses = 0;
+		return;
+	}
+
+	*hits = atomic_load_explicit(&x->memo_stats->hits, memory_order_relaxed);
+	*misses = atomic_load_explicit(&x->memo_stats->misses, memory_order_relaxed);
+}
@@ -32,6 +32,12 @@ extern "C" {
 
 #include <freeradius-devel/io/pair.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #ifdef DEBUG_XLAT
 #  define XLAT_DEBUG RDEBUG3
 #else
@@ -42,6 +48,15 @@ typedef fr_slen_t (*xlat_print_t)(fr_sbuff_t *in, xlat_exp_t const *self, void *
 typedef int (*xlat_resolve_t)(xlat_exp_t *self, void *inst, xlat_res_rules_t const *xr_rules);
 typedef int (*xlat_purify_t)(xlat_exp_t *self, void *inst, request_t *request);
 
+/** Counters for memoised xlat functions
+ *
+ * Updated by all worker threads.
+ */
+typedef struct {
+	_Atomic(uint64_t)	hits;			//!< Calls which used a previous result.
+	_Atomic(uint64_t)	misses;			//!< Calls where the function was called.
+} xlat_memo_stats_t;
+
 typedef struct xlat_s {
 	fr_rb_node_t		node;			//!< Entry in the xlat function tree.
 	char const		*name;			//!< Name of xlat function.
@@ -74,6 +89,10 @@ typedef struct xlat_s {
 
 	xlat_input_type_t	input_type;		//!< Type of input used.
 	xlat_arg_parser_t const	*args;			//!< Definition of args consumed.
+
+	bool			memoise;		//!< Record results for the lifetime of the request.
+	xlat_memoise_t		memoise_check;		//!< Decides whether a call can be memoised.
+	xlat_memo_stats_t	*memo_stats;		//!< How often memoised results were used.
 } xlat_t;
 
 typedef enum {
@@ -342,6 +361,17 @@ int		xlat_eval_init(void);
 
 void		xlat_eval_free(void);
 
+/*
+ *	xlat_memo.c
+ */
+bool		xlat_memo_find(TALLOC_CTX *ctx, fr_dcursor_t *out,
+			       request_t *request, xlat_exp_t const *exp, fr_value_box_list_t const *args);
+
+void		xlat_memo_done(request_t *request, xlat_exp_t const *exp, fr_value_box_list_t const *out,
+			       fr_value_box_t const *first);
+
+void		xlat_memo_cancel(request_t *request, xlat_exp_t const *exp);
+
 void		unlang_xlat_init(void);
 
 int		unlang_xlat_push_node(TALLOC_CTX *ctx, bool *p_success, fr_value_box_list_t *out,
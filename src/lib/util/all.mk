@@ -2,12 +2,15 @@ SUBMAKEFILES := \
 	base_16_32_64_tests.mk \
 	dbuff_tests.mk \
 	dcursor_tests.mk \
+	dict_snapshot_tests.mk \
 	dlist_tests.mk \
 	edit_tests.mk \
 	heap_tests.mk \
+	histogram_tests.mk \
 	hmac_tests.mk \
 	libfreeradius-util.mk \
 	lst_tests.mk \
+	md5_mb_tests.mk \
 	minmax_heap_tests.mk \
 	pair_legacy_tests.mk \
 	pair_list_perf_test.mk \
@@ -15,5 +18,8 @@ SUBMAKEFILES := \
 	rb_tests.mk \
 	sbuff_tests.mk \
 	size_tests.mk \
-	strerror_tests.mk
+	strerror_tests.mk \
+	timer_wheel_tests.mk \
+	value_cast_perf_test.mk \
+	value_cast_tests.mk
 
@@ -589,6 +589,8 @@ int			fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name, char
 						    char const *dependent);
 
 int			fr_dict_read(fr_dict_t *dict, char const *dict_dir, char const *filename);
+
+int			fr_dict_snapshot_write(fr_dict_t const *dict, char const *dict_dir) CC_HINT(nonnull);
 /** @} */
 
 /** @name Autoloader interface
@@ -635,6 +637,8 @@ fr_dict_gctx_t		*fr_dict_global_ctx_init(TALLOC_CTX *ctx, bool free_at_exit, cha
 
 void			fr_dict_global_ctx_perm_check(fr_dict_gctx_t *gctx, bool enable);
 
+void			fr_dict_global_ctx_snapshot(fr_dict_gctx_t *gctx, bool enable);
+
 void			fr_dict_global_ctx_set(fr_dict_gctx_t const *gctx);
 
 int			fr_dict_global_ctx_free(fr_dict_gctx_t const *gctx);
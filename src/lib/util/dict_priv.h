@@ -118,6 +118,9 @@ struct fr_dict_gctx_s {
 
 	bool			read_only;
 
+	bool			snapshot;		//!< Whether we load precompiled snapshots of
+							///< protocol dictionaries, if they're available.
+
 	char			*dict_dir_default;	//!< The default location for loading dictionaries if one
 							///< wasn't provided.
 
@@ -151,6 +154,14 @@ fr_dict_t		*dict_alloc(TALLOC_CTX *ctx);
 
 int			dict_dlopen(fr_dict_t *dict, char const *name);
 
+int			dict_root_set(fr_dict_t *dict, char const *name, unsigned int proto_number);
+
+/** Name of the precompiled snapshot in a protocol's dictionary directory
+ */
+#define FR_DICT_SNAPSHOT_FILE	"dictionary.snapshot"
+
+int			dict_snapshot_load(fr_dict_t **out, char const *dict_dir, char const *proto_name);
+
 fr_dict_attr_t 		*dict_attr_alloc_null(TALLOC_CTX *ctx);
 
 /** Optional arguments for initialising/allocating attributes
@@ -0,0 +1,1144 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Precompiled binary snapshots of protocol dictionaries
+ *
+ * Loading a protocol dictionary from text means tokenising every file,
+ * resolving every name, and validating every definition.  A snapshot
+ * stores the result of all of that work.  Loading a snapshot just
+ * replays the attributes, vendors, enumerations and references back
+ * into the dictionary, without any lookups or validation.
+ *
+ * The snapshot contains no pointers.  Attributes refer to each other
+ * by their index in the snapshot, and attributes in other protocol
+ * dictionaries are referred to by protocol name and OID.  Strings are
+ * stored with their terminating '\0'.  They're read directly from the
+ * mapped file, and copied into the dictionary as it's rebuilt.
+ *
+ * Snapshots are tied to the library build which wrote them, and record
+ * a SHA1 digest of the names and contents of all the files in the
+ * protocol's dictionary directory.  If any of the files have changed,
+ * the snapshot is ignored and the text dictionaries are read as normal.
+ * The body of the snapshot has its own digest, so a damaged snapshot
+ * is detected before anything is read from it.
+ *
+ * @file src/lib/util/dict_snapshot.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/dict_priv.h>
+#include <freeradius-devel/util/rb.h>
+#include <freeradius-devel/util/sha1.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/version.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DICT_SNAPSHOT_MAGIC	0x46524453	/* "FRDS" */
+#define DICT_SNAPSHOT_VERSION	2
+
+/** How a reference is stored
+ *
+ */
+typedef enum {
+	DICT_SNAPSHOT_REF_LOCAL = 0,		//!< Index of an attribute in this snapshot.
+	DICT_SNAPSHOT_REF_FOREIGN_ROOT,		//!< Root of another protocol dictionary.
+	DICT_SNAPSHOT_REF_FOREIGN		//!< OID of an attribute in another protocol dictionary.
+} dict_snapshot_ref_t;
+
+/** Maps attributes to their index in the snapshot
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the index tree.
+	fr_dict_attr_t const	*da;			//!< Attribute.
+	uint32_t		idx;			//!< Index of the attribute in the snapshot.
+} dict_snapshot_index_t;
+
+typedef struct {
+	fr_dict_t const		*dict;			//!< Dictionary being written.
+	fr_dbuff_t		*dbuff;			//!< Where the snapshot is being written.
+
+	fr_rb_tree_t		*index;			//!< Attributes by pointer.
+	fr_dict_attr_t const	**attrs;		//!< Attributes by index.
+	uint32_t		num_attrs;		//!< Number of attributes written.
+} dict_snapshot_ctx_t;
+
+/** Skip hidden files, the snapshot, and any partially written snapshots
+ *
+ */
+static int dict_snapshot_source_filter(struct dirent const *dp)
+{
+	if (dp->d_name[0] == '.') return 0;
+
+	return (strncmp(dp->d_name, FR_DICT_SNAPSHOT_FILE, sizeof(FR_DICT_SNAPSHOT_FILE) - 1) != 0);
+}
+
+/** Add one file to the digest of the dictionary sources
+ *
+ */
+static int dict_snapshot_source_hash(fr_sha1_ctx *sha1, char const *path, char const *rel, off_t size)
+{
+	uint8_t		buffer[8192];
+	uint64_t	len = size;
+	int		fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening \"%s\": %s", path, fr_syserror(errno));
+		return -1;
+	}
+
+	fr_sha1_update(sha1, (uint8_t const *)rel, strlen(rel) + 1);
+	fr_sha1_update(sha1, (uint8_t const *)&len, sizeof(len));
+
+	for (;;) {
+		ssize_t slen;
+
+		slen = read(fd, buffer, sizeof(buffer));
+		if (slen == 0) break;
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf("Failed reading \"%s\": %s", path, fr_syserror(errno));
+			close(fd);
+			return -1;
+		}
+		fr_sha1_update(sha1, buffer, slen);
+	}
+	close(fd);
+
+	return 0;
+}
+
+/** Hash the files in a dictionary directory, and all of its subdirectories
+ *
+ * Files are hashed in name order, along with their path relative to the
+ * protocol's dictionary directory.  The digest therefore depends only on
+ * the dictionaries themselves, and not on where or when they were
+ * installed.
+ */
+static int dict_snapshot_sources(fr_sha1_ctx *sha1, char const *dir, char const *rel)
+{
+	struct dirent	**names;
+	int		num, i;
+	int		ret = 0;
+
+	num = scandir(dir, &names, dict_snapshot_source_filter, alphasort);
+	if (num < 0) {
+		fr_strerror_printf("Failed opening \"%s\": %s", dir, fr_syserror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct stat	statbuf;
+		char		*path, *path_rel;
+
+		if (ret < 0) goto next;
+
+		path = talloc_asprintf(NULL, "%s%c%s", dir, FR_DIR_SEP, names[i]->d_name);
+		path_rel = rel ? talloc_asprintf(path, "%s%c%s", rel, FR_DIR_SEP, names[i]->d_name) :
+				 talloc_strdup(path, names[i]->d_name);
+
+		if (stat(path, &statbuf) < 0) {
+			fr_strerror_printf("Failed stating \"%s\": %s", path, fr_syserror(errno));
+			ret = -1;
+		} else if (S_ISDIR(statbuf.st_mode)) {
+			ret = dict_snapshot_sources(sha1, path, path_rel);
+		} else if (S_ISREG(statbuf.st_mode)) {
+			ret = dict_snapshot_source_hash(sha1, path, path_rel, statbuf.st_size);
+		}
+		talloc_free(path);
+
+	next:
+		free(names[i]);
+	}
+	free(names);
+
+	return ret;
+}
+
+/** Calculate the digest of the dictionary sources
+ *
+ */
+static int dict_snapshot_sources_digest(uint8_t digest[static SHA1_DIGEST_LENGTH], char const *dict_dir)
+{
+	fr_sha1_ctx sha1;
+
+	fr_sha1_init(&sha1);
+	if (dict_snapshot_sources(&sha1, dict_dir, NULL) < 0) return -1;
+	fr_sha1_final(digest, &sha1);
+
+	return 0;
+}
+
+static int8_t dict_snapshot_index_cmp(void const *one, void const *two)
+{
+	dict_snapshot_index_t const *a = one, *b = two;
+
+	return CMP((uintptr_t)a->da, (uintptr_t)b->da);
+}
+
+/** Find the snapshot index of an attribute
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the attribute isn't in the snapshot.
+ */
+static int dict_snapshot_index_find(uint32_t *idx, dict_snapshot_ctx_t *sctx, fr_dict_attr_t const *da)
+{
+	dict_snapshot_index_t *found;
+
+	found = fr_rb_find(sctx->index, &(dict_snapshot_index_t){ .da = da });
+	if (!found) {
+		fr_strerror_printf("Attribute \"%s\" is not part of dictionary \"%s\"",
+				   da->name, fr_dict_root(sctx->dict)->name);
+		return -1;
+	}
+	*idx = found->idx;
+
+	return 0;
+}
+
+static ssize_t dict_snapshot_str_in(fr_dbuff_t *dbuff, char const *str)
+{
+	size_t		len = strlen(str) + 1;
+	fr_dbuff_t	work_dbuff = FR_DBUFF(dbuff);
+
+	if (len > UINT16_MAX) {
+		fr_strerror_printf("String \"%.32s...\" is too long", str);
+		return -1;
+	}
+
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint16_t)len);
+	FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, (uint8_t const *)str, len);
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
+}
+
+static ssize_t dict_snapshot_flags_in(fr_dbuff_t *dbuff, fr_dict_attr_flags_t const *flags)
+{
+	return fr_dbuff_in_memcpy(dbuff, (uint8_t const *)flags, sizeof(*flags));
+}
+
+/** Write a reference to another attribute
+ *
+ */
+static int dict_snapshot_ref_encode(dict_snapshot_ctx_t *sctx, fr_dict_attr_t const *ref)
+{
+	fr_dict_t const	*other = fr_dict_by_da(ref);
+	char		oid[1024];
+	uint32_t	idx;
+
+	if (other == sctx->dict) {
+		if (dict_snapshot_index_find(&idx, sctx, ref) < 0) return -1;
+
+		if ((fr_dbuff_in(sctx->dbuff, (uint8_t)DICT_SNAPSHOT_REF_LOCAL) < 0) ||
+		    (fr_dbuff_in(sctx->dbuff, idx) < 0)) return -1;
+		return 0;
+	}
+
+	if (ref->flags.is_root) {
+		if ((fr_dbuff_in(sctx->dbuff, (uint8_t)DICT_SNAPSHOT_REF_FOREIGN_ROOT) < 0) ||
+		    (dict_snapshot_str_in(sctx->dbuff, fr_dict_root(other)->name) < 0)) return -1;
+		return 0;
+	}
+
+	if (fr_dict_attr_oid_print(&FR_SBUFF_OUT(oid, sizeof(oid)), NULL, ref, false) <= 0) {
+		fr_strerror_printf_push("Failed printing reference to \"%s\"", ref->name);
+		return -1;
+	}
+
+	if ((fr_dbuff_in(sctx->dbuff, (uint8_t)DICT_SNAPSHOT_REF_FOREIGN) < 0) ||
+	    (dict_snapshot_str_in(sctx->dbuff, fr_dict_root(other)->name) < 0) ||
+	    (dict_snapshot_str_in(sctx->dbuff, oid) < 0)) return -1;
+
+	return 0;
+}
+
+static int dict_snapshot_attr_encode(dict_snapshot_ctx_t *sctx, fr_dict_attr_t const *da, uint32_t parent_idx);
+
+/** Write all the children of an attribute
+ *
+ * Attributes within the same bin of the child array are written in
+ * reverse order.  Re-inserting them in that order results in exactly
+ * the same bin ordering as the text dictionaries produced.
+ */
+static int dict_snapshot_chain_encode(dict_snapshot_ctx_t *sctx, fr_dict_attr_t const *da, uint32_t parent_idx)
+{
+	if (da->next && (dict_snapshot_chain_encode(sctx, da->next, parent_idx) < 0)) return -1;
+
+	return dict_snapshot_attr_encode(sctx, da, parent_idx);
+}
+
+static int dict_snapshot_children_encode(dict_snapshot_ctx_t *sctx, fr_dict_attr_t const *parent, uint32_t parent_idx)
+{
+	fr_dict_attr_t const	**children;
+	unsigned int		i;
+
+	if (!fr_dict_attr_has_ext(parent, FR_DICT_ATTR_EXT_CHILDREN)) return 0;
+
+	children = dict_attr_children(parent);
+	if (!children) return 0;
+
+	for (i = 0; i <= UINT8_MAX; i++) {
+		if (!children[i]) continue;
+
+		if (dict_snapshot_chain_encode(sctx, children[i], parent_idx) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Write an attribute, and then its children
+ *
+ */
+static int dict_snapshot_attr_encode(dict_snapshot_ctx_t *sctx, fr_dict_attr_t const *da, uint32_t parent_idx)
+{
+	dict_snapshot_index_t	*entry;
+	fr_hash_table_t		*namespace;
+	uint8_t			in_namespace = 0;
+	uint32_t		idx = sctx->num_attrs++;
+
+	entry = talloc(sctx->index, dict_snapshot_index_t);
+	if (unlikely(!entry)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	entry->da = da;
+	entry->idx = idx;
+	if (!fr_rb_insert(sctx->index, entry)) {
+		fr_strerror_printf("Attribute \"%s\" appears twice in the attribute tree", da->name);
+		return -1;
+	}
+
+	if (idx >= talloc_array_length(sctx->attrs)) {
+		fr_dict_attr_t const **attrs;
+
+		attrs = talloc_realloc(sctx->index, sctx->attrs, fr_dict_attr_t const *, idx * 2);
+		if (unlikely(!attrs)) goto oom;
+		sctx->attrs = attrs;
+	}
+	sctx->attrs[idx] = da;
+
+	/*
+	 *	Attributes which were redefined later in the
+	 *	dictionaries are still children of the parent,
+	 *	but aren't found by name.
+	 */
+	if (!da->flags.is_root) {
+		namespace = dict_attr_namespace(da->parent);
+		if (namespace && (fr_hash_table_find(namespace, da) == da)) in_namespace = 1;
+
+		if ((fr_dbuff_in(sctx->dbuff, parent_idx) < 0) ||
+		    (fr_dbuff_in(sctx->dbuff, (uint32_t)da->attr) < 0) ||
+		    (fr_dbuff_in(sctx->dbuff, (uint8_t)da->type) < 0) ||
+		    (fr_dbuff_in(sctx->dbuff, in_namespace) < 0) ||
+		    (dict_snapshot_flags_in(sctx->dbuff, &da->flags) < 0) ||
+		    (dict_snapshot_str_in(sctx->dbuff, da->name) < 0)) return -1;
+	}
+
+	return dict_snapshot_children_encode(sctx, da, idx);
+}
+
+/** Write all the attributes in the dictionary
+ *
+ */
+static int dict_snapshot_tree_encode(dict_snapshot_ctx_t *sctx, uint32_t *count)
+{
+	if (dict_snapshot_attr_encode(sctx, sctx->dict->root, 0) < 0) return -1;
+	*count = sctx->num_attrs - 1;
+
+	return 0;
+}
+
+/** Write the aliases in the namespace of every attribute
+ *
+ */
+static int dict_snapshot_aliases_encode(dict_snapshot_ctx_t *sctx, uint32_t *count)
+{
+	uint32_t		i;
+
+	for (i = 0; i < sctx->num_attrs; i++) {
+		fr_dict_attr_t const	*da = sctx->attrs[i];
+		fr_dict_attr_t const	*alias;
+		fr_hash_table_t		*namespace;
+		fr_hash_iter_t		iter;
+
+		namespace = dict_attr_namespace(da);
+		if (!namespace) continue;
+
+		for (alias = fr_hash_table_iter_init(namespace, &iter);
+		     alias;
+		     alias = fr_hash_table_iter_next(namespace, &iter)) {
+			if (!alias->flags.is_alias) {
+				uint32_t idx;
+
+				/*
+				 *	Everything else in the namespace
+				 *	must already have been written.
+				 */
+				if (dict_snapshot_index_find(&idx, sctx, alias) < 0) return -1;
+				continue;
+			}
+
+			if ((fr_dbuff_in(sctx->dbuff, i) < 0) ||
+			    (fr_dbuff_in(sctx->dbuff, (uint32_t)alias->attr) < 0) ||
+			    (fr_dbuff_in(sctx->dbuff, (uint8_t)alias->type) < 0) ||
+			    (dict_snapshot_flags_in(sctx->dbuff, &alias->flags) < 0) ||
+			    (dict_snapshot_str_in(sctx->dbuff, alias->name) < 0) ||
+			    (dict_snapshot_ref_encode(sctx, fr_dict_attr_ref(alias)) < 0)) return -1;
+			(*count)++;
+		}
+	}
+
+	return 0;
+}
+
+/** Write one enumeration value
+ *
+ * Values are checked to ensure they survive a round trip through their
+ * network encoding.
+ */
+static int dict_snapshot_enum_encode(dict_snapshot_ctx_t *sctx, uint32_t idx, fr_dict_attr_t const *da,
+				     fr_dict_enum_value_t const *enumv)
+{
+	uint8_t		buffer[1024];
+	fr_dbuff_t	value_dbuff = FR_DBUFF_TMP(buffer, sizeof(buffer));
+	fr_value_box_t	check;
+	ssize_t		slen;
+	uint32_t	child_idx = 0;
+	int		cmp;
+
+	slen = fr_value_box_to_network(&value_dbuff, enumv->value);
+	if (slen < 0) {
+		fr_strerror_printf_push("Failed encoding VALUE %s for %s", enumv->name, da->name);
+		return -1;
+	}
+
+	fr_value_box_init_null(&check);
+	if (fr_value_box_from_network(NULL, &check, da->type, NULL,
+				      &FR_DBUFF_TMP(buffer, (size_t)slen), slen, false) < 0) {
+		fr_strerror_printf_push("Failed decoding VALUE %s for %s", enumv->name, da->name);
+		return -1;
+	}
+	cmp = fr_value_box_cmp(&check, enumv->value);
+	fr_value_box_clear(&check);
+	if (cmp != 0) {
+		fr_strerror_printf("VALUE %s for %s can't be stored without loss of precision",
+				   enumv->name, da->name);
+		return -1;
+	}
+
+	if (fr_dict_attr_is_key_field(da) && enumv->child_struct[0]) {
+		if (dict_snapshot_index_find(&child_idx, sctx, enumv->child_struct[0]) < 0) return -1;
+		child_idx++;
+	}
+
+	if ((fr_dbuff_in(sctx->dbuff, idx) < 0) ||
+	    (fr_dbuff_in(sctx->dbuff, child_idx) < 0) ||
+	    (dict_snapshot_str_in(sctx->dbuff, enumv->name) < 0) ||
+	    (fr_dbuff_in(sctx->dbuff, (uint16_t)slen) < 0) ||
+	    (fr_dbuff_in_memcpy(sctx->dbuff, buffer, slen) < 0)) return -1;
+
+	return 0;
+}
+
+/** Write the enumeration values of every attribute
+ *
+ * The names which are used when printing a value are written first, so
+ * that they take precedence when the snapshot is loaded.
+ */
+static int dict_snapshot_enums_encode(dict_snapshot_ctx_t *sctx, uint32_t *count)
+{
+	uint32_t i;
+
+	for (i = 0; i < sctx->num_attrs; i++) {
+		fr_dict_attr_t const		*da = sctx->attrs[i];
+		fr_dict_attr_ext_enumv_t const	*ext;
+		fr_dict_enum_value_t const	*enumv;
+		fr_hash_iter_t			iter;
+
+		ext = fr_dict_attr_ext(da, FR_DICT_ATTR_EXT_ENUMV);
+		if (!ext || !ext->name_by_value) continue;
+
+		for (enumv = fr_hash_table_iter_init(ext->name_by_value, &iter);
+		     enumv;
+		     enumv = fr_hash_table_iter_next(ext->name_by_value, &iter)) {
+			if (dict_snapshot_enum_encode(sctx, i, da, enumv) < 0) return -1;
+			(*count)++;
+		}
+
+		for (enumv = fr_hash_table_iter_init(ext->value_by_name, &iter);
+		     enumv;
+		     enumv = fr_hash_table_iter_next(ext->value_by_name, &iter)) {
+			if (fr_hash_table_find(ext->name_by_value, enumv) == enumv) continue;
+
+			if (dict_snapshot_enum_encode(sctx, i, da, enumv) < 0) return -1;
+			(*count)++;
+		}
+	}
+
+	return 0;
+}
+
+/** Write the vendors
+ *
+ * Where multiple vendor names share a PEN, the one which is used when
+ * looking up by PEN is written last.
+ */
+static int dict_snapshot_vendors_encode(dict_snapshot_ctx_t *sctx, uint32_t *count)
+{
+	fr_dict_t const		*dict = sctx->dict;
+	fr_dict_vendor_t const	*dv;
+	fr_hash_iter_t		iter;
+	int			pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (dv = fr_hash_table_iter_init(dict->vendors_by_name, &iter);
+		     dv;
+		     dv = fr_hash_table_iter_next(dict->vendors_by_name, &iter)) {
+			bool by_num = (fr_hash_table_find(dict->vendors_by_num, dv) == dv);
+
+			if (by_num != (pass == 1)) continue;
+
+			if ((dict_snapshot_str_in(sctx->dbuff, dv->name) < 0) ||
+			    (fr_dbuff_in(sctx->dbuff, dv->pen) < 0) ||
+			    (fr_dbuff_in(sctx->dbuff, (uint8_t)dv->type) < 0) ||
+			    (fr_dbuff_in(sctx->dbuff, (uint8_t)dv->length) < 0) ||
+			    (fr_dbuff_in(sctx->dbuff, (uint8_t)dv->continuation) < 0)) return -1;
+			(*count)++;
+		}
+	}
+
+	return 0;
+}
+
+/** Write a snapshot of a protocol dictionary
+ *
+ * The snapshot is written to a temporary file, and then renamed to
+ * #FR_DICT_SNAPSHOT_FILE in dict_dir, so running servers never see a
+ * partially written snapshot.
+ *
+ * @param[in] dict	to write a snapshot of.  Must have been loaded from
+ *			dict_dir.
+ * @param[in] dict_dir	the protocol's dictionary directory.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_dict_snapshot_write(fr_dict_t const *dict, char const *dict_dir)
+{
+	TALLOC_CTX		*ctx;
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	fr_dbuff_marker_t	m_count, m_digest;
+	dict_snapshot_ctx_t	sctx;
+	uint8_t			digest[SHA1_DIGEST_LENGTH];
+	fr_sha1_ctx		sha1;
+	uint32_t		count;
+	char			*filename, *tmp;
+	int			fd = -1;
+	int			ret = -1;
+
+	if (dict == dict_gctx->internal) {
+		fr_strerror_const("Snapshots can only be written for protocol dictionaries");
+		return -1;
+	}
+
+	if (dict_snapshot_sources_digest(digest, dict_dir) < 0) return -1;
+
+	ctx = talloc_init_const("dict_snapshot");
+	if (!fr_dbuff_init_talloc(ctx, &dbuff, &tctx, 65536, SIZE_MAX)) goto error;
+
+	sctx = (dict_snapshot_ctx_t) {
+		.dict = dict,
+		.dbuff = &dbuff
+	};
+	sctx.index = fr_rb_inline_talloc_alloc(ctx, dict_snapshot_index_t, node, dict_snapshot_index_cmp, NULL);
+	if (unlikely(!sctx.index)) goto oom;
+	sctx.attrs = talloc_array(sctx.index, fr_dict_attr_t const *, 1024);
+	if (unlikely(!sctx.attrs)) goto oom;
+
+	/*
+	 *	Header.  The digest of the body is filled in
+	 *	once the body has been written.
+	 */
+	if ((fr_dbuff_in(&dbuff, (uint32_t)DICT_SNAPSHOT_MAGIC) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint32_t)DICT_SNAPSHOT_VERSION) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint64_t)RADIUSD_MAGIC_NUMBER) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint16_t)sizeof(fr_dict_attr_flags_t)) < 0) ||
+	    (fr_dbuff_in_memcpy(&dbuff, digest, sizeof(digest)) < 0)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		goto error;
+	}
+	fr_dbuff_marker(&m_digest, &dbuff);
+	if (fr_dbuff_memset(&dbuff, 0, SHA1_DIGEST_LENGTH) < 0) goto oom;
+
+	/*
+	 *	Protocol
+	 */
+	if ((dict_snapshot_str_in(&dbuff, dict->root->name) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint32_t)dict->root->attr) < 0) ||
+	    (dict_snapshot_flags_in(&dbuff, &dict->root->flags) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint8_t)(dict->dl != NULL)) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint32_t)dict->vsa_parent) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint32_t)dict->self_allocated) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint8_t)dict->default_type_size) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint8_t)dict->default_type_length) < 0)) goto oom;
+
+#define SECTION(_func) \
+	do { \
+		count = 0; \
+		fr_dbuff_marker(&m_count, &dbuff); \
+		if (fr_dbuff_in(&dbuff, count) < 0) goto oom; \
+		if (_func < 0) goto error; \
+		if (fr_dbuff_in(&m_count, count) < 0) goto oom; \
+		fr_dbuff_marker_release(&m_count); \
+	} while (0)
+
+	SECTION(dict_snapshot_vendors_encode(&sctx, &count));
+
+	/*
+	 *	The attribute count doesn't include the root.
+	 */
+	SECTION(dict_snapshot_tree_encode(&sctx, &count));
+
+	SECTION(dict_snapshot_aliases_encode(&sctx, &count));
+	SECTION(dict_snapshot_enums_encode(&sctx, &count));
+
+	/*
+	 *	References are resolved last, as attributes with
+	 *	references can't have children added to them.
+	 */
+	{
+		uint32_t i;
+
+		count = 0;
+		fr_dbuff_marker(&m_count, &dbuff);
+		if (fr_dbuff_in(&dbuff, count) < 0) goto oom;
+
+		for (i = 0; i < sctx.num_attrs; i++) {
+			fr_dict_attr_t const *ref = fr_dict_attr_ref(sctx.attrs[i]);
+
+			if (!ref) continue;
+
+			if ((fr_dbuff_in(&dbuff, i) < 0) ||
+			    (dict_snapshot_ref_encode(&sctx, ref) < 0)) goto error;
+			count++;
+		}
+
+		if (fr_dbuff_in(&m_count, count) < 0) goto oom;
+		fr_dbuff_marker_release(&m_count);
+	}
+
+	/*
+	 *	Digest of everything after the header
+	 */
+	{
+		uint8_t const *body = fr_dbuff_current(&m_digest) + SHA1_DIGEST_LENGTH;
+
+		fr_sha1_init(&sha1);
+		fr_sha1_update(&sha1, body, fr_dbuff_current(&dbuff) - body);
+		fr_sha1_final(digest, &sha1);
+	}
+	if (fr_dbuff_in_memcpy(&m_digest, digest, sizeof(digest)) < 0) goto oom;
+	fr_dbuff_marker_release(&m_digest);
+
+	/*
+	 *	Write to a temporary file and rename it into place.
+	 */
+	filename = talloc_asprintf(ctx, "%s%c%s", dict_dir, FR_DIR_SEP, FR_DICT_SNAPSHOT_FILE);
+	tmp = talloc_asprintf(ctx, "%s.%u", filename, (unsigned int)getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening \"%s\": %s", tmp, fr_syserror(errno));
+		goto error;
+	}
+
+	{
+		uint8_t const	*p = fr_dbuff_start(&dbuff);
+		size_t		len = fr_dbuff_used(&dbuff);
+
+		while (len > 0) {
+			ssize_t slen;
+
+			slen = write(fd, p, len);
+			if (slen < 0) {
+				if (errno == EINTR) continue;
+
+				fr_strerror_printf("Failed writing \"%s\": %s", tmp, fr_syserror(errno));
+			write_error:
+				unlink(tmp);
+				goto error;
+			}
+			p += slen;
+			len -= slen;
+		}
+
+		if (close(fd) < 0) {
+			fd = -1;
+			fr_strerror_printf("Failed closing \"%s\": %s", tmp, fr_syserror(errno));
+			goto write_error;
+		}
+		fd = -1;
+	}
+
+	if (rename(tmp, filename) < 0) {
+		fr_strerror_printf("Failed renaming \"%s\" to \"%s\": %s", tmp, filename, fr_syserror(errno));
+		goto write_error;
+	}
+
+	ret = 0;
+
+error:
+	if (fd >= 0) close(fd);
+	talloc_free(ctx);
+
+	return ret;
+}
+
+/** Read a string
+ *
+ * The string points into the mapped snapshot, so it must be copied
+ * before the snapshot is unmapped.  All the functions which add names
+ * to the dictionary do so.
+ */
+static int dict_snapshot_str_out(char const **out, fr_dbuff_t *dbuff)
+{
+	uint16_t	len;
+	char const	*p;
+
+	if (fr_dbuff_out(&len, dbuff) < 0) return -1;
+	if ((len == 0) || (fr_dbuff_remaining(dbuff) < len)) return -1;
+
+	p = (char const *)fr_dbuff_current(dbuff);
+	if (p[len - 1] != '\0') return -1;
+	fr_dbuff_advance(dbuff, len);
+
+	*out = p;
+	return 0;
+}
+
+static int dict_snapshot_flags_out(fr_dict_attr_flags_t *flags, fr_dbuff_t *dbuff)
+{
+	if (fr_dbuff_out_memcpy((uint8_t *)flags, dbuff, sizeof(*flags)) < 0) return -1;
+
+	return 0;
+}
+
+/** Read an attribute index
+ *
+ */
+static int dict_snapshot_idx_out(fr_dict_attr_t **out, fr_dict_attr_t **attrs, fr_dbuff_t *dbuff)
+{
+	uint32_t idx;
+
+	if (fr_dbuff_out(&idx, dbuff) < 0) return -1;
+	if (idx >= talloc_array_length(attrs)) {
+		fr_strerror_printf("Invalid attribute index %u", idx);
+		return -1;
+	}
+
+	*out = attrs[idx];
+	return 0;
+}
+
+/** Read a reference, loading other protocol dictionaries if required
+ *
+ */
+static int dict_snapshot_ref_out(fr_dict_attr_t const **out, fr_dict_attr_t **attrs,
+				 char const *filename, fr_dbuff_t *dbuff)
+{
+	uint8_t		kind;
+	char const	*proto, *oid;
+	fr_dict_t	*other;
+
+	if (fr_dbuff_out(&kind, dbuff) < 0) return -1;
+
+	switch (kind) {
+	case DICT_SNAPSHOT_REF_LOCAL:
+	{
+		fr_dict_attr_t *da;
+
+		if (dict_snapshot_idx_out(&da, attrs, dbuff) < 0) return -1;
+		*out = da;
+		return 0;
+	}
+
+	case DICT_SNAPSHOT_REF_FOREIGN_ROOT:
+	case DICT_SNAPSHOT_REF_FOREIGN:
+		if (dict_snapshot_str_out(&proto, dbuff) < 0) return -1;
+
+		other = dict_by_protocol_name(proto);
+		if (!other && (fr_dict_protocol_afrom_file(&other, proto, NULL, filename) < 0)) return -1;
+
+		if (kind == DICT_SNAPSHOT_REF_FOREIGN_ROOT) {
+			*out = other->root;
+			return 0;
+		}
+
+		if (dict_snapshot_str_out(&oid, dbuff) < 0) return -1;
+
+		*out = fr_dict_attr_by_oid(NULL, other->root, oid);
+		if (!*out) {
+			fr_strerror_printf("No such attribute '%s.%s'", proto, oid);
+			return -1;
+		}
+		return 0;
+
+	default:
+		fr_strerror_printf("Invalid reference type %u", kind);
+		return -1;
+	}
+}
+
+/** Rebuild a protocol dictionary from a mapped snapshot
+ *
+ */
+static int dict_snapshot_decode(fr_dict_t **out, char const *filename, char const *dict_dir,
+				char const *proto_name, fr_dbuff_t *dbuff)
+{
+	fr_dict_t		*dict = NULL;
+	fr_dict_attr_t		**attrs = NULL;
+	fr_dict_attr_t		*da;
+	fr_dict_attr_flags_t	flags;
+	uint8_t			sources[SHA1_DIGEST_LENGTH], current[SHA1_DIGEST_LENGTH];
+	uint8_t			body[SHA1_DIGEST_LENGTH], digest[SHA1_DIGEST_LENGTH];
+	fr_sha1_ctx		sha1;
+	uint32_t		magic, version, proto_num, vsa_parent, self_allocated, count, i;
+	uint64_t		lib_magic;
+	uint16_t		flags_len;
+	uint8_t			require_dl, default_type_size, default_type_length;
+	char const		*name;
+	TALLOC_CTX		*tmp_ctx = NULL;
+
+#define OUT(_x) if (fr_dbuff_out(_x, dbuff) < 0) goto truncated
+
+	OUT(&magic);
+	OUT(&version);
+	OUT(&lib_magic);
+	OUT(&flags_len);
+
+	if ((magic != DICT_SNAPSHOT_MAGIC) || (version != DICT_SNAPSHOT_VERSION) ||
+	    (lib_magic != RADIUSD_MAGIC_NUMBER) || (flags_len != sizeof(fr_dict_attr_flags_t))) {
+		fr_strerror_printf("Snapshot \"%s\" was written by a different version of the server", filename);
+		return 0;
+	}
+
+	/*
+	 *	Check the source files haven't changed
+	 */
+	if (fr_dbuff_out_memcpy(sources, dbuff, sizeof(sources)) < 0) goto truncated;
+	if (fr_dbuff_out_memcpy(body, dbuff, sizeof(body)) < 0) goto truncated;
+
+	if (dict_snapshot_sources_digest(current, dict_dir) < 0) return -1;
+	if (memcmp(current, sources, sizeof(current)) != 0) {
+		fr_strerror_printf("Snapshot \"%s\" does not match the dictionaries in \"%s\"", filename, dict_dir);
+		return 0;
+	}
+
+	/*
+	 *	Check the snapshot itself hasn't been damaged
+	 */
+	fr_sha1_init(&sha1);
+	fr_sha1_update(&sha1, fr_dbuff_current(dbuff), fr_dbuff_remaining(dbuff));
+	fr_sha1_final(digest, &sha1);
+	if (memcmp(digest, body, sizeof(digest)) != 0) goto truncated;
+
+	if (dict_snapshot_str_out(&name, dbuff) < 0) goto truncated;
+	if (strcasecmp(name, proto_name) != 0) {
+		fr_strerror_printf("Snapshot \"%s\" is for protocol \"%s\", not \"%s\"", filename, name, proto_name);
+		return 0;
+	}
+	OUT(&proto_num);
+	if (dict_snapshot_flags_out(&flags, dbuff) < 0) goto truncated;
+	OUT(&require_dl);
+	OUT(&vsa_parent);
+	OUT(&self_allocated);
+	OUT(&default_type_size);
+	OUT(&default_type_length);
+
+	/*
+	 *	Mirrors what happens when a PROTOCOL line is read.
+	 */
+	dict = dict_alloc(dict_gctx);
+	if (!dict) return -1;
+
+	if ((dict_dlopen(dict, name) < 0) && require_dl) {
+		talloc_free(dict);
+		return -1;
+	}
+
+	if (dict_root_set(dict, name, proto_num) < 0) {
+		talloc_free(dict);
+		return -1;
+	}
+
+	if (dict_protocol_add(dict) < 0) {
+		talloc_free(dict);
+		return -1;
+	}
+	dict->root->flags = flags;
+	dict->vsa_parent = vsa_parent;
+	dict->self_allocated = self_allocated;
+	dict->default_type_size = default_type_size;
+	dict->default_type_length = default_type_length;
+
+	tmp_ctx = talloc_new(NULL);
+
+	/*
+	 *	Vendors
+	 */
+	OUT(&count);
+	for (i = 0; i < count; i++) {
+		uint32_t		pen;
+		uint8_t			type, length, continuation;
+		fr_dict_vendor_t	*dv;
+
+		if (dict_snapshot_str_out(&name, dbuff) < 0) goto truncated;
+		OUT(&pen);
+		OUT(&type);
+		OUT(&length);
+		OUT(&continuation);
+
+		if (dict_vendor_add(dict, name, pen) < 0) goto error;
+
+		dv = UNCONST(fr_dict_vendor_t *, fr_dict_vendor_by_name(dict, name));
+		if (!dv) goto error;
+		dv->type = type;
+		dv->length = length;
+		dv->continuation = continuation;
+	}
+
+	/*
+	 *	Attributes, parents always come before their children.
+	 */
+	OUT(&count);
+	attrs = talloc_array(tmp_ctx, fr_dict_attr_t *, count + 1);
+	if (unlikely(!attrs)) {
+		fr_strerror_const("Out of memory");
+		goto error;
+	}
+	attrs[0] = dict->root;
+
+	for (i = 1; i <= count; i++) {
+		fr_dict_attr_t	*parent;
+		uint32_t	parent_idx, attr;
+		uint8_t		type, in_namespace;
+
+		OUT(&parent_idx);
+		OUT(&attr);
+		OUT(&type);
+		OUT(&in_namespace);
+		if (dict_snapshot_flags_out(&flags, dbuff) < 0) goto truncated;
+		if (dict_snapshot_str_out(&name, dbuff) < 0) goto truncated;
+
+		if ((parent_idx >= i) || (type >= FR_TYPE_MAX) || (in_namespace > 1)) {
+			fr_strerror_printf("Invalid definition for attribute \"%s\"", name);
+			goto error;
+		}
+		parent = attrs[parent_idx];
+
+		da = dict_attr_alloc(dict->pool, parent, name, attr, type, &(dict_attr_args_t){ .flags = &flags });
+		if (!da) goto error;
+
+		if (in_namespace && (dict_attr_add_to_namespace(parent, da) < 0)) goto error;
+		if (dict_attr_child_add(parent, da) < 0) goto error;
+
+		attrs[i] = da;
+	}
+
+	/*
+	 *	Aliases
+	 */
+	OUT(&count);
+	for (i = 0; i < count; i++) {
+		fr_dict_attr_t		*parent;
+		fr_dict_attr_t const	*ref;
+		fr_hash_table_t		*namespace;
+		uint32_t		attr;
+		uint8_t			type;
+
+		if (dict_snapshot_idx_out(&parent, attrs, dbuff) < 0) goto truncated;
+		OUT(&attr);
+		OUT(&type);
+		if (dict_snapshot_flags_out(&flags, dbuff) < 0) goto truncated;
+		if (dict_snapshot_str_out(&name, dbuff) < 0) goto truncated;
+		if (dict_snapshot_ref_out(&ref, attrs, filename, dbuff) < 0) goto error;
+
+		if (type >= FR_TYPE_MAX) {
+			fr_strerror_printf("Invalid definition for ALIAS \"%s\"", name);
+			goto error;
+		}
+
+		namespace = dict_attr_namespace(parent);
+		if (!namespace) {
+			fr_strerror_printf("Attribute '%s' does not contain a namespace", parent->name);
+			goto error;
+		}
+
+		da = dict_attr_alloc(dict->pool, parent, name, attr, type,
+				     &(dict_attr_args_t){ .flags = &flags, .ref = ref });
+		if (!da) goto error;
+
+		if (!fr_hash_table_insert(namespace, da)) {
+			fr_strerror_printf("Failed inserting ALIAS '%s' into namespace %s", name, parent->name);
+			talloc_free(da);
+			goto error;
+		}
+	}
+
+	/*
+	 *	Enumeration values
+	 */
+	OUT(&count);
+	for (i = 0; i < count; i++) {
+		fr_dict_attr_t	*child_struct = NULL;
+		uint32_t	child_idx;
+		uint16_t	len;
+		fr_value_box_t	value;
+
+		if (dict_snapshot_idx_out(&da, attrs, dbuff) < 0) goto truncated;
+		OUT(&child_idx);
+		if (dict_snapshot_str_out(&name, dbuff) < 0) goto truncated;
+		OUT(&len);
+
+		if (child_idx > 0) {
+			if (child_idx > talloc_array_length(attrs)) {
+				fr_strerror_printf("Invalid attribute index %u", child_idx - 1);
+				goto error;
+			}
+			child_struct = attrs[child_idx - 1];
+		}
+
+		if (fr_dbuff_remaining(dbuff) < len) goto truncated;
+
+		fr_value_box_init_null(&value);
+		if (fr_value_box_from_network(tmp_ctx, &value, da->type, NULL,
+					      &FR_DBUFF_TMP(fr_dbuff_current(dbuff), (size_t)len), len, false) < 0) goto error;
+		fr_dbuff_advance(dbuff, len);
+
+		if (dict_attr_enum_add_name(da, name, &value, false, false, child_struct) < 0) goto error;
+		fr_value_box_clear(&value);
+	}
+
+	/*
+	 *	References
+	 */
+	OUT(&count);
+	for (i = 0; i < count; i++) {
+		fr_dict_attr_t const *ref;
+
+		if (dict_snapshot_idx_out(&da, attrs, dbuff) < 0) goto truncated;
+		if (dict_snapshot_ref_out(&ref, attrs, filename, dbuff) < 0) goto error;
+
+		if (dict_attr_ref_set(da, ref) < 0) goto error;
+	}
+
+	if (fr_dbuff_remaining(dbuff) != 0) {
+		fr_strerror_printf("Trailing garbage in snapshot \"%s\"", filename);
+		goto error;
+	}
+
+	talloc_free(tmp_ctx);
+	*out = dict;
+
+	return 1;
+
+truncated:
+	fr_strerror_printf("Snapshot \"%s\" is truncated or corrupt", filename);
+
+error:
+	talloc_free(tmp_ctx);
+	if (dict) fr_dict_free(&dict, "global");
+
+	return -1;
+}
+
+/** Load a protocol dictionary from a snapshot, if there's a usable one
+ *
+ * @param[out] out		Where to write the new dictionary.
+ * @param[in] dict_dir		the protocol's dictionary directory.
+ * @param[in] proto_name	that we're loading the dictionary for.
+ * @return
+ *	- 1 if the dictionary was loaded from the snapshot.
+ *	- 0 if there's no snapshot, or the snapshot is out of date.
+ *	- -1 if the snapshot couldn't be loaded.
+ */
+int dict_snapshot_load(fr_dict_t **out, char const *dict_dir, char const *proto_name)
+{
+	char		*filename;
+	struct stat	statbuf;
+	void		*map;
+	int		fd, ret;
+
+	filename = talloc_asprintf(NULL, "%s%c%s", dict_dir, FR_DIR_SEP, FR_DICT_SNAPSHOT_FILE);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			talloc_free(filename);
+			return 0;
+		}
+
+		fr_strerror_printf("Failed opening \"%s\": %s", filename, fr_syserror(errno));
+	error:
+		if (fd >= 0) close(fd);
+		talloc_free(filename);
+		return -1;
+	}
+
+	if (fstat(fd, &statbuf) < 0) {
+		fr_strerror_printf("Failed stating \"%s\": %s", filename, fr_syserror(errno));
+		goto error;
+	}
+
+#ifdef S_IWOTH
+	if (dict_gctx->perm_check && ((statbuf.st_mode & S_IWOTH) != 0)) {
+		fr_strerror_printf("Dictionary snapshot is globally writable: %s", filename);
+		goto error;
+	}
+#endif
+
+	if (statbuf.st_size == 0) {
+		fr_strerror_printf("Snapshot \"%s\" is empty", filename);
+		goto error;
+	}
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping \"%s\": %s", filename, fr_syserror(errno));
+		goto error;
+	}
+
+	ret = dict_snapshot_decode(out, filename, dict_dir, proto_name,
+				   &FR_DBUFF_TMP((uint8_t const *)map, (size_t)statbuf.st_size));
+
+	munmap(map, statbuf.st_size);
+	close(fd);
+	talloc_free(filename);
+
+	return ret;
+}
@@ -0,0 +1,321 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for precompiled dictionary snapshots
+ *
+ * The dictionaries are copied to a temporary directory, so that the
+ * tests can write snapshots, and modify the text dictionaries, without
+ * touching the source tree.
+ *
+ * @file src/lib/util/dict_snapshot_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/dict_priv.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static TALLOC_CTX	*autofree;
+static char		*test_dir;
+static char		*radius_dir;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("dict_snapshot_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+}
+
+/** Copy the dictionaries to a new temporary directory
+ *
+ */
+static void test_dir_alloc(void)
+{
+	char *cmd;
+
+	test_dir = talloc_strdup(autofree, "/tmp/dict_snapshot_tests.XXXXXX");
+	TEST_ASSERT(mkdtemp(test_dir) != NULL);
+
+	cmd = talloc_asprintf(autofree, "cp -R share/dictionary/. %s", test_dir);
+	TEST_ASSERT(system(cmd) == 0);
+	talloc_free(cmd);
+
+	radius_dir = talloc_asprintf(autofree, "%s/radius", test_dir);
+}
+
+/** Remove the temporary directory
+ *
+ */
+static void test_dir_free(void)
+{
+	char *cmd;
+
+	cmd = talloc_asprintf(autofree, "rm -rf %s", test_dir);
+	TEST_CHECK(system(cmd) == 0);
+	talloc_free(cmd);
+}
+
+/** Create a new global dictionary context, containing just the internal dictionary
+ *
+ */
+static void test_gctx_alloc(bool snapshot)
+{
+	fr_dict_gctx_t	*gctx;
+	fr_dict_t	*internal;
+
+	gctx = fr_dict_global_ctx_init(autofree, false, test_dir);
+	TEST_CHECK(gctx != NULL);
+	if (!gctx) fr_perror("dict_snapshot_tests");
+
+	fr_dict_global_ctx_set(gctx);
+	fr_dict_global_ctx_perm_check(gctx, false);
+	fr_dict_global_ctx_snapshot(gctx, snapshot);
+
+	TEST_CHECK(fr_dict_internal_afrom_file(&internal, FR_DICTIONARY_INTERNAL_DIR, __FILE__) == 0);
+}
+
+/** Load the RADIUS dictionary from the text files, and write a snapshot of it
+ *
+ */
+static fr_dict_t *test_snapshot_write(void)
+{
+	fr_dict_t *dict = NULL;
+
+	test_dir_alloc();
+	test_gctx_alloc(false);
+
+	TEST_CHECK(fr_dict_protocol_afrom_file(&dict, "radius", NULL, __FILE__) == 0);
+	if (!dict) {
+		fr_perror("dict_snapshot_tests");
+		return NULL;
+	}
+
+	TEST_CHECK(fr_dict_snapshot_write(dict, radius_dir) == 0);
+
+	return dict;
+}
+
+/** Replace the first occurrence of a string in a file, keeping the file the same size
+ *
+ */
+static void test_file_replace(char const *filename, char const *from, char const *to)
+{
+	uint8_t		buffer[1 << 20];
+	uint8_t		*p;
+	ssize_t		len;
+	int		fd;
+	struct stat	statbuf;
+	struct timeval	times[2];
+
+	fr_assert(strlen(from) == strlen(to));
+
+	TEST_CHECK(stat(filename, &statbuf) == 0);
+
+	fd = open(filename, O_RDWR);
+	TEST_CHECK(fd >= 0);
+
+	len = read(fd, buffer, sizeof(buffer));
+	TEST_CHECK(len > 0);
+
+	p = memmem(buffer, len, from, strlen(from));
+	TEST_CHECK(p != NULL);
+	if (!p) {
+		close(fd);
+		return;
+	}
+	memcpy(p, to, strlen(to));
+
+	TEST_CHECK(pwrite(fd, buffer, len, 0) == len);
+	close(fd);
+
+	/*
+	 *	Put the modification time back, so that only the
+	 *	contents of the file have changed.
+	 */
+	times[0] = (struct timeval){ .tv_sec = statbuf.st_atime };
+	times[1] = (struct timeval){ .tv_sec = statbuf.st_mtime };
+	TEST_CHECK(utimes(filename, times) == 0);
+}
+
+typedef struct {
+	fr_dict_attr_t const	*other;		//!< Root of the dictionary we're comparing against.
+	unsigned int		count;		//!< Number of attributes compared.
+} test_compare_ctx_t;
+
+/** Check an attribute has an identical counterpart in the other dictionary
+ *
+ */
+static int test_attr_compare(fr_dict_attr_t const *da, void *uctx)
+{
+	test_compare_ctx_t	*cctx = uctx;
+	char			oid[1024];
+	fr_dict_attr_t const	*found;
+	fr_dict_attr_t const	*ref, *found_ref;
+
+	if (da->flags.is_root) return 0;
+
+	TEST_CHECK(fr_dict_attr_oid_print(&FR_SBUFF_OUT(oid, sizeof(oid)), NULL, da, false) > 0);
+
+	found = fr_dict_attr_by_oid(NULL, cctx->other, oid);
+	TEST_CHECK(found != NULL);
+	TEST_MSG("Attribute %s is missing", oid);
+	if (!found) return -1;
+
+	TEST_CHECK(strcmp(da->name, found->name) == 0);
+	TEST_MSG("Attribute %s has name %s", oid, found->name);
+	TEST_CHECK(da->attr == found->attr);
+	TEST_CHECK(da->type == found->type);
+	TEST_CHECK(memcmp(&da->flags, &found->flags, sizeof(da->flags)) == 0);
+	TEST_MSG("Attribute %s has different flags", oid);
+
+	ref = fr_dict_attr_ref(da);
+	found_ref = fr_dict_attr_ref(found);
+	TEST_CHECK(!ref == !found_ref);
+	if (ref && found_ref) {
+		TEST_CHECK(strcmp(ref->name, found_ref->name) == 0);
+		TEST_MSG("Attribute %s references %s, not %s", oid, found_ref->name, ref->name);
+	}
+
+	cctx->count++;
+
+	return 0;
+}
+
+/** A snapshot rebuilds exactly the same dictionary as the text files
+ *
+ */
+static void test_snapshot_round_trip(void)
+{
+	fr_dict_t		*text, *snapshot = NULL;
+	fr_dict_attr_t const	*da;
+	fr_dict_enum_value_t	*enumv;
+	test_compare_ctx_t	cctx = { 0 };
+
+	text = test_snapshot_write();
+	TEST_ASSERT(text != NULL);
+
+	test_gctx_alloc(true);
+	TEST_CHECK(dict_snapshot_load(&snapshot, radius_dir, "radius") == 1);
+	TEST_ASSERT(snapshot != NULL);
+
+	TEST_CASE("Every attribute in the text dictionary is in the snapshot");
+	cctx.other = fr_dict_root(snapshot);
+	TEST_CHECK(fr_dict_walk(fr_dict_root(text), test_attr_compare, &cctx) == 0);
+	TEST_MSG("Compared %u attributes", cctx.count);
+
+	TEST_CASE("Every attribute in the snapshot is in the text dictionary");
+	cctx = (test_compare_ctx_t){ .other = fr_dict_root(text) };
+	TEST_CHECK(fr_dict_walk(fr_dict_root(snapshot), test_attr_compare, &cctx) == 0);
+
+	TEST_CASE("Vendors are preserved");
+	TEST_CHECK(fr_dict_vendor_by_num(snapshot, 9) != NULL);
+	TEST_CHECK(fr_dict_vendor_by_name(snapshot, "Cisco") != NULL);
+
+	TEST_CASE("Enumeration values are preserved");
+	da = fr_dict_attr_by_name(NULL, fr_dict_root(snapshot), "Service-Type");
+	TEST_ASSERT(da != NULL);
+	enumv = fr_dict_enum_by_name(da, "Framed-User", -1);
+	TEST_ASSERT(enumv != NULL);
+	TEST_CHECK(enumv->value->vb_uint32 == 2);
+
+	test_dir_free();
+}
+
+/** A snapshot isn't used if the dictionary contents change, even if the size and mtime don't
+ *
+ */
+static void test_snapshot_stale(void)
+{
+	char		*filename;
+	fr_dict_t	*dict = NULL;
+
+	TEST_ASSERT(test_snapshot_write() != NULL);
+
+	filename = talloc_asprintf(autofree, "%s/dictionary.rfc2865", radius_dir);
+	test_file_replace(filename, "Callback-Id", "Callback-Ix");
+
+	test_gctx_alloc(true);
+	TEST_CHECK(dict_snapshot_load(&dict, radius_dir, "radius") == 0);
+	TEST_CHECK(dict == NULL);
+
+	TEST_CASE("The text dictionaries are read instead");
+	TEST_CHECK(fr_dict_protocol_afrom_file(&dict, "radius", NULL, __FILE__) == 0);
+	TEST_ASSERT(dict != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(NULL, fr_dict_root(dict), "Callback-Ix") != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(NULL, fr_dict_root(dict), "Callback-Id") == NULL);
+
+	test_dir_free();
+}
+
+/** A damaged snapshot is rejected, rather than producing a damaged dictionary
+ *
+ */
+static void test_snapshot_corrupt(void)
+{
+	char		*filename;
+	fr_dict_t	*dict = NULL;
+
+	TEST_ASSERT(test_snapshot_write() != NULL);
+
+	filename = talloc_asprintf(autofree, "%s/%s", radius_dir, FR_DICT_SNAPSHOT_FILE);
+	test_file_replace(filename, "Callback-Id", "Callback-Ix");
+
+	test_gctx_alloc(true);
+	TEST_CHECK(dict_snapshot_load(&dict, radius_dir, "radius") < 0);
+	TEST_CHECK(dict == NULL);
+
+	TEST_CASE("The text dictionaries are read instead");
+	TEST_CHECK(fr_dict_protocol_afrom_file(&dict, "radius", NULL, __FILE__) == 0);
+	TEST_ASSERT(dict != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(NULL, fr_dict_root(dict), "Callback-Id") != NULL);
+	TEST_CHECK(fr_dict_attr_by_name(NULL, fr_dict_root(dict), "Callback-Ix") == NULL);
+
+	test_dir_free();
+}
+
+TEST_LIST = {
+	{ "snapshot_round_trip",	test_snapshot_round_trip },
+	{ "snapshot_stale",		test_snapshot_stale },
+	{ "snapshot_corrupt",		test_snapshot_corrupt },
+
+	{ NULL }
+};
@@ -0,0 +1,6 @@
+TARGET		:= dict_snapshot_tests$(E)
+SOURCES		:= dict_snapshot_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-radius$(L)
@@ -148,7 +148,7 @@ static int dict_read_sscanf_i(unsigned int *pvalue, char const *str)
  *	- 0 on success.
  *	- -1 on failure.
  */
-static int dict_root_set(fr_dict_t *dict, char const *name, unsigned int proto_number)
+int dict_root_set(fr_dict_t *dict, char const *name, unsigned int proto_number)
 {
 	fr_dict_attr_t *da;
 
@@ -2756,6 +2756,20 @@ int fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name, char co
 
 	fr_strerror_clear();	/* Ensure we don't report spurious errors */
 
+	/*
+	 *	Use a precompiled snapshot if there's one which is
+	 *	newer than the dictionary files.  If there's any
+	 *	problem with the snapshot, we read the text files
+	 *	instead.
+	 */
+	if (!dict && dict_gctx->snapshot) {
+		if (dict_snapshot_load(&dict, dict_dir, proto_name) == 1) {
+			talloc_free(dict_dir);
+			goto done;
+		}
+		fr_strerror_clear();
+	}
+
 	/*
 	 *	Start in the context of the internal dictionary,
 	 *	and switch to the context of a protocol dictionary
@@ -2782,6 +2796,7 @@ int fr_dict_protocol_afrom_file(fr_dict_t **out, char const *proto_name, char co
 
 	talloc_free(dict_dir);
 
+done:
 	/*
 	 *	If we're autoloading a previously defined dictionary,
 	 *	then mark up the dictionary as now autoloaded.
@@ -3695,6 +3695,7 @@ fr_dict_gctx_t *fr_dict_global_ctx_init(TALLOC_CTX *ctx, bool free_at_exit, char
 		return NULL;
 	}
 	new_ctx->perm_check = true;	/* Check file permissions by default */
+	new_ctx->snapshot = true;	/* Use snapshots if they're up to date */
 
 	new_ctx->protocol_by_name = fr_hash_table_alloc(new_ctx, dict_protocol_name_hash, dict_protocol_name_cmp, NULL);
 	if (!new_ctx->protocol_by_name) {
@@ -3739,6 +3740,20 @@ void fr_dict_global_ctx_perm_check(fr_dict_gctx_t *gctx, bool enable)
 	gctx->perm_check = enable;
 }
 
+/** Set whether we load precompiled dictionary snapshots
+ *
+ * Snapshots must be disabled when writing new snapshots, so that the
+ * dictionaries are read from the text files.
+ *
+ * @param[in] gctx	to alter.
+ * @param[in] enable	Whether we should use snapshots which are newer than
+ *			the dictionary files.
+ */
+void fr_dict_global_ctx_snapshot(fr_dict_gctx_t *gctx, bool enable)
+{
+	gctx->snapshot = enable;
+}
+
 /** Set a new, active, global dictionary context
  *
  * @param[in] gctx	To set.
@@ -0,0 +1,378 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** High dynamic range histograms
+ *
+ * Records values (usually latencies in nanoseconds) across a large range
+ * with a fixed relative precision, using a fixed amount of memory.
+ *
+ * Values are stored in buckets covering successive powers of two.  Each
+ * bucket is split into enough linear sub-buckets to give the requested
+ * number of significant decimal digits.  Recording a value is a couple
+ * of shifts and an increment, so histograms can be updated for every
+ * packet.
+ *
+ * This is the same layout as Gil Tene's HdrHistogram, so percentiles can
+ * be compared directly with other tools which use it.
+ *
+ * Histograms are not thread safe.  Each thread should record into its
+ * own histogram, and the histograms should be merged for reporting.
+ *
+ * @file src/lib/util/histogram.c
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/histogram.h>
+#include <freeradius-devel/util/strerror.h>
+
+#include <math.h>
+
+struct fr_histogram_s {
+	uint64_t	lowest;				//!< Lowest value which can be distinguished from 0.
+	uint64_t	highest;			//!< Highest value which can be recorded.
+	unsigned int	sig_figs;			//!< Significant decimal digits.
+
+	unsigned int	unit_magnitude;			//!< log2(lowest).
+	unsigned int	sub_bucket_half_count_magnitude;
+	uint32_t	sub_bucket_count;		//!< Linear sub-buckets per bucket.
+	uint32_t	sub_bucket_half_count;
+	uint64_t	sub_bucket_mask;
+
+	size_t		counts_len;			//!< Number of counters.
+	uint64_t	*counts;			//!< Counters.
+
+	uint64_t	total;				//!< Number of values recorded.
+	uint64_t	min;				//!< Smallest value recorded.
+	uint64_t	max;				//!< Largest value recorded.
+	long double	sum;				//!< Sum of all values, for the mean.
+};
+
+static inline CC_HINT(always_inline) int histogram_bucket_index(fr_histogram_t const *h, uint64_t value)
+{
+	int pow2ceiling = 64 - __builtin_clzll(value | h->sub_bucket_mask);
+
+	return pow2ceiling - h->unit_magnitude - (h->sub_bucket_half_count_magnitude + 1);
+}
+
+static inline CC_HINT(always_inline) uint32_t histogram_sub_bucket_index(fr_histogram_t const *h,
+									   uint64_t value, int bucket_index)
+{
+	return (uint32_t)(value >> (bucket_index + h->unit_magnitude));
+}
+
+static inline CC_HINT(always_inline) size_t histogram_counts_index(fr_histogram_t const *h, uint64_t value)
+{
+	int		bucket_index = histogram_bucket_index(h, value);
+	uint32_t	sub_bucket_index = histogram_sub_bucket_index(h, value, bucket_index);
+
+	/*
+	 *	Values in the first bucket have sub_bucket_index < sub_bucket_half_count,
+	 *	so add the base index first, to stop the unsigned subtraction wrapping.
+	 */
+	return ((size_t)(bucket_index + 1) << h->sub_bucket_half_count_magnitude) +
+		sub_bucket_index - h->sub_bucket_half_count;
+}
+
+/** Return the lowest value which maps to a counter
+ *
+ */
+static uint64_t histogram_value_at_index(fr_histogram_t const *h, size_t idx)
+{
+	int		bucket_index = (int)(idx >> h->sub_bucket_half_count_magnitude) - 1;
+	uint32_t	sub_bucket_index = (idx & (h->sub_bucket_half_count - 1)) + h->sub_bucket_half_count;
+
+	if (bucket_index < 0) {
+		sub_bucket_index -= h->sub_bucket_half_count;
+		bucket_index = 0;
+	}
+
+	return (uint64_t)sub_bucket_index << (bucket_index + h->unit_magnitude);
+}
+
+/** Return the highest value which is equivalent to the given value
+ *
+ * i.e. the highest value which maps to the same counter.
+ */
+static uint64_t histogram_highest_equivalent(fr_histogram_t const *h, uint64_t value)
+{
+	int		bucket_index = histogram_bucket_index(h, value);
+	uint32_t	sub_bucket_index = histogram_sub_bucket_index(h, value, bucket_index);
+	uint64_t	lowest = (uint64_t)sub_bucket_index << (bucket_index + h->unit_magnitude);
+	int		adjusted = (sub_bucket_index >= h->sub_bucket_count) ? bucket_index + 1 : bucket_index;
+
+	return lowest + (UINT64_C(1) << (h->unit_magnitude + adjusted)) - 1;
+}
+
+/** Allocate a new histogram
+ *
+ * @param[in] ctx		to allocate the histogram in.
+ * @param[in] lowest		lowest value which can be distinguished from 0.
+ *				Must be >= 1.  For latencies in nanoseconds,
+ *				1000 (1us) is usually sufficient.
+ * @param[in] highest		highest value which can be recorded.  Larger
+ *				values are recorded as this value.
+ * @param[in] sig_figs		number of significant decimal digits, 1-5.
+ *				3 gives a precision of 0.1%.
+ * @return
+ *	- A new histogram.
+ *	- NULL on error.
+ */
+fr_histogram_t *fr_histogram_alloc(TALLOC_CTX *ctx, uint64_t lowest, uint64_t highest, unsigned int sig_figs)
+{
+	fr_histogram_t	*h;
+	uint64_t	largest_single_unit, smallest_untrackable;
+	unsigned int	sub_bucket_count_magnitude, bucket_count;
+
+	if (lowest < 1) {
+		fr_strerror_const("Lowest trackable value must be >= 1");
+		return NULL;
+	}
+
+	if ((sig_figs < 1) || (sig_figs > 5)) {
+		fr_strerror_const("Significant figures must be between 1 and 5");
+		return NULL;
+	}
+
+	if (highest < (2 * lowest)) {
+		fr_strerror_const("Highest trackable value must be >= 2 * lowest trackable value");
+		return NULL;
+	}
+
+	h = talloc_zero(ctx, fr_histogram_t);
+	if (unlikely(!h)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	h->lowest = lowest;
+	h->highest = highest;
+	h->sig_figs = sig_figs;
+
+	largest_single_unit = 2 * (uint64_t)pow(10, sig_figs);
+	sub_bucket_count_magnitude = (unsigned int)ceil(log2((double)largest_single_unit));
+	h->sub_bucket_half_count_magnitude = ((sub_bucket_count_magnitude > 1) ? sub_bucket_count_magnitude : 1) - 1;
+	h->unit_magnitude = (unsigned int)floor(log2((double)lowest));
+	h->sub_bucket_count = UINT32_C(1) << (h->sub_bucket_half_count_magnitude + 1);
+	h->sub_bucket_half_count = h->sub_bucket_count / 2;
+	h->sub_bucket_mask = ((uint64_t)h->sub_bucket_count - 1) << h->unit_magnitude;
+
+	/*
+	 *	Work out how many power of two buckets we need
+	 *	to cover the range.
+	 */
+	smallest_untrackable = (uint64_t)h->sub_bucket_count << h->unit_magnitude;
+	bucket_count = 1;
+	while (smallest_untrackable <= highest) {
+		if (smallest_untrackable > (UINT64_MAX / 2)) {
+			bucket_count++;
+			break;
+		}
+		smallest_untrackable <<= 1;
+		bucket_count++;
+	}
+
+	h->counts_len = (size_t)(bucket_count + 1) * h->sub_bucket_half_count;
+	h->counts = talloc_zero_array(h, uint64_t, h->counts_len);
+	if (unlikely(!h->counts)) {
+		talloc_free(h);
+		goto oom;
+	}
+
+	h->min = UINT64_MAX;
+
+	return h;
+}
+
+/** Record a value
+ *
+ * @param[in] h		to record the value in.
+ * @param[in] value	to record.
+ */
+void fr_histogram_record(fr_histogram_t *h, uint64_t value)
+{
+	fr_histogram_record_n(h, value, 1);
+}
+
+/** Record multiple instances of a value
+ *
+ * @param[in] h		to record the value in.
+ * @param[in] value	to record.
+ * @param[in] count	number of times the value was seen.
+ */
+void fr_histogram_record_n(fr_histogram_t *h, uint64_t value, uint64_t count)
+{
+	size_t idx;
+
+	if (count == 0) return;
+
+	if (value < h->min) h->min = value;
+	if (value > h->max) h->max = value;
+	h->total += count;
+	h->sum += (long double)value * count;
+
+	if (value > h->highest) value = h->highest;
+
+	idx = histogram_counts_index(h, value);
+	if (!fr_cond_assert(idx < h->counts_len)) return;
+
+	h->counts[idx] += count;
+}
+
+/** Add the values recorded in one histogram to another
+ *
+ * @param[in] dst	to add values to.
+ * @param[in] src	to add values from.  Must have been allocated with
+ *			the same parameters as dst.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the histograms have different layouts.
+ */
+int fr_histogram_merge(fr_histogram_t *dst, fr_histogram_t const *src)
+{
+	size_t i;
+
+	if ((dst->lowest != src->lowest) || (dst->highest != src->highest) || (dst->sig_figs != src->sig_figs)) {
+		fr_strerror_const("Can't merge histograms with different ranges or precision");
+		return -1;
+	}
+
+	for (i = 0; i < src->counts_len; i++) dst->counts[i] += src->counts[i];
+
+	if (src->min < dst->min) dst->min = src->min;
+	if (src->max > dst->max) dst->max = src->max;
+	dst->total += src->total;
+	dst->sum += src->sum;
+
+	return 0;
+}
+
+/** Discard all recorded values
+ *
+ * @param[in] h		to reset.
+ */
+void fr_histogram_reset(fr_histogram_t *h)
+{
+	memset(h->counts, 0, sizeof(h->counts[0]) * h->counts_len);
+	h->total = 0;
+	h->min = UINT64_MAX;
+	h->max = 0;
+	h->sum = 0;
+}
+
+/** Return the value at a percentile
+ *
+ * @param[in] h			to query.
+ * @param[in] percentile	0-100.
+ * @return
+ *	- The highest value equivalent to the value at the percentile.
+ *	- 0 if no values have been recorded.
+ */
+uint64_t fr_histogram_percentile(fr_histogram_t const *h, double percentile)
+{
+	uint64_t	target, seen = 0;
+	size_t		i;
+
+	if (h->total == 0) return 0;
+
+	if (percentile > 100.0) percentile = 100.0;
+	if (percentile < 0.0) percentile = 0.0;
+
+	target = (uint64_t)(((percentile / 100.0) * h->total) + 0.5);
+	if (target < 1) target = 1;
+
+	for (i = 0; i < h->counts_len; i++) {
+		seen += h->counts[i];
+		if (seen >= target) {
+			uint64_t value = histogram_highest_equivalent(h, histogram_value_at_index(h, i));
+
+			/*
+			 *	Don't report values we never saw.  Values
+			 *	above the range are counted in the bucket
+			 *	for h->highest, so that bucket extends up
+			 *	to the largest value recorded.
+			 */
+			if ((value > h->max) || (value >= h->highest)) return h->max;
+			if (value < h->min) return h->min;
+
+			return value;
+		}
+	}
+
+	return h->max;
+}
+
+/** Return the number of values recorded
+ *
+ */
+uint64_t fr_histogram_count(fr_histogram_t const *h)
+{
+	return h->total;
+}
+
+/** Return the smallest value recorded, or 0 if no values have been recorded
+ *
+ */
+uint64_t fr_histogram_min(fr_histogram_t const *h)
+{
+	return h->total ? h->min : 0;
+}
+
+/** Return the largest value recorded
+ *
+ */
+uint64_t fr_histogram_max(fr_histogram_t const *h)
+{
+	return h->max;
+}
+
+/** Return the mean of all values recorded
+ *
+ */
+double fr_histogram_mean(fr_histogram_t const *h)
+{
+	if (h->total == 0) return 0;
+
+	return (double)(h->sum / h->total);
+}
+
+/** Return the next non-empty bucket
+ *
+ * @param[in] iter	initialised with #fr_histogram_iter_init.
+ * @param[out] value	highest value equivalent to the bucket.
+ * @param[out] count	of values in the bucket.
+ * @return
+ *	- true if a bucket was returned.
+ *	- false if there are no more buckets.
+ */
+bool fr_histogram_iter_next(fr_histogram_iter_t *iter, uint64_t *value, uint64_t *count)
+{
+	fr_histogram_t const *h = iter->h;
+
+	while (iter->idx < h->counts_len) {
+		size_t i = iter->idx++;
+
+		if (!h->counts[i]) continue;
+
+		*value = histogram_highest_equivalent(h, histogram_value_at_index(h, i));
+		*count = h->counts[i];
+		return true;
+	}
+
+	return false;
+}
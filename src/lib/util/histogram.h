@@ -0,0 +1,78 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** High dynamic range histograms, for recording latencies
+ *
+ * @file src/lib/util/histogram.h
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+RCSIDH(histogram_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fr_histogram_s fr_histogram_t;
+
+fr_histogram_t	*fr_histogram_alloc(TALLOC_CTX *ctx, uint64_t lowest, uint64_t highest, unsigned int sig_figs);
+
+void		fr_histogram_record(fr_histogram_t *h, uint64_t value) CC_HINT(nonnull);
+
+void		fr_histogram_record_n(fr_histogram_t *h, uint64_t value, uint64_t count) CC_HINT(nonnull);
+
+int		fr_histogram_merge(fr_histogram_t *dst, fr_histogram_t const *src) CC_HINT(nonnull);
+
+void		fr_histogram_reset(fr_histogram_t *h) CC_HINT(nonnull);
+
+uint64_t	fr_histogram_percentile(fr_histogram_t const *h, double percentile) CC_HINT(nonnull);
+
+uint64_t	fr_histogram_count(fr_histogram_t const *h) CC_HINT(nonnull);
+
+uint64_t	fr_histogram_min(fr_histogram_t const *h) CC_HINT(nonnull);
+
+uint64_t	fr_histogram_max(fr_histogram_t const *h) CC_HINT(nonnull);
+
+double		fr_histogram_mean(fr_histogram_t const *h) CC_HINT(nonnull);
+
+typedef struct {
+	fr_histogram_t const	*h;		//!< Histogram we're iterating over.
+	size_t			idx;		//!< Current bucket.
+} fr_histogram_iter_t;
+
+bool		fr_histogram_iter_next(fr_histogram_iter_t *iter, uint64_t *value, uint64_t *count) CC_HINT(nonnull);
+
+/** Initialise an iterator over the non-empty buckets of a histogram
+ *
+ * @param[out] iter	to initialise.
+ * @param[in] h		to iterate over.
+ */
+static inline CC_HINT(nonnull) void fr_histogram_iter_init(fr_histogram_iter_t *iter, fr_histogram_t const *h)
+{
+	iter->h = h;
+	iter->idx = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
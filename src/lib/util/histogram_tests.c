@@ -0,0 +1,141 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for high dynamic range histograms
+ *
+ * @file src/lib/util/histogram_tests.c
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "histogram.h"
+
+/*
+ *	1us to 1 minute, in nanoseconds.
+ */
+#define HIST_LOWEST	1000
+#define HIST_HIGHEST	((uint64_t)60 * 1000 * 1000 * 1000)
+
+/** Check a value is within one sub-bucket of a 3 significant figure histogram
+ *
+ */
+static bool hist_close(uint64_t got, uint64_t expected)
+{
+	uint64_t diff = (got > expected) ? got - expected : expected - got;
+
+	return diff <= (expected / 500) + HIST_LOWEST;
+}
+
+static void histogram_test_alloc(void)
+{
+	TEST_CHECK(fr_histogram_alloc(NULL, 0, HIST_HIGHEST, 3) == NULL);
+	TEST_CHECK(fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 0) == NULL);
+	TEST_CHECK(fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 6) == NULL);
+	TEST_CHECK(fr_histogram_alloc(NULL, HIST_LOWEST, HIST_LOWEST, 3) == NULL);
+}
+
+static void histogram_test_percentiles(void)
+{
+	fr_histogram_t	*h;
+	uint64_t	i;
+
+	h = fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 3);
+	TEST_CHECK(h != NULL);
+
+	TEST_CASE("Empty histogram");
+	TEST_CHECK(fr_histogram_count(h) == 0);
+	TEST_CHECK(fr_histogram_percentile(h, 50) == 0);
+	TEST_CHECK(fr_histogram_min(h) == 0);
+
+	/*
+	 *	Uniform distribution from 1us to 1s
+	 */
+	for (i = 1; i <= 1000000; i++) fr_histogram_record(h, i * 1000);
+
+	TEST_CASE("Percentiles are within precision");
+	TEST_CHECK(fr_histogram_count(h) == 1000000);
+	TEST_CHECK(hist_close(fr_histogram_percentile(h, 50), 500000000));
+	TEST_MSG("p50 %" PRIu64, fr_histogram_percentile(h, 50));
+	TEST_CHECK(hist_close(fr_histogram_percentile(h, 99), 990000000));
+	TEST_MSG("p99 %" PRIu64, fr_histogram_percentile(h, 99));
+	TEST_CHECK(hist_close(fr_histogram_percentile(h, 99.9), 999000000));
+	TEST_MSG("p99.9 %" PRIu64, fr_histogram_percentile(h, 99.9));
+
+	TEST_CASE("Min, max and mean are exact");
+	TEST_CHECK(fr_histogram_min(h) == 1000);
+	TEST_CHECK(fr_histogram_max(h) == 1000000000);
+	TEST_CHECK(fr_histogram_percentile(h, 100) == 1000000000);
+	TEST_CHECK(fr_histogram_mean(h) == 500000500.0);
+
+	TEST_CASE("Values above the range are clamped");
+	fr_histogram_record(h, HIST_HIGHEST * 2);
+	TEST_CHECK(fr_histogram_max(h) == HIST_HIGHEST * 2);
+	TEST_CHECK(fr_histogram_percentile(h, 100) == HIST_HIGHEST * 2);
+
+	TEST_CASE("Reset");
+	fr_histogram_reset(h);
+	TEST_CHECK(fr_histogram_count(h) == 0);
+	TEST_CHECK(fr_histogram_max(h) == 0);
+
+	talloc_free(h);
+}
+
+static void histogram_test_merge(void)
+{
+	fr_histogram_t	*a, *b, *c;
+	uint64_t	i, value, count, total = 0;
+	fr_histogram_iter_t iter;
+
+	a = fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 3);
+	b = fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 3);
+	c = fr_histogram_alloc(NULL, HIST_LOWEST, HIST_HIGHEST, 2);
+
+	for (i = 0; i < 100; i++) fr_histogram_record(a, 1000000);	/* 1ms */
+	fr_histogram_record_n(b, 10000000, 100);			/* 10ms */
+
+	TEST_CHECK(fr_histogram_merge(a, c) < 0);
+	TEST_CHECK(fr_histogram_merge(a, b) == 0);
+	TEST_CHECK(fr_histogram_count(a) == 200);
+	TEST_CHECK(hist_close(fr_histogram_percentile(a, 50), 1000000));
+	TEST_CHECK(hist_close(fr_histogram_percentile(a, 51), 10000000));
+	TEST_CHECK(fr_histogram_min(a) == 1000000);
+	TEST_CHECK(fr_histogram_max(a) == 10000000);
+
+	TEST_CASE("Iteration returns the non-empty buckets");
+	fr_histogram_iter_init(&iter, a);
+	i = 0;
+	while (fr_histogram_iter_next(&iter, &value, &count)) {
+		total += count;
+		i++;
+	}
+	TEST_CHECK(i == 2);
+	TEST_CHECK(total == 200);
+
+	talloc_free(a);
+	talloc_free(b);
+	talloc_free(c);
+}
+
+TEST_LIST = {
+	{ "histogram_test_alloc",	histogram_test_alloc },
+	{ "histogram_test_percentiles",	histogram_test_percentiles },
+	{ "histogram_test_merge",	histogram_test_merge },
+
+	{ NULL }
+};
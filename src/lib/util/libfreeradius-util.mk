@@ -18,6 +18,7 @@ SOURCES		:= \
 		   dict_ext.c \
 		   dict_fixup.c \
 		   dict_print.c \
+		   dict_snapshot.c \
 		   dict_test.c \
 		   dict_tokenize.c \
 		   dict_unknown.c \
@@ -36,6 +37,7 @@ SOURCES		:= \
 		   getaddrinfo.c \
 		   hash.c \
 		   heap.c \
+		   histogram.c \
 		   hmac_md5.c \
 		   hmac_sha1.c \
 		   htrie.c \
@@ -47,6 +49,7 @@ SOURCES		:= \
 		   machine.c \
 		   md4.c \
 		   md5.c \
+		   md5_mb.c \
 		   minmax_heap.c \
 		   misc.c \
 		   missing.c \
@@ -79,6 +82,7 @@ SOURCES		:= \
 		   table.c \
 		   talloc.c \
 		   time.c \
+		   timer_wheel.c \
 		   timeval.c \
 		   token.c \
 		   trie.c \
@@ -96,6 +96,39 @@ void		fr_md5_ctx_free_from_list(fr_md5_ctx_t **ctx);
 /* hmac.c */
 int		fr_hmac_md5(uint8_t digest[static MD5_DIGEST_LENGTH], uint8_t const *in, size_t inlen,
 			    uint8_t const *key, size_t key_len);
+
+/* md5_mb.c */
+#define		FR_MD5_MB_MAX_SEGMENTS	4
+
+/** A message to digest as part of a batch
+ *
+ * The message is the concatenation of the segments.  Unused segments
+ * must have a length of zero.
+ */
+typedef struct {
+	struct {
+		uint8_t const	*data;			//!< Start of the segment.
+		size_t		len;			//!< Length of the segment.
+	} seg[FR_MD5_MB_MAX_SEGMENTS];
+	uint8_t		*out;				//!< Where to write the digest.
+} fr_md5_mb_job_t;
+
+/** A message to authenticate as part of a batch
+ *
+ */
+typedef struct {
+	uint8_t const	*in;				//!< Message to authenticate.
+	size_t		inlen;				//!< Length of the message.
+	uint8_t const	*key;				//!< Key to use.
+	size_t		key_len;			//!< Length of the key.
+	uint8_t		*out;				//!< Where to write the MD5_DIGEST_LENGTH byte HMAC.
+} fr_hmac_md5_mb_job_t;
+
+void		fr_md5_mb_calc(fr_md5_mb_job_t const *jobs, size_t num);
+
+void		fr_hmac_md5_mb(fr_hmac_md5_mb_job_t const *jobs, size_t num);
+
+char const	*fr_md5_mb_engine_name(void);
 #ifdef __cplusplus
 }
 #endif
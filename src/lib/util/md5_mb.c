@@ -0,0 +1,481 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Multi-buffer MD5 and HMAC-MD5
+ *
+ * MD5 can't be parallelised within a single message, each block depends
+ * on the state left by the previous one.  It can be parallelised across
+ * messages.  Here each 32bit lane of a SIMD register holds the state of a
+ * different message, so one pass of the compression function advances
+ * 8 or 16 digests at once.
+ *
+ * Jobs are fed into lanes as they become free, so a long message only
+ * occupies its own lane, and the others keep being refilled with new jobs.
+ *
+ * The engine is selected at runtime:
+ *
+ * - avx512	16 lanes, if the CPU supports AVX-512F.
+ * - avx2	8 lanes, if the CPU supports AVX2.
+ * - vector	8 lanes using whatever SIMD the compiler targets by default
+ *		(SSE2 on x86_64, NEON on aarch64).
+ * - scalar	one message at a time, for compilers without vector extensions.
+ *
+ * @file src/lib/util/md5_mb.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/md5.h>
+#include <freeradius-devel/util/debug.h>
+
+#define MD5_MB_BLOCK_LENGTH	64
+#define MD5_MB_MAX_LANES	16
+
+/** State for one lane of the engine
+ *
+ */
+typedef struct {
+	fr_md5_mb_job_t const	*job;			//!< Job being digested, or NULL if the lane is idle.
+	size_t			seg;			//!< Segment we're reading from.
+	size_t			off;			//!< Offset into the current segment.
+	uint64_t		len;			//!< Total length of the job's data.
+	size_t			blocks;			//!< Number of blocks including padding.
+	size_t			done;			//!< Number of blocks fed to the engine.
+	bool			padded;			//!< Whether the 0x80 terminator has been written.
+} md5_mb_lane_t;
+
+/** Advance the digests held in each lane by one block
+ *
+ * @param[in,out] state	A, B, C, D for each lane.
+ * @param[in] in	The 16 little endian words of each lane's block.
+ */
+typedef void (*md5_mb_transform_t)(uint32_t state[4][MD5_MB_MAX_LANES], uint32_t const in[16][MD5_MB_MAX_LANES]);
+
+typedef struct {
+	char const		*name;			//!< Printable name of the engine.
+	unsigned int		lanes;			//!< How many messages are processed at once.
+	md5_mb_transform_t	transform;		//!< Compression function.
+	bool			(*usable)(void);	//!< Whether the CPU supports the engine.
+} md5_mb_engine_t;
+
+#define MD5_MB_F1(x, y, z) (z ^ (x & (y ^ z)))
+#define MD5_MB_F2(x, y, z) MD5_MB_F1(z, x, y)
+#define MD5_MB_F3(x, y, z) (x ^ y ^ z)
+#define MD5_MB_F4(x, y, z) (y ^ (x | ~z))
+
+#define MD5_MB_STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = (w << s) | (w >> (32 - s)), w += x)
+
+/** The 64 MD5 steps
+ *
+ * Works on uint32_t and on vectors of uint32_t, as the vector extensions
+ * apply the same operators lane by lane, and broadcast scalar constants.
+ */
+#define MD5_MB_ROUNDS(a, b, c, d, in) \
+do { \
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 0] + 0xd76aa478,  7); \
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12); \
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[ 2] + 0x242070db, 17); \
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22); \
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7); \
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 5] + 0x4787c62a, 12); \
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[ 6] + 0xa8304613, 17); \
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[ 7] + 0xfd469501, 22); \
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[ 8] + 0x698098d8,  7); \
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12); \
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[10] + 0xffff5bb1, 17); \
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[11] + 0x895cd7be, 22); \
+	MD5_MB_STEP(MD5_MB_F1, a, b, c, d, in[12] + 0x6b901122,  7); \
+	MD5_MB_STEP(MD5_MB_F1, d, a, b, c, in[13] + 0xfd987193, 12); \
+	MD5_MB_STEP(MD5_MB_F1, c, d, a, b, in[14] + 0xa679438e, 17); \
+	MD5_MB_STEP(MD5_MB_F1, b, c, d, a, in[15] + 0x49b40821, 22); \
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 1] + 0xf61e2562,  5); \
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[ 6] + 0xc040b340,  9); \
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[11] + 0x265e5a51, 14); \
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20); \
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 5] + 0xd62f105d,  5); \
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[10] + 0x02441453,  9); \
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[15] + 0xd8a1e681, 14); \
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20); \
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5); \
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[14] + 0xc33707d6,  9); \
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14); \
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[ 8] + 0x455a14ed, 20); \
+	MD5_MB_STEP(MD5_MB_F2, a, b, c, d, in[13] + 0xa9e3e905,  5); \
+	MD5_MB_STEP(MD5_MB_F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9); \
+	MD5_MB_STEP(MD5_MB_F2, c, d, a, b, in[ 7] + 0x676f02d9, 14); \
+	MD5_MB_STEP(MD5_MB_F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20); \
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 5] + 0xfffa3942,  4); \
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 8] + 0x8771f681, 11); \
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[11] + 0x6d9d6122, 16); \
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[14] + 0xfde5380c, 23); \
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 1] + 0xa4beea44,  4); \
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11); \
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16); \
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[10] + 0xbebfbc70, 23); \
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[13] + 0x289b7ec6,  4); \
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11); \
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16); \
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[ 6] + 0x04881d05, 23); \
+	MD5_MB_STEP(MD5_MB_F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4); \
+	MD5_MB_STEP(MD5_MB_F3, d, a, b, c, in[12] + 0xe6db99e5, 11); \
+	MD5_MB_STEP(MD5_MB_F3, c, d, a, b, in[15] + 0x1fa27cf8, 16); \
+	MD5_MB_STEP(MD5_MB_F3, b, c, d, a, in[ 2] + 0xc4ac5665, 23); \
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 0] + 0xf4292244,  6); \
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[ 7] + 0x432aff97, 10); \
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[14] + 0xab9423a7, 15); \
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 5] + 0xfc93a039, 21); \
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[12] + 0x655b59c3,  6); \
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[ 3] + 0x8f0ccc92, 10); \
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[10] + 0xffeff47d, 15); \
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 1] + 0x85845dd1, 21); \
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 8] + 0x6fa87e4f,  6); \
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10); \
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[ 6] + 0xa3014314, 15); \
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[13] + 0x4e0811a1, 21); \
+	MD5_MB_STEP(MD5_MB_F4, a, b, c, d, in[ 4] + 0xf7537e82,  6); \
+	MD5_MB_STEP(MD5_MB_F4, d, a, b, c, in[11] + 0xbd3af235, 10); \
+	MD5_MB_STEP(MD5_MB_F4, c, d, a, b, in[ 2] + 0x2ad7d2bb, 15); \
+	MD5_MB_STEP(MD5_MB_F4, b, c, d, a, in[ 9] + 0xeb86d391, 21); \
+} while (0)
+
+/** Scalar compression function, one lane
+ *
+ */
+static void md5_mb_transform_scalar(uint32_t state[4][MD5_MB_MAX_LANES], uint32_t const in[16][MD5_MB_MAX_LANES])
+{
+	uint32_t	a = state[0][0], b = state[1][0], c = state[2][0], d = state[3][0];
+	uint32_t	w[16];
+	int		i;
+
+	for (i = 0; i < 16; i++) w[i] = in[i][0];
+
+	MD5_MB_ROUNDS(a, b, c, d, w);
+
+	state[0][0] += a;
+	state[1][0] += b;
+	state[2][0] += c;
+	state[3][0] += d;
+}
+
+static bool md5_mb_always(void)
+{
+	return true;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+/** Define a compression function operating on a vector of _lanes words
+ *
+ * The state and input words are stored lane-contiguous, so each row can
+ * be loaded directly into a vector register.
+ */
+#define MD5_MB_TRANSFORM_VECTOR(_name, _lanes, ...) \
+typedef uint32_t _name ## _vec_t __attribute__((vector_size((_lanes) * sizeof(uint32_t)))); \
+static __VA_ARGS__ void _name(uint32_t state[4][MD5_MB_MAX_LANES], uint32_t const in[16][MD5_MB_MAX_LANES]) \
+{ \
+	_name ## _vec_t a, b, c, d, sa, sb, sc, sd, w[16]; \
+	int i; \
+	memcpy(&sa, state[0], sizeof(sa)); \
+	memcpy(&sb, state[1], sizeof(sb)); \
+	memcpy(&sc, state[2], sizeof(sc)); \
+	memcpy(&sd, state[3], sizeof(sd)); \
+	for (i = 0; i < 16; i++) memcpy(&w[i], in[i], sizeof(w[i])); \
+	a = sa; b = sb; c = sc; d = sd; \
+	MD5_MB_ROUNDS(a, b, c, d, w); \
+	sa += a; sb += b; sc += c; sd += d; \
+	memcpy(state[0], &sa, sizeof(sa)); \
+	memcpy(state[1], &sb, sizeof(sb)); \
+	memcpy(state[2], &sc, sizeof(sc)); \
+	memcpy(state[3], &sd, sizeof(sd)); \
+}
+
+MD5_MB_TRANSFORM_VECTOR(md5_mb_transform_vector, 8)
+
+#  if defined(__x86_64__) || defined(__i386__)
+MD5_MB_TRANSFORM_VECTOR(md5_mb_transform_avx2, 8, __attribute__((target("avx2"))))
+MD5_MB_TRANSFORM_VECTOR(md5_mb_transform_avx512, 16, __attribute__((target("avx512f"))))
+
+static bool md5_mb_have_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static bool md5_mb_have_avx512(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f");
+}
+#  endif
+#endif
+
+/** Engines in order of preference
+ *
+ */
+static md5_mb_engine_t const md5_mb_engines[] = {
+#if defined(__GNUC__) || defined(__clang__)
+#  if defined(__x86_64__) || defined(__i386__)
+	{ .name = "avx512", .lanes = 16, .transform = md5_mb_transform_avx512, .usable = md5_mb_have_avx512 },
+	{ .name = "avx2", .lanes = 8, .transform = md5_mb_transform_avx2, .usable = md5_mb_have_avx2 },
+#  endif
+	{ .name = "vector", .lanes = 8, .transform = md5_mb_transform_vector, .usable = md5_mb_always },
+#endif
+	{ .name = "scalar", .lanes = 1, .transform = md5_mb_transform_scalar, .usable = md5_mb_always }
+};
+
+static md5_mb_engine_t const *md5_mb_engine;
+
+/** Pick the fastest engine the CPU supports
+ *
+ */
+static inline md5_mb_engine_t const *md5_mb_engine_get(void)
+{
+	size_t i;
+
+	if (likely(md5_mb_engine != NULL)) return md5_mb_engine;
+
+	for (i = 0; i < NUM_ELEMENTS(md5_mb_engines); i++) {
+		if (md5_mb_engines[i].usable()) break;
+	}
+	md5_mb_engine = &md5_mb_engines[i];
+
+	return md5_mb_engine;
+}
+
+/** Return the name of the engine used for batch digests
+ *
+ */
+char const *fr_md5_mb_engine_name(void)
+{
+	return md5_mb_engine_get()->name;
+}
+
+/** Start digesting a job in a lane
+ *
+ */
+static inline void md5_mb_lane_start(md5_mb_lane_t *lane, uint32_t state[4][MD5_MB_MAX_LANES], unsigned int idx,
+				     fr_md5_mb_job_t const *job)
+{
+	size_t i;
+
+	*lane = (md5_mb_lane_t){ .job = job };
+	for (i = 0; i < NUM_ELEMENTS(job->seg); i++) lane->len += job->seg[i].len;
+	lane->blocks = ((lane->len + 8) / MD5_MB_BLOCK_LENGTH) + 1;
+
+	state[0][idx] = 0x67452301;
+	state[1][idx] = 0xefcdab89;
+	state[2][idx] = 0x98badcfe;
+	state[3][idx] = 0x10325476;
+}
+
+/** Write the next block of a lane's message, including padding, into the engine's input
+ *
+ */
+static inline void md5_mb_lane_block(md5_mb_lane_t *lane, uint32_t in[16][MD5_MB_MAX_LANES], unsigned int idx)
+{
+	uint8_t		block[MD5_MB_BLOCK_LENGTH];
+	size_t		used = 0;
+	int		i;
+
+	while ((used < sizeof(block)) && (lane->seg < NUM_ELEMENTS(lane->job->seg))) {
+		uint8_t const	*data = lane->job->seg[lane->seg].data;
+		size_t		avail = lane->job->seg[lane->seg].len - lane->off;
+		size_t		n;
+
+		if (!avail) {
+			lane->seg++;
+			lane->off = 0;
+			continue;
+		}
+
+		n = sizeof(block) - used;
+		if (n > avail) n = avail;
+
+		memcpy(block + used, data + lane->off, n);
+		used += n;
+		lane->off += n;
+	}
+
+	if (used < sizeof(block)) {
+		if (!lane->padded) {
+			block[used++] = 0x80;
+			lane->padded = true;
+		}
+		memset(block + used, 0, sizeof(block) - used);
+
+		/*
+		 *	Length in bits, little endian, at the end
+		 *	of the last block.
+		 */
+		if (lane->done == (lane->blocks - 1)) {
+			uint64_t bits = lane->len << 3;
+
+			for (i = 0; i < 8; i++) block[56 + i] = (uint8_t)(bits >> (i * 8));
+		}
+	}
+	lane->done++;
+
+	for (i = 0; i < 16; i++) {
+		in[i][idx] = (uint32_t)block[(i * 4)] |
+			     ((uint32_t)block[(i * 4) + 1] << 8) |
+			     ((uint32_t)block[(i * 4) + 2] << 16) |
+			     ((uint32_t)block[(i * 4) + 3] << 24);
+	}
+}
+
+/** Calculate the MD5 digests of many independent messages
+ *
+ * Each job's segments are digested as if they were a single contiguous
+ * buffer.  The digest is written to the job's out field as soon as the
+ * job's last block has been processed, so out must not overlap the input
+ * of any other job in the batch.
+ *
+ * @param[in] jobs	Array of jobs.
+ * @param[in] num	Number of jobs in the array.
+ */
+void fr_md5_mb_calc(fr_md5_mb_job_t const *jobs, size_t num)
+{
+	md5_mb_engine_t const	*engine = md5_mb_engine_get();
+	md5_mb_lane_t		lanes[MD5_MB_MAX_LANES] = {};
+	uint32_t		state[4][MD5_MB_MAX_LANES] = {};
+	uint32_t		in[16][MD5_MB_MAX_LANES] = {};
+	size_t			next = 0;
+	unsigned int		i, active = 0;
+
+	/*
+	 *	Fill the lanes
+	 */
+	for (i = 0; (i < engine->lanes) && (next < num); i++) {
+		md5_mb_lane_start(&lanes[i], state, i, &jobs[next++]);
+		active++;
+	}
+
+	while (active) {
+		for (i = 0; i < engine->lanes; i++) {
+			if (lanes[i].job) md5_mb_lane_block(&lanes[i], in, i);
+		}
+
+		engine->transform(state, in);
+
+		/*
+		 *	Output the digests of finished jobs,
+		 *	and replace them with new ones.
+		 */
+		for (i = 0; i < engine->lanes; i++) {
+			int j;
+
+			if (!lanes[i].job || (lanes[i].done < lanes[i].blocks)) continue;
+
+			for (j = 0; j < 4; j++) {
+				uint8_t *p = lanes[i].job->out + (j * 4);
+
+				p[0] = (uint8_t)state[j][i];
+				p[1] = (uint8_t)(state[j][i] >> 8);
+				p[2] = (uint8_t)(state[j][i] >> 16);
+				p[3] = (uint8_t)(state[j][i] >> 24);
+			}
+
+			if (next < num) {
+				md5_mb_lane_start(&lanes[i], state, i, &jobs[next++]);
+				continue;
+			}
+
+			lanes[i].job = NULL;
+			active--;
+		}
+	}
+
+	memset(in, 0, sizeof(in));
+	memset(state, 0, sizeof(state));
+}
+
+/** Number of HMAC jobs to prepare at once
+ *
+ * Bounds the amount of stack used for the padded keys and inner digests.
+ */
+#define HMAC_MD5_MB_CHUNK	64
+
+/** Calculate HMAC-MD5 for many independent messages
+ *
+ * Each job may use a different key.  The inner digests for a chunk of jobs
+ * are calculated in one batch, then the outer digests in a second batch.
+ *
+ * @param[in] jobs	Array of jobs.
+ * @param[in] num	Number of jobs in the array.
+ */
+void fr_hmac_md5_mb(fr_hmac_md5_mb_job_t const *jobs, size_t num)
+{
+	uint8_t			k_ipad[HMAC_MD5_MB_CHUNK][MD5_MB_BLOCK_LENGTH];
+	uint8_t			k_opad[HMAC_MD5_MB_CHUNK][MD5_MB_BLOCK_LENGTH];
+	uint8_t			inner[HMAC_MD5_MB_CHUNK][MD5_DIGEST_LENGTH];
+	fr_md5_mb_job_t		md5_jobs[HMAC_MD5_MB_CHUNK];
+	size_t			base, n, i;
+	int			j;
+
+	for (base = 0; base < num; base += n) {
+		n = num - base;
+		if (n > HMAC_MD5_MB_CHUNK) n = HMAC_MD5_MB_CHUNK;
+
+		for (i = 0; i < n; i++) {
+			fr_hmac_md5_mb_job_t const	*job = &jobs[base + i];
+			uint8_t const			*key = job->key;
+			size_t				key_len = job->key_len;
+			uint8_t				tk[MD5_DIGEST_LENGTH];
+
+			/* if key is longer than 64 bytes reset it to key=MD5(key) */
+			if (key_len > MD5_MB_BLOCK_LENGTH) {
+				fr_md5_calc(tk, key, key_len);
+				key = tk;
+				key_len = sizeof(tk);
+			}
+
+			memset(k_ipad[i], 0, sizeof(k_ipad[i]));
+			if (key_len) memcpy(k_ipad[i], key, key_len);
+			memcpy(k_opad[i], k_ipad[i], sizeof(k_opad[i]));
+
+			for (j = 0; j < MD5_MB_BLOCK_LENGTH; j++) {
+				k_ipad[i][j] ^= 0x36;
+				k_opad[i][j] ^= 0x5c;
+			}
+
+			/* inner = MD5(K XOR ipad, in) */
+			md5_jobs[i] = (fr_md5_mb_job_t){
+				.seg = {
+					{ .data = k_ipad[i], .len = sizeof(k_ipad[i]) },
+					{ .data = job->in, .len = job->inlen }
+				},
+				.out = inner[i]
+			};
+		}
+		fr_md5_mb_calc(md5_jobs, n);
+
+		/* MD5(K XOR opad, inner) */
+		for (i = 0; i < n; i++) {
+			md5_jobs[i] = (fr_md5_mb_job_t){
+				.seg = {
+					{ .data = k_opad[i], .len = sizeof(k_opad[i]) },
+					{ .data = inner[i], .len = sizeof(inner[i]) }
+				},
+				.out = jobs[base + i].out
+			};
+		}
+		fr_md5_mb_calc(md5_jobs, n);
+	}
+
+	memset(k_ipad, 0, sizeof(k_ipad));
+	memset(k_opad, 0, sizeof(k_opad));
+	memset(inner, 0, sizeof(inner));
+}
@@ -0,0 +1,231 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the multi-buffer MD5 functions
+ *
+ * @file src/lib/util/md5_mb_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/time.h>
+
+#include "md5_mb.c"
+
+#define MD5_MB_TEST_MAX_LEN	300
+#define MD5_MB_TEST_BENCH_JOBS	4096
+#define MD5_MB_TEST_BENCH_LEN	100	/* Typical size of a RADIUS reply */
+
+/** Run a test against every engine the CPU supports
+ *
+ */
+#define MD5_MB_FOREACH_ENGINE(_engine) \
+	for (size_t _i = 0; _i < NUM_ELEMENTS(md5_mb_engines); _i++) \
+		if ((_engine = md5_mb_engine = &md5_mb_engines[_i])->usable())
+
+static uint8_t	md5_mb_test_data[MD5_MB_TEST_MAX_LEN];
+
+static void md5_mb_test_data_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(md5_mb_test_data); i++) md5_mb_test_data[i] = (uint8_t)((i * 31) + 7);
+}
+
+/*
+ *	Every length from 0 to MD5_MB_TEST_MAX_LEN, so the padding
+ *	is checked at each position in the last block, and lanes
+ *	finish at different times.
+ */
+static void md5_mb_test_lengths(void)
+{
+	md5_mb_engine_t const	*engine;
+	fr_md5_mb_job_t		jobs[MD5_MB_TEST_MAX_LEN + 1];
+	uint8_t			out[MD5_MB_TEST_MAX_LEN + 1][MD5_DIGEST_LENGTH];
+	uint8_t			expected[MD5_DIGEST_LENGTH];
+	size_t			i;
+
+	md5_mb_test_data_init();
+
+	MD5_MB_FOREACH_ENGINE(engine) {
+		TEST_CASE(engine->name);
+
+		for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+			/*
+			 *	Longest first, so the shorter jobs have to
+			 *	be loaded into lanes as they're freed.
+			 */
+			jobs[i] = (fr_md5_mb_job_t){
+				.seg = { { .data = md5_mb_test_data, .len = MD5_MB_TEST_MAX_LEN - i } },
+				.out = out[i]
+			};
+		}
+		memset(out, 0, sizeof(out));
+
+		fr_md5_mb_calc(jobs, NUM_ELEMENTS(jobs));
+
+		for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+			fr_md5_calc(expected, md5_mb_test_data, MD5_MB_TEST_MAX_LEN - i);
+			TEST_CHECK(memcmp(out[i], expected, sizeof(expected)) == 0);
+			TEST_MSG("length %zu", MD5_MB_TEST_MAX_LEN - i);
+		}
+	}
+	md5_mb_engine = NULL;
+}
+
+/*
+ *	Segments must produce the same digest as a
+ *	contiguous buffer, wherever the boundaries fall.
+ */
+static void md5_mb_test_segments(void)
+{
+	md5_mb_engine_t const	*engine;
+	fr_md5_mb_job_t		jobs[MD5_MB_TEST_MAX_LEN];
+	uint8_t			out[MD5_MB_TEST_MAX_LEN][MD5_DIGEST_LENGTH];
+	uint8_t			expected[MD5_DIGEST_LENGTH];
+	size_t			i;
+
+	md5_mb_test_data_init();
+	fr_md5_calc(expected, md5_mb_test_data, MD5_MB_TEST_MAX_LEN);
+
+	MD5_MB_FOREACH_ENGINE(engine) {
+		TEST_CASE(engine->name);
+
+		for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+			size_t a = i, b = (MD5_MB_TEST_MAX_LEN - i) / 2;
+
+			jobs[i] = (fr_md5_mb_job_t){
+				.seg = {
+					{ .data = md5_mb_test_data, .len = a },
+					{ .data = NULL, .len = 0 },
+					{ .data = md5_mb_test_data + a, .len = b },
+					{ .data = md5_mb_test_data + a + b, .len = MD5_MB_TEST_MAX_LEN - a - b }
+				},
+				.out = out[i]
+			};
+		}
+		memset(out, 0, sizeof(out));
+
+		fr_md5_mb_calc(jobs, NUM_ELEMENTS(jobs));
+
+		for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+			TEST_CHECK(memcmp(out[i], expected, sizeof(expected)) == 0);
+			TEST_MSG("split at %zu", i);
+		}
+	}
+	md5_mb_engine = NULL;
+}
+
+/*
+ *	RFC 2104 test vectors, plus a key longer than the block size,
+ *	checked against fr_hmac_md5().
+ */
+static void md5_mb_test_hmac(void)
+{
+	md5_mb_engine_t const	*engine;
+	uint8_t			key1[16], key3[16], data3[50], key4[80];
+	fr_hmac_md5_mb_job_t	jobs[4];
+	uint8_t			out[4][MD5_DIGEST_LENGTH];
+	uint8_t			expected[MD5_DIGEST_LENGTH];
+	size_t			i;
+
+	memset(key1, 0x0b, sizeof(key1));
+	memset(key3, 0xaa, sizeof(key3));
+	memset(data3, 0xdd, sizeof(data3));
+	memset(key4, 0x42, sizeof(key4));
+
+	MD5_MB_FOREACH_ENGINE(engine) {
+		TEST_CASE(engine->name);
+
+		jobs[0] = (fr_hmac_md5_mb_job_t){ .in = (uint8_t const *)"Hi There", .inlen = 8,
+						  .key = key1, .key_len = sizeof(key1), .out = out[0] };
+		jobs[1] = (fr_hmac_md5_mb_job_t){ .in = (uint8_t const *)"what do ya want for nothing?", .inlen = 28,
+						  .key = (uint8_t const *)"Jefe", .key_len = 4, .out = out[1] };
+		jobs[2] = (fr_hmac_md5_mb_job_t){ .in = data3, .inlen = sizeof(data3),
+						  .key = key3, .key_len = sizeof(key3), .out = out[2] };
+		jobs[3] = (fr_hmac_md5_mb_job_t){ .in = data3, .inlen = sizeof(data3),
+						  .key = key4, .key_len = sizeof(key4), .out = out[3] };
+		memset(out, 0, sizeof(out));
+
+		fr_hmac_md5_mb(jobs, NUM_ELEMENTS(jobs));
+
+		TEST_CHECK(memcmp(out[0], "\x92\x94\x72\x7a\x36\x38\xbb\x1c\x13\xf4\x8e\xf8\x15\x8b\xfc\x9d",
+				  MD5_DIGEST_LENGTH) == 0);
+		TEST_CHECK(memcmp(out[1], "\x75\x0c\x78\x3e\x6a\xb0\xb5\x03\xea\xa8\x6e\x31\x0a\x5d\xb7\x38",
+				  MD5_DIGEST_LENGTH) == 0);
+		TEST_CHECK(memcmp(out[2], "\x56\xbe\x34\x52\x1d\x14\x4c\x88\xdb\xb8\xc7\x33\xf0\xe8\xb3\xf6",
+				  MD5_DIGEST_LENGTH) == 0);
+
+		for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+			fr_hmac_md5(expected, jobs[i].in, jobs[i].inlen, jobs[i].key, jobs[i].key_len);
+			TEST_CHECK(memcmp(out[i], expected, sizeof(expected)) == 0);
+			TEST_MSG("job %zu", i);
+		}
+	}
+	md5_mb_engine = NULL;
+}
+
+/*
+ *	Digests/s for each engine, compared with calling
+ *	fr_md5_calc() in a loop.
+ */
+static void md5_mb_test_speed(void)
+{
+	md5_mb_engine_t const	*engine;
+	static fr_md5_mb_job_t	jobs[MD5_MB_TEST_BENCH_JOBS];
+	static uint8_t		out[MD5_MB_TEST_BENCH_JOBS][MD5_DIGEST_LENGTH];
+	fr_time_t		start;
+	fr_time_delta_t		used;
+	size_t			i;
+	int			rounds = 50, r;
+
+	md5_mb_test_data_init();
+
+	for (i = 0; i < NUM_ELEMENTS(jobs); i++) {
+		jobs[i] = (fr_md5_mb_job_t){
+			.seg = { { .data = md5_mb_test_data, .len = MD5_MB_TEST_BENCH_LEN } },
+			.out = out[i]
+		};
+	}
+
+	start = fr_time();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < NUM_ELEMENTS(jobs); i++) fr_md5_calc(out[i], md5_mb_test_data, MD5_MB_TEST_BENCH_LEN);
+	}
+	used = fr_time_sub(fr_time(), start);
+	TEST_MSG_ALWAYS("fr_md5_calc per_sec=%0.0lf",
+			(rounds * NUM_ELEMENTS(jobs)) / (fr_time_delta_unwrap(used) / (double)NSEC));
+
+	MD5_MB_FOREACH_ENGINE(engine) {
+		start = fr_time();
+		for (r = 0; r < rounds; r++) fr_md5_mb_calc(jobs, NUM_ELEMENTS(jobs));
+		used = fr_time_sub(fr_time(), start);
+
+		TEST_MSG_ALWAYS("%s per_sec=%0.0lf", engine->name,
+				(rounds * NUM_ELEMENTS(jobs)) / (fr_time_delta_unwrap(used) / (double)NSEC));
+	}
+	md5_mb_engine = NULL;
+}
+
+TEST_LIST = {
+	{ "md5_mb_lengths",	md5_mb_test_lengths },
+	{ "md5_mb_segments",	md5_mb_test_segments },
+	{ "md5_mb_hmac",	md5_mb_test_hmac },
+	{ "md5_mb_speed",	md5_mb_test_speed },
+
+	{ NULL }
+};
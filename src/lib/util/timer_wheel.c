@@ -0,0 +1,357 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Hashed timing wheel
+ *
+ * The event list stores timers in a heap, which costs O(log n) for
+ * every insert and delete.  Protocol timers (retransmissions, response
+ * timeouts) are armed for nearly every packet, and are almost always
+ * deleted before they fire.  At high packet rates, the cost of
+ * maintaining the heap dominates.
+ *
+ * A timing wheel instead hashes each timer into a slot by its expiry
+ * tick.  Inserting and deleting a timer are O(1) list operations.  The
+ * wheel keeps a single event list timer, armed for the first tick which
+ * has timers in it, and all timers in a tick are expired together.
+ *
+ * Timers fire at most one tick after they were due, and never before.
+ * Timers further in the future than one rotation of the wheel are
+ * stored in the same slot as nearer timers, and are skipped until their
+ * tick comes around.
+ *
+ * @file src/lib/util/timer_wheel.c
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/timer_wheel.h>
+
+#define TIMER_WHEEL_NOT_ARMED	UINT64_MAX
+
+struct fr_timer_wheel_s {
+	fr_event_list_t		*el;			//!< Event list we run timers from.
+	fr_event_timer_t const	*ev;			//!< Event list timer for the next tick.
+	uint64_t		armed;			//!< Tick the event list timer is armed for.
+
+	int64_t			resolution;		//!< Length of a tick in nanoseconds.
+	uint64_t		last;			//!< Last tick which was fully processed.
+
+	unsigned int		num_slots;		//!< Number of slots.  Always a power of 2.
+	unsigned int		mask;			//!< num_slots - 1.
+	fr_dlist_head_t		*slots;			//!< Timers, hashed by tick.
+
+	fr_dlist_head_t		expired;		//!< Timers which are about to fire.
+	unsigned int		num_elements;		//!< Timers in the slots.
+
+	fr_timer_wheel_stats_t	stats;			//!< Operation counters.
+};
+
+static inline CC_HINT(always_inline) uint64_t timer_wheel_tick(fr_timer_wheel_t const *tw, fr_time_t when)
+{
+	int64_t ns = fr_time_unwrap(when);
+
+	if (ns < 0) return 0;
+
+	return (uint64_t)ns / (uint64_t)tw->resolution;
+}
+
+static void _timer_wheel_tick(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Arm the event list timer so that the wheel runs after the given tick has elapsed
+ *
+ */
+static int timer_wheel_arm(fr_timer_wheel_t *tw, uint64_t tick)
+{
+	if (fr_event_timer_at(tw, tw->el, &tw->ev, fr_time_wrap((int64_t)(tick + 1) * tw->resolution),
+			      _timer_wheel_tick, tw) < 0) {
+		fr_strerror_const_push("Failed arming timing wheel");
+		return -1;
+	}
+	tw->armed = tick;
+	tw->stats.event_ops++;
+
+	return 0;
+}
+
+/** Arm the event list timer for the first slot which has timers in it
+ *
+ */
+static void timer_wheel_rearm(fr_timer_wheel_t *tw)
+{
+	unsigned int i;
+
+	if ((tw->num_elements == 0) || (tw->armed != TIMER_WHEEL_NOT_ARMED)) return;
+
+	for (i = 1; i <= tw->num_slots; i++) {
+		uint64_t tick = tw->last + i;
+
+		if (fr_dlist_empty(&tw->slots[tick & tw->mask])) continue;
+
+		if (timer_wheel_arm(tw, tick) < 0) {
+			fr_perror("timer_wheel");
+			fr_assert_fail("Failed re-arming timing wheel");
+		}
+		return;
+	}
+}
+
+/** Called by the event list when the next tick has elapsed
+ *
+ */
+static void _timer_wheel_tick(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_timer_wheel_t *tw = talloc_get_type_abort(uctx, fr_timer_wheel_t);
+
+	tw->stats.ticks++;
+	tw->armed = TIMER_WHEEL_NOT_ARMED;
+
+	(void) fr_timer_wheel_run(tw, now);
+}
+
+/** Disarm any timers still in the wheel when it's freed
+ *
+ */
+static int _timer_wheel_free(fr_timer_wheel_t *tw)
+{
+	fr_timer_wheel_entry_t	*te;
+	unsigned int		i;
+
+	for (i = 0; i < tw->num_slots; i++) {
+		while ((te = fr_dlist_pop_head(&tw->slots[i]))) te->list = NULL;
+	}
+	while ((te = fr_dlist_pop_head(&tw->expired))) te->list = NULL;
+
+	return 0;
+}
+
+/** Allocate a new timing wheel
+ *
+ * @param[in] ctx		to allocate the wheel in.
+ * @param[in] el		to run the wheel from.
+ * @param[in] resolution	length of a tick.  Timers fire at most this
+ *				long after they were due.
+ * @param[in] slots		number of slots.  Will be rounded up to a power of 2.
+ *				One rotation of the wheel is resolution * slots.
+ * @return
+ *	- A new timing wheel.
+ *	- NULL on error.
+ */
+fr_timer_wheel_t *fr_timer_wheel_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+				       fr_time_delta_t resolution, unsigned int slots)
+{
+	fr_timer_wheel_t	*tw;
+	unsigned int		i, num_slots;
+
+	if (!fr_time_delta_ispos(resolution)) {
+		fr_strerror_const("Timing wheel resolution must be greater than zero");
+		return NULL;
+	}
+
+	if ((slots == 0) || (slots > (1 << 24))) {
+		fr_strerror_printf("Timing wheel must have between 1 and %u slots", 1 << 24);
+		return NULL;
+	}
+
+	for (num_slots = 1; num_slots < slots; num_slots <<= 1);
+
+	tw = talloc_zero(ctx, fr_timer_wheel_t);
+	if (unlikely(!tw)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	tw->slots = talloc_array(tw, fr_dlist_head_t, num_slots);
+	if (unlikely(!tw->slots)) {
+		talloc_free(tw);
+		goto oom;
+	}
+
+	tw->el = el;
+	tw->armed = TIMER_WHEEL_NOT_ARMED;
+	tw->resolution = fr_time_delta_unwrap(resolution);
+	tw->num_slots = num_slots;
+	tw->mask = num_slots - 1;
+
+	for (i = 0; i < num_slots; i++) fr_dlist_init(&tw->slots[i], fr_timer_wheel_entry_t, entry);
+	fr_dlist_init(&tw->expired, fr_timer_wheel_entry_t, entry);
+
+	/*
+	 *	The current tick hasn't elapsed yet.
+	 */
+	tw->last = timer_wheel_tick(tw, fr_event_list_time(el));
+	if (tw->last > 0) tw->last--;
+
+	talloc_set_destructor(tw, _timer_wheel_free);
+
+	return tw;
+}
+
+/** Arm a timer
+ *
+ * If the timer is already armed, it is moved to the new expiry time.
+ *
+ * @param[in] tw	to insert the timer into.
+ * @param[in] te	timer to arm.  Usually embedded in the structure
+ *			the timer is for.
+ * @param[in] when	the timer should fire.
+ * @param[in] callback	to call when the timer fires.
+ * @param[in] uctx	to pass to the callback.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_timer_wheel_insert(fr_timer_wheel_t *tw, fr_timer_wheel_entry_t *te,
+			  fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+{
+	uint64_t	tick;
+
+	if (te->list) fr_timer_wheel_delete(te);
+
+	/*
+	 *	Timers in the past fire on the next tick.
+	 */
+	tick = timer_wheel_tick(tw, when);
+	if (tick <= tw->last) tick = tw->last + 1;
+
+	te->tw = tw;
+	te->tick = tick;
+	te->when = when;
+	te->callback = callback;
+	te->uctx = uctx;
+	te->list = &tw->slots[tick & tw->mask];
+
+	fr_dlist_insert_tail(te->list, te);
+	tw->num_elements++;
+	tw->stats.inserts++;
+
+	/*
+	 *	Only touch the event list if this timer is due
+	 *	before the tick we're already armed for.  In
+	 *	steady state, new timers are always later than
+	 *	existing ones.
+	 */
+	if ((tick < tw->armed) && (timer_wheel_arm(tw, tick) < 0)) {
+		fr_dlist_remove(te->list, te);
+		te->list = NULL;
+		tw->num_elements--;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Disarm a timer
+ *
+ * Does nothing if the timer isn't armed.
+ *
+ * @param[in] te	to disarm.
+ */
+void fr_timer_wheel_delete(fr_timer_wheel_entry_t *te)
+{
+	fr_timer_wheel_t *tw = te->tw;
+
+	if (!te->list) return;
+
+	fr_dlist_remove(te->list, te);
+	if (te->list != &tw->expired) tw->num_elements--;
+	te->list = NULL;
+
+	tw->stats.deletes++;
+}
+
+/** Run all timers which are due
+ *
+ * This is called automatically from the event list.  It only needs to
+ * be called directly if the caller is driving time itself.
+ *
+ * @param[in] tw	to run.
+ * @param[in] now	the current time.
+ * @return the number of timers which fired.
+ */
+unsigned int fr_timer_wheel_run(fr_timer_wheel_t *tw, fr_time_t now)
+{
+	fr_timer_wheel_entry_t	*te;
+	uint64_t		target, tick, end;
+	unsigned int		fired = 0;
+
+	target = timer_wheel_tick(tw, now);
+	if (target == 0) return 0;
+	target--;			/* The current tick hasn't fully elapsed */
+
+	if (target <= tw->last) goto done;
+
+	/*
+	 *	Each slot only needs to be visited once, no matter how
+	 *	many rotations have elapsed.
+	 */
+	end = target;
+	if ((end - tw->last) > tw->num_slots) end = tw->last + tw->num_slots;
+
+	for (tick = tw->last + 1; tick <= end; tick++) {
+		fr_dlist_head_t		*slot = &tw->slots[tick & tw->mask];
+		fr_timer_wheel_entry_t	*next;
+
+		for (te = fr_dlist_head(slot); te; te = next) {
+			next = fr_dlist_next(slot, te);
+
+			if (te->tick > target) continue;	/* Due on a later rotation */
+
+			fr_dlist_remove(slot, te);
+			fr_dlist_insert_tail(&tw->expired, te);
+			te->list = &tw->expired;
+			tw->num_elements--;
+		}
+	}
+
+	tw->last = target;
+	if (tw->armed <= target) tw->armed = TIMER_WHEEL_NOT_ARMED;
+
+	/*
+	 *	Callbacks may insert or delete other timers, including
+	 *	ones on the expired list.
+	 */
+	while ((te = fr_dlist_pop_head(&tw->expired))) {
+		te->list = NULL;
+		tw->stats.fired++;
+		fired++;
+
+		te->callback(tw->el, now, UNCONST(void *, te->uctx));
+	}
+
+done:
+	timer_wheel_rearm(tw);
+
+	return fired;
+}
+
+/** Return the number of armed timers
+ *
+ */
+unsigned int fr_timer_wheel_num_elements(fr_timer_wheel_t const *tw)
+{
+	return tw->num_elements;
+}
+
+/** Return the operation counters for a timing wheel
+ *
+ */
+fr_timer_wheel_stats_t const *fr_timer_wheel_stats(fr_timer_wheel_t const *tw)
+{
+	return &tw->stats;
+}
@@ -0,0 +1,98 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Hashed timing wheel, for large numbers of short lived timers
+ *
+ * @file src/lib/util/timer_wheel.h
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+RCSIDH(timer_wheel_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+typedef struct fr_timer_wheel_s fr_timer_wheel_t;
+
+/** A timer in a timing wheel
+ *
+ * This structure should be embedded in the structure the timer is for.
+ * The wheel never allocates or frees memory when timers are inserted,
+ * deleted, or fired.
+ *
+ * It must be zeroed before first use.
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in a wheel slot.
+	fr_dlist_head_t		*list;		//!< The slot we're in.  NULL if the timer isn't armed.
+	fr_timer_wheel_t	*tw;		//!< The wheel we're in.
+
+	uint64_t		tick;		//!< Tick the timer expires on.
+	fr_time_t		when;		//!< When the timer was set to fire.
+
+	fr_event_timer_cb_t	callback;	//!< To call when the timer fires.
+	void const		*uctx;		//!< Passed to the callback.
+} fr_timer_wheel_entry_t;
+
+/** Statistics for a timing wheel
+ *
+ */
+typedef struct {
+	uint64_t		inserts;	//!< Timers armed.
+	uint64_t		deletes;	//!< Timers disarmed before they fired.
+	uint64_t		fired;		//!< Timers which fired.
+	uint64_t		ticks;		//!< Times the wheel was run from the event loop.
+	uint64_t		event_ops;	//!< Event list timer inserts and updates.
+} fr_timer_wheel_stats_t;
+
+fr_timer_wheel_t		*fr_timer_wheel_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+						      fr_time_delta_t resolution, unsigned int slots) CC_HINT(nonnull(2));
+
+int				fr_timer_wheel_insert(fr_timer_wheel_t *tw, fr_timer_wheel_entry_t *te,
+						      fr_time_t when, fr_event_timer_cb_t callback, void const *uctx)
+						      CC_HINT(nonnull(1,2,4));
+
+void				fr_timer_wheel_delete(fr_timer_wheel_entry_t *te) CC_HINT(nonnull);
+
+unsigned int			fr_timer_wheel_run(fr_timer_wheel_t *tw, fr_time_t now) CC_HINT(nonnull);
+
+unsigned int			fr_timer_wheel_num_elements(fr_timer_wheel_t const *tw) CC_HINT(nonnull);
+
+fr_timer_wheel_stats_t const	*fr_timer_wheel_stats(fr_timer_wheel_t const *tw) CC_HINT(nonnull);
+
+/** Check whether a timer is armed
+ *
+ * @param[in] te	to check.
+ * @return
+ *	- true if the timer will fire.
+ *	- false if the timer isn't armed.
+ */
+static inline CC_HINT(nonnull) bool fr_timer_wheel_entry_armed(fr_timer_wheel_entry_t const *te)
+{
+	return (te->list != NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
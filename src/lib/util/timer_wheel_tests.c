@@ -0,0 +1,265 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the timing wheel
+ *
+ * @file src/lib/util/timer_wheel_tests.c
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "timer_wheel.h"
+
+typedef struct {
+	fr_timer_wheel_entry_t	te;
+	fr_event_timer_t const	*ev;
+	unsigned int		fired;
+	unsigned int		order;
+	fr_timer_wheel_t	*reinsert;	//!< Re-arm the timer from the callback.
+} tw_thing;
+
+static unsigned int fired_count;
+
+static void tw_fire(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	tw_thing *thing = uctx;
+
+	thing->fired++;
+	thing->order = ++fired_count;
+
+	if (thing->reinsert) {
+		TEST_CHECK(fr_timer_wheel_insert(thing->reinsert, &thing->te,
+						 fr_time_add(now, fr_time_delta_from_msec(5)), tw_fire, thing) == 0);
+		thing->reinsert = NULL;
+	}
+}
+
+static void timer_wheel_test_basic(void)
+{
+	fr_event_list_t		*el;
+	fr_timer_wheel_t	*tw;
+	tw_thing		things[3] = { 0 };
+	fr_time_t		now;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+
+	tw = fr_timer_wheel_alloc(el, el, fr_time_delta_from_msec(1), 64);
+	TEST_CHECK(tw != NULL);
+
+	now = fr_event_list_time(el);
+	fired_count = 0;
+
+	/*
+	 *	The last timer is further away than one rotation
+	 *	of the wheel (64ms).
+	 */
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[2].te, fr_time_add(now, fr_time_delta_from_msec(200)), tw_fire, &things[2]) == 0);
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[1].te, fr_time_add(now, fr_time_delta_from_msec(20)), tw_fire, &things[1]) == 0);
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[0].te, fr_time_add(now, fr_time_delta_from_msec(10)), tw_fire, &things[0]) == 0);
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 3);
+
+	TEST_CASE("Nothing fires early");
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(9))) == 0);
+
+	TEST_CASE("Timers fire in order");
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(12))) == 1);
+	TEST_CHECK(things[0].fired == 1);
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(22))) == 1);
+	TEST_CHECK(things[1].fired == 1);
+	TEST_CHECK(things[0].order < things[1].order);
+
+	TEST_CASE("Timers on later rotations are skipped");
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(150))) == 0);
+	TEST_CHECK(things[2].fired == 0);
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(202))) == 1);
+	TEST_CHECK(things[2].fired == 1);
+
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 0);
+	TEST_CHECK(!fr_timer_wheel_entry_armed(&things[2].te));
+
+	talloc_free(el);
+}
+
+static void timer_wheel_test_delete(void)
+{
+	fr_event_list_t		*el;
+	fr_timer_wheel_t	*tw;
+	tw_thing		things[2] = { 0 };
+	fr_time_t		now;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	tw = fr_timer_wheel_alloc(el, el, fr_time_delta_from_msec(1), 64);
+	now = fr_event_list_time(el);
+
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[0].te, fr_time_add(now, fr_time_delta_from_msec(10)), tw_fire, &things[0]) == 0);
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[1].te, fr_time_add(now, fr_time_delta_from_msec(10)), tw_fire, &things[1]) == 0);
+	TEST_CHECK(fr_timer_wheel_entry_armed(&things[0].te));
+
+	fr_timer_wheel_delete(&things[0].te);
+	TEST_CHECK(!fr_timer_wheel_entry_armed(&things[0].te));
+	fr_timer_wheel_delete(&things[0].te);	/* No-op */
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 1);
+
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(20))) == 1);
+	TEST_CHECK(things[0].fired == 0);
+	TEST_CHECK(things[1].fired == 1);
+
+	TEST_CASE("Moving an armed timer");
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[0].te, fr_time_add(now, fr_time_delta_from_msec(30)), tw_fire, &things[0]) == 0);
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[0].te, fr_time_add(now, fr_time_delta_from_msec(40)), tw_fire, &things[0]) == 0);
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 1);
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(35))) == 0);
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(45))) == 1);
+
+	TEST_CASE("Freeing the wheel disarms timers");
+	TEST_CHECK(fr_timer_wheel_insert(tw, &things[1].te, fr_time_add(now, fr_time_delta_from_msec(100)), tw_fire, &things[1]) == 0);
+	talloc_free(tw);
+	TEST_CHECK(!fr_timer_wheel_entry_armed(&things[1].te));
+
+	talloc_free(el);
+}
+
+static void timer_wheel_test_reinsert(void)
+{
+	fr_event_list_t		*el;
+	fr_timer_wheel_t	*tw;
+	tw_thing		thing = { 0 };
+	fr_time_t		now;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	tw = fr_timer_wheel_alloc(el, el, fr_time_delta_from_msec(1), 64);
+	now = fr_event_list_time(el);
+
+	thing.reinsert = tw;
+	TEST_CHECK(fr_timer_wheel_insert(tw, &thing.te, fr_time_add(now, fr_time_delta_from_msec(10)), tw_fire, &thing) == 0);
+
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(12))) == 1);
+	TEST_CHECK(fr_timer_wheel_entry_armed(&thing.te));
+	TEST_CHECK(fr_timer_wheel_run(tw, fr_time_add(now, fr_time_delta_from_msec(20))) == 1);
+	TEST_CHECK(thing.fired == 2);
+
+	talloc_free(el);
+}
+
+static void ev_fire(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	tw_thing *thing = uctx;
+
+	thing->fired++;
+}
+
+/** Compare the cost of per-packet timers in the event list and the timing wheel
+ *
+ * Emulates a proxy.  Each packet arms a response timer, which is nearly
+ * always cancelled when the reply arrives.  Packets arrive in order, so
+ * their timers are in ascending order.
+ */
+static void timer_wheel_cmp(unsigned int count)
+{
+	fr_event_list_t		*el;
+	fr_timer_wheel_t	*tw;
+	tw_thing		*things;
+	fr_time_t		now, start, end;
+	fr_time_delta_t		timeout = fr_time_delta_from_sec(2);
+	unsigned int		i;
+	fr_timer_wheel_stats_t const *stats;
+
+	things = talloc_zero_array(NULL, tw_thing, count);
+
+	/*
+	 *	Event list, one heap insert and delete per packet.
+	 */
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	now = fr_event_list_time(el);
+
+	start = fr_time();
+	for (i = 0; i < count; i++) {
+		TEST_CHECK(fr_event_timer_at(things, el, &things[i].ev,
+					     fr_time_add(now, fr_time_delta_add(timeout, fr_time_delta_wrap(i * 1000))),
+					     ev_fire, &things[i]) == 0);
+	}
+	for (i = 0; i < count; i++) (void) fr_event_timer_delete(&things[i].ev);
+	end = fr_time();
+
+	TEST_MSG_ALWAYS("\nevent list, %u packets: %"PRIu64" ns/packet, 2 event ops/packet\n",
+			count, fr_time_delta_unwrap(fr_time_sub(end, start)) / count);
+
+	talloc_free(el);
+
+	/*
+	 *	Timing wheel, with 10ms ticks.
+	 */
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	tw = fr_timer_wheel_alloc(el, el, fr_time_delta_from_msec(10), 1024);
+	now = fr_event_list_time(el);
+
+	start = fr_time();
+	for (i = 0; i < count; i++) {
+		TEST_CHECK(fr_timer_wheel_insert(tw, &things[i].te,
+						 fr_time_add(now, fr_time_delta_add(timeout, fr_time_delta_wrap(i * 1000))),
+						 tw_fire, &things[i]) == 0);
+	}
+	for (i = 0; i < count; i++) fr_timer_wheel_delete(&things[i].te);
+	end = fr_time();
+
+	stats = fr_timer_wheel_stats(tw);
+	TEST_MSG_ALWAYS("timing wheel, %u packets: %"PRIu64" ns/packet, %.4f event ops/packet\n",
+			count, fr_time_delta_unwrap(fr_time_sub(end, start)) / count,
+			(double)stats->event_ops / count);
+	TEST_CHECK(stats->inserts == count);
+	TEST_CHECK(stats->deletes == count);
+	TEST_CHECK(fr_timer_wheel_num_elements(tw) == 0);
+
+	talloc_free(el);
+	talloc_free(things);
+}
+
+static void timer_wheel_cmp_1000(void)
+{
+	timer_wheel_cmp(1000);
+}
+
+static void timer_wheel_cmp_100000(void)
+{
+	timer_wheel_cmp(100000);
+}
+
+static void timer_wheel_cmp_1000000(void)
+{
+	timer_wheel_cmp(1000000);
+}
+
+TEST_LIST = {
+	/*
+	 *	Basic tests
+	 */
+	{ "timer_wheel_test_basic",	timer_wheel_test_basic },
+	{ "timer_wheel_test_delete",	timer_wheel_test_delete },
+	{ "timer_wheel_test_reinsert",	timer_wheel_test_reinsert },
+
+	/*
+	 *	Performance comparison with the event list
+	 */
+	{ "timer_wheel_cmp_1000",	timer_wheel_cmp_1000 },
+	{ "timer_wheel_cmp_100000",	timer_wheel_cmp_100000 },
+	{ "timer_wheel_cmp_1000000",	timer_wheel_cmp_1000000 },
+
+	{ NULL }
+};
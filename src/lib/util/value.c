@@ -52,6 +52,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/base16.h>
 #include <freeradius-devel/util/dcursor.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/size.h>
 #include <freeradius-devel/util/time.h>
 
@@ -3156,11 +3157,322 @@ bad_cast:
 }
 
 
-/** Convert one type of fr_value_box_t to another
+/** @name Cast fast paths
  *
- * This should be the canonical function used to convert between INTERNAL data formats.
+ * fr_value_box_cast_generic() handles every conversion, but it has to
+ * work through several switch statements to do so, and it often goes
+ * via the presentation format.  The most common conversions instead
+ * have a direct function in #value_box_cast_funcs, which is indexed by
+ * destination and source type.
  *
- * If you want to convert from PRESENTATION format, use #fr_value_box_from_substr.
+ * Callers which know the types in advance (e.g. tmpls with a cast)
+ * can look up the function once with fr_value_box_cast_select(), and
+ * call it directly.
+ *
+ * Every function checks that it's been given the types it expects.
+ * Anything unusual (enumerations, values out of range, numbers in
+ * octal or hex) is handed to fr_value_box_cast_generic(), so that the
+ * results and error messages are always the same as the slow path.
+ * @{
+ */
+
+/** Whether a box's value might be printed as an enumeration name
+ *
+ * Boxes taken from pairs always have enumv set to the pair's
+ * attribute, but most attributes have no enumeration values.
+ */
+static inline CC_HINT(always_inline) bool value_box_has_enum_names(fr_value_box_t const *vb)
+{
+	fr_dict_attr_ext_enumv_t *ext;
+
+	if (!vb->enumv || !vb->enumv->name) return false;
+
+	ext = fr_dict_attr_ext(vb->enumv, FR_DICT_ATTR_EXT_ENUMV);
+	if (!ext || !ext->name_by_value) return false;
+
+	return fr_hash_table_num_elements(ext->name_by_value) > 0;
+}
+
+/** Print an unsigned integer into the end of a buffer
+ *
+ * @return the start of the number.
+ */
+static inline CC_HINT(always_inline) char *value_box_utoa(char *end, uint64_t num)
+{
+	char *p = end;
+
+	do {
+		*--p = '0' + (num % 10);
+		num /= 10;
+	} while (num);
+
+	return p;
+}
+
+/** Parse a plain decimal number
+ *
+ * Only accepts a '-' followed by digits.  Leading zeros (octal),
+ * empty strings, and numbers which might overflow are rejected, and
+ * left for the slow path.
+ */
+static inline CC_HINT(always_inline) bool value_box_str_to_num(char const *p, size_t len, uint64_t *out, bool *neg)
+{
+	char const	*end;
+	uint64_t	num = 0;
+
+	*neg = false;
+	if ((len > 0) && (*p == '-')) {
+		*neg = true;
+		p++;
+		len--;
+	}
+
+	if ((len == 0) || (len > 18) || ((*p == '0') && (len > 1))) return false;
+
+	for (end = p + len; p < end; p++) {
+		if ((*p < '0') || (*p > '9')) return false;
+		num = (num * 10) + (*p - '0');
+	}
+
+	*out = num;
+	return true;
+}
+
+#define CAST_FALLBACK(_cond) \
+	if (unlikely(_cond)) return fr_value_box_cast_generic(ctx, dst, dst_type, dst_enumv, src)
+
+#define CAST_FUNC(_name) \
+static int _name(TALLOC_CTX *ctx, fr_value_box_t *dst, \
+		 fr_type_t dst_type, fr_dict_attr_t const *dst_enumv, \
+		 fr_value_box_t const *src)
+
+/*
+ *	Integer types which have fast paths.  Dates and time deltas
+ *	need scaling, and bools have their own rules, so they use the
+ *	slow path.
+ */
+#define CAST_INT_TYPES(_X, ...) \
+	_X(uint8, FR_TYPE_UINT8, false, __VA_ARGS__) \
+	_X(uint16, FR_TYPE_UINT16, false, __VA_ARGS__) \
+	_X(uint32, FR_TYPE_UINT32, false, __VA_ARGS__) \
+	_X(uint64, FR_TYPE_UINT64, false, __VA_ARGS__) \
+	_X(int8, FR_TYPE_INT8, true, __VA_ARGS__) \
+	_X(int16, FR_TYPE_INT16, true, __VA_ARGS__) \
+	_X(int32, FR_TYPE_INT32, true, __VA_ARGS__) \
+	_X(int64, FR_TYPE_INT64, true, __VA_ARGS__) \
+	_X(size, FR_TYPE_SIZE, false, __VA_ARGS__)
+
+/*
+ *	<integer> -> <integer>
+ */
+#define CAST_INT_TO_INT(_sf, _st, _signed, _df, _dt) \
+CAST_FUNC(value_box_cast_##_sf##_to_##_df) \
+{ \
+	uint64_t	num; \
+	bool		tainted; \
+\
+	CAST_FALLBACK((src->type != _st) || (dst_type != _dt)); \
+\
+	num = (uint64_t)src->vb_##_sf; \
+	if (_signed) { \
+		CAST_FALLBACK(((int64_t)num < fr_value_box_integer_min[_dt]) || \
+			      (((int64_t)num > 0) && (num > fr_value_box_integer_max[_dt]))); \
+	} else { \
+		CAST_FALLBACK(num > fr_value_box_integer_max[_dt]); \
+	} \
+\
+	tainted = src->tainted; \
+	fr_value_box_init(dst, _dt, dst_enumv, tainted); \
+	dst->vb_##_df = num; \
+	return 0; \
+}
+
+#define CAST_INT_TO_INT_ROW(_df, _dt) CAST_INT_TYPES(CAST_INT_TO_INT, _df, _dt)
+
+CAST_INT_TO_INT_ROW(uint8, FR_TYPE_UINT8)
+CAST_INT_TO_INT_ROW(uint16, FR_TYPE_UINT16)
+CAST_INT_TO_INT_ROW(uint32, FR_TYPE_UINT32)
+CAST_INT_TO_INT_ROW(uint64, FR_TYPE_UINT64)
+CAST_INT_TO_INT_ROW(int8, FR_TYPE_INT8)
+CAST_INT_TO_INT_ROW(int16, FR_TYPE_INT16)
+CAST_INT_TO_INT_ROW(int32, FR_TYPE_INT32)
+CAST_INT_TO_INT_ROW(int64, FR_TYPE_INT64)
+CAST_INT_TO_INT_ROW(size, FR_TYPE_SIZE)
+
+/*
+ *	<integer> -> <string>, unless the source has enumeration
+ *	names, which are printed instead of the number.
+ */
+#define CAST_INT_TO_STRING(_sf, _st, _signed, ...) \
+CAST_FUNC(value_box_cast_##_sf##_to_string) \
+{ \
+	char		buffer[24]; \
+	char		*end = buffer + sizeof(buffer), *p; \
+	int64_t		num; \
+\
+	CAST_FALLBACK((src->type != _st) || (dst_type != FR_TYPE_STRING) || value_box_has_enum_names(src)); \
+\
+	num = (int64_t)src->vb_##_sf; \
+	if (_signed && (num < 0)) { \
+		p = value_box_utoa(end, (uint64_t)0 - (uint64_t)num); \
+		*--p = '-'; \
+	} else { \
+		p = value_box_utoa(end, (uint64_t)src->vb_##_sf); \
+	} \
+\
+	return fr_value_box_bstrndup(ctx, dst, dst_enumv, p, end - p, src->tainted); \
+}
+
+CAST_INT_TYPES(CAST_INT_TO_STRING)
+
+/*
+ *	<integer> -> <octets>, in network byte order.  fr_value_box_hton()
+ *	doesn't swap sizes, so they're copied as they are in memory.
+ */
+#define CAST_INT_TO_OCTETS(_sf, _st, _signed, ...) \
+CAST_FUNC(value_box_cast_##_sf##_to_octets) \
+{ \
+	uint8_t		buffer[sizeof(src->vb_##_sf)]; \
+	uint64_t	num; \
+	size_t		i; \
+\
+	CAST_FALLBACK((src->type != _st) || (dst_type != FR_TYPE_OCTETS)); \
+\
+	if (_st == FR_TYPE_SIZE) return fr_value_box_memdup(ctx, dst, dst_enumv, \
+							     (uint8_t const *)&src->vb_##_sf, sizeof(buffer), \
+							     src->tainted); \
+\
+	num = (uint64_t)src->vb_##_sf; \
+	for (i = sizeof(buffer); i > 0; i--) { \
+		buffer[i - 1] = num & 0xff; \
+		num >>= 8; \
+	} \
+\
+	return fr_value_box_memdup(ctx, dst, dst_enumv, buffer, sizeof(buffer), src->tainted); \
+}
+
+CAST_INT_TYPES(CAST_INT_TO_OCTETS)
+
+/*
+ *	<string> -> <integer>, for plain decimal numbers.  Sizes can
+ *	have units, so they use the slow path.
+ *
+ *	Like fr_value_box_from_str(), returns the number of bytes
+ *	parsed.
+ */
+#define CAST_STRING_TO_INT(_df, _dt, _signed, ...) \
+CAST_FUNC(value_box_cast_string_to_##_df) \
+{ \
+	uint64_t	num; \
+	bool		neg, tainted; \
+\
+	CAST_FALLBACK((src->type != FR_TYPE_STRING) || (dst_type != _dt) || dst_enumv); \
+	CAST_FALLBACK(!value_box_str_to_num(src->vb_strvalue, src->vb_length, &num, &neg)); \
+\
+	if (neg) { \
+		CAST_FALLBACK(!_signed || (-(int64_t)num < fr_value_box_integer_min[_dt])); \
+	} else { \
+		CAST_FALLBACK(num > fr_value_box_integer_max[_dt]); \
+	} \
+\
+	tainted = src->tainted; \
+	fr_value_box_init(dst, _dt, NULL, tainted); \
+	dst->vb_##_df = neg ? -(int64_t)num : (int64_t)num; \
+	return src->vb_length; \
+}
+
+CAST_STRING_TO_INT(uint8, FR_TYPE_UINT8, false)
+CAST_STRING_TO_INT(uint16, FR_TYPE_UINT16, false)
+CAST_STRING_TO_INT(uint32, FR_TYPE_UINT32, false)
+CAST_STRING_TO_INT(uint64, FR_TYPE_UINT64, false)
+CAST_STRING_TO_INT(int8, FR_TYPE_INT8, true)
+CAST_STRING_TO_INT(int16, FR_TYPE_INT16, true)
+CAST_STRING_TO_INT(int32, FR_TYPE_INT32, true)
+CAST_STRING_TO_INT(int64, FR_TYPE_INT64, true)
+
+/*
+ *	<ipv4addr> | <ipv6addr> -> <string>
+ */
+CAST_FUNC(value_box_cast_ipaddr_to_string)
+{
+	char buffer[FR_IPADDR_STRLEN];
+
+	CAST_FALLBACK(((src->type != FR_TYPE_IPV4_ADDR) && (src->type != FR_TYPE_IPV6_ADDR)) ||
+		      (dst_type != FR_TYPE_STRING) || value_box_has_enum_names(src));
+	CAST_FALLBACK(!fr_inet_ntop(buffer, sizeof(buffer), &src->vb_ip));
+
+	return fr_value_box_bstrndup(ctx, dst, dst_enumv, buffer, strlen(buffer), src->tainted);
+}
+
+#define CAST_ENTRY_INT_TO_INT(_sf, _st, _signed, _df, _dt) [_st] = value_box_cast_##_sf##_to_##_df,
+#define CAST_ENTRY_INT_TO_STRING(_sf, _st, _signed, ...) [_st] = value_box_cast_##_sf##_to_string,
+#define CAST_ENTRY_INT_TO_OCTETS(_sf, _st, _signed, ...) [_st] = value_box_cast_##_sf##_to_octets,
+
+#define CAST_ROW_INT(_df, _dt) \
+	[_dt] = { \
+		CAST_INT_TYPES(CAST_ENTRY_INT_TO_INT, _df, _dt) \
+		[FR_TYPE_STRING] = value_box_cast_string_to_##_df, \
+	}
+
+/** Direct cast functions, indexed by [dst_type][src_type]
+ *
+ * NULL entries use fr_value_box_cast_generic().
+ */
+static fr_value_box_cast_t const value_box_cast_funcs[FR_TYPE_MAX][FR_TYPE_MAX] = {
+	CAST_ROW_INT(uint8, FR_TYPE_UINT8),
+	CAST_ROW_INT(uint16, FR_TYPE_UINT16),
+	CAST_ROW_INT(uint32, FR_TYPE_UINT32),
+	CAST_ROW_INT(uint64, FR_TYPE_UINT64),
+	CAST_ROW_INT(int8, FR_TYPE_INT8),
+	CAST_ROW_INT(int16, FR_TYPE_INT16),
+	CAST_ROW_INT(int32, FR_TYPE_INT32),
+	CAST_ROW_INT(int64, FR_TYPE_INT64),
+
+	[FR_TYPE_SIZE] = {
+		CAST_INT_TYPES(CAST_ENTRY_INT_TO_INT, size, FR_TYPE_SIZE)
+	},
+
+	[FR_TYPE_STRING] = {
+		CAST_INT_TYPES(CAST_ENTRY_INT_TO_STRING)
+		[FR_TYPE_IPV4_ADDR] = value_box_cast_ipaddr_to_string,
+		[FR_TYPE_IPV6_ADDR] = value_box_cast_ipaddr_to_string,
+	},
+
+	[FR_TYPE_OCTETS] = {
+		CAST_INT_TYPES(CAST_ENTRY_INT_TO_OCTETS)
+	},
+};
+
+/** Return the function which casts one type to another
+ *
+ * The function has the same arguments and behaviour as fr_value_box_cast(),
+ * but skips the dispatch.  It can be looked up once, when the types are
+ * known, and called for every value.
+ *
+ * If the source box isn't of src_type, the function falls back to the
+ * slow path, so the result is always correct.
+ *
+ * @param[in] dst_type	to cast to.
+ * @param[in] src_type	the type of the boxes which will be cast.
+ * @return the cast function.  Never NULL.
+ */
+fr_value_box_cast_t fr_value_box_cast_select(fr_type_t dst_type, fr_type_t src_type)
+{
+	fr_value_box_cast_t func;
+
+	if ((dst_type >= FR_TYPE_MAX) || (src_type >= FR_TYPE_MAX) || (dst_type == src_type)) return fr_value_box_cast;
+
+	func = value_box_cast_funcs[dst_type][src_type];
+	if (!func) return fr_value_box_cast_generic;
+
+	return func;
+}
+/** @} */
+
+/** Convert one type of fr_value_box_t to another, without using the cast table
+ *
+ * Handles every pair of types which can be cast.  The functions in
+ * the cast table MUST give the same results as this function.
  *
  * @note src and dst must not be the same box.  We do not support casting in place.
  *
@@ -3168,16 +3480,14 @@ bad_cast:
  * @param dst		Where to write result of casting.
  * @param dst_type	to cast to.
  * @param dst_enumv	Aliases for values contained within this fr_value_box_t.
- *			If #fr_value_box_t is passed to #fr_value_box_aprint
- *			names will be printed instead of actual value.
  * @param src		Input data.
  * @return
  *	- 0 on success.
  *	- -1 on failure.
  */
-int fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
-		      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
-		      fr_value_box_t const *src)
+int fr_value_box_cast_generic(TALLOC_CTX *ctx, fr_value_box_t *dst,
+			      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+			      fr_value_box_t const *src)
 {
 	if (!fr_cond_assert(dst_type != FR_TYPE_NULL)) return -1;
 	if (!fr_cond_assert(src != dst)) return -1;
@@ -3334,6 +3644,39 @@ int fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
 	return 0;
 }
 
+/** Convert one type of fr_value_box_t to another
+ *
+ * This should be the canonical function used to convert between INTERNAL data formats.
+ *
+ * If you want to convert from PRESENTATION format, use #fr_value_box_from_substr.
+ *
+ * @note src and dst must not be the same box.  We do not support casting in place.
+ *
+ * @param ctx		to allocate buffers in (usually the same as dst)
+ * @param dst		Where to write result of casting.
+ * @param dst_type	to cast to.
+ * @param dst_enumv	Aliases for values contained within this fr_value_box_t.
+ *			If #fr_value_box_t is passed to #fr_value_box_aprint
+ *			names will be printed instead of actual value.
+ * @param src		Input data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
+		      fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+		      fr_value_box_t const *src)
+{
+	fr_value_box_cast_t func;
+
+	if (likely((dst_type < FR_TYPE_MAX) && (src->type < FR_TYPE_MAX) && (dst_type != src->type))) {
+		func = value_box_cast_funcs[dst_type][src->type];
+		if (func) return func(ctx, dst, dst_type, dst_enumv, src);
+	}
+
+	return fr_value_box_cast_generic(ctx, dst, dst_type, dst_enumv, src);
+}
+
 /** Convert one type of fr_value_box_t to another in place
  *
  * This should be the canonical function used to convert between INTERNAL data formats.
@@ -3352,6 +3695,23 @@ int fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
  */
 int fr_value_box_cast_in_place(TALLOC_CTX *ctx, fr_value_box_t *vb,
 			       fr_type_t dst_type, fr_dict_attr_t const *dst_enumv)
+{
+	return fr_value_box_cast_in_place_with(ctx, vb, fr_value_box_cast, dst_type, dst_enumv);
+}
+
+/** Convert one type of fr_value_box_t to another in place, using a specific cast function
+ *
+ * @param ctx		to allocate buffers in (usually the same as dst)
+ * @param vb		to cast.
+ * @param cast		function to use, usually from #fr_value_box_cast_select.
+ * @param dst_type	to cast to.
+ * @param dst_enumv	Aliases for values contained within this fr_value_box_t.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_cast_in_place_with(TALLOC_CTX *ctx, fr_value_box_t *vb, fr_value_box_cast_t cast,
+				    fr_type_t dst_type, fr_dict_attr_t const *dst_enumv)
 {
 	fr_value_box_t tmp;
 	/*
@@ -3376,7 +3736,7 @@ int fr_value_box_cast_in_place(TALLOC_CTX *ctx, fr_value_box_t *vb,
 	 */
 	fr_value_box_copy_shallow(NULL, &tmp, vb);
 
-	if (fr_value_box_cast(ctx, vb, dst_type, dst_enumv, &tmp) < 0) {
+	if (cast(ctx, vb, dst_type, dst_enumv, &tmp) < 0) {
 		/*
 		 *	On error, make sure the original
 		 *	box is left in a consistent state.
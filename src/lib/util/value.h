@@ -803,15 +803,34 @@ ssize_t		fr_value_box_from_network(TALLOC_CTX *ctx,
 					  fr_dbuff_t *dbuff, size_t len, bool tainted)
 		CC_HINT(nonnull(2,5));
 
+/** A function which casts a value box to a particular type
+ *
+ * Has the same arguments and return values as #fr_value_box_cast.
+ */
+typedef int (*fr_value_box_cast_t)(TALLOC_CTX *ctx, fr_value_box_t *dst,
+				   fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+				   fr_value_box_t const *src);
+
 int		fr_value_box_cast(TALLOC_CTX *ctx, fr_value_box_t *dst,
 				  fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
 				  fr_value_box_t const *src)
 		CC_HINT(nonnull(2,5));
 
+int		fr_value_box_cast_generic(TALLOC_CTX *ctx, fr_value_box_t *dst,
+					  fr_type_t dst_type, fr_dict_attr_t const *dst_enumv,
+					  fr_value_box_t const *src)
+		CC_HINT(nonnull(2,5));
+
+fr_value_box_cast_t fr_value_box_cast_select(fr_type_t dst_type, fr_type_t src_type);
+
 int		fr_value_box_cast_in_place(TALLOC_CTX *ctx, fr_value_box_t *vb,
 					   fr_type_t dst_type, fr_dict_attr_t const *dst_enumv)
 		CC_HINT(nonnull(1));
 
+int		fr_value_box_cast_in_place_with(TALLOC_CTX *ctx, fr_value_box_t *vb, fr_value_box_cast_t cast,
+						fr_type_t dst_type, fr_dict_attr_t const *dst_enumv)
+		CC_HINT(nonnull(2,3));
+
 bool		fr_value_box_is_truthy(fr_value_box_t const *box)
 		CC_HINT(nonnull(1));
 
@@ -0,0 +1,131 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Performance tests for the value box cast table
+ *
+ * Compares the speed of the direct cast functions with
+ * fr_value_box_cast_generic().
+ *
+ * @file src/lib/util/value_cast_perf_test.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/value.h>
+
+#define CAST_BENCH_ITERATIONS	(10000)
+
+static char const *cast_samples[] = {
+	"0", "1", "-1", "127", "128", "-128", "255", "256",
+	"65535", "65536", "4294967295", "18446744073709551615",
+	"192.0.2.1", "2001:db8::1", "00:11:22:33:44:55",
+	"yes", "abc",
+};
+
+static int cast_sample(fr_value_box_t *out, fr_type_t type, char const *str)
+{
+	if (fr_value_box_from_str(NULL, out, type, NULL, str, strlen(str), NULL, false) < 0) {
+		fr_strerror_clear();
+		return -1;
+	}
+
+	return 0;
+}
+
+static bool cast_pair_valid(fr_type_t dst_type, fr_type_t src_type)
+{
+	if (!fr_type_is_leaf(dst_type) || !fr_type_is_leaf(src_type)) return false;
+
+	return (dst_type == src_type) || fr_type_cast(dst_type, src_type);
+}
+
+static void value_cast_test_speed(void)
+{
+	fr_type_t	dst_type, src_type;
+	size_t		i, j;
+	uint64_t	total_fast = 0, total_generic = 0;
+
+	TEST_MSG_ALWAYS("\n%-12s %-12s %12s %12s\n", "src", "dst", "fast ns/op", "generic ns/op");
+
+	for (src_type = FR_TYPE_NULL; src_type < FR_TYPE_MAX; src_type++) {
+		for (dst_type = FR_TYPE_NULL; dst_type < FR_TYPE_MAX; dst_type++) {
+			fr_value_box_t	src, dst;
+			fr_time_t	start;
+			uint64_t	fast = 0, generic = 0, ops = 0;
+
+			if (!cast_pair_valid(dst_type, src_type)) continue;
+
+			for (i = 0; i < NUM_ELEMENTS(cast_samples); i++) {
+				if (cast_sample(&src, src_type, cast_samples[i]) < 0) continue;
+
+				/*
+				 *	Only time values which can be cast.
+				 */
+				if (fr_value_box_cast(NULL, &dst, dst_type, NULL, &src) < 0) {
+					fr_strerror_clear();
+					fr_value_box_clear(&src);
+					continue;
+				}
+				fr_value_box_clear(&dst);
+
+				start = fr_time();
+				for (j = 0; j < CAST_BENCH_ITERATIONS; j++) {
+					(void) fr_value_box_cast(NULL, &dst, dst_type, NULL, &src);
+					fr_value_box_clear(&dst);
+				}
+				fast += fr_time_delta_unwrap(fr_time_sub(fr_time(), start));
+
+				start = fr_time();
+				for (j = 0; j < CAST_BENCH_ITERATIONS; j++) {
+					(void) fr_value_box_cast_generic(NULL, &dst, dst_type, NULL, &src);
+					fr_value_box_clear(&dst);
+				}
+				generic += fr_time_delta_unwrap(fr_time_sub(fr_time(), start));
+
+				ops += CAST_BENCH_ITERATIONS;
+				fr_value_box_clear(&src);
+			}
+
+			if (!ops) continue;
+
+			total_fast += fast;
+			total_generic += generic;
+
+			/*
+			 *	Only print the pairs which have direct functions,
+			 *	the rest should be the same.
+			 */
+			if (fr_value_box_cast_select(dst_type, src_type) == fr_value_box_cast_generic) continue;
+			if (dst_type == src_type) continue;
+
+			TEST_MSG_ALWAYS("%-12s %-12s %12.1f %12.1f\n",
+					fr_type_to_str(src_type), fr_type_to_str(dst_type),
+					(double)fast / ops, (double)generic / ops);
+		}
+	}
+
+	TEST_MSG_ALWAYS("all pairs: fast %.3fs, generic %.3fs\n",
+			(double)total_fast / NSEC, (double)total_generic / NSEC);
+}
+
+TEST_LIST = {
+	{ "value_cast_test_speed",	value_cast_test_speed },
+
+	{ NULL }
+};
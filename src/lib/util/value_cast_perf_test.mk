@@ -0,0 +1,6 @@
+TARGET		:= value_cast_perf_test$(E)
+SOURCES		:= value_cast_perf_test.c
+
+TGT_INSTALLDIR	:=
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-util$(L)
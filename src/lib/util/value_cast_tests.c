@@ -0,0 +1,292 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the value box cast table
+ *
+ * Checks that the direct cast functions give the same results as
+ * fr_value_box_cast_generic().  The speed comparison is in
+ * value_cast_perf_test.c.
+ *
+ * @file src/lib/util/value_cast_tests.c
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/dict_test.h>
+#include <freeradius-devel/util/value.h>
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*test_dict;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("value_cast_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+}
+
+/*
+ *	Parsed as every leaf type.  The ones which don't parse as a
+ *	particular type are skipped for that type.
+ */
+static char const *cast_samples[] = {
+	"0", "1", "-1", "127", "128", "-128", "-129", "255", "256",
+	"32767", "-32768", "65535", "65536",
+	"2147483647", "-2147483648", "4294967295", "4294967296",
+	"9223372036854775807", "-9223372036854775808", "18446744073709551615",
+	"010", "0x10", "007", "-0", "123", "321",
+	"192.0.2.1", "2001:db8::1", "00:11:22:33:44:55",
+	"yes", "abc", "", " 5",
+};
+
+static int cast_sample(fr_value_box_t *out, fr_type_t type, char const *str)
+{
+	if (fr_value_box_from_str(NULL, out, type, NULL, str, strlen(str), NULL, false) < 0) {
+		fr_strerror_clear();
+		return -1;
+	}
+
+	/*
+	 *	Some parsers accept input (e.g. "" for addresses)
+	 *	without producing a value.
+	 */
+	if (out->type != type) {
+		fr_value_box_clear(out);
+		return -1;
+	}
+
+	return 0;
+}
+
+static bool cast_pair_valid(fr_type_t dst_type, fr_type_t src_type)
+{
+	if (!fr_type_is_leaf(dst_type) || !fr_type_is_leaf(src_type)) return false;
+
+	return (dst_type == src_type) || fr_type_cast(dst_type, src_type);
+}
+
+/** Return a test attribute of the given type, which has no enumeration values
+ *
+ * Values taken from pairs always have enumv set, so the direct functions
+ * must be used for them too.
+ */
+static fr_dict_attr_t const *cast_enumv(fr_type_t type)
+{
+	switch (type) {
+	case FR_TYPE_STRING:		return fr_dict_attr_test_string;
+	case FR_TYPE_OCTETS:		return fr_dict_attr_test_octets;
+	case FR_TYPE_IPV4_ADDR:		return fr_dict_attr_test_ipv4_addr;
+	case FR_TYPE_IPV4_PREFIX:	return fr_dict_attr_test_ipv4_prefix;
+	case FR_TYPE_IPV6_ADDR:		return fr_dict_attr_test_ipv6_addr;
+	case FR_TYPE_IPV6_PREFIX:	return fr_dict_attr_test_ipv6_prefix;
+	case FR_TYPE_ETHERNET:		return fr_dict_attr_test_ethernet;
+	case FR_TYPE_BOOL:		return fr_dict_attr_test_bool;
+	case FR_TYPE_UINT8:		return fr_dict_attr_test_uint8;
+	case FR_TYPE_UINT16:		return fr_dict_attr_test_uint16;
+	case FR_TYPE_UINT32:		return fr_dict_attr_test_uint32;
+	case FR_TYPE_UINT64:		return fr_dict_attr_test_uint64;
+	case FR_TYPE_INT8:		return fr_dict_attr_test_int8;
+	case FR_TYPE_INT16:		return fr_dict_attr_test_int16;
+	case FR_TYPE_INT32:		return fr_dict_attr_test_int32;
+	case FR_TYPE_INT64:		return fr_dict_attr_test_int64;
+	case FR_TYPE_FLOAT32:		return fr_dict_attr_test_float32;
+	case FR_TYPE_FLOAT64:		return fr_dict_attr_test_float64;
+	case FR_TYPE_DATE:		return fr_dict_attr_test_date;
+	case FR_TYPE_TIME_DELTA:	return fr_dict_attr_test_time_delta;
+	case FR_TYPE_SIZE:		return fr_dict_attr_test_size;
+	default:			return NULL;
+	}
+}
+
+static void value_cast_test_equivalent(void)
+{
+	fr_type_t	dst_type, src_type;
+	size_t		i;
+	unsigned int	fast = 0;
+
+	for (src_type = FR_TYPE_NULL; src_type < FR_TYPE_MAX; src_type++) {
+		for (dst_type = FR_TYPE_NULL; dst_type < FR_TYPE_MAX; dst_type++) {
+			fr_value_box_cast_t	func;
+
+			if (!cast_pair_valid(dst_type, src_type)) continue;
+
+			func = fr_value_box_cast_select(dst_type, src_type);
+			TEST_CHECK(func != NULL);
+
+			/*
+			 *	Pairs without a direct function use the
+			 *	generic code, so there's nothing to compare.
+			 */
+			if ((func == fr_value_box_cast) || (func == fr_value_box_cast_generic)) continue;
+			fast++;
+
+			for (i = 0; i < NUM_ELEMENTS(cast_samples); i++) {
+				fr_dict_attr_t const	*enumvs[] = {
+								NULL,
+								cast_enumv(src_type),
+								(src_type == FR_TYPE_UINT32) ? fr_dict_attr_test_enum : NULL
+							};
+				size_t			j;
+
+				for (j = 0; j < NUM_ELEMENTS(enumvs); j++) {
+					fr_value_box_t	src, a, b;
+					int		ret_a, ret_b;
+
+					if ((j > 0) && !enumvs[j]) continue;
+					if (cast_sample(&src, src_type, cast_samples[i]) < 0) continue;
+					src.enumv = enumvs[j];
+
+					ret_a = func(NULL, &a, dst_type, NULL, &src);
+					ret_b = fr_value_box_cast_generic(NULL, &b, dst_type, NULL, &src);
+					fr_strerror_clear();
+
+					TEST_CHECK(ret_a == ret_b);
+					TEST_MSG("%s -> %s of \"%s\" (enumv %s): fast %d, generic %d",
+						 fr_type_to_str(src_type), fr_type_to_str(dst_type), cast_samples[i],
+						 enumvs[j] ? enumvs[j]->name : "none", ret_a, ret_b);
+
+					if ((ret_a == 0) && (ret_b == 0)) {
+						TEST_CHECK((a.type == dst_type) && (b.type == dst_type));
+						TEST_MSG("%s -> %s of \"%s\" (enumv %s): fast gave %s, generic gave %s",
+							 fr_type_to_str(src_type), fr_type_to_str(dst_type), cast_samples[i],
+							 enumvs[j] ? enumvs[j]->name : "none",
+							 fr_type_to_str(a.type), fr_type_to_str(b.type));
+
+						if ((a.type == dst_type) && (b.type == dst_type)) {
+							TEST_CHECK(fr_value_box_cmp(&a, &b) == 0);
+							TEST_MSG("%s -> %s of \"%s\" (enumv %s): results differ",
+								 fr_type_to_str(src_type), fr_type_to_str(dst_type),
+								 cast_samples[i], enumvs[j] ? enumvs[j]->name : "none");
+						}
+					}
+
+					if (ret_a == 0) fr_value_box_clear(&a);
+					if (ret_b == 0) fr_value_box_clear(&b);
+					fr_value_box_clear(&src);
+				}
+			}
+		}
+	}
+
+	TEST_CHECK(fast > 0);
+	TEST_MSG_ALWAYS("\n%u type pairs have direct cast functions\n", fast);
+}
+
+static void value_cast_test_select(void)
+{
+	TEST_CASE("Same types and unknown pairs use the generic code");
+	TEST_CHECK(fr_value_box_cast_select(FR_TYPE_UINT32, FR_TYPE_UINT32) == fr_value_box_cast);
+	TEST_CHECK(fr_value_box_cast_select(FR_TYPE_IPV4_PREFIX, FR_TYPE_OCTETS) == fr_value_box_cast_generic);
+
+	TEST_CASE("Common pairs have direct functions");
+	TEST_CHECK(fr_value_box_cast_select(FR_TYPE_UINT32, FR_TYPE_STRING) != fr_value_box_cast_generic);
+	TEST_CHECK(fr_value_box_cast_select(FR_TYPE_STRING, FR_TYPE_UINT32) != fr_value_box_cast_generic);
+	TEST_CHECK(fr_value_box_cast_select(FR_TYPE_UINT64, FR_TYPE_UINT8) != fr_value_box_cast_generic);
+}
+
+static void value_cast_test_in_place(void)
+{
+	fr_value_box_t		vb;
+	fr_value_box_cast_t	func = fr_value_box_cast_select(FR_TYPE_UINT16, FR_TYPE_STRING);
+
+	TEST_CASE("In place with a direct function");
+	fr_value_box_strdup(NULL, &vb, NULL, "1234", true);
+	TEST_CHECK(fr_value_box_cast_in_place_with(NULL, &vb, func, FR_TYPE_UINT16, NULL) == 0);
+	TEST_CHECK(vb.type == FR_TYPE_UINT16);
+	TEST_CHECK(vb.vb_uint16 == 1234);
+	TEST_CHECK(vb.tainted);
+
+	TEST_CASE("Out of range values fall back, and fail the same way");
+	fr_value_box_strdup(NULL, &vb, NULL, "65536", false);
+	TEST_CHECK(fr_value_box_cast_in_place_with(NULL, &vb, func, FR_TYPE_UINT16, NULL) < 0);
+	TEST_CHECK(vb.type == FR_TYPE_STRING);
+	fr_value_box_clear(&vb);
+
+	TEST_CASE("Octal is handled by the generic code");
+	fr_value_box_strdup(NULL, &vb, NULL, "010", false);
+	TEST_CHECK(fr_value_box_cast_in_place_with(NULL, &vb, func, FR_TYPE_UINT16, NULL) == 0);
+	TEST_CHECK(vb.vb_uint16 == 8);
+}
+
+static void value_cast_test_enumv(void)
+{
+	fr_value_box_t		src, dst;
+	fr_value_box_cast_t	func = fr_value_box_cast_select(FR_TYPE_STRING, FR_TYPE_UINT32);
+
+	TEST_CASE("Attributes without enumeration values print the number");
+	fr_value_box_init(&src, FR_TYPE_UINT32, fr_dict_attr_test_uint32, false);
+	src.vb_uint32 = 123;
+	TEST_CHECK(func(NULL, &dst, FR_TYPE_STRING, NULL, &src) == 0);
+	TEST_CHECK(strcmp(dst.vb_strvalue, "123") == 0);
+	TEST_MSG("Expected \"123\", got \"%s\"", dst.vb_strvalue);
+	fr_value_box_clear(&dst);
+
+	TEST_CASE("Attributes with enumeration values print the name");
+	fr_value_box_init(&src, FR_TYPE_UINT32, fr_dict_attr_test_enum, false);
+	src.vb_uint32 = 123;
+	TEST_CHECK(func(NULL, &dst, FR_TYPE_STRING, NULL, &src) == 0);
+	TEST_CHECK(strcmp(dst.vb_strvalue, "test123") == 0);
+	TEST_MSG("Expected \"test123\", got \"%s\"", dst.vb_strvalue);
+	fr_value_box_clear(&dst);
+
+	TEST_CASE("Values with no name print the number");
+	src.vb_uint32 = 5;
+	TEST_CHECK(func(NULL, &dst, FR_TYPE_STRING, NULL, &src) == 0);
+	TEST_CHECK(strcmp(dst.vb_strvalue, "5") == 0);
+	TEST_MSG("Expected \"5\", got \"%s\"", dst.vb_strvalue);
+	fr_value_box_clear(&dst);
+
+	TEST_CASE("Addresses without enumeration values");
+	TEST_CHECK(fr_value_box_from_str(NULL, &src, FR_TYPE_IPV4_ADDR, fr_dict_attr_test_ipv4_addr,
+					 "192.0.2.1", strlen("192.0.2.1"), NULL, false) > 0);
+	func = fr_value_box_cast_select(FR_TYPE_STRING, FR_TYPE_IPV4_ADDR);
+	TEST_CHECK(func(NULL, &dst, FR_TYPE_STRING, NULL, &src) == 0);
+	TEST_CHECK(strcmp(dst.vb_strvalue, "192.0.2.1") == 0);
+	TEST_MSG("Expected \"192.0.2.1\", got \"%s\"", dst.vb_strvalue);
+	fr_value_box_clear(&dst);
+}
+
+TEST_LIST = {
+	{ "value_cast_test_select",	value_cast_test_select },
+	{ "value_cast_test_equivalent",	value_cast_test_equivalent },
+	{ "value_cast_test_in_place",	value_cast_test_in_place },
+	{ "value_cast_test_enumv",	value_cast_test_enumv },
+
+	{ NULL }
+};
@@ -55,6 +55,12 @@ static CONF_PARSER const proto_load_config[] = {
 
 	{ FR_CONF_OFFSET("priority", FR_TYPE_UINT32, proto_load_t, priority) },
 
+	/*
+	 *	Spread the load across this many generators, each of
+	 *	which may run in a different network thread.
+	 */
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, proto_load_t, threads), .dflt = "1" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -229,15 +235,23 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 static int mod_open(void *instance, fr_schedule_t *sc, UNUSED CONF_SECTION *conf)
 {
 	proto_load_t 	*inst = talloc_get_type_abort(instance, proto_load_t);
+	uint32_t	i;
 
 	inst->io.app = &proto_load;
 	inst->io.app_instance = instance;
 
 	/*
+	 *	Open one listener per generator.  The scheduler
+	 *	spreads them across the network threads.
+	 *
 	 *	io.app_io should already be set
 	 */
-	return fr_master_io_listen(inst, &inst->io, sc,
-				   inst->max_packet_size, inst->num_messages);
+	for (i = 0; i < inst->threads; i++) {
+		if (fr_master_io_listen(inst, &inst->io, sc,
+					inst->max_packet_size, inst->num_messages) < 0) return -1;
+	}
+
+	return 0;
 }
 
 
@@ -269,6 +283,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 1024);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
 
+	FR_INTEGER_BOUND_CHECK("threads", inst->threads, >=, 1);
+	FR_INTEGER_BOUND_CHECK("threads", inst->threads, <=, 64);
+
 	/*
 	 *	Instantiate the master io submodule
 	 */
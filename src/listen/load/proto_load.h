@@ -47,6 +47,7 @@ typedef struct {
 	uint32_t			max_packet_size;		//!< for message ring buffer
 	uint32_t			num_messages;			//!< for message ring buffer
 	uint32_t			priority;			//!< for packet processing, larger == higher
+	uint32_t			threads;			//!< how many load generators to run
 } proto_load_t;
 
 #include <pthread.h>
@@ -37,6 +37,29 @@ extern fr_app_io_t proto_load_step;
 
 typedef struct proto_load_step_s proto_load_step_t;
 
+/** State shared by all of the generators for one listener
+ *
+ *  Each generator sends its share of the packets.  At the end of each
+ *  step, the generators add their statistics here.  The last one to
+ *  report decides the rate for the next step, and writes the report.
+ */
+typedef struct {
+	pthread_mutex_t			mutex;			//!< protects everything below
+
+	unsigned int			generators;		//!< how many generators have been opened
+	unsigned int			reported;		//!< how many generators reported the current step
+
+	unsigned int			decided;		//!< last step we have decided the next rate for
+	uint32_t			next_pps;		//!< the next rate, over all generators.  0 for "stop"
+
+	fr_load_step_t			step;			//!< the current step, summed over all generators
+	fr_load_search_t		search;			//!< state for finding the maximum rate
+
+	fr_time_t			start;			//!< when the first step started
+	int				fd;			//!< for the step report
+	bool				header;			//!< whether we've written the CSV header
+} proto_load_step_shared_t;
+
 typedef struct {
 	fr_event_list_t			*el;			//!< event list
 	fr_network_t			*nr;			//!< network handler
@@ -48,6 +71,8 @@ typedef struct {
 	fr_time_t			recv_time;		//!< recv time of the last packet
 
 	proto_load_step_t const      	*inst;
+	unsigned int			index;			//!< which generator we are
+	unsigned int			reported;		//!< last step we reported to the shared state
 	fr_load_t			*l;			//!< load generation handler
 	fr_load_config_t		load;			//!< load configuration
 	fr_stats_t			stats;			//!< statistics for this socket
@@ -74,6 +99,12 @@ struct proto_load_step_s {
 	fr_load_config_t		load;			//!< load configuration
 	bool				repeat;			//!, do we repeat the load generation
 	char const     			*csv;			//!< where to write CSV stats
+
+	char const			*report;		//!< where to write per-step results
+	char const			*report_format;		//!< "json" or "csv"
+	bool				report_csv;		//!< whether the report is CSV
+
+	proto_load_step_shared_t	*shared;		//!< between all of the generators
 };
 
 
@@ -91,6 +122,13 @@ static const CONF_PARSER load_listen_config[] = {
 	{ FR_CONF_OFFSET("parallel", FR_TYPE_UINT32, proto_load_step_t, load.parallel) },
 	{ FR_CONF_OFFSET("repeat", FR_TYPE_BOOL, proto_load_step_t, repeat) },
 
+	{ FR_CONF_OFFSET("latency_slo", FR_TYPE_TIME_DELTA, proto_load_step_t, load.latency_slo) },
+	{ FR_CONF_OFFSET("percentile", FR_TYPE_FLOAT64, proto_load_step_t, load.percentile), .dflt = "99" },
+	{ FR_CONF_OFFSET("resolution", FR_TYPE_UINT32, proto_load_step_t, load.resolution) },
+
+	{ FR_CONF_OFFSET("report", FR_TYPE_STRING, proto_load_step_t, report) },
+	{ FR_CONF_OFFSET("report_format", FR_TYPE_STRING, proto_load_step_t, report_format), .dflt = "json" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -177,6 +215,19 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t req
 		if (!thread->inst->repeat) {
 			thread->done = true;
 		} else {
+			proto_load_step_shared_t *shared = thread->inst->shared;
+
+			/*
+			 *	"repeat" is only allowed with one
+			 *	generator, so we can reset the shared
+			 *	state without worrying about the others.
+			 */
+			pthread_mutex_lock(&shared->mutex);
+			shared->decided = 0;
+			shared->reported = 0;
+			thread->reported = 0;
+			pthread_mutex_unlock(&shared->mutex);
+
 			(void) fr_load_generator_stop(thread->l); /* ensure l->ev is gone */
 			(void) fr_load_generator_start(thread->l);
 		}
@@ -202,13 +253,29 @@ static int mod_open(fr_listen_t *li)
 	 */
 	li->fd = open(inst->filename, O_RDONLY);
 
+	/*
+	 *	Listeners are opened one at a time by the main
+	 *	thread, so we don't need to lock the shared state.
+	 */
+	thread->index = inst->shared->generators++;
+
+	/*
+	 *	Each generator needs a unique "address", otherwise
+	 *	the listeners conflict with each other.
+	 */
 	memset(&ipaddr, 0, sizeof(ipaddr));
 	ipaddr.af = AF_INET;
-	li->app_io_addr = fr_socket_addr_alloc_inet_src(li, IPPROTO_UDP, 0, &ipaddr, 0);
+	li->app_io_addr = fr_socket_addr_alloc_inet_src(li, IPPROTO_UDP, 0, &ipaddr, thread->index);
 
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
-	thread->name = talloc_typed_asprintf(thread, "load_step from filename %s", inst->filename ? inst->filename : "none");
+	if (inst->parent->threads > 1) {
+		thread->name = talloc_typed_asprintf(thread, "load_step %u from filename %s", thread->index,
+						     inst->filename ? inst->filename : "none");
+	} else {
+		thread->name = talloc_typed_asprintf(thread, "load_step from filename %s",
+						     inst->filename ? inst->filename : "none");
+	}
 	thread->parent = talloc_parent(li);
 
 	return 0;
@@ -249,6 +316,237 @@ static void write_stats(fr_event_list_t *el, fr_time_t now, void *uctx)
 }
 
 
+/** Split a rate between the generators
+ *
+ */
+static uint32_t load_share(uint32_t pps, unsigned int generators, unsigned int index)
+{
+	uint32_t share;
+
+	if (!pps) return 0;
+
+	share = pps / generators;
+	if (index < (pps % generators)) share++;
+
+	/*
+	 *	Every generator has to send something, otherwise it
+	 *	would stop.
+	 */
+	if (!share) share = 1;
+
+	return share;
+}
+
+static double load_usec(uint64_t nsec)
+{
+	return nsec / 1000.0;
+}
+
+/** Write the results of one step to the report file
+ *
+ *  Called with the shared mutex held.
+ */
+static void step_report(proto_load_step_t const *inst, fr_load_step_t const *step, bool ok)
+{
+	proto_load_step_shared_t	*shared = inst->shared;
+	fr_histogram_t const		*hist = step->hist;
+	fr_histogram_iter_t		iter;
+	uint64_t			value, count;
+	double				duration;
+	char				*out;
+	bool				first = true;
+
+	if (shared->fd < 0) return;
+
+	duration = fr_time_delta_unwrap(fr_time_sub(step->end, step->start)) / (double)NSEC;
+	if (duration <= 0) duration = 1;
+
+	if (inst->report_csv) {
+		if (!shared->header) {
+			shared->header = true;
+			out = talloc_typed_strdup(NULL, "\"step\",\"time\",\"pps\",\"sent\",\"received\",\"skipped\","
+						  "\"throughput\",\"min_us\",\"mean_us\",\"p50_us\",\"p90_us\","
+						  "\"p99_us\",\"p99.9_us\",\"max_us\",\"ok\",\"histogram\"\n");
+		} else {
+			out = talloc_typed_strdup(NULL, "");
+		}
+		out = talloc_asprintf_append_buffer(out, "%u,%f,%u,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f,"
+						    "%f,%f,%f,%f,%f,%f,%f,%d,\"",
+						    step->number,
+						    fr_time_delta_unwrap(fr_time_sub(step->start, shared->start)) / (double)NSEC,
+						    step->pps, step->sent, step->received, step->skipped,
+						    step->received / duration,
+						    load_usec(fr_histogram_min(hist)), fr_histogram_mean(hist) / 1000.0,
+						    load_usec(fr_histogram_percentile(hist, 50)),
+						    load_usec(fr_histogram_percentile(hist, 90)),
+						    load_usec(fr_histogram_percentile(hist, 99)),
+						    load_usec(fr_histogram_percentile(hist, 99.9)),
+						    load_usec(fr_histogram_max(hist)), ok);
+
+		/*
+		 *	The histogram is a space separated list of
+		 *	"usec:count", where "usec" is the upper bound
+		 *	of each bucket.
+		 */
+		fr_histogram_iter_init(&iter, hist);
+		while (fr_histogram_iter_next(&iter, &value, &count)) {
+			out = talloc_asprintf_append_buffer(out, "%s%.3f:%" PRIu64, first ? "" : " ",
+							    load_usec(value), count);
+			first = false;
+		}
+		out = talloc_strdup_append_buffer(out, "\"\n");
+
+	} else {
+		out = talloc_typed_asprintf(NULL, "{\"step\":%u,\"time\":%f,\"pps\":%u,\"sent\":%" PRIu64 ","
+					    "\"received\":%" PRIu64 ",\"skipped\":%" PRIu64 ",\"throughput\":%f,"
+					    "\"min_us\":%f,\"mean_us\":%f,\"p50_us\":%f,\"p90_us\":%f,"
+					    "\"p99_us\":%f,\"p999_us\":%f,\"max_us\":%f,\"ok\":%s,\"histogram\":[",
+					    step->number,
+					    fr_time_delta_unwrap(fr_time_sub(step->start, shared->start)) / (double)NSEC,
+					    step->pps, step->sent, step->received, step->skipped,
+					    step->received / duration,
+					    load_usec(fr_histogram_min(hist)), fr_histogram_mean(hist) / 1000.0,
+					    load_usec(fr_histogram_percentile(hist, 50)),
+					    load_usec(fr_histogram_percentile(hist, 90)),
+					    load_usec(fr_histogram_percentile(hist, 99)),
+					    load_usec(fr_histogram_percentile(hist, 99.9)),
+					    load_usec(fr_histogram_max(hist)), ok ? "true" : "false");
+
+		fr_histogram_iter_init(&iter, hist);
+		while (fr_histogram_iter_next(&iter, &value, &count)) {
+			out = talloc_asprintf_append_buffer(out, "%s[%.3f,%" PRIu64 "]", first ? "" : ",",
+							    load_usec(value), count);
+			first = false;
+		}
+		out = talloc_strdup_append_buffer(out, "]}\n");
+	}
+
+	if (write(shared->fd, out, talloc_array_length(out) - 1) < 0) {
+		ERROR("Failed writing to %s - %s", inst->report, fr_syserror(errno));
+	}
+	talloc_free(out);
+}
+
+/** Report the result of the search for the maximum rate
+ *
+ *  Called with the shared mutex held.
+ */
+static void search_report(proto_load_step_t const *inst)
+{
+	proto_load_step_shared_t	*shared = inst->shared;
+	char				buffer[256];
+	size_t				len;
+
+	if (!shared->search.good) {
+		INFO("proto_load_step - No rate met the p%g latency SLO of %.3fms",
+		     inst->load.percentile, fr_time_delta_unwrap(inst->load.latency_slo) / 1000000.0);
+	} else {
+		INFO("proto_load_step - Maximum rate meeting the p%g latency SLO of %.3fms is %u packets/s (p%g %.3fms)",
+		     inst->load.percentile, fr_time_delta_unwrap(inst->load.latency_slo) / 1000000.0,
+		     shared->search.good, inst->load.percentile, shared->search.good_latency / 1000000.0);
+	}
+
+	if ((shared->fd < 0) || inst->report_csv) return;
+
+	len = snprintf(buffer, sizeof(buffer), "{\"result\":{\"max_pps\":%u,\"percentile\":%g,"
+		       "\"latency_slo_us\":%f,\"latency_us\":%f}}\n",
+		       shared->search.good, inst->load.percentile,
+		       load_usec(fr_time_delta_unwrap(inst->load.latency_slo)),
+		       load_usec(shared->search.good_latency));
+	if (write(shared->fd, buffer, len) < 0) {
+		ERROR("Failed writing to %s - %s", inst->report, fr_syserror(errno));
+	}
+}
+
+/** Decide the rate for the next step
+ *
+ *  Called with the shared mutex held, once all of the generators
+ *  have reported the current step.
+ */
+static void step_decide(proto_load_step_t const *inst)
+{
+	proto_load_step_shared_t	*shared = inst->shared;
+	fr_load_step_t			*step = &shared->step;
+	bool				ok = fr_load_step_ok(&inst->load, step);
+	uint32_t			next;
+
+	if (fr_time_delta_ispos(inst->load.latency_slo)) {
+		next = fr_load_search_next(&shared->search, &inst->load, step);
+
+		DEBUG("proto_load_step - step %u at %u packets/s %s the p%g latency SLO (%.3fms)",
+		      step->number, step->pps, ok ? "met" : "failed", inst->load.percentile,
+		      fr_histogram_percentile(step->hist, inst->load.percentile) / 1000000.0);
+	} else {
+		next = step->pps + inst->load.step;
+		if (inst->load.max_pps && (next > inst->load.max_pps)) next = 0;
+	}
+
+	step_report(inst, step, ok);
+
+	if (!next && fr_time_delta_ispos(inst->load.latency_slo)) search_report(inst);
+
+	shared->decided = step->number;
+	shared->next_pps = next;
+
+	/*
+	 *	Get ready for the next step.
+	 */
+	shared->reported = 0;
+	step->pps = 0;
+	step->sent = step->received = step->skipped = 0;
+	fr_histogram_reset(step->hist);
+}
+
+/** Called by the load generator at the end of each step
+ *
+ */
+static int mod_step(fr_load_step_t const *step, uint32_t *pps, void *uctx)
+{
+	fr_listen_t			*li = uctx;
+	proto_load_step_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_step_thread_t);
+	proto_load_step_t const		*inst = thread->inst;
+	proto_load_step_shared_t	*shared = inst->shared;
+	int				rcode = 0;
+
+	pthread_mutex_lock(&shared->mutex);
+
+	/*
+	 *	Add our statistics to the shared ones, but only once
+	 *	per step.
+	 */
+	if (thread->reported < step->number) {
+		thread->reported = step->number;
+
+		if (!shared->reported) {
+			shared->step.number = step->number;
+			shared->step.start = step->start;
+			shared->step.end = step->end;
+			if (step->number == 1) shared->start = step->start;
+		}
+
+		shared->step.pps += step->pps;
+		shared->step.sent += step->sent;
+		shared->step.received += step->received;
+		shared->step.skipped += step->skipped;
+		if (fr_time_gt(step->end, shared->step.end)) shared->step.end = step->end;
+		(void) fr_histogram_merge(shared->step.hist, step->hist);
+
+		if (++shared->reported == inst->parent->threads) step_decide(inst);
+	}
+
+	/*
+	 *	Wait for the other generators to finish this step.
+	 */
+	if (shared->decided >= step->number) {
+		*pps = load_share(shared->next_pps, inst->parent->threads, thread->index);
+		rcode = 1;
+	}
+
+	pthread_mutex_unlock(&shared->mutex);
+
+	return rcode;
+}
+
 /** Decode the packet
  *
  */
@@ -309,21 +607,40 @@ static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
 	size_t len;
 	char buffer[256];
 
+	char const			*csv;
+
 	thread->el = el;
 	thread->nr = nr;
 	thread->inst = inst;
 	thread->load = inst->load;
 
+	/*
+	 *	We only send our share of the packets.  The shared
+	 *	state decides the rate for each step.
+	 */
+	thread->load.start_pps = load_share(inst->load.start_pps, inst->parent->threads, thread->index);
+
 	thread->l = fr_load_generator_create(thread, el, &thread->load, mod_generate, li);
 	if (!thread->l) return;
 
+	fr_load_generator_step_callback_set(thread->l, mod_step);
+
 	(void) fr_load_generator_start(thread->l);
 
 	if (!inst->csv) return;
 
-	thread->fd = open(inst->csv, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	/*
+	 *	Each generator writes its own statistics.
+	 */
+	if (inst->parent->threads > 1) {
+		csv = talloc_typed_asprintf(thread, "%s.%u", inst->csv, thread->index);
+	} else {
+		csv = inst->csv;
+	}
+
+	thread->fd = open(csv, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
 	if (thread->fd < 0) {
-		ERROR("Failed opening %s - %s", inst->csv, fr_syserror(errno));
+		ERROR("Failed opening %s - %s", csv, fr_syserror(errno));
 		return;
 	}
 
@@ -360,14 +677,18 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	inst->parent = talloc_get_type_abort(dl_inst->parent->data, proto_load_t);
 	inst->cs = conf;
 
+	/*
+	 *	Higher rates are possible by spreading the load
+	 *	across multiple generators.  See "threads".
+	 */
 	FR_INTEGER_BOUND_CHECK("start_pps", inst->load.start_pps, >=, 10);
-	FR_INTEGER_BOUND_CHECK("start_pps", inst->load.start_pps, <, 400000);
+	FR_INTEGER_BOUND_CHECK("start_pps", inst->load.start_pps, <, 10000000);
 
 	FR_INTEGER_BOUND_CHECK("step", inst->load.step, >=, 1);
-	FR_INTEGER_BOUND_CHECK("step", inst->load.step, <, 100000);
+	FR_INTEGER_BOUND_CHECK("step", inst->load.step, <, 10000000);
 
 	if (inst->load.max_pps > 0) FR_INTEGER_BOUND_CHECK("max_pps", inst->load.max_pps, >, inst->load.start_pps);
-	FR_INTEGER_BOUND_CHECK("max_pps", inst->load.max_pps, <, 100000);
+	FR_INTEGER_BOUND_CHECK("max_pps", inst->load.max_pps, <=, 10000000);
 
 	FR_TIME_DELTA_BOUND_CHECK("duration", inst->load.duration, >=, fr_time_delta_from_sec(1));
 	FR_TIME_DELTA_BOUND_CHECK("duration", inst->load.duration, <, fr_time_delta_from_sec(10000));
@@ -379,6 +700,38 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, >=, 1);
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, <, 100000);
 
+	if (fr_time_delta_ispos(inst->load.latency_slo)) {
+		if ((inst->load.percentile < 50) || (inst->load.percentile >= 100)) {
+			cf_log_err(conf, "Invalid value for 'percentile', it must be between 50 and 100");
+			return -1;
+		}
+
+		/*
+		 *	By default, find the maximum rate to
+		 *	within a tenth of a step.
+		 */
+		if (!inst->load.resolution) inst->load.resolution = inst->load.step / 10;
+		if (!inst->load.resolution) inst->load.resolution = 1;
+
+		if (inst->repeat) {
+			cf_log_err(conf, "Cannot use 'repeat' with 'latency_slo'");
+			return -1;
+		}
+	}
+
+	if (inst->repeat && (inst->parent->threads > 1)) {
+		cf_log_err(conf, "Cannot use 'repeat' with more than one thread");
+		return -1;
+	}
+
+	if (strcmp(inst->report_format, "csv") == 0) {
+		inst->report_csv = true;
+
+	} else if (strcmp(inst->report_format, "json") != 0) {
+		cf_log_err(conf, "Invalid value for 'report_format', it must be 'json' or 'csv'");
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -390,6 +743,14 @@ static RADCLIENT *mod_client_find(fr_listen_t *li, UNUSED fr_ipaddr_t const *ipa
 }
 
 
+static int _load_step_shared_free(proto_load_step_shared_t *shared)
+{
+	if (shared->fd >= 0) close(shared->fd);
+	pthread_mutex_destroy(&shared->mutex);
+
+	return 0;
+}
+
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	proto_load_step_t	*inst = talloc_get_type_abort(mctx->inst->data, proto_load_step_t);
@@ -397,6 +758,25 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	RADCLIENT		*client;
 	fr_pair_t		*vp;
 
+	MEM(inst->shared = talloc_zero(inst, proto_load_step_shared_t));
+	pthread_mutex_init(&inst->shared->mutex, NULL);
+	talloc_set_destructor(inst->shared, _load_step_shared_free);
+
+	inst->shared->fd = -1;
+	inst->shared->step.hist = fr_histogram_alloc(inst->shared, 1000, (uint64_t) 60 * NSEC, 3);
+	if (!inst->shared->step.hist) {
+		cf_log_perr(conf, "Failed allocating histogram");
+		return -1;
+	}
+
+	if (inst->report) {
+		inst->shared->fd = open(inst->report, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (inst->shared->fd < 0) {
+			cf_log_err(conf, "Failed opening %s - %s", inst->report, fr_syserror(errno));
+			return -1;
+		}
+	}
+
 	fr_pair_list_init(&inst->pair_list);
 	inst->client = client = talloc_zero(inst, RADCLIENT);
 	if (!inst->client) return 0;
@@ -447,6 +827,7 @@ fr_app_io_t proto_load_step = {
 	},
 	.default_message_size	= 4096,
 	.track_duplicates	= false,
+	.any_network		= true,
 
 	.open			= mod_open,
 	.read			= mod_read,
@@ -36,6 +36,12 @@ extern fr_app_t proto_tacacs;
 static int type_parse(TALLOC_CTX *ctx, void *out, void *parent, CONF_ITEM *ci, UNUSED CONF_PARSER const *rule);
 static int transport_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 
+static CONF_PARSER const limit_config[] = {
+	{ FR_CONF_OFFSET("max_outstanding", FR_TYPE_UINT32, proto_tacacs_t, io.max_outstanding), .dflt = "64" } ,
+
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER priority_config[] = {
 	{ FR_CONF_OFFSET("Authentication-Start", FR_TYPE_VOID, proto_tacacs_t, priorities[FR_TAC_PLUS_AUTHEN]),
 	  .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = channel_packet_priority, .len = &channel_packet_priority_len }, .dflt = "high" },
@@ -54,6 +60,8 @@ static const CONF_PARSER proto_tacacs_config[] = {
 	  .func = type_parse },
 	{ FR_CONF_OFFSET("transport", FR_TYPE_VOID, proto_tacacs_t, io.submodule),
 	  .func = transport_parse },
+	{ FR_CONF_POINTER("limit", FR_TYPE_SUBSECTION, NULL),
+	  .subcs = (void const *) limit_config },
 	{ FR_CONF_POINTER("priority", FR_TYPE_SUBSECTION, NULL),
 	  .subcs = (void const *) priority_config },
 
@@ -525,6 +533,11 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	FR_TIME_DELTA_BOUND_CHECK("nak_lifetime", inst->io.nak_lifetime, >=, fr_time_delta_from_sec(1));
 	FR_TIME_DELTA_BOUND_CHECK("nak_lifetime", inst->io.nak_lifetime, <=, fr_time_delta_from_sec(600));
 
+	if (inst->io.max_outstanding) {
+		FR_INTEGER_BOUND_CHECK("max_outstanding", inst->io.max_outstanding, >=, 4);
+		FR_INTEGER_BOUND_CHECK("max_outstanding", inst->io.max_outstanding, <=, 65536);
+	}
+
  	/*
 	 *	Tell the master handler about the main protocol instance.
 	 */
@@ -1,7 +1,3 @@
-TARGETNAME	:= proto_bfd
-
-ifneq "$(TARGETNAME)" ""
-TARGET		:= $(TARGETNAME)$(L)
-endif
-
-SOURCES		:= proto_bfd.c
+SUBMAKEFILES := \
+	proto_bfd.mk \
+	proto_bfd_tests.mk
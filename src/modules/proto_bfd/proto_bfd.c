@@ -20,6 +20,7 @@
  * @copyright 2012 Network RADIUS SARL (legal@networkradius.com)
  */
 
+#include <freeradius-devel/missing.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/server/protocol.h>
@@ -29,13 +30,28 @@
 
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/base16.h>
+#include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/rand.h>
 #include <freeradius-devel/util/sha1.h>
 #include <freeradius-devel/util/socket.h>
 #include <freeradius-devel/util/time.h>
+#include <freeradius-devel/util/timer_wheel.h>
+
+#include <sys/socket.h>
+#include <poll.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
 
 #define BFD_MAX_SECRET_LENGTH 20
+#define BFD_MAX_THREADS		64
+#define BFD_TX_BATCH		64	//!< Maximum number of packets sent with one call to sendmmsg().
+#define BFD_TIMER_RESOLUTION	1	//!< Tick length of the session timing wheel (ms).
+#define BFD_TIMER_SLOTS		4096	//!< Slots in the session timing wheel.
 
 typedef enum bfd_session_state_t {
 	BFD_STATE_ADMIN_DOWN = 0,
@@ -67,21 +83,20 @@ typedef enum bfd_auth_type_t {
 
 #define BFD_AUTH_INVALID (BFD_AUTH_MET_KEYED_SHA1 + 1)
 
+typedef struct bfd_thread_s bfd_thread_t;
+
 typedef struct {
 	fr_rb_node_t	node;		//!< Entry in the tree of sessions.
+	fr_dlist_t	entry;		//!< Entry in the thread's list of sessions.
 
 	int		number;
 
 	fr_socket_t socket;
 
-	fr_event_list_t *el;
+	bfd_thread_t	*thread;	//!< Thread which runs this session's timers.
 	CONF_SECTION	*server_cs;
 	CONF_SECTION	*unlang;
 
-	bool		blocked;
-	int		pipefd[2];
-	pthread_t	pthread_id;
-
 	bfd_auth_type_t auth_type;
 	uint8_t		secret[BFD_MAX_SECRET_LENGTH];
 	size_t		secret_len;
@@ -92,8 +107,8 @@ typedef struct {
 	struct sockaddr_storage remote_sockaddr;
 	socklen_t	salen;
 
-	fr_event_timer_t const	*ev_timeout;
-	fr_event_timer_t const	*ev_packet;
+	fr_timer_wheel_entry_t	te_timeout;	//!< Detection timer.
+	fr_timer_wheel_entry_t	te_packet;	//!< Next control packet.
 	fr_time_t	last_recv;
 	fr_time_t	next_recv;
 	fr_time_t	last_sent;
@@ -208,6 +223,66 @@ typedef struct {
 	bfd_auth_t	auth;
 } __attribute__ ((packed)) bfd_packet_t;
 
+typedef enum {
+	BFD_PIPE_PACKET = 0,			//!< Process a received packet.
+	BFD_PIPE_EXIT				//!< Stop the thread's sessions, and exit.
+} bfd_pipe_op_t;
+
+/** A message from the listener to a session's thread
+ *
+ * This is much smaller than PIPE_BUF, so writes to the pipe are atomic.
+ */
+typedef struct {
+	bfd_pipe_op_t	op;
+	bfd_state_t	*session;
+	bfd_packet_t	packet;
+} bfd_pipe_msg_t;
+
+/** Counters for a BFD thread
+ *
+ */
+typedef struct {
+	uint64_t	sent;			//!< Control packets sent.
+	uint64_t	send_calls;		//!< Calls to sendmmsg().
+	uint64_t	send_errors;		//!< Control packets which couldn't be sent.
+	uint64_t	received;		//!< Control packets processed.
+	uint64_t	timeouts;		//!< Detection timeouts.
+	uint64_t	scheduled;		//!< Control packets sent from the transmit timer.
+	uint64_t	late_total;		//!< Sum of how late the transmit timers fired (usec).
+	uint64_t	late_max;		//!< Latest a transmit timer fired (usec).
+} bfd_thread_stats_t;
+
+/** Runs the timers and transmits the packets for a subset of the sessions
+ *
+ * A session only ever belongs to one thread, so neither the session
+ * nor the thread's timing wheel need locking.
+ */
+struct bfd_thread_s {
+	int			id;			//!< Thread number, for logging.
+	int			sockfd;			//!< Socket to send control packets from.
+
+	fr_event_list_t		*el;			//!< Event list the thread runs.
+	fr_timer_wheel_t	*tw;			//!< Transmit and detection timers for the sessions.
+
+	int			pipefd[2];		//!< Packets from the listener.  -1 if the sessions
+							///< run in the main event list.
+	pthread_t		pthread_id;
+	bool			running;		//!< A separate thread has been started, and
+							///< hasn't been joined.
+
+	fr_dlist_head_t		sessions;		//!< Sessions run by this thread.
+
+	unsigned int		tx_num;			//!< Number of packets waiting to be sent.
+	bfd_packet_t		tx_packet[BFD_TX_BATCH];
+	struct iovec		tx_iov[BFD_TX_BATCH];
+	struct mmsghdr		tx_msg[BFD_TX_BATCH];
+
+	fr_event_timer_t const	*ev_stats;		//!< Periodic statistics.
+	fr_time_delta_t		stats_interval;		//!< How often to log statistics.
+	bfd_thread_stats_t	stats;
+	_Atomic(uint64_t)	dropped;		//!< Packets the listener couldn't pass to the thread.
+};
+
 
 typedef struct {
 	fr_ipaddr_t	my_ipaddr;
@@ -228,6 +303,11 @@ typedef struct {
 	uint8_t		secret[BFD_MAX_SECRET_LENGTH];
 	size_t		secret_len;
 
+	uint32_t	num_threads;
+	uint32_t	stats_interval;
+
+	bfd_thread_t	**threads;
+
 	fr_rb_tree_t	*session_tree;
 } bfd_socket_t;
 
@@ -254,128 +334,405 @@ void bfd_init(fr_event_list_t *xel)
 	event_list = xel;
 }
 
-static void bfd_pthread_free(bfd_state_t *session)
+/** Send all of the control packets a thread has queued
+ *
+ */
+static void bfd_tx_flush(bfd_thread_t *thread)
+{
+	unsigned int	i = 0;
+	int		sent;
+
+	while (i < thread->tx_num) {
+		sent = sendmmsg(thread->sockfd, &thread->tx_msg[i], thread->tx_num - i, 0);
+		thread->stats.send_calls++;
+
+		if (sent < 0) {
+			switch (errno) {
+			case EINTR:
+				continue;
+
+			/*
+			 *	No buffer space.  Trying again now won't
+			 *	help, and the peers will cope with a
+			 *	missed packet.
+			 */
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+			case EWOULDBLOCK:
+#endif
+			case EAGAIN:
+			case ENOBUFS:
+				ERROR("BFD thread %d failed sending packets: %s", thread->id, fr_syserror(errno));
+				thread->stats.send_errors += thread->tx_num - i;
+				goto done;
+
+			/*
+			 *	Only the first packet failed.
+			 */
+			default:
+				ERROR("BFD thread %d failed sending packet: %s", thread->id, fr_syserror(errno));
+				thread->stats.send_errors++;
+				i++;
+				continue;
+			}
+		}
+
+		thread->stats.sent += sent;
+		i += sent;
+	}
+
+done:
+	thread->tx_num = 0;
+}
+
+/** Send the packets queued during this pass of the event loop
+ *
+ */
+static void bfd_tx_flush_post(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
 {
-	session->blocked = true;
+	bfd_thread_t *thread = uctx;
 
-	close(session->pipefd[0]);
-	close(session->pipefd[1]);
+	if (thread->tx_num > 0) bfd_tx_flush(thread);
+}
 
-	talloc_free(session->el);
+/** Queue a signed control packet
+ *
+ * Packets are sent together at the end of the event loop pass, so
+ * sessions whose timers fire on the same tick share one system call.
+ */
+static void bfd_tx_queue(bfd_state_t *session, bfd_packet_t const *bfd)
+{
+	bfd_thread_t	*thread = session->thread;
+	unsigned int	i;
 
-	session->el = NULL;
-	session->pipefd[0] = session->pipefd[1] = -1;
+	if (thread->tx_num == BFD_TX_BATCH) bfd_tx_flush(thread);
 
-	session->blocked = false;
+	i = thread->tx_num++;
+	memcpy(&thread->tx_packet[i], bfd, bfd->length);
+	thread->tx_iov[i].iov_len = bfd->length;
+	thread->tx_msg[i].msg_hdr.msg_name = &session->remote_sockaddr;
+	thread->tx_msg[i].msg_hdr.msg_namelen = session->salen;
 }
 
 /*
- *	A child thread reads the packet from a pipe, and processes it.
+ *	Stop the timers of all of the thread's sessions, and exit the
+ *	event loop.  This runs in the thread which owns the timing
+ *	wheel, so nothing else can be using it.
  */
-static void bfd_pipe_recv(UNUSED fr_event_list_t *xel, int fd, UNUSED int flags, void *ctx)
+static void bfd_thread_exit(bfd_thread_t *thread)
 {
-	ssize_t num;
-	bfd_state_t *session = ctx;
-	bfd_packet_t bfd;
+	bfd_state_t *session = NULL;
 
-	if (session->blocked) return;
+	while ((session = fr_dlist_next(&thread->sessions, session))) bfd_stop_control(session);
 
-	/*
-	 *	Read the header
-	 */
-	num = read(fd, &bfd, 4);
-	if ((num < 4) || (bfd.length < 4)) {
-	fail:
-		ERROR("BFD Failed reading from pipe!");
-		session->blocked = true;
-		return;
+	if (thread->ev_stats) (void) fr_event_timer_delete(&thread->ev_stats);
+
+	fr_event_loop_exit(thread->el, 1);
+}
+
+/*
+ *	Write a message to a thread's pipe.
+ *
+ *	Packets are dropped if the pipe is full.  Other messages
+ *	wait until the thread has made room for them.
+ */
+static int bfd_pipe_send(bfd_thread_t *thread, bfd_pipe_msg_t const *msg)
+{
+	ssize_t rcode;
+
+	for (;;) {
+		rcode = write(thread->pipefd[1], msg, sizeof(*msg));
+		if (rcode == sizeof(*msg)) return 0;
+
+		if ((rcode < 0) && (errno == EINTR)) continue;
+
+		if ((rcode < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)) && (msg->op != BFD_PIPE_PACKET)) {
+			struct pollfd pfd = { .fd = thread->pipefd[1], .events = POLLOUT };
+
+			(void) poll(&pfd, 1, -1);
+			continue;
+		}
+
+		break;
 	}
 
 	/*
-	 *	This is already checked in the caller, but what the heck...
+	 *	If the pipe is full, the thread is overloaded.
+	 *	Dropping the packet is no worse than the network
+	 *	dropping it.
+	 *
+	 *	The listener writes the counter, and the thread reads
+	 *	it when logging statistics, so it's atomic.
 	 */
-	if (bfd.length > sizeof(bfd)) goto fail;
+	if (msg->op == BFD_PIPE_PACKET) atomic_fetch_add_explicit(&thread->dropped, 1, memory_order_relaxed);
+
+	return -1;
+}
+
+/*
+ *	A child thread reads packets from a pipe, and processes them.
+ */
+static void bfd_pipe_recv(UNUSED fr_event_list_t *xel, int fd, UNUSED int flags, void *ctx)
+{
+	bfd_thread_t	*thread = ctx;
+	bfd_pipe_msg_t	msg;
+	ssize_t		num;
 
 	/*
-	 *	Read the rest of the packet.
+	 *	Messages are written atomically, so we either get
+	 *	all of one, or nothing.
 	 */
-	num = read(fd, ((uint8_t *) &bfd) + 4, bfd.length - 4);
-	if ((num < 0) || ((num + 4) != bfd.length)) goto fail;
+	while ((num = read(fd, &msg, sizeof(msg))) == sizeof(msg)) {
+		if (msg.op == BFD_PIPE_EXIT) {
+			bfd_thread_exit(thread);
+			return;
+		}
+
+		fr_assert(msg.session->thread == thread);
 
-	bfd_process(session, &bfd);
+		bfd_process(msg.session, &msg.packet);
+	}
+
+	if ((num < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+		ERROR("BFD thread %d failed reading from pipe: %s", thread->id, fr_syserror(errno));
+	}
 }
 
 /*
- *	Do nothing more than read from the sockets and process the
+ *	Log the thread's counters, and re-arm the timer.
+ */
+static void bfd_thread_stats(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	bfd_thread_t			*thread = uctx;
+	bfd_thread_stats_t const	*stats = &thread->stats;
+	bfd_state_t			*session = NULL;
+	unsigned int			up = 0;
+
+	while ((session = fr_dlist_next(&thread->sessions, session))) {
+		if (session->session_state == BFD_STATE_UP) up++;
+	}
+
+	INFO("BFD thread %d - sessions %u (%u up), timers %u, sent %" PRIu64 " in %" PRIu64 " calls, "
+	     "send errors %" PRIu64 ", received %" PRIu64 ", dropped %" PRIu64 ", timeouts %" PRIu64 ", "
+	     "transmit timer late by avg %" PRIu64 "us max %" PRIu64 "us",
+	     thread->id, fr_dlist_num_elements(&thread->sessions), up, fr_timer_wheel_num_elements(thread->tw),
+	     stats->sent, stats->send_calls, stats->send_errors, stats->received,
+	     atomic_load_explicit(&thread->dropped, memory_order_relaxed),
+	     stats->timeouts, stats->scheduled ? stats->late_total / stats->scheduled : 0, stats->late_max);
+
+	if (fr_event_timer_at(thread, el, &thread->ev_stats, fr_time_add(now, thread->stats_interval),
+			      bfd_thread_stats, thread) < 0) {
+		PERROR("BFD thread %d failed inserting statistics timer", thread->id);
+	}
+}
+
+/*
+ *	Start the sessions which belong to a thread.
+ */
+static void bfd_thread_start(bfd_thread_t *thread)
+{
+	bfd_state_t *session = NULL;
+
+	while ((session = fr_dlist_next(&thread->sessions, session))) bfd_start_control(session);
+
+	if (fr_time_delta_ispos(thread->stats_interval) &&
+	    (fr_event_timer_in(thread, thread->el, &thread->ev_stats, thread->stats_interval,
+			       bfd_thread_stats, thread) < 0)) {
+		PERROR("BFD thread %d failed inserting statistics timer", thread->id);
+	}
+}
+
+/*
+ *	Do nothing more than read from the pipe and process the
  *	timers.
  */
 static void *bfd_child_thread(void *ctx)
 {
-	bfd_state_t *session = ctx;
+	bfd_thread_t *thread = ctx;
 
-	DEBUG("BFD %d starting child thread", session->number);
-	bfd_start_control(session);
+	DEBUG("BFD thread %d starting with %u sessions", thread->id, fr_dlist_num_elements(&thread->sessions));
+	bfd_thread_start(thread);
 
-	fr_event_loop(session->el);
-
-	bfd_pthread_free(session);
+	fr_event_loop(thread->el);
 
 	return NULL;
 }
 
-
-static int bfd_pthread_create(bfd_state_t *session)
+/*
+ *	Allocate a thread, and everything it needs to run its
+ *	sessions.  The thread isn't started until the sessions
+ *	have been created.
+ */
+static bfd_thread_t *bfd_thread_alloc(bfd_socket_t *sock, int id, int sockfd)
 {
-	pthread_attr_t attr;
+	bfd_thread_t	*thread;
+	unsigned int	i;
 
-	if (pipe(session->pipefd) < 0) {
-		ERROR("Failed opening pipe: %s", fr_syserror(errno));
-		return 0;
-	}
+	thread = talloc_zero(sock->threads, bfd_thread_t);
+	if (!thread) return NULL;
 
-	session->el = fr_event_list_alloc(session, NULL, NULL);
-	if (!session->el) {
-		ERROR("Failed creating event list");
-	close_pipes:
-		close(session->pipefd[0]);
-		close(session->pipefd[1]);
-		session->pipefd[0] = session->pipefd[1] = -1;
-		return 0;
+	thread->id = id;
+	thread->sockfd = sockfd;
+	thread->pipefd[0] = thread->pipefd[1] = -1;
+	thread->stats_interval = fr_time_delta_from_sec(sock->stats_interval);
+	fr_dlist_talloc_init(&thread->sessions, bfd_state_t, entry);
+
+	for (i = 0; i < BFD_TX_BATCH; i++) {
+		thread->tx_iov[i].iov_base = &thread->tx_packet[i];
+		thread->tx_msg[i].msg_hdr.msg_iov = &thread->tx_iov[i];
+		thread->tx_msg[i].msg_hdr.msg_iovlen = 1;
 	}
 
+	if (event_list) {
+		thread->el = event_list;
+		thread->pthread_id = pthread_self();
+	} else {
+		if (pipe(thread->pipefd) < 0) {
+			ERROR("Failed opening pipe: %s", fr_syserror(errno));
+			goto error;
+		}
+
 #ifdef O_NONBLOCK
-	fcntl(session->pipefd[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
-	fcntl(session->pipefd[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+		fcntl(thread->pipefd[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+		fcntl(thread->pipefd[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
 #endif
 
-	if (fr_event_fd_insert(session, session->el, session->pipefd[0],
-			       bfd_pipe_recv,
-			       NULL,
-			       NULL,
-			       session) < 0) {
-		PERROR("Failed inserting file descriptor into event list");
-		goto close_pipes;
+		thread->el = fr_event_list_alloc(thread, NULL, NULL);
+		if (!thread->el) {
+			ERROR("Failed creating event list");
+			goto error;
+		}
+
+		if (fr_event_fd_insert(thread, thread->el, thread->pipefd[0],
+				       bfd_pipe_recv,
+				       NULL,
+				       NULL,
+				       thread) < 0) {
+			PERROR("Failed inserting file descriptor into event list");
+			goto error;
+		}
+	}
+
+	thread->tw = fr_timer_wheel_alloc(thread, thread->el, fr_time_delta_from_msec(BFD_TIMER_RESOLUTION),
+					  BFD_TIMER_SLOTS);
+	if (!thread->tw) {
+		PERROR("Failed creating timing wheel");
+		goto error;
+	}
+
+	if (fr_event_post_insert(thread->el, bfd_tx_flush_post, thread) < 0) {
+		PERROR("Failed inserting post-processing callback");
+		goto error;
+	}
+
+	return thread;
+
+error:
+	if (thread->pipefd[0] >= 0) close(thread->pipefd[0]);
+	if (thread->pipefd[1] >= 0) close(thread->pipefd[1]);
+	talloc_free(thread);
+	return NULL;
+}
+
+/*
+ *	Start the threads, or, if there's a shared event list, just
+ *	the sessions.
+ */
+static int bfd_threads_start(bfd_socket_t *sock)
+{
+	uint32_t i;
+
+	for (i = 0; i < sock->num_threads; i++) {
+		bfd_thread_t *thread = sock->threads[i];
+
+		if (thread->pipefd[0] < 0) {
+			bfd_thread_start(thread);
+			continue;
+		}
+
+		/*
+		 *	The thread runs until the listener is freed.
+		 */
+		if (fr_schedule_pthread_create(&thread->pthread_id, bfd_child_thread, thread) < 0) {
+			PERROR("Thread create failed");
+			return -1;
+		}
+		thread->running = true;
+	}
+
+	return 0;
+}
+
+/*
+ *	Ask a thread to stop its sessions, and wait for it to exit.
+ */
+static int bfd_thread_stop(bfd_thread_t *thread)
+{
+	bfd_pipe_msg_t	msg = { .op = BFD_PIPE_EXIT };
+	int		ret;
+
+	if (!thread->running) return 0;
+
+	if (bfd_pipe_send(thread, &msg) < 0) {
+		ERROR("BFD thread %d failed sending exit message: %s", thread->id, fr_syserror(errno));
+		return -1;
+	}
+
+	ret = pthread_join(thread->pthread_id, NULL);
+	if (ret != 0) {
+		ERROR("BFD thread %d failed exiting: %s", thread->id, fr_syserror(ret));
+		return -1;
 	}
 
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	thread->running = false;
+
+	return 0;
+}
+
+/*
+ *	Stop the threads before anything they use is freed.  The
+ *	sessions are then freed from the tree, as nothing else is
+ *	running their timers.
+ */
+static int _bfd_socket_free(bfd_socket_t *sock)
+{
+	uint32_t i;
+
+	if (!sock->threads) return 0;
 
 	/*
-	 *	Create the thread detached, so that it cleans up it's
-	 *	own memory when it exits.
-	 *
-	 *	Note that the function returns non-zero on error, NOT
-	 *	-1.  The return code is the error, and errno isn't set.
+	 *	If a thread is still running, we can't free anything
+	 *	it uses.
 	 */
-	if (fr_schedule_pthread_create(&session->pthread_id, bfd_child_thread, session) < 0) {
-		talloc_free(session->el);
-		session->el = NULL;
-		PERROR("Thread create failed");
-		goto close_pipes;
+	for (i = 0; i < sock->num_threads; i++) {
+		if (sock->threads[i] && (bfd_thread_stop(sock->threads[i]) < 0)) return -1;
 	}
-	pthread_attr_destroy(&attr);
 
-	return 1;
+	talloc_free(sock->session_tree);
+	sock->session_tree = NULL;
+
+	for (i = 0; i < sock->num_threads; i++) {
+		bfd_thread_t	*thread = sock->threads[i];
+		int		pipefd[2];
+
+		if (!thread) continue;
+
+		/*
+		 *	The thread's timers and callbacks are in the
+		 *	shared event list, which outlives it.
+		 */
+		if (thread->pipefd[0] < 0) (void) fr_event_post_delete(thread->el, bfd_tx_flush_post, thread);
+
+		pipefd[0] = thread->pipefd[0];
+		pipefd[1] = thread->pipefd[1];
+
+		talloc_free(thread);
+		sock->threads[i] = NULL;
+
+		if (pipefd[0] >= 0) close(pipefd[0]);
+		if (pipefd[1] >= 0) close(pipefd[1]);
+	}
+
+	return 0;
 }
 
 static const char *bfd_state[] = {
@@ -415,11 +772,16 @@ static void bfd_session_free(void *ctx)
 {
 	bfd_state_t *session = ctx;
 
-	if (event_list != session->el) {
-		/*
-		 *	FIXME: this isn't particularly safe.
-		 */
-		bfd_pthread_free(session);
+	/*
+	 *	Sessions are only freed with the listener, after
+	 *	_bfd_socket_free() has stopped their thread.  Until
+	 *	then, the timers belong to the thread.
+	 */
+	if (session->thread) {
+		fr_assert(!session->thread->running);
+
+		bfd_stop_control(session);
+		fr_dlist_remove(&session->thread->sessions, session);
 	}
 
 	talloc_free(session);
@@ -593,25 +955,14 @@ static bfd_state_t *bfd_new_session(bfd_socket_t *sock, int sockfd,
 		return NULL;
 	}
 
-	bfd_trigger(session);
-
 	/*
-	 *	Check for threaded / non-threaded operation.
+	 *	Spread the sessions evenly over the threads.  The
+	 *	session is started when its thread is.
 	 */
-	if (event_list) {
-		session->el = event_list;
+	session->thread = sock->threads[session->number % sock->num_threads];
+	fr_dlist_insert_tail(&session->thread->sessions, session);
 
-		bfd_start_control(session);
-
-		session->pipefd[0] = session->pipefd[1] = -1;
-		session->pthread_id = pthread_self();
-	} else {
-		if (!bfd_pthread_create(session)) {
-			fr_rb_delete(sock->session_tree, session);
-			talloc_free(session);
-			return NULL;
-		}
-	}
+	bfd_trigger(session);
 
 	return session;
 }
@@ -876,10 +1227,23 @@ static void bfd_sign(bfd_state_t *session, bfd_packet_t *bfd)
 /*
  *	Send a packet.
  */
-static void bfd_send_packet(UNUSED fr_event_list_t *eel, UNUSED fr_time_t now, void *ctx)
+static void bfd_send_packet(UNUSED fr_event_list_t *eel, fr_time_t now, void *ctx)
 {
-	bfd_state_t *session = ctx;
-	bfd_packet_t bfd;
+	bfd_state_t		*session = ctx;
+	bfd_thread_stats_t	*stats = &session->thread->stats;
+	bfd_packet_t		bfd;
+	int64_t			late;
+
+	/*
+	 *	How much later than scheduled the packet is going
+	 *	out, on top of the jitter we add deliberately.
+	 */
+	late = fr_time_delta_to_usec(fr_time_sub(now, session->te_packet.when));
+	if (late < 0) late = 0;
+
+	stats->scheduled++;
+	stats->late_total += late;
+	if ((uint64_t) late > stats->late_max) stats->late_max = late;
 
 	bfd_control_packet_init(session, &bfd);
 
@@ -895,11 +1259,7 @@ static void bfd_send_packet(UNUSED fr_event_list_t *eel, UNUSED fr_time_t now, v
 
 	DEBUG("BFD %d sending packet state %s",
 	      session->number, bfd_state[session->session_state]);
-	if (sendto(session->socket.fd, &bfd, bfd.length, 0,
-		   (struct sockaddr *) &session->remote_sockaddr,
-		   session->salen) < 0) {
-		ERROR("Failed sending packet: %s", fr_syserror(errno));
-	}
+	bfd_tx_queue(session, &bfd);
 }
 
 static int bfd_start_packets(bfd_state_t *session)
@@ -910,7 +1270,7 @@ static int bfd_start_packets(bfd_state_t *session)
 	/*
 	 *	Reset the timers.
 	 */
-	fr_event_timer_delete(&session->ev_packet);
+	fr_timer_wheel_delete(&session->te_packet);
 
 	session->last_sent = fr_time();
 
@@ -935,9 +1295,9 @@ static int bfd_start_packets(bfd_state_t *session)
 	interval = base;
 	interval += jitter;
 
-	if (fr_event_timer_in(session, session->el, &session->ev_packet,
-			      fr_time_delta_from_usec(interval),
-			      bfd_send_packet, session) < 0) {
+	if (fr_timer_wheel_insert(session->thread->tw, &session->te_packet,
+				  fr_time_add(session->last_sent, fr_time_delta_from_usec(interval)),
+				  bfd_send_packet, session) < 0) {
 		fr_assert("Failed to insert event" == NULL);
 	}
 
@@ -949,7 +1309,7 @@ static void bfd_set_timeout(bfd_state_t *session, fr_time_t when)
 {
 	fr_time_t now;
 
-	fr_event_timer_delete(&session->ev_timeout);
+	fr_timer_wheel_delete(&session->te_timeout);
 
 	now = fr_time_add(when, fr_time_delta_from_usec(session->detection_time));
 
@@ -963,8 +1323,8 @@ static void bfd_set_timeout(bfd_state_t *session, fr_time_t when)
 		session->next_recv = fr_time_add(session->next_recv, fr_time_delta_from_usec(delay));
 	}
 
-	if (fr_event_timer_at(session, session->el, &session->ev_timeout,
-			      now, bfd_detection_timeout, session) < 0) {
+	if (fr_timer_wheel_insert(session->thread->tw, &session->te_timeout,
+				  now, bfd_detection_timeout, session) < 0) {
 		fr_assert("Failed to insert event" == NULL);
 	}
 }
@@ -989,15 +1349,15 @@ static int bfd_start_control(bfd_state_t *session)
 
 	bfd_set_timeout(session, session->last_recv);
 
-	if (session->ev_packet) return 0;
+	if (fr_timer_wheel_entry_armed(&session->te_packet)) return 0;
 
 	return bfd_start_packets(session);
 }
 
 static int bfd_stop_control(bfd_state_t *session)
 {
-	fr_event_timer_delete(&session->ev_timeout);
-	fr_event_timer_delete(&session->ev_packet);
+	fr_timer_wheel_delete(&session->te_timeout);
+	fr_timer_wheel_delete(&session->te_packet);
 	return 1;
 }
 
@@ -1042,8 +1402,8 @@ static int bfd_stop_poll(bfd_state_t *session)
 	 *	re-set the timers.
 	 */
 	if (!session->remote_demand_mode) {
-		fr_assert(session->ev_timeout != NULL);
-		fr_assert(session->ev_packet != NULL);
+		fr_assert(fr_timer_wheel_entry_armed(&session->te_timeout));
+		fr_assert(fr_timer_wheel_entry_armed(&session->te_packet));
 		session->doing_poll = 0;
 
 		bfd_stop_control(session);
@@ -1086,6 +1446,7 @@ static void bfd_detection_timeout(UNUSED fr_event_list_t *eel, fr_time_t now, vo
 
 	DEBUG("BFD %d Timeout state %s ****** ", session->number,
 	      bfd_state[session->session_state]);
+	session->thread->stats.timeouts++;
 
 	if (!session->demand_mode) {
 		switch (session->session_state) {
@@ -1139,11 +1500,7 @@ static void bfd_poll_response(bfd_state_t *session)
 
 	bfd_sign(session, &bfd);
 
-	if (sendto(session->socket.fd, &bfd, bfd.length, 0,
-		   (struct sockaddr *) &session->remote_sockaddr,
-		   session->salen) < 0) {
-		ERROR("Failed sending poll response: %s", fr_syserror(errno));
-	}
+	bfd_tx_queue(session, &bfd);
 }
 
 
@@ -1166,6 +1523,7 @@ static int bfd_process(bfd_state_t *session, bfd_packet_t *bfd)
 	}
 
 	DEBUG("BFD %d processing packet", session->number);
+	session->thread->stats.received++;
 	session->remote_disc = bfd->my_disc;
 	session->remote_session_state = bfd->state;
 	session->remote_demand_mode = bfd->demand;
@@ -1494,36 +1852,14 @@ static int bfd_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
-	if (!event_list) {
-		uint8_t *p = (uint8_t *) &bfd;
-		size_t total = bfd.length;
+	if (session->thread->pipefd[1] >= 0) {
+		bfd_pipe_msg_t msg = {
+			.op = BFD_PIPE_PACKET,
+			.session = session,
+			.packet = bfd
+		};
 
-		/*
-		 *	A child has had a problem.  Do some cleanups.
-		 */
-		if (session->blocked) bfd_pthread_free(session);
-
-		/*
-		 *	No event list, try to create a new one.
-		 */
-		if (!session->el && !bfd_pthread_create(session)) {
-			DEBUG("BFD %d - error trying to create child thread",
-			      session->number);
-			return 0;
-		}
-
-		do {
-			rcode = write(session->pipefd[1], p, total);
-			if ((rcode < 0) && (errno == EINTR)) continue;
-
-			if (rcode < 0) {
-				session->blocked = true;
-				return 0;
-			}
-
-			total -= rcode;
-			p += rcode;
-		} while (total > 0);
+		(void) bfd_pipe_send(session->thread, &msg);
 		return 0;
 	}
 
@@ -1669,6 +2005,10 @@ static int bfd_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 			  "no", T_DOUBLE_QUOTED_STRING) < 0) return -1;
 	if (cf_pair_parse(NULL, cs, "auth_type", FR_ITEM_POINTER(FR_TYPE_STRING, &auth_type_str),
 			  NULL, T_INVALID) < 0) return -1;
+	if (cf_pair_parse(sock, cs, "num_threads", FR_ITEM_POINTER(FR_TYPE_UINT32,
+			  &sock->num_threads), "1", T_BARE_WORD) < 0) return -1;
+	if (cf_pair_parse(sock, cs, "stats_interval", FR_ITEM_POINTER(FR_TYPE_UINT32,
+			  &sock->stats_interval), "0", T_BARE_WORD) < 0) return -1;
 
 	if (!this->server) {
 		char const *server;
@@ -1688,6 +2028,14 @@ static int bfd_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 	if (sock->max_timeouts == 0) sock->max_timeouts = 1;
 	if (sock->max_timeouts > 10) sock->max_timeouts = 10;
 
+	if (sock->num_threads == 0) sock->num_threads = 1;
+	if (sock->num_threads > BFD_MAX_THREADS) sock->num_threads = BFD_MAX_THREADS;
+
+	/*
+	 *	Everything runs in the one event list.
+	 */
+	if (event_list) sock->num_threads = 1;
+
 	sock->auth_type = fr_table_value_by_str(auth_types, auth_type_str, BFD_AUTH_INVALID);
 	if (sock->auth_type == BFD_AUTH_INVALID) {
 		ERROR("Unknown auth_type '%s'", auth_type_str);
@@ -1732,6 +2080,7 @@ static int bfd_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 static int bfd_socket_open(CONF_SECTION *cs, rad_listen_t *this)
 {
 	int rcode;
+	uint32_t i;
 	uint16_t port;
 	bfd_socket_t *sock = this->data;
 
@@ -1761,6 +2110,15 @@ static int bfd_socket_open(CONF_SECTION *cs, rad_listen_t *this)
 		return -1;
 	}
 
+	sock->threads = talloc_zero_array(sock, bfd_thread_t *, sock->num_threads);
+	if (!sock->threads) return -1;
+	talloc_set_destructor(sock, _bfd_socket_free);
+
+	for (i = 0; i < sock->num_threads; i++) {
+		sock->threads[i] = bfd_thread_alloc(sock, i, this->fd);
+		if (!sock->threads[i]) return -1;
+	}
+
 	/*
 	 *	Bootstrap the initial set of connections.
 	 */
@@ -1768,7 +2126,7 @@ static int bfd_socket_open(CONF_SECTION *cs, rad_listen_t *this)
 		return -1;
 	}
 
-	return 0;
+	return bfd_threads_start(sock);
 }
 
 static int bfd_socket_print(const rad_listen_t *this, char *buffer, size_t bufsize)
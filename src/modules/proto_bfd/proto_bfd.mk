@@ -0,0 +1,7 @@
+TARGETNAME	:= proto_bfd
+
+ifneq "$(TARGETNAME)" ""
+TARGET		:= $(TARGETNAME)$(L)
+endif
+
+SOURCES		:= proto_bfd.c
@@ -0,0 +1,283 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the BFD session threads
+ *
+ * @file src/modules/proto_bfd/proto_bfd_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "proto_bfd.c"
+
+#include <netinet/in.h>
+
+#define TEST_THREADS		4
+#define TEST_SESSIONS		16
+#define TEST_WRITERS		8
+#define TEST_WRITES		2000
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	if (fr_time_start() < 0) {
+		fr_perror("proto_bfd_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+/** Open a UDP socket on 127.0.0.1, or on all addresses
+ *
+ */
+static int test_udp_socket(bool any, uint16_t *port)
+{
+	struct sockaddr_in	sin = { .sin_family = AF_INET };
+	socklen_t		len = sizeof(sin);
+	int			fd;
+
+	sin.sin_addr.s_addr = any ? htonl(INADDR_ANY) : htonl(INADDR_LOOPBACK);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	TEST_ASSERT(fd >= 0);
+	TEST_ASSERT(bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0);
+	TEST_ASSERT(fr_nonblock(fd) >= 0);
+
+	if (port) {
+		TEST_ASSERT(getsockname(fd, (struct sockaddr *)&sin, &len) == 0);
+		*port = ntohs(sin.sin_port);
+	}
+
+	return fd;
+}
+
+/** Allocate a listener with its own threads, but don't start them
+ *
+ */
+static bfd_socket_t *test_sock_alloc(uint32_t num_threads, int sockfd)
+{
+	bfd_socket_t	*sock;
+	uint32_t	i;
+
+	sock = talloc_zero(NULL, bfd_socket_t);
+	TEST_ASSERT(sock != NULL);
+
+	sock->num_threads = num_threads;
+	sock->min_tx_interval = 10;
+	sock->min_rx_interval = 1000;
+	sock->max_timeouts = 3;
+
+	sock->session_tree = fr_rb_inline_talloc_alloc(sock, bfd_state_t, node, bfd_session_cmp, bfd_session_free);
+	TEST_ASSERT(sock->session_tree != NULL);
+
+	sock->threads = talloc_zero_array(sock, bfd_thread_t *, sock->num_threads);
+	TEST_ASSERT(sock->threads != NULL);
+	talloc_set_destructor(sock, _bfd_socket_free);
+
+	for (i = 0; i < sock->num_threads; i++) {
+		sock->threads[i] = bfd_thread_alloc(sock, i, sockfd);
+		TEST_ASSERT(sock->threads[i] != NULL);
+		TEST_ASSERT(sock->threads[i]->pipefd[0] >= 0);
+	}
+
+	return sock;
+}
+
+/** Add a session which sends a packet every 10ms to 127.0.0.<n + 2>
+ *
+ * The detection time is long enough that the session never times out.
+ */
+static bfd_state_t *test_session_alloc(bfd_socket_t *sock, int sockfd, uint16_t port)
+{
+	bfd_state_t	*session;
+
+	session = talloc_zero(sock, bfd_state_t);
+	TEST_ASSERT(session != NULL);
+
+	session->number = sock->number++;
+	session->socket.fd = sockfd;
+	session->session_state = BFD_STATE_DOWN;
+	session->local_disc = fr_rand();
+	session->desired_min_tx_interval = sock->min_tx_interval * 1000;
+	session->required_min_rx_interval = sock->min_rx_interval * 1000;
+	session->remote_min_rx_interval = 1;
+	session->detect_multi = sock->max_timeouts;
+	session->auth_type = BFD_AUTH_RESERVED;
+	session->detection_time = 60 * USEC;
+	session->last_recv = fr_time();
+
+	session->socket.inet.dst_ipaddr = (fr_ipaddr_t){
+		.af = AF_INET,
+		.prefix = 32,
+		.addr.v4.s_addr = htonl(INADDR_LOOPBACK + 1 + session->number)
+	};
+	session->socket.inet.dst_port = port;
+	fr_ipaddr_to_sockaddr(&session->remote_sockaddr, &session->salen,
+			      &session->socket.inet.dst_ipaddr, port);
+
+	TEST_ASSERT(fr_rb_insert(sock->session_tree, session));
+
+	session->thread = sock->threads[session->number % sock->num_threads];
+	fr_dlist_insert_tail(&session->thread->sessions, session);
+
+	return session;
+}
+
+/** Count the packets waiting on a socket
+ *
+ */
+static unsigned int test_drain(int fd)
+{
+	uint8_t		buffer[256];
+	unsigned int	count = 0;
+
+	while (recv(fd, buffer, sizeof(buffer), 0) > 0) count++;
+
+	return count;
+}
+
+/** Freeing the listener stops the threads before their sessions are freed
+ *
+ * Each thread stops its own sessions' timers, so nothing is sent once
+ * the listener has gone.
+ */
+static void test_teardown(void)
+{
+	bfd_socket_t	*sock;
+	int		sockfd, peerfd;
+	uint16_t	port;
+	unsigned int	i;
+
+	sockfd = test_udp_socket(false, NULL);
+	peerfd = test_udp_socket(true, &port);
+
+	sock = test_sock_alloc(TEST_THREADS, sockfd);
+	for (i = 0; i < TEST_SESSIONS; i++) test_session_alloc(sock, sockfd, port);
+
+	TEST_ASSERT(bfd_threads_start(sock) == 0);
+	for (i = 0; i < TEST_THREADS; i++) TEST_CHECK(sock->threads[i]->running);
+
+	usleep(100 * 1000);
+
+	TEST_CASE("Free the listener while its threads are sending");
+	TEST_CHECK(talloc_free(sock) == 0);
+
+	TEST_CHECK(test_drain(peerfd) > 0);
+	TEST_MSG("The threads didn't send any packets");
+
+	usleep(50 * 1000);
+	TEST_CHECK(test_drain(peerfd) == 0);
+	TEST_MSG("Packets were sent after the listener was freed");
+
+	close(sockfd);
+	close(peerfd);
+}
+
+/** Freeing a listener whose threads were never started
+ *
+ */
+static void test_teardown_not_started(void)
+{
+	bfd_socket_t	*sock;
+	int		sockfd;
+	unsigned int	i;
+
+	sockfd = test_udp_socket(false, NULL);
+
+	sock = test_sock_alloc(TEST_THREADS, sockfd);
+	for (i = 0; i < TEST_SESSIONS; i++) test_session_alloc(sock, sockfd, 9);
+
+	TEST_CHECK(talloc_free(sock) == 0);
+
+	close(sockfd);
+}
+
+typedef struct {
+	bfd_thread_t	*thread;
+	unsigned int	sent;
+} test_writer_t;
+
+static void *test_writer(void *uctx)
+{
+	test_writer_t	*w = uctx;
+	bfd_pipe_msg_t	msg = { .op = BFD_PIPE_PACKET };
+	unsigned int	i;
+
+	for (i = 0; i < TEST_WRITES; i++) {
+		if (bfd_pipe_send(w->thread, &msg) == 0) w->sent++;
+	}
+
+	return NULL;
+}
+
+/** Every packet which isn't written to the pipe is counted as dropped
+ *
+ * The thread isn't started, so the pipe fills up, and many writers
+ * race to update the counter.
+ */
+static void test_dropped(void)
+{
+	bfd_socket_t	*sock;
+	int		sockfd;
+	pthread_t	tid[TEST_WRITERS];
+	test_writer_t	w[TEST_WRITERS];
+	uint64_t	sent = 0, dropped;
+	unsigned int	i;
+
+	sockfd = test_udp_socket(false, NULL);
+	sock = test_sock_alloc(1, sockfd);
+
+	for (i = 0; i < TEST_WRITERS; i++) {
+		w[i] = (test_writer_t){ .thread = sock->threads[0] };
+		TEST_ASSERT(pthread_create(&tid[i], NULL, test_writer, &w[i]) == 0);
+	}
+
+	for (i = 0; i < TEST_WRITERS; i++) {
+		pthread_join(tid[i], NULL);
+		sent += w[i].sent;
+	}
+
+	dropped = atomic_load_explicit(&sock->threads[0]->dropped, memory_order_relaxed);
+
+	TEST_CHECK(dropped > 0);
+	TEST_MSG("The pipe never filled up");
+	TEST_CHECK((sent + dropped) == (TEST_WRITERS * TEST_WRITES));
+	TEST_MSG("sent %" PRIu64 " + dropped %" PRIu64 " != %u", sent, dropped, TEST_WRITERS * TEST_WRITES);
+
+	TEST_CHECK(talloc_free(sock) == 0);
+
+	close(sockfd);
+}
+
+TEST_LIST = {
+	{ "teardown",			test_teardown },
+	{ "teardown_not_started",	test_teardown_not_started },
+	{ "dropped",			test_dropped },
+
+	{ NULL }
+};
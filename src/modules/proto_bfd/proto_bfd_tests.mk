@@ -0,0 +1,6 @@
+TARGET		:= proto_bfd_tests$(E)
+SOURCES		:= proto_bfd_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) $(LIBFREERADIUS_SERVER) libfreeradius-io$(L)
@@ -112,6 +112,18 @@ static CONF_PARSER sasl_mech_static[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static CONF_PARSER ldap_sync_replica_config[] = {
+	{ FR_CONF_OFFSET("name", FR_TYPE_STRING, sync_config_t, replica_name) },
+
+	{ FR_CONF_OFFSET("key_attribute", FR_TYPE_STRING, sync_config_t, replica_key_attr) },
+
+	{ FR_CONF_OFFSET("file", FR_TYPE_FILE_OUTPUT, sync_config_t, replica_file) },
+
+	{ FR_CONF_OFFSET("persist_interval", FR_TYPE_TIME_DELTA, sync_config_t, replica_persist_interval), .dflt = "60" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER ldap_sync_search_config[] = {
 	{ FR_CONF_OFFSET("base_dn", FR_TYPE_STRING, sync_config_t, base_dn), .dflt = "", .quote = T_SINGLE_QUOTED_STRING },
 
@@ -123,6 +135,8 @@ static CONF_PARSER ldap_sync_search_config[] = {
 
 	{ FR_CONF_OFFSET("allow_refresh", FR_TYPE_BOOL, sync_config_t, allow_refresh), .dflt = "no" },
 
+	{ FR_CONF_POINTER("replica", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) ldap_sync_replica_config },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -567,7 +581,14 @@ static int proto_ldap_attributes_add(request_t *request, sync_config_t const *co
 static void proto_ldap_sync_reinit(fr_event_list_t *el, fr_time_t now, void *user_ctx)
 {
 	sync_config_t const	*config = talloc_get_type_abort_const(user_ctx, sync_config_t);
-	proto_ldap_inst_t	*inst = talloc_get_type_abort(config->user_ctx, proto_ldap_inst_t);
+	rad_listen_t		*listen = talloc_get_type_abort(config->user_ctx, rad_listen_t);
+	proto_ldap_inst_t	*inst = talloc_get_type_abort(listen->data, proto_ldap_inst_t);
+
+	/*
+	 *	Without a cookie the server sends every entry
+	 *	again, so anything it doesn't send has gone.
+	 */
+	if (config->replica) fr_ldap_replica_refresh_start(config->replica, true);
 
 	/*
 	 *	Reinitialise the sync
@@ -617,7 +638,7 @@ static void proto_ldap_connection_init(UNUSED fr_event_list_t *el, UNUSED fr_tim
  * @param[in] user_ctx	The listener.
  * @return 0.
  */
-static int _proto_ldap_refresh_required(fr_ldap_connection_t *conn, UNUSED sync_config_t const *config,
+static int _proto_ldap_refresh_required(fr_ldap_connection_t *conn, sync_config_t const *config,
 				        int sync_id, UNUSED sync_phases_t phase, void *user_ctx)
 {
 	rad_listen_t		*listen = talloc_get_type_abort(user_ctx, rad_listen_t);
@@ -627,7 +648,7 @@ static int _proto_ldap_refresh_required(fr_ldap_connection_t *conn, UNUSED sync_
 
 	DEBUG2("Refresh required");
 
-	proto_ldap_sync_reinit(inst->el, fr_time(), user_ctx);
+	proto_ldap_sync_reinit(inst->el, fr_time(), UNCONST(sync_config_t *, config));
 
 	return 0;
 }
@@ -657,6 +678,29 @@ static int _proto_ldap_present(fr_ldap_connection_t *conn, sync_config_t const *
 	return 0;
 }
 
+/** Receive notification that the refresh phase is complete
+ *
+ * @note This is a callback for the sync_demux function.
+ *
+ * @param[in] conn	the sync belongs to.
+ * @param[in] config	of the sync that completed its refresh.
+ * @param[in] sync_id	of the sync that completed its refresh.
+ * @param[in] phase	Refresh phase the sync was in when the refresh completed.
+ * @param[in] user_ctx	The listener.
+ * @return 0.
+ */
+static int _proto_ldap_done(UNUSED fr_ldap_connection_t *conn, sync_config_t const *config,
+			    UNUSED int sync_id, sync_phases_t phase, UNUSED void *user_ctx)
+{
+	/*
+	 *	After a present phase, entries the server
+	 *	didn't mention have been deleted.
+	 */
+	if (config->replica) fr_ldap_replica_refresh_done(config->replica, (phase & SYNC_PHASE_PRESENT) != 0);
+
+	return 0;
+}
+
 /** Enque a new cookie store request
  *
  * Create a new request containing the cookie we received from the LDAP server. This allows
@@ -682,6 +726,15 @@ static int _proto_ldap_cookie_store(UNUSED fr_ldap_connection_t *conn, sync_conf
 	request_t			*request;
 	fr_pair_t		*vp;
 
+	/*
+	 *	The replica stores its own cookie, which it
+	 *	persists along with the entries.
+	 */
+	if (config->replica) {
+		fr_ldap_replica_cookie_set(config->replica, cookie);
+		if (!cf_section_find(listen->server_cs, "store", "Cookie")) return 0;
+	}
+
 	request = proto_ldap_request_setup(listen, inst, sync_id);
 	if (!request) return -1;
 
@@ -724,6 +777,35 @@ static int _proto_ldap_entry(fr_ldap_connection_t *conn, sync_config_t const *co
 	fr_ldap_map_exp_t	expanded;
 	request_t			*request;
 
+	if (config->replica) {
+		switch (state) {
+		case SYNC_STATE_ADD:
+		case SYNC_STATE_MODIFY:
+			if (fr_ldap_replica_update(config->replica, uuid, conn->handle, msg) < 0) {
+				PERROR("Failed updating replica \"%s\"", config->replica_name);
+				return -1;
+			}
+			break;
+
+		case SYNC_STATE_PRESENT:
+			fr_ldap_replica_present(config->replica, uuid);
+			break;
+
+		case SYNC_STATE_DELETE:
+			fr_ldap_replica_delete(config->replica, uuid);
+			break;
+
+		default:
+			break;
+		}
+
+		/*
+		 *	Nothing else to do if the virtual server
+		 *	doesn't want to see the entries.
+		 */
+		if (!cf_section_find(listen->server_cs, "recv", CF_IDENT_ANY)) return 0;
+	}
+
 	request = proto_ldap_request_setup(listen, inst, sync_id);
 	if (!request) return -1;
 
@@ -1057,14 +1139,27 @@ static int proto_ldap_socket_open(UNUSED CONF_SECTION *cs, rad_listen_t *listen)
 
 	DEBUG2("Starting sync(s)");
 	for (i = 0; i < talloc_array_length(inst->sync_config); i++) {
-		uint8_t *cookie;
-		int	ret;
+		sync_config_t	*config = inst->sync_config[i];
+		uint8_t		*cookie;
+		int		ret;
+
+		/*
+		 *	A replica can only resume from the cookie
+		 *	stored with its snapshot.  Any other cookie
+		 *	would miss the entries we don't have.
+		 */
+		if (config->replica) {
+			cookie = fr_ldap_replica_cookie(inst, config->replica);
+			if (cookie) DEBUG2("Resuming sync from replica \"%s\" snapshot", config->replica_name);
+
+			fr_ldap_replica_refresh_start(config->replica, !cookie);
 
 		/*
 		 *	Synchronously load the cookie... ewww
 		 */
-		if (proto_ldap_cookie_load(inst, &cookie, listen, inst->sync_config[i]) < 0) goto error;
-		ret = sync_state_init(inst->conn, inst->sync_config[i], cookie, false);
+		} else if (proto_ldap_cookie_load(inst, &cookie, listen, config) < 0) goto error;
+
+		ret = sync_state_init(inst->conn, config, cookie, false);
 		talloc_free(cookie);
 		if (ret < 0) goto error;
 	}
@@ -1146,6 +1241,29 @@ static int proto_ldap_socket_parse(CONF_SECTION *cs, rad_listen_t *listen)
 		inst->sync_config[i]->entry = _proto_ldap_entry;
 		inst->sync_config[i]->refresh_required = _proto_ldap_refresh_required;
 		inst->sync_config[i]->present = _proto_ldap_present;
+		inst->sync_config[i]->done = _proto_ldap_done;
+
+		/*
+		 *	Maintain a local copy of the entries
+		 */
+		if (inst->sync_config[i]->replica_name) {
+			sync_config_t *config = inst->sync_config[i];
+
+			if (!config->replica_key_attr) {
+				cf_log_err(sync_cs, "'replica.key_attribute' must be set");
+				return -1;
+			}
+
+			config->replica = fr_ldap_replica_acquire(config, config->replica_name);
+			if (!config->replica ||
+			    (fr_ldap_replica_source(config->replica, config->replica_key_attr, config->attrs,
+						    config->replica_file, config->replica_persist_interval) < 0)) {
+				cf_log_perr(sync_cs, "Failed configuring replica \"%s\"", config->replica_name);
+				return -1;
+			}
+
+			if (fr_ldap_replica_load(config->replica) < 0) return -1;
+		}
 
 		/*
 		 *	Parse and validate any maps
@@ -1199,7 +1317,7 @@ static int ldap_compile_section(CONF_SECTION *server_cs, char const *name1, char
  * @param[in] server_cs		The virtual server containing the sections to compile.
  * @param[in] listen_cs		The listen config section.
  */
-static int proto_ldap_listen_compile(CONF_SECTION *server_cs, UNUSED CONF_SECTION *listen_cs)
+static int proto_ldap_listen_compile(CONF_SECTION *server_cs, CONF_SECTION *listen_cs)
 {
 	int ret;
 	int found = 0;
@@ -1229,8 +1347,21 @@ static int proto_ldap_listen_compile(CONF_SECTION *server_cs, UNUSED CONF_SECTIO
 	if (ret > 0) found++;
 
 	if (found == 0) {
+		CONF_SECTION *sync_cs;
+
+		/*
+		 *	Syncs which only maintain a replica
+		 *	don't need any sections.
+		 */
+		for (sync_cs = cf_section_find(listen_cs, "sync", NULL);
+		     sync_cs;
+		     sync_cs = cf_section_find_next(listen_cs, sync_cs, "sync", NULL)) {
+			if (cf_section_find(sync_cs, "replica", NULL)) return 0;
+		}
+
 		cf_log_err(server_cs, "At least one of 'recv [Present|Add|Delete|Modify] { ... }' "
-			      "sections must be present in virtual server %s", cf_section_name2(server_cs));
+			      "sections, or a sync 'replica { ... }' must be present in virtual server %s",
+			      cf_section_name2(server_cs));
 
 		return -1;
 	}
@@ -141,6 +141,28 @@ static int sync_new_cookie(bool *new_cookie, sync_state_t *sync, BerElement *ber
 	return 0;
 }
 
+/** Inform the caller that the refresh phase is complete
+ *
+ * With refreshAndPersist the end of the refresh phase is signalled by a
+ * refreshPresent or refreshDelete message with refreshDone set.
+ *
+ * @param[in] sync	which completed its refresh.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int sync_refresh_done(sync_state_t *sync)
+{
+	int ret = 0;
+
+	if (sync->config->done) {
+		ret = sync->config->done(sync->conn, sync->config, sync->msgid, sync->phase, sync->config->user_ctx);
+	}
+	sync->phase = SYNC_PHASE_DONE;
+
+	return ret;
+}
+
 /** Handle a LDAP_RES_SEARCH_ENTRY (SearchResultEntry) or LDAP_RES_SEARCH_REFRENCE (SearchResultReference) response
  *
  * Upon receipt of a search request containing the syncControl the server provides the initial
@@ -235,13 +257,17 @@ static int sync_search_entry_or_reference(sync_state_t *sync, LDAPMessage *msg,
 	}
 
 	switch (state) {
+	/*
+	 *  The refreshPresent and refreshDelete messages
+	 *  mark the end of a phase, so the first entry
+	 *  sent with present or delete state is what tells
+	 *  us which phase we're in.
+	 */
 	case SYNC_STATE_PRESENT:
 		switch (sync->phase) {
-/*
 		case SYNC_PHASE_INIT:
 			sync->phase = SYNC_PHASE_PRESENT;
 			break;
-*/
 
 		case SYNC_PHASE_PRESENT:
 			break;
@@ -257,6 +283,10 @@ static int sync_search_entry_or_reference(sync_state_t *sync, LDAPMessage *msg,
 
 	case SYNC_STATE_DELETE:
 		switch (sync->phase) {
+		case SYNC_PHASE_INIT:
+			sync->phase = SYNC_PHASE_DELETE;
+			break;
+
 		case SYNC_PHASE_DELETE:
 		case SYNC_PHASE_DONE:
 			break;
@@ -266,10 +296,16 @@ static int sync_search_entry_or_reference(sync_state_t *sync, LDAPMessage *msg,
 		}
 		break;
 
+	/*
+	 *  Entries which changed are sent during
+	 *  either refresh phase.
+	 */
 	case SYNC_STATE_ADD:
 	case SYNC_STATE_MODIFY:
 		switch (sync->phase) {
 		case SYNC_PHASE_INIT:
+		case SYNC_PHASE_PRESENT:
+		case SYNC_PHASE_DELETE:
 		case SYNC_PHASE_DONE:
 			break;
 
@@ -409,13 +445,15 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 	case LDAP_TAG_SYNC_REFRESH_PRESENT:
 		switch (sync->phase) {
 		case SYNC_PHASE_INIT:
+		case SYNC_PHASE_PRESENT:
+		case SYNC_PHASE_PRESENT_IDSET:
 			sync->phase = SYNC_PHASE_PRESENT;
 			break;
 
 		default:
 			ERROR("Invalid refresh phase transition (%s->%s)",
 			      fr_table_str_by_value(sync_phase_table, sync->phase, "<unknown>"),
-			      fr_table_str_by_value(sync_phase_table, SYNC_PHASE_DELETE, "<unknown>"));
+			      fr_table_str_by_value(sync_phase_table, SYNC_PHASE_PRESENT, "<unknown>"));
 			goto error;
 		}
 
@@ -445,12 +483,12 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 		 *  refreshOnly mode of Sync Operation because it is followed by a delete
 		 *  phase.
 		 */
-		if (!sync->config->persist) {
+		if (refresh_done && !sync->config->persist) {
 			ERROR("Got refreshPresent refreshDone = true in refreshOnly mode (which is invalid)");
 			goto error;
 		}
 
-		if (refresh_done) sync->phase = SYNC_PHASE_DONE;
+		if (refresh_done && (sync_refresh_done(sync) < 0)) goto error;
 		break;
 
 	case LDAP_TAG_SYNC_REFRESH_DELETE:
@@ -458,6 +496,8 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 		case SYNC_PHASE_INIT:
 		case SYNC_PHASE_PRESENT:
 		case SYNC_PHASE_PRESENT_IDSET:
+		case SYNC_PHASE_DELETE:
+		case SYNC_PHASE_DELETE_IDSET:
 			sync->phase = SYNC_PHASE_DELETE;
 			break;
 
@@ -489,7 +529,7 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 			ERROR("Malformed refreshPresent sequence");
 			goto error;
 		}
-		if (refresh_done) sync->phase = SYNC_PHASE_DONE;
+		if (refresh_done && (sync_refresh_done(sync) < 0)) goto error;
 		break;
 
 	case LDAP_TAG_SYNC_ID_SET:
@@ -517,6 +557,8 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 			case SYNC_PHASE_INIT:
 			case SYNC_PHASE_PRESENT:
 			case SYNC_PHASE_PRESENT_IDSET:
+			case SYNC_PHASE_DELETE:
+			case SYNC_PHASE_DELETE_IDSET:
 				sync->phase = SYNC_PHASE_DELETE_IDSET;
 				break;
 
@@ -529,6 +571,8 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 		} else {
 			switch (sync->phase) {
 			case SYNC_PHASE_INIT:
+			case SYNC_PHASE_PRESENT:
+			case SYNC_PHASE_PRESENT_IDSET:
 				sync->phase = SYNC_PHASE_PRESENT_IDSET;
 				break;
 
@@ -547,10 +591,13 @@ static int sync_intermediate(sync_state_t *sync, LDAPMessage *msg, UNUSED LDAPCo
 				goto error;
 			}
 
+			if (!sync->config->entry) continue;
+
 			ret = sync->config->entry(sync->conn, sync->config, sync->msgid, sync->phase,
-						  (uint8_t const *)sync_uuids[i].bv_val, NULL, SYNC_STATE_DELETE,
+						  (uint8_t const *)sync_uuids[i].bv_val, NULL,
+						  refresh_deletes ? SYNC_STATE_DELETE : SYNC_STATE_PRESENT,
 						  sync->config->user_ctx);
-			if (!ret) goto error;
+			if (ret < 0) goto error;
 		}
 
 		ber_bvarray_free(sync_uuids);
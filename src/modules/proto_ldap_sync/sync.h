@@ -47,7 +47,7 @@ typedef enum {
 	SYNC_PHASE_PRESENT		= 0x01,			//!< Currently in the present phase.
 	SYNC_PHASE_DELETE		= 0x02,			//!< Currently in the delete phase.
 	SYNC_PHASE_PRESENT_IDSET 	= (SYNC_PHASE_PRESENT | SYNC_PHASE_FLAG_IDSET),
-	SYNC_PHASE_DELETE_IDSET 	= (SYNC_PHASE_PRESENT | SYNC_PHASE_FLAG_IDSET),
+	SYNC_PHASE_DELETE_IDSET 	= (SYNC_PHASE_DELETE | SYNC_PHASE_FLAG_IDSET),
 	SYNC_PHASE_DONE			= 0x04			//!< Refresh phase is complete.
 } sync_phases_t;
 
@@ -152,6 +152,15 @@ struct sync_config_s {
 	map_list_t			entry_map;		//!< How to convert attributes in entries
 								//!< to FreeRADIUS attributes.
 
+	/*
+	 *	Local copy of the entries
+	 */
+	char const			*replica_name;		//!< Name modules use to find the replica.
+	char const			*replica_key_attr;	//!< Attribute replica entries are looked up by.
+	char const			*replica_file;		//!< Where the replica is persisted.
+	fr_time_delta_t			replica_persist_interval;	//!< Minimum time between snapshots.
+	fr_ldap_replica_t		*replica;		//!< Replica maintained from this sync's entries.
+
 	/*
 	 *	Callbacks for various events
 	 */
@@ -0,0 +1 @@
+SUBMAKEFILES := rlm_ippool.mk ippool_tests.mk
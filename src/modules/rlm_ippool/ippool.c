@@ -0,0 +1,1084 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ippool.c
+ * @brief In-memory IPv4 address pool, persisted with a journal and snapshots.
+ *
+ * The pool is shared by all worker threads.
+ *
+ * Which addresses are in use is tracked by a bitmap.  Free addresses
+ * are claimed by atomically setting their bit, so threads allocating
+ * for different devices never wait for each other.  Each thread starts
+ * searching the bitmap at a different position, to avoid fighting over
+ * the same words.
+ *
+ * Each address has a lease record holding a hash of the owner, and
+ * the time the lease expires.  Expired leases are reclaimed by
+ * atomically swapping their expiry time for zero, which marks the
+ * lease as busy until the new owner is written.
+ *
+ * Leases are found by owner using a hash table, which is split into
+ * stripes, each with its own mutex.  All operations for a single owner
+ * are serialised by the mutex of the owner's stripe.  Entries whose lease
+ * has been reclaimed by another owner are detected lazily, and reused.
+ *
+ * Every change is written as a fixed size record to a per-thread buffer,
+ * which is periodically appended to the journal.  Records are numbered
+ * from a global sequence counter, as buffers from different threads may
+ * reach the journal out of order.  A snapshot of all leases is written
+ * periodically, after which the journal is discarded.  On startup the
+ * snapshot is loaded, and the journal is replayed on top of it.
+ *
+ * Records are written in host byte order, the files aren't portable
+ * between architectures.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <unistd.h>
+
+#include "ippool.h"
+
+#define CACHE_LINE_SIZE		64
+
+#define IPPOOL_STRIPES		64		//!< Owner index stripes.  Must be a power of 2.
+#define IPPOOL_THREAD_RECORDS	128		//!< Journal records buffered by each thread.
+
+#define IPPOOL_MAGIC		"FRIPPOOL"
+#define IPPOOL_VERSION		1
+
+#define OWNER_EMPTY		((uint64_t)0)
+#define OWNER_TOMBSTONE		UINT64_MAX
+
+typedef enum {
+	IPPOOL_OP_SET = 1,			//!< Lease allocated or updated.
+	IPPOOL_OP_RELEASE = 2			//!< Lease released.
+} ippool_op_t;
+
+/** Header written at the start of the journal and snapshot files
+ *
+ */
+typedef struct {
+	char			magic[8];	//!< IPPOOL_MAGIC, without the trailing '\0'.
+	uint32_t		version;	//!< IPPOOL_VERSION.
+	uint32_t		start;		//!< First address of the pool when the file was written.
+	uint32_t		num;		//!< Number of addresses in the pool.
+	uint32_t		pad;
+	uint64_t		seq;		//!< Snapshots only.  Records with a lower sequence
+						///< number are already reflected in the snapshot.
+} ippool_header_t;
+
+/** A change to a single lease
+ *
+ */
+typedef struct {
+	uint64_t		seq;		//!< Orders records from different threads.
+	uint64_t		owner;		//!< Hash of the owner.
+	int64_t			expires;	//!< Unix time the lease expires at.
+	uint32_t		idx;		//!< Offset of the address from the start of the pool.
+	uint32_t		op;		//!< One of the #ippool_op_t values.
+} ippool_record_t;
+
+typedef struct {
+	_Atomic(uint64_t)	owner;		//!< Hash of the owner, or OWNER_EMPTY.
+	_Atomic(int64_t)	expires;	//!< Unix time the lease expires at.  Zero whilst
+						///< the lease is free, or is being claimed.
+} ippool_lease_t;
+
+typedef struct {
+	uint64_t		owner;		//!< Hash of the owner, OWNER_EMPTY or OWNER_TOMBSTONE.
+	uint32_t		idx;		//!< Lease the owner had when the slot was written.
+} ippool_slot_t;
+
+typedef struct {
+	alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;	//!< Serialises operations for owners in this stripe.
+	ippool_slot_t		*slots;		//!< Open addressed, linear probing.
+	uint32_t		mask;		//!< Number of slots - 1.
+} ippool_stripe_t;
+
+struct ippool_s {
+	uint32_t		start;		//!< First address in the pool (host byte order).
+	uint32_t		num;		//!< Number of addresses in the pool.
+	uint32_t		words;		//!< Number of words in the bitmap.
+	uint64_t		last_mask;	//!< Valid bits in the last word of the bitmap.
+
+	_Atomic(uint64_t)	*bitmap;	//!< One bit per address, set if the address is in use.
+	ippool_lease_t		*leases;	//!< One per address.
+
+	ippool_stripe_t		stripes[IPPOOL_STRIPES];
+
+	alignas(CACHE_LINE_SIZE) _Atomic(uint64_t) seq;	//!< Next journal sequence number.
+	_Atomic(uint32_t)	used;		//!< Number of addresses with their bit set.
+	_Atomic(int64_t)	next_snapshot;	//!< When the next snapshot should be written.
+
+	char const		*filename;	//!< Journal, or NULL if the pool isn't persisted.
+	char const		*old_filename;	//!< Journal being replaced by a snapshot.
+	char const		*snapshot_filename;
+
+	pthread_mutex_t		journal_mutex;	//!< Serialises writes to the journal, and rotating it.
+	int			fd;		//!< Journal file descriptor.
+	pthread_mutex_t		snapshot_mutex;	//!< Only one snapshot may be written at a time.
+};
+
+struct ippool_thread_s {
+	ippool_t		*pool;		//!< This thread is using.
+	uint32_t		cursor;		//!< Where to start searching for free addresses.
+	size_t			used;		//!< Number of records in the buffer.
+	size_t			lost;		//!< Records which couldn't be written.
+	ippool_record_t		records[IPPOOL_THREAD_RECORDS];
+};
+
+typedef struct {
+	ippool_record_t		*records;
+	size_t			num;
+	uint64_t		seq_min;	//!< From the snapshot.
+	uint64_t		seq_max;	//!< Highest sequence number seen.
+} ippool_replay_t;
+
+/** Hash a lease owner
+ *
+ * The low bits select the stripe, the high bits the slot within the stripe.
+ *
+ * @param[in] owner	Identifier of the device, usually its MAC address.
+ * @param[in] owner_len	Length of the identifier.
+ * @return A 64bit hash, which is never OWNER_EMPTY or OWNER_TOMBSTONE.
+ */
+uint64_t ippool_owner(uint8_t const *owner, size_t owner_len)
+{
+	uint32_t	hash = fr_hash(owner, owner_len);
+	uint64_t	ret;
+
+	ret = ((uint64_t)hash << 32) | fr_hash_update(owner, owner_len, hash);
+	if ((ret == OWNER_EMPTY) || (ret == OWNER_TOMBSTONE)) ret = 1;
+
+	return ret;
+}
+
+static inline CC_HINT(always_inline) ippool_stripe_t *owner_stripe(ippool_t *pool, uint64_t owner)
+{
+	return &pool->stripes[owner & (IPPOOL_STRIPES - 1)];
+}
+
+static inline CC_HINT(always_inline) bool slot_live(ippool_t *pool, ippool_slot_t const *slot)
+{
+	if ((slot->owner == OWNER_EMPTY) || (slot->owner == OWNER_TOMBSTONE)) return false;
+
+	return atomic_load_explicit(&pool->leases[slot->idx].owner, memory_order_acquire) == slot->owner;
+}
+
+/** Find the lease held by an owner
+ *
+ * @note The stripe mutex must be held.
+ */
+static uint32_t owner_find(ippool_t *pool, ippool_stripe_t *stripe, uint64_t owner)
+{
+	uint32_t	i, pos = (uint32_t)(owner >> 32) & stripe->mask;
+
+	for (i = 0; i <= stripe->mask; i++, pos = (pos + 1) & stripe->mask) {
+		ippool_slot_t *slot = &stripe->slots[pos];
+
+		if (slot->owner == OWNER_EMPTY) break;
+		if (slot->owner != owner) continue;
+
+		/*
+		 *	Each owner has at most one slot.  If its lease
+		 *	was reclaimed by someone else, the slot is stale.
+		 */
+		if (!slot_live(pool, slot)) {
+			slot->owner = OWNER_TOMBSTONE;
+			break;
+		}
+
+		return slot->idx;
+	}
+
+	return UINT32_MAX;
+}
+
+static void owner_insert(ippool_t *pool, ippool_stripe_t *stripe, uint64_t owner, uint32_t idx);
+
+/** Remove stale slots and tombstones from a stripe, growing it if it's more than half full
+ *
+ */
+static void owner_rebuild(ippool_t *pool, ippool_stripe_t *stripe)
+{
+	ippool_slot_t	*old = stripe->slots;
+	uint32_t	i, live = 0, old_size = stripe->mask + 1, size = old_size;
+
+	for (i = 0; i < old_size; i++) if (slot_live(pool, &old[i])) live++;
+	if ((live * 2) >= size) size *= 2;
+
+	MEM(stripe->slots = talloc_zero_array(pool, ippool_slot_t, size));
+	stripe->mask = size - 1;
+
+	for (i = 0; i < old_size; i++) {
+		if (slot_live(pool, &old[i])) owner_insert(pool, stripe, old[i].owner, old[i].idx);
+	}
+
+	talloc_free(old);
+}
+
+/** Record the lease held by an owner
+ *
+ * @note The stripe mutex must be held.
+ */
+static void owner_insert(ippool_t *pool, ippool_stripe_t *stripe, uint64_t owner, uint32_t idx)
+{
+	uint32_t	i, pos;
+	ippool_slot_t	*reuse;
+
+again:
+	reuse = NULL;
+	pos = (uint32_t)(owner >> 32) & stripe->mask;
+
+	for (i = 0; i <= stripe->mask; i++, pos = (pos + 1) & stripe->mask) {
+		ippool_slot_t *slot = &stripe->slots[pos];
+
+		if (slot->owner == owner) {
+			slot->idx = idx;
+			return;
+		}
+
+		if (slot->owner == OWNER_EMPTY) {
+			if (!reuse) reuse = slot;
+			break;
+		}
+
+		if (!reuse && !slot_live(pool, slot)) reuse = slot;
+	}
+
+	if (!reuse) {
+		owner_rebuild(pool, stripe);
+		goto again;
+	}
+
+	reuse->owner = owner;
+	reuse->idx = idx;
+}
+
+/** Add a record to the thread's journal buffer
+ *
+ * Must be called after the lease has been changed, so that the
+ * sequence numbers of changes to the same lease are in order.
+ */
+static inline CC_HINT(always_inline) void journal_add(ippool_thread_t *thread, ippool_op_t op,
+						      uint32_t idx, uint64_t owner, int64_t expires)
+{
+	ippool_t	*pool = thread->pool;
+	ippool_record_t	*rec;
+
+	if (!pool->filename) return;
+
+	if (thread->used == NUM_ELEMENTS(thread->records)) (void) ippool_thread_flush(thread);
+
+	rec = &thread->records[thread->used++];
+	rec->seq = atomic_fetch_add_explicit(&pool->seq, 1, memory_order_relaxed);
+	rec->owner = owner;
+	rec->expires = expires;
+	rec->idx = idx;
+	rec->op = op;
+}
+
+/** Claim a free address
+ *
+ */
+static inline CC_HINT(always_inline) bool lease_claim_free(ippool_t *pool, uint32_t idx)
+{
+	uint64_t bit = (uint64_t)1 << (idx & 63);
+
+	if (atomic_fetch_or_explicit(&pool->bitmap[idx >> 6], bit, memory_order_acq_rel) & bit) return false;
+
+	atomic_fetch_add_explicit(&pool->used, 1, memory_order_relaxed);
+	return true;
+}
+
+/** Claim an address whose lease has expired
+ *
+ */
+static inline CC_HINT(always_inline) bool lease_claim_expired(ippool_t *pool, uint32_t idx, int64_t now)
+{
+	int64_t expires = atomic_load_explicit(&pool->leases[idx].expires, memory_order_acquire);
+
+	if ((expires == 0) || (expires > now)) return false;
+
+	return atomic_compare_exchange_strong_explicit(&pool->leases[idx].expires, &expires, 0,
+						       memory_order_acq_rel, memory_order_relaxed);
+}
+
+/** Set the owner and expiry of a lease we've just claimed
+ *
+ */
+static inline CC_HINT(always_inline) void lease_set(ippool_thread_t *thread, uint32_t idx, uint64_t owner, int64_t expires)
+{
+	ippool_lease_t *lease = &thread->pool->leases[idx];
+
+	atomic_store_explicit(&lease->owner, owner, memory_order_release);
+	atomic_store_explicit(&lease->expires, expires, memory_order_release);
+
+	journal_add(thread, IPPOOL_OP_SET, idx, owner, expires);
+}
+
+/** Change the expiry time of a lease held by owner
+ *
+ * @return
+ *	- true if the lease was updated.
+ *	- false if the lease is no longer held by owner.
+ */
+static bool lease_extend(ippool_thread_t *thread, uint32_t idx, uint64_t owner, int64_t expires)
+{
+	ippool_lease_t	*lease = &thread->pool->leases[idx];
+	int64_t		current = atomic_load_explicit(&lease->expires, memory_order_acquire);
+
+	do {
+		if (current == 0) return false;
+		if (atomic_load_explicit(&lease->owner, memory_order_acquire) != owner) return false;
+	} while (!atomic_compare_exchange_weak_explicit(&lease->expires, &current, expires,
+							memory_order_acq_rel, memory_order_acquire));
+
+	journal_add(thread, IPPOOL_OP_SET, idx, owner, expires);
+
+	return true;
+}
+
+/** Find and claim a free address, starting at the thread's cursor
+ *
+ */
+static uint32_t lease_find_free(ippool_thread_t *thread)
+{
+	ippool_t	*pool = thread->pool;
+	uint32_t	i, w = thread->cursor >> 6;
+
+	for (i = 0; i < pool->words; i++, w = ((w + 1) == pool->words) ? 0 : w + 1) {
+		uint64_t valid = ((w + 1) == pool->words) ? pool->last_mask : UINT64_MAX;
+		uint64_t used = atomic_load_explicit(&pool->bitmap[w], memory_order_relaxed);
+
+		while ((used & valid) != valid) {
+			uint64_t	bit = ~used & valid;
+			uint32_t	idx;
+
+			bit &= -bit;	/* Lowest free bit */
+
+			used = atomic_fetch_or_explicit(&pool->bitmap[w], bit, memory_order_acq_rel);
+			if (used & bit) continue;	/* Lost the race, try the next one */
+
+			atomic_fetch_add_explicit(&pool->used, 1, memory_order_relaxed);
+
+			idx = (w << 6) + (fr_low_bit_pos(bit) - 1);
+			thread->cursor = ((idx + 1) == pool->num) ? 0 : idx + 1;
+			return idx;
+		}
+	}
+
+	return UINT32_MAX;
+}
+
+/** Find and claim an address with an expired lease, starting at the thread's cursor
+ *
+ * Only used when there are no free addresses.
+ */
+static uint32_t lease_find_expired(ippool_thread_t *thread, int64_t now)
+{
+	ippool_t	*pool = thread->pool;
+	uint32_t	i, idx = thread->cursor;
+
+	for (i = 0; i < pool->num; i++, idx = ((idx + 1) == pool->num) ? 0 : idx + 1) {
+		if (!lease_claim_expired(pool, idx, now)) continue;
+
+		thread->cursor = ((idx + 1) == pool->num) ? 0 : idx + 1;
+		return idx;
+	}
+
+	return UINT32_MAX;
+}
+
+/** Allocate an address for an owner
+ *
+ * If the owner already has a lease, its expiry time is updated, and the
+ * same address is returned.  Otherwise the requested address is used if
+ * it's free or expired, or the next free or expired address is allocated.
+ *
+ * @param[out] out		Allocated address (host byte order).
+ * @param[in] thread		Per-thread pool handle.
+ * @param[in] owner		Hash of the owner, from #ippool_owner.
+ * @param[in] requested		Address the device asked for, or 0.
+ * @param[in] now		Current unix time.
+ * @param[in] expires		Unix time the lease should expire.
+ * @return
+ *	- IPPOOL_RCODE_SUCCESS.
+ *	- IPPOOL_RCODE_POOL_EMPTY if there are no free or expired addresses.
+ */
+ippool_rcode_t ippool_allocate(uint32_t *out, ippool_thread_t *thread,
+			       uint64_t owner, uint32_t requested, int64_t now, int64_t expires)
+{
+	ippool_t	*pool = thread->pool;
+	ippool_stripe_t	*stripe = owner_stripe(pool, owner);
+	uint32_t	idx;
+
+	pthread_mutex_lock(&stripe->mutex);
+
+	idx = owner_find(pool, stripe, owner);
+	if ((idx != UINT32_MAX) && lease_extend(thread, idx, owner, expires)) goto done;
+
+	idx = requested - pool->start;	/* Wraps if requested is below the start */
+	if ((idx < pool->num) && (lease_claim_free(pool, idx) || lease_claim_expired(pool, idx, now))) goto claimed;
+
+	idx = lease_find_free(thread);
+	if (idx == UINT32_MAX) idx = lease_find_expired(thread, now);
+	if (idx == UINT32_MAX) {
+		pthread_mutex_unlock(&stripe->mutex);
+		return IPPOOL_RCODE_POOL_EMPTY;
+	}
+
+claimed:
+	lease_set(thread, idx, owner, expires);
+	owner_insert(pool, stripe, owner, idx);
+
+done:
+	pthread_mutex_unlock(&stripe->mutex);
+
+	*out = pool->start + idx;
+	return IPPOOL_RCODE_SUCCESS;
+}
+
+/** Update the expiry time of an existing lease
+ *
+ * @param[in] thread		Per-thread pool handle.
+ * @param[in] addr		Leased address (host byte order).
+ * @param[in] owner		Hash of the owner, from #ippool_owner.
+ * @param[in] now		Current unix time.
+ * @param[in] expires		Unix time the lease should expire.
+ * @return
+ *	- IPPOOL_RCODE_SUCCESS.
+ *	- IPPOOL_RCODE_NOT_FOUND if the address isn't in the pool.
+ *	- IPPOOL_RCODE_DEVICE_MISMATCH if another device holds the lease.
+ *	- IPPOOL_RCODE_EXPIRED if the lease isn't held by anyone.
+ */
+ippool_rcode_t ippool_update(ippool_thread_t *thread, uint32_t addr, uint64_t owner, int64_t now, int64_t expires)
+{
+	ippool_t	*pool = thread->pool;
+	ippool_stripe_t	*stripe = owner_stripe(pool, owner);
+	ippool_lease_t	*lease;
+	uint32_t	idx = addr - pool->start;
+	uint64_t	current;
+
+	if (idx >= pool->num) return IPPOOL_RCODE_NOT_FOUND;
+	lease = &pool->leases[idx];
+
+	pthread_mutex_lock(&stripe->mutex);
+
+	current = atomic_load_explicit(&lease->owner, memory_order_acquire);
+	if (current != owner) {
+		pthread_mutex_unlock(&stripe->mutex);
+
+		if ((current != OWNER_EMPTY) &&
+		    (atomic_load_explicit(&lease->expires, memory_order_acquire) > now)) return IPPOOL_RCODE_DEVICE_MISMATCH;
+
+		return IPPOOL_RCODE_EXPIRED;
+	}
+
+	if (!lease_extend(thread, idx, owner, expires)) {
+		pthread_mutex_unlock(&stripe->mutex);
+		return IPPOOL_RCODE_EXPIRED;
+	}
+	owner_insert(pool, stripe, owner, idx);
+
+	pthread_mutex_unlock(&stripe->mutex);
+
+	return IPPOOL_RCODE_SUCCESS;
+}
+
+/** Release a lease
+ *
+ * @param[in] thread		Per-thread pool handle.
+ * @param[in] addr		Leased address (host byte order).
+ * @param[in] owner		Hash of the owner, from #ippool_owner.
+ * @return
+ *	- IPPOOL_RCODE_SUCCESS.
+ *	- IPPOOL_RCODE_NOT_FOUND if the address isn't in the pool.
+ *	- IPPOOL_RCODE_DEVICE_MISMATCH if the lease isn't held by owner.
+ */
+ippool_rcode_t ippool_release(ippool_thread_t *thread, uint32_t addr, uint64_t owner)
+{
+	ippool_t	*pool = thread->pool;
+	ippool_stripe_t	*stripe = owner_stripe(pool, owner);
+	ippool_lease_t	*lease;
+	uint32_t	idx = addr - pool->start;
+	int64_t		expires;
+
+	if (idx >= pool->num) return IPPOOL_RCODE_NOT_FOUND;
+	lease = &pool->leases[idx];
+
+	pthread_mutex_lock(&stripe->mutex);
+
+	/*
+	 *	Swap the expiry for zero, so the lease can't be
+	 *	reclaimed whilst we're releasing it.
+	 */
+	expires = atomic_load_explicit(&lease->expires, memory_order_acquire);
+	do {
+		if ((expires == 0) || (atomic_load_explicit(&lease->owner, memory_order_acquire) != owner)) {
+			pthread_mutex_unlock(&stripe->mutex);
+			return IPPOOL_RCODE_DEVICE_MISMATCH;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&lease->expires, &expires, 0,
+							memory_order_acq_rel, memory_order_acquire));
+
+	atomic_store_explicit(&lease->owner, OWNER_EMPTY, memory_order_release);
+	atomic_fetch_and_explicit(&pool->bitmap[idx >> 6], ~((uint64_t)1 << (idx & 63)), memory_order_acq_rel);
+	atomic_fetch_sub_explicit(&pool->used, 1, memory_order_relaxed);
+
+	journal_add(thread, IPPOOL_OP_RELEASE, idx, owner, 0);
+
+	pthread_mutex_unlock(&stripe->mutex);
+
+	return IPPOOL_RCODE_SUCCESS;
+}
+
+/** Return the number of addresses which are allocated, including expired leases
+ *
+ */
+uint32_t ippool_num_used(ippool_t *pool)
+{
+	return atomic_load_explicit(&pool->used, memory_order_relaxed);
+}
+
+static inline CC_HINT(always_inline) void header_init(ippool_header_t *hdr, ippool_t *pool, uint64_t seq)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, IPPOOL_MAGIC, sizeof(hdr->magic));
+	hdr->version = IPPOOL_VERSION;
+	hdr->start = pool->start;
+	hdr->num = pool->num;
+	hdr->seq = seq;
+}
+
+/** Open the journal for appending, writing a header if it's new
+ *
+ * @note The journal mutex must be held, or the pool not yet in use.
+ */
+static int journal_open(ippool_t *pool)
+{
+	int		fd;
+	off_t		len;
+	ippool_header_t	hdr;
+
+	fd = open(pool->filename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening journal \"%s\": %s", pool->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	len = lseek(fd, 0, SEEK_END);
+	if (len == 0) {
+		header_init(&hdr, pool, 0);
+		if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+			fr_strerror_printf("Failed writing journal \"%s\": %s", pool->filename, fr_syserror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+
+	pool->fd = fd;
+	return 0;
+}
+
+/** Append the thread's buffered records to the journal
+ *
+ * @param[in] thread	to flush records for.
+ * @return
+ *	- 0 on success.
+ *	- -1 if records were lost.  The buffer is emptied either way.
+ */
+int ippool_thread_flush(ippool_thread_t *thread)
+{
+	ippool_t	*pool = thread->pool;
+	size_t		len = thread->used * sizeof(thread->records[0]);
+	ssize_t		slen = -1;
+	off_t		offset = -1;
+	int		ret = 0;
+
+	if (!thread->used) return 0;
+
+	pthread_mutex_lock(&pool->journal_mutex);
+	if (pool->fd >= 0) {
+		offset = lseek(pool->fd, 0, SEEK_END);
+		slen = write(pool->fd, thread->records, len);
+
+		/*
+		 *	Don't leave a partial record in the journal,
+		 *	it would misalign everything written after it.
+		 */
+		if ((slen >= 0) && ((size_t)slen != len) && (offset >= 0)) (void) ftruncate(pool->fd, offset);
+	}
+	pthread_mutex_unlock(&pool->journal_mutex);
+
+	if ((slen < 0) || ((size_t)slen != len)) {
+		thread->lost += thread->used;
+		fr_strerror_printf("Failed writing journal \"%s\": %s - %zu records lost",
+				   pool->filename, (slen < 0) ? fr_syserror(errno) : "Short write", thread->lost);
+		ret = -1;
+	}
+	thread->used = 0;
+
+	return ret;
+}
+
+/** Write a snapshot of all leases, and discard the journal
+ *
+ * The journal is renamed before the snapshot is written, so changes
+ * made whilst we're writing are recorded in a new journal.  Its records
+ * may also be reflected in the snapshot.  That's fine, replaying them is
+ * idempotent.
+ *
+ * @param[in] pool	to snapshot.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The journal is kept until a snapshot succeeds.
+ */
+int ippool_snapshot(ippool_t *pool)
+{
+	char		*tmp = NULL;
+	int		fd = -1, ret = -1;
+	uint32_t	idx;
+	ippool_header_t	hdr;
+	ippool_record_t	buff[1024];
+	size_t		used = 0;
+	uint64_t	seq;
+
+	if (!pool->filename) return 0;
+
+	pthread_mutex_lock(&pool->snapshot_mutex);
+
+	/*
+	 *	If the last snapshot failed, the old journal still
+	 *	has records we need, so don't overwrite it.  The
+	 *	current journal is kept too, as it's not rotated.
+	 */
+	pthread_mutex_lock(&pool->journal_mutex);
+	if (access(pool->old_filename, F_OK) < 0) {
+		if (pool->fd >= 0) {
+			close(pool->fd);
+			pool->fd = -1;
+		}
+
+		if ((rename(pool->filename, pool->old_filename) < 0) && (errno != ENOENT)) {
+			fr_strerror_printf("Failed renaming journal \"%s\": %s", pool->filename, fr_syserror(errno));
+			(void) journal_open(pool);
+			pthread_mutex_unlock(&pool->journal_mutex);
+			goto finish;
+		}
+	}
+	if ((pool->fd < 0) && (journal_open(pool) < 0)) {
+		pthread_mutex_unlock(&pool->journal_mutex);
+		goto finish;
+	}
+	pthread_mutex_unlock(&pool->journal_mutex);
+
+	/*
+	 *	Everything written to the old journal was changed
+	 *	before this point, so is reflected in the snapshot.
+	 */
+	seq = atomic_load_explicit(&pool->seq, memory_order_acquire);
+
+	MEM(tmp = talloc_asprintf(NULL, "%s.tmp", pool->snapshot_filename));
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening \"%s\": %s", tmp, fr_syserror(errno));
+		goto finish;
+	}
+
+	header_init(&hdr, pool, seq);
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+	error:
+		fr_strerror_printf("Failed writing \"%s\": %s", tmp, fr_syserror(errno));
+		goto finish;
+	}
+
+	for (idx = 0; idx < pool->num; idx++) {
+		ippool_lease_t	*lease = &pool->leases[idx];
+		ippool_record_t	*rec;
+		int64_t		expires;
+
+		/*
+		 *	Skip whole words of free addresses
+		 */
+		if (((idx & 63) == 0) && !atomic_load_explicit(&pool->bitmap[idx >> 6], memory_order_relaxed)) {
+			idx += 63;
+			continue;
+		}
+
+		expires = atomic_load_explicit(&lease->expires, memory_order_acquire);
+		if (expires == 0) continue;
+
+		rec = &buff[used++];
+		rec->seq = seq;
+		rec->owner = atomic_load_explicit(&lease->owner, memory_order_acquire);
+		rec->expires = expires;
+		rec->idx = idx;
+		rec->op = IPPOOL_OP_SET;
+
+		if (used == NUM_ELEMENTS(buff)) {
+			if (write(fd, buff, sizeof(buff)) != sizeof(buff)) goto error;
+			used = 0;
+		}
+	}
+
+	if (used && (write(fd, buff, used * sizeof(buff[0])) != (ssize_t)(used * sizeof(buff[0])))) goto error;
+
+	if (fsync(fd) < 0) goto error;
+
+	if (rename(tmp, pool->snapshot_filename) < 0) {
+		fr_strerror_printf("Failed renaming \"%s\": %s", tmp, fr_syserror(errno));
+		goto finish;
+	}
+
+	(void) unlink(pool->old_filename);
+	ret = 0;
+
+finish:
+	if (fd >= 0) close(fd);
+	if (tmp) {
+		if (ret < 0) (void) unlink(tmp);
+		talloc_free(tmp);
+	}
+
+	pthread_mutex_unlock(&pool->snapshot_mutex);
+
+	return ret;
+}
+
+/** Check whether a snapshot should be written
+ *
+ * Only returns true for one caller per interval.
+ *
+ * @param[in] pool	to check.
+ * @param[in] now	the current time.
+ * @param[in] interval	between snapshots.
+ * @return true if the caller should call #ippool_snapshot.
+ */
+bool ippool_snapshot_due(ippool_t *pool, fr_time_t now, fr_time_delta_t interval)
+{
+	int64_t next = atomic_load_explicit(&pool->next_snapshot, memory_order_relaxed);
+
+	if (!pool->filename) return false;
+
+	/*
+	 *	First call, we've just written a snapshot in ippool_load()
+	 */
+	if (next == 0) {
+		(void) atomic_compare_exchange_strong(&pool->next_snapshot, &next,
+						      fr_time_unwrap(fr_time_add(now, interval)));
+		return false;
+	}
+
+	if (fr_time_unwrap(now) < next) return false;
+
+	return atomic_compare_exchange_strong(&pool->next_snapshot, &next, fr_time_unwrap(fr_time_add(now, interval)));
+}
+
+static void record_apply(ippool_t *pool, ippool_record_t const *rec)
+{
+	ippool_lease_t	*lease = &pool->leases[rec->idx];
+	uint64_t	bit = (uint64_t)1 << (rec->idx & 63);
+
+	switch (rec->op) {
+	case IPPOOL_OP_SET:
+		atomic_fetch_or(&pool->bitmap[rec->idx >> 6], bit);
+		atomic_store(&lease->owner, rec->owner);
+		atomic_store(&lease->expires, rec->expires);
+		break;
+
+	/*
+	 *	The address may have been allocated to someone
+	 *	else before the release was written.
+	 */
+	case IPPOOL_OP_RELEASE:
+		if (atomic_load(&lease->owner) != rec->owner) break;
+
+		atomic_store(&lease->owner, OWNER_EMPTY);
+		atomic_store(&lease->expires, 0);
+		atomic_fetch_and(&pool->bitmap[rec->idx >> 6], ~bit);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/** Read a snapshot or journal file
+ *
+ * Snapshot records are applied immediately, journal records are added
+ * to the replay list, to be sorted.
+ */
+static int file_load(ippool_t *pool, ippool_replay_t *replay, char const *filename, bool snapshot)
+{
+	int		fd, ret = -1;
+	ippool_header_t	hdr;
+	ippool_record_t	buff[1024];
+	ssize_t		slen;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT) return 0;
+
+		fr_strerror_printf("Failed opening \"%s\": %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	slen = read(fd, &hdr, sizeof(hdr));
+	if (slen == 0) {
+		ret = 0;
+		goto finish;
+	}
+
+	if ((slen != sizeof(hdr)) || (memcmp(hdr.magic, IPPOOL_MAGIC, sizeof(hdr.magic)) != 0)) {
+		fr_strerror_printf("\"%s\" is not an ippool file", filename);
+		goto finish;
+	}
+
+	if (hdr.version != IPPOOL_VERSION) {
+		fr_strerror_printf("\"%s\" has version %u, expected %u", filename, hdr.version, IPPOOL_VERSION);
+		goto finish;
+	}
+
+	if (snapshot) replay->seq_min = hdr.seq;
+
+	while ((slen = read(fd, buff, sizeof(buff))) > 0) {
+		size_t i, num = (size_t)slen / sizeof(buff[0]);	/* Ignore any trailing partial record */
+
+		for (i = 0; i < num; i++) {
+			ippool_record_t rec = buff[i];
+
+			if ((rec.idx >= hdr.num) || ((rec.op != IPPOOL_OP_SET) && (rec.op != IPPOOL_OP_RELEASE))) continue;
+
+			/*
+			 *	The range may have changed since the
+			 *	file was written.  Keep the leases
+			 *	which are still in the pool.
+			 */
+			rec.idx = (hdr.start + rec.idx) - pool->start;
+			if (rec.idx >= pool->num) continue;
+
+			if (rec.seq > replay->seq_max) replay->seq_max = rec.seq;
+
+			if (snapshot) {
+				record_apply(pool, &rec);
+				continue;
+			}
+
+			if (rec.seq < replay->seq_min) continue;
+
+			if (replay->num == talloc_array_length(replay->records)) {
+				MEM(replay->records = talloc_realloc(pool, replay->records, ippool_record_t,
+								     replay->num ? replay->num * 2 : 1024));
+			}
+			replay->records[replay->num++] = rec;
+		}
+	}
+	if (slen < 0) {
+		fr_strerror_printf("Failed reading \"%s\": %s", filename, fr_syserror(errno));
+		goto finish;
+	}
+
+	ret = 0;
+
+finish:
+	close(fd);
+	return ret;
+}
+
+static int record_cmp(void const *one, void const *two)
+{
+	ippool_record_t const *a = one, *b = two;
+
+	return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+/** Restore the pool from the snapshot and journal, then write a new snapshot
+ *
+ * @param[in] pool	to restore.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int ippool_load(ippool_t *pool)
+{
+	ippool_replay_t	replay = {};
+	uint32_t	idx;
+	size_t		i;
+
+	if (!pool->filename) return 0;
+
+	if (file_load(pool, &replay, pool->snapshot_filename, true) < 0) return -1;
+
+	/*
+	 *	The old journal only exists if we stopped whilst
+	 *	writing a snapshot.
+	 */
+	if ((file_load(pool, &replay, pool->old_filename, false) < 0) ||
+	    (file_load(pool, &replay, pool->filename, false) < 0)) {
+		talloc_free(replay.records);
+		return -1;
+	}
+
+	/*
+	 *	Threads append their buffers to the journal
+	 *	independently, so the records aren't in order.
+	 */
+	if (replay.num) qsort(replay.records, replay.num, sizeof(replay.records[0]), record_cmp);
+	for (i = 0; i < replay.num; i++) record_apply(pool, &replay.records[i]);
+	talloc_free(replay.records);
+
+	atomic_store(&pool->seq, (replay.seq_max >= replay.seq_min) ? replay.seq_max + 1 : replay.seq_min);
+
+	/*
+	 *	Rebuild the owner index and usage count
+	 */
+	for (idx = 0; idx < pool->num; idx++) {
+		uint64_t owner;
+
+		if (!(atomic_load(&pool->bitmap[idx >> 6]) & ((uint64_t)1 << (idx & 63)))) continue;
+
+		owner = atomic_load(&pool->leases[idx].owner);
+		atomic_fetch_add(&pool->used, 1);
+		owner_insert(pool, owner_stripe(pool, owner), owner, idx);
+	}
+
+	/*
+	 *	Compact the journal
+	 */
+	return ippool_snapshot(pool);
+}
+
+static int _ippool_free(ippool_t *pool)
+{
+	size_t i;
+
+	if (pool->fd >= 0) close(pool->fd);
+
+	pthread_mutex_destroy(&pool->journal_mutex);
+	pthread_mutex_destroy(&pool->snapshot_mutex);
+	for (i = 0; i < NUM_ELEMENTS(pool->stripes); i++) pthread_mutex_destroy(&pool->stripes[i].mutex);
+
+	return 0;
+}
+
+/** Allocate an empty pool
+ *
+ * @param[in] ctx	to allocate the pool in.
+ * @param[in] start	first address in the pool (host byte order).
+ * @param[in] num	number of addresses in the pool.
+ * @param[in] filename	of the journal.  The snapshot is written to
+ *			"<filename>.snapshot".  May be NULL, in which
+ *			case the pool isn't persisted.
+ * @return
+ *	- A new pool.
+ *	- NULL on error.
+ */
+ippool_t *ippool_alloc(TALLOC_CTX *ctx, uint32_t start, uint32_t num, char const *filename)
+{
+	ippool_t	*pool;
+	size_t		i;
+	uint32_t	slots;
+
+	if ((num == 0) || (num > IPPOOL_MAX_LEASES)) {
+		fr_strerror_printf("Pool must contain between 1 and %u addresses", IPPOOL_MAX_LEASES);
+		return NULL;
+	}
+
+	if ((uint64_t)start + num > ((uint64_t)UINT32_MAX + 1)) {
+		fr_strerror_const("Pool extends past 255.255.255.255");
+		return NULL;
+	}
+
+	MEM(pool = talloc_zero(ctx, ippool_t));
+	pool->start = start;
+	pool->num = num;
+	pool->words = ROUND_UP_DIV(num, 64);
+	pool->last_mask = (num & 63) ? (((uint64_t)1 << (num & 63)) - 1) : UINT64_MAX;
+	pool->fd = -1;
+
+	MEM(pool->bitmap = talloc_zero_array(pool, _Atomic(uint64_t), pool->words));
+	MEM(pool->leases = talloc_zero_array(pool, ippool_lease_t, num));
+
+	/*
+	 *	Enough slots for each stripe to be at most a
+	 *	quarter full, if owners are evenly distributed.
+	 */
+	slots = ROUND_UP_DIV(num * 4, IPPOOL_STRIPES);
+	if (slots < 16) slots = 16;
+	slots = (uint32_t)1 << fr_high_bit_pos(slots - 1);
+
+	for (i = 0; i < NUM_ELEMENTS(pool->stripes); i++) {
+		pthread_mutex_init(&pool->stripes[i].mutex, NULL);
+		MEM(pool->stripes[i].slots = talloc_zero_array(pool, ippool_slot_t, slots));
+		pool->stripes[i].mask = slots - 1;
+	}
+
+	pthread_mutex_init(&pool->journal_mutex, NULL);
+	pthread_mutex_init(&pool->snapshot_mutex, NULL);
+	talloc_set_destructor(pool, _ippool_free);
+
+	if (filename) {
+		MEM(pool->filename = talloc_strdup(pool, filename));
+		MEM(pool->old_filename = talloc_asprintf(pool, "%s.old", filename));
+		MEM(pool->snapshot_filename = talloc_asprintf(pool, "%s.snapshot", filename));
+	}
+
+	return pool;
+}
+
+static int _ippool_thread_free(ippool_thread_t *thread)
+{
+	(void) ippool_thread_flush(thread);
+
+	return 0;
+}
+
+/** Allocate a per-thread handle for a pool
+ *
+ * Buffered journal records are flushed when the handle is freed.
+ */
+ippool_thread_t *ippool_thread_alloc(TALLOC_CTX *ctx, ippool_t *pool)
+{
+	ippool_thread_t *thread;
+
+	MEM(thread = talloc_zero(ctx, ippool_thread_t));
+	thread->pool = pool;
+	thread->cursor = fr_rand() % pool->num;
+	talloc_set_destructor(thread, _ippool_thread_free);
+
+	return thread;
+}
@@ -0,0 +1,70 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ippool.h
+ * @brief In-memory IPv4 address pool, persisted with a journal and snapshots.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSIDH(ippool_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+/** Maximum number of addresses in a single pool
+ *
+ * A /8.  Each lease uses around 48 bytes, including the owner index.
+ */
+#define IPPOOL_MAX_LEASES	(1 << 24)
+
+typedef enum {
+	IPPOOL_RCODE_SUCCESS = 0,		//!< Lease allocated, updated or released.
+	IPPOOL_RCODE_NOT_FOUND = -1,		//!< Address isn't in the pool.
+	IPPOOL_RCODE_EXPIRED = -2,		//!< Lease expired, and isn't owned by anyone.
+	IPPOOL_RCODE_DEVICE_MISMATCH = -3,	//!< Lease is owned by another device.
+	IPPOOL_RCODE_POOL_EMPTY = -4,		//!< No free, or expired addresses.
+	IPPOOL_RCODE_FAIL = -5			//!< Internal error.
+} ippool_rcode_t;
+
+typedef struct ippool_s ippool_t;
+typedef struct ippool_thread_s ippool_thread_t;
+
+ippool_t		*ippool_alloc(TALLOC_CTX *ctx, uint32_t start, uint32_t num, char const *filename);
+
+int			ippool_load(ippool_t *pool);
+
+int			ippool_snapshot(ippool_t *pool);
+
+bool			ippool_snapshot_due(ippool_t *pool, fr_time_t now, fr_time_delta_t interval);
+
+ippool_thread_t		*ippool_thread_alloc(TALLOC_CTX *ctx, ippool_t *pool);
+
+int			ippool_thread_flush(ippool_thread_t *thread);
+
+uint64_t		ippool_owner(uint8_t const *owner, size_t owner_len);
+
+ippool_rcode_t		ippool_allocate(uint32_t *out, ippool_thread_t *thread,
+					uint64_t owner, uint32_t requested, int64_t now, int64_t expires);
+
+ippool_rcode_t		ippool_update(ippool_thread_t *thread,
+				      uint32_t addr, uint64_t owner, int64_t now, int64_t expires);
+
+ippool_rcode_t		ippool_release(ippool_thread_t *thread, uint32_t addr, uint64_t owner);
+
+uint32_t		ippool_num_used(ippool_t *pool);
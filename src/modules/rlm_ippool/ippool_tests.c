@@ -0,0 +1,330 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for persisting the in-memory IPv4 address pool
+ *
+ * A restart is simulated by freeing the pool, without writing a final
+ * snapshot, and loading a new pool from the same files.
+ *
+ * @file src/modules/rlm_ippool/ippool_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/version.h>
+
+#include "ippool.c"
+
+#include <sys/stat.h>
+
+#define TEST_START	((uint32_t)0xc0a80001)	/* 192.168.0.1 */
+#define TEST_NUM	(8)
+
+static TALLOC_CTX	*autofree;
+static char		*test_dir;
+static char		*test_journal;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("ippool_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+}
+
+/** Create an empty directory for the journal and snapshot
+ *
+ */
+static void test_dir_alloc(void)
+{
+	test_dir = talloc_strdup(autofree, "/tmp/ippool_tests.XXXXXX");
+	TEST_ASSERT(mkdtemp(test_dir) != NULL);
+
+	test_journal = talloc_asprintf(autofree, "%s/ippool.journal", test_dir);
+}
+
+static void test_dir_free(void)
+{
+	char *cmd;
+
+	cmd = talloc_asprintf(autofree, "rm -rf %s", test_dir);
+	TEST_CHECK(system(cmd) == 0);
+	talloc_free(cmd);
+}
+
+/** Load a pool from the journal and snapshot
+ *
+ */
+static ippool_t *test_pool_load(uint32_t start, uint32_t num)
+{
+	ippool_t *pool;
+
+	pool = ippool_alloc(autofree, start, num, test_journal);
+	TEST_ASSERT(pool != NULL);
+
+	TEST_CHECK(ippool_load(pool) == 0);
+	if (fr_strerror_peek()) TEST_MSG("%s", fr_strerror());
+
+	return pool;
+}
+
+static uint64_t test_owner(char const *name)
+{
+	return ippool_owner((uint8_t const *)name, strlen(name));
+}
+
+static off_t test_file_size(char const *filename)
+{
+	struct stat buf;
+
+	if (stat(filename, &buf) < 0) return -1;
+
+	return buf.st_size;
+}
+
+/** Leases are restored from the journal if the server stops without writing a snapshot
+ *
+ */
+static void test_journal_replay(void)
+{
+	ippool_t	*pool;
+	ippool_thread_t	*t1, *t2;
+	uint32_t	addr, addr_b;
+	int64_t		now = time(NULL);
+	uint64_t	owner_a = test_owner("a"), owner_b = test_owner("b"), owner_c = test_owner("c");
+
+	test_dir_alloc();
+
+	pool = test_pool_load(TEST_START, TEST_NUM);
+	t1 = ippool_thread_alloc(autofree, pool);
+	t2 = ippool_thread_alloc(autofree, pool);
+
+	TEST_CHECK(ippool_allocate(&addr, t1, owner_a, TEST_START + 2, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(addr == TEST_START + 2);
+
+	TEST_CHECK(ippool_allocate(&addr_b, t2, owner_b, 0, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(addr_b != TEST_START + 2);
+
+	TEST_CHECK(ippool_allocate(&addr, t1, owner_c, TEST_START + 5, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(addr == TEST_START + 5);
+	TEST_CHECK(ippool_release(t2, TEST_START + 5, owner_c) == IPPOOL_RCODE_SUCCESS);
+
+	TEST_CHECK(ippool_update(t2, TEST_START + 2, owner_a, now, now + 120) == IPPOOL_RCODE_SUCCESS);
+
+	/*
+	 *	Write the later changes first, so the journal
+	 *	records are out of order.
+	 */
+	TEST_CHECK(ippool_thread_flush(t2) == 0);
+	TEST_CHECK(ippool_thread_flush(t1) == 0);
+	TEST_CHECK(ippool_num_used(pool) == 2);
+
+	talloc_free(t1);
+	talloc_free(t2);
+	talloc_free(pool);
+
+	TEST_CASE("Leases are restored after a restart");
+	pool = test_pool_load(TEST_START, TEST_NUM);
+	TEST_CHECK(ippool_num_used(pool) == 2);
+	TEST_MSG("Expected 2 leases, got %u", ippool_num_used(pool));
+
+	TEST_CASE("Updates are replayed");
+	TEST_CHECK(atomic_load(&pool->leases[2].expires) == now + 120);
+
+	TEST_CASE("Releases are replayed after the allocations they follow");
+	TEST_CHECK(atomic_load(&pool->leases[5].owner) == OWNER_EMPTY);
+
+	t1 = ippool_thread_alloc(autofree, pool);
+
+	TEST_CASE("Owners get the same address again");
+	TEST_CHECK(ippool_allocate(&addr, t1, owner_a, 0, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(addr == TEST_START + 2);
+	TEST_CHECK(ippool_allocate(&addr, t1, owner_b, 0, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(addr == addr_b);
+
+	TEST_CASE("Leases can only be released by their owner");
+	TEST_CHECK(ippool_release(t1, TEST_START + 2, owner_b) == IPPOOL_RCODE_DEVICE_MISMATCH);
+	TEST_CHECK(ippool_update(t1, TEST_START + 5, owner_c, now, now + 60) == IPPOOL_RCODE_EXPIRED);
+
+	talloc_free(t1);
+	talloc_free(pool);
+
+	test_dir_free();
+}
+
+/** Changes made after a snapshot are restored on top of it
+ *
+ */
+static void test_journal_snapshot(void)
+{
+	ippool_t	*pool;
+	ippool_thread_t	*t;
+	uint32_t	addr;
+	int64_t		now = time(NULL);
+	uint64_t	owner_a = test_owner("a"), owner_b = test_owner("b");
+	char		*snapshot;
+
+	test_dir_alloc();
+	snapshot = talloc_asprintf(autofree, "%s.snapshot", test_journal);
+
+	pool = test_pool_load(TEST_START, TEST_NUM);
+	t = ippool_thread_alloc(autofree, pool);
+
+	TEST_CHECK(ippool_allocate(&addr, t, owner_a, TEST_START, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(ippool_thread_flush(t) == 0);
+
+	TEST_CASE("A snapshot discards the journal");
+	TEST_CHECK(ippool_snapshot(pool) == 0);
+	TEST_CHECK(test_file_size(test_journal) == (off_t)sizeof(ippool_header_t));
+	TEST_CHECK(test_file_size(snapshot) == (off_t)(sizeof(ippool_header_t) + sizeof(ippool_record_t)));
+
+	TEST_CHECK(ippool_allocate(&addr, t, owner_b, TEST_START + 1, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(ippool_release(t, TEST_START, owner_a) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(ippool_thread_flush(t) == 0);
+	TEST_CHECK(test_file_size(test_journal) == (off_t)(sizeof(ippool_header_t) + (2 * sizeof(ippool_record_t))));
+
+	talloc_free(t);
+	talloc_free(pool);
+
+	TEST_CASE("The journal is replayed on top of the snapshot");
+	pool = test_pool_load(TEST_START, TEST_NUM);
+	TEST_CHECK(ippool_num_used(pool) == 1);
+	TEST_CHECK(atomic_load(&pool->leases[0].owner) == OWNER_EMPTY);
+	TEST_CHECK(atomic_load(&pool->leases[1].owner) == owner_b);
+
+	TEST_CASE("Loading compacts the journal into a new snapshot");
+	TEST_CHECK(test_file_size(test_journal) == (off_t)sizeof(ippool_header_t));
+	TEST_CHECK(test_file_size(snapshot) == (off_t)(sizeof(ippool_header_t) + sizeof(ippool_record_t)));
+
+	talloc_free(pool);
+
+	test_dir_free();
+}
+
+/** A journal left behind by an interrupted snapshot is replayed
+ *
+ */
+static void test_journal_interrupted(void)
+{
+	ippool_t	*pool;
+	ippool_thread_t	*t;
+	uint32_t	addr;
+	int64_t		now = time(NULL);
+	uint64_t	owner_a = test_owner("a"), owner_b = test_owner("b");
+	char		*old;
+
+	test_dir_alloc();
+	old = talloc_asprintf(autofree, "%s.old", test_journal);
+
+	pool = test_pool_load(TEST_START, TEST_NUM);
+	t = ippool_thread_alloc(autofree, pool);
+
+	TEST_CHECK(ippool_allocate(&addr, t, owner_a, TEST_START + 3, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(ippool_thread_flush(t) == 0);
+
+	/*
+	 *	Stop after the journal was rotated, but before
+	 *	the snapshot was written.
+	 */
+	TEST_CHECK(rename(test_journal, old) == 0);
+	close(pool->fd);
+	pool->fd = -1;
+	TEST_CHECK(journal_open(pool) == 0);
+
+	TEST_CHECK(ippool_allocate(&addr, t, owner_b, TEST_START + 4, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(ippool_thread_flush(t) == 0);
+
+	talloc_free(t);
+	talloc_free(pool);
+
+	TEST_CASE("Both journals are replayed");
+	pool = test_pool_load(TEST_START, TEST_NUM);
+	TEST_CHECK(ippool_num_used(pool) == 2);
+	TEST_CHECK(atomic_load(&pool->leases[3].owner) == owner_a);
+	TEST_CHECK(atomic_load(&pool->leases[4].owner) == owner_b);
+
+	TEST_CASE("The old journal is removed once the snapshot is written");
+	TEST_CHECK(test_file_size(old) < 0);
+
+	talloc_free(pool);
+
+	test_dir_free();
+}
+
+/** Leases keep their address if the range changes
+ *
+ */
+static void test_journal_range(void)
+{
+	ippool_t	*pool;
+	ippool_thread_t	*t;
+	uint32_t	addr;
+	int64_t		now = time(NULL);
+	uint64_t	owner_a = test_owner("a"), owner_b = test_owner("b");
+
+	test_dir_alloc();
+
+	pool = test_pool_load(TEST_START, TEST_NUM);
+	t = ippool_thread_alloc(autofree, pool);
+
+	TEST_CHECK(ippool_allocate(&addr, t, owner_a, TEST_START, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(ippool_allocate(&addr, t, owner_b, TEST_START + 6, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+
+	talloc_free(t);
+	talloc_free(pool);
+
+	TEST_CASE("Leases outside the new range are dropped");
+	pool = test_pool_load(TEST_START + 2, TEST_NUM);
+	TEST_CHECK(ippool_num_used(pool) == 1);
+
+	t = ippool_thread_alloc(autofree, pool);
+	TEST_CHECK(ippool_allocate(&addr, t, owner_b, 0, now, now + 60) == IPPOOL_RCODE_SUCCESS);
+	TEST_CHECK(addr == TEST_START + 6);
+
+	talloc_free(t);
+	talloc_free(pool);
+
+	test_dir_free();
+}
+
+TEST_LIST = {
+	{ "journal_replay",		test_journal_replay },
+	{ "journal_snapshot",		test_journal_snapshot },
+	{ "journal_interrupted",	test_journal_interrupted },
+	{ "journal_range",		test_journal_range },
+
+	{ NULL }
+};
@@ -0,0 +1,5 @@
+TARGET		:= ippool_tests$(E)
+SOURCES		:= ippool_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_PREREQS	:= libfreeradius-util$(L)
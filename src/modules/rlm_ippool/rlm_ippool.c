@@ -0,0 +1,560 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_ippool.c
+ * @brief Allocates IPv4 addresses from pools held in memory.
+ *
+ * Unlike rlm_sqlippool and rlm_redis_ippool, no external database is
+ * needed.  Each module instance holds a single pool, which is shared by
+ * all worker threads.  Leases are persisted with an append-only journal,
+ * and periodic snapshots.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX mctx->inst->name
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module_rlm.h>
+#include <freeradius-devel/dhcpv4/dhcpv4.h>
+#include <freeradius-devel/util/debug.h>
+
+#include "ippool.h"
+
+typedef enum {
+	POOL_ACTION_ALLOCATE = 1,
+	POOL_ACTION_UPDATE = 2,
+	POOL_ACTION_RELEASE = 3,
+	POOL_ACTION_BULK_RELEASE = 4,
+} ippool_action_t;
+
+typedef struct {
+	fr_ipaddr_t		range_start;	//!< First address in the pool.
+	fr_ipaddr_t		range_end;	//!< Last address in the pool.
+
+	tmpl_t			*owner;		//!< Unique lease owner identifier.  Could be mac-address
+						//!< or a combination of User-Name and something
+						//!< unique to the device.
+
+	fr_time_delta_t		offer_time;	//!< How long an offered address is reserved for.
+	fr_time_delta_t		lease_time;	//!< How long a lease lasts.
+
+	tmpl_t			*requested_address;	//!< Attribute to read the IP for renewal from.
+
+	tmpl_t			*allocated_address_attr;	//!< IP attribute and destination.
+
+	tmpl_t			*expiry_attr;	//!< Attribute to write the lease time to.
+
+	bool			copy_on_update; //!< Copy the requested address to the
+						//!< allocated_address_attr if updates are successful.
+
+	char const		*journal;	//!< Journal file.  If not set the pool isn't persisted.
+	fr_time_delta_t		flush_interval;	//!< How often each thread writes to the journal.
+	fr_time_delta_t		snapshot_interval;	//!< How often the pool is written to the snapshot.
+
+	ippool_t		*pool;		//!< Shared by all threads.
+} rlm_ippool_t;
+
+typedef struct {
+	module_thread_inst_ctx_t *mctx;		//!< Copy of the thread instantiation ctx, for the timer.
+	ippool_thread_t		*thread;	//!< Our handle for the pool.
+	fr_event_timer_t const	*ev;		//!< Flush timer.
+} rlm_ippool_thread_t;
+
+static CONF_PARSER journal_config[] = {
+	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT, rlm_ippool_t, journal) },
+	{ FR_CONF_OFFSET("flush_interval", FR_TYPE_TIME_DELTA, rlm_ippool_t, flush_interval), .dflt = "0.1" },
+	{ FR_CONF_OFFSET("snapshot_interval", FR_TYPE_TIME_DELTA, rlm_ippool_t, snapshot_interval), .dflt = "300" },
+	CONF_PARSER_TERMINATOR
+};
+
+static CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("range_start", FR_TYPE_IPV4_ADDR | FR_TYPE_REQUIRED, rlm_ippool_t, range_start) },
+	{ FR_CONF_OFFSET("range_end", FR_TYPE_IPV4_ADDR | FR_TYPE_REQUIRED, rlm_ippool_t, range_end) },
+
+	{ FR_CONF_OFFSET("owner", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_ippool_t, owner) },
+
+	{ FR_CONF_OFFSET("offer_time", FR_TYPE_TIME_DELTA, rlm_ippool_t, offer_time) },
+	{ FR_CONF_OFFSET("lease_time", FR_TYPE_TIME_DELTA | FR_TYPE_REQUIRED, rlm_ippool_t, lease_time) },
+
+	{ FR_CONF_OFFSET("requested_address", FR_TYPE_TMPL, rlm_ippool_t, requested_address), .dflt = "%{%{Requested-IP-Address}:-%{Client-IP-Address}}", .quote = T_DOUBLE_QUOTED_STRING },
+	{ FR_CONF_OFFSET("allocated_address_attr", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE, rlm_ippool_t, allocated_address_attr), .dflt = "&reply.Your-IP-Address", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("expiry_attr", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE, rlm_ippool_t, expiry_attr) },
+
+	{ FR_CONF_OFFSET("copy_on_update", FR_TYPE_BOOL, rlm_ippool_t, copy_on_update), .dflt = "yes", .quote = T_BARE_WORD },
+
+	{ FR_CONF_POINTER("journal", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) journal_config },
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t const *dict_freeradius;
+static fr_dict_t const *dict_radius;
+static fr_dict_t const *dict_dhcpv4;
+
+extern fr_dict_autoload_t rlm_ippool_dict[];
+fr_dict_autoload_t rlm_ippool_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ .out = &dict_radius, .proto = "radius" },
+	{ .out = &dict_dhcpv4, .proto = "dhcpv4" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_pool_action;
+static fr_dict_attr_t const *attr_acct_status_type;
+static fr_dict_attr_t const *attr_message_type;
+
+extern fr_dict_attr_autoload_t rlm_ippool_dict_attr[];
+fr_dict_attr_autoload_t rlm_ippool_dict_attr[] = {
+	{ .out = &attr_pool_action, .name = "IP-Pool.Action", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+	{ .out = &attr_acct_status_type, .name = "Acct-Status-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_message_type, .name = "Message-Type", .type = FR_TYPE_UINT8, .dict = &dict_dhcpv4 },
+	{ NULL }
+};
+
+static fr_value_box_t const	*enum_acct_status_type_start;
+static fr_value_box_t const	*enum_acct_status_type_interim_update;
+static fr_value_box_t const	*enum_acct_status_type_stop;
+static fr_value_box_t const	*enum_acct_status_type_on;
+static fr_value_box_t const	*enum_acct_status_type_off;
+
+extern fr_dict_enum_autoload_t rlm_ippool_dict_enum[];
+fr_dict_enum_autoload_t rlm_ippool_dict_enum[] = {
+	{ .out = &enum_acct_status_type_start, .name = "Start", .attr = &attr_acct_status_type },
+	{ .out = &enum_acct_status_type_interim_update, .name = "Interim-Update", .attr = &attr_acct_status_type },
+	{ .out = &enum_acct_status_type_stop, .name = "Stop", .attr = &attr_acct_status_type },
+	{ .out = &enum_acct_status_type_on, .name = "Accounting-On", .attr = &attr_acct_status_type },
+	{ .out = &enum_acct_status_type_off, .name = "Accounting-Off", .attr = &attr_acct_status_type },
+	{ NULL }
+};
+
+/** Write the allocated address, and the lease time, to the request
+ *
+ */
+static int ippool_reply(rlm_ippool_t const *inst, request_t *request, uint32_t addr, fr_time_delta_t lease_time)
+{
+	fr_pair_t *vp;
+
+	if (tmpl_find_or_add_vp(&vp, request, inst->allocated_address_attr) < 0) {
+		REDEBUG("Failed adding %s", inst->allocated_address_attr->name);
+		return -1;
+	}
+	vp->vp_ip = (fr_ipaddr_t){ .af = AF_INET, .prefix = 32, .addr.v4.s_addr = htonl(addr) };
+
+	if (!inst->expiry_attr) return 0;
+
+	if (tmpl_find_or_add_vp(&vp, request, inst->expiry_attr) < 0) {
+		REDEBUG("Failed adding %s", inst->expiry_attr->name);
+		return -1;
+	}
+	vp->vp_uint32 = fr_time_delta_to_sec(lease_time);
+
+	return 0;
+}
+
+/** Get the address the device asked for
+ *
+ * @return
+ *	- 1 if an address was found.
+ *	- 0 if no address was provided.
+ *	- -1 on error.
+ */
+static int ippool_requested_address(uint32_t *out, rlm_ippool_t const *inst, request_t *request)
+{
+	char			buff[INET6_ADDRSTRLEN + 4];
+	fr_value_box_t const	*box;
+	fr_value_box_t		ipv4;
+
+	if (tmpl_expand(&box, buff, sizeof(buff), request, inst->requested_address, NULL, NULL) < 0) return 0;
+
+	if (box->type != FR_TYPE_IPV4_ADDR) {
+		if ((box->type == FR_TYPE_STRING) && (box->vb_length == 0)) return 0;
+
+		if (fr_value_box_cast(NULL, &ipv4, FR_TYPE_IPV4_ADDR, NULL, box) < 0) {
+			RPEDEBUG("Failed parsing requested address");
+			return -1;
+		}
+		box = &ipv4;
+	}
+
+	*out = ntohl(box->vb_ip.addr.v4.s_addr);
+	return 1;
+}
+
+static unlang_action_t mod_action(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				  ippool_action_t action)
+{
+	rlm_ippool_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_ippool_t);
+	rlm_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_ippool_thread_t);
+	uint8_t			owner_buff[256];
+	uint8_t const		*owner;
+	ssize_t			slen;
+	uint64_t		owner_hash;
+	uint32_t		addr = 0;
+	int64_t			now = fr_unix_time_to_sec(fr_time_to_unix_time(request->packet->timestamp));
+	int			ret;
+
+	slen = tmpl_expand(&owner, owner_buff, sizeof(owner_buff), request, inst->owner, NULL, NULL);
+	if (slen < 0) {
+		REDEBUG("Failed expanding owner (%s)", inst->owner->name);
+		RETURN_MODULE_FAIL;
+	}
+	if (slen == 0) {
+		RDEBUG2("Empty owner.  Doing nothing");
+		RETURN_MODULE_NOOP;
+	}
+	owner_hash = ippool_owner(owner, (size_t)slen);
+
+	ret = ippool_requested_address(&addr, inst, request);
+	if (ret < 0) RETURN_MODULE_FAIL;
+
+	switch (action) {
+	case POOL_ACTION_ALLOCATE:
+		switch (ippool_allocate(&addr, t->thread, owner_hash, addr, now,
+					now + fr_time_delta_to_sec(inst->offer_time))) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("IP address %pV allocated", fr_box_ipaddr(((fr_ipaddr_t){ .af = AF_INET, .prefix = 32,
+											 .addr.v4.s_addr = htonl(addr) })));
+			if (ippool_reply(inst, request, addr, inst->offer_time) < 0) RETURN_MODULE_FAIL;
+			RETURN_MODULE_UPDATED;
+
+		case IPPOOL_RCODE_POOL_EMPTY:
+			RWDEBUG("Pool contains no free addresses");
+			RETURN_MODULE_NOTFOUND;
+
+		default:
+			RETURN_MODULE_FAIL;
+		}
+
+	case POOL_ACTION_UPDATE:
+		if (ret == 0) {
+			REDEBUG("No requested address (%s)", inst->requested_address->name);
+			RETURN_MODULE_INVALID;
+		}
+
+		switch (ippool_update(t->thread, addr, owner_hash, now, now + fr_time_delta_to_sec(inst->lease_time))) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("Requested IP address lease updated");
+			if (inst->copy_on_update && (ippool_reply(inst, request, addr, inst->lease_time) < 0)) {
+				RETURN_MODULE_FAIL;
+			}
+			RETURN_MODULE_UPDATED;
+
+		/*
+		 *	It's useful to be able to identify the 'not found' case
+		 *	as we can relay to a server where the IP address might
+		 *	be found.  This extremely useful for migrations.
+		 */
+		case IPPOOL_RCODE_NOT_FOUND:
+			REDEBUG("Requested IP address is not a member of the pool");
+			RETURN_MODULE_NOTFOUND;
+
+		case IPPOOL_RCODE_EXPIRED:
+			REDEBUG("Requested IP address' lease already expired at time of renewal");
+			RETURN_MODULE_INVALID;
+
+		case IPPOOL_RCODE_DEVICE_MISMATCH:
+			REDEBUG("Requested IP address' lease allocated to another device");
+			RETURN_MODULE_INVALID;
+
+		default:
+			RETURN_MODULE_FAIL;
+		}
+
+	case POOL_ACTION_RELEASE:
+		if (ret == 0) {
+			REDEBUG("No requested address (%s)", inst->requested_address->name);
+			RETURN_MODULE_INVALID;
+		}
+
+		switch (ippool_release(t->thread, addr, owner_hash)) {
+		case IPPOOL_RCODE_SUCCESS:
+			RDEBUG2("IP address released");
+			RETURN_MODULE_UPDATED;
+
+		case IPPOOL_RCODE_NOT_FOUND:
+			REDEBUG("Requested IP address is not a member of the pool");
+			RETURN_MODULE_NOTFOUND;
+
+		case IPPOOL_RCODE_DEVICE_MISMATCH:
+			REDEBUG("Requested IP address' lease allocated to another device");
+			RETURN_MODULE_INVALID;
+
+		default:
+			RETURN_MODULE_FAIL;
+		}
+
+	case POOL_ACTION_BULK_RELEASE:
+		RDEBUG2("Bulk release not yet implemented");
+		RETURN_MODULE_NOOP;
+
+	default:
+		fr_assert(0);
+		RETURN_MODULE_FAIL;
+	}
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	fr_pair_t			*vp;
+
+	/*
+	 *	IP-Pool.Action override
+	 */
+	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
+	if (vp) return mod_action(p_result, mctx, request, vp->vp_uint32);
+
+	/*
+	 *	Otherwise, guess the action by Acct-Status-Type
+	 */
+	vp = fr_pair_find_by_da_idx(&request->request_pairs, attr_acct_status_type, 0);
+	if (!vp) {
+		RDEBUG2("Couldn't find &request.Acct-Status-Type or &control.IP-Pool.Action, doing nothing...");
+		RETURN_MODULE_NOOP;
+	}
+
+	if ((vp->vp_uint32 == enum_acct_status_type_start->vb_uint32) ||
+	    (vp->vp_uint32 == enum_acct_status_type_interim_update->vb_uint32)) {
+		return mod_action(p_result, mctx, request, POOL_ACTION_UPDATE);
+
+	} else if (vp->vp_uint32 == enum_acct_status_type_stop->vb_uint32) {
+		return mod_action(p_result, mctx, request, POOL_ACTION_RELEASE);
+
+	} else if ((vp->vp_uint32 == enum_acct_status_type_on->vb_uint32) ||
+		   (vp->vp_uint32 == enum_acct_status_type_off->vb_uint32)) {
+		return mod_action(p_result, mctx, request, POOL_ACTION_BULK_RELEASE);
+
+	}
+
+	RETURN_MODULE_NOOP;
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	fr_pair_t			*vp;
+
+	/*
+	 *	Unless it's overridden the default action is to allocate
+	 *	when called in Post-Auth.
+	 */
+	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
+	return mod_action(p_result, mctx, request, vp ? vp->vp_uint32 : POOL_ACTION_ALLOCATE);
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	fr_pair_t			*vp;
+	ippool_action_t			action = POOL_ACTION_ALLOCATE;
+
+	/*
+	 *	Unless it's overridden the default action is to allocate
+	 *	when called in Post-Auth.
+	 */
+	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
+	if (vp) {
+		if ((vp->vp_uint32 > 0) && (vp->vp_uint32 <= POOL_ACTION_BULK_RELEASE)) {
+			action = vp->vp_uint32;
+
+		} else {
+			RWDEBUG("Ignoring invalid action %d", vp->vp_uint32);
+			RETURN_MODULE_NOOP;
+		}
+
+	} else if (request->dict == dict_dhcpv4) {
+		vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_message_type, 0);
+		if (!vp) goto run;
+
+		if (vp->vp_uint8 == FR_DHCP_REQUEST) action = POOL_ACTION_UPDATE;
+	}
+
+run:
+	return mod_action(p_result, mctx, request, action);
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_request(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	fr_pair_t			*vp;
+
+	/*
+	 *	Unless it's overridden the default action is to update
+	 *	when called by DHCP request
+	 */
+	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
+	return mod_action(p_result, mctx, request, vp ? vp->vp_uint32 : POOL_ACTION_UPDATE);
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_release(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	fr_pair_t			*vp;
+
+	/*
+	 *	Unless it's overridden the default action is to release
+	 *	when called by DHCP release
+	 */
+	vp = fr_pair_find_by_da_idx(&request->control_pairs, attr_pool_action, 0);
+	return mod_action(p_result, mctx, request, vp ? vp->vp_uint32 : POOL_ACTION_RELEASE);
+}
+
+/** Write this thread's changes to the journal, and snapshot the pool if it's due
+ *
+ */
+static void _ippool_flush(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	rlm_ippool_thread_t		*t = talloc_get_type_abort(uctx, rlm_ippool_thread_t);
+	module_thread_inst_ctx_t const	*mctx = t->mctx;
+	rlm_ippool_t const		*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_ippool_t);
+
+	if (ippool_thread_flush(t->thread) < 0) PERROR("Failed flushing journal");
+
+	/*
+	 *	Only one thread will see the snapshot as due.
+	 */
+	if (ippool_snapshot_due(inst->pool, now, inst->snapshot_interval)) {
+		DEBUG2("Writing snapshot of %u leases", ippool_num_used(inst->pool));
+		if (ippool_snapshot(inst->pool) < 0) PERROR("Failed writing snapshot");
+	}
+
+	if (fr_event_timer_in(t, el, &t->ev, inst->flush_interval, _ippool_flush, t) < 0) {
+		PERROR("Failed re-arming journal flush timer");
+	}
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_ippool_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_ippool_t);
+	rlm_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_ippool_thread_t);
+
+	/*
+	 *	Create a copy of the mctx on the heap that we can
+	 *	use in the timer callback.
+	 */
+	MEM(t->mctx = talloc_zero(t, module_thread_inst_ctx_t));
+	memcpy(t->mctx, mctx, sizeof(*t->mctx));
+
+	t->thread = ippool_thread_alloc(t, inst->pool);
+
+	if (!inst->journal) return 0;
+
+	if (fr_event_timer_in(t, mctx->el, &t->ev, inst->flush_interval, _ippool_flush, t) < 0) {
+		PERROR("Failed inserting journal flush timer");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_ippool_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_ippool_thread_t);
+
+	if (ippool_thread_flush(t->thread) < 0) PERROR("Failed flushing journal");
+
+	return 0;
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_ippool_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_ippool_t);
+	CONF_SECTION	*conf = mctx->inst->conf;
+	uint32_t	start = ntohl(inst->range_start.addr.v4.s_addr);
+	uint32_t	end = ntohl(inst->range_end.addr.v4.s_addr);
+
+	fr_assert(tmpl_is_attr(inst->allocated_address_attr));
+
+	if (tmpl_da(inst->allocated_address_attr)->type != FR_TYPE_IPV4_ADDR) {
+		cf_log_err(conf, "allocated_address_attr must be an IPv4 address attribute");
+		return -1;
+	}
+
+	if (inst->expiry_attr && (tmpl_da(inst->expiry_attr)->type != FR_TYPE_UINT32)) {
+		cf_log_err(conf, "expiry_attr must be a 32bit integer attribute");
+		return -1;
+	}
+
+	if (end < start) {
+		cf_log_err(conf, "range_end must not be less than range_start");
+		return -1;
+	}
+
+	/*
+	 *	If we don't have a separate time specifically for offers
+	 *	just use the lease time.
+	 */
+	if (!fr_time_delta_ispos(inst->offer_time)) inst->offer_time = inst->lease_time;
+
+	FR_TIME_DELTA_BOUND_CHECK("flush_interval", inst->flush_interval, >=, fr_time_delta_from_msec(10));
+	FR_TIME_DELTA_BOUND_CHECK("flush_interval", inst->flush_interval, <=, fr_time_delta_from_sec(10));
+	FR_TIME_DELTA_BOUND_CHECK("snapshot_interval", inst->snapshot_interval, >=, fr_time_delta_from_sec(1));
+
+	inst->pool = ippool_alloc(inst, start, (end - start) + 1, inst->journal);
+	if (!inst->pool) {
+		cf_log_perr(conf, "Failed creating pool");
+		return -1;
+	}
+
+	if (ippool_load(inst->pool) < 0) {
+		cf_log_perr(conf, "Failed loading pool");
+		return -1;
+	}
+
+	if (inst->journal) INFO("Loaded %u leases from \"%s\"", ippool_num_used(inst->pool), inst->journal);
+
+	return 0;
+}
+
+/** Write a final snapshot, now all threads have flushed their journal records
+ *
+ */
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_ippool_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_ippool_t);
+
+	if (inst->pool && (ippool_snapshot(inst->pool) < 0)) PERROR("Failed writing snapshot");
+
+	return 0;
+}
+
+extern module_rlm_t rlm_ippool;
+module_rlm_t rlm_ippool = {
+	.common = {
+		.magic			= MODULE_MAGIC_INIT,
+		.name			= "ippool",
+		.type			= MODULE_TYPE_THREAD_SAFE,
+		.inst_size		= sizeof(rlm_ippool_t),
+		.config			= module_config,
+		.instantiate		= mod_instantiate,
+		.detach			= mod_detach,
+		.thread_inst_size	= sizeof(rlm_ippool_thread_t),
+		.thread_inst_type	= "rlm_ippool_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
+	},
+	.methods = {
+		[MOD_ACCOUNTING]	= mod_accounting,
+		[MOD_AUTHORIZE]		= mod_authorize,
+		[MOD_POST_AUTH]		= mod_post_auth,
+	},
+	.method_names = (module_method_names_t[]) {
+		{ .name1 = "recv",	.name2 = "Request",	.method = mod_request },
+		{ .name1 = "recv",	.name2 = "Confirm",	.method = mod_request },
+		{ .name1 = "recv",	.name2 = "Renew",	.method = mod_request },
+		{ .name1 = "recv",	.name2 = "Rebind",	.method = mod_request },
+		{ .name1 = "recv",	.name2 = "Release",	.method = mod_release },
+		MODULE_NAME_TERMINATOR
+	}
+};
@@ -0,0 +1,6 @@
+TARGETNAME	:= rlm_ippool
+
+TARGET		:= $(TARGETNAME)$(L)
+SOURCES		:= $(TARGETNAME).c ippool.c
+
+LOG_ID_LIB	= 62
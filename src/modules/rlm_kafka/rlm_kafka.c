@@ -19,18 +19,588 @@
  * @file rlm_kafka.c
  * @brief Kafka producer module
  *
+ * Each worker thread has its own producer.  Messages are queued with
+ * librdkafka, which batches and sends them from its own threads.
+ *
+ * Delivery reports, errors and log messages are placed on the
+ * producer's main queue.  librdkafka writes to a pipe when that queue
+ * becomes non-empty, and the read end of the pipe is watched by the
+ * worker's event loop, so all of the callbacks run in the worker
+ * thread, and requests waiting for delivery can be resumed directly.
+ *
  * @copyright 2022 Arran Cudbard-Bell (a.cudbardb@freeradius.org)
  */
 RCSID("$Id$")
 USES_APPLE_DEPRECATED_API
 
+#define LOG_PREFIX mctx->inst->name
+
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/kafka/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/misc.h>
+
+#include <syslog.h>
+#include <unistd.h>
+
+typedef struct {
+	char const		*name;			//!< Of the header.
+	tmpl_t			*value;			//!< Expanded to produce the value of the header.
+} rlm_kafka_header_t;
 
 typedef struct {
-	char const *foo;
+	char const		*topic;			//!< To produce messages to.
+	tmpl_t			*key;			//!< Expanded to produce the message key.
+							///< Used by the partitioner.
+	tmpl_t			*value;			//!< Expanded to produce the message value.
+							///< If NULL, the request pairs are encoded instead.
+	rlm_kafka_header_t	*headers;		//!< Expanded to produce the message headers.
+
+	bool			wait;			//!< Wait for the broker to acknowledge the message
+							///< before continuing.
+	fr_time_delta_t		flush_timeout;		//!< How long to wait for queued messages to be
+							///< delivered when a thread exits.
 } rlm_kafka_t;
 
+typedef struct {
+	module_thread_inst_ctx_t *mctx;			//!< Copy of the thread instantiation ctx, for callbacks.
+
+	rd_kafka_t		*rk;			//!< Producer handle.
+	rd_kafka_topic_t	*rkt;			//!< Topic handle.
+	rd_kafka_queue_t	*queue;			//!< Main queue of the producer.
+
+	int			fd[2];			//!< librdkafka writes to fd[1] when the main queue
+							///< becomes non-empty.  We watch fd[0].
+} rlm_kafka_thread_t;
+
+/** A message we're waiting for the delivery report for
+ *
+ * Allocated in the thread ctx, as the request may be cancelled before
+ * the delivery report arrives.
+ */
+typedef struct {
+	request_t		*request;		//!< To resume.  NULL if the request was cancelled.
+	rlm_rcode_t		rcode;			//!< Result of delivering the message.
+	bool			reported;		//!< The delivery report has been received, and
+							///< librdkafka no longer references the message.
+} rlm_kafka_msg_t;
+
+static const CONF_PARSER message_config[] = {
+	{ FR_CONF_OFFSET("topic", FR_TYPE_STRING | FR_TYPE_REQUIRED | FR_TYPE_NOT_EMPTY, rlm_kafka_t, topic) },
+	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL, rlm_kafka_t, key) },
+	{ FR_CONF_OFFSET("value", FR_TYPE_TMPL, rlm_kafka_t, value) },
+	{ FR_CONF_OFFSET("wait_for_delivery", FR_TYPE_BOOL, rlm_kafka_t, wait), .dflt = "no" },
+	{ FR_CONF_OFFSET("flush_timeout", FR_TYPE_TIME_DELTA, rlm_kafka_t, flush_timeout), .dflt = "5s" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Called by rd_kafka_poll() for every message which has been delivered, or has failed
+ *
+ */
+static void _kafka_delivery_report(UNUSED rd_kafka_t *rk, rd_kafka_message_t const *rkmessage, void *opaque)
+{
+	rlm_kafka_thread_t		*t = talloc_get_type_abort(opaque, rlm_kafka_thread_t);
+	module_thread_inst_ctx_t const	*mctx = t->mctx;
+	rlm_kafka_msg_t			*msg;
+	request_t			*request;
+
+	/*
+	 *	Fire and forget.  Nothing is waiting for the result.
+	 */
+	if (!rkmessage->_private) {
+		if (rkmessage->err) {
+			ERROR("Failed delivering message to topic \"%s\": %s",
+			      rd_kafka_topic_name(rkmessage->rkt), rd_kafka_err2str(rkmessage->err));
+		}
+		return;
+	}
+
+	msg = talloc_get_type_abort(rkmessage->_private, rlm_kafka_msg_t);
+	if (!msg->request) {
+		talloc_free(msg);
+		return;
+	}
+	request = msg->request;
+	msg->reported = true;
+
+	if (rkmessage->err) {
+		REDEBUG("Failed delivering message to topic \"%s\": %s",
+			rd_kafka_topic_name(rkmessage->rkt), rd_kafka_err2str(rkmessage->err));
+		msg->rcode = RLM_MODULE_FAIL;
+	} else {
+		RDEBUG2("Message delivered to topic \"%s\", partition %d, offset %" PRId64,
+			rd_kafka_topic_name(rkmessage->rkt), rkmessage->partition, rkmessage->offset);
+		msg->rcode = RLM_MODULE_OK;
+	}
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Called by rd_kafka_poll() for errors which aren't associated with a message
+ *
+ */
+static void _kafka_error(UNUSED rd_kafka_t *rk, int err, char const *reason, void *opaque)
+{
+	rlm_kafka_thread_t		*t = talloc_get_type_abort(opaque, rlm_kafka_thread_t);
+	module_thread_inst_ctx_t const	*mctx = t->mctx;
+
+	ERROR("%s: %s", rd_kafka_err2name(err), reason);
+}
+
+/** Called by rd_kafka_poll() with log messages from librdkafka
+ *
+ * "log.queue" is set, so these are served from the main queue,
+ * in the worker thread.
+ */
+static void _kafka_log(rd_kafka_t const *rk, int level, char const *fac, char const *buf)
+{
+	rlm_kafka_thread_t		*t = talloc_get_type_abort(rd_kafka_opaque(rk), rlm_kafka_thread_t);
+	module_thread_inst_ctx_t const	*mctx = t->mctx;
+
+	/*
+	 *	Levels are syslog levels
+	 */
+	if (level <= LOG_ERR) {
+		ERROR("%s: %s", fac, buf);
+	} else if (level == LOG_WARNING) {
+		WARN("%s: %s", fac, buf);
+	} else if (level < LOG_DEBUG) {
+		INFO("%s: %s", fac, buf);
+	} else {
+		DEBUG2("%s: %s", fac, buf);
+	}
+}
+
+/** Serve the callbacks on the main queue, when librdkafka tells us there's something there
+ *
+ */
+static void _kafka_io_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+	uint8_t			buffer[64];
+
+	/*
+	 *	Drain the pipe first, so that we don't miss a
+	 *	notification for events which are queued while
+	 *	we're polling.
+	 */
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+
+	/*
+	 *	We're only woken up when the queue goes from
+	 *	empty to non-empty, so we need to serve
+	 *	everything on it.
+	 */
+	while (rd_kafka_poll(t->rk, 0) > 0);
+}
+
+static void _kafka_io_error(fr_event_list_t *el, int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	rlm_kafka_thread_t		*t = talloc_get_type_abort(uctx, rlm_kafka_thread_t);
+	module_thread_inst_ctx_t const	*mctx = t->mctx;
+
+	ERROR("Failed reading from notification pipe: %s - Delivery reports will no longer be processed",
+	      fr_syserror(fd_errno));
+
+	(void) fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+}
+
+/** Encode the request pairs as "<attr> = <value>" lines
+ *
+ * Used when no "value" is configured.
+ */
+static ssize_t kafka_encode_pairs(TALLOC_CTX *ctx, char **out, request_t *request)
+{
+	fr_sbuff_t	*agg;
+	fr_pair_t	*vp;
+
+	FR_SBUFF_TALLOC_THREAD_LOCAL(&agg, 1024, SIZE_MAX);
+
+	for (vp = fr_pair_list_head(&request->request_pairs);
+	     vp;
+	     vp = fr_pair_list_next(&request->request_pairs, vp)) {
+		if (fr_pair_print(agg, NULL, vp) < 0) return -1;
+		if (fr_sbuff_in_char(agg, '\n') < 0) return -1;
+	}
+
+	MEM(*out = talloc_bstrndup(ctx, fr_sbuff_start(agg), fr_sbuff_used(agg)));
+
+	return fr_sbuff_used(agg);
+}
+
+static unlang_action_t mod_produce_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, UNUSED request_t *request)
+{
+	rlm_kafka_msg_t	*msg = talloc_get_type_abort(mctx->rctx, rlm_kafka_msg_t);
+	rlm_rcode_t	rcode = msg->rcode;
+
+	talloc_free(msg);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static void mod_produce_signal(module_ctx_t const *mctx, request_t *request, fr_state_signal_t action)
+{
+	rlm_kafka_msg_t	*msg = talloc_get_type_abort(mctx->rctx, rlm_kafka_msg_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	/*
+	 *	The delivery report has already been received, but
+	 *	the request was cancelled before it was resumed.
+	 *	Nothing else references the message.
+	 */
+	if (msg->reported) {
+		talloc_free(msg);
+		return;
+	}
+
+	RDEBUG2("Request cancelled, no longer waiting for delivery report");
+
+	/*
+	 *	The message is still owned by librdkafka, the
+	 *	delivery report callback will free it.
+	 */
+	msg->request = NULL;
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_produce(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_kafka_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_kafka_t);
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+	char			*key = NULL, *value = NULL;
+	ssize_t			key_len = 0, value_len;
+	rd_kafka_headers_t	*headers = NULL;
+	rlm_kafka_msg_t		*msg = NULL;
+	rd_kafka_resp_err_t	err;
+	size_t			i, num_headers = talloc_array_length(inst->headers);
+	bool			retried = false;
+
+	if (inst->key) {
+		key_len = tmpl_aexpand(request, &key, request, inst->key, NULL, NULL);
+		if (key_len < 0) {
+			RPEDEBUG("Failed expanding key");
+			RETURN_MODULE_FAIL;
+		}
+	}
+
+	if (inst->value) {
+		value_len = tmpl_aexpand(request, &value, request, inst->value, NULL, NULL);
+	} else {
+		value_len = kafka_encode_pairs(request, &value, request);
+	}
+	if (value_len < 0) {
+		RPEDEBUG("Failed creating message value");
+	error:
+		talloc_free(key);
+		talloc_free(value);
+		if (headers) rd_kafka_headers_destroy(headers);
+		RETURN_MODULE_FAIL;
+	}
+
+	if (num_headers) {
+		MEM(headers = rd_kafka_headers_new(num_headers));
+
+		for (i = 0; i < num_headers; i++) {
+			char	*header;
+			ssize_t	slen;
+
+			slen = tmpl_aexpand(request, &header, request, inst->headers[i].value, NULL, NULL);
+			if (slen < 0) {
+				RPEDEBUG("Failed expanding header \"%s\"", inst->headers[i].name);
+				goto error;
+			}
+
+			(void) rd_kafka_header_add(headers, inst->headers[i].name, -1, header, slen);
+			talloc_free(header);
+		}
+	}
+
+	if (inst->wait) {
+		MEM(msg = talloc_zero(t, rlm_kafka_msg_t));
+		msg->request = request;
+	}
+
+again:
+	/*
+	 *	Key and value are copied, the headers are owned
+	 *	by librdkafka if the call succeeds.
+	 */
+	err = rd_kafka_producev(t->rk,
+				RD_KAFKA_V_RKT(t->rkt),
+				RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
+				RD_KAFKA_V_KEY(key, (size_t)key_len),
+				RD_KAFKA_V_VALUE(value, (size_t)value_len),
+				RD_KAFKA_V_HEADERS(headers),
+				RD_KAFKA_V_OPAQUE(msg),
+				RD_KAFKA_V_END);
+	switch (err) {
+	case RD_KAFKA_RESP_ERR_NO_ERROR:
+		break;
+
+	/*
+	 *	Serve any outstanding delivery reports, which
+	 *	may free up space in the queue, then try once more.
+	 */
+	case RD_KAFKA_RESP_ERR__QUEUE_FULL:
+		if (!retried) {
+			retried = true;
+			while (rd_kafka_poll(t->rk, 0) > 0);
+			goto again;
+		}
+		FALL_THROUGH;
+
+	default:
+		REDEBUG("Failed queueing message for topic \"%s\": %s", inst->topic, rd_kafka_err2str(err));
+		talloc_free(msg);
+		goto error;
+	}
+
+	talloc_free(key);
+	talloc_free(value);
+
+	if (!msg) {
+		RDEBUG2("Message queued for topic \"%s\"", inst->topic);
+		RETURN_MODULE_OK;
+	}
+
+	RDEBUG2("Message queued for topic \"%s\", waiting for delivery report", inst->topic);
+
+	return unlang_module_yield(request, mod_produce_resume, mod_produce_signal, msg);
+}
+
+/** Parse the "header" section
+ *
+ * Each pair is a header name, and a template which is expanded to
+ * produce its value.
+ */
+static int kafka_headers_parse(rlm_kafka_t *inst, CONF_SECTION *cs)
+{
+	CONF_PAIR		*cp = NULL;
+	size_t			i = 0;
+	static tmpl_rules_t	rules = {
+					.attr = {
+						.allow_unknown = true,
+						.allow_unresolved = true,
+						.allow_foreign = true
+					}
+				};
+
+	if (cf_section_find_next(cs, NULL, CF_IDENT_ANY, CF_IDENT_ANY)) {
+		cf_log_err(cs, "Unexpected subsection in \"header\"");
+		return -1;
+	}
+
+	MEM(inst->headers = talloc_zero_array(inst, rlm_kafka_header_t, cf_pair_count(cs, CF_IDENT_ANY)));
+
+	while ((cp = cf_pair_find_next(cs, cp, CF_IDENT_ANY))) {
+		char const	*value = cf_pair_value(cp);
+		tmpl_t		*vpt;
+
+		if (!value) {
+			cf_log_err(cp, "Header \"%s\" must have a value", cf_pair_attr(cp));
+			return -1;
+		}
+
+		(void) tmpl_afrom_substr(inst->headers, &vpt, &FR_SBUFF_IN(value, strlen(value)),
+					 cf_pair_value_quote(cp),
+					 value_parse_rules_unquoted[cf_pair_value_quote(cp)],
+					 &rules);
+		if (!vpt) {
+			cf_log_perr(cp, "Failed parsing header \"%s\"", cf_pair_attr(cp));
+			return -1;
+		}
+		cf_pair_mark_parsed(cp);
+
+		inst->headers[i].name = cf_pair_attr(cp);
+		inst->headers[i].value = vpt;
+		i++;
+	}
+
+	return 0;
+}
+
+static int mod_bootstrap(module_inst_ctx_t const *mctx)
+{
+	rlm_kafka_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_kafka_t);
+	CONF_SECTION	*conf = mctx->inst->conf;
+	CONF_SECTION	*message, *header;
+
+	message = cf_section_find(conf, "message", NULL);
+	if (!message) {
+		cf_log_err(conf, "Missing \"message\" section");
+		return -1;
+	}
+
+	if ((cf_section_rules_push(message, message_config) < 0) ||
+	    (cf_section_parse(inst, inst, message) < 0)) return -1;
+
+	header = cf_section_find(message, "header", NULL);
+	if (header && (kafka_headers_parse(inst, header) < 0)) return -1;
+
+	return 0;
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_kafka_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_kafka_t);
+	CONF_SECTION	*conf = mctx->inst->conf;
+	size_t		i;
+
+	if (!fr_kafka_conf_find(conf)) {
+		cf_log_err(conf, "No kafka configuration found");
+		return -1;
+	}
+
+	/*
+	 *	Resolve attribute references and xlats, now that
+	 *	all the xlat functions have been registered.
+	 */
+	if (cf_section_parse_pass2(inst, cf_section_find(conf, "message", NULL)) < 0) return -1;
+
+	for (i = 0; i < talloc_array_length(inst->headers); i++) {
+		if (tmpl_resolve(inst->headers[i].value, NULL) < 0) {
+			cf_log_perr(conf, "Failed resolving header \"%s\"", inst->headers[i].name);
+			return -1;
+		}
+	}
+
+	FR_TIME_DELTA_BOUND_CHECK("flush_timeout", inst->flush_timeout, <=, fr_time_delta_from_sec(60));
+
+	return 0;
+}
+
+/** Destroy the producer, waiting for queued messages to be delivered
+ *
+ */
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_kafka_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_kafka_t);
+	rlm_kafka_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+
+	if (t->rk && (rd_kafka_flush(t->rk, fr_time_delta_to_msec(inst->flush_timeout)) != RD_KAFKA_RESP_ERR_NO_ERROR)) {
+		WARN("%d message(s) were not delivered before the producer was destroyed", rd_kafka_outq_len(t->rk));
+	}
+
+	if (t->queue) {
+		rd_kafka_queue_io_event_enable(t->queue, -1, NULL, 0);
+		rd_kafka_queue_destroy(t->queue);
+		t->queue = NULL;
+	}
+
+	if (t->fd[0] >= 0) {
+		(void) fr_event_fd_delete(mctx->el, t->fd[0], FR_EVENT_FILTER_IO);
+		close(t->fd[0]);
+		close(t->fd[1]);
+		t->fd[0] = t->fd[1] = -1;
+	}
+
+	if (t->rkt) {
+		rd_kafka_topic_destroy(t->rkt);
+		t->rkt = NULL;
+	}
+
+	if (t->rk) {
+		rd_kafka_destroy(t->rk);
+		t->rk = NULL;
+	}
+
+	return 0;
+}
+
+/** Create a producer for this thread
+ *
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_kafka_t const		*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_kafka_t);
+	rlm_kafka_thread_t		*t = talloc_get_type_abort(mctx->thread, rlm_kafka_thread_t);
+	fr_kafka_conf_t const		*kc = fr_kafka_conf_find(mctx->inst->conf);
+	fr_kafka_topic_conf_t const	*ktc = fr_kafka_topic_conf_find(mctx->inst->conf, inst->topic);
+	rd_kafka_conf_t			*conf;
+	rd_kafka_topic_conf_t		*topic_conf = NULL;
+	char				errstr[512];
+
+	t->fd[0] = t->fd[1] = -1;
+
+	/*
+	 *	Create a copy of the mctx on the heap that we can
+	 *	use in the librdkafka callbacks.
+	 */
+	MEM(t->mctx = talloc_zero(t, module_thread_inst_ctx_t));
+	memcpy(t->mctx, mctx, sizeof(*t->mctx));
+
+	if (!fr_cond_assert(kc)) return -1;
+
+	/*
+	 *	rd_kafka_new() takes ownership of the configuration,
+	 *	so each thread needs its own copy.
+	 */
+	MEM(conf = rd_kafka_conf_dup(kc->conf));
+	rd_kafka_conf_set_opaque(conf, t);
+	rd_kafka_conf_set_dr_msg_cb(conf, _kafka_delivery_report);
+	rd_kafka_conf_set_error_cb(conf, _kafka_error);
+	rd_kafka_conf_set_log_cb(conf, _kafka_log);
+
+	if (rd_kafka_conf_set(conf, "log.queue", "true", errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+		rd_kafka_conf_destroy(conf);
+		ERROR("Failed configuring producer: %s", errstr);
+		return -1;
+	}
+
+	t->rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+	if (!t->rk) {
+		rd_kafka_conf_destroy(conf);
+		ERROR("Failed creating producer: %s", errstr);
+		return -1;
+	}
+
+	/*
+	 *	Send log messages to the main queue, so they're
+	 *	served in this thread.
+	 */
+	(void) rd_kafka_set_log_queue(t->rk, NULL);
+
+	if (ktc) MEM(topic_conf = rd_kafka_topic_conf_dup(ktc->conf));
+	t->rkt = rd_kafka_topic_new(t->rk, inst->topic, topic_conf);
+	if (!t->rkt) {
+		if (topic_conf) rd_kafka_topic_conf_destroy(topic_conf);
+		ERROR("Failed creating topic \"%s\": %s", inst->topic, rd_kafka_err2str(rd_kafka_last_error()));
+	error:
+		mod_thread_detach(mctx);
+		return -1;
+	}
+
+	if (pipe(t->fd) < 0) {
+		ERROR("Failed creating notification pipe: %s", fr_syserror(errno));
+		t->fd[0] = t->fd[1] = -1;
+		goto error;
+	}
+
+	if ((fr_nonblock(t->fd[0]) < 0) || (fr_nonblock(t->fd[1]) < 0)) {
+		PERROR("Failed setting notification pipe to non-blocking");
+		goto error;
+	}
+
+	if (fr_event_fd_insert(t, mctx->el, t->fd[0],
+			       _kafka_io_read,
+			       NULL,
+			       _kafka_io_error,
+			       t) < 0) {
+		PERROR("Failed adding notification pipe to event loop");
+		goto error;
+	}
+
+	/*
+	 *	librdkafka writes a byte to the pipe whenever the
+	 *	main queue goes from empty to non-empty.
+	 */
+	MEM(t->queue = rd_kafka_queue_get_main(t->rk));
+	rd_kafka_queue_io_event_enable(t->queue, t->fd[1], "1", 1);
+
+	return 0;
+}
+
 /*
  *	The module name should be the only globally exported symbol.
  *	That is, everything else should be 'static'.
@@ -43,9 +613,21 @@ typedef struct {
 extern module_rlm_t rlm_kafka;
 module_rlm_t rlm_kafka = {
 	.common = {
-		.magic		= MODULE_MAGIC_INIT,
-		.name		= "kafka",
-		.inst_size	= sizeof(rlm_kafka_t),
-		.config		= kafka_base_producer_config,
+		.magic			= MODULE_MAGIC_INIT,
+		.name			= "kafka",
+		.type			= MODULE_TYPE_THREAD_SAFE,
+		.inst_size		= sizeof(rlm_kafka_t),
+		.config			= kafka_base_producer_config,
+		.bootstrap		= mod_bootstrap,
+		.instantiate		= mod_instantiate,
+		.thread_inst_size	= sizeof(rlm_kafka_thread_t),
+		.thread_inst_type	= "rlm_kafka_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
+	},
+	.method_names = (module_method_names_t[]){
+		{ .name1 = CF_IDENT_ANY,	.name2 = CF_IDENT_ANY,	.method = mod_produce },
+
+		MODULE_NAME_TERMINATOR
 	}
 };
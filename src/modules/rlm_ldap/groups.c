@@ -266,25 +266,103 @@ finish:
 	RETURN_MODULE_RCODE(rcode);
 }
 
-/** Convert group membership information into attributes
+/** Resolve a group DN to a name using the group replica
+ *
+ * @param[in] ctx		to allocate the name in.
+ * @param[out] out		Where to write the group name.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[in] dn		to resolve.
+ * @return
+ *	- true if the group was found in the replica.
+ *	- false if the DN needs to be resolved by searching the directory.
+ */
+static bool rlm_ldap_group_replica_dn2name(TALLOC_CTX *ctx, char **out, rlm_ldap_t const *inst,
+					   request_t *request, char const *dn)
+{
+	fr_ldap_replica_entry_t const	*group;
+	struct berval			**values;
+
+	if (!inst->group_replica || !inst->groupobj_name_attr || !fr_ldap_replica_ready(inst->group_replica)) {
+		return false;
+	}
+
+	group = fr_ldap_replica_find_by_dn(inst->group_replica, dn);
+	if (!group) return false;
+
+	if ((fr_ldap_replica_entry_values(&values, inst->group_replica, group, inst->groupobj_name_attr) < 0) ||
+	    !values) {
+		fr_ldap_replica_entry_release(group);
+		return false;
+	}
+
+	*out = fr_ldap_berval_to_string(ctx, values[0]);
+	fr_ldap_replica_entry_release(group);
+	RDEBUG2("Group DN \"%s\" resolves to name \"%s\" (from replica)", dn, *out);
+
+	return true;
+}
+
+/** Resolve a group name to a DN using the group replica
+ *
+ * The group replica must use the group name attribute as its key.  The group
+ * must also be within group.base_dn and group.scope, and match group.filter.
+ *
+ * @param[in] ctx		to allocate the DN in.
+ * @param[out] out		Where to write the group DN.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[in] name		to resolve.
+ * @return
+ *	- true if the group was found in the replica.
+ *	- false if the name needs to be resolved by searching the directory.
+ */
+static bool rlm_ldap_group_replica_name2dn(TALLOC_CTX *ctx, char **out, rlm_ldap_t const *inst,
+					   request_t *request, char const *name)
+{
+	fr_ldap_replica_entry_t const	*group;
+	char const			*base_dn;
+	char				base_dn_buff[LDAP_MAX_DN_STR_LEN];
+
+	if (!inst->group_replica || !fr_ldap_replica_ready(inst->group_replica)) return false;
+
+	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
+			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) return false;
+
+	group = fr_ldap_replica_find(inst->group_replica, name);
+	if (!group) return false;
+
+	/*
+	 *	If we can't tell, let the search decide
+	 */
+	if (fr_ldap_replica_entry_match(inst->group_replica, group, base_dn,
+					inst->groupobj_scope, inst->groupobj_filter) != 1) {
+		fr_ldap_replica_entry_release(group);
+		return false;
+	}
+
+	*out = talloc_typed_strdup(ctx, fr_ldap_replica_entry_dn(group));
+	fr_ldap_replica_entry_release(group);
+	RDEBUG2("Group name \"%s\" resolves to DN \"%s\" (from replica)", name, *out);
+
+	return true;
+}
+
+/** Convert the values of a membership attribute into attributes
  *
  * @param[out] p_result		The result of trying to resolve a dn to a group name.
  * @param[in] inst		rlm_ldap configuration.
  * @param[in] request		Current request.
  * @param[in] ttrunk		to use.
- * @param[in] entry		retrieved by rlm_ldap_find_user or fr_ldap_search.
- * @param[in] handle		on which original object was found.
- * @param[in] attr		membership attribute to look for in the entry.
+ * @param[in] values		of the membership attribute.
  * @return One of the RLM_MODULE_* values.
  */
-unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t const *inst,
-					   request_t *request, fr_ldap_thread_trunk_t *ttrunk,
-					   LDAPMessage *entry, LDAP *handle, char const *attr)
+static unlang_action_t rlm_ldap_cacheable_values(rlm_rcode_t *p_result, rlm_ldap_t const *inst,
+						 request_t *request, fr_ldap_thread_trunk_t *ttrunk,
+						 struct berval **values)
 {
 	rlm_rcode_t rcode = RLM_MODULE_OK;
 
-	struct berval **values;
-
 	char *group_name[LDAP_MAX_CACHEABLE + 1];
 	char **name_p = group_name;
 
@@ -299,18 +377,6 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 
 	int is_dn, i, count;
 
-	fr_assert(entry);
-	fr_assert(attr);
-
-	/*
-	 *	Parse the membership information we got in the initial user query.
-	 */
-	values = ldap_get_values_len(handle, entry, attr);
-	if (!values) {
-		RDEBUG2("No cacheable group memberships found in user object");
-
-		RETURN_MODULE_OK;
-	}
 	count = ldap_count_values_len(values);
 
 	list = tmpl_list_head(request, PAIR_LIST_CONTROL);
@@ -346,7 +412,16 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 			 *	this to a DN. Store all the group names in an array so we can do one query.
 			 */
 			} else {
-				*name_p++ = fr_ldap_berval_to_string(value_ctx, values[i]);
+				char *dn;
+
+				name = fr_ldap_berval_to_string(value_ctx, values[i]);
+				if (rlm_ldap_group_replica_name2dn(value_ctx, &dn, inst, request, name)) {
+					MEM(vp = fr_pair_afrom_da(list_ctx, inst->cache_da));
+					fr_pair_value_strdup(vp, dn, false);
+					fr_pair_append(&groups, vp);
+				} else {
+					*name_p++ = name;
+				}
 			}
 		}
 
@@ -368,13 +443,16 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 				char *dn;
 
 				dn = fr_ldap_berval_to_string(value_ctx, values[i]);
-				rlm_ldap_group_dn2name(&rcode, inst, request, ttrunk, dn, &name);
+				if (rlm_ldap_group_replica_dn2name(value_ctx, &name, inst, request, dn)) {
+					rcode = RLM_MODULE_OK;
+				} else {
+					rlm_ldap_group_dn2name(&rcode, inst, request, ttrunk, dn, &name);
+				}
 				talloc_free(dn);
 
 				if (rcode == RLM_MODULE_NOOP) continue;
 
 				if (rcode != RLM_MODULE_OK) {
-					ldap_value_free_len(values);
 					talloc_free(value_ctx);
 					fr_pair_list_free(&groups);
 
@@ -392,7 +470,6 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 
 	rlm_ldap_group_name2dn(&rcode, inst, request, ttrunk, group_name, group_dn, sizeof(group_dn));
 
-	ldap_value_free_len(values);
 	talloc_free(value_ctx);
 
 	if (rcode != RLM_MODULE_OK) RETURN_MODULE_RCODE(rcode);
@@ -422,6 +499,72 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 	RETURN_MODULE_RCODE(rcode);
 }
 
+/** Convert group membership information into attributes
+ *
+ * @param[out] p_result		The result of trying to resolve a dn to a group name.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[in] ttrunk		to use.
+ * @param[in] entry		retrieved by rlm_ldap_find_user or fr_ldap_search.
+ * @param[in] handle		on which original object was found.
+ * @param[in] attr		membership attribute to look for in the entry.
+ * @return One of the RLM_MODULE_* values.
+ */
+unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t const *inst,
+					   request_t *request, fr_ldap_thread_trunk_t *ttrunk,
+					   LDAPMessage *entry, LDAP *handle, char const *attr)
+{
+	struct berval	**values;
+
+	fr_assert(entry);
+	fr_assert(attr);
+
+	/*
+	 *	Parse the membership information we got in the initial user query.
+	 */
+	values = ldap_get_values_len(handle, entry, attr);
+	if (!values) {
+		RDEBUG2("No cacheable group memberships found in user object");
+
+		RETURN_MODULE_OK;
+	}
+
+	rlm_ldap_cacheable_values(p_result, inst, request, ttrunk, values);
+	ldap_value_free_len(values);
+
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+/** Convert group membership information from a replica entry into attributes
+ *
+ * @param[out] p_result		The result of trying to resolve a dn to a group name.
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] request		Current request.
+ * @param[in] ttrunk		to use if group names or DNs can't be resolved with the group replica.
+ * @param[in] entry		retrieved by rlm_ldap_replica_find_user.
+ * @param[in] attr		membership attribute to look for in the entry.
+ * @return One of the RLM_MODULE_* values.
+ */
+unlang_action_t rlm_ldap_replica_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t const *inst,
+						   request_t *request, fr_ldap_thread_trunk_t *ttrunk,
+						   fr_ldap_replica_entry_t const *entry, char const *attr)
+{
+	struct berval	**values;
+
+	if (fr_ldap_replica_entry_values(&values, inst->user_replica, entry, attr) < 0) {
+		RPEDEBUG("Can't retrieve group memberships");
+
+		RETURN_MODULE_FAIL;
+	}
+	if (!values) {
+		RDEBUG2("No cacheable group memberships found in user object");
+
+		RETURN_MODULE_OK;
+	}
+
+	return rlm_ldap_cacheable_values(p_result, inst, request, ttrunk, values);
+}
+
 /** Convert group membership information into attributes
  *
  * @param[out] p_result		The result of trying to resolve a dn to a group name.
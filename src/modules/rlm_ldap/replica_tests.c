@@ -0,0 +1,531 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the LDAP replicas rlm_ldap looks users and groups up in
+ *
+ * Entries are loaded from snapshots written by the tests, as they can't be
+ * received from a directory.
+ *
+ * @file src/modules/rlm_ldap/replica_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/ldap/base.h>
+#include <freeradius-devel/util/nbo.h>
+
+#include <sys/stat.h>
+
+#define TEST_MAGIC		"FRLDAPR1"
+#define TEST_NUM_ATTRS		3
+#define TEST_KEY_ATTR		"uid"
+#define TEST_PEOPLE		"ou=people,dc=example,dc=com"
+
+static char const *test_attrs[] = { "uid", "radiusAccess", "memberOf", NULL };
+
+typedef struct {
+	uint8_t		uuid;					//!< Repeated to make the entryUUID.
+	char const	*dn;
+	char const	*values[TEST_NUM_ATTRS][3];		//!< NULL terminated values of each attribute.
+} test_entry_t;
+
+static test_entry_t const test_entries[] = {
+	{ 1, "uid=bob," TEST_PEOPLE, {
+		{ "bob" }, { "TRUE" },
+		{ "cn=staff,ou=groups,dc=example,dc=com", "cn=admins,ou=groups,dc=example,dc=com" } } },
+	{ 2, "uid=alice," TEST_PEOPLE, { { "alice" }, { "FALSE" } } },
+	{ 3, "cn=contractor,ou=contractors," TEST_PEOPLE, { { "b*b" } } },
+	{ 4, "uid=svc,ou=services,dc=example,dc=com", { { "svc" }, { "TRUE" } } }
+};
+#define TEST_NUM_ENTRIES	NUM_ELEMENTS(test_entries)
+
+static TALLOC_CTX	*autofree;
+static char		*test_dir;
+static char		*test_file;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("replica_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_time_start() < 0) goto error;
+}
+
+/** Create an empty directory for the snapshots
+ *
+ */
+static void test_dir_alloc(void)
+{
+	test_dir = talloc_strdup(autofree, "/tmp/replica_tests.XXXXXX");
+	TEST_ASSERT(mkdtemp(test_dir) != NULL);
+
+	test_file = talloc_asprintf(autofree, "%s/users.replica", test_dir);
+}
+
+static void test_dir_free(void)
+{
+	char *cmd;
+
+	cmd = talloc_asprintf(autofree, "rm -rf %s", test_dir);
+	TEST_CHECK(system(cmd) == 0);
+	talloc_free(cmd);
+}
+
+static void test_uuid(uint8_t uuid[static FR_LDAP_REPLICA_UUID_LEN], uint8_t n)
+{
+	memset(uuid, n, FR_LDAP_REPLICA_UUID_LEN);
+}
+
+static void test_write_data(FILE *fp, void const *data, size_t len)
+{
+	uint8_t hdr[sizeof(uint32_t)];
+
+	fr_nbo_from_uint32(hdr, (uint32_t)len);
+	TEST_ASSERT(fwrite(hdr, sizeof(hdr), 1, fp) == 1);
+	if (len) TEST_ASSERT(fwrite(data, len, 1, fp) == 1);
+}
+
+/** Write a snapshot, in the same format as fr_ldap_replica_persist()
+ *
+ * @param[in] attrs	the snapshot was written with.
+ * @param[in] cookie	describing the contents.
+ * @param[in] truncate	If true, leave the end of the snapshot off.
+ */
+static void test_snapshot_write(char const * const *attrs, char const *cookie, bool truncate)
+{
+	FILE		*fp;
+	uint8_t		num[sizeof(uint64_t)];
+	size_t		i, j, k;
+
+	fp = fopen(test_file, "w");
+	TEST_ASSERT(fp != NULL);
+
+	TEST_ASSERT(fwrite(TEST_MAGIC, strlen(TEST_MAGIC), 1, fp) == 1);
+	test_write_data(fp, TEST_KEY_ATTR, strlen(TEST_KEY_ATTR));
+
+	for (i = 0; attrs[i]; i++);
+	fr_nbo_from_uint32(num, (uint32_t)i);
+	TEST_ASSERT(fwrite(num, sizeof(uint32_t), 1, fp) == 1);
+	for (i = 0; attrs[i]; i++) test_write_data(fp, attrs[i], strlen(attrs[i]));
+
+	test_write_data(fp, cookie, strlen(cookie));
+
+	fr_nbo_from_uint64(num, TEST_NUM_ENTRIES);
+	TEST_ASSERT(fwrite(num, sizeof(uint64_t), 1, fp) == 1);
+
+	for (i = 0; i < TEST_NUM_ENTRIES; i++) {
+		uint8_t uuid[FR_LDAP_REPLICA_UUID_LEN];
+
+		test_uuid(uuid, test_entries[i].uuid);
+		TEST_ASSERT(fwrite(uuid, sizeof(uuid), 1, fp) == 1);
+		test_write_data(fp, test_entries[i].dn, strlen(test_entries[i].dn));
+
+		for (j = 0; j < TEST_NUM_ATTRS; j++) {
+			char const * const *values = test_entries[i].values[j];
+
+			for (k = 0; values[k]; k++);
+			fr_nbo_from_uint32(num, (uint32_t)k);
+			TEST_ASSERT(fwrite(num, sizeof(uint32_t), 1, fp) == 1);
+
+			for (k = 0; values[k]; k++) test_write_data(fp, values[k], strlen(values[k]));
+		}
+	}
+
+	if (!truncate) TEST_ASSERT(fwrite(TEST_MAGIC, strlen(TEST_MAGIC), 1, fp) == 1);
+
+	TEST_ASSERT(fclose(fp) == 0);
+}
+
+/** Acquire a replica, maintained as if by a sync copying test_attrs
+ *
+ */
+static fr_ldap_replica_t *test_replica_alloc(TALLOC_CTX *ctx, char const *name)
+{
+	fr_ldap_replica_t *replica;
+
+	replica = fr_ldap_replica_acquire(ctx, name);
+	TEST_ASSERT(replica != NULL);
+
+	TEST_CHECK(fr_ldap_replica_source(replica, TEST_KEY_ATTR, test_attrs, test_file, fr_time_delta_wrap(0)) == 0);
+	if (fr_strerror_peek()) TEST_MSG("%s", fr_strerror());
+
+	return replica;
+}
+
+/** Acquire a replica, and load the entries from a snapshot
+ *
+ */
+static fr_ldap_replica_t *test_replica_load(TALLOC_CTX *ctx, char const *name)
+{
+	fr_ldap_replica_t *replica;
+
+	test_snapshot_write(test_attrs, "cookie-1", false);
+
+	replica = test_replica_alloc(ctx, name);
+	TEST_CHECK(fr_ldap_replica_load(replica) == 1);
+	TEST_CHECK(fr_ldap_replica_ready(replica));
+
+	return replica;
+}
+
+/** Whether an entry with the given key is in the replica
+ *
+ */
+static bool test_found(fr_ldap_replica_t *replica, char const *key)
+{
+	fr_ldap_replica_entry_t const *entry;
+
+	entry = fr_ldap_replica_find(replica, key);
+	if (!entry) return false;
+
+	fr_ldap_replica_entry_release(entry);
+
+	return true;
+}
+
+static void test_load(void)
+{
+	TALLOC_CTX			*ctx;
+	fr_ldap_replica_t		*replica;
+	fr_ldap_replica_entry_t const	*entry;
+	struct berval			**values;
+	uint8_t				*cookie;
+
+	test_dir_alloc();
+	MEM(ctx = talloc_new(autofree));
+
+	replica = test_replica_load(ctx, "load");
+
+	TEST_CASE("Entries are found by key, case insensitively");
+	entry = fr_ldap_replica_find(replica, "BOB");
+	TEST_ASSERT(entry != NULL);
+	TEST_CHECK(strcmp(fr_ldap_replica_entry_dn(entry), "uid=bob," TEST_PEOPLE) == 0);
+
+	TEST_CHECK(fr_ldap_replica_entry_values(&values, replica, entry, "memberof") == 0);
+	TEST_CHECK(ldap_count_values_len(values) == 2);
+	TEST_CHECK((values != NULL) && (strcmp(values[1]->bv_val, "cn=admins,ou=groups,dc=example,dc=com") == 0));
+	fr_ldap_replica_entry_release(entry);
+
+	TEST_CASE("Entries are found by DN");
+	entry = fr_ldap_replica_find_by_dn(replica, "uid=alice," TEST_PEOPLE);
+	TEST_ASSERT(entry != NULL);
+
+	TEST_CASE("Attributes without values are distinguished from attributes which aren't copied");
+	TEST_CHECK(fr_ldap_replica_entry_values(&values, replica, entry, "memberOf") == 0);
+	TEST_CHECK(values == NULL);
+	TEST_CHECK(fr_ldap_replica_entry_values(&values, replica, entry, "mail") < 0);
+	TEST_CHECK(!fr_ldap_replica_has_attr(replica, "mail"));
+	fr_ldap_replica_entry_release(entry);
+
+	TEST_CASE("The cookie is restored");
+	cookie = fr_ldap_replica_cookie(ctx, replica);
+	TEST_ASSERT(cookie != NULL);
+	TEST_CHECK((talloc_array_length(cookie) == strlen("cookie-1")) &&
+		   (memcmp(cookie, "cookie-1", talloc_array_length(cookie)) == 0));
+
+	talloc_free(ctx);
+	test_dir_free();
+}
+
+/** Snapshots which don't match the sync's configuration, or are damaged, are ignored
+ *
+ */
+static void test_load_unusable(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_ldap_replica_t	*replica;
+	char const		*other_attrs[] = { "uid", "radiusAccess", "mail", NULL };
+
+	test_dir_alloc();
+	MEM(ctx = talloc_new(autofree));
+
+	TEST_CASE("No snapshot");
+	replica = test_replica_alloc(ctx, "missing");
+	TEST_CHECK(fr_ldap_replica_load(replica) == 0);
+	TEST_CHECK(!fr_ldap_replica_ready(replica));
+
+	TEST_CASE("Snapshot written with different attributes");
+	test_snapshot_write(other_attrs, "cookie-1", false);
+	replica = test_replica_alloc(ctx, "mismatch");
+	TEST_CHECK(fr_ldap_replica_load(replica) == 0);
+	TEST_CHECK(!fr_ldap_replica_ready(replica));
+	TEST_CHECK(fr_ldap_replica_cookie(ctx, replica) == NULL);
+
+	TEST_CASE("Truncated snapshot");
+	test_snapshot_write(test_attrs, "cookie-1", true);
+	replica = test_replica_alloc(ctx, "truncated");
+	TEST_CHECK(fr_ldap_replica_load(replica) == 0);
+	TEST_CHECK(!fr_ldap_replica_ready(replica));
+	TEST_CHECK(!test_found(replica, "bob"));
+
+	talloc_free(ctx);
+	test_dir_free();
+}
+
+/** Changes are written to the snapshot, and loaded on restart
+ *
+ */
+static void test_persist(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_ldap_replica_t	*replica;
+	uint8_t			uuid[FR_LDAP_REPLICA_UUID_LEN];
+	uint8_t			*cookie;
+	struct stat		st;
+
+	test_dir_alloc();
+	MEM(ctx = talloc_new(autofree));
+
+	replica = test_replica_load(ctx, "persist");
+
+	test_uuid(uuid, 2);
+	fr_ldap_replica_delete(replica, uuid);
+	TEST_CHECK(!test_found(replica, "alice"));
+
+	/*
+	 *	persist_interval is zero, so setting the
+	 *	cookie writes the snapshot.
+	 */
+	MEM(cookie = talloc_memdup(ctx, "cookie-2", strlen("cookie-2")));
+	fr_ldap_replica_cookie_set(replica, cookie);
+
+	TEST_CHECK(stat(test_file, &st) == 0);
+	TEST_CHECK((st.st_mode & 0777) == (S_IRUSR | S_IWUSR));
+	TEST_MSG("The snapshot is readable by other users");
+
+	/*
+	 *	A different name, so the changes can only
+	 *	have come from the snapshot.
+	 */
+	TEST_CASE("Snapshot is loaded into a new replica");
+	replica = test_replica_alloc(ctx, "persist-reload");
+	TEST_CHECK(fr_ldap_replica_load(replica) == 1);
+	TEST_CHECK(test_found(replica, "bob"));
+	TEST_CHECK(test_found(replica, "b*b"));
+	TEST_CHECK(test_found(replica, "svc"));
+	TEST_CHECK(!test_found(replica, "alice"));
+	TEST_MSG("Deleted entry was loaded from the snapshot");
+
+	cookie = fr_ldap_replica_cookie(ctx, replica);
+	TEST_ASSERT(cookie != NULL);
+	TEST_CHECK((talloc_array_length(cookie) == strlen("cookie-2")) &&
+		   (memcmp(cookie, "cookie-2", talloc_array_length(cookie)) == 0));
+
+	talloc_free(ctx);
+	test_dir_free();
+}
+
+/** Entries the server doesn't mention during a refresh are removed, when the refresh says so
+ *
+ */
+static void test_sweep(void)
+{
+	TALLOC_CTX			*ctx;
+	fr_ldap_replica_t		*replica;
+	fr_ldap_replica_entry_t const	*held;
+	uint8_t				uuid[FR_LDAP_REPLICA_UUID_LEN];
+
+	test_dir_alloc();
+	MEM(ctx = talloc_new(autofree));
+
+	replica = test_replica_load(ctx, "sweep");
+
+	TEST_CASE("Refresh with only changes keeps every entry");
+	fr_ldap_replica_refresh_start(replica, false);
+	fr_ldap_replica_refresh_done(replica, false);
+	TEST_CHECK(test_found(replica, "bob") && test_found(replica, "alice") &&
+		   test_found(replica, "b*b") && test_found(replica, "svc"));
+
+	TEST_CASE("Refresh with a present phase removes entries which weren't present");
+	fr_ldap_replica_refresh_start(replica, false);
+	test_uuid(uuid, 1);
+	fr_ldap_replica_present(replica, uuid);
+	test_uuid(uuid, 3);
+	fr_ldap_replica_present(replica, uuid);
+	fr_ldap_replica_refresh_done(replica, true);
+	TEST_CHECK(test_found(replica, "bob"));
+	TEST_CHECK(test_found(replica, "b*b"));
+	TEST_CHECK(!test_found(replica, "alice"));
+	TEST_CHECK(!test_found(replica, "svc"));
+
+	TEST_CASE("Entries in use stay valid after they're removed");
+	held = fr_ldap_replica_find(replica, "bob");
+	TEST_ASSERT(held != NULL);
+
+	TEST_CASE("Full refresh removes every entry which wasn't sent");
+	fr_ldap_replica_refresh_start(replica, true);
+	fr_ldap_replica_refresh_done(replica, false);
+	TEST_CHECK(!test_found(replica, "bob"));
+	TEST_CHECK(!test_found(replica, "b*b"));
+	TEST_CHECK(fr_ldap_replica_ready(replica));
+
+	TEST_CHECK(strcmp(fr_ldap_replica_entry_dn(held), "uid=bob," TEST_PEOPLE) == 0);
+	fr_ldap_replica_entry_release(held);
+
+	talloc_free(ctx);
+	test_dir_free();
+}
+
+/** Attributes rlm_ldap needs must be copied by the sync, whichever is instantiated first
+ *
+ */
+static void test_require(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_ldap_replica_t	*replica;
+	char const		*need[] = { "radiusAccess", "MEMBEROF", NULL };
+	char const		*need_mail[] = { "uid", "mail", NULL };
+	char const		*wildcard[] = { "uid", "*", NULL };
+
+	test_dir_alloc();
+	MEM(ctx = talloc_new(autofree));
+
+	TEST_CASE("Module instantiated after the sync");
+	replica = test_replica_alloc(ctx, "require-after");
+	TEST_CHECK(fr_ldap_replica_require(replica, NULL, need) == 0);
+	TEST_CHECK(fr_ldap_replica_require(replica, "uid", NULL) == 0);
+	TEST_CHECK(fr_ldap_replica_require(replica, NULL, need_mail) < 0);
+	TEST_MSG("Attribute the sync doesn't copy was accepted");
+	TEST_CHECK(fr_ldap_replica_require(replica, "cn", NULL) < 0);
+	TEST_MSG("Key attribute the sync doesn't use was accepted");
+
+	TEST_CASE("Module instantiated before the sync");
+	replica = fr_ldap_replica_acquire(ctx, "require-before");
+	TEST_ASSERT(replica != NULL);
+	TEST_CHECK(fr_ldap_replica_require(replica, NULL, need_mail) == 0);
+	TEST_CHECK(fr_ldap_replica_source(replica, TEST_KEY_ATTR, test_attrs, NULL, fr_time_delta_wrap(0)) < 0);
+	TEST_MSG("Sync which doesn't copy an attribute the module needs was accepted");
+	TEST_CHECK(fr_ldap_replica_source(replica, TEST_KEY_ATTR, need_mail, NULL, fr_time_delta_wrap(0)) == 0);
+
+	TEST_CASE("Modules must agree on the key attribute");
+	replica = fr_ldap_replica_acquire(ctx, "require-key");
+	TEST_ASSERT(replica != NULL);
+	TEST_CHECK(fr_ldap_replica_require(replica, "cn", NULL) == 0);
+	TEST_CHECK(fr_ldap_replica_require(replica, "uid", NULL) < 0);
+	TEST_CHECK(fr_ldap_replica_source(replica, TEST_KEY_ATTR, test_attrs, NULL, fr_time_delta_wrap(0)) < 0);
+
+	TEST_CASE("Wildcards can't be copied");
+	replica = fr_ldap_replica_acquire(ctx, "require-wildcard");
+	TEST_ASSERT(replica != NULL);
+	TEST_CHECK(fr_ldap_replica_source(replica, TEST_KEY_ATTR, wildcard, NULL, fr_time_delta_wrap(0)) < 0);
+
+	talloc_free(ctx);
+	test_dir_free();
+}
+
+/** Check an entry against a search
+ *
+ */
+static int test_match(fr_ldap_replica_t *replica, char const *key,
+		      char const *base_dn, int scope, char const *filter)
+{
+	fr_ldap_replica_entry_t const	*entry;
+	int				ret;
+
+	entry = fr_ldap_replica_find(replica, key);
+	TEST_ASSERT(entry != NULL);
+
+	ret = fr_ldap_replica_entry_match(replica, entry, base_dn, scope, filter);
+	fr_ldap_replica_entry_release(entry);
+
+	return ret;
+}
+
+/** Entries are only used if the search they replace would have returned them
+ *
+ */
+static void test_entry_match(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_ldap_replica_t	*replica;
+
+	test_dir_alloc();
+	MEM(ctx = talloc_new(autofree));
+
+	replica = test_replica_load(ctx, "match");
+
+	TEST_CASE("Base DN and scope");
+	TEST_CHECK(test_match(replica, "bob", TEST_PEOPLE, LDAP_SCOPE_SUB, NULL) == 1);
+	TEST_CHECK(test_match(replica, "bob", TEST_PEOPLE, LDAP_SCOPE_ONE, NULL) == 1);
+	TEST_CHECK(test_match(replica, "bob", "OU=People,DC=example,DC=com", LDAP_SCOPE_SUB, NULL) == 1);
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, NULL) == 1);
+	TEST_CHECK(test_match(replica, "bob", TEST_PEOPLE, LDAP_SCOPE_BASE, NULL) == 0);
+	TEST_CHECK(test_match(replica, "bob", "uid=bob," TEST_PEOPLE, LDAP_SCOPE_BASE, NULL) == 1);
+#ifdef LDAP_SCOPE_CHILDREN
+	TEST_CHECK(test_match(replica, "bob", "uid=bob," TEST_PEOPLE, LDAP_SCOPE_CHILDREN, NULL) == 0);
+#endif
+	TEST_CHECK(test_match(replica, "bob", "ple,dc=example,dc=com", LDAP_SCOPE_SUB, NULL) == 0);
+	TEST_CHECK(test_match(replica, "b*b", TEST_PEOPLE, LDAP_SCOPE_SUB, NULL) == 1);
+	TEST_CHECK(test_match(replica, "b*b", TEST_PEOPLE, LDAP_SCOPE_ONE, NULL) == 0);
+	TEST_CHECK(test_match(replica, "svc", TEST_PEOPLE, LDAP_SCOPE_SUB, NULL) == 0);
+	TEST_MSG("Entry outside of the base DN matched");
+
+	TEST_CASE("Filters");
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(uid=bob)") == 1);
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(&(uid=bob)(radiusAccess=TRUE))") == 1);
+	TEST_CHECK(test_match(replica, "alice", "", LDAP_SCOPE_SUB, "(&(uid=alice)(radiusAccess=TRUE))") == 0);
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(!(radiusAccess=TRUE))") == 0);
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(memberOf=cn=admins,*)") == 1);
+	TEST_CHECK(test_match(replica, "alice", "", LDAP_SCOPE_SUB, "(!(memberOf=*))") == 1);
+	TEST_CHECK(test_match(replica, "alice", "", LDAP_SCOPE_SUB, "(|(uid=nobody)(memberOf=*))") == 0);
+
+	TEST_CASE("Escaped values match literally");
+	TEST_CHECK(test_match(replica, "b*b", "", LDAP_SCOPE_SUB, "(uid=b\\2ab)") == 1);
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(uid=b\\2ab)") == 0);
+	TEST_MSG("Escaped '*' was treated as a wildcard");
+
+	TEST_CASE("Filters which can't be evaluated using the replica");
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(mail=bob@example.com)") < 0);
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(!(mail=*))") < 0);
+	TEST_MSG("Attribute the replica doesn't copy was treated as absent");
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(uid=b\\2a*)") < 0);
+	TEST_CHECK(test_match(replica, "bob", "", LDAP_SCOPE_SUB, "(uid=bob") < 0);
+
+	TEST_CASE("Filters aren't evaluated for entries outside of the base DN");
+	TEST_CHECK(test_match(replica, "svc", TEST_PEOPLE, LDAP_SCOPE_SUB, "(mail=*)") == 0);
+
+	talloc_free(ctx);
+	test_dir_free();
+}
+
+TEST_LIST = {
+	{ "load",			test_load },
+	{ "load_unusable",		test_load_unusable },
+	{ "persist",			test_persist },
+	{ "sweep",			test_sweep },
+	{ "require",			test_require },
+	{ "entry_match",		test_entry_match },
+
+	{ NULL }
+};
@@ -0,0 +1,15 @@
+#  This needs to be cleared explicitly, as the libfreeradius-ldap.mk
+#  might not always be available, and the TARGETNAME from the previous
+#  target may stick around.
+TARGETNAME=
+-include $(top_builddir)/src/lib/ldap/all.mk
+
+ifneq "${TARGETNAME}" ""
+  TARGET	:= replica_tests$(E)
+endif
+
+SOURCES		:= replica_tests.c
+
+TGT_LDLIBS	+= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) $(LIBFREERADIUS_SERVER) libfreeradius-ldap$(L)
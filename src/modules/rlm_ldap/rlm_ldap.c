@@ -54,6 +54,16 @@ static CONF_PARSER profile_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	User replica configuration
+ */
+static CONF_PARSER user_replica_config[] = {
+	{ FR_CONF_OFFSET("name", FR_TYPE_STRING, rlm_ldap_t, user_replica_name) },
+	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL, rlm_ldap_t, user_replica_key), .dflt = "%{%{Stripped-User-Name}:-%{User-Name}}", .quote = T_DOUBLE_QUOTED_STRING },
+	{ FR_CONF_OFFSET("fallback", FR_TYPE_BOOL, rlm_ldap_t, user_replica_fallback), .dflt = "yes" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	User configuration
  */
@@ -68,6 +78,8 @@ static CONF_PARSER user_config[] = {
 
 	/* Should be deprecated */
 	{ FR_CONF_OFFSET("sasl", FR_TYPE_SUBSECTION, rlm_ldap_t, user_sasl), .subcs = (void const *) sasl_mech_dynamic },
+
+	{ FR_CONF_POINTER("replica", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) user_replica_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -87,6 +99,7 @@ static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("cache_attribute", FR_TYPE_STRING, rlm_ldap_t, cache_attribute) },
 	{ FR_CONF_OFFSET("group_attribute", FR_TYPE_STRING, rlm_ldap_t, group_attribute) },
 	{ FR_CONF_OFFSET("allow_dangling_group_ref", FR_TYPE_BOOL, rlm_ldap_t, allow_dangling_group_refs), .dflt = "no" },
+	{ FR_CONF_OFFSET("replica", FR_TYPE_STRING, rlm_ldap_t, group_replica_name) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -1126,10 +1139,11 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	int			i;
 	struct berval		**values;
 	fr_ldap_thread_trunk_t	*ttrunk;
-	LDAP			*handle;
-	LDAPMessage		*result, *entry;
+	LDAP			*handle = NULL;
+	LDAPMessage		*result, *entry = NULL;
 	char const 		*dn = NULL;
 	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
+	fr_ldap_replica_entry_t const *replica_entry = NULL;
 
 	/*
 	 *	Don't be tempted to add a check for User-Name or
@@ -1164,24 +1178,51 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 
 	expanded.attrs[expanded.count] = NULL;
 
-	dn = rlm_ldap_find_user(inst, request, ttrunk, expanded.attrs, true, &result, &handle, &rcode);
-	if (!dn) {
-		goto finish;
+	/*
+	 *	Look in the local replica first, it's maintained by an
+	 *	ldap_sync listener so we don't need to search the directory.
+	 */
+	if (inst->user_replica) {
+		if (!fr_ldap_replica_ready(inst->user_replica)) {
+			RWDEBUG("User replica \"%s\" has not completed its initial refresh", inst->user_replica_name);
+			rcode = RLM_MODULE_NOTFOUND;
+		} else {
+			replica_entry = rlm_ldap_replica_find_user(inst, request, &rcode);
+		}
+
+		if (!replica_entry) {
+			if ((rcode != RLM_MODULE_NOTFOUND) || !inst->user_replica_fallback) goto finish;
+
+			RDEBUG2("Falling back to searching the directory");
+		}
 	}
 
-	entry = ldap_first_entry(handle, result);
-	if (!entry) {
-		ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+	if (replica_entry) {
+		dn = fr_ldap_replica_entry_dn(replica_entry);
+	} else {
+		dn = rlm_ldap_find_user(inst, request, ttrunk, expanded.attrs, true, &result, &handle, &rcode);
+		if (!dn) {
+			goto finish;
+		}
+
+		entry = ldap_first_entry(handle, result);
+		if (!entry) {
+			ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+			REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
 
-		goto finish;
+			goto finish;
+		}
 	}
 
 	/*
 	 *	Check for access.
 	 */
 	if (inst->userobj_access_attr) {
-		rcode = rlm_ldap_check_access(inst, request, handle, entry);
+		if (replica_entry) {
+			rcode = rlm_ldap_replica_check_access(inst, request, replica_entry);
+		} else {
+			rcode = rlm_ldap_check_access(inst, request, handle, entry);
+		}
 		if (rcode != RLM_MODULE_OK) {
 			goto finish;
 		}
@@ -1192,7 +1233,13 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	 */
 	if (inst->cacheable_group_dn || inst->cacheable_group_name) {
 		if (inst->userobj_membership_attr) {
-			rlm_ldap_cacheable_userobj(&rcode, inst, request, ttrunk, entry, handle, inst->userobj_membership_attr);
+			if (replica_entry) {
+				rlm_ldap_replica_cacheable_userobj(&rcode, inst, request, ttrunk, replica_entry,
+								   inst->userobj_membership_attr);
+			} else {
+				rlm_ldap_cacheable_userobj(&rcode, inst, request, ttrunk, entry, handle,
+							   inst->userobj_membership_attr);
+			}
 			if (rcode != RLM_MODULE_OK) {
 				goto finish;
 			}
@@ -1210,6 +1257,11 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 	 */
 	if (fr_pair_find_by_da_idx(&request->control_pairs, attr_cleartext_password, 0)) goto skip_edir;
 
+	/*
+	 *	Universal Password can only be retrieved from the directory.
+	 */
+	if (replica_entry) goto skip_edir;
+
 	/*
 	 *      Retrieve Universal Password if we use eDirectory
 	 */
@@ -1299,7 +1351,19 @@ skip_edir:
 	 *	Apply a SET of user profiles.
 	 */
 	if (inst->profile_attr) {
-		values = ldap_get_values_len(handle, entry, inst->profile_attr);
+		/*
+		 *	Values from the replica belong to the replica entry
+		 */
+		if (replica_entry) {
+			if (fr_ldap_replica_entry_values(&values, inst->user_replica, replica_entry,
+							 inst->profile_attr) < 0) {
+				RPEDEBUG("Can't apply user profiles");
+				rcode = RLM_MODULE_FAIL;
+				goto finish;
+			}
+		} else {
+			values = ldap_get_values_len(handle, entry, inst->profile_attr);
+		}
 		if (values != NULL) {
 			for (i = 0; values[i] != NULL; i++) {
 				rlm_rcode_t ret;
@@ -1309,26 +1373,39 @@ skip_edir:
 				rlm_ldap_map_profile(&ret, inst, request, ttrunk, value, &expanded);
 				talloc_free(value);
 				if (ret == RLM_MODULE_FAIL) {
-					ldap_value_free_len(values);
+					if (!replica_entry) ldap_value_free_len(values);
 					rcode = ret;
 					goto finish;
 				}
 
 			}
-			ldap_value_free_len(values);
+			if (!replica_entry) ldap_value_free_len(values);
 		}
 	}
 
 	if (!map_list_empty(&inst->user_map) || inst->valuepair_attr) {
+		int ret;
+
 		RDEBUG2("Processing user attributes");
 		RINDENT();
-		if (fr_ldap_map_do(request, handle, inst->valuepair_attr,
-				   &expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+		if (replica_entry) {
+			ret = fr_ldap_replica_map_do(request, inst->user_replica, inst->valuepair_attr,
+						     &expanded, replica_entry);
+			if (ret < 0) {
+				REXDENT();
+				rcode = RLM_MODULE_FAIL;
+				goto finish;
+			}
+		} else {
+			ret = fr_ldap_map_do(request, handle, inst->valuepair_attr, &expanded, entry);
+		}
+		if (ret > 0) rcode = RLM_MODULE_UPDATED;
 		REXDENT();
 		rlm_ldap_check_reply(mctx, request, ttrunk);
 	}
 
 finish:
+	if (replica_entry) fr_ldap_replica_entry_release(replica_entry);
 	talloc_free(expanded.ctx);
 
 	RETURN_MODULE_RCODE(rcode);
@@ -1769,6 +1846,71 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+/** Add an attribute to the list of attributes a replica must copy
+ *
+ * Has the same signature as filter_attr_check_t, so it can also be used to
+ * collect the attributes a filter uses.
+ */
+static int mod_replica_attr_add(char const *attr, void *uctx)
+{
+	char const	***attrs = uctx;
+	size_t		len = talloc_array_length(*attrs);
+
+	MEM(*attrs = talloc_realloc(NULL, *attrs, char const *, len + 1));
+	MEM((*attrs)[len] = talloc_typed_strdup(*attrs, attr));
+
+	return 0;
+}
+
+/** Add the attributes used in a filter to the list of attributes a replica must copy
+ *
+ * Values in the filter may be expanded, but the attribute names almost never are.
+ * If the filter can't be parsed before it's expanded, it's checked when it's used.
+ */
+static void mod_replica_filter_attrs_add(char const ***attrs, char const *filter)
+{
+	fr_dlist_head_t	*root;
+	size_t		len = talloc_array_length(*attrs);
+
+	if (fr_ldap_filter_parse(NULL, &root, &FR_SBUFF_IN(filter, strlen(filter)),
+				 mod_replica_attr_add, attrs) < 0) {
+		if (!len) {
+			TALLOC_FREE(*attrs);
+			return;
+		}
+		MEM(*attrs = talloc_realloc(NULL, *attrs, char const *, len));
+		return;
+	}
+	talloc_free(root);
+}
+
+/** Tell a replica which attributes we need
+ *
+ * Anything we'd have retrieved from the directory must be copied by the sync
+ * maintaining the replica.  Otherwise users would be treated as if they didn't
+ * have the attribute, which may give them access they shouldn't have.
+ *
+ * @param[in] replica	to register the attributes with.
+ * @param[in] key_attr	we look entries up with.  May be NULL.
+ * @param[in] attrs	talloc array of attributes.  Freed by this function.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the sync doesn't copy the attributes.
+ */
+static int mod_replica_require(fr_ldap_replica_t *replica, char const *key_attr, char const **attrs)
+{
+	size_t	len = talloc_array_length(attrs);
+	int	ret;
+
+	MEM(attrs = talloc_realloc(NULL, attrs, char const *, len + 1));
+	attrs[len] = NULL;
+
+	ret = fr_ldap_replica_require(replica, key_attr, attrs);
+	talloc_free(attrs);
+
+	return ret;
+}
+
 /** Instantiate the module
  *
  * Creates a new instance of the module reading parameters from a configuration section.
@@ -1815,6 +1957,36 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		}
 	}
 
+	/*
+	 *	Replicas are populated by ldap_sync listeners with
+	 *	the same replica name.
+	 */
+	if (inst->user_replica_name) {
+#ifdef WITH_EDIR
+		if (inst->edir) {
+			cf_log_err(conf, "Configuration item 'user.replica.name' can't be used with 'edir', "
+				   "Universal Password must be retrieved from the directory");
+
+			goto error;
+		}
+#endif
+		inst->user_replica = fr_ldap_replica_acquire(inst, inst->user_replica_name);
+		if (!inst->user_replica) {
+			cf_log_perr(conf, "Failed acquiring user replica");
+
+			goto error;
+		}
+	}
+
+	if (inst->group_replica_name) {
+		inst->group_replica = fr_ldap_replica_acquire(inst, inst->group_replica_name);
+		if (!inst->group_replica) {
+			cf_log_perr(conf, "Failed acquiring group replica");
+
+			goto error;
+		}
+	}
+
 	/*
 	 *	If we have a *pair* as opposed to a *section*
 	 *	then the module is referencing another ldap module's
@@ -2008,6 +2180,54 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		}
 	}
 
+	/*
+	 *	Fail now if the replicas don't copy the attributes
+	 *	we need.  If the ldap_sync listener hasn't been
+	 *	instantiated yet, it does the check instead.
+	 */
+	if (inst->user_replica) {
+		char const	**attrs = NULL;
+		map_t const	*map = NULL;
+
+		if (inst->userobj_access_attr) mod_replica_attr_add(inst->userobj_access_attr, &attrs);
+		if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
+			mod_replica_attr_add(inst->userobj_membership_attr, &attrs);
+		}
+		if (inst->profile_attr) mod_replica_attr_add(inst->profile_attr, &attrs);
+		if (inst->valuepair_attr) mod_replica_attr_add(inst->valuepair_attr, &attrs);
+
+		/*
+		 *	Attribute names which are expanded at
+		 *	runtime are checked when they're used.
+		 */
+		while ((map = map_list_next(&inst->user_map, map))) {
+			if (tmpl_is_unresolved(map->rhs) || tmpl_is_data(map->rhs)) {
+				mod_replica_attr_add(map->rhs->name, &attrs);
+			}
+		}
+		if (inst->userobj_filter) mod_replica_filter_attrs_add(&attrs, inst->userobj_filter->name);
+
+		if (mod_replica_require(inst->user_replica, NULL, attrs) < 0) {
+			cf_log_perr(conf, "Can't use user replica \"%s\"", inst->user_replica_name);
+			goto error;
+		}
+	}
+
+	/*
+	 *	Group names are looked up with the replica's key.
+	 */
+	if (inst->group_replica && inst->groupobj_name_attr) {
+		char const	**attrs = NULL;
+
+		mod_replica_attr_add(inst->groupobj_name_attr, &attrs);
+		if (inst->groupobj_filter) mod_replica_filter_attrs_add(&attrs, inst->groupobj_filter);
+
+		if (mod_replica_require(inst->group_replica, inst->groupobj_name_attr, attrs) < 0) {
+			cf_log_perr(conf, "Can't use group replica \"%s\"", inst->group_replica_name);
+			goto error;
+		}
+	}
+
 	return 0;
 
 error:
@@ -58,6 +58,11 @@ typedef struct {
 
 	int		userobj_scope;			//!< Search scope.
 
+	char const	*user_replica_name;		//!< Name of the ldap_sync replica holding user objects.
+	tmpl_t		*user_replica_key;		//!< Value to look up in the user replica.
+	bool		user_replica_fallback;		//!< Search the directory if the user isn't in the replica.
+	fr_ldap_replica_t *user_replica;		//!< Replica to look up user objects in.
+
 	char const	*userobj_membership_attr;	//!< Attribute that describes groups the user is a member of.
 	char const	*userobj_access_attr;		//!< Attribute to check to see if the user should be locked out.
 	bool		access_positive;		//!< If true the presence of the attribute will allow access,
@@ -78,6 +83,8 @@ typedef struct {
 	int		groupobj_scope;			//!< Search scope.
 
 	char const	*groupobj_name_attr;		//!< The name of the group.
+	char const	*group_replica_name;		//!< Name of the ldap_sync replica holding group objects.
+	fr_ldap_replica_t *group_replica;		//!< Replica used to resolve group names and DNs.
 	char const	*groupobj_membership_filter;	//!< Filter to only retrieve groups which contain
 							//!< the user as a member.
 
@@ -155,6 +162,12 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, request_t *request, fr_ld
 
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, LDAP *handle, LDAPMessage *entry);
 
+fr_ldap_replica_entry_t const *rlm_ldap_replica_find_user(rlm_ldap_t const *inst, request_t *request,
+							  rlm_rcode_t *rcode);
+
+rlm_rcode_t rlm_ldap_replica_check_access(rlm_ldap_t const *inst, request_t *request,
+					  fr_ldap_replica_entry_t const *entry);
+
 void rlm_ldap_check_reply(module_ctx_t const *mctx, request_t *request, fr_ldap_thread_trunk_t const *ttrunk);
 
 /*
@@ -164,6 +177,10 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t con
 					   request_t *request, fr_ldap_thread_trunk_t *ttrunk,
 					   LDAPMessage *entry, LDAP *handle, char const *attr);
 
+unlang_action_t rlm_ldap_replica_cacheable_userobj(rlm_rcode_t *p_result, rlm_ldap_t const *inst,
+						   request_t *request, fr_ldap_thread_trunk_t *ttrunk,
+						   fr_ldap_replica_entry_t const *entry, char const *attr);
+
 unlang_action_t rlm_ldap_cacheable_groupobj(rlm_rcode_t *p_result,
 					    rlm_ldap_t const *inst, request_t *request, fr_ldap_thread_trunk_t *ttrunk);
 
@@ -186,22 +186,19 @@ finish:
 	return vp ? vp->vp_strvalue : NULL;
 }
 
-/** Check for presence of access attribute in result
+/** Check the values of the access attribute
  *
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
- * @param[in] handle used to retrieve access attributes.
- * @param[in] entry retrieved by rlm_ldap_find_user or fr_ldap_search.
+ * @param[in] values of the access attribute, may be NULL.
  * @return
  *	- #RLM_MODULE_DISALLOW if the user was denied access.
  *	- #RLM_MODULE_OK otherwise.
  */
-rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, LDAP *handle, LDAPMessage *entry)
+static rlm_rcode_t ldap_check_access_values(rlm_ldap_t const *inst, request_t *request, struct berval **values)
 {
 	rlm_rcode_t rcode = RLM_MODULE_OK;
-	struct berval **values = NULL;
 
-	values = ldap_get_values_len(handle, entry, inst->userobj_access_attr);
 	if (values) {
 		if (inst->access_positive) {
 			if ((values[0]->bv_len >= 5) && (strncasecmp(values[0]->bv_val, "false", 5) == 0)) {
@@ -214,7 +211,6 @@ rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, LD
 			REDEBUG("\"%s\" attribute exists - user locked out", inst->userobj_access_attr);
 			rcode = RLM_MODULE_DISALLOW;
 		}
-		ldap_value_free_len(values);
 	} else if (inst->access_positive) {
 		REDEBUG("No \"%s\" attribute - user locked out", inst->userobj_access_attr);
 		rcode = RLM_MODULE_DISALLOW;
@@ -223,6 +219,150 @@ rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, LD
 	return rcode;
 }
 
+/** Check for presence of access attribute in result
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] handle used to retrieve access attributes.
+ * @param[in] entry retrieved by rlm_ldap_find_user or fr_ldap_search.
+ * @return
+ *	- #RLM_MODULE_DISALLOW if the user was denied access.
+ *	- #RLM_MODULE_OK otherwise.
+ */
+rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, LDAP *handle, LDAPMessage *entry)
+{
+	rlm_rcode_t rcode;
+	struct berval **values = NULL;
+
+	values = ldap_get_values_len(handle, entry, inst->userobj_access_attr);
+	rcode = ldap_check_access_values(inst, request, values);
+	if (values) ldap_value_free_len(values);
+
+	return rcode;
+}
+
+/** Find a user object in the user replica
+ *
+ * Expands user.replica.key and looks it up in the replica's index.  The entry must
+ * also be within user.base_dn and user.scope, and match user.filter, as it would
+ * have to be for the search to return it.  If the user is found, their DN is added
+ * to the control list as LDAP-UserDN.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ *			 #RLM_MODULE_NOTFOUND if the user isn't in the replica, or the
+ *			 directory must be searched to find out if they exist.
+ * @return
+ *	- The user's replica entry.  Must be released with #fr_ldap_replica_entry_release.
+ *	- NULL if the user wasn't found, or on error.
+ */
+fr_ldap_replica_entry_t const *rlm_ldap_replica_find_user(rlm_ldap_t const *inst, request_t *request,
+							  rlm_rcode_t *rcode)
+{
+	fr_ldap_replica_entry_t const	*entry;
+	fr_pair_t			*vp;
+	char const			*key;
+	char				key_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const			*filter = NULL;
+	char				filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const			*base_dn;
+	char				base_dn_buff[LDAP_MAX_DN_STR_LEN];
+
+	if (tmpl_expand(&key, key_buff, sizeof(key_buff), request, inst->user_replica_key, NULL, NULL) < 0) {
+		REDEBUG("Unable to create user replica key");
+		*rcode = RLM_MODULE_INVALID;
+
+		return NULL;
+	}
+
+	/*
+	 *	Expanded exactly as they are for the search
+	 */
+	if (inst->userobj_filter) {
+		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
+				fr_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			*rcode = RLM_MODULE_INVALID;
+
+			return NULL;
+		}
+	}
+
+	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
+			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		*rcode = RLM_MODULE_INVALID;
+
+		return NULL;
+	}
+
+	entry = fr_ldap_replica_find(inst->user_replica, key);
+	if (!entry) {
+		RDEBUG2("User \"%s\" not found in replica", key);
+		*rcode = RLM_MODULE_NOTFOUND;
+
+		return NULL;
+	}
+
+	switch (fr_ldap_replica_entry_match(inst->user_replica, entry, base_dn, inst->userobj_scope, filter)) {
+	case 1:
+		break;
+
+	case 0:
+		RDEBUG2("User object at DN \"%s\" in replica is not matched by user.base_dn, user.scope "
+			"and user.filter", fr_ldap_replica_entry_dn(entry));
+		fr_ldap_replica_entry_release(entry);
+		*rcode = RLM_MODULE_NOTFOUND;
+
+		return NULL;
+
+	default:
+		/*
+		 *	We can't tell whether the search would
+		 *	return the user, so only the directory
+		 *	can answer.
+		 */
+		RPWDEBUG("Can't check user object at DN \"%s\" in replica against user.filter",
+			 fr_ldap_replica_entry_dn(entry));
+		fr_ldap_replica_entry_release(entry);
+		*rcode = inst->user_replica_fallback ? RLM_MODULE_NOTFOUND : RLM_MODULE_FAIL;
+
+		return NULL;
+	}
+
+	RDEBUG2("User object found in replica at DN \"%s\"", fr_ldap_replica_entry_dn(entry));
+
+	MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
+	fr_pair_value_strdup(vp, fr_ldap_replica_entry_dn(entry), false);
+	*rcode = RLM_MODULE_OK;
+
+	return entry;
+}
+
+/** Check for presence of access attribute in a replica entry
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] entry retrieved by rlm_ldap_replica_find_user.
+ * @return
+ *	- #RLM_MODULE_DISALLOW if the user was denied access.
+ *	- #RLM_MODULE_FAIL if the replica doesn't copy the access attribute.
+ *	- #RLM_MODULE_OK otherwise.
+ */
+rlm_rcode_t rlm_ldap_replica_check_access(rlm_ldap_t const *inst, request_t *request,
+					  fr_ldap_replica_entry_t const *entry)
+{
+	struct berval **values;
+
+	if (fr_ldap_replica_entry_values(&values, inst->user_replica, entry, inst->userobj_access_attr) < 0) {
+		RPEDEBUG("Can't check access");
+		return RLM_MODULE_FAIL;
+	}
+
+	return ldap_check_access_values(inst, request, values);
+}
+
 /** Verify we got a password from the search
  *
  * Checks to see if after the LDAP to RADIUS mapping has been completed that a reference password.
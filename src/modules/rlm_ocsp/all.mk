@@ -0,0 +1 @@
+SUBMAKEFILES := rlm_ocsp.mk ocsp_cache_tests.mk ocsp_fetch_tests.mk
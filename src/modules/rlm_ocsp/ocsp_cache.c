@@ -0,0 +1,365 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file ocsp_cache.c
+ * @brief Cache of OCSP responses, shared by all workers.
+ *
+ * Responses are keyed by the DER encoding of the OCSP_CERTID, which
+ * contains the hash of the issuer's name, the hash of the issuer's
+ * public key, and the serial number of the certificate.  A response
+ * is used until its nextUpdate time, or until the cache's default
+ * lifetime if the responder didn't provide one.
+ *
+ * Each entry records how many times it was used since it was last
+ * fetched.  Entries which are used frequently, and are close to
+ * expiring, can be claimed by a prefetcher, which fetches a new
+ * response in the background and replaces the entry, so that
+ * frequently seen certificates never need to wait for the responder.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+
+#include <pthread.h>
+
+#include "ocsp_cache.h"
+
+/** A cached OCSP response
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;		//!< Entry in the LRU list.
+	uint8_t			*key;		//!< DER encoded OCSP_CERTID.
+
+	char			*host;		//!< OCSP responder the response came from.
+	char			*port;
+	char			*path;
+
+	int			status;		//!< V_OCSP_CERTSTATUS_* value.
+	uint8_t			*response;	//!< DER encoded OCSP_RESPONSE.
+	fr_unix_time_t		next_update;	//!< When the response must be refreshed.
+
+	uint32_t		hits;		//!< Number of times used since it was fetched.
+	bool			refreshing;	//!< A prefetcher is fetching a new response.
+} ocsp_cache_entry_t;
+
+struct ocsp_cache_s {
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+	TALLOC_CTX		*pool;		//!< Entries are allocated from here.
+	fr_hash_table_t		*ht;		//!< Entries indexed by key.
+	fr_dlist_head_t		lru;		//!< Most recently used at the head.
+	uint32_t		max_entries;	//!< Maximum number of responses to hold.
+
+	ocsp_cache_stats_t	stats;
+};
+
+static uint32_t ocsp_cache_entry_hash(void const *data)
+{
+	ocsp_cache_entry_t const *entry = data;
+
+	return fr_hash(entry->key, talloc_array_length(entry->key));
+}
+
+static int8_t ocsp_cache_entry_cmp(void const *one, void const *two)
+{
+	ocsp_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(talloc_array_length(a->key), talloc_array_length(b->key));
+	if (ret != 0) return ret;
+
+	ret = memcmp(a->key, b->key, talloc_array_length(a->key));
+	return CMP(ret, 0);
+}
+
+/** Unlink an entry and free it
+ *
+ * @note Cache must be locked.
+ */
+static inline CC_HINT(always_inline)
+void ocsp_cache_entry_free(ocsp_cache_t *cache, ocsp_cache_entry_t *entry)
+{
+	fr_hash_table_remove(cache->ht, entry);
+	fr_dlist_remove(&cache->lru, entry);
+	talloc_free(entry);
+}
+
+/** Build a cache key from an OCSP certificate ID
+ *
+ * @param[in] ctx	to allocate the key in.
+ * @param[in] certid	to encode.
+ * @return
+ *	- The DER encoded certid.
+ *	- NULL on error.
+ */
+uint8_t *ocsp_cache_key(TALLOC_CTX *ctx, OCSP_CERTID *certid)
+{
+	uint8_t	*key, *p;
+	int	len;
+
+	len = i2d_OCSP_CERTID(certid, NULL);
+	if (len <= 0) return NULL;
+
+	MEM(key = talloc_array(ctx, uint8_t, len));
+	p = key;
+	if (i2d_OCSP_CERTID(certid, &p) != len) {
+		talloc_free(key);
+		return NULL;
+	}
+
+	return key;
+}
+
+/** Find a current response for a certificate
+ *
+ * @param[in] ctx		to allocate the copy of the response in.
+ * @param[out] response		DER encoded OCSP_RESPONSE.  May be NULL if the
+ *				caller only needs the status.
+ * @param[out] status		V_OCSP_CERTSTATUS_* value for the certificate.
+ * @param[out] next_update	When the response expires.
+ * @param[in] cache		to search.
+ * @param[in] key		produced by #ocsp_cache_key.
+ * @return
+ *	- true if a response was found.
+ *	- false if there's no response, or it has expired.
+ */
+bool ocsp_cache_find(TALLOC_CTX *ctx, uint8_t **response, int *status, fr_unix_time_t *next_update,
+		     ocsp_cache_t *cache, uint8_t const *key)
+{
+	ocsp_cache_entry_t	*entry;
+	bool			found = false;
+
+	pthread_mutex_lock(&cache->mutex);
+	cache->stats.lookups++;
+
+	entry = fr_hash_table_find(cache->ht, &(ocsp_cache_entry_t){ .key = UNCONST(uint8_t *, key) });
+	if (!entry) goto done;
+
+	if (fr_unix_time_lteq(entry->next_update, fr_time_to_unix_time(fr_time()))) {
+		/*
+		 *	Leave it for the prefetcher, it'll be
+		 *	replaced shortly.
+		 */
+		if (!entry->refreshing) ocsp_cache_entry_free(cache, entry);
+		goto done;
+	}
+
+	entry->hits++;
+	fr_dlist_remove(&cache->lru, entry);
+	fr_dlist_insert_head(&cache->lru, entry);
+
+	if (response) {
+		MEM(*response = talloc_memdup(ctx, entry->response, talloc_array_length(entry->response)));
+		talloc_set_type(*response, uint8_t);
+	}
+	*status = entry->status;
+	*next_update = entry->next_update;
+	found = true;
+
+done:
+	if (found) {
+		cache->stats.hits++;
+	} else {
+		cache->stats.misses++;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return found;
+}
+
+/** Add or replace a response
+ *
+ * @param[in] cache		to add the response to.
+ * @param[in] key		produced by #ocsp_cache_key.
+ * @param[in] host		of the OCSP responder, used for prefetching.
+ * @param[in] port		of the OCSP responder, used for prefetching.
+ * @param[in] path		of the OCSP responder, used for prefetching.
+ * @param[in] status		V_OCSP_CERTSTATUS_* value for the certificate.
+ * @param[in] response		DER encoded OCSP_RESPONSE.
+ * @param[in] response_len	Length of the response.
+ * @param[in] next_update	When the response expires.
+ * @param[in] refresh		true if this response was fetched by a prefetcher.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int ocsp_cache_insert(ocsp_cache_t *cache, uint8_t const *key,
+		      char const *host, char const *port, char const *path,
+		      int status, uint8_t const *response, size_t response_len,
+		      fr_unix_time_t next_update, bool refresh)
+{
+	ocsp_cache_entry_t	*entry, *old;
+	int			ret = 0;
+
+	pthread_mutex_lock(&cache->mutex);
+	old = fr_hash_table_find(cache->ht, &(ocsp_cache_entry_t){ .key = UNCONST(uint8_t *, key) });
+	if (old) ocsp_cache_entry_free(cache, old);
+
+	while ((fr_dlist_num_elements(&cache->lru) >= cache->max_entries) &&
+	       (old = fr_dlist_tail(&cache->lru))) {
+		cache->stats.evictions++;
+		ocsp_cache_entry_free(cache, old);
+	}
+
+	MEM(entry = talloc_zero(cache->pool, ocsp_cache_entry_t));
+	MEM(entry->key = talloc_memdup(entry, key, talloc_array_length(key)));
+	talloc_set_type(entry->key, uint8_t);
+	MEM(entry->host = talloc_strdup(entry, host));
+	MEM(entry->port = talloc_strdup(entry, port));
+	MEM(entry->path = talloc_strdup(entry, path));
+	entry->status = status;
+	MEM(entry->response = talloc_memdup(entry, response, response_len));
+	talloc_set_type(entry->response, uint8_t);
+	entry->next_update = next_update;
+
+	if (!fr_hash_table_insert(cache->ht, entry)) {
+		talloc_free(entry);
+		ret = -1;
+		goto done;
+	}
+	fr_dlist_insert_head(&cache->lru, entry);
+
+	if (refresh) {
+		cache->stats.refreshes++;
+	} else {
+		cache->stats.inserts++;
+	}
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/** Claim responses which should be refreshed
+ *
+ * A response is due if it was used at least min_hits times since it
+ * was fetched, and it expires within the prefetch window.  Claimed
+ * responses won't be returned again until they're replaced with
+ * #ocsp_cache_insert, or released with #ocsp_cache_prefetch_release.
+ *
+ * @param[in] ctx	to allocate the array of claims in.
+ * @param[in] cache	to search.
+ * @param[in] window	How long before expiry a response can be refreshed.
+ * @param[in] min_hits	Minimum number of uses since the response was fetched.
+ * @param[in] max	Maximum number of responses to claim.
+ * @return
+ *	- A talloced array of claims.
+ *	- NULL if no responses are due.
+ */
+ocsp_cache_prefetch_t *ocsp_cache_prefetch_claim(TALLOC_CTX *ctx, ocsp_cache_t *cache,
+						 fr_time_delta_t window, uint32_t min_hits, size_t max)
+{
+	ocsp_cache_prefetch_t	*out = NULL;
+	ocsp_cache_entry_t	*entry = NULL;
+	fr_unix_time_t		due = fr_unix_time_add_time_delta(fr_time_to_unix_time(fr_time()), window);
+	size_t			num = 0;
+
+	pthread_mutex_lock(&cache->mutex);
+	while ((num < max) && (entry = fr_dlist_next(&cache->lru, entry))) {
+		ocsp_cache_prefetch_t *claim;
+
+		if (entry->refreshing || (entry->hits < min_hits) ||
+		    fr_unix_time_gt(entry->next_update, due)) continue;
+
+		if (!out) MEM(out = talloc_array(ctx, ocsp_cache_prefetch_t, max));
+		claim = &out[num++];
+
+		MEM(claim->key = talloc_memdup(out, entry->key, talloc_array_length(entry->key)));
+		talloc_set_type(claim->key, uint8_t);
+		MEM(claim->host = talloc_strdup(out, entry->host));
+		MEM(claim->port = talloc_strdup(out, entry->port));
+		MEM(claim->path = talloc_strdup(out, entry->path));
+
+		entry->refreshing = true;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	if (out) MEM(out = talloc_realloc(ctx, out, ocsp_cache_prefetch_t, num));
+
+	return out;
+}
+
+/** Release a claim after a failed prefetch
+ *
+ * The existing response is kept until it expires, and the entry may
+ * be claimed again.
+ *
+ * @param[in] cache	the response was claimed from.
+ * @param[in] key	of the claimed response.
+ */
+void ocsp_cache_prefetch_release(ocsp_cache_t *cache, uint8_t const *key)
+{
+	ocsp_cache_entry_t *entry;
+
+	pthread_mutex_lock(&cache->mutex);
+	cache->stats.refresh_failures++;
+	entry = fr_hash_table_find(cache->ht, &(ocsp_cache_entry_t){ .key = UNCONST(uint8_t *, key) });
+	if (entry) entry->refreshing = false;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Copy the cache's counters
+ *
+ * @param[out] stats	Where to write the counters.
+ * @param[in] cache	to retrieve counters for.
+ */
+void ocsp_cache_stats(ocsp_cache_stats_t *stats, ocsp_cache_t *cache)
+{
+	pthread_mutex_lock(&cache->mutex);
+	*stats = cache->stats;
+	stats->entries = fr_dlist_num_elements(&cache->lru);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+static int _ocsp_cache_free(ocsp_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate a new OCSP response cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of responses to hold.
+ * @return A new cache.
+ */
+ocsp_cache_t *ocsp_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries)
+{
+	ocsp_cache_t *cache;
+
+	fr_assert(max_entries > 0);
+
+	MEM(cache = talloc_zero(ctx, ocsp_cache_t));
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	MEM(cache->pool = talloc_new(cache));
+	MEM(cache->ht = fr_hash_table_alloc(cache, ocsp_cache_entry_hash, ocsp_cache_entry_cmp, NULL));
+	fr_dlist_init(&cache->lru, ocsp_cache_entry_t, entry);
+	cache->max_entries = max_entries;
+
+	return cache;
+}
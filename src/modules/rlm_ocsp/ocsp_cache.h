@@ -0,0 +1,78 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ocsp_cache.h
+ * @brief Cache of OCSP responses, shared by all workers.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSIDH(ocsp_cache_h, "$Id$")
+
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+#include <freeradius-devel/tls/openssl_user_macros.h>
+#include <openssl/ocsp.h>
+
+typedef struct ocsp_cache_s ocsp_cache_t;
+
+/** A cached response which should be refreshed
+ *
+ * Everything needed to send a new request, copied out of the cache
+ * so it can be used without holding the cache lock.
+ */
+typedef struct {
+	uint8_t		*key;				//!< DER encoded OCSP_CERTID.
+	char		*host;				//!< OCSP responder host.
+	char		*port;				//!< OCSP responder port.
+	char		*path;				//!< OCSP responder path.
+} ocsp_cache_prefetch_t;
+
+/** Counters for an OCSP response cache
+ *
+ */
+typedef struct {
+	uint64_t	lookups;			//!< Number of times a certificate's status was requested.
+	uint64_t	hits;				//!< Lookups which found a current response.
+	uint64_t	misses;				//!< Lookups which found nothing, or an expired response.
+	uint64_t	inserts;			//!< Responses added by the handshake path.
+	uint64_t	refreshes;			//!< Responses replaced by prefetching.
+	uint64_t	refresh_failures;		//!< Prefetches which failed.
+	uint64_t	evictions;			//!< Responses removed to stay under max_entries.
+	uint64_t	entries;			//!< Responses currently in the cache.
+} ocsp_cache_stats_t;
+
+ocsp_cache_t		*ocsp_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries);
+
+uint8_t			*ocsp_cache_key(TALLOC_CTX *ctx, OCSP_CERTID *certid);
+
+bool			ocsp_cache_find(TALLOC_CTX *ctx, uint8_t **response, int *status, fr_unix_time_t *next_update,
+					ocsp_cache_t *cache, uint8_t const *key);
+
+int			ocsp_cache_insert(ocsp_cache_t *cache, uint8_t const *key,
+					  char const *host, char const *port, char const *path,
+					  int status, uint8_t const *response, size_t response_len,
+					  fr_unix_time_t next_update, bool refresh);
+
+ocsp_cache_prefetch_t	*ocsp_cache_prefetch_claim(TALLOC_CTX *ctx, ocsp_cache_t *cache,
+						   fr_time_delta_t window, uint32_t min_hits, size_t max);
+
+void			ocsp_cache_prefetch_release(ocsp_cache_t *cache, uint8_t const *key);
+
+void			ocsp_cache_stats(ocsp_cache_stats_t *stats, ocsp_cache_t *cache);
@@ -0,0 +1,294 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the OCSP response cache
+ *
+ * @file src/modules/rlm_ocsp/ocsp_cache_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/version.h>
+
+#include "ocsp_cache.c"
+
+static TALLOC_CTX	*autofree;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("ocsp_cache_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_time_start() < 0) goto error;
+}
+
+static fr_unix_time_t test_expires(int64_t sec)
+{
+	return fr_unix_time_add(fr_time_to_unix_time(fr_time()), fr_time_delta_from_sec(sec));
+}
+
+static uint8_t *test_key(char const *name)
+{
+	uint8_t *key;
+
+	MEM(key = talloc_memdup(autofree, name, strlen(name)));
+	talloc_set_type(key, uint8_t);
+
+	return key;
+}
+
+static int test_insert(ocsp_cache_t *cache, char const *name, int status, char const *response,
+		       fr_unix_time_t next_update, bool refresh)
+{
+	return ocsp_cache_insert(cache, test_key(name), "127.0.0.1", "8080", "/",
+				 status, (uint8_t const *)response, strlen(response), next_update, refresh);
+}
+
+static bool test_find(ocsp_cache_t *cache, char const *name)
+{
+	int		status;
+	fr_unix_time_t	next_update;
+
+	return ocsp_cache_find(NULL, NULL, &status, &next_update, cache, test_key(name));
+}
+
+/** Build a certificate ID for a made up issuer
+ *
+ */
+static OCSP_CERTID *test_certid(long serial)
+{
+	X509_NAME	*name;
+	ASN1_BIT_STRING	*key;
+	unsigned char	key_data[] = "key";
+	ASN1_INTEGER	*sn;
+	OCSP_CERTID	*certid;
+
+	MEM(name = X509_NAME_new());
+	TEST_CHECK(X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+					      (unsigned char const *)"Test CA", -1, -1, 0) == 1);
+	MEM(key = ASN1_BIT_STRING_new());
+	TEST_CHECK(ASN1_BIT_STRING_set(key, key_data, sizeof(key_data) - 1) == 1);
+	MEM(sn = ASN1_INTEGER_new());
+	TEST_CHECK(ASN1_INTEGER_set(sn, serial) == 1);
+
+	certid = OCSP_cert_id_new(EVP_sha1(), name, key, sn);
+
+	ASN1_INTEGER_free(sn);
+	ASN1_BIT_STRING_free(key);
+	X509_NAME_free(name);
+
+	return certid;
+}
+
+static void test_key_certid(void)
+{
+	OCSP_CERTID	*a, *b, *c;
+	uint8_t		*key_a, *key_b, *key_c;
+
+	a = test_certid(1);
+	b = test_certid(1);
+	c = test_certid(2);
+	TEST_ASSERT(a && b && c);
+
+	key_a = ocsp_cache_key(autofree, a);
+	key_b = ocsp_cache_key(autofree, b);
+	key_c = ocsp_cache_key(autofree, c);
+	TEST_ASSERT(key_a && key_b && key_c);
+
+	TEST_CASE("The same issuer and serial produce the same key");
+	TEST_CHECK(talloc_array_length(key_a) == talloc_array_length(key_b));
+	TEST_CHECK(memcmp(key_a, key_b, talloc_array_length(key_a)) == 0);
+
+	TEST_CASE("A different serial produces a different key");
+	TEST_CHECK((talloc_array_length(key_a) != talloc_array_length(key_c)) ||
+		   (memcmp(key_a, key_c, talloc_array_length(key_a)) != 0));
+
+	OCSP_CERTID_free(a);
+	OCSP_CERTID_free(b);
+	OCSP_CERTID_free(c);
+}
+
+static void test_insert_find(void)
+{
+	ocsp_cache_t		*cache;
+	ocsp_cache_stats_t	stats;
+	fr_unix_time_t		expires = test_expires(60), next_update;
+	uint8_t			*response = NULL;
+	int			status = -1;
+
+	cache = ocsp_cache_alloc(autofree, 16);
+	TEST_ASSERT(cache != NULL);
+
+	TEST_CHECK(test_insert(cache, "one", V_OCSP_CERTSTATUS_GOOD, "resp1", expires, false) == 0);
+
+	TEST_CASE("Responses are found by key");
+	TEST_CHECK(ocsp_cache_find(autofree, &response, &status, &next_update, cache, test_key("one")));
+	TEST_CHECK(status == V_OCSP_CERTSTATUS_GOOD);
+	TEST_CHECK(fr_unix_time_eq(next_update, expires));
+	TEST_ASSERT(response != NULL);
+	TEST_CHECK(talloc_array_length(response) == 5);
+	TEST_CHECK(memcmp(response, "resp1", 5) == 0);
+
+	TEST_CHECK(!test_find(cache, "two"));
+
+	TEST_CASE("Inserting the same key replaces the response");
+	TEST_CHECK(test_insert(cache, "one", V_OCSP_CERTSTATUS_REVOKED, "resp2", expires, false) == 0);
+	TEST_CHECK(ocsp_cache_find(NULL, NULL, &status, &next_update, cache, test_key("one")));
+	TEST_CHECK(status == V_OCSP_CERTSTATUS_REVOKED);
+
+	ocsp_cache_stats(&stats, cache);
+	TEST_CHECK(stats.lookups == 3);
+	TEST_CHECK(stats.hits == 2);
+	TEST_CHECK(stats.misses == 1);
+	TEST_CHECK(stats.inserts == 2);
+	TEST_CHECK(stats.entries == 1);
+
+	talloc_free(cache);
+}
+
+static void test_expiry(void)
+{
+	ocsp_cache_t		*cache;
+	ocsp_cache_stats_t	stats;
+
+	cache = ocsp_cache_alloc(autofree, 16);
+	TEST_ASSERT(cache != NULL);
+
+	TEST_CASE("Responses past their nextUpdate aren't returned");
+	TEST_CHECK(test_insert(cache, "old", V_OCSP_CERTSTATUS_GOOD, "resp", test_expires(-1), false) == 0);
+	TEST_CHECK(!test_find(cache, "old"));
+
+	ocsp_cache_stats(&stats, cache);
+	TEST_CHECK(stats.misses == 1);
+	TEST_CHECK(stats.entries == 0);
+
+	talloc_free(cache);
+}
+
+static void test_lru(void)
+{
+	ocsp_cache_t		*cache;
+	ocsp_cache_stats_t	stats;
+
+	cache = ocsp_cache_alloc(autofree, 2);
+	TEST_ASSERT(cache != NULL);
+
+	TEST_CHECK(test_insert(cache, "a", V_OCSP_CERTSTATUS_GOOD, "resp", test_expires(60), false) == 0);
+	TEST_CHECK(test_insert(cache, "b", V_OCSP_CERTSTATUS_GOOD, "resp", test_expires(60), false) == 0);
+
+	/*
+	 *	Makes "b" the least recently used
+	 */
+	TEST_CHECK(test_find(cache, "a"));
+
+	TEST_CASE("The least recently used response is evicted when the cache is full");
+	TEST_CHECK(test_insert(cache, "c", V_OCSP_CERTSTATUS_GOOD, "resp", test_expires(60), false) == 0);
+	TEST_CHECK(test_find(cache, "a"));
+	TEST_CHECK(!test_find(cache, "b"));
+	TEST_CHECK(test_find(cache, "c"));
+
+	ocsp_cache_stats(&stats, cache);
+	TEST_CHECK(stats.evictions == 1);
+	TEST_CHECK(stats.entries == 2);
+
+	talloc_free(cache);
+}
+
+static void test_prefetch(void)
+{
+	ocsp_cache_t		*cache;
+	ocsp_cache_stats_t	stats;
+	ocsp_cache_prefetch_t	*claims;
+	fr_time_delta_t		window = fr_time_delta_from_sec(60);
+
+	cache = ocsp_cache_alloc(autofree, 16);
+	TEST_ASSERT(cache != NULL);
+
+	TEST_CHECK(test_insert(cache, "hot", V_OCSP_CERTSTATUS_GOOD, "resp", test_expires(30), false) == 0);
+	TEST_CHECK(test_insert(cache, "cold", V_OCSP_CERTSTATUS_GOOD, "resp", test_expires(30), false) == 0);
+	TEST_CHECK(test_insert(cache, "later", V_OCSP_CERTSTATUS_GOOD, "resp", test_expires(3600), false) == 0);
+
+	TEST_CHECK(test_find(cache, "hot"));
+	TEST_CHECK(test_find(cache, "hot"));
+	TEST_CHECK(test_find(cache, "cold"));
+	TEST_CHECK(test_find(cache, "later"));
+	TEST_CHECK(test_find(cache, "later"));
+
+	TEST_CASE("Only frequently used responses close to expiry are claimed");
+	claims = ocsp_cache_prefetch_claim(autofree, cache, window, 2, 16);
+	TEST_ASSERT(claims != NULL);
+	TEST_CHECK(talloc_array_length(claims) == 1);
+	TEST_CHECK((talloc_array_length(claims[0].key) == 3) && (memcmp(claims[0].key, "hot", 3) == 0));
+	TEST_CHECK(strcmp(claims[0].host, "127.0.0.1") == 0);
+	TEST_CHECK(strcmp(claims[0].port, "8080") == 0);
+	TEST_CHECK(strcmp(claims[0].path, "/") == 0);
+	talloc_free(claims);
+
+	TEST_CASE("A claimed response isn't claimed twice");
+	TEST_CHECK(ocsp_cache_prefetch_claim(autofree, cache, window, 2, 16) == NULL);
+
+	TEST_CASE("A released response can be claimed again, and is still served");
+	ocsp_cache_prefetch_release(cache, test_key("hot"));
+	TEST_CHECK(test_find(cache, "hot"));
+	claims = ocsp_cache_prefetch_claim(autofree, cache, window, 2, 16);
+	TEST_CHECK(talloc_array_length(claims) == 1);
+	talloc_free(claims);
+
+	TEST_CASE("A refreshed response is no longer due");
+	TEST_CHECK(test_insert(cache, "hot", V_OCSP_CERTSTATUS_GOOD, "resp", test_expires(30), true) == 0);
+	TEST_CHECK(test_find(cache, "hot"));
+	TEST_CHECK(ocsp_cache_prefetch_claim(autofree, cache, window, 2, 16) == NULL);
+
+	ocsp_cache_stats(&stats, cache);
+	TEST_CHECK(stats.inserts == 3);
+	TEST_CHECK(stats.refreshes == 1);
+	TEST_CHECK(stats.refresh_failures == 1);
+	TEST_CHECK(stats.entries == 3);
+
+	talloc_free(cache);
+}
+
+TEST_LIST = {
+	{ "key_certid",		test_key_certid },
+	{ "insert_find",	test_insert_find },
+	{ "expiry",		test_expiry },
+	{ "lru",		test_lru },
+	{ "prefetch",		test_prefetch },
+
+	{ NULL }
+};
@@ -0,0 +1,265 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file ocsp_fetch.c
+ * @brief Non-blocking OCSP requests.
+ *
+ * The HTTP exchange with the OCSP responder is driven by
+ * OCSP_sendreq_nbio() over a non-blocking connect BIO.  The BIO's
+ * file descriptor is inserted into the caller's event list, and a
+ * callback is called when the response has been received, or the
+ * request times out.  Nothing blocks.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#define LOG_PREFIX "ocsp"
+
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include "ocsp_fetch.h"
+
+/*
+ *	OpenSSL >= 3.0 only provides the OCSP_REQ_CTX API if
+ *	deprecated interfaces are enabled, and we disable them.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  define OCSP_REQ_CTX			OSSL_HTTP_REQ_CTX
+#  define OCSP_REQ_CTX_free		OSSL_HTTP_REQ_CTX_free
+#  define OCSP_REQ_CTX_add1_header	OSSL_HTTP_REQ_CTX_add1_header
+#  define OCSP_REQ_CTX_set1_req(_ctx, _req) \
+	OSSL_HTTP_REQ_CTX_set1_req(_ctx, "application/ocsp-request", ASN1_ITEM_rptr(OCSP_REQUEST), \
+				   (ASN1_VALUE const *)(_req))
+#  define OCSP_sendreq_nbio(_out, _ctx) \
+	OSSL_HTTP_REQ_CTX_nbio_d2i(_ctx, (ASN1_VALUE **)(_out), ASN1_ITEM_rptr(OCSP_RESPONSE))
+#endif
+
+struct ocsp_fetch_s {
+	BIO			*conn;		//!< Connection to the OCSP responder.
+	OCSP_REQ_CTX		*ctx;		//!< HTTP request state.
+	int			fd;		//!< The connection's file descriptor.
+
+	fr_event_list_t		*el;		//!< Event list the descriptor was inserted into.
+	fr_event_timer_t const	*ev;		//!< Request timeout.
+	bool			reading;	//!< Request has been written, only waiting for readability.
+
+	ocsp_fetch_cb_t		cb;		//!< Called on completion.
+	void			*uctx;		//!< Passed to the callback.
+};
+
+static int _ocsp_fetch_free(ocsp_fetch_t *fetch)
+{
+	if (fetch->el && (fetch->fd >= 0)) fr_event_fd_delete(fetch->el, fetch->fd, FR_EVENT_FILTER_IO);
+	if (fetch->ctx) OCSP_REQ_CTX_free(fetch->ctx);
+	if (fetch->conn) BIO_free_all(fetch->conn);
+
+	return 0;
+}
+
+/** Connect to the responder, and prepare the HTTP request
+ *
+ */
+static ocsp_fetch_t *ocsp_fetch_alloc(TALLOC_CTX *ctx,
+				      char const *host, char const *port, char const *path, OCSP_REQUEST *req)
+{
+	ocsp_fetch_t	*fetch;
+	char		host_header[1024];
+	int		rc;
+
+	/* Check host and port length are sane, then create Host: HTTP header */
+	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
+		fr_strerror_const("Host and port too long");
+		return NULL;
+	}
+	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
+
+	MEM(fetch = talloc_zero(ctx, ocsp_fetch_t));
+	fetch->fd = -1;
+	talloc_set_destructor(fetch, _ocsp_fetch_free);
+
+	fetch->conn = BIO_new_connect(host);
+	if (!fetch->conn) {
+		fr_strerror_const("Failed allocating connection");
+	error:
+		talloc_free(fetch);
+		return NULL;
+	}
+	BIO_set_conn_port(fetch->conn, port);
+	BIO_set_nbio(fetch->conn, 1);
+
+	rc = BIO_do_connect(fetch->conn);
+	if ((rc <= 0) && !BIO_should_retry(fetch->conn)) {
+		fr_strerror_printf("Couldn't connect to OCSP responder %s", host_header);
+		goto error;
+	}
+
+	if ((BIO_get_fd(fetch->conn, &fetch->fd) < 0) || (fetch->fd < 0)) {
+		fr_strerror_const("Couldn't get file descriptor for connection");
+		goto error;
+	}
+
+	fetch->ctx = OCSP_sendreq_new(fetch->conn, path, NULL, -1);
+	if (!fetch->ctx) {
+		fr_strerror_const("Couldn't create OCSP request");
+		goto error;
+	}
+
+	if (!OCSP_REQ_CTX_add1_header(fetch->ctx, "Host", host_header)) {
+		fr_strerror_const("Couldn't set Host header");
+		goto error;
+	}
+
+	if (!OCSP_REQ_CTX_set1_req(fetch->ctx, req)) {
+		fr_strerror_const("Couldn't add data to OCSP request");
+		goto error;
+	}
+
+	return fetch;
+}
+
+/** Advance the request
+ *
+ * @return
+ *	- 1 if the response was received.
+ *	- 0 if we need to wait for the descriptor.
+ *	- -1 on error.
+ */
+static int ocsp_fetch_step(OCSP_RESPONSE **out, ocsp_fetch_t *fetch)
+{
+	int rc;
+
+	rc = OCSP_sendreq_nbio(out, fetch->ctx);
+	if (rc == 1) return 1;
+	if ((rc == 0) || !BIO_should_retry(fetch->conn)) {
+		fr_strerror_const("Couldn't get OCSP response");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Call the callback, and free the fetch
+ *
+ */
+static void ocsp_fetch_done(ocsp_fetch_t *fetch, OCSP_RESPONSE *resp)
+{
+	ocsp_fetch_cb_t	cb = fetch->cb;
+	void		*uctx = fetch->uctx;
+
+	talloc_free(fetch);
+	cb(resp, uctx);
+}
+
+static void ocsp_fetch_io(fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx);
+
+static void ocsp_fetch_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	ocsp_fetch_t *fetch = talloc_get_type_abort(uctx, ocsp_fetch_t);
+
+	DEBUG2("OCSP request failed: %s", fr_syserror(fd_errno));
+	ocsp_fetch_done(fetch, NULL);
+}
+
+static void ocsp_fetch_io(fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	ocsp_fetch_t	*fetch = talloc_get_type_abort(uctx, ocsp_fetch_t);
+	OCSP_RESPONSE	*resp = NULL;
+
+	switch (ocsp_fetch_step(&resp, fetch)) {
+	case 1:
+		ocsp_fetch_done(fetch, resp);
+		return;
+
+	case 0:
+		break;
+
+	default:
+		PDEBUG2("OCSP request failed");
+		ocsp_fetch_done(fetch, NULL);
+		return;
+	}
+
+	/*
+	 *	Once the request has been written we only
+	 *	need to know when the response arrives,
+	 *	otherwise the write filter fires continuously.
+	 */
+	if (!fetch->reading && BIO_should_read(fetch->conn)) {
+		fetch->reading = true;
+		if (fr_event_fd_insert(fetch, el, fetch->fd, ocsp_fetch_io, NULL, ocsp_fetch_error, fetch) < 0) {
+			PDEBUG2("Failed updating OCSP request filters");
+			ocsp_fetch_done(fetch, NULL);
+		}
+	}
+}
+
+static void ocsp_fetch_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	ocsp_fetch_t *fetch = talloc_get_type_abort(uctx, ocsp_fetch_t);
+
+	DEBUG2("OCSP request timed out");
+	ocsp_fetch_done(fetch, NULL);
+}
+
+/** Send an OCSP request without blocking
+ *
+ * @param[in] ctx	to allocate the request in.  Freeing the request before it
+ *			completes cancels it, and the callback is not called.
+ * @param[in] el	to insert the connection into.
+ * @param[in] host	of the OCSP responder.
+ * @param[in] port	of the OCSP responder.
+ * @param[in] path	of the OCSP responder.
+ * @param[in] req	to send.  Is copied, and may be freed after this function returns.
+ * @param[in] timeout	Maximum time to wait for a response.
+ * @param[in] cb	to call when the request completes.  The request is freed
+ *			before the callback is called.
+ * @param[in] uctx	to pass to the callback.
+ * @return
+ *	- The new request.
+ *	- NULL on error.  The callback won't be called.
+ */
+ocsp_fetch_t *ocsp_fetch_start(TALLOC_CTX *ctx, fr_event_list_t *el,
+			       char const *host, char const *port, char const *path, OCSP_REQUEST *req,
+			       fr_time_delta_t timeout, ocsp_fetch_cb_t cb, void *uctx)
+{
+	ocsp_fetch_t *fetch;
+
+	fetch = ocsp_fetch_alloc(ctx, host, port, path, req);
+	if (!fetch) return NULL;
+
+	fetch->cb = cb;
+	fetch->uctx = uctx;
+
+	if (fr_event_fd_insert(fetch, el, fetch->fd, ocsp_fetch_io, ocsp_fetch_io, ocsp_fetch_error, fetch) < 0) {
+		talloc_free(fetch);
+		return NULL;
+	}
+	fetch->el = el;
+
+	if (fr_event_timer_in(fetch, el, &fetch->ev, timeout, ocsp_fetch_timeout, fetch) < 0) {
+		talloc_free(fetch);
+		return NULL;
+	}
+
+	return fetch;
+}
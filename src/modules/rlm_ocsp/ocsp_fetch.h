@@ -0,0 +1,45 @@
+#pragma once
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ocsp_fetch.h
+ * @brief Non-blocking OCSP requests.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSIDH(ocsp_fetch_h, "$Id$")
+
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <freeradius-devel/tls/openssl_user_macros.h>
+#include <openssl/ocsp.h>
+
+typedef struct ocsp_fetch_s ocsp_fetch_t;
+
+/** Called when an OCSP request completes
+ *
+ * @param[in] resp	The response, or NULL if the request failed or timed out.
+ *			The callback takes ownership of the response.
+ * @param[in] uctx	passed to #ocsp_fetch_start.
+ */
+typedef void (*ocsp_fetch_cb_t)(OCSP_RESPONSE *resp, void *uctx);
+
+ocsp_fetch_t	*ocsp_fetch_start(TALLOC_CTX *ctx, fr_event_list_t *el,
+				  char const *host, char const *port, char const *path, OCSP_REQUEST *req,
+				  fr_time_delta_t timeout, ocsp_fetch_cb_t cb, void *uctx);
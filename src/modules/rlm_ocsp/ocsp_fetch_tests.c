@@ -0,0 +1,436 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for non-blocking OCSP requests
+ *
+ * A CA, and a good and a revoked certificate, are generated in a
+ * temporary directory, and `openssl ocsp` is run as the responder.
+ *
+ * @file src/modules/rlm_ocsp/ocsp_fetch_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#define USE_CONSTRUCTOR
+
+#ifdef USE_CONSTRUCTOR
+static void test_init(void) __attribute__((constructor));
+#else
+static void test_init(void);
+#  define TEST_INIT  test_init()
+#endif
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "ocsp_fetch.c"
+
+#include <openssl/pem.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static TALLOC_CTX	*autofree;
+static char		*test_dir;
+static char		test_port[8];
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("ocsp_fetch_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_time_start() < 0) goto error;
+}
+
+static int test_run(char const *fmt, ...)
+{
+	va_list	ap;
+	char	*cmd;
+	int	ret;
+
+	va_start(ap, fmt);
+	cmd = talloc_vasprintf(autofree, fmt, ap);
+	va_end(ap);
+
+	ret = system(cmd);
+	talloc_free(cmd);
+
+	return ret;
+}
+
+/** Bind a socket to a free port on the loopback interface
+ *
+ * @param[out] port	the socket is bound to.
+ * @param[in] listening	Whether the socket should accept connections.
+ * @return The socket.
+ */
+static int test_socket(uint16_t *port, bool listening)
+{
+	struct sockaddr_in	sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t		len = sizeof(sin);
+	int			fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	TEST_ASSERT(fd >= 0);
+	TEST_ASSERT(bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0);
+	TEST_ASSERT(getsockname(fd, (struct sockaddr *)&sin, &len) == 0);
+	if (listening) TEST_ASSERT(listen(fd, 8) == 0);
+
+	*port = ntohs(sin.sin_port);
+
+	return fd;
+}
+
+static X509 *test_cert_load(char const *name)
+{
+	char	*filename;
+	FILE	*fp;
+	X509	*cert;
+
+	filename = talloc_asprintf(autofree, "%s/%s.pem", test_dir, name);
+	fp = fopen(filename, "r");
+	TEST_ASSERT(fp != NULL);
+	cert = PEM_read_X509(fp, NULL, NULL, NULL);
+	fclose(fp);
+	talloc_free(filename);
+
+	TEST_ASSERT(cert != NULL);
+
+	return cert;
+}
+
+/** Generate the certificates, and start an OCSP responder
+ *
+ */
+static void test_responder_start(void)
+{
+	uint16_t		port;
+	int			i;
+
+	test_dir = talloc_strdup(autofree, "/tmp/ocsp_fetch_tests.XXXXXX");
+	TEST_ASSERT(mkdtemp(test_dir) != NULL);
+
+	TEST_ASSERT(test_run("cd %s && "
+			     "openssl req -x509 -newkey rsa:2048 -nodes -keyout ca.key -out ca.pem -days 2 "
+			     "-subj /CN=ocsp_fetch_tests >/dev/null 2>&1 && "
+			     "for i in good:1 revoked:2; do "
+			     "openssl req -newkey rsa:2048 -nodes -keyout ${i%%:*}.key -out ${i%%:*}.csr "
+			     "-subj /CN=${i%%:*} >/dev/null 2>&1 && "
+			     "openssl x509 -req -in ${i%%:*}.csr -CA ca.pem -CAkey ca.key -set_serial ${i#*:} "
+			     "-out ${i%%:*}.pem -days 2 >/dev/null 2>&1 || exit 1; "
+			     "done && "
+			     "printf 'V\\t301231235959Z\\t\\t01\\tunknown\\t/CN=good\\n"
+			     "R\\t301231235959Z\\t220101000000Z\\t02\\tunknown\\t/CN=revoked\\n' > index.txt",
+			     test_dir) == 0);
+
+	/*
+	 *	Find a free port, and give it to the responder
+	 */
+	close(test_socket(&port, false));
+	snprintf(test_port, sizeof(test_port), "%u", port);
+
+	TEST_ASSERT(test_run("cd %s && "
+			     "(openssl ocsp -index index.txt -port %s -rsigner ca.pem -rkey ca.key -CA ca.pem "
+			     "-nmin 5 >ocsp.log 2>&1 & echo $! > ocsp.pid)",
+			     test_dir, test_port) == 0);
+
+	/*
+	 *	Wait for the responder to start listening.  We can't
+	 *	probe the port, as the OpenSSL 3.0 responder stops
+	 *	answering after a client disconnects without sending
+	 *	a request.  It logs this once it's listening.
+	 */
+	for (i = 0; i < 100; i++) {
+		if (test_run("grep -q 'waiting for OCSP client connections' %s/ocsp.log", test_dir) == 0) return;
+		usleep(100000);
+	}
+	TEST_CHECK(i < 100);
+	TEST_MSG("OCSP responder didn't start");
+}
+
+static void test_responder_stop(void)
+{
+	TEST_CHECK(test_run("kill $(cat %s/ocsp.pid); rm -rf %s", test_dir, test_dir) == 0);
+}
+
+typedef struct {
+	bool		done;
+	OCSP_RESPONSE	*resp;
+} test_result_t;
+
+static void test_fetch_done(OCSP_RESPONSE *resp, void *uctx)
+{
+	test_result_t *result = uctx;
+
+	result->done = true;
+	result->resp = resp;
+}
+
+/** Run the event loop until the request completes, or the deadline passes
+ *
+ */
+static void test_el_run(fr_event_list_t *el, test_result_t *result, fr_time_delta_t max)
+{
+	fr_time_t end = fr_time_add(fr_time(), max);
+
+	while (!result->done && fr_time_lt(fr_time(), end)) {
+		if (fr_event_corral(el, fr_time(), true) < 0) break;
+		fr_event_service(el);
+	}
+}
+
+/** Ask the responder for a certificate's status, and check the answer
+ *
+ */
+static void test_status(fr_event_list_t *el, X509 *ca, X509 *cert, int expected)
+{
+	test_result_t		result = { 0 };
+	OCSP_REQUEST		*req;
+	OCSP_CERTID		*certid;
+	OCSP_BASICRESP		*bresp;
+	X509_STORE		*store;
+	ASN1_GENERALIZEDTIME	*rev, *this_update, *next_update;
+	int			status, reason;
+
+	MEM(req = OCSP_REQUEST_new());
+	MEM(certid = OCSP_cert_to_id(NULL, cert, ca));
+	OCSP_request_add0_id(req, OCSP_CERTID_dup(certid));
+	OCSP_request_add1_nonce(req, NULL, 8);
+
+	TEST_CHECK(ocsp_fetch_start(autofree, el, "127.0.0.1", test_port, "/", req,
+				    fr_time_delta_from_sec(5), test_fetch_done, &result) != NULL);
+	test_el_run(el, &result, fr_time_delta_from_sec(10));
+
+	TEST_CHECK(result.done);
+	TEST_ASSERT(result.resp != NULL);
+	TEST_CHECK(OCSP_response_status(result.resp) == OCSP_RESPONSE_STATUS_SUCCESSFUL);
+
+	bresp = OCSP_response_get1_basic(result.resp);
+	TEST_ASSERT(bresp != NULL);
+
+	TEST_CASE("The response echoes our nonce");
+	TEST_CHECK(OCSP_check_nonce(req, bresp) == 1);
+
+	TEST_CASE("The response is signed by the CA");
+	MEM(store = X509_STORE_new());
+	TEST_CHECK(X509_STORE_add_cert(store, ca) == 1);
+	TEST_CHECK(OCSP_basic_verify(bresp, NULL, store, 0) == 1);
+
+	TEST_CASE("The response has the certificate's status, and a nextUpdate time");
+	TEST_CHECK(OCSP_resp_find_status(bresp, certid, &status, &reason, &rev, &this_update, &next_update) == 1);
+	TEST_CHECK(status == expected);
+	TEST_MSG("Expected status %s, got %s", OCSP_cert_status_str(expected), OCSP_cert_status_str(status));
+	TEST_CHECK(next_update != NULL);
+
+	X509_STORE_free(store);
+	OCSP_BASICRESP_free(bresp);
+	OCSP_RESPONSE_free(result.resp);
+	OCSP_CERTID_free(certid);
+	OCSP_REQUEST_free(req);
+
+	/*
+	 *	Everything was removed from the event list
+	 */
+	TEST_CHECK(fr_event_list_num_fds(el) == 0);
+	TEST_CHECK(fr_event_list_num_timers(el) == 0);
+}
+
+static void test_fetch_status(void)
+{
+	fr_event_list_t	*el;
+	X509		*ca, *good, *revoked;
+
+	test_responder_start();
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	TEST_ASSERT(el != NULL);
+
+	ca = test_cert_load("ca");
+	good = test_cert_load("good");
+	revoked = test_cert_load("revoked");
+
+	TEST_CASE("A good certificate is reported as good");
+	test_status(el, ca, good, V_OCSP_CERTSTATUS_GOOD);
+
+	TEST_CASE("A revoked certificate is reported as revoked");
+	test_status(el, ca, revoked, V_OCSP_CERTSTATUS_REVOKED);
+
+	X509_free(revoked);
+	X509_free(good);
+	X509_free(ca);
+	talloc_free(el);
+
+	test_responder_stop();
+}
+
+/** A request which can't get a response, because the responder isn't sending one
+ *
+ */
+static OCSP_REQUEST *test_request(void)
+{
+	OCSP_REQUEST	*req;
+	OCSP_CERTID	*certid;
+	X509_NAME	*name;
+	ASN1_BIT_STRING	*key;
+	unsigned char	key_data[] = "key";
+	ASN1_INTEGER	*sn;
+
+	MEM(name = X509_NAME_new());
+	MEM(key = ASN1_BIT_STRING_new());
+	TEST_CHECK(ASN1_BIT_STRING_set(key, key_data, sizeof(key_data) - 1) == 1);
+	MEM(sn = ASN1_INTEGER_new());
+	TEST_CHECK(ASN1_INTEGER_set(sn, 1) == 1);
+
+	MEM(certid = OCSP_cert_id_new(EVP_sha1(), name, key, sn));
+	MEM(req = OCSP_REQUEST_new());
+	OCSP_request_add0_id(req, certid);
+
+	ASN1_INTEGER_free(sn);
+	ASN1_BIT_STRING_free(key);
+	X509_NAME_free(name);
+
+	return req;
+}
+
+static void test_fetch_timeout(void)
+{
+	fr_event_list_t	*el;
+	test_result_t	result = { 0 };
+	OCSP_REQUEST	*req = test_request();
+	fr_time_t	start;
+	uint16_t	port;
+	char		port_str[8];
+	int		fd;
+
+	/*
+	 *	Accepts connections, but never answers
+	 */
+	fd = test_socket(&port, true);
+	snprintf(port_str, sizeof(port_str), "%u", port);
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	TEST_ASSERT(el != NULL);
+
+	TEST_CASE("The callback is called with no response when the request times out");
+	start = fr_time();
+	TEST_CHECK(ocsp_fetch_start(autofree, el, "127.0.0.1", port_str, "/", req,
+				    fr_time_delta_from_msec(200), test_fetch_done, &result) != NULL);
+	test_el_run(el, &result, fr_time_delta_from_sec(5));
+
+	TEST_CHECK(result.done);
+	TEST_CHECK(result.resp == NULL);
+	TEST_CHECK(fr_time_delta_gteq(fr_time_sub(fr_time(), start), fr_time_delta_from_msec(200)));
+	TEST_CHECK(fr_event_list_num_fds(el) == 0);
+
+	talloc_free(el);
+	OCSP_REQUEST_free(req);
+	close(fd);
+}
+
+static void test_fetch_refused(void)
+{
+	fr_event_list_t	*el;
+	test_result_t	result = { 0 };
+	OCSP_REQUEST	*req = test_request();
+	fr_time_t	start;
+	ocsp_fetch_t	*fetch;
+	uint16_t	port;
+	char		port_str[8];
+
+	/*
+	 *	Nothing is listening on the port
+	 */
+	close(test_socket(&port, false));
+	snprintf(port_str, sizeof(port_str), "%u", port);
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	TEST_ASSERT(el != NULL);
+
+	TEST_CASE("The callback is called with no response as soon as the connection fails");
+	start = fr_time();
+	fetch = ocsp_fetch_start(autofree, el, "127.0.0.1", port_str, "/", req,
+				 fr_time_delta_from_sec(5), test_fetch_done, &result);
+	if (fetch) {
+		test_el_run(el, &result, fr_time_delta_from_sec(10));
+
+		TEST_CHECK(result.done);
+		TEST_CHECK(result.resp == NULL);
+		TEST_CHECK(fr_time_delta_lt(fr_time_sub(fr_time(), start), fr_time_delta_from_sec(5)));
+	}
+	TEST_CHECK(fr_event_list_num_fds(el) == 0);
+	TEST_CHECK(fr_event_list_num_timers(el) == 0);
+
+	talloc_free(el);
+	OCSP_REQUEST_free(req);
+}
+
+static void test_fetch_cancel(void)
+{
+	fr_event_list_t	*el;
+	test_result_t	result = { 0 };
+	OCSP_REQUEST	*req = test_request();
+	ocsp_fetch_t	*fetch;
+	uint16_t	port;
+	char		port_str[8];
+	int		fd, i;
+
+	fd = test_socket(&port, true);
+	snprintf(port_str, sizeof(port_str), "%u", port);
+
+	el = fr_event_list_alloc(autofree, NULL, NULL);
+	TEST_ASSERT(el != NULL);
+
+	fetch = ocsp_fetch_start(autofree, el, "127.0.0.1", port_str, "/", req,
+				 fr_time_delta_from_msec(100), test_fetch_done, &result);
+	TEST_ASSERT(fetch != NULL);
+
+	for (i = 0; i < 3; i++) {
+		if (fr_event_corral(el, fr_time(), false) > 0) fr_event_service(el);
+	}
+
+	TEST_CASE("Freeing a request removes it from the event list, and the callback isn't called");
+	talloc_free(fetch);
+	TEST_CHECK(fr_event_list_num_fds(el) == 0);
+	TEST_CHECK(fr_event_list_num_timers(el) == 0);
+
+	usleep(200000);
+	if (fr_event_corral(el, fr_time(), false) > 0) fr_event_service(el);
+	TEST_CHECK(!result.done);
+
+	talloc_free(el);
+	OCSP_REQUEST_free(req);
+	close(fd);
+}
+
+TEST_LIST = {
+	{ "fetch_status",	test_fetch_status },
+	{ "fetch_timeout",	test_fetch_timeout },
+	{ "fetch_refused",	test_fetch_refused },
+	{ "fetch_cancel",	test_fetch_cancel },
+
+	{ NULL }
+};
@@ -0,0 +1,9 @@
+ifneq "$(OPENSSL_LIBS)" ""
+TARGET		:= ocsp_fetch_tests$(E)
+endif
+
+SOURCES		:= ocsp_fetch_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-server$(L)
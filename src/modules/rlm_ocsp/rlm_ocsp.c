@@ -0,0 +1,694 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_ocsp.c
+ * @brief Check the status of client certificates with an OCSP responder.
+ *
+ * The module is called from the `verify certificate { ... }` section
+ * of a TLS virtual server.  It builds an OCSP certificate ID from the
+ * configured issuer certificate and the client certificate's serial
+ * number, and looks for a current response in a cache shared by all
+ * threads.  On a miss the request yields, and the OCSP request is
+ * sent from the worker's event loop.
+ *
+ * Responses which are used frequently are refreshed by the workers
+ * shortly before they expire, so certificates which are seen often
+ * never wait for the responder.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#define LOG_PREFIX mctx->inst->name
+
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/module_rlm.h>
+#include <freeradius-devel/tls/utils.h>
+#include <freeradius-devel/unlang/interpret.h>
+
+#include <openssl/pem.h>
+
+#include "ocsp_cache.h"
+#include "ocsp_fetch.h"
+
+/** Maximum leeway in validity period of OCSP response
+ *
+ * Default 5 minutes.
+ */
+#define OCSP_MAX_VALIDITY_PERIOD (5 * 60)
+
+/** Maximum number of responses each thread will refresh per prefetch interval
+ *
+ */
+#define OCSP_PREFETCH_MAX	16
+
+/** Values of TLS-OCSP-Cert-Valid
+ *
+ */
+typedef enum {
+	OCSP_CERT_VALID_NO	= 0,
+	OCSP_CERT_VALID_YES	= 1,
+	OCSP_CERT_VALID_SKIPPED	= 2,
+	OCSP_CERT_VALID_UNKNOWN	= 3
+} rlm_ocsp_cert_valid_t;
+
+typedef struct {
+	uint32_t		max_entries;		//!< Maximum number of responses to cache.
+							///< 0 disables the response cache.
+	fr_time_delta_t		lifetime;		//!< How long to cache responses without a nextUpdate.
+	fr_time_delta_t		prefetch_window;	//!< Refresh responses this long before they expire.
+	uint32_t		prefetch_min_hits;	//!< Only refresh responses used at least this many times.
+	fr_time_delta_t		prefetch_interval;	//!< How often each thread looks for responses to refresh.
+} rlm_ocsp_cache_conf_t;
+
+typedef struct {
+	char const		*url;			//!< OCSP responder URL.
+	char const		*issuer_file;		//!< Certificate of the CA which issued the client certificates.
+	tmpl_t			*serial;		//!< Serial number of the certificate to check.
+	bool			use_nonce;		//!< Add a nonce to requests sent while a client waits.
+	fr_time_delta_t		timeout;		//!< Maximum time to wait for the OCSP responder.
+	bool			softfail;		//!< Return noop, instead of fail, if the responder
+							///< can't be contacted.
+
+	rlm_ocsp_cache_conf_t	cache;
+
+	char			*host;			//!< Parsed from the URL.
+	char			*port;
+	char			*path;
+
+	X509			*issuer;		//!< Loaded from issuer_file.
+	X509_STORE		*store;			//!< Trusts the issuer, used to verify responses.
+	ocsp_cache_t		*response_cache;	//!< Responses shared by all threads.
+} rlm_ocsp_t;
+
+typedef struct {
+	rlm_ocsp_t const	*inst;			//!< Instance data.
+	module_thread_inst_ctx_t *mctx;			//!< Copy of the thread instantiation ctx, for callbacks.
+	fr_event_list_t		*el;			//!< Event list requests are sent from.
+	fr_event_timer_t const	*ev;			//!< When we next look for responses to refresh.
+} rlm_ocsp_thread_t;
+
+/** State of a request waiting for the responder
+ *
+ */
+typedef struct {
+	request_t		*request;		//!< To mark as runnable when the response arrives.
+	ocsp_fetch_t		*fetch;			//!< Outstanding OCSP request, NULL once complete.
+	OCSP_REQUEST		*req;			//!< Request we sent, used to check the nonce.
+	OCSP_CERTID		*certid;		//!< Certificate we're checking.
+	uint8_t			*key;			//!< Cache key for the certificate.
+	OCSP_RESPONSE		*resp;			//!< The response, or NULL if the request failed.
+} rlm_ocsp_rctx_t;
+
+/** A single outstanding prefetch request
+ *
+ */
+typedef struct {
+	rlm_ocsp_thread_t	*t;			//!< Thread the request is running in.
+	ocsp_cache_prefetch_t	*claim;			//!< The response being refreshed.
+	OCSP_CERTID		*certid;		//!< Decoded from the claim's key.
+} rlm_ocsp_prefetch_t;
+
+static const CONF_PARSER cache_config[] = {
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_ocsp_cache_conf_t, max_entries), .dflt = "1024" },
+	{ FR_CONF_OFFSET("lifetime", FR_TYPE_TIME_DELTA, rlm_ocsp_cache_conf_t, lifetime), .dflt = "300" },
+	{ FR_CONF_OFFSET("prefetch_window", FR_TYPE_TIME_DELTA, rlm_ocsp_cache_conf_t, prefetch_window), .dflt = "60" },
+	{ FR_CONF_OFFSET("prefetch_min_hits", FR_TYPE_UINT32, rlm_ocsp_cache_conf_t, prefetch_min_hits), .dflt = "2" },
+	{ FR_CONF_OFFSET("prefetch_interval", FR_TYPE_TIME_DELTA, rlm_ocsp_cache_conf_t, prefetch_interval), .dflt = "10" },
+	CONF_PARSER_TERMINATOR
+};
+
+static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("url", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_ocsp_t, url) },
+	{ FR_CONF_OFFSET("issuer", FR_TYPE_FILE_INPUT | FR_TYPE_REQUIRED, rlm_ocsp_t, issuer_file) },
+	{ FR_CONF_OFFSET("serial", FR_TYPE_TMPL | FR_TYPE_ATTRIBUTE, rlm_ocsp_t, serial),
+	  .dflt = "&parent.session-state.TLS-Certificate[0].Serial", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("use_nonce", FR_TYPE_BOOL, rlm_ocsp_t, use_nonce), .dflt = "yes" },
+	{ FR_CONF_OFFSET("timeout", FR_TYPE_TIME_DELTA, rlm_ocsp_t, timeout), .dflt = "5" },
+	{ FR_CONF_OFFSET("softfail", FR_TYPE_BOOL, rlm_ocsp_t, softfail), .dflt = "no" },
+	{ FR_CONF_OFFSET("cache", FR_TYPE_SUBSECTION, rlm_ocsp_t, cache), .subcs = (void const *) cache_config },
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t const *dict_freeradius;
+
+extern fr_dict_autoload_t rlm_ocsp_dict[];
+fr_dict_autoload_t rlm_ocsp_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_tls_ocsp_cert_valid;
+static fr_dict_attr_t const *attr_tls_ocsp_next_update;
+
+extern fr_dict_attr_autoload_t rlm_ocsp_dict_attr[];
+fr_dict_attr_autoload_t rlm_ocsp_dict_attr[] = {
+	{ .out = &attr_tls_ocsp_cert_valid, .name = "TLS-OCSP-Cert-Valid", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+	{ .out = &attr_tls_ocsp_next_update, .name = "TLS-OCSP-Next-Update", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+	{ NULL }
+};
+
+/** Check a response is from the responder we trust, and find the certificate's status
+ *
+ * @param[out] status	V_OCSP_CERTSTATUS_* value for the certificate.
+ * @param[out] reason	Revocation reason, or -1.
+ * @param[out] expires	When the response should no longer be used.
+ * @param[in] resp	to verify.
+ * @param[in] req	the response is for.  If not NULL, the nonce is checked.
+ * @param[in] certid	to find the status of.
+ * @param[in] inst	Module instance.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ocsp_response_verify(int *status, int *reason, fr_unix_time_t *expires,
+				OCSP_RESPONSE *resp, OCSP_REQUEST *req, OCSP_CERTID *certid, rlm_ocsp_t const *inst)
+{
+	OCSP_BASICRESP		*bresp;
+	ASN1_GENERALIZEDTIME	*rev, *this_update, *next_update;
+	time_t			next;
+	int			ret = -1;
+
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+		fr_strerror_printf("Response status: %s", OCSP_response_status_str(OCSP_response_status(resp)));
+		return -1;
+	}
+
+	bresp = OCSP_response_get1_basic(resp);
+	if (!bresp) {
+		fr_strerror_const("Response contained no basic response");
+		return -1;
+	}
+
+	if (req && (OCSP_check_nonce(req, bresp) != 1)) {
+		fr_strerror_const("Response has wrong nonce value");
+		goto finish;
+	}
+
+	if (OCSP_basic_verify(bresp, NULL, inst->store, 0) != 1) {
+		fr_strerror_const("Couldn't verify OCSP basic response");
+		goto finish;
+	}
+
+	if (!OCSP_resp_find_status(bresp, certid, status, reason, &rev, &this_update, &next_update)) {
+		fr_strerror_const("No Status found");
+		goto finish;
+	}
+
+	if (!OCSP_check_validity(this_update, next_update, OCSP_MAX_VALIDITY_PERIOD, -1)) {
+		fr_strerror_printf("Delta +/- between OCSP response time and our time is greater than %u seconds.  "
+				   "Check servers are synchronised to a common time source", OCSP_MAX_VALIDITY_PERIOD);
+		goto finish;
+	}
+
+	if (next_update && (fr_tls_utils_asn1time_to_epoch(&next, next_update) == 0)) {
+		*expires = fr_unix_time_from_sec(next);
+	} else {
+		*expires = fr_unix_time_add(fr_time_to_unix_time(fr_time()), inst->cache.lifetime);
+	}
+	ret = 0;
+
+finish:
+	OCSP_BASICRESP_free(bresp);
+
+	return ret;
+}
+
+/** Add a verified response to the cache
+ *
+ * Only definite answers are cached.
+ */
+static int ocsp_response_cache(rlm_ocsp_t const *inst, uint8_t const *key, int status,
+			       OCSP_RESPONSE *resp, fr_unix_time_t expires, bool refresh)
+{
+	uint8_t	*data, *p;
+	int	len, ret = -1;
+
+	if (!inst->response_cache ||
+	    ((status != V_OCSP_CERTSTATUS_GOOD) && (status != V_OCSP_CERTSTATUS_REVOKED))) return 0;
+
+	len = i2d_OCSP_RESPONSE(resp, NULL);
+	if (len <= 0) return -1;
+
+	MEM(data = talloc_array(NULL, uint8_t, len));
+	p = data;
+	if (i2d_OCSP_RESPONSE(resp, &p) == len) {
+		ret = ocsp_cache_insert(inst->response_cache, key, inst->host, inst->port, inst->path,
+					status, data, len, expires, refresh);
+	}
+	talloc_free(data);
+
+	return ret;
+}
+
+/** Set the result attributes, and convert the certificate status to an rcode
+ *
+ */
+static rlm_rcode_t ocsp_result(request_t *request, rlm_ocsp_t const *inst, int status, fr_unix_time_t expires)
+{
+	fr_pair_t		*vp;
+	fr_unix_time_t		now = fr_time_to_unix_time(fr_time());
+	rlm_ocsp_cert_valid_t	valid;
+	rlm_rcode_t		rcode;
+
+	switch (status) {
+	case V_OCSP_CERTSTATUS_GOOD:
+		RDEBUG2("Cert status: good");
+		valid = OCSP_CERT_VALID_YES;
+		rcode = RLM_MODULE_OK;
+		break;
+
+	case V_OCSP_CERTSTATUS_REVOKED:
+		REDEBUG("Cert status: revoked");
+		valid = OCSP_CERT_VALID_NO;
+		rcode = RLM_MODULE_REJECT;
+		break;
+
+	case V_OCSP_CERTSTATUS_UNKNOWN:
+		REDEBUG("Cert status: unknown");
+		valid = OCSP_CERT_VALID_UNKNOWN;
+		rcode = RLM_MODULE_REJECT;
+		break;
+
+	default:
+		valid = OCSP_CERT_VALID_SKIPPED;
+		if (inst->softfail) {
+			RWDEBUG("Unable to check certificate status, softfail is enabled, continuing");
+			rcode = RLM_MODULE_NOOP;
+		} else {
+			REDEBUG("Unable to check certificate status, softfail is disabled, failing");
+			rcode = RLM_MODULE_FAIL;
+		}
+		break;
+	}
+
+	MEM(pair_update_reply(&vp, attr_tls_ocsp_cert_valid) >= 0);
+	vp->vp_uint32 = valid;
+	RDEBUG2("&reply.%pP", vp);
+
+	if ((valid != OCSP_CERT_VALID_SKIPPED) && fr_unix_time_gt(expires, now)) {
+		MEM(pair_update_reply(&vp, attr_tls_ocsp_next_update) >= 0);
+		vp->vp_uint32 = fr_time_delta_to_sec(fr_unix_time_sub(expires, now));
+		RDEBUG2("&reply.%pP", vp);
+	}
+
+	return rcode;
+}
+
+static int _ocsp_rctx_free(rlm_ocsp_rctx_t *rctx)
+{
+	TALLOC_FREE(rctx->fetch);
+	if (rctx->resp) OCSP_RESPONSE_free(rctx->resp);
+	if (rctx->req) OCSP_REQUEST_free(rctx->req);
+	if (rctx->certid) OCSP_CERTID_free(rctx->certid);
+
+	return 0;
+}
+
+/** Build the certificate ID from the issuer, and the certificate's serial number
+ *
+ */
+static OCSP_CERTID *ocsp_certid_alloc(request_t *request, rlm_ocsp_t const *inst)
+{
+	fr_pair_t	*vp;
+	ASN1_INTEGER	*serial;
+	OCSP_CERTID	*certid;
+
+	if ((tmpl_find_vp(&vp, request, inst->serial) < 0) || (vp->vp_length == 0)) {
+		REDEBUG("No certificate serial number found in %s", inst->serial->name);
+		return NULL;
+	}
+
+	MEM(serial = ASN1_INTEGER_new());
+	if (!ASN1_STRING_set(serial, vp->vp_octets, vp->vp_length)) {
+		ASN1_INTEGER_free(serial);
+		return NULL;
+	}
+
+	certid = OCSP_cert_id_new(EVP_sha1(), X509_get_subject_name(inst->issuer),
+				  X509_get0_pubkey_bitstr(inst->issuer), serial);
+	ASN1_INTEGER_free(serial);
+
+	return certid;
+}
+
+/** Called by the event loop when the OCSP request completes
+ *
+ */
+static void _ocsp_fetch_done(OCSP_RESPONSE *resp, void *uctx)
+{
+	rlm_ocsp_rctx_t	*rctx = talloc_get_type_abort(uctx, rlm_ocsp_rctx_t);
+
+	rctx->fetch = NULL;	/* Freed before we were called */
+	rctx->resp = resp;
+
+	unlang_interpret_mark_runnable(rctx->request);
+}
+
+static unlang_action_t mod_ocsp_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_ocsp_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_ocsp_t);
+	rlm_ocsp_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, rlm_ocsp_rctx_t);
+	fr_unix_time_t		expires = fr_unix_time_wrap(0);
+	int			status = -1, reason = -1;
+
+	if (!rctx->resp) {
+		REDEBUG("No response from OCSP responder");
+	} else if (ocsp_response_verify(&status, &reason, &expires, rctx->resp,
+					inst->use_nonce ? rctx->req : NULL, rctx->certid, inst) < 0) {
+		RPEDEBUG("Invalid OCSP response");
+		status = -1;
+	} else {
+		if (reason != -1) RDEBUG2("Reason: %s", OCSP_crl_reason_str(reason));
+		if (ocsp_response_cache(inst, rctx->key, status, rctx->resp, expires, false) < 0) {
+			RWDEBUG("Failed caching OCSP response");
+		}
+	}
+
+	*p_result = ocsp_result(request, inst, status, expires);
+	talloc_free(rctx);
+
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+static void mod_ocsp_signal(module_ctx_t const *mctx, request_t *request, fr_state_signal_t action)
+{
+	rlm_ocsp_rctx_t *rctx = talloc_get_type_abort(mctx->rctx, rlm_ocsp_rctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG2("Cancelling OCSP request");
+
+	/*
+	 *	Freeing the fetch closes the connection,
+	 *	and its callback won't be called.
+	 */
+	TALLOC_FREE(rctx->fetch);
+}
+
+/** Check the status of the client certificate
+ *
+ */
+static unlang_action_t CC_HINT(nonnull) mod_ocsp(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_ocsp_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_ocsp_t);
+	rlm_ocsp_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_ocsp_thread_t);
+	rlm_ocsp_rctx_t		*rctx;
+	OCSP_CERTID		*certid;
+	fr_unix_time_t		expires;
+	int			status;
+
+	MEM(rctx = talloc_zero(request, rlm_ocsp_rctx_t));
+	talloc_set_destructor(rctx, _ocsp_rctx_free);
+	rctx->request = request;
+
+	rctx->certid = ocsp_certid_alloc(request, inst);
+	if (!rctx->certid) {
+	skipped:
+		talloc_free(rctx);
+		RETURN_MODULE_RCODE(ocsp_result(request, inst, -1, fr_unix_time_wrap(0)));
+	}
+
+	rctx->key = ocsp_cache_key(rctx, rctx->certid);
+	if (!rctx->key) goto skipped;
+
+	/*
+	 *	Check for a current response from an
+	 *	earlier request, or from the prefetcher.
+	 */
+	if (inst->response_cache &&
+	    ocsp_cache_find(NULL, NULL, &status, &expires, inst->response_cache, rctx->key)) {
+		RDEBUG2("Using cached OCSP response");
+		talloc_free(rctx);
+		RETURN_MODULE_RCODE(ocsp_result(request, inst, status, expires));
+	}
+
+	/*
+	 *	add0 takes ownership of the certid,
+	 *	so give it a copy.
+	 */
+	MEM(rctx->req = OCSP_REQUEST_new());
+	MEM(certid = OCSP_CERTID_dup(rctx->certid));
+	OCSP_request_add0_id(rctx->req, certid);
+	if (inst->use_nonce) OCSP_request_add1_nonce(rctx->req, NULL, 8);
+
+	RDEBUG2("Sending OCSP request to \"%s\"", inst->url);
+
+	rctx->fetch = ocsp_fetch_start(rctx, t->el, inst->host, inst->port, inst->path, rctx->req,
+				       inst->timeout, _ocsp_fetch_done, rctx);
+	if (!rctx->fetch) {
+		RPEDEBUG("Failed sending OCSP request");
+		goto skipped;
+	}
+
+	return unlang_module_yield(request, mod_ocsp_resume, mod_ocsp_signal, rctx);
+}
+
+static int _ocsp_prefetch_free(rlm_ocsp_prefetch_t *prefetch)
+{
+	if (prefetch->certid) OCSP_CERTID_free(prefetch->certid);
+
+	return 0;
+}
+
+/** Replace the cached response with the one we just fetched
+ *
+ * Prefetch requests are sent without a nonce.  The refreshed
+ * response will be served to many clients, so there's no single
+ * request for the nonce to protect.
+ */
+static void _ocsp_prefetch_done(OCSP_RESPONSE *resp, void *uctx)
+{
+	rlm_ocsp_prefetch_t		*prefetch = talloc_get_type_abort(uctx, rlm_ocsp_prefetch_t);
+	module_thread_inst_ctx_t const	*mctx = prefetch->t->mctx;
+	rlm_ocsp_t const		*inst = prefetch->t->inst;
+	fr_unix_time_t			expires;
+	int				status, reason;
+
+	if (!resp) {
+		DEBUG2("Failed refreshing OCSP response from %s", prefetch->claim->host);
+	release:
+		ocsp_cache_prefetch_release(inst->response_cache, prefetch->claim->key);
+		goto finish;
+	}
+
+	if (ocsp_response_verify(&status, &reason, &expires, resp, NULL, prefetch->certid, inst) < 0) {
+		PDEBUG2("Failed verifying refreshed OCSP response from %s", prefetch->claim->host);
+		goto release;
+	}
+
+	/*
+	 *	The certificate's status is no longer
+	 *	definite, let the next request ask.
+	 */
+	if ((status != V_OCSP_CERTSTATUS_GOOD) && (status != V_OCSP_CERTSTATUS_REVOKED)) goto release;
+
+	if (ocsp_response_cache(inst, prefetch->claim->key, status, resp, expires, true) < 0) goto release;
+
+	DEBUG3("Refreshed OCSP response from %s", prefetch->claim->host);
+
+finish:
+	if (resp) OCSP_RESPONSE_free(resp);
+	talloc_free(prefetch);
+}
+
+/** Start requests for any hot responses which are close to expiry
+ *
+ */
+static void _ocsp_prefetch_timer(fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_ocsp_thread_t		*t = talloc_get_type_abort(uctx, rlm_ocsp_thread_t);
+	module_thread_inst_ctx_t const	*mctx = t->mctx;
+	rlm_ocsp_t const		*inst = t->inst;
+	ocsp_cache_prefetch_t		*claims;
+	size_t				i;
+
+	claims = ocsp_cache_prefetch_claim(t, inst->response_cache,
+					   inst->cache.prefetch_window, inst->cache.prefetch_min_hits, OCSP_PREFETCH_MAX);
+
+	for (i = 0; i < talloc_array_length(claims); i++) {
+		rlm_ocsp_prefetch_t	*prefetch;
+		OCSP_REQUEST		*req;
+		OCSP_CERTID		*certid;
+		uint8_t const		*q = claims[i].key;
+
+		MEM(prefetch = talloc_zero(t, rlm_ocsp_prefetch_t));
+		talloc_set_destructor(prefetch, _ocsp_prefetch_free);
+		prefetch->t = t;
+		MEM(prefetch->claim = talloc_memdup(prefetch, &claims[i], sizeof(claims[i])));
+		talloc_steal(prefetch->claim, claims[i].key);
+		talloc_steal(prefetch->claim, claims[i].host);
+		talloc_steal(prefetch->claim, claims[i].port);
+		talloc_steal(prefetch->claim, claims[i].path);
+
+		prefetch->certid = d2i_OCSP_CERTID(NULL, &q, talloc_array_length(claims[i].key));
+		if (!prefetch->certid) {
+		error:
+			ocsp_cache_prefetch_release(inst->response_cache, prefetch->claim->key);
+			talloc_free(prefetch);
+			continue;
+		}
+
+		MEM(req = OCSP_REQUEST_new());
+		MEM(certid = OCSP_CERTID_dup(prefetch->certid));
+		OCSP_request_add0_id(req, certid);
+
+		if (!ocsp_fetch_start(prefetch, el, prefetch->claim->host, prefetch->claim->port,
+				      prefetch->claim->path, req, inst->timeout, _ocsp_prefetch_done, prefetch)) {
+			PDEBUG2("Failed refreshing OCSP response from %s", prefetch->claim->host);
+			OCSP_REQUEST_free(req);
+			goto error;
+		}
+		OCSP_REQUEST_free(req);	/* The fetch has its own copy */
+	}
+	talloc_free(claims);
+
+	if (fr_event_timer_in(t, el, &t->ev, inst->cache.prefetch_interval, _ocsp_prefetch_timer, t) < 0) {
+		PERROR("Failed rescheduling OCSP prefetch, responses will no longer be refreshed");
+	}
+}
+
+/** Start refreshing cached responses from this thread's event loop
+ *
+ * Each thread claims a share of the responses that are due, so the
+ * work is spread across all threads, and a response is only
+ * refreshed once.
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_ocsp_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_ocsp_t);
+	rlm_ocsp_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_ocsp_thread_t);
+
+	t->inst = inst;
+	t->el = mctx->el;
+
+	/*
+	 *	Create a copy of the mctx on the heap that we can
+	 *	use in the prefetch callbacks.
+	 */
+	MEM(t->mctx = talloc_zero(t, module_thread_inst_ctx_t));
+	memcpy(t->mctx, mctx, sizeof(*t->mctx));
+
+	if (!inst->response_cache || !fr_time_delta_ispos(inst->cache.prefetch_window)) return 0;
+
+	if (fr_event_timer_in(t, t->el, &t->ev, inst->cache.prefetch_interval, _ocsp_prefetch_timer, t) < 0) {
+		PERROR("Failed scheduling OCSP prefetch");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_ocsp_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_ocsp_t);
+	CONF_SECTION	*conf = mctx->inst->conf;
+	char		*url;
+	int		use_ssl = 0;
+	FILE		*fp;
+
+	/* Reading the libssl src, they do a strdup on the URL, so it could of been const *sigh* */
+	memcpy(&url, &inst->url, sizeof(url));
+	if (!OCSP_parse_url(url, &inst->host, &inst->port, &inst->path, &use_ssl)) {
+		cf_log_err(conf, "Invalid OCSP responder URL \"%s\"", inst->url);
+		return -1;
+	}
+
+	if (use_ssl) {
+		cf_log_err(conf, "HTTPS OCSP responders are not supported");
+		return -1;
+	}
+
+	fp = fopen(inst->issuer_file, "r");
+	if (!fp) {
+		cf_log_err(conf, "Failed opening issuer certificate \"%s\": %s", inst->issuer_file, fr_syserror(errno));
+		return -1;
+	}
+	inst->issuer = PEM_read_X509(fp, NULL, NULL, NULL);
+	fclose(fp);
+	if (!inst->issuer) {
+		cf_log_err(conf, "Failed reading issuer certificate \"%s\"", inst->issuer_file);
+		return -1;
+	}
+
+	/*
+	 *	Responses must be signed by the issuer, or by
+	 *	a responder the issuer has delegated to.
+	 */
+	MEM(inst->store = X509_STORE_new());
+	if (!X509_STORE_add_cert(inst->store, inst->issuer)) {
+		cf_log_err(conf, "Failed adding issuer certificate to store");
+		return -1;
+	}
+
+	FR_TIME_DELTA_BOUND_CHECK("timeout", inst->timeout, >=, fr_time_delta_from_msec(100));
+
+	/*
+	 *	The response cache is shared by all threads.
+	 */
+	if (inst->cache.max_entries) {
+		FR_TIME_DELTA_BOUND_CHECK("cache.prefetch_interval", inst->cache.prefetch_interval, >=, fr_time_delta_from_sec(1));
+		inst->response_cache = ocsp_cache_alloc(inst, inst->cache.max_entries);
+	}
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_ocsp_t *inst = talloc_get_type_abort(mctx->inst->data, rlm_ocsp_t);
+
+	if (inst->store) X509_STORE_free(inst->store);
+	if (inst->issuer) X509_free(inst->issuer);
+	OPENSSL_free(inst->host);
+	OPENSSL_free(inst->port);
+	OPENSSL_free(inst->path);
+
+	return 0;
+}
+
+/*
+ *	The module name should be the only globally exported symbol.
+ *	That is, everything else should be 'static'.
+ *
+ *	If the module needs to temporarily modify it's instantiation
+ *	data, the type should be changed to MODULE_TYPE_THREAD_UNSAFE.
+ *	The server will then take care of ensuring that the module
+ *	is single-threaded.
+ */
+extern module_rlm_t rlm_ocsp;
+module_rlm_t rlm_ocsp = {
+	.common = {
+		.magic			= MODULE_MAGIC_INIT,
+		.name			= "ocsp",
+		.type			= MODULE_TYPE_THREAD_SAFE,
+		.inst_size		= sizeof(rlm_ocsp_t),
+		.config			= module_config,
+		.instantiate		= mod_instantiate,
+		.detach			= mod_detach,
+		.thread_inst_size	= sizeof(rlm_ocsp_thread_t),
+		.thread_inst_type	= "rlm_ocsp_thread_t",
+		.thread_instantiate	= mod_thread_instantiate
+	},
+	.method_names = (module_method_names_t[]){
+		{ .name1 = CF_IDENT_ANY,	.name2 = CF_IDENT_ANY,	.method = mod_ocsp },
+
+		MODULE_NAME_TERMINATOR
+	}
+};
@@ -0,0 +1,11 @@
+TARGETNAME	:= rlm_ocsp
+
+ifneq "$(OPENSSL_LIBS)" ""
+TARGET		:= $(TARGETNAME)$(L)
+endif
+
+SOURCES		:= $(TARGETNAME).c ocsp_cache.c ocsp_fetch.c
+
+TGT_PREREQS	:= libfreeradius-tls$(L)
+
+LOG_ID_LIB	= 63
@@ -0,0 +1,311 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file src/modules/rlm_radius/cache.c
+ * @brief Per-thread cache of replies from home servers
+ *
+ * Replies are keyed on the packet code of the request, followed by the
+ * expansion of the configured key.  Each worker thread has its own
+ * cache, so no locking is required.
+ *
+ * Entries are kept on an LRU list.  When the cache is full, the least
+ * recently used entry is evicted.  Expired entries are removed when
+ * they're next looked up, or when they reach the end of the LRU list.
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/rb.h>
+
+#include "cache.h"
+
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the lookup tree.
+	fr_dlist_t		entry;			//!< Entry in the LRU list.
+
+	uint8_t const		*key;			//!< Request packet code, followed by the expanded key.
+	size_t			key_len;		//!< Length of the key.
+
+	fr_time_t		expires;		//!< When this entry should no longer be used.
+
+	uint8_t			code;			//!< Packet code of the cached reply.
+	rlm_rcode_t		rcode;			//!< What the module returned for the original request.
+	fr_pair_list_t		reply;			//!< Attributes from the cached reply.
+} radius_cache_entry_t;
+
+struct radius_cache_s {
+	rlm_radius_cache_conf_t const	*conf;		//!< Our configuration.
+	fr_dict_attr_t const	*proxy_state;		//!< Never stored in a cached reply.
+
+	fr_rb_tree_t		*tree;			//!< Entries indexed by key.
+	fr_dlist_head_t		lru;			//!< Most recently used entries at the head.
+
+	radius_cache_stats_t	stats;			//!< Hit / miss counters.
+};
+
+/** Compare two entries by key
+ *
+ */
+static int8_t cache_entry_cmp(void const *one, void const *two)
+{
+	radius_cache_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key, key_len);
+	return 0;
+}
+
+/** Remove an entry from the cache, and free it
+ *
+ */
+static void cache_entry_free(radius_cache_t *cache, radius_cache_entry_t *c)
+{
+	fr_rb_remove_by_inline_node(cache->tree, &c->node);
+	fr_dlist_remove(&cache->lru, c);
+	talloc_free(c);
+}
+
+/** Allocate a new reply cache
+ *
+ * @param[in] ctx	to allocate the cache in.  Usually the thread instance data.
+ * @param[in] conf	cache configuration.
+ * @param[in] proxy_state	attribute to strip from cached replies.
+ * @return
+ *	- A new cache on success.
+ *	- NULL on failure.
+ */
+radius_cache_t *radius_cache_alloc(TALLOC_CTX *ctx, rlm_radius_cache_conf_t const *conf,
+				   fr_dict_attr_t const *proxy_state)
+{
+	radius_cache_t *cache;
+
+	MEM(cache = talloc_zero(ctx, radius_cache_t));
+	cache->conf = conf;
+	cache->proxy_state = proxy_state;
+
+	cache->tree = fr_rb_inline_talloc_alloc(cache, radius_cache_entry_t, node, cache_entry_cmp, NULL);
+	if (!cache->tree) {
+		talloc_free(cache);
+		return NULL;
+	}
+	fr_dlist_talloc_init(&cache->lru, radius_cache_entry_t, entry);
+
+	return cache;
+}
+
+/** Create the cache key for a request
+ *
+ * @param[in] ctx	to allocate the key in.
+ * @param[in] conf	cache configuration.
+ * @param[in] request	to create the key for.
+ * @return
+ *	- The key, as a talloced uint8_t array.
+ *	- NULL if the request should not be cached.
+ */
+uint8_t *radius_cache_key(TALLOC_CTX *ctx, rlm_radius_cache_conf_t const *conf, request_t *request)
+{
+	char		buffer[1024];
+	char const	*p;
+	ssize_t		slen;
+	uint8_t		*key;
+
+	/*
+	 *	Only replies to Access-Request and Status-Server are
+	 *	cached.  Accounting, CoA and Disconnect packets change
+	 *	state on the home server, so every one of them has to
+	 *	be forwarded.
+	 */
+	switch (request->packet->code) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+		break;
+
+	default:
+		return NULL;
+	}
+
+	slen = tmpl_expand(&p, buffer, sizeof(buffer), request, conf->key, NULL, NULL);
+	if (slen < 0) {
+		RPERROR("Failed expanding cache key");
+		return NULL;
+	}
+
+	if (slen == 0) {
+		RDEBUG2("Cache key is empty - not caching the reply");
+		return NULL;
+	}
+
+	/*
+	 *	The request packet code is always part of the key,
+	 *	so that (e.g.) Access-Request and CoA-Request for
+	 *	the same user don't share cache entries.
+	 */
+	MEM(key = talloc_array(ctx, uint8_t, slen + 1));
+	key[0] = request->packet->code;
+	memcpy(key + 1, p, slen);
+
+	return key;
+}
+
+/** Find a cached reply, and add it to the request
+ *
+ * @param[out] p_result	the rcode of the cached reply.
+ * @param[in] cache	to search.
+ * @param[in] request	to add the cached reply to.
+ * @param[in] key	as returned by #radius_cache_key.
+ * @return
+ *	- true if the reply was served from the cache.
+ *	- false if the request needs to be proxied.
+ */
+bool radius_cache_reply(rlm_rcode_t *p_result, radius_cache_t *cache, request_t *request, uint8_t const *key)
+{
+	radius_cache_entry_t	*c;
+	fr_time_t		now;
+
+	c = fr_rb_find(cache->tree, &(radius_cache_entry_t){ .key = key, .key_len = talloc_array_length(key) });
+	if (!c) {
+	miss:
+		cache->stats.misses++;
+		return false;
+	}
+
+	now = fr_time();
+	if (fr_time_lteq(c->expires, now)) {
+		RDEBUG2("Cached %s reply has expired", fr_packet_codes[c->code]);
+		cache_entry_free(cache, c);
+		cache->stats.expired++;
+		goto miss;
+	}
+
+	if (fr_pair_list_copy(request->reply_ctx, &request->reply_pairs, &c->reply) < 0) {
+		RPERROR("Failed copying cached reply");
+		goto miss;
+	}
+	request->reply->code = c->code;
+
+	fr_dlist_remove(&cache->lru, c);
+	fr_dlist_insert_head(&cache->lru, c);
+
+	cache->stats.hits++;
+	if (c->rcode == RLM_MODULE_REJECT) cache->stats.negative_hits++;
+
+	RDEBUG("Using cached %s reply, expires in %pVs", fr_packet_codes[c->code],
+	       fr_box_time_delta(fr_time_sub(c->expires, now)));
+
+	*p_result = c->rcode;
+	return true;
+}
+
+/** Add the reply for a proxied request to the cache
+ *
+ * Only Access-Accept and, if negative_ttl is set, Access-Reject
+ * are cached.  Access-Challenge, Protocol-Error and timeouts are
+ * never cached.  Proxy-State is stripped from the cached reply, as
+ * it belongs to the request which was proxied, and not to any
+ * later request which is answered from the cache.
+ *
+ * @param[in] cache	to add the entry to.
+ * @param[in] request	which was proxied.
+ * @param[in] rcode	returned by the I/O submodule.
+ * @param[in] key	as returned by #radius_cache_key.
+ * @param[in] skip	how many reply attributes were in the request
+ *			before it was proxied.  These aren't cached.
+ */
+void radius_cache_insert(radius_cache_t *cache, request_t *request, rlm_rcode_t rcode,
+			 uint8_t const *key, size_t skip)
+{
+	radius_cache_entry_t	*c;
+	fr_pair_t		*vp;
+	fr_time_delta_t		ttl;
+
+	switch (rcode) {
+	case RLM_MODULE_OK:
+		ttl = cache->conf->ttl;
+		break;
+
+	case RLM_MODULE_REJECT:
+		ttl = cache->conf->negative_ttl;
+		break;
+
+	default:
+		return;
+	}
+
+	if (!fr_time_delta_ispos(ttl) || !request->reply->code) return;
+
+	/*
+	 *	Another request with the same key may have been
+	 *	proxied at the same time.  The newest reply wins.
+	 */
+	c = fr_rb_find(cache->tree, &(radius_cache_entry_t){ .key = key, .key_len = talloc_array_length(key) });
+	if (c) cache_entry_free(cache, c);
+
+	while (fr_rb_num_elements(cache->tree) >= cache->conf->max_entries) {
+		c = fr_dlist_tail(&cache->lru);
+		if (fr_time_lteq(c->expires, fr_time())) {
+			cache->stats.expired++;
+		} else {
+			cache->stats.evicted++;
+		}
+		cache_entry_free(cache, c);
+	}
+
+	MEM(c = talloc_zero(cache, radius_cache_entry_t));
+	MEM(c->key = talloc_memdup(c, key, talloc_array_length(key)));
+	c->key_len = talloc_array_length(key);
+	c->expires = fr_time_add(fr_time(), ttl);
+	c->code = request->reply->code;
+	c->rcode = rcode;
+	fr_pair_list_init(&c->reply);
+
+	for (vp = fr_pair_list_head(&request->reply_pairs);
+	     vp;
+	     vp = fr_pair_list_next(&request->reply_pairs, vp)) {
+		fr_pair_t *copy;
+
+		if (skip > 0) {
+			skip--;
+			continue;
+		}
+
+		if (vp->da == cache->proxy_state) continue;
+
+		MEM(copy = fr_pair_copy(c, vp));
+		fr_pair_append(&c->reply, copy);
+	}
+
+	if (!fr_rb_insert(cache->tree, c)) {
+		RERROR("Failed inserting reply into cache");
+		talloc_free(c);
+		return;
+	}
+	fr_dlist_insert_head(&cache->lru, c);
+
+	cache->stats.inserts++;
+
+	RDEBUG2("Cached %s reply for %pVs", fr_packet_codes[c->code], fr_box_time_delta(ttl));
+}
+
+/** Return the statistics for a cache
+ *
+ */
+radius_cache_stats_t const *radius_cache_stats(radius_cache_t const *cache)
+{
+	return &cache->stats;
+}
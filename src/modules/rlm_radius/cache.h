@@ -0,0 +1,54 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file cache.h
+ * @brief Per-thread cache of replies from home servers
+ *
+ * @copyright 2022 Network RADIUS SARL (legal@networkradius.com)
+ */
+
+#include "rlm_radius.h"
+
+typedef struct radius_cache_s radius_cache_t;
+
+/** Statistics for a reply cache
+ *
+ */
+typedef struct {
+	uint64_t		hits;			//!< Replies served from the cache.
+	uint64_t		negative_hits;		//!< Of which were Access-Reject.
+	uint64_t		misses;			//!< Requests we had to proxy.
+	uint64_t		inserts;		//!< Replies added to the cache.
+	uint64_t		expired;		//!< Entries removed because their TTL passed.
+	uint64_t		evicted;		//!< Entries removed to make room for new ones.
+} radius_cache_stats_t;
+
+radius_cache_t			*radius_cache_alloc(TALLOC_CTX *ctx, rlm_radius_cache_conf_t const *conf,
+						   fr_dict_attr_t const *proxy_state);
+
+uint8_t				*radius_cache_key(TALLOC_CTX *ctx, rlm_radius_cache_conf_t const *conf, request_t *request);
+
+bool				radius_cache_reply(rlm_rcode_t *p_result, radius_cache_t *cache,
+						   request_t *request, uint8_t const *key) CC_HINT(nonnull);
+
+void				radius_cache_insert(radius_cache_t *cache, request_t *request, rlm_rcode_t rcode,
+						    uint8_t const *key, size_t skip) CC_HINT(nonnull);
+
+radius_cache_stats_t const	*radius_cache_stats(radius_cache_t const *cache) CC_HINT(nonnull);
@@ -0,0 +1,616 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_radius/codec.c
+ * @brief Packet encoding and decoding shared by the rlm_radius transports
+ *
+ * Everything here is independent of how the packets get to the home
+ * server.  The transports deal with sockets, IDs, and timers.
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/pair.h>
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/nbo.h>
+
+#include "codec.h"
+
+static fr_dict_t const *dict_radius;
+
+static fr_dict_autoload_t codec_dict[] = {
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_acct_delay_time;
+static fr_dict_attr_t const *attr_error_cause;
+static fr_dict_attr_t const *attr_event_timestamp;
+static fr_dict_attr_t const *attr_extended_attribute_1;
+static fr_dict_attr_t const *attr_message_authenticator;
+static fr_dict_attr_t const *attr_original_packet_code;
+static fr_dict_attr_t const *attr_proxy_state;
+static fr_dict_attr_t const *attr_response_length;
+
+static fr_dict_attr_autoload_t codec_dict_attr[] = {
+	{ .out = &attr_acct_delay_time, .name = "Acct-Delay-Time", .type = FR_TYPE_UINT32, .dict = &dict_radius},
+	{ .out = &attr_error_cause, .name = "Error-Cause", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ .out = &attr_event_timestamp, .name = "Event-Timestamp", .type = FR_TYPE_DATE, .dict = &dict_radius},
+	{ .out = &attr_extended_attribute_1, .name = "Extended-Attribute-1", .type = FR_TYPE_TLV, .dict = &dict_radius},
+	{ .out = &attr_message_authenticator, .name = "Message-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
+	{ .out = &attr_original_packet_code, .name = "Extended-Attribute-1.Original-Packet-Code", .type = FR_TYPE_UINT32, .dict = &dict_radius},
+	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
+	{ .out = &attr_response_length, .name = "Extended-Attribute-1.Response-Length", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ NULL }
+};
+
+/** If we get a reply, the request must come from one of a small
+ * number of packet types.
+ */
+static fr_radius_packet_code_t allowed_replies[FR_RADIUS_CODE_MAX] = {
+	[FR_RADIUS_CODE_ACCESS_ACCEPT]		= FR_RADIUS_CODE_ACCESS_REQUEST,
+	[FR_RADIUS_CODE_ACCESS_CHALLENGE]	= FR_RADIUS_CODE_ACCESS_REQUEST,
+	[FR_RADIUS_CODE_ACCESS_REJECT]		= FR_RADIUS_CODE_ACCESS_REQUEST,
+
+	[FR_RADIUS_CODE_ACCOUNTING_RESPONSE]	= FR_RADIUS_CODE_ACCOUNTING_REQUEST,
+
+	[FR_RADIUS_CODE_COA_ACK]		= FR_RADIUS_CODE_COA_REQUEST,
+	[FR_RADIUS_CODE_COA_NAK]		= FR_RADIUS_CODE_COA_REQUEST,
+
+	[FR_RADIUS_CODE_DISCONNECT_ACK]	= FR_RADIUS_CODE_DISCONNECT_REQUEST,
+	[FR_RADIUS_CODE_DISCONNECT_NAK]	= FR_RADIUS_CODE_DISCONNECT_REQUEST,
+
+	[FR_RADIUS_CODE_PROTOCOL_ERROR]	= FR_RADIUS_CODE_PROTOCOL_ERROR,	/* Any */
+};
+
+/** Turn a reply code into a module rcode;
+ *
+ */
+rlm_rcode_t const radius_code_to_rcode[FR_RADIUS_CODE_MAX] = {
+	[FR_RADIUS_CODE_ACCESS_ACCEPT]		= RLM_MODULE_OK,
+	[FR_RADIUS_CODE_ACCESS_CHALLENGE]	= RLM_MODULE_UPDATED,
+	[FR_RADIUS_CODE_ACCESS_REJECT]		= RLM_MODULE_REJECT,
+
+	[FR_RADIUS_CODE_ACCOUNTING_RESPONSE]	= RLM_MODULE_OK,
+
+	[FR_RADIUS_CODE_COA_ACK]		= RLM_MODULE_OK,
+	[FR_RADIUS_CODE_COA_NAK]		= RLM_MODULE_REJECT,
+
+	[FR_RADIUS_CODE_DISCONNECT_ACK]	= RLM_MODULE_OK,
+	[FR_RADIUS_CODE_DISCONNECT_NAK]	= RLM_MODULE_REJECT,
+
+	[FR_RADIUS_CODE_PROTOCOL_ERROR]	= RLM_MODULE_HANDLED,
+};
+
+/** Load the dictionaries used by the codec
+ *
+ * Called from the onload callback of each transport.
+ */
+int radius_codec_init(void)
+{
+	if (fr_dict_autoload(codec_dict) < 0) {
+		PERROR("%s", __FUNCTION__);
+		return -1;
+	}
+
+	if (fr_dict_attr_autoload(codec_dict_attr) < 0) {
+		PERROR("%s", __FUNCTION__);
+		fr_dict_autofree(codec_dict);
+		return -1;
+	}
+
+	return 0;
+}
+
+void radius_codec_free(void)
+{
+	fr_dict_autofree(codec_dict);
+}
+
+/** Encode a packet for sending to a home server
+ *
+ * Adds our Proxy-State (unless we're originating the packet), and a
+ * Message-Authenticator where required, updates Acct-Delay-Time, and
+ * signs the packet, unless pkt->sign is set.
+ *
+ * @param[in] ctx		to allocate the packet in.
+ * @param[out] packet_p		Where to write the encoded packet.
+ * @param[out] packet_len_p	Where to write the length of the encoded packet.
+ * @param[out] extra		Where to add pairs we added to the packet, for debugging.
+ *				They're parented by the packet, and are freed with it.
+ * @param[in] codec		Transport configuration.
+ * @param[in] request		containing the pairs to encode.
+ * @param[in] pkt		Packet specific information.
+ * @return
+ *	- 0 on success.
+ *	- 1 on success, but the packet contains an updated Acct-Delay-Time,
+ *	  so it must be encoded again before being retransmitted.
+ *	- -1 on failure.
+ */
+int radius_codec_encode(TALLOC_CTX *ctx, uint8_t **packet_p, size_t *packet_len_p, fr_pair_list_t *extra,
+			radius_codec_t const *codec, request_t *request, radius_codec_packet_t const *pkt)
+{
+	rlm_radius_t const	*parent = codec->parent;
+	uint8_t			*packet;
+	size_t			buflen;
+	ssize_t			packet_len;
+	uint8_t			*msg = NULL;
+	int			message_authenticator = pkt->require_ma * (RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2);
+	int			ret = 0;
+
+	/*
+	 *	Proxy-State is our magic number, and a loop counter.
+	 */
+	int			proxy_state = 7;
+
+	fr_assert(parent->allowed[pkt->code]);
+
+	if (pkt->sign) *pkt->sign = (fr_radius_sign_job_t){};
+
+	/*
+	 *	This is essentially free, as this memory was
+	 *	pre-allocated as part of the treq.
+	 */
+	buflen = codec->max_packet_size;
+	MEM(packet = talloc_array(ctx, uint8_t, buflen));
+
+	/*
+	 *	All proxied Access-Request packets MUST have a
+	 *	Message-Authenticator, otherwise they're insecure.
+	 *	Same goes for Status-Server.
+	 *
+	 *	And we set the authentication vector to a random
+	 *	number...
+	 */
+	switch (pkt->code) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+	{
+		size_t i;
+		uint32_t hash, base;
+
+		message_authenticator = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
+
+		base = fr_rand();
+		for (i = 0; i < RADIUS_AUTH_VECTOR_LENGTH; i += sizeof(uint32_t)) {
+			hash = fr_rand() ^ base;
+			memcpy(packet + RADIUS_AUTH_VECTOR_OFFSET + i, &hash, sizeof(hash));
+		}
+	}
+		FALL_THROUGH;
+
+	default:
+		break;
+	}
+
+	/*
+	 *	If we're sending a status check packet, update any
+	 *	necessary timestamps.  Also, don't add Proxy-State, as
+	 *	we're originating the packet.
+	 */
+	if (pkt->status_check) {
+		fr_pair_t *vp;
+
+		proxy_state = 0;
+		vp = fr_pair_find_by_da_idx(&request->request_pairs, attr_event_timestamp, 0);
+		if (vp) vp->vp_date = fr_time_to_unix_time(pkt->now);
+
+	} else if (parent->originate) {
+		/*
+		 *	We're originating packets instead of proxying
+		 *	them.  We don't add a Proxy-State attribute.
+		 */
+		proxy_state = 0;
+	}
+
+	/*
+	 *	We should have at minimum 64-byte packets, so don't
+	 *	bother doing run-time checks here.
+	 */
+	fr_assert(buflen >= (size_t) (RADIUS_HEADER_LENGTH + proxy_state + message_authenticator));
+
+	/*
+	 *	Encode it, leaving room for Proxy-State and
+	 *	Message-Authenticator if necessary.
+	 */
+	packet_len = fr_radius_encode(packet, buflen - (proxy_state + message_authenticator), NULL,
+				      codec->secret, talloc_array_length(codec->secret) - 1,
+				      pkt->code, pkt->id, &request->request_pairs);
+	if (fr_pair_encode_is_error(packet_len)) {
+		RPERROR("Failed encoding packet");
+
+	error:
+		talloc_free(packet);
+		return -1;
+	}
+
+	if (packet_len < 0) {
+		size_t have;
+		size_t need;
+
+		have = buflen - (proxy_state + message_authenticator);
+		need = have - packet_len;
+
+		if (need > RADIUS_MAX_PACKET_SIZE) {
+			RERROR("Failed encoding packet.  Have %zu bytes of buffer, need %zu bytes",
+			       have, need);
+		} else {
+			RERROR("Failed encoding packet.  Have %zu bytes of buffer, need %zu bytes.  "
+			       "Increase 'max_packet_size'", have, need);
+		}
+
+		goto error;
+	}
+	/*
+	 *	The encoded packet should NOT over-run the input buffer.
+	 */
+	fr_assert((size_t) (packet_len + proxy_state + message_authenticator) <= buflen);
+
+	/*
+	 *	Add Proxy-State to the tail end of the packet.
+	 *
+	 *	We need to add it here, and NOT in
+	 *	request->request_pairs, because multiple modules
+	 *	may be sending the packets at the same time.
+	 */
+	if (proxy_state) {
+		uint8_t		*attr = packet + packet_len;
+		fr_pair_t	*vp;
+		fr_dcursor_t	cursor;
+		int		count = 0;
+
+		/*
+		 *	Count how many Proxy-State attributes have
+		 *	*our* magic number.  Note that we also add a
+		 *	counter to each Proxy-State, so we're double
+		 *	sure that it's a loop.
+		 */
+		if (DEBUG_ENABLED) {
+			for (vp = fr_pair_dcursor_by_da_init(&cursor, &request->request_pairs, attr_proxy_state);
+			     vp;
+			     vp = fr_dcursor_next(&cursor)) {
+				if ((vp->vp_length == 5) && (memcmp(vp->vp_octets, &parent->proxy_state, 4) == 0)) {
+					count++;
+				}
+			}
+
+			/*
+			 *	Some configurations may proxy to
+			 *	ourselves for tests / simplicity.  But
+			 *	warn if there are a large number of
+			 *	identical Proxy-State attributes.
+			 */
+			if (count >= 4) RWARN("Potential proxy loop detected!  Please recheck your configuration.");
+		}
+
+		attr[0] = (uint8_t)attr_proxy_state->attr;
+		attr[1] = proxy_state;
+		memcpy(attr + 2, &parent->proxy_state, 4);
+		attr[6] = count & 0xff;
+		packet_len += proxy_state;
+
+		MEM(vp = fr_pair_afrom_da(packet, attr_proxy_state));
+		fr_pair_value_memdup(vp, attr + 2, proxy_state - 2, true);
+		fr_pair_append(extra, vp);
+	}
+
+	/*
+	 *	Add Message-Authenticator manually.
+	 *
+	 *	Note that the length check will always pass, due to
+	 *	the buflen manipulation done above.
+	 */
+	if (message_authenticator) {
+		msg = packet + packet_len;
+
+		msg[0] = (uint8_t) attr_message_authenticator->attr;
+		msg[1] = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
+		memset(msg + 2, 0,  RADIUS_MESSAGE_AUTHENTICATOR_LENGTH);
+
+		packet_len += msg[1];
+	}
+
+	/*
+	 *	Update the packet header based on the new attributes.
+	 */
+	packet[2] = (packet_len >> 8) & 0xff;
+	packet[3] = packet_len & 0xff;
+
+	/*
+	 *	Ensure that we update the Acct-Delay-Time based on the
+	 *	time difference between now, and when we originally
+	 *	received the request.
+	 */
+	if ((pkt->code == FR_RADIUS_CODE_ACCOUNTING_REQUEST) &&
+	    (fr_pair_find_by_da_idx(&request->request_pairs, attr_acct_delay_time, 0) != NULL)) {
+		uint8_t *attr, *end;
+		uint32_t delay;
+
+		/*
+		 *	Change Acct-Delay-Time in the packet, but not
+		 *	in the debug output.  Oh well.  We don't want
+		 *	to edit the incoming VPs, and we want to
+		 *	update the encoded version of Acct-Delay-Time.
+		 *	So we just walk through the packet to find it.
+		 */
+		end = packet + packet_len;
+
+		for (attr = packet + RADIUS_HEADER_LENGTH;
+		     attr < end;
+		     attr += attr[1]) {
+			if (attr[0] != attr_acct_delay_time->attr) continue;
+			if (attr[1] != 6) continue;
+
+			/*
+			 *	Add in the time between when
+			 *	we received the packet, and
+			 *	when we're sending the packet.
+			 */
+			memcpy(&delay, attr + 2, 4);
+			delay = ntohl(delay);
+			delay += fr_time_delta_to_sec(fr_time_sub(pkt->now, pkt->recv_time));
+			delay = htonl(delay);
+			memcpy(attr + 2, &delay, 4);
+			break;
+		}
+
+		ret = 1;
+	}
+
+	/*
+	 *	Only certain types of packet, and those with a
+	 *	message_authenticator need signing.
+	 */
+	if (message_authenticator) goto sign;
+	switch (pkt->code) {
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+	sign:
+		/*
+		 *	Leave signing to the caller if it's
+		 *	signing many packets at once.
+		 */
+		if (pkt->sign) {
+			*pkt->sign = (fr_radius_sign_job_t){
+				.packet = packet,
+				.secret = (uint8_t const *) codec->secret,
+				.secret_len = talloc_array_length(codec->secret) - 1
+			};
+			break;
+		}
+
+		/*
+		 *	Now that we're done mangling the packet, sign it.
+		 */
+		if (fr_radius_sign(packet, NULL, (uint8_t const *) codec->secret,
+				   talloc_array_length(codec->secret) - 1) < 0) {
+			RERROR("Failed signing packet");
+			goto error;
+		}
+		break;
+
+	default:
+		break;
+
+	}
+
+	*packet_p = packet;
+	*packet_len_p = packet_len;
+
+	return ret;
+}
+
+/** Validate and decode a reply from a home server
+ *
+ * @param[in] ctx			to allocate pairs in.
+ * @param[out] reply			Pointer to head of pair list to add reply attributes to.
+ * @param[out] response_code		The type of response packet.
+ * @param[in] codec			Transport configuration.
+ * @param[in] request			the request.
+ * @param[in] request_code		Code of the packet we sent.
+ * @param[in] status_check		Whether the packet we sent was a status check.
+ * @param[in] request_authenticator	from the original request.
+ * @param[in] data			to decode.
+ * @param[in] data_len			Length of input data.
+ * @return
+ *	- DECODE_FAIL_NONE on success.
+ *	- DECODE_FAIL_* on failure.
+ */
+decode_fail_t radius_codec_decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
+				  radius_codec_t const *codec, request_t *request,
+				  uint8_t request_code, bool status_check,
+				  uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
+				  uint8_t *data, size_t data_len)
+{
+	size_t			packet_len;
+	decode_fail_t		reason;
+	uint8_t			code;
+	uint8_t			original[RADIUS_HEADER_LENGTH];
+
+	*response_code = 0;	/* Initialise to keep the rest of the code happy */
+
+	packet_len = data_len;
+	if (!fr_radius_ok(data, &packet_len, codec->parent->max_attributes, false, &reason)) {
+		RWARN("Ignoring malformed packet");
+		return reason;
+	}
+
+	RHEXDUMP3(data, packet_len, "Read packet");
+
+	original[0] = request_code;
+	original[1] = 0;			/* not looked at by fr_radius_verify() */
+	original[2] = 0;
+	original[3] = RADIUS_HEADER_LENGTH;	/* for debugging */
+	memcpy(original + RADIUS_AUTH_VECTOR_OFFSET, request_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
+
+	if (fr_radius_verify(data, original,
+			     (uint8_t const *) codec->secret, talloc_array_length(codec->secret) - 1, false) < 0) {
+		RPWDEBUG("Ignoring response with invalid signature");
+		return DECODE_FAIL_MA_INVALID;
+	}
+
+	code = data[0];
+	if (!code || (code >= FR_RADIUS_CODE_MAX)) {
+		REDEBUG("Unknown reply code %d", code);
+		return DECODE_FAIL_UNKNOWN_PACKET_CODE;
+	}
+
+	if (!allowed_replies[code]) {
+		REDEBUG("%s packet received invalid reply code %s",
+			fr_packet_codes[request_code], fr_packet_codes[code]);
+		return DECODE_FAIL_UNKNOWN_PACKET_CODE;
+	}
+
+	/*
+	 *	Protocol error is allowed as a response to any
+	 *	packet code.
+	 *
+	 *	Status checks accept any response code.
+	 */
+	if (!status_check && (code != FR_RADIUS_CODE_PROTOCOL_ERROR)) {
+		if (allowed_replies[code] != (fr_radius_packet_code_t) request_code) {
+			REDEBUG("%s packet received invalid reply code %s",
+				fr_packet_codes[request_code], fr_packet_codes[code]);
+			return DECODE_FAIL_UNKNOWN_PACKET_CODE;
+		}
+	}
+
+	/*
+	 *	Decode the attributes, in the context of the reply.
+	 *	This only fails if the packet is strangely malformed,
+	 *	or if we run out of memory.
+	 */
+	if (fr_radius_decode(ctx, reply, data, packet_len, original,
+			     codec->secret, talloc_array_length(codec->secret) - 1) < 0) {
+		REDEBUG("Failed decoding attributes for packet");
+		fr_pair_list_free(reply);
+		return DECODE_FAIL_UNKNOWN;
+	}
+
+	*response_code = code;
+
+	return DECODE_FAIL_NONE;
+}
+
+/** Check a Protocol-Error reply, and see if the home server wants bigger replies
+ *
+ * @param[out] response_length	The buffer size the home server asked for, or
+ *				0 if it didn't ask for a larger buffer.
+ * @param[in] request_code	Code of the packet we sent.
+ * @param[in] data		The Protocol-Error packet.  Must already have been
+ *				validated by radius_codec_decode().
+ * @return
+ *	- RLM_MODULE_FAIL if the Protocol-Error doesn't match the packet we sent.
+ *	- RLM_MODULE_HANDLED otherwise.
+ */
+rlm_rcode_t radius_codec_protocol_error(uint32_t *response_length, uint8_t request_code, uint8_t const *data)
+{
+	bool	  	error_601 = false;
+	uint32_t	length = 0;
+	uint8_t const	*attr, *end;
+
+	*response_length = 0;
+
+	end = data + fr_nbo_to_uint16(data + 2);
+
+	for (attr = data + RADIUS_HEADER_LENGTH;
+	     attr < end;
+	     attr += attr[1]) {
+		/*
+		 *	Error-Cause = Response-Too-Big
+		 */
+		if ((attr[0] == attr_error_cause->attr) && (attr[1] == 6)) {
+			if (fr_nbo_to_uint32(attr + 2) == 601) error_601 = true;
+			continue;
+		}
+
+		/*
+		 *	The other end wants us to increase our Response-Length
+		 */
+		if ((attr[0] == attr_response_length->attr) && (attr[1] == 6)) {
+			length = fr_nbo_to_uint32(attr + 2);
+			continue;
+		}
+
+		/*
+		 *	Protocol-Error packets MUST contain an
+		 *	Original-Packet-Code attribute.
+		 *
+		 *	The attribute containing the
+		 *	Original-Packet-Code is an extended
+		 *	attribute.
+		 */
+		if (attr[0] != attr_extended_attribute_1->attr) continue;
+
+		/*
+		 *	ATTR + LEN + EXT-Attr + uint32
+		 */
+		if (attr[1] != 7) continue;
+
+		/*
+		 *	See if there's an Original-Packet-Code.
+		 */
+		if (attr[2] != (uint8_t)attr_original_packet_code->attr) continue;
+
+		/*
+		 *	Has to be an 8-bit number.
+		 */
+		if ((attr[3] != 0) ||
+		    (attr[4] != 0) ||
+		    (attr[5] != 0)) return RLM_MODULE_FAIL;
+
+		/*
+		 *	The value has to match.  We don't
+		 *	currently multiplex different codes
+		 *	with the same IDs on connections.  So
+		 *	this check is just for RFC compliance,
+		 *	and for sanity.
+		 */
+		if (attr[6] != request_code) return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Error-Cause = Response-Too-Big
+	 *
+	 *	The other end says it needs more room to send it's response
+	 *
+	 *	Limit it to reasonable values.
+	 */
+	if (error_601 && length) {
+		if (length < 4096) length = 4096;
+		if (length > 65535) length = 65535;
+
+		*response_length = length;
+	}
+
+	/*
+	 *	fail - something went wrong internally, or with the connection.
+	 *	invalid - wrong response to packet
+	 *	handled - best remaining alternative :(
+	 *
+	 *	i.e. if the response is NOT accept, reject, whatever,
+	 *	then we shouldn't allow the caller to do any more
+	 *	processing of this packet.  There was a protocol
+	 *	error, and the response is valid, but not useful for
+	 *	anything.
+	 */
+	return RLM_MODULE_HANDLED;
+}
@@ -0,0 +1,69 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file codec.h
+ * @brief Packet encoding and decoding shared by the rlm_radius transports
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#include "rlm_radius.h"
+
+/** What a transport needs to know about its configuration to encode and decode packets
+ *
+ */
+typedef struct {
+	rlm_radius_t const	*parent;		//!< rlm_radius instance.
+	char const		*secret;		//!< Shared secret.
+	size_t			max_packet_size;	//!< Largest packet we send.
+} radius_codec_t;
+
+/** A packet we're about to send to a home server
+ *
+ */
+typedef struct {
+	uint8_t			code;			//!< Packet code.
+	uint8_t			id;			//!< ID to put into the packet header.
+	bool			require_ma;		//!< Add a Message-Authenticator.
+	bool			status_check;		//!< We're originating a status check.
+	fr_time_t		recv_time;		//!< When we received the request.
+	fr_time_t		now;			//!< When we're sending the packet.
+	fr_radius_sign_job_t	*sign;			//!< If set, the packet isn't signed.  Instead
+							///< this is filled in, so the caller can sign it
+							///< along with other packets.  sign->packet is NULL
+							///< if the packet doesn't need signing.
+} radius_codec_packet_t;
+
+extern rlm_rcode_t const radius_code_to_rcode[FR_RADIUS_CODE_MAX];
+
+int		radius_codec_init(void);
+
+void		radius_codec_free(void);
+
+int		radius_codec_encode(TALLOC_CTX *ctx, uint8_t **packet_p, size_t *packet_len_p, fr_pair_list_t *extra,
+				    radius_codec_t const *codec, request_t *request, radius_codec_packet_t const *pkt);
+
+decode_fail_t	radius_codec_decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
+				    radius_codec_t const *codec, request_t *request,
+				    uint8_t request_code, bool status_check,
+				    uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
+				    uint8_t *data, size_t data_len);
+
+rlm_rcode_t	radius_codec_protocol_error(uint32_t *response_length, uint8_t request_code, uint8_t const *data);
@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/dlist.h>
 
 #include "rlm_radius.h"
+#include "cache.h"
 
 static int type_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
 static int status_check_type_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent, CONF_ITEM *ci, CONF_PARSER const *rule);
@@ -42,6 +43,15 @@ static CONF_PARSER const status_check_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static CONF_PARSER const cache_config[] = {
+	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL, rlm_radius_t, cache.key) },
+	{ FR_CONF_OFFSET("ttl", FR_TYPE_TIME_DELTA, rlm_radius_t, cache.ttl), .dflt = STRINGIFY(5) },
+	{ FR_CONF_OFFSET("negative_ttl", FR_TYPE_TIME_DELTA, rlm_radius_t, cache.negative_ttl), .dflt = STRINGIFY(0) },
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_radius_t, cache.max_entries), .dflt = STRINGIFY(16384) },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER const status_check_update_config[] = {
 	{ FR_CONF_OFFSET("update", FR_TYPE_SUBSECTION | FR_TYPE_REQUIRED, rlm_radius_t, status_check_map),
 	  .ident2 = CF_IDENT_ANY,
@@ -123,6 +133,8 @@ static CONF_PARSER const module_config[] = {
 
 	{ FR_CONF_OFFSET("pool", FR_TYPE_SUBSECTION, rlm_radius_t, trunk_conf), .subcs = (void const *) fr_trunk_config, },
 
+	{ FR_CONF_POINTER("cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) cache_config },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -135,6 +147,23 @@ static CONF_PARSER const type_interval_config[FR_RADIUS_CODE_MAX] = {
 	[FR_RADIUS_CODE_DISCONNECT_REQUEST] = { FR_CONF_POINTER("Disconnect-Request", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) disconnect_config },
 };
 
+/** Per-thread data for rlm_radius
+ *
+ */
+typedef struct {
+	radius_cache_t		*cache;			//!< Replies cached from home servers.
+} rlm_radius_thread_t;
+
+/** Resume context used when the reply needs to be cached
+ *
+ */
+typedef struct {
+	void			*io_rctx;		//!< Resume context of the I/O submodule.
+	uint8_t			*key;			//!< What to cache the reply under.
+	size_t			num_reply;		//!< Number of reply attributes before the request
+							///< was proxied.  These are not cached.
+} rlm_radius_cache_rctx_t;
+
 static fr_dict_t const *dict_radius;
 
 extern fr_dict_autoload_t rlm_radius_dict[];
@@ -147,6 +176,7 @@ static fr_dict_attr_t const *attr_chap_challenge;
 static fr_dict_attr_t const *attr_chap_password;
 static fr_dict_attr_t const *attr_packet_type;
 static fr_dict_attr_t const *attr_proxy_state;
+static fr_dict_attr_t const *attr_state;
 
 extern fr_dict_attr_autoload_t rlm_radius_dict_attr[];
 fr_dict_attr_autoload_t rlm_radius_dict_attr[] = {
@@ -154,6 +184,7 @@ fr_dict_attr_autoload_t rlm_radius_dict_attr[] = {
 	{ .out = &attr_chap_password, .name = "CHAP-Password", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
+	{ .out = &attr_state, .name = "State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ NULL }
 };
 
@@ -349,6 +380,31 @@ static void mod_radius_signal(module_ctx_t const *mctx, request_t *request, fr_s
 			      mctx->rctx), request, action);
 }
 
+static void mod_radius_cache_signal(module_ctx_t const *mctx, request_t *request, fr_state_signal_t action)
+{
+	rlm_radius_cache_rctx_t	*rctx = talloc_get_type_abort(mctx->rctx, rlm_radius_cache_rctx_t);
+
+	mod_radius_signal(MODULE_CTX(mctx->inst, mctx->thread, rctx->io_rctx), request, action);
+}
+
+/** Get the result from the I/O submodule, and cache the reply
+ *
+ */
+static unlang_action_t mod_radius_cache_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_radius_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_radius_t);
+	rlm_radius_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_radius_thread_t);
+	rlm_radius_cache_rctx_t	*rctx = talloc_get_type_abort(mctx->rctx, rlm_radius_cache_rctx_t);
+	rlm_rcode_t		rcode = RLM_MODULE_FAIL;
+
+	(void) inst->io->resume(&rcode, MODULE_CTX(mctx->inst, mctx->thread, rctx->io_rctx), request);
+
+	radius_cache_insert(t->cache, request, rcode, rctx->key, rctx->num_reply);
+	talloc_free(rctx);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
 /** Do any RADIUS-layer fixups for proxying.
  *
  */
@@ -390,9 +446,11 @@ static void radius_fixups(rlm_radius_t const *inst, request_t *request)
 static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_radius_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_radius_t);
+	rlm_radius_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_radius_thread_t);
 	rlm_rcode_t		rcode;
 	unlang_action_t		ua;
 	RADCLIENT		*client;
+	uint8_t			*key = NULL;
 
 	void			*rctx = NULL;
 
@@ -435,6 +493,19 @@ static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, modul
 	 */
 	radius_fixups(inst, request);
 
+	/*
+	 *	Check the reply cache.  Requests which are part of a
+	 *	multi-round exchange are never cached, as the home
+	 *	server's reply depends on its own session state.
+	 */
+	if (t->cache && !fr_pair_find_by_da_idx(&request->request_pairs, attr_state, 0)) {
+		key = radius_cache_key(request, &inst->cache, request);
+		if (key && radius_cache_reply(&rcode, t->cache, request, key)) {
+			talloc_free(key);
+			RETURN_MODULE_RCODE(rcode);
+		}
+	}
+
 	/*
 	 *	Push the request and it's data to the IO submodule.
 	 *
@@ -446,9 +517,23 @@ static unlang_action_t CC_HINT(nonnull) mod_process(rlm_rcode_t *p_result, modul
 			       module_thread(inst->io_submodule)->data, request);
 	if (ua != UNLANG_ACTION_YIELD) {
 		fr_assert(rctx == NULL);
+		talloc_free(key);
 		RETURN_MODULE_RCODE(rcode);
 	}
 
+	if (key) {
+		rlm_radius_cache_rctx_t *cache_rctx;
+
+		MEM(cache_rctx = talloc(request, rlm_radius_cache_rctx_t));
+		*cache_rctx = (rlm_radius_cache_rctx_t) {
+			.io_rctx = rctx,
+			.key = talloc_steal(cache_rctx, key),
+			.num_reply = fr_pair_list_len(&request->reply_pairs)
+		};
+
+		return unlang_module_yield(request, mod_radius_cache_resume, mod_radius_cache_signal, cache_rctx);
+	}
+
 	return unlang_module_yield(request, inst->io->resume, mod_radius_signal, rctx);
 }
 
@@ -624,6 +709,55 @@ setup_io_submodule:
 	 */
 	inst->proxy_state = fr_rand();
 
+	/*
+	 *	Caching replies only makes sense if we wait for them.
+	 */
+	if (inst->cache.key) {
+		if (inst->replicate) {
+			cf_log_err(conf, "Cannot use 'cache' with 'replicate = true'");
+			return -1;
+		}
+
+		FR_TIME_DELTA_BOUND_CHECK("cache.ttl", inst->cache.ttl, >=, fr_time_delta_from_sec(1));
+		FR_TIME_DELTA_BOUND_CHECK("cache.ttl", inst->cache.ttl, <=, fr_time_delta_from_sec(3600));
+		FR_TIME_DELTA_BOUND_CHECK("cache.negative_ttl", inst->cache.negative_ttl, <=, fr_time_delta_from_sec(3600));
+		FR_INTEGER_BOUND_CHECK("cache.max_entries", inst->cache.max_entries, >=, 1);
+	}
+
+	return 0;
+}
+
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_radius_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_radius_t);
+	rlm_radius_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_radius_thread_t);
+
+	if (!inst->cache.key) return 0;
+
+	t->cache = radius_cache_alloc(t, &inst->cache, attr_proxy_state);
+	if (!t->cache) {
+		ERROR("Failed allocating reply cache");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_radius_thread_t		*t = talloc_get_type_abort(mctx->thread, rlm_radius_thread_t);
+	radius_cache_stats_t const	*stats;
+
+	if (!t->cache) return 0;
+
+	stats = radius_cache_stats(t->cache);
+	DEBUG2("%s - Reply cache hits %" PRIu64 " (negative %" PRIu64 "), misses %" PRIu64
+	       ", inserts %" PRIu64 ", expired %" PRIu64 ", evicted %" PRIu64,
+	       mctx->inst->name, stats->hits, stats->negative_hits, stats->misses,
+	       stats->inserts, stats->expired, stats->evicted);
+
+	TALLOC_FREE(t->cache);
+
 	return 0;
 }
 
@@ -663,6 +797,11 @@ module_rlm_t rlm_radius = {
 		.unload		= mod_unload,
 
 		.bootstrap	= mod_bootstrap,
+
+		.thread_inst_size	= sizeof(rlm_radius_thread_t),
+		.thread_inst_type	= "rlm_radius_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach,
 	},
 	.methods = {
 		[MOD_PREACCT]		= mod_process,
@@ -36,6 +36,18 @@
 typedef struct rlm_radius_s rlm_radius_t;
 typedef struct rlm_radius_io_s rlm_radius_io_t;
 
+/** Configuration for the reply cache
+ *
+ */
+typedef struct {
+	tmpl_t			*key;			//!< What to key cached replies on.  The cache
+							///< is disabled if this isn't set.
+	fr_time_delta_t		ttl;			//!< How long Access-Accept is cached for.
+	fr_time_delta_t		negative_ttl;		//!< How long Access-Reject is cached for.
+							///< Zero disables negative caching.
+	uint32_t		max_entries;		//!< Maximum number of replies cached per thread.
+} rlm_radius_cache_conf_t;
+
 /*
  *	Define a structure for our module configuration.
  */
@@ -67,6 +79,8 @@ struct rlm_radius_s {
 	fr_retry_config_t      	retry[FR_RADIUS_CODE_MAX];
 
 	fr_trunk_conf_t		trunk_conf;		//!< trunk configuration
+
+	rlm_radius_cache_conf_t	cache;			//!< Reply cache configuration.
 };
 
 /** Enqueue a request_t to an IO submodule
@@ -1,7 +1,7 @@
 TARGETNAME	:= rlm_radius
 TARGET		:= $(TARGETNAME)$(L)
 
-SOURCES		:= rlm_radius.c
+SOURCES		:= rlm_radius.c cache.c
 
 TGT_PREREQS	:= libfreeradius-radius$(L)
 LOG_ID_LIB	= 39
@@ -0,0 +1,2314 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_radius_tcp.c
+ * @brief RADIUS TCP and RADIUS/TLS (RadSec) transport
+ *
+ * Requests are pipelined over a small number of long lived connections.
+ * As per RFC 6613, packets are never retransmitted over the same
+ * connection.  If the home server doesn't respond, the connection is
+ * marked zombie, and the requests are failed or moved to another
+ * connection.
+ *
+ * @copyright 2017 Network RADIUS SARL
+ * @copyright 2020 Arran Cudbard-Bell (a.cudbardb@freeradius.org)
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/application.h>
+#include <freeradius-devel/io/listen.h>
+#include <freeradius-devel/io/pair.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/server/connection.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/nbo.h>
+
+#ifdef WITH_TLS
+#  include <freeradius-devel/tls/base.h>
+#  include <freeradius-devel/tls/log.h>
+#endif
+
+#include <sys/socket.h>
+
+#include "rlm_radius.h"
+#include "codec.h"
+#include "track.h"
+
+/** Static configuration for the module.
+ *
+ */
+typedef struct {
+	rlm_radius_t		*parent;		//!< rlm_radius instance.
+	CONF_SECTION		*config;
+
+	fr_ipaddr_t		dst_ipaddr;		//!< IP of the home server.
+	fr_ipaddr_t		src_ipaddr;		//!< IP we open our socket on.
+	uint16_t		dst_port;		//!< Port of the home server.
+	char const		*secret;		//!< Shared secret.
+
+	char const		*interface;		//!< Interface to bind to.
+
+	uint32_t		recv_buff;		//!< How big the kernel's receive buffer should be.
+	uint32_t		send_buff;		//!< How big the kernel's send buffer should be.
+
+	uint32_t		max_packet_size;	//!< Maximum packet size.
+
+	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
+	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
+
+#ifdef WITH_TLS
+	fr_tls_conf_t		*tls;			//!< TLS configuration.  NULL if we're doing plain TCP.
+#endif
+
+	fr_trunk_conf_t		*trunk_conf;		//!< trunk configuration
+
+	radius_codec_t		codec;			//!< What we need to encode and decode packets.
+} rlm_radius_tcp_t;
+
+typedef struct {
+	fr_event_list_t		*el;			//!< Event list.
+
+	rlm_radius_tcp_t const	*inst;			//!< our instance
+
+	fr_trunk_t		*trunk;			//!< trunk handler
+
+#ifdef WITH_TLS
+	SSL_CTX			*ssl_ctx;		//!< Thread local SSL_CTX.
+	SSL_SESSION		*tls_session;		//!< Most recent resumable session.  Used to
+							///< resume sessions when we open new connections.
+#endif
+} tcp_thread_t;
+
+typedef struct {
+	fr_trunk_request_t	*treq;
+	rlm_rcode_t		rcode;			//!< from the transport
+} tcp_result_t;
+
+typedef struct tcp_request_s tcp_request_t;
+
+/** Track the handle, which is tightly correlated with the FD
+ *
+ */
+typedef struct {
+	char const     		*name;			//!< From IP PORT to IP PORT.
+	char const		*module_name;		//!< the module that opened the connection
+
+	int			fd;			//!< File descriptor.
+
+	rlm_radius_tcp_t const	*inst;			//!< Our module instance.
+	tcp_thread_t		*thread;
+
+	uint32_t		max_packet_size;	//!< Our max packet size. may be different from the parent.
+
+	fr_ipaddr_t		src_ipaddr;		//!< Source IP address.
+	uint16_t		src_port;		//!< Source port specific to this connection.
+
+	uint8_t			*buffer;		//!< Receive buffer.
+	size_t			buflen;			//!< Receive buffer length.
+	size_t			recv_len;		//!< How much data is in the receive buffer.
+
+	uint8_t			*send_buf;		//!< Remainder of a partially written packet.
+	size_t			send_len;		//!< How much data is left to write.
+
+	fr_trunk_connection_event_t	notify_on;	//!< What the trunk last asked us to watch for.
+
+#ifdef WITH_TLS
+	bool			write_wants_read;	//!< OpenSSL has to read before it can finish the
+							///< last write.
+	bool			read_wants_write;	//!< OpenSSL has to write before it can finish the
+							///< last read.
+#endif
+
+	radius_track_t		*tt;			//!< RADIUS ID tracking structure.
+
+	fr_time_t		mrs_time;		//!< Most recent sent time which had a reply.
+	fr_time_t		last_reply;		//!< When we last received a reply.
+	fr_time_t		first_sent;		//!< first time we sent a packet since going idle
+	fr_time_t		last_sent;		//!< last time we sent a packet.
+	fr_time_t		last_idle;		//!< last time we had nothing to do
+
+	fr_event_timer_t const	*zombie_ev;		//!< Zombie timeout.
+	fr_event_timer_t const	*status_ev;		//!< When to send the next status check.
+
+	bool			status_checking;       	//!< whether we're doing status checks
+	tcp_request_t		*status_u;		//!< for sending status check packets
+	tcp_result_t		*status_r;		//!< for faking out status checks as real packets
+	request_t		*status_request;
+
+#ifdef WITH_TLS
+	SSL			*ssl;			//!< TLS session for this connection.
+#endif
+} tcp_handle_t;
+
+
+/** Connect request_t to local tracking structure
+ *
+ */
+struct tcp_request_s {
+	uint32_t		priority;		//!< copied from request->async->priority
+	fr_time_t		recv_time;		//!< copied from request->async->recv_time
+
+	uint32_t		num_replies;		//!< number of reply packets, sent is in retry.count
+
+	bool			synchronous;		//!< cached from inst->parent->synchronous
+	bool			require_ma;		//!< saved from the original packet.
+	bool			status_check;		//!< is this packet a status check?
+
+	fr_pair_list_t		extra;			//!< VPs for debugging, like Proxy-State.
+
+	uint8_t			code;			//!< Packet code.
+	uint8_t			id;			//!< Last ID assigned to this packet.
+	uint8_t			*packet;		//!< Packet we write to the network.
+	size_t			packet_len;		//!< Length of the packet.
+
+	radius_track_entry_t	*rr;			//!< ID tracking, resend count, etc.
+	fr_event_timer_t const	*ev;			//!< timer for response timeouts
+	fr_retry_t		retry;			//!< retransmission timers
+};
+
+static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_tcp_t, dst_ipaddr), },
+	{ FR_CONF_OFFSET("ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_tcp_t, dst_ipaddr) },
+	{ FR_CONF_OFFSET("ipv6addr", FR_TYPE_IPV6_ADDR, rlm_radius_tcp_t, dst_ipaddr) },
+
+	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, rlm_radius_tcp_t, dst_port) },
+
+	{ FR_CONF_OFFSET("secret", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_radius_tcp_t, secret) },
+
+	{ FR_CONF_OFFSET("interface", FR_TYPE_STRING, rlm_radius_tcp_t, interface) },
+
+	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, rlm_radius_tcp_t, recv_buff) },
+	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, rlm_radius_tcp_t, send_buff) },
+
+	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, rlm_radius_tcp_t, max_packet_size), .dflt = "4096" },
+
+	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_tcp_t, src_ipaddr) },
+	{ FR_CONF_OFFSET("src_ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_tcp_t, src_ipaddr) },
+	{ FR_CONF_OFFSET("src_ipv6addr", FR_TYPE_IPV6_ADDR, rlm_radius_tcp_t, src_ipaddr) },
+
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_dict_t const *dict_radius;
+
+extern fr_dict_autoload_t rlm_radius_tcp_dict[];
+fr_dict_autoload_t rlm_radius_tcp_dict[] = {
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_event_timestamp;
+static fr_dict_attr_t const *attr_message_authenticator;
+static fr_dict_attr_t const *attr_nas_identifier;
+static fr_dict_attr_t const *attr_proxy_state;
+static fr_dict_attr_t const *attr_user_password;
+static fr_dict_attr_t const *attr_packet_type;
+
+extern fr_dict_attr_autoload_t rlm_radius_tcp_dict_attr[];
+fr_dict_attr_autoload_t rlm_radius_tcp_dict_attr[] = {
+	{ .out = &attr_event_timestamp, .name = "Event-Timestamp", .type = FR_TYPE_DATE, .dict = &dict_radius},
+	{ .out = &attr_message_authenticator, .name = "Message-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
+	{ .out = &attr_nas_identifier, .name = "NAS-Identifier", .type = FR_TYPE_STRING, .dict = &dict_radius},
+	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
+	{ .out = &attr_user_password, .name = "User-Password", .type = FR_TYPE_STRING, .dict = &dict_radius},
+	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
+	{ NULL }
+};
+
+static void		protocol_error_reply(tcp_request_t *u, tcp_result_t *r, tcp_handle_t *h,
+					     uint8_t const *data);
+
+static int		conn_flush(fr_event_list_t *el, fr_trunk_connection_t *tconn, tcp_handle_t *h);
+
+#ifndef NDEBUG
+/** Log additional information about a tracking entry
+ *
+ * @param[in] te	Tracking entry we're logging information for.
+ * @param[in] log	destination.
+ * @param[in] log_type	Type of log message.
+ * @param[in] file	the logging request was made in.
+ * @param[in] line 	logging request was made on.
+ */
+static void tcp_tracking_entry_log(fr_log_t const *log, fr_log_type_t log_type, char const *file, int line,
+				   radius_track_entry_t *te)
+{
+	request_t			*request;
+
+	if (!te->request) return;	/* Free entry */
+
+	request = talloc_get_type_abort(te->request, request_t);
+
+	fr_log(log, log_type, file, line, "request %s, allocated %s:%u", request->name,
+	       request->alloc_file, request->alloc_line);
+
+	fr_trunk_request_state_log(log, log_type, file, line, talloc_get_type_abort(te->uctx, fr_trunk_request_t));
+}
+#endif
+
+/** Clear out any connection specific resources from a tcp request
+ *
+ * Unlike UDP, we never retransmit a packet over the same connection,
+ * so the encoded packet and its ID are always released.
+ */
+static void tcp_request_reset(tcp_request_t *u)
+{
+	TALLOC_FREE(u->packet);
+	fr_pair_list_init(&u->extra);	/* Freed with packet */
+
+	if (u->rr) radius_track_entry_release(&u->rr);
+}
+
+/** Reset a status_check packet, ready to re-use
+ *
+ */
+static void status_check_reset(tcp_handle_t *h, tcp_request_t *u)
+{
+	fr_assert(u->status_check == true);
+
+	h->status_checking = false;
+	u->num_replies = 0;	/* Reset */
+	u->retry.start = fr_time_wrap(0);
+
+	if (u->ev) (void) fr_event_timer_delete(&u->ev);
+	if (h->status_ev) (void) fr_event_timer_delete(&h->status_ev);
+
+	tcp_request_reset(u);
+}
+
+/*
+ *	Status-Server checks.  Manually build the packet, and
+ *	all of its associated glue.
+ */
+static void CC_HINT(nonnull) status_check_alloc(tcp_handle_t *h)
+{
+	tcp_request_t		*u;
+	request_t		*request;
+	rlm_radius_tcp_t const	*inst = h->inst;
+	map_t			*map = NULL;
+
+	fr_assert(!h->status_u && !h->status_r && !h->status_request);
+
+	u = talloc_zero(h, tcp_request_t);
+	fr_pair_list_init(&u->extra);
+
+	/*
+	 *	Status checks are prioritized over any other packet
+	 */
+	u->priority = ~(uint32_t) 0;
+	u->status_check = true;
+
+	/*
+	 *	Allocate outside of the free list.
+	 *	There appears to be an issue where
+	 *	the thread destructor runs too
+	 *	early, and frees the freelist's
+	 *	head before the module destructor
+	 *      runs.
+	 */
+	request = request_local_alloc_external(u, NULL);
+	request->async = talloc_zero(request, fr_async_t);
+	talloc_const_free(request->name);
+	request->name = talloc_strdup(request, h->module_name);
+
+	request->packet = fr_radius_packet_alloc(request, false);
+	request->reply = fr_radius_packet_alloc(request, false);
+
+	/*
+	 *	Create the VPs, and ignore any errors
+	 *	creating them.
+	 */
+	while ((map = map_list_next(&inst->parent->status_check_map, map))) {
+		/*
+		 *	Skip things which aren't attributes.
+		 */
+		if (!tmpl_is_attr(map->lhs)) continue;
+
+		/*
+		 *	Ignore internal attributes.
+		 */
+		if (tmpl_da(map->lhs)->flags.internal) continue;
+
+		/*
+		 *	Ignore signalling attributes.  They shouldn't exist.
+		 */
+		if ((tmpl_da(map->lhs) == attr_proxy_state) ||
+		    (tmpl_da(map->lhs) == attr_message_authenticator)) continue;
+
+		/*
+		 *	Allow passwords only in Access-Request packets.
+		 */
+		if ((inst->parent->status_check != FR_RADIUS_CODE_ACCESS_REQUEST) &&
+		    (tmpl_da(map->lhs) == attr_user_password)) continue;
+
+		(void) map_to_request(request, map, map_to_vp, NULL);
+	}
+
+	/*
+	 *	Ensure that there's a NAS-Identifier, if one wasn't
+	 *	already added.
+	 */
+	if (!fr_pair_find_by_da_idx(&request->request_pairs, attr_nas_identifier, 0)) {
+		fr_pair_t *vp;
+
+		MEM(pair_append_request(&vp, attr_nas_identifier) >= 0);
+		fr_pair_value_strdup(vp, "status check - are you alive?", false);
+	}
+
+	/*
+	 *	Always add an Event-Timestamp, which will be the time
+	 *	at which the first packet is sent.  Or for
+	 *	Status-Server, the time of the current packet.
+	 */
+	if (!fr_pair_find_by_da_idx(&request->request_pairs, attr_event_timestamp, 0)) {
+		MEM(pair_append_request(NULL, attr_event_timestamp) >= 0);
+	}
+
+	/*
+	 *	Initialize the request IO ctx.  Note that we don't set
+	 *	destructors.
+	 */
+	u->code = inst->parent->status_check;
+	request->packet->code = u->code;
+
+	DEBUG3("%s - Status check packet type will be %s", h->module_name, fr_packet_codes[u->code]);
+	log_request_pair_list(L_DBG_LVL_3, request, NULL, &request->request_pairs, NULL);
+
+	MEM(h->status_r = talloc_zero(request, tcp_result_t));
+	h->status_u = u;
+	h->status_request = request;
+}
+
+/** Write data to the connection
+ *
+ * @param[in] h		Connection handle.
+ * @param[in] data	to write.
+ * @param[in] data_len	Length of data to write.
+ * @return
+ *	- >0 the number of bytes written.
+ *	- 0 if the connection isn't currently writable.
+ *	- <0 on fatal error.  fr_strerror() will describe the error.
+ */
+static ssize_t tcp_write(tcp_handle_t *h, uint8_t const *data, size_t data_len)
+{
+	ssize_t slen;
+
+#ifdef WITH_TLS
+	if (h->ssl) {
+		int ret;
+
+		h->write_wants_read = false;
+
+		ERR_clear_error();
+		ret = SSL_write(h->ssl, data, data_len);
+		if (ret > 0) return ret;
+
+		switch (SSL_get_error(h->ssl, ret)) {
+		/*
+		 *	OpenSSL has to read a record (e.g. a key
+		 *	update) before it can write any more.  Waiting
+		 *	for the socket to become writable won't help,
+		 *	so retry the write when it becomes readable.
+		 */
+		case SSL_ERROR_WANT_READ:
+			h->write_wants_read = true;
+			return 0;
+
+		case SSL_ERROR_WANT_WRITE:
+			return 0;
+
+		default:
+			fr_tls_log_strerror_printf("Failed writing to TLS session");
+			return -1;
+		}
+	}
+#endif
+
+	slen = write(h->fd, data, data_len);
+	if (slen >= 0) return slen;
+
+	switch (errno) {
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+	case EWOULDBLOCK:
+#endif
+	case EAGAIN:
+	case EINTR:
+		return 0;
+
+	default:
+		fr_strerror_printf("%s", fr_syserror(errno));
+		return -1;
+	}
+}
+
+/** Read data from the connection
+ *
+ * @param[in] h		Connection handle.
+ * @param[out] buffer	to read into.
+ * @param[in] buflen	Length of the buffer.
+ * @return
+ *	- >0 the number of bytes read.
+ *	- 0 if there is no data available.
+ *	- <0 on fatal error, or if the other end closed the connection.
+ */
+static ssize_t tcp_read(tcp_handle_t *h, uint8_t *buffer, size_t buflen)
+{
+	ssize_t slen;
+
+#ifdef WITH_TLS
+	if (h->ssl) {
+		int ret;
+
+		h->read_wants_write = false;
+
+		ERR_clear_error();
+		ret = SSL_read(h->ssl, buffer, buflen);
+		if (ret > 0) return ret;
+
+		switch (SSL_get_error(h->ssl, ret)) {
+		case SSL_ERROR_WANT_READ:
+			return 0;
+
+		/*
+		 *	OpenSSL has to write before it can read any
+		 *	more.  Retry the read when the socket becomes
+		 *	writable.
+		 */
+		case SSL_ERROR_WANT_WRITE:
+			h->read_wants_write = true;
+			return 0;
+
+		case SSL_ERROR_ZERO_RETURN:
+			fr_strerror_const("Home server closed the TLS session");
+			return -1;
+
+		default:
+			fr_tls_log_strerror_printf("Failed reading from TLS session");
+			return -1;
+		}
+	}
+#endif
+
+	slen = read(h->fd, buffer, buflen);
+	if (slen > 0) return slen;
+
+	if (slen == 0) {
+		fr_strerror_const("Home server closed the connection");
+		return -1;
+	}
+
+	switch (errno) {
+#if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
+	case EWOULDBLOCK:
+#endif
+	case EAGAIN:
+	case EINTR:
+		return 0;
+
+	default:
+		fr_strerror_printf("%s", fr_syserror(errno));
+		return -1;
+	}
+}
+
+/** Free a connection handle, closing associated resources
+ *
+ */
+static int _tcp_handle_free(tcp_handle_t *h)
+{
+	fr_assert(h->fd >= 0);
+
+	if (h->status_u) fr_event_timer_delete(&h->status_u->ev);
+
+	fr_event_fd_delete(h->thread->el, h->fd, FR_EVENT_FILTER_IO);
+
+#ifdef WITH_TLS
+	if (h->ssl) {
+		SSL_SESSION *session;
+
+		/*
+		 *	Remember the session so that the next
+		 *	connection we open can resume it, and
+		 *	skip the full handshake.
+		 */
+		session = SSL_get1_session(h->ssl);
+		if (session) {
+			if (SSL_SESSION_is_resumable(session)) {
+				if (h->thread->tls_session) SSL_SESSION_free(h->thread->tls_session);
+				h->thread->tls_session = session;
+			} else {
+				SSL_SESSION_free(session);
+			}
+		}
+
+		(void) SSL_shutdown(h->ssl);	/* Best effort, the socket is non-blocking */
+		SSL_free(h->ssl);
+		h->ssl = NULL;
+	}
+#endif
+
+	if (shutdown(h->fd, SHUT_RDWR) < 0) {
+		DEBUG3("%s - Failed shutting down connection %s: %s",
+		       h->module_name, h->name, fr_syserror(errno));
+	}
+
+	if (close(h->fd) < 0) {
+		DEBUG3("%s - Failed closing connection %s: %s",
+		       h->module_name, h->name, fr_syserror(errno));
+	}
+
+	h->fd = -1;
+
+	DEBUG("%s - Connection closed - %s", h->module_name, h->name);
+
+	return 0;
+}
+
+#ifdef WITH_TLS
+/** Connection errored during the TLS handshake
+ *
+ * @param[in] el	The event list signalling.
+ * @param[in] fd	that errored.
+ * @param[in] flags	El flags.
+ * @param[in] fd_errno	The nature of the error.
+ * @param[in] uctx	The connection.
+ */
+static void conn_error_tls_handshake(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				     int fd_errno, void *uctx)
+{
+	fr_connection_t		*conn = talloc_get_type_abort(uctx, fr_connection_t);
+	tcp_handle_t		*h;
+
+	fr_assert(conn->state == FR_CONNECTION_STATE_CONNECTING);
+
+	h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	ERROR("%s - Connection %s failed: %s", h->module_name, h->name, fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+}
+
+/** Drive the TLS handshake
+ *
+ * Called first when the TCP connection is established, and then whenever
+ * the socket becomes readable or writable (as requested by OpenSSL), until
+ * the handshake completes.
+ */
+static void conn_tls_handshake(fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_connection_t		*conn = talloc_get_type_abort(uctx, fr_connection_t);
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+	fr_event_fd_cb_t	read_fn = NULL;
+	fr_event_fd_cb_t	write_fn = NULL;
+	int			ret;
+
+	ERR_clear_error();
+	ret = SSL_connect(h->ssl);
+	if (ret == 1) {
+		DEBUG("%s - TLS session %s (%s) - %s", h->module_name,
+		      SSL_session_reused(h->ssl) ? "resumed" : "established",
+		      SSL_get_version(h->ssl), h->name);
+
+		fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+		fr_connection_signal_connected(conn);
+		return;
+	}
+
+	switch (SSL_get_error(h->ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		read_fn = conn_tls_handshake;
+		break;
+
+	case SSL_ERROR_WANT_WRITE:
+		write_fn = conn_tls_handshake;
+		break;
+
+	default:
+		fr_tls_log_strerror_printf("TLS handshake failed");
+		PERROR("%s - Connection %s failed", h->module_name, h->name);
+
+		/*
+		 *	The home server may have refused to resume the
+		 *	session we offered.  Don't keep offering it.
+		 */
+		if (h->thread->tls_session) {
+			SSL_SESSION_free(h->thread->tls_session);
+			h->thread->tls_session = NULL;
+		}
+
+		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+		return;
+	}
+
+	if (fr_event_fd_insert(h, el, fd, read_fn, write_fn, conn_error_tls_handshake, conn) < 0) {
+		PERROR("%s - Failed inserting FD event", h->module_name);
+		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+	}
+}
+#endif
+
+/** Initialise a new outbound connection
+ *
+ * @param[out] h_out	Where to write the new file descriptor.
+ * @param[in] conn	to initialise.
+ * @param[in] uctx	A #tcp_thread_t
+ */
+static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void *uctx)
+{
+	int			fd;
+	tcp_handle_t		*h;
+	tcp_thread_t		*thread = talloc_get_type_abort(uctx, tcp_thread_t);
+	struct sockaddr_storage	salocal;
+	socklen_t		salen = sizeof(salocal);
+
+	MEM(h = talloc_zero(conn, tcp_handle_t));
+	h->thread = thread;
+	h->inst = thread->inst;
+	h->module_name = h->inst->parent->name;
+	h->src_ipaddr = h->inst->src_ipaddr;
+	h->src_port = 0;
+	h->max_packet_size = h->inst->max_packet_size;
+	h->last_idle = fr_time();
+	h->fd = -1;
+
+	MEM(h->buffer = talloc_array(h, uint8_t, h->max_packet_size));
+	h->buflen = h->max_packet_size;
+	MEM(h->send_buf = talloc_array(h, uint8_t, h->max_packet_size));
+
+	MEM(h->tt = radius_track_alloc(h));
+
+	/*
+	 *	Open the outgoing socket.  The connect() completes
+	 *	asynchronously.
+	 */
+	fd = fr_socket_client_tcp(&h->src_ipaddr, &h->inst->dst_ipaddr, h->inst->dst_port, true);
+	if (fd < 0) {
+		PERROR("%s - Failed opening socket", h->module_name);
+	fail:
+		talloc_free(h);
+		return FR_CONNECTION_STATE_FAILED;
+	}
+
+	/*
+	 *	Find out which source port the kernel gave us,
+	 *	so that the connection name is useful.
+	 */
+	if (getsockname(fd, (struct sockaddr *)&salocal, &salen) == 0) {
+		(void) fr_ipaddr_from_sockaddr(&h->src_ipaddr, &h->src_port, &salocal, salen);
+	}
+
+	/*
+	 *	Set the connection name.
+	 */
+	h->name = fr_asprintf(h, "proto %s local %pV port %u remote %pV port %u",
+#ifdef WITH_TLS
+			      h->inst->tls ? "tls" : "tcp",
+#else
+			      "tcp",
+#endif
+			      fr_box_ipaddr(h->src_ipaddr), h->src_port,
+			      fr_box_ipaddr(h->inst->dst_ipaddr), h->inst->dst_port);
+
+	h->fd = fd;
+	talloc_set_destructor(h, _tcp_handle_free);
+
+#ifdef SO_RCVBUF
+	if (h->inst->recv_buff_is_set) {
+		int opt;
+
+		opt = h->inst->recv_buff;
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(int)) < 0) {
+			WARN("%s - Failed setting 'SO_RCVBUF': %s", h->module_name, fr_syserror(errno));
+		}
+	}
+#endif
+
+#ifdef SO_SNDBUF
+	if (h->inst->send_buff_is_set) {
+		int opt;
+
+		opt = h->inst->send_buff;
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(int)) < 0) {
+			WARN("%s - Failed setting 'SO_SNDBUF': %s", h->module_name, fr_syserror(errno));
+		}
+	}
+#endif
+
+	if (h->inst->parent->status_check) status_check_alloc(h);
+
+#ifdef WITH_TLS
+	/*
+	 *	Wait for the TCP connection to be established, and
+	 *	then run the TLS handshake.  The connection is only
+	 *	signalled as connected once the handshake completes.
+	 */
+	if (h->inst->tls) {
+		h->ssl = SSL_new(thread->ssl_ctx);
+		if (!h->ssl) {
+			fr_tls_log_strerror_printf("Failed allocating TLS session");
+			PERROR("%s - Failed opening connection %s", h->module_name, h->name);
+			goto fail;
+		}
+
+		/*
+		 *	A partially written packet is retried from
+		 *	h->send_buf, which isn't where SSL_write() was
+		 *	first called with it.
+		 */
+		SSL_set_mode(h->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		SSL_set_connect_state(h->ssl);
+
+		if (SSL_set_fd(h->ssl, fd) != 1) {
+			fr_tls_log_strerror_printf("Failed associating socket with TLS session");
+			PERROR("%s - Failed opening connection %s", h->module_name, h->name);
+			goto fail;
+		}
+
+		/*
+		 *	Offer the session from a previous connection
+		 *	to the same home server.
+		 */
+		if (thread->tls_session && (SSL_set_session(h->ssl, thread->tls_session) != 1)) {
+			DEBUG2("%s - Failed offering previous TLS session for resumption", h->module_name);
+		}
+
+		if (fr_event_fd_insert(h, conn->el, fd, NULL,
+				       conn_tls_handshake, conn_error_tls_handshake, conn) < 0) goto fail;
+
+		*h_out = h;
+
+		return FR_CONNECTION_STATE_CONNECTING;
+	}
+#endif
+
+	/*
+	 *	Signal the connection as open as soon as it
+	 *	becomes writable, i.e. the connect() completes.
+	 *
+	 *	Unlike UDP, we don't need a status check before
+	 *	using the connection.  The home server completing
+	 *	the TCP handshake is enough to show it's alive.
+	 */
+	fr_connection_signal_on_fd(conn, fd);
+
+	*h_out = h;
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+/** Shutdown/close a file descriptor
+ *
+ */
+static void conn_close(UNUSED fr_event_list_t *el, void *handle, UNUSED void *uctx)
+{
+	tcp_handle_t *h = talloc_get_type_abort(handle, tcp_handle_t);
+
+	/*
+	 *	There's tracking entries still allocated
+	 *	this is bad, they should have all been
+	 *	released.
+	 */
+	if (h->tt && (h->tt->num_requests != 0)) {
+#ifndef NDEBUG
+		radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__, h->tt, tcp_tracking_entry_log);
+#endif
+		fr_assert_fail("%u tracking entries still allocated at conn close", h->tt->num_requests);
+	}
+
+	DEBUG4("Freeing rlm_radius_tcp handle %p", handle);
+
+	talloc_free(h);
+}
+
+/** Connection failed
+ *
+ * @param[in] handle   	of connection that failed.
+ * @param[in] state	the connection was in when it failed.
+ * @param[in] uctx	UNUSED.
+ */
+static fr_connection_state_t conn_failed(void *handle, fr_connection_state_t state, UNUSED void *uctx)
+{
+	switch (state) {
+	/*
+	 *	If the connection was connected when it failed,
+	 *	we need to handle any outstanding packets and
+	 *	timer events before reconnecting.
+	 */
+	case FR_CONNECTION_STATE_CONNECTED:
+	{
+		tcp_handle_t	*h = talloc_get_type_abort(handle, tcp_handle_t); /* h only available if connected */
+
+		/*
+		 *	Reset the Status-Server checks.
+		 */
+		if (h->status_u && h->status_u->ev) (void) fr_event_timer_delete(&h->status_u->ev);
+		if (h->status_ev) (void) fr_event_timer_delete(&h->status_ev);
+	}
+		break;
+
+	default:
+		break;
+	}
+
+	return FR_CONNECTION_STATE_INIT;
+}
+
+static fr_connection_t *thread_conn_alloc(fr_trunk_connection_t *tconn, fr_event_list_t *el,
+					  fr_connection_conf_t const *conf,
+					  char const *log_prefix, void *uctx)
+{
+	fr_connection_t		*conn;
+	tcp_thread_t		*thread = talloc_get_type_abort(uctx, tcp_thread_t);
+
+	conn = fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+					.init = conn_init,
+					.close = conn_close,
+					.failed = conn_failed
+				   },
+				   conf,
+				   log_prefix,
+				   thread);
+	if (!conn) {
+		PERROR("%s - Failed allocating state handler for new connection", thread->inst->parent->name);
+		return NULL;
+	}
+
+	return conn;
+}
+
+/** Standard I/O read function
+ *
+ * Underlying FD in now readable, so call the trunk to read any pending requests
+ * from this connection.
+ *
+ * @param[in] el	The event list signalling.
+ * @param[in] fd	that's now readable.
+ * @param[in] flags	describing the read event.
+ * @param[in] uctx	The trunk connection handle (tconn).
+ */
+static void conn_readable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+#ifdef WITH_TLS
+	tcp_handle_t		*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+	/*
+	 *	The last write was waiting for data from the
+	 *	home server.  Retry it first.
+	 */
+	if (h->write_wants_read && (conn_flush(el, tconn, h) < 0)) return;
+#else
+	UNUSED_VAR(el);
+#endif
+
+	fr_trunk_connection_signal_readable(tconn);
+}
+
+/** Standard I/O write function
+ *
+ * Underlying FD is now writable, so call the trunk to write any pending requests
+ * to this connection.
+ *
+ * @param[in] el	The event list signalling.
+ * @param[in] fd	that's now writable.
+ * @param[in] flags	describing the write event.
+ * @param[in] uctx	The trunk connection handle (tcon).
+ */
+static void conn_writable(fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	tcp_handle_t		*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+#ifdef WITH_TLS
+	/*
+	 *	The last read was waiting to write data to the
+	 *	home server.  Retry it.
+	 */
+	if (h->read_wants_write) {
+		fr_trunk_connection_signal_readable(tconn);
+		return;
+	}
+#endif
+
+	/*
+	 *	Finish writing the previous packet.  The trunk only
+	 *	calls request_mux() when it has pending requests, so
+	 *	we can't leave this to request_mux().
+	 */
+	if (h->send_len > 0) {
+		if (conn_flush(el, tconn, h) < 0) return;
+		if (h->send_len > 0) return;
+	}
+
+	fr_trunk_connection_signal_writable(tconn);
+}
+
+/** Connection errored
+ *
+ * We were signalled by the event loop that a fatal error occurred on this connection.
+ *
+ * @param[in] el	The event list signalling.
+ * @param[in] fd	that errored.
+ * @param[in] flags	El flags.
+ * @param[in] fd_errno	The nature of the error.
+ * @param[in] uctx	The trunk connection handle (tconn).
+ */
+static void conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	fr_connection_t		*conn = tconn->conn;
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	ERROR("%s - Connection %s failed: %s", h->module_name, h->name, fr_syserror(fd_errno));
+
+	fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
+}
+
+/** Update the I/O handlers for the connection
+ *
+ * We always read from the connection, even if the trunk doesn't have
+ * any outstanding requests.  Otherwise we wouldn't notice the home
+ * server closing the connection, and we'd lose our place in the stream.
+ *
+ * We also need to write whenever we have a partially written packet,
+ * even if the trunk doesn't have anything else for us to send.
+ */
+static int conn_notify_update(fr_trunk_connection_t *tconn, tcp_handle_t *h, fr_event_list_t *el)
+{
+	fr_event_fd_cb_t	write_fn = NULL;
+
+	switch (h->notify_on) {
+	case FR_TRUNK_CONN_EVENT_WRITE:
+	case FR_TRUNK_CONN_EVENT_BOTH:
+		write_fn = conn_writable;
+		break;
+
+	default:
+		if (h->send_len > 0) write_fn = conn_writable;
+		break;
+	}
+
+#ifdef WITH_TLS
+	/*
+	 *	Don't spin on write events when OpenSSL can't write
+	 *	until it's read something.  conn_readable() retries
+	 *	the write.
+	 */
+	if (h->write_wants_read) write_fn = NULL;
+
+	/*
+	 *	And the reverse.  conn_writable() retries the read.
+	 */
+	if (h->read_wants_write) write_fn = conn_writable;
+#endif
+
+	if (fr_event_fd_insert(h, el, h->fd,
+			       conn_readable,
+			       write_fn,
+			       conn_error,
+			       tconn) < 0) {
+		PERROR("%s - Failed inserting FD event", h->module_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+			       fr_event_list_t *el,
+			       fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	h->notify_on = notify_on;
+
+	/*
+	 *	May free the connection!
+	 */
+	if (conn_notify_update(tconn, h, el) < 0) fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+/*
+ *  Return negative numbers to put 'a' at the top of the heap.
+ *  Return positive numbers to put 'b' at the top of the heap.
+ *
+ *  We want the value with the lowest timestamp to be prioritized at
+ *  the top of the heap.
+ */
+static int8_t request_prioritise(void const *one, void const *two)
+{
+	tcp_request_t const *a = one;
+	tcp_request_t const *b = two;
+	int8_t ret;
+
+	/*
+	 *	Prioritise status check packets
+	 */
+	ret = (b->status_check - a->status_check);
+	if (ret != 0) return ret;
+
+	/*
+	 *	Larger priority is more important.
+	 */
+	ret = CMP(a->priority, b->priority);
+	if (ret != 0) return ret;
+
+	/*
+	 *	Smaller timestamp (i.e. earlier) is more important.
+	 */
+	return CMP_PREFER_SMALLER(fr_time_unwrap(a->recv_time), fr_time_unwrap(b->recv_time));
+}
+
+/** Decode response packet data, extracting relevant information and validating the packet
+ *
+ * @param[in] ctx			to allocate pairs in.
+ * @param[out] reply			Pointer to head of pair list to add reply attributes to.
+ * @param[out] response_code		The type of response packet.
+ * @param[in] h				connection handle.
+ * @param[in] request			the request.
+ * @param[in] u				TCP request.
+ * @param[in] request_authenticator	from the original request.
+ * @param[in] data			to decode.
+ * @param[in] data_len			Length of input data.
+ * @return
+ *	- DECODE_FAIL_NONE on success.
+ *	- DECODE_FAIL_* on failure.
+ */
+static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
+			    tcp_handle_t *h, request_t *request, tcp_request_t *u,
+			    uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
+			    uint8_t *data, size_t data_len)
+{
+	decode_fail_t		reason;
+
+	reason = radius_codec_decode(ctx, reply, response_code, &h->inst->codec, request, u->code, u->status_check,
+				     request_authenticator, data, data_len);
+	if (reason != DECODE_FAIL_NONE) return reason;
+
+	RDEBUG("Received %s ID %d length %u reply packet on connection %s",
+	       fr_packet_codes[*response_code], data[1], fr_nbo_to_uint16(data + 2), h->name);
+	log_request_pair_list(L_DBG_LVL_2, request, NULL, reply, NULL);
+
+	/*
+	 *	Record the fact we've seen a response
+	 */
+	u->num_replies++;
+
+	/*
+	 *	Fixup retry times
+	 */
+	if (fr_time_gt(u->retry.start, h->mrs_time)) h->mrs_time = u->retry.start;
+
+	return DECODE_FAIL_NONE;
+}
+
+static int encode(rlm_radius_tcp_t const *inst, request_t *request, tcp_request_t *u, uint8_t id)
+{
+	int ret;
+
+	fr_assert(!u->packet);
+
+	ret = radius_codec_encode(u, &u->packet, &u->packet_len, &u->extra, &inst->codec, request,
+				  &(radius_codec_packet_t){
+					.code = u->code,
+					.id = id,
+					.require_ma = u->require_ma,
+					.status_check = u->status_check,
+					.recv_time = u->recv_time,
+					.now = u->retry.updated
+				  });
+	if (ret < 0) return -1;
+
+	return 0;
+}
+
+
+/** Revive a connection after "revive_interval"
+ *
+ */
+static void revive_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	tcp_handle_t	 	*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+	INFO("%s - Reviving connection %s", h->module_name, h->name);
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+/** Mark a connection dead after "zombie_interval"
+ *
+ */
+static void zombie_timeout(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	tcp_handle_t	 	*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+	INFO("%s - No replies during 'zombie_period', marking connection %s as dead", h->module_name, h->name);
+
+	/*
+	 *	Don't use this connection, and re-queue all of its
+	 *	requests onto other connections.
+	 */
+	fr_trunk_connection_signal_inactive(tconn);
+	(void) fr_trunk_connection_requests_requeue(tconn, FR_TRUNK_REQUEST_STATE_ALL, 0, false);
+
+	/*
+	 *	Revive the connection after a time.
+	 */
+	if (fr_event_timer_at(h, el, &h->zombie_ev,
+			      fr_time_add(now, h->inst->parent->revive_interval), revive_timeout, tconn) < 0) {
+		ERROR("Failed inserting revive timeout for connection");
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+/** See if the connection is zombied.
+ *
+ * We check for zombie when a request hits its final timeout, and
+ * before we write new packets to the connection.
+ *
+ * @return
+ *	- true if the connection is zombie.
+ *	- false if the connection is not zombie.
+ */
+static bool check_for_zombie(fr_event_list_t *el, fr_trunk_connection_t *tconn, fr_time_t now, fr_time_t last_sent)
+{
+	tcp_handle_t	*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+	/*
+	 *	If we're status checking OR already zombie, don't go to zombie
+	 *
+	 */
+	if (h->status_checking || h->zombie_ev) return true;
+
+	if (fr_time_eq(now, fr_time_wrap(0))) now = fr_time();
+
+	/*
+	 *	We received a reply since this packet was sent, the connection isn't zombie.
+	 */
+	if (fr_time_gteq(h->last_reply, last_sent)) return false;
+
+	/*
+	 *	If we've seen ANY response in the allowed window, then the connection is still alive.
+	 */
+	if (h->inst->parent->synchronous && fr_time_gt(last_sent, fr_time_wrap(0)) &&
+	    (fr_time_lt(fr_time_add(last_sent, h->inst->parent->response_window), now))) return false;
+
+	/*
+	 *	Mark the connection as inactive, but keep sending
+	 *	packets on it.
+	 */
+	WARN("%s - Entering Zombie state - connection %s", h->module_name, h->name);
+	fr_trunk_connection_signal_inactive(tconn);
+
+	if (h->inst->parent->status_check) {
+		h->status_checking = true;
+
+		/*
+		 *	Queue up the status check packet.  It will be sent
+		 *	when the connection is writable.
+		 */
+		h->status_u->retry.start = fr_time_wrap(0);
+		h->status_r->treq = NULL;
+
+		if (fr_trunk_request_enqueue_on_conn(&h->status_r->treq, tconn, h->status_request,
+						     h->status_u, h->status_r, true) != FR_TRUNK_ENQUEUE_OK) {
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		}
+	} else {
+		if (fr_event_timer_at(h, el, &h->zombie_ev, fr_time_add(now, h->inst->parent->zombie_period),
+				      zombie_timeout, tconn) < 0) {
+			ERROR("Failed inserting zombie timeout for connection");
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		}
+	}
+
+	return true;
+}
+
+/** Handle timeouts when waiting for a response
+ *
+ * We never retransmit over the same connection, so the request is
+ * failed, and the connection checked to see if it's still alive.
+ */
+static void request_timeout(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_trunk_request_t	*treq = talloc_get_type_abort(uctx, fr_trunk_request_t);
+	tcp_request_t		*u = talloc_get_type_abort(treq->preq, tcp_request_t);
+	tcp_result_t		*r = talloc_get_type_abort(treq->rctx, tcp_result_t);
+	request_t		*request = treq->request;
+	fr_trunk_connection_t	*tconn = treq->tconn;
+
+	fr_assert(treq->state == FR_TRUNK_REQUEST_STATE_SENT);		/* No other states should be timing out */
+	fr_assert(treq->preq);						/* Must still have a protocol request */
+	fr_assert(u->rr);
+	fr_assert(tconn);
+
+	fr_assert(!u->status_check);
+
+	REDEBUG("No response to %s ID %d within %pVs, failing request", fr_packet_codes[u->code], u->id,
+		fr_box_time_delta(fr_time_sub(now, u->retry.start)));
+
+	r->rcode = RLM_MODULE_FAIL;
+	fr_trunk_request_signal_complete(treq);
+
+	check_for_zombie(el, tconn, now, u->retry.start);
+}
+
+/** Handle retries for a status check
+ *
+ * Each status check is sent as a new packet, with a new ID.
+ */
+static void status_check_retry(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_trunk_request_t	*treq = talloc_get_type_abort(uctx, fr_trunk_request_t);
+	tcp_handle_t		*h;
+	tcp_request_t		*u = talloc_get_type_abort(treq->preq, tcp_request_t);
+	tcp_result_t		*r = talloc_get_type_abort(treq->rctx, tcp_result_t);
+	request_t		*request = treq->request;
+	fr_trunk_connection_t	*tconn = treq->tconn;
+
+	fr_assert(treq->state == FR_TRUNK_REQUEST_STATE_SENT);		/* No other states should be timing out */
+	fr_assert(treq->preq);						/* Must still have a protocol request */
+	fr_assert(u->rr);
+	fr_assert(tconn);
+
+	h = talloc_get_type_abort(treq->tconn->conn->h, tcp_handle_t);
+
+	fr_assert(u->status_check);
+
+	switch (fr_retry_next(&u->retry, now)) {
+	/*
+	 *	Queue another status check.  request_cancel()
+	 *	releases the ID, so it gets a new one when it's
+	 *	written out again.
+	 */
+	case FR_RETRY_CONTINUE:
+		fr_trunk_request_requeue(treq);
+		return;
+
+	case FR_RETRY_MRD:
+		REDEBUG("Reached maximum_retransmit_duration (%pVs > %pVs), failing request",
+			fr_box_time_delta(fr_time_sub(now, u->retry.start)), fr_box_time_delta(u->retry.config->mrd));
+		break;
+
+	case FR_RETRY_MRC:
+		REDEBUG("Reached maximum_retransmit_count (%u > %u), failing request",
+		        u->retry.count, u->retry.config->mrc);
+		break;
+	}
+
+	r->rcode = RLM_MODULE_FAIL;
+	fr_trunk_request_signal_complete(treq);
+
+	WARN("%s - No response to status check, marking connection as dead - %s", h->module_name, h->name);
+
+	/*
+	 *	We're no longer status checking, reconnect the
+	 *	connection.
+	 */
+	h->status_checking = false;
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+/** Write out the remainder of a partially written packet
+ *
+ * @return
+ *	- 0 on success.  h->send_len will be 0 if everything was written.
+ *	- -1 on failure.  The connection has been signalled for reconnection.
+ */
+static int conn_flush(fr_event_list_t *el, fr_trunk_connection_t *tconn, tcp_handle_t *h)
+{
+	ssize_t slen;
+
+	slen = tcp_write(h, h->send_buf, h->send_len);
+	if (slen < 0) {
+		PERROR("%s - Failed sending data over connection %s", h->module_name, h->name);
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return -1;
+	}
+
+	if ((size_t)slen < h->send_len) memmove(h->send_buf, h->send_buf + slen, h->send_len - slen);
+	h->send_len -= slen;
+
+	/*
+	 *	Stop asking for write events if the trunk doesn't
+	 *	have anything else for us, or if OpenSSL is waiting
+	 *	for data from the home server.
+	 */
+	if (conn_notify_update(tconn, h, el) < 0) {
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void request_mux(fr_event_list_t *el,
+			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+	rlm_radius_tcp_t const	*inst = h->inst;
+
+	/*
+	 *	Finish writing the previous packet before we start
+	 *	on any new ones.
+	 */
+	if (h->send_len > 0) {
+		if (conn_flush(el, tconn, h) < 0) return;
+		if (h->send_len > 0) return;
+	}
+
+	/*
+	 *	If the connection is zombie, then don't try to enqueue
+	 *	things on it!
+	 */
+	if (check_for_zombie(el, tconn, fr_time_wrap(0), h->last_sent)) return;
+
+	/*
+	 *	Pipeline as many packets as the connection will take.
+	 */
+	while (true) {
+		fr_trunk_request_t	*treq;
+		tcp_request_t		*u;
+		request_t		*request;
+		char const		*action;
+		ssize_t			slen;
+
+		if (unlikely(fr_trunk_connection_pop_request(&treq, tconn) < 0)) return;
+
+		/*
+		 *	No more requests to send
+		 */
+		if (!treq) break;
+
+		fr_assert((treq->state == FR_TRUNK_REQUEST_STATE_PENDING) ||
+			  (treq->state == FR_TRUNK_REQUEST_STATE_PARTIAL));
+
+		request = treq->request;
+		u = talloc_get_type_abort(treq->preq, tcp_request_t);
+
+		/*
+		 *	We never retransmit over the same connection,
+		 *	so any previous packet has already been
+		 *	released by request_cancel() or
+		 *	request_conn_release().
+		 */
+		fr_assert(!u->packet && !u->rr);
+
+		/*
+		 *	Each status check is a new packet, so
+		 *	we only set up the timers once.
+		 */
+		if (fr_time_eq(u->retry.start, fr_time_wrap(0))) {
+			(void) fr_retry_init(&u->retry, fr_time(), &inst->parent->retry[u->code]);
+			fr_assert(fr_time_delta_ispos(u->retry.rt));
+			fr_assert(fr_time_gt(u->retry.next, fr_time_wrap(0)));
+		}
+
+		if (unlikely(radius_track_entry_reserve(&u->rr, treq, h->tt, request, u->code, treq) < 0)) {
+#ifndef NDEBUG
+			radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__,
+					       h->tt, tcp_tracking_entry_log);
+#endif
+			fr_assert_fail("Tracking entry allocation failed: %s", fr_strerror());
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+		u->id = u->rr->id;
+
+		if (encode(inst, request, u, u->id) < 0) {
+			/*
+			 *	Need to do this because request_conn_release
+			 *	may not be called.
+			 */
+			tcp_request_reset(u);
+			if (u->ev) (void) fr_event_timer_delete(&u->ev);
+			fr_trunk_request_signal_fail(treq);
+			continue;
+		}
+
+		RDEBUG("Sending %s ID %d length %ld over connection %s",
+		       fr_packet_codes[u->code], u->id, u->packet_len, h->name);
+		RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+
+		/*
+		 *	Remember the authentication vector, which now has the
+		 *	packet signature.
+		 */
+		(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+
+		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->request_pairs, NULL);
+		if (!fr_pair_list_empty(&u->extra)) log_request_pair_list(L_DBG_LVL_2, request, NULL, &u->extra, NULL);
+
+		slen = tcp_write(h, u->packet, u->packet_len);
+		if (slen < 0) {
+			PERROR("%s - Failed sending data over connection %s", h->module_name, h->name);
+
+			/*
+			 *	Will re-queue any 'sent' requests, and
+			 *	this one, so we don't have to do any
+			 *	cleanup.
+			 */
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+
+		/*
+		 *	Keep a copy of whatever didn't get written.  We
+		 *	can't point to the packet, as the request may be
+		 *	freed before we finish writing it, and the other
+		 *	end would then see a truncated packet.
+		 */
+		if ((size_t)slen < u->packet_len) {
+			h->send_len = u->packet_len - slen;
+			memcpy(h->send_buf, u->packet + slen, h->send_len);
+		}
+
+		/*
+		 *	Tell the trunk API that this request is now in
+		 *	the "sent" state.  Any remaining data is our
+		 *	problem, not the trunk's.
+		 */
+		fr_trunk_request_signal_sent(treq);
+
+		action = inst->parent->originate ? "Originated" : "Proxied";
+		h->last_sent = u->retry.start;
+		if (fr_time_lteq(h->first_sent, h->last_idle)) h->first_sent = h->last_sent;
+
+		if (u->status_check) {
+			RDEBUG("Sent status check.  Expecting response within %pVs",
+			       fr_box_time_delta(u->retry.rt));
+
+			if (fr_event_timer_at(u, el, &u->ev, u->retry.next, status_check_retry, treq) < 0) {
+				RERROR("Failed inserting retransmit timeout for connection");
+				fr_trunk_request_signal_fail(treq);
+			}
+
+		} else {
+			fr_time_delta_t timeout;
+
+			/*
+			 *	When we're asynchronous, the home server
+			 *	gets as long as we would have spent
+			 *	retransmitting over UDP.
+			 */
+			timeout = inst->parent->retry[u->code].mrd;
+			if (u->synchronous || !fr_time_delta_ispos(timeout)) timeout = inst->parent->response_window;
+
+			RDEBUG("%s request.  Expecting response within %pVs", action, fr_box_time_delta(timeout));
+
+			if (fr_event_timer_at(u, el, &u->ev, fr_time_add(u->retry.start, timeout),
+					      request_timeout, treq) < 0) {
+				RERROR("Failed inserting timeout for connection");
+				fr_trunk_request_signal_fail(treq);
+			}
+		}
+
+		/*
+		 *	The socket is full.  Wait for it to become
+		 *	writable again.
+		 */
+		if (h->send_len > 0) {
+			if (conn_notify_update(tconn, h, el) < 0) {
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			}
+			return;
+		}
+	}
+}
+
+/** Deal with Protocol-Error replies, and possible negotiation
+ *
+ */
+static void protocol_error_reply(tcp_request_t *u, tcp_result_t *r, tcp_handle_t *h, uint8_t const *data)
+{
+	uint32_t	response_length;
+	rlm_rcode_t	rcode;
+
+	rcode = radius_codec_protocol_error(&response_length, u->code, data);
+	if (r) r->rcode = rcode;
+
+	/*
+	 *	The other end says it needs more room to send its
+	 *	response.  The receive buffer may contain the start
+	 *	of the next packet, so we preserve its contents.
+	 */
+	if (response_length > h->buflen) {
+		DEBUG("%s - Increasing buffer size to %u for connection %s", h->module_name, response_length, h->name);
+
+		h->buflen = response_length;
+		MEM(h->buffer = talloc_realloc(h, h->buffer, uint8_t, h->buflen));
+	}
+}
+
+
+/** Send the next status check
+ *
+ */
+static void status_check_next(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	tcp_handle_t		*h = talloc_get_type_abort(tconn->conn->h, tcp_handle_t);
+
+	/*
+	 *	Start a new round of timers for this status check.
+	 */
+	h->status_u->retry.start = fr_time_wrap(0);
+
+	if (fr_trunk_request_enqueue_on_conn(&h->status_r->treq, tconn, h->status_request,
+					     h->status_u, h->status_r, true) != FR_TRUNK_ENQUEUE_OK) {
+		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+	}
+}
+
+/** Deal with replies replies to status checks and possible negotiation
+ *
+ */
+static void status_check_reply(fr_trunk_request_t *treq, fr_time_t now, uint8_t const *data)
+{
+	tcp_handle_t		*h = talloc_get_type_abort(treq->tconn->conn->h, tcp_handle_t);
+	rlm_radius_t const 	*inst = h->inst->parent;
+	tcp_request_t		*u = talloc_get_type_abort(treq->preq, tcp_request_t);
+	tcp_result_t		*r = talloc_get_type_abort(treq->rctx, tcp_result_t);
+
+	fr_assert(treq->preq == h->status_u);
+	fr_assert(treq->rctx == h->status_r);
+
+	r->treq = NULL;
+
+	if (data[0] == FR_RADIUS_CODE_PROTOCOL_ERROR) protocol_error_reply(u, NULL, h, data);
+
+	if (u->num_replies < inst->num_answers_to_alive) {
+		DEBUG("Received %d / %u replies for status check, on connection - %s",
+		      u->num_replies, inst->num_answers_to_alive, h->name);
+		DEBUG("Next status check packet will be in %pVs", fr_box_time_delta(fr_time_sub(u->retry.next, now)));
+
+		/*
+		 *	Set the timer for the next status check.  This
+		 *	lives in the handle, as the request timers are
+		 *	cleared when the status check completes.
+		 */
+		if (fr_event_timer_at(h, h->thread->el, &h->status_ev, u->retry.next,
+				      status_check_next, treq->tconn) < 0) {
+			fr_trunk_connection_signal_reconnect(treq->tconn, FR_CONNECTION_FAILED);
+		}
+		return;
+	}
+
+	DEBUG("Received enough replies to status check, marking connection as active - %s", h->name);
+
+	/*
+	 *	Set the "last idle" time to now, so that we don't
+	 *	restart zombie_period until sufficient time has
+	 *	passed.
+	 */
+	h->last_idle = fr_time();
+
+	/*
+	 *	Reset retry interval and retransmission counters
+	 *	also frees u->ev.
+	 */
+	status_check_reset(h, u);
+	fr_trunk_connection_signal_active(treq->tconn);
+}
+
+/** Process one complete reply from the stream
+ *
+ */
+static void tcp_reply(tcp_handle_t *h, uint8_t *data, size_t data_len)
+{
+	fr_trunk_request_t	*treq;
+	request_t		*request;
+	tcp_request_t		*u;
+	tcp_result_t		*r;
+	radius_track_entry_t	*rr;
+	decode_fail_t		reason;
+	uint8_t			code = 0;
+	fr_pair_list_t		reply;
+	fr_time_t		now;
+
+	fr_pair_list_init(&reply);
+
+	/*
+	 *	Note that we don't care about packet codes.  All
+	 *	packet codes share the same ID space.
+	 */
+	rr = radius_track_entry_find(h->tt, data[1], NULL);
+	if (!rr) {
+		WARN("%s - Ignoring reply with ID %i that arrived too late",
+		     h->module_name, data[1]);
+		return;
+	}
+
+	treq = talloc_get_type_abort(rr->uctx, fr_trunk_request_t);
+	request = treq->request;
+	fr_assert(request != NULL);
+	u = talloc_get_type_abort(treq->preq, tcp_request_t);
+	r = talloc_get_type_abort(treq->rctx, tcp_result_t);
+
+	/*
+	 *	Validate and decode the incoming packet
+	 */
+	reason = decode(request->reply_ctx, &reply, &code, h, request, u, rr->vector, data, data_len);
+	if (reason != DECODE_FAIL_NONE) return;
+
+	/*
+	 *	Only valid packets are processed
+	 *	Otherwise an attacker could perform
+	 *	a DoS attack against the proxying servers
+	 *	by sending fake responses for upstream
+	 *	servers.
+	 */
+	h->last_reply = now = fr_time();
+
+	/*
+	 *	Status-Server can have any reply code, we don't care
+	 *	what it is.  So long as it's signed properly, we
+	 *	accept it.  This flexibility is because we don't
+	 *	expose Status-Server to the admins.  It's only used by
+	 *	this module for internal signalling.
+	 */
+	if (u == h->status_u) {
+		fr_pair_list_free(&reply);	/* Probably want to pass this to status_check_reply? */
+		status_check_reply(treq, now, data);
+		fr_trunk_request_signal_complete(treq);
+		return;
+	}
+
+	/*
+	 *	Handle any state changes, etc. needed by receiving a
+	 *	Protocol-Error reply packet.
+	 *
+	 *	Protocol-Error is permitted as a reply to any
+	 *	packet.
+	 */
+	switch (code) {
+	case FR_RADIUS_CODE_PROTOCOL_ERROR:
+		protocol_error_reply(u, r, h, data);
+		break;
+
+	default:
+		break;
+	}
+
+	/*
+	 *	Mark up the request as being an Access-Challenge, if
+	 *	required.
+	 *
+	 *	We don't do this for other packet types, because the
+	 *	ok/fail nature of the module return code will
+	 *	automatically result in it the parent request
+	 *	returning an ok/fail packet code.
+	 */
+	if ((u->code == FR_RADIUS_CODE_ACCESS_REQUEST) && (code == FR_RADIUS_CODE_ACCESS_CHALLENGE)) {
+		fr_pair_t	*vp;
+
+		vp = fr_pair_find_by_da_idx(&request->reply_pairs, attr_packet_type, 0);
+		if (!vp) {
+			MEM(vp = fr_pair_afrom_da(request->reply_ctx, attr_packet_type));
+			vp->vp_uint32 = FR_RADIUS_CODE_ACCESS_CHALLENGE;
+			fr_pair_append(&request->reply_pairs, vp);
+		}
+	}
+
+	/*
+	 *	Delete Proxy-State attributes from the reply.
+	 */
+	fr_pair_delete_by_da(&reply, attr_proxy_state);
+
+	/*
+	 *	If the reply has Message-Authenticator, delete
+	 *	it from the proxy reply so that it isn't
+	 *	copied over to our reply.  But also create a
+	 *	reply.Message-Authenticator attribute, so that
+	 *	it ends up in our reply.
+	 */
+	if (fr_pair_find_by_da_idx(&reply, attr_message_authenticator, 0)) {
+		fr_pair_t *vp;
+
+		fr_pair_delete_by_da(&reply, attr_message_authenticator);
+
+		MEM(vp = fr_pair_afrom_da(request->reply_ctx, attr_message_authenticator));
+		(void) fr_pair_value_memdup(vp, (uint8_t const *) "", 1, false);
+		fr_pair_append(&request->reply_pairs, vp);
+	}
+
+	treq->request->reply->code = code;
+	r->rcode = radius_code_to_rcode[code];
+	fr_pair_list_append(&request->reply_pairs, &reply);
+	fr_trunk_request_signal_complete(treq);
+}
+
+static void request_demux(fr_event_list_t *el, fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+#ifdef WITH_TLS
+	bool			read_wanted_write = h->read_wants_write;
+#endif
+
+	DEBUG3("%s - Reading data for connection %s", h->module_name, h->name);
+
+	while (true) {
+		ssize_t			slen;
+
+		/*
+		 *	Drain the socket.  If we're busy, this saves a
+		 *	round through the event loop.  With TLS, it
+		 *	also empties OpenSSL's internal buffer, which
+		 *	won't trigger another read event.
+		 */
+		slen = tcp_read(h, h->buffer + h->recv_len, h->buflen - h->recv_len);
+		if (slen == 0) {
+#ifdef WITH_TLS
+			/*
+			 *	Start or stop watching for write
+			 *	events, so the read can be retried.
+			 */
+			if ((h->read_wants_write != read_wanted_write) && (conn_notify_update(tconn, h, el) < 0)) {
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			}
+#else
+			UNUSED_VAR(el);
+#endif
+			return;
+		}
+
+		if (slen < 0) {
+			PERROR("%s - Failed reading response from connection %s", h->module_name, h->name);
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
+
+		h->recv_len += slen;
+
+		/*
+		 *	Process all of the complete packets we have.
+		 */
+		while (h->recv_len >= RADIUS_HEADER_LENGTH) {
+			size_t packet_len;
+
+			packet_len = fr_nbo_to_uint16(h->buffer + 2);
+
+			/*
+			 *	We can't resynchronise the stream if the
+			 *	home server sends us garbage.
+			 */
+			if ((packet_len < RADIUS_HEADER_LENGTH) || (packet_len > h->buflen)) {
+				ERROR("%s - Received packet with invalid length %zu (expected %zu..%zu) on connection %s",
+				      h->module_name, packet_len, (size_t)RADIUS_HEADER_LENGTH, h->buflen, h->name);
+				fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+				return;
+			}
+
+			if (h->recv_len < packet_len) break;
+
+			tcp_reply(h, h->buffer, packet_len);
+
+			/*
+			 *	Note that tcp_reply() may have
+			 *	reallocated the buffer.
+			 */
+			h->recv_len -= packet_len;
+			if (h->recv_len > 0) memmove(h->buffer, h->buffer + packet_len, h->recv_len);
+		}
+	}
+}
+
+/** Remove the request from any tracking structures
+ *
+ * Frees encoded packets, as we never retransmit over the same connection.
+ */
+static void request_cancel(UNUSED fr_connection_t *conn, void *preq_to_reset,
+			   fr_trunk_cancel_reason_t reason, UNUSED void *uctx)
+{
+	tcp_request_t	*u = talloc_get_type_abort(preq_to_reset, tcp_request_t);
+
+	/*
+	 *	Request has been requeued on the same connection.
+	 *	This only happens for status checks, which get a
+	 *	new ID every time they're sent.
+	 */
+	if (reason == FR_TRUNK_CANCEL_REASON_REQUEUE) {
+		if (u->ev) (void) fr_event_timer_delete(&u->ev);
+		tcp_request_reset(u);
+	}
+
+	/*
+	 *      Other cancellations are dealt with by
+	 *      request_conn_release as the request is removed
+	 *	from the trunk.
+	 */
+}
+
+/** Clear out anything associated with the handle from the request
+ *
+ */
+static void request_conn_release(fr_connection_t *conn, void *preq_to_reset, UNUSED void *uctx)
+{
+	tcp_request_t		*u = talloc_get_type_abort(preq_to_reset, tcp_request_t);
+	tcp_handle_t		*h = talloc_get_type_abort(conn->h, tcp_handle_t);
+
+	if (u->ev) (void)fr_event_timer_delete(&u->ev);
+	if (u->packet) tcp_request_reset(u);
+
+	u->num_replies = 0;
+
+	/*
+	 *	If there are no outstanding tracking entries
+	 *	allocated then the connection is "idle".
+	 */
+	if (!h->tt || (h->tt->num_requests == 0)) h->last_idle = fr_time();
+}
+
+/** Write out a canned failure
+ *
+ */
+static void request_fail(request_t *request, void *preq, void *rctx,
+			 NDEBUG_UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	tcp_result_t		*r = talloc_get_type_abort(rctx, tcp_result_t);
+	tcp_request_t		*u = talloc_get_type_abort(preq, tcp_request_t);
+
+	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+
+	fr_assert(state != FR_TRUNK_REQUEST_STATE_INIT);
+
+	if (u->status_check) return;
+
+	r->rcode = RLM_MODULE_FAIL;
+	r->treq = NULL;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Response has already been written to the rctx at this point
+ *
+ */
+static void request_complete(request_t *request, void *preq, void *rctx, UNUSED void *uctx)
+{
+	tcp_result_t		*r = talloc_get_type_abort(rctx, tcp_result_t);
+	tcp_request_t		*u = talloc_get_type_abort(preq, tcp_request_t);
+
+	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+
+	if (u->status_check) return;
+
+	r->treq = NULL;
+
+	unlang_interpret_mark_runnable(request);
+}
+
+/** Explicitly free resources associated with the protocol request
+ *
+ */
+static void request_free(UNUSED request_t *request, void *preq_to_free, UNUSED void *uctx)
+{
+	tcp_request_t		*u = talloc_get_type_abort(preq_to_free, tcp_request_t);
+
+	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+
+	/*
+	 *	Don't free status check requests.
+	 */
+	if (u->status_check) return;
+
+	talloc_free(u);
+}
+
+/** Resume execution of the request, returning the rcode set during trunk execution
+ *
+ */
+static unlang_action_t mod_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, UNUSED request_t *request)
+{
+	tcp_result_t	*r = talloc_get_type_abort(mctx->rctx, tcp_result_t);
+	rlm_rcode_t	rcode = r->rcode;
+
+	talloc_free(r);
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
+static void mod_signal(module_ctx_t const *mctx, UNUSED request_t *request, fr_state_signal_t action)
+{
+	tcp_result_t		*r = talloc_get_type_abort(mctx->rctx, tcp_result_t);
+
+	/*
+	 *	If we don't have a treq associated with the
+	 *	rctx it's likely because the request was
+	 *	scheduled, but hasn't yet been resumed, and
+	 *	has received a signal, OR has been resumed
+	 *	and immediately cancelled as the event loop
+	 *	is exiting, in which case
+	 *	unlang_request_is_scheduled will return false
+	 *	(don't use it).
+	 */
+	if (!r->treq) {
+		talloc_free(r);
+		return;
+	}
+
+	switch (action) {
+	/*
+	 *	The request is being cancelled, tell the
+	 *	trunk so it can clean up the treq.
+	 */
+	case FR_SIGNAL_CANCEL:
+		fr_trunk_request_signal_cancel(r->treq);
+		r->treq = NULL;
+		talloc_free(r);		/* Should be freed soon anyway, but better to be explicit */
+		return;
+
+	/*
+	 *	The NAS retransmitted.  The transport is reliable,
+	 *	so we don't retransmit over the same connection
+	 *	(RFC 6613 Section 2.6.1).
+	 */
+	case FR_SIGNAL_DUP:
+	default:
+		return;
+	}
+}
+
+#ifndef NDEBUG
+/** Free a tcp_result_t
+ *
+ * Allows us to set break points for debugging.
+ */
+static int _tcp_result_free(tcp_result_t *r)
+{
+	fr_trunk_request_t	*treq;
+	tcp_request_t		*u;
+
+	if (!r->treq) return 0;
+
+	treq = talloc_get_type_abort(r->treq, fr_trunk_request_t);
+	u = talloc_get_type_abort(treq->preq, tcp_request_t);
+
+	fr_assert_msg(!u->ev, "tcp_result_t freed with active timer");
+
+	return 0;
+}
+#endif
+
+/** Free a tcp_request_t
+ */
+static int _tcp_request_free(tcp_request_t *u)
+{
+	if (u->ev) (void) fr_event_timer_delete(&u->ev);
+
+	fr_assert(u->rr == NULL);
+
+	return 0;
+}
+
+static unlang_action_t mod_enqueue(rlm_rcode_t *p_result, void **rctx_out, void *instance, void *thread, request_t *request)
+{
+	rlm_radius_tcp_t		*inst = talloc_get_type_abort(instance, rlm_radius_tcp_t);
+	tcp_thread_t			*t = talloc_get_type_abort(thread, tcp_thread_t);
+	tcp_result_t			*r;
+	tcp_request_t			*u;
+	fr_trunk_request_t		*treq;
+
+	fr_assert(request->packet->code > 0);
+	fr_assert(request->packet->code < FR_RADIUS_CODE_MAX);
+
+	if (request->packet->code == FR_RADIUS_CODE_STATUS_SERVER) {
+		RWDEBUG("Status-Server is reserved for internal use, and cannot be sent manually.");
+		RETURN_MODULE_NOOP;
+	}
+
+	treq = fr_trunk_request_alloc(t->trunk, request);
+	if (!treq) RETURN_MODULE_FAIL;
+
+	MEM(r = talloc_zero(request, tcp_result_t));
+#ifndef NDEBUG
+	talloc_set_destructor(r, _tcp_result_free);
+#endif
+
+	/*
+	 *	Can't use compound literal - const issues.
+	 */
+	MEM(u = talloc_zero(treq, tcp_request_t));
+	u->code = request->packet->code;
+	u->synchronous = inst->parent->synchronous;
+	u->priority = request->async->priority;
+	u->recv_time = request->async->recv_time;
+	fr_pair_list_init(&u->extra);
+
+	r->rcode = RLM_MODULE_FAIL;
+
+	/*
+	 *	Make sure that we print out the actual encoded value
+	 *	of the Message-Authenticator attribute.  If the caller
+	 *	asked for one, delete theirs (which has a bad value),
+	 *	and remember to add one manually when we encode the
+	 *	packet.  This is the only editing we do on the input
+	 *	request.
+	 *
+	 *	@todo - don't edit the input packet!
+	 */
+	if (fr_pair_find_by_da_idx(&request->request_pairs, attr_message_authenticator, 0)) {
+		u->require_ma = true;
+		pair_delete_request(attr_message_authenticator);
+	}
+
+	if (fr_trunk_request_enqueue(&treq, t->trunk, request, u, r) < 0) {
+		fr_assert(!u->rr && !u->packet);	/* Should not have been fed to the muxer */
+		fr_trunk_request_free(&treq);		/* Return to the free list */
+		talloc_free(r);
+		RETURN_MODULE_FAIL;
+	}
+
+	r->treq = treq;	/* Remember for signalling purposes */
+
+	talloc_set_destructor(u, _tcp_request_free);
+
+	*rctx_out = r;
+
+	return UNLANG_ACTION_YIELD;
+}
+
+/** Instantiate thread data for the submodule.
+ *
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_radius_tcp_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_radius_tcp_t);
+	tcp_thread_t			*thread = talloc_get_type_abort(mctx->thread, tcp_thread_t);
+
+	static fr_trunk_io_funcs_t	io_funcs = {
+						.connection_alloc = thread_conn_alloc,
+						.connection_notify = thread_conn_notify,
+						.request_prioritise = request_prioritise,
+						.request_mux = request_mux,
+						.request_demux = request_demux,
+						.request_conn_release = request_conn_release,
+						.request_complete = request_complete,
+						.request_fail = request_fail,
+						.request_cancel = request_cancel,
+						.request_free = request_free
+					};
+
+	inst->trunk_conf = &inst->parent->trunk_conf;
+
+	inst->trunk_conf->req_pool_headers = 4;	/* One for the request, one for the buffer, one for the tracking binding, one for Proxy-State VP */
+	inst->trunk_conf->req_pool_size = sizeof(tcp_request_t) + inst->max_packet_size + sizeof(radius_track_entry_t ***) + sizeof(fr_pair_t) + 20;
+
+	thread->el = mctx->el;
+	thread->inst = inst;
+
+#ifdef WITH_TLS
+	if (inst->tls) {
+		thread->ssl_ctx = fr_tls_ctx_alloc(inst->tls, true);
+		if (!thread->ssl_ctx) return -1;
+	}
+#endif
+
+	thread->trunk = fr_trunk_alloc(thread, mctx->el, &io_funcs,
+				       inst->trunk_conf, inst->parent->name, thread, false);
+	if (!thread->trunk) return -1;
+
+	return 0;
+}
+
+/** Free thread specific data for the submodule
+ *
+ */
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	tcp_thread_t			*thread = talloc_get_type_abort(mctx->thread, tcp_thread_t);
+
+	/*
+	 *	Close the connections first, so that they don't
+	 *	refer to the SSL_CTX, or cache sessions after we've
+	 *	freed them.
+	 */
+	TALLOC_FREE(thread->trunk);
+
+#ifdef WITH_TLS
+	if (thread->tls_session) SSL_SESSION_free(thread->tls_session);
+	thread->tls_session = NULL;
+
+	if (thread->ssl_ctx) SSL_CTX_free(thread->ssl_ctx);
+	thread->ssl_ctx = NULL;
+#endif
+
+	return 0;
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_radius_t		*parent = talloc_get_type_abort(mctx->inst->parent->data, rlm_radius_t);
+	rlm_radius_tcp_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_radius_tcp_t);
+	CONF_SECTION		*conf = mctx->inst->conf;
+	CONF_SECTION		*tls;
+
+	if (!parent) {
+		ERROR("IO module cannot be instantiated directly");
+		return -1;
+	}
+
+	inst->parent = parent;
+
+	/*
+	 *	Replication is fire and forget, which doesn't work
+	 *	well with a stream transport.
+	 */
+	if (parent->replicate) {
+		cf_log_err(conf, "'replicate = yes' is not supported with the TCP transport.  Use UDP instead");
+		return -1;
+	}
+
+	/*
+	 *	Ensure that we have a destination address.
+	 */
+	if (inst->dst_ipaddr.af == AF_UNSPEC) {
+		cf_log_err(conf, "A value must be given for 'ipaddr'");
+		return -1;
+	}
+
+	/*
+	 *	If src_ipaddr isn't set, make sure it's INADDR_ANY, of
+	 *	the same address family as dst_ipaddr.
+	 */
+	if (inst->src_ipaddr.af == AF_UNSPEC) {
+		memset(&inst->src_ipaddr, 0, sizeof(inst->src_ipaddr));
+
+		inst->src_ipaddr.af = inst->dst_ipaddr.af;
+
+		if (inst->src_ipaddr.af == AF_INET) {
+			inst->src_ipaddr.prefix = 32;
+		} else {
+			inst->src_ipaddr.prefix = 128;
+		}
+	}
+
+	else if (inst->src_ipaddr.af != inst->dst_ipaddr.af) {
+		cf_log_err(conf, "The 'ipaddr' and 'src_ipaddr' configuration items must "
+			   "be both of the same address family");
+		return -1;
+	}
+
+	/*
+	 *	Clamp max_packet_size first before checking recv_buff and send_buff
+	 */
+	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 64);
+	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
+
+	if (inst->recv_buff_is_set) {
+		FR_INTEGER_BOUND_CHECK("recv_buff", inst->recv_buff, >=, inst->max_packet_size);
+		FR_INTEGER_BOUND_CHECK("recv_buff", inst->recv_buff, <=, (1 << 30));
+	}
+
+	if (inst->send_buff_is_set) {
+		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, >=, inst->max_packet_size);
+		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, <=, (1 << 30));
+	}
+
+	tls = cf_section_find(conf, "tls", NULL);
+	if (tls) {
+#ifdef WITH_TLS
+		inst->tls = fr_tls_conf_parse_client(tls);
+		if (!inst->tls) {
+			cf_log_perr(tls, "Failed parsing TLS configuration");
+			return -1;
+		}
+#else
+		cf_log_err(tls, "Server was built without TLS support");
+		return -1;
+#endif
+	}
+
+	/*
+	 *	RFC 6614 Section 2.3 - the well known port for
+	 *	RADIUS/TLS is 2083.  For plain TCP, the port is the
+	 *	same as for UDP, so it has to be given.
+	 */
+	if (!inst->dst_port) {
+#ifdef WITH_TLS
+		if (inst->tls) {
+			inst->dst_port = 2083;
+		} else
+#endif
+		{
+			cf_log_err(conf, "A value must be given for 'port'");
+			return -1;
+		}
+	}
+
+#ifdef WITH_TLS
+	/*
+	 *	RFC 6614 Section 2.3 - the shared secret is
+	 *	"radsec".  We still allow it to be changed, as
+	 *	some home servers use other values.
+	 */
+	if (inst->tls && (strcmp(inst->secret, "radsec") != 0)) {
+		cf_log_warn(conf, "RFC 6614 requires 'secret = radsec' when using TLS");
+	}
+#endif
+
+	/*
+	 *	Each connection has 256 IDs, and we need one for
+	 *	the status checks.
+	 */
+	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", parent->trunk_conf.max_req_per_conn, <=, 255);
+	FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", parent->trunk_conf.target_req_per_conn,
+			       <=, parent->trunk_conf.max_req_per_conn / 2);
+
+	inst->codec = (radius_codec_t) {
+		.parent = parent,
+		.secret = inst->secret,
+		.max_packet_size = inst->max_packet_size
+	};
+
+	return 0;
+}
+
+static int mod_load(void)
+{
+	return radius_codec_init();
+}
+
+static void mod_unload(void)
+{
+	radius_codec_free();
+}
+
+extern rlm_radius_io_t rlm_radius_tcp;
+rlm_radius_io_t rlm_radius_tcp = {
+	.common = {
+		.magic			= MODULE_MAGIC_INIT,
+		.name			= "radius_tcp",
+		.inst_size		= sizeof(rlm_radius_tcp_t),
+
+		.thread_inst_size	= sizeof(tcp_thread_t),
+		.thread_inst_type	= "tcp_thread_t",
+
+		.config			= module_config,
+		.onload			= mod_load,
+		.unload			= mod_unload,
+		.instantiate		= mod_instantiate,
+		.thread_instantiate 	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach,
+	},
+	.enqueue		= mod_enqueue,
+	.signal			= mod_signal,
+	.resume			= mod_resume,
+};
@@ -0,0 +1,10 @@
+TARGETNAME	:= rlm_radius_tcp
+TARGET		:= $(TARGETNAME)$(L)
+
+SOURCES		:= rlm_radius_tcp.c codec.c track.c
+
+TGT_PREREQS	:= libfreeradius-radius$(L)
+
+ifneq "$(OPENSSL_LIBS)" ""
+TGT_PREREQS	+= libfreeradius-tls$(L)
+endif
@@ -31,13 +31,24 @@ RCSID("$Id$")
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/timer_wheel.h>
 #include <freeradius-devel/util/udp.h>
 
 #include <sys/socket.h>
 
 #include "rlm_radius.h"
+#include "codec.h"
 #include "track.h"
 
+/*
+ *	Request timers are kept in a per-connection timing wheel.
+ *	Timers fire at most one tick late, and one rotation is
+ *	~10s, so most response windows fit in a single rotation.
+ */
+#define UDP_TIMER_RESOLUTION	fr_time_delta_from_msec(10)
+#define UDP_TIMER_SLOTS		1024
+
 /** Static configuration for the module.
  *
  */
@@ -63,6 +74,8 @@ typedef struct {
 	bool			replicate;		//!< Copied from parent->replicate
 
 	fr_trunk_conf_t		*trunk_conf;		//!< trunk configuration
+
+	radius_codec_t		codec;			//!< What we need to encode and decode packets.
 } rlm_radius_udp_t;
 
 typedef struct {
@@ -83,6 +96,7 @@ typedef struct udp_request_s udp_request_t;
 typedef struct {
 	struct iovec		out;			//!< Describes buffer to send.
 	fr_trunk_request_t	*treq;			//!< Used for signalling.
+	bool			sign;			//!< Packet has to be signed before it's sent.
 } udp_coalesced_t;
 
 /** Track the handle, which is tightly correlated with the FD
@@ -96,6 +110,7 @@ typedef struct {
 
 	struct mmsghdr		*mmsgvec;		//!< Vector of inbound/outbound packets.
 	udp_coalesced_t		*coalesced;		//!< Outbound coalesced requests.
+	fr_radius_sign_job_t	*sign;			//!< Coalesced packets to sign in one batch.
 
 	size_t			send_buff_actual;	//!< What we believe the maximum SO_SNDBUF size to be.
 							///< We don't try and encode more packet data than this
@@ -128,6 +143,9 @@ typedef struct {
 
 	fr_event_timer_t const	*zombie_ev;		//!< Zombie timeout.
 
+	fr_timer_wheel_t	*tw;			//!< Retransmission and response timers for
+							///< requests on this connection.
+
 	bool			status_checking;       	//!< whether we're doing status checks
 	udp_request_t		*status_u;		//!< for sending status check packets
 	udp_result_t		*status_r;		//!< for faking out status checks as real packets
@@ -157,7 +175,8 @@ struct udp_request_s {
 	size_t			packet_len;		//!< Length of the packet.
 
 	radius_track_entry_t	*rr;			//!< ID tracking, resend count, etc.
-	fr_event_timer_t const	*ev;			//!< timer for retransmissions
+	fr_event_timer_t const	*ev;			//!< timer for status check retransmissions
+	fr_timer_wheel_entry_t	te;			//!< timer for request retransmissions and timeouts
 	fr_retry_t		retry;			//!< retransmission timers
 };
 
@@ -193,76 +212,29 @@ fr_dict_autoload_t rlm_radius_udp_dict[] = {
 	{ NULL }
 };
 
-static fr_dict_attr_t const *attr_acct_delay_time;
-static fr_dict_attr_t const *attr_error_cause;
 static fr_dict_attr_t const *attr_event_timestamp;
-static fr_dict_attr_t const *attr_extended_attribute_1;
 static fr_dict_attr_t const *attr_message_authenticator;
 static fr_dict_attr_t const *attr_nas_identifier;
-static fr_dict_attr_t const *attr_original_packet_code;
 static fr_dict_attr_t const *attr_proxy_state;
-static fr_dict_attr_t const *attr_response_length;
 static fr_dict_attr_t const *attr_user_password;
 static fr_dict_attr_t const *attr_packet_type;
 
 extern fr_dict_attr_autoload_t rlm_radius_udp_dict_attr[];
 fr_dict_attr_autoload_t rlm_radius_udp_dict_attr[] = {
-	{ .out = &attr_acct_delay_time, .name = "Acct-Delay-Time", .type = FR_TYPE_UINT32, .dict = &dict_radius},
-	{ .out = &attr_error_cause, .name = "Error-Cause", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_event_timestamp, .name = "Event-Timestamp", .type = FR_TYPE_DATE, .dict = &dict_radius},
-	{ .out = &attr_extended_attribute_1, .name = "Extended-Attribute-1", .type = FR_TYPE_TLV, .dict = &dict_radius},
 	{ .out = &attr_message_authenticator, .name = "Message-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
 	{ .out = &attr_nas_identifier, .name = "NAS-Identifier", .type = FR_TYPE_STRING, .dict = &dict_radius},
-	{ .out = &attr_original_packet_code, .name = "Extended-Attribute-1.Original-Packet-Code", .type = FR_TYPE_UINT32, .dict = &dict_radius},
 	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius},
-	{ .out = &attr_response_length, .name = "Extended-Attribute-1.Response-Length", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_user_password, .name = "User-Password", .type = FR_TYPE_STRING, .dict = &dict_radius},
 	{ .out = &attr_packet_type, .name = "Packet-Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ NULL }
 };
 
-/** If we get a reply, the request must come from one of a small
- * number of packet types.
- */
-static fr_radius_packet_code_t allowed_replies[FR_RADIUS_CODE_MAX] = {
-	[FR_RADIUS_CODE_ACCESS_ACCEPT]		= FR_RADIUS_CODE_ACCESS_REQUEST,
-	[FR_RADIUS_CODE_ACCESS_CHALLENGE]	= FR_RADIUS_CODE_ACCESS_REQUEST,
-	[FR_RADIUS_CODE_ACCESS_REJECT]		= FR_RADIUS_CODE_ACCESS_REQUEST,
-
-	[FR_RADIUS_CODE_ACCOUNTING_RESPONSE]	= FR_RADIUS_CODE_ACCOUNTING_REQUEST,
-
-	[FR_RADIUS_CODE_COA_ACK]		= FR_RADIUS_CODE_COA_REQUEST,
-	[FR_RADIUS_CODE_COA_NAK]		= FR_RADIUS_CODE_COA_REQUEST,
-
-	[FR_RADIUS_CODE_DISCONNECT_ACK]	= FR_RADIUS_CODE_DISCONNECT_REQUEST,
-	[FR_RADIUS_CODE_DISCONNECT_NAK]	= FR_RADIUS_CODE_DISCONNECT_REQUEST,
-
-	[FR_RADIUS_CODE_PROTOCOL_ERROR]	= FR_RADIUS_CODE_PROTOCOL_ERROR,	/* Any */
-};
-
-/** Turn a reply code into a module rcode;
- *
- */
-static rlm_rcode_t radius_code_to_rcode[FR_RADIUS_CODE_MAX] = {
-	[FR_RADIUS_CODE_ACCESS_ACCEPT]		= RLM_MODULE_OK,
-	[FR_RADIUS_CODE_ACCESS_CHALLENGE]	= RLM_MODULE_UPDATED,
-	[FR_RADIUS_CODE_ACCESS_REJECT]		= RLM_MODULE_REJECT,
-
-	[FR_RADIUS_CODE_ACCOUNTING_RESPONSE]	= RLM_MODULE_OK,
-
-	[FR_RADIUS_CODE_COA_ACK]		= RLM_MODULE_OK,
-	[FR_RADIUS_CODE_COA_NAK]		= RLM_MODULE_REJECT,
-
-	[FR_RADIUS_CODE_DISCONNECT_ACK]	= RLM_MODULE_OK,
-	[FR_RADIUS_CODE_DISCONNECT_NAK]	= RLM_MODULE_REJECT,
-
-	[FR_RADIUS_CODE_PROTOCOL_ERROR]	= RLM_MODULE_HANDLED,
-};
-
 static void		conn_writable_status_check(UNUSED fr_event_list_t *el, UNUSED int fd,
 						   UNUSED int flags, void *uctx);
 
-static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id);
+static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id,
+			       fr_radius_sign_job_t *sign);
 
 static decode_fail_t	decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
 			       udp_handle_t *h, request_t *request, udp_request_t *u,
@@ -312,6 +284,15 @@ static void udp_request_reset(udp_request_t *u)
 	u->can_retransmit = false;
 }
 
+/** Disarm any timers associated with a request
+ *
+ */
+static inline CC_HINT(always_inline) void udp_request_timer_delete(udp_request_t *u)
+{
+	if (u->ev) (void) fr_event_timer_delete(&u->ev);
+	fr_timer_wheel_delete(&u->te);
+}
+
 /** Reset a status_check packet, ready to re-use
  *
  */
@@ -650,7 +631,7 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 	DEBUG("%s - Sending %s ID %d length %ld over connection %s",
 	      h->module_name, fr_packet_codes[u->code], u->id, u->packet_len, h->name);
 
-	if (encode(h->inst, h->status_request, u, u->id) < 0) {
+	if (encode(h->inst, h->status_request, u, u->id, NULL) < 0) {
 	fail:
 		fr_connection_signal_reconnect(conn, FR_CONNECTION_FAILED);
 		return;
@@ -710,6 +691,14 @@ static int _udp_handle_free(udp_handle_t *h)
 
 	DEBUG("%s - Connection closed - %s", h->module_name, h->name);
 
+	{
+		fr_timer_wheel_stats_t const *stats = fr_timer_wheel_stats(h->tw);
+
+		DEBUG3("%s - Request timers armed %" PRIu64 ", cancelled %" PRIu64 ", fired %" PRIu64
+		       ", event list updates %" PRIu64, h->module_name,
+		       stats->inserts, stats->deletes, stats->fired, stats->event_ops);
+	}
+
 	return 0;
 }
 
@@ -743,6 +732,7 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	 */
 	h->mmsgvec = talloc_zero_array(h, struct mmsghdr, h->inst->max_send_coalesce);
 	h->coalesced = talloc_zero_array(h, udp_coalesced_t, h->inst->max_send_coalesce);
+	h->sign = talloc_zero_array(h, fr_radius_sign_job_t, h->inst->max_send_coalesce);
 	for (i = 0; i < h->inst->max_send_coalesce; i++) {
 		h->mmsgvec[i].msg_hdr.msg_iov = &h->coalesced[i].out;
 		h->mmsgvec[i].msg_hdr.msg_iovlen = 1;
@@ -751,6 +741,8 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	MEM(h->buffer = talloc_array(h, uint8_t, h->max_packet_size));
 	h->buflen = h->max_packet_size;
 
+	MEM(h->tw = fr_timer_wheel_alloc(h, thread->el, UDP_TIMER_RESOLUTION, UDP_TIMER_SLOTS));
+
 	if (!h->inst->replicate) MEM(h->tt = radius_track_alloc(h));
 
 	/*
@@ -1180,78 +1172,16 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 			    uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
 			    uint8_t *data, size_t data_len)
 {
-	rlm_radius_udp_t const *inst = h->thread->inst;
-	size_t			packet_len;
 	decode_fail_t		reason;
-	uint8_t			code;
-	uint8_t			original[RADIUS_HEADER_LENGTH];
-
-	*response_code = 0;	/* Initialise to keep the rest of the code happy */
-
-	packet_len = data_len;
-	if (!fr_radius_ok(data, &packet_len, inst->parent->max_attributes, false, &reason)) {
-		RWARN("Ignoring malformed packet");
-		return reason;
-	}
-
-	RHEXDUMP3(data, packet_len, "Read packet");
 
-	original[0] = u->code;
-	original[1] = 0;			/* not looked at by fr_radius_verify() */
-	original[2] = 0;
-	original[3] = RADIUS_HEADER_LENGTH;	/* for debugging */
-	memcpy(original + RADIUS_AUTH_VECTOR_OFFSET, request_authenticator, RADIUS_AUTH_VECTOR_LENGTH);
-
-	if (fr_radius_verify(data, original,
-			     (uint8_t const *) inst->secret, talloc_array_length(inst->secret) - 1, false) < 0) {
-		RPWDEBUG("Ignoring response with invalid signature");
-		return DECODE_FAIL_MA_INVALID;
-	}
+	reason = radius_codec_decode(ctx, reply, response_code, &h->inst->codec, request, u->code, u->status_check,
+				     request_authenticator, data, data_len);
+	if (reason != DECODE_FAIL_NONE) return reason;
 
-	code = data[0];
-	if (!code || (code >= FR_RADIUS_CODE_MAX)) {
-		REDEBUG("Unknown reply code %d", code);
-		return DECODE_FAIL_UNKNOWN_PACKET_CODE;
-	}
-
-	if (!allowed_replies[code]) {
-		REDEBUG("%s packet received invalid reply code %s",
-			fr_packet_codes[u->code], fr_packet_codes[code]);
-		return DECODE_FAIL_UNKNOWN_PACKET_CODE;
-	}
-
-	/*
-	 *	Protocol error is allowed as a response to any
-	 *	packet code.
-	 *
-	 *	Status checks accept any response code.
-	 */
-	if (!u->status_check && (code != FR_RADIUS_CODE_PROTOCOL_ERROR)) {
-		if (allowed_replies[code] != (fr_radius_packet_code_t) u->code) {
-			REDEBUG("%s packet received invalid reply code %s",
-				fr_packet_codes[u->code], fr_packet_codes[code]);
-			return DECODE_FAIL_UNKNOWN_PACKET_CODE;
-		}
-	}
-
-	/*
-	 *	Decode the attributes, in the context of the reply.
-	 *	This only fails if the packet is strangely malformed,
-	 *	or if we run out of memory.
-	 */
-	if (fr_radius_decode(ctx, reply, data, packet_len, original,
-			     inst->secret, talloc_array_length(inst->secret) - 1) < 0) {
-		REDEBUG("Failed decoding attributes for packet");
-		fr_pair_list_free(reply);
-		return DECODE_FAIL_UNKNOWN;
-	}
-
-	RDEBUG("Received %s ID %d length %ld reply packet on connection %s",
-	       fr_packet_codes[code], code, packet_len, h->name);
+	RDEBUG("Received %s ID %d length %u reply packet on connection %s",
+	       fr_packet_codes[*response_code], data[1], fr_nbo_to_uint16(data + 2), h->name);
 	log_request_pair_list(L_DBG_LVL_2, request, NULL, reply, NULL);
 
-	*response_code = code;
-
 	/*
 	 *	Record the fact we've seen a response
 	 */
@@ -1265,263 +1195,34 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 	return DECODE_FAIL_NONE;
 }
 
-static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id)
+static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_t *u, uint8_t id,
+		  fr_radius_sign_job_t *sign)
 {
-	ssize_t			packet_len;
-	uint8_t			*msg = NULL;
-	int			message_authenticator = u->require_ma * (RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2);
-	int			proxy_state = 6;
+	int ret;
 
-	fr_assert(inst->parent->allowed[u->code]);
 	fr_assert(!u->packet);
 
-	/*
-	 *	Try to retransmit, unless there are special
-	 *	circumstances.
-	 */
-	u->can_retransmit = true;
-
-	/*
-	 *	This is essentially free, as this memory was
-	 *	pre-allocated as part of the treq.
-	 */
-	u->packet_len = inst->max_packet_size;
-	MEM(u->packet = talloc_array(u, uint8_t, u->packet_len));
-
-	/*
-	 *	All proxied Access-Request packets MUST have a
-	 *	Message-Authenticator, otherwise they're insecure.
-	 *	Same goes for Status-Server.
-	 *
-	 *	And we set the authentication vector to a random
-	 *	number...
-	 */
-	switch (u->code) {
-	case FR_RADIUS_CODE_ACCESS_REQUEST:
-	case FR_RADIUS_CODE_STATUS_SERVER:
-	{
-		size_t i;
-		uint32_t hash, base;
-
-		message_authenticator = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
-
-		base = fr_rand();
-		for (i = 0; i < RADIUS_AUTH_VECTOR_LENGTH; i += sizeof(uint32_t)) {
-			hash = fr_rand() ^ base;
-			memcpy(u->packet + RADIUS_AUTH_VECTOR_OFFSET + i, &hash, sizeof(hash));
-		}
-	}
-		FALL_THROUGH;
-
-	default:
-		break;
-	}
-
-
-	/*
-	 *	If we're sending a status check packet, update any
-	 *	necessary timestamps.  Also, don't add Proxy-State, as
-	 *	we're originating the packet.
-	 */
-	if (u->status_check) {
-		fr_pair_t *vp;
-
-		proxy_state = 0;
-		vp = fr_pair_find_by_da_idx(&request->request_pairs, attr_event_timestamp, 0);
-		if (vp) vp->vp_date = fr_time_to_unix_time(u->retry.updated);
-
-		if (u->code == FR_RADIUS_CODE_STATUS_SERVER) u->can_retransmit = false;
-
-	} else if (inst->parent->originate) {
-		/*
-		 *	We're originating packets instead of proxying
-		 *	them.  We don't add a Proxy-State attribute.
-		 */
-		proxy_state = 0;
-	}
-
-	/*
-	 *	We should have at minimum 64-byte packets, so don't
-	 *	bother doing run-time checks here.
-	 */
-	fr_assert(u->packet_len >= (size_t) (RADIUS_HEADER_LENGTH + proxy_state + message_authenticator));
-
-	/*
-	 *	Encode it, leaving room for Proxy-State and
-	 *	Message-Authenticator if necessary.
-	 */
-	packet_len = fr_radius_encode(u->packet, u->packet_len - (proxy_state + message_authenticator), NULL,
-				      inst->secret, talloc_array_length(inst->secret) - 1,
-				      u->code, id, &request->request_pairs);
-	if (fr_pair_encode_is_error(packet_len)) {
-		RPERROR("Failed encoding packet");
-
-	error:
-		TALLOC_FREE(u->packet);
-		return -1;
-	}
-
-	if (packet_len < 0) {
-		size_t have;
-		size_t need;
-
-		have = u->packet_len - (proxy_state + message_authenticator);
-		need = have - packet_len;
-
-		if (need > RADIUS_MAX_PACKET_SIZE) {
-			RERROR("Failed encoding packet.  Have %zu bytes of buffer, need %zu bytes",
-			       have, need);
-		} else {
-			RERROR("Failed encoding packet.  Have %zu bytes of buffer, need %zu bytes.  "
-			       "Increase 'max_packet_size'", have, need);
-		}
-
-		goto error;
-	}
-	/*
-	 *	The encoded packet should NOT over-run the input buffer.
-	 */
-	fr_assert((size_t) (packet_len + proxy_state + message_authenticator) <= u->packet_len);
-
-	/*
-	 *	Add Proxy-State to the tail end of the packet.
-	 *
-	 *	We need to add it here, and NOT in
-	 *	request->request_pairs, because multiple modules
-	 *	may be sending the packets at the same time.
-	 */
-	if (proxy_state) {
-		uint8_t		*attr = u->packet + packet_len;
-		fr_pair_t	*vp;
-		fr_dcursor_t	cursor;
-		int		count = 0;
-
-		/*
-		 *	Count how many Proxy-State attributes have
-		 *	*our* magic number.  Note that we also add a
-		 *	counter to each Proxy-State, so we're double
-		 *	sure that it's a loop.
-		 */
-		if (DEBUG_ENABLED) {
-			for (vp = fr_pair_dcursor_by_da_init(&cursor, &request->request_pairs, attr_proxy_state);
-			     vp;
-			     vp = fr_dcursor_next(&cursor)) {
-				if ((vp->vp_length == 5) && (memcmp(vp->vp_octets, &inst->parent->proxy_state, 4) == 0)) {
-					count++;
-				}
-			}
-
-			/*
-			 *	Some configurations may proxy to
-			 *	ourselves for tests / simplicity.  But
-			 *	warn if there are a large number of
-			 *	identical Proxy-State attributes.
-			 */
-			if (count >= 4) RWARN("Potential proxy loop detected!  Please recheck your configuration.");
-		}
-
-		attr[0] = (uint8_t)attr_proxy_state->attr;
-		attr[1] = 7;
-		memcpy(attr + 2, &inst->parent->proxy_state, 4);
-		attr[6] = count & 0xff;
-		packet_len += 7;
-
-		MEM(vp = fr_pair_afrom_da(u->packet, attr_proxy_state));
-		fr_pair_value_memdup(vp, attr + 2, 5, true);
-		fr_pair_append(&u->extra, vp);
-	}
-
-	/*
-	 *	Add Message-Authenticator manually.
-	 *
-	 *	Note that the length check will always pass, due to
-	 *	the buflen manipulation done above.
-	 */
-	if (message_authenticator) {
-		msg = u->packet + packet_len;
-
-		msg[0] = (uint8_t) attr_message_authenticator->attr;
-		msg[1] = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
-		memset(msg + 2, 0,  RADIUS_MESSAGE_AUTHENTICATOR_LENGTH);
-
-		packet_len += msg[1];
-	}
+	ret = radius_codec_encode(u, &u->packet, &u->packet_len, &u->extra, &inst->codec, request,
+				  &(radius_codec_packet_t){
+					.code = u->code,
+					.id = id,
+					.require_ma = u->require_ma,
+					.status_check = u->status_check,
+					.recv_time = u->recv_time,
+					.now = u->retry.updated,
+					.sign = sign
+				  });
+	if (ret < 0) return -1;
 
 	/*
-	 *	Update the packet header based on the new attributes.
-	 */
-	u->packet[2] = (packet_len >> 8) & 0xff;
-	u->packet[3] = packet_len & 0xff;
-	u->packet_len = packet_len;
-
-	/*
-	 *	Ensure that we update the Acct-Delay-Time based on the
-	 *	time difference between now, and when we originally
-	 *	received the request.
-	 */
-	if ((u->code == FR_RADIUS_CODE_ACCOUNTING_REQUEST) &&
-	    (fr_pair_find_by_da_idx(&request->request_pairs, attr_acct_delay_time, 0) != NULL)) {
-		uint8_t *attr, *end;
-		uint32_t delay;
-		fr_time_t now;
-
-		/*
-		 *	Change Acct-Delay-Time in the packet, but not
-		 *	in the debug output.  Oh well.  We don't want
-		 *	to edit the incoming VPs, and we want to
-		 *	update the encoded version of Acct-Delay-Time.
-		 *	So we just walk through the packet to find it.
-		 */
-		end = u->packet + packet_len;
-
-		for (attr = u->packet + RADIUS_HEADER_LENGTH;
-		     attr < end;
-		     attr += attr[1]) {
-			if (attr[0] != attr_acct_delay_time->attr) continue;
-			if (attr[1] != 6) continue;
-
-			now = u->retry.updated;
-
-			/*
-			 *	Add in the time between when
-			 *	we received the packet, and
-			 *	when we're sending the packet.
-			 */
-			memcpy(&delay, attr + 2, 4);
-			delay = ntohl(delay);
-			delay += fr_time_delta_to_sec(fr_time_sub(now, u->recv_time));
-			delay = htonl(delay);
-			memcpy(attr + 2, &delay, 4);
-			break;
-		}
-
-		u->can_retransmit = false;
-	}
-
-	/*
-	 *	Only certain types of packet, and those with a
-	 *	message_authenticator need signing.
+	 *	Try to retransmit, unless there are special
+	 *	circumstances.  Status-Server packets have a new
+	 *	Event-Timestamp each time, and an updated
+	 *	Acct-Delay-Time means the packet has to be encoded
+	 *	again.
 	 */
-	if (message_authenticator) goto sign;
-	switch (u->code) {
-	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
-	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
-	case FR_RADIUS_CODE_COA_REQUEST:
-	sign:
-		/*
-		 *	Now that we're done mangling the packet, sign it.
-		 */
-		if (fr_radius_sign(u->packet, NULL, (uint8_t const *) inst->secret,
-				   talloc_array_length(inst->secret) - 1) < 0) {
-			RERROR("Failed signing packet");
-			goto error;
-		}
-		break;
+	u->can_retransmit = (ret == 0) && !(u->status_check && (u->code == FR_RADIUS_CODE_STATUS_SERVER));
 
-	default:
-		break;
-
-	}
 	return 0;
 }
 
@@ -1786,13 +1487,69 @@ static void status_check_retry(UNUSED fr_event_list_t *el, fr_time_t now, void *
         fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
 }
 
+/** Sign the newly encoded packets in the coalesced set, all at once
+ *
+ * Packets which can't be signed are failed, and removed from the set.
+ *
+ * @param[in] h		Connection handle.
+ * @param[in] queued	Number of packets in h->coalesced.
+ * @param[in] signing	Number of packets in h->sign.  One for each entry
+ *			in h->coalesced with sign set, in the same order.
+ * @return The number of packets left in h->coalesced.
+ */
+static uint16_t request_mux_sign(udp_handle_t *h, uint16_t queued, uint16_t signing)
+{
+	uint16_t	i, j, k;
+
+	fr_radius_sign_batch(h->sign, signing);
+
+	for (i = 0, j = 0, k = 0; i < queued; i++) {
+		fr_trunk_request_t	*treq = h->coalesced[i].treq;
+		request_t		*request = treq->request;
+		udp_request_t		*u = talloc_get_type_abort(treq->preq, udp_request_t);
+
+		if (h->coalesced[i].sign) {
+			fr_assert(h->sign[k].packet == u->packet);
+
+			if (h->sign[k++].ret < 0) {
+				RERROR("Failed signing packet");
+
+				/*
+				 *	As with encoding failures, request_conn_release
+				 *	may not be called.
+				 */
+				udp_request_reset(u);
+				udp_request_timer_delete(u);
+				fr_trunk_request_signal_fail(treq);
+				continue;
+			}
+			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+
+			/*
+			 *	Remember the authentication vector, which now has the
+			 *	packet signature.
+			 */
+			if (u->rr) (void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+		}
+
+		/*
+		 *	mmsgvec points at the iovecs in coalesced,
+		 *	so moving the entry is enough.
+		 */
+		if (j != i) h->coalesced[j] = h->coalesced[i];
+		j++;
+	}
+
+	return j;
+}
+
 static void request_mux(fr_event_list_t *el,
 			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	rlm_radius_udp_t const	*inst = h->inst;
 	int			sent;
-	uint16_t		i, queued;
+	uint16_t		i, queued, signing = 0;
 	size_t			total_len = 0;
 
 	/*
@@ -1859,26 +1616,32 @@ static void request_mux(fr_event_list_t *el,
 			RDEBUG("Sending %s ID %d length %ld over connection %s",
 			       fr_packet_codes[u->code], u->id, u->packet_len, h->name);
 
-			if (encode(h->inst, request, u, u->id) < 0) {
+			if (encode(h->inst, request, u, u->id, &h->sign[signing]) < 0) {
 				/*
 				 *	Need to do this because request_conn_release
 				 *	may not be called.
 				 */
 				udp_request_reset(u);
-				if (u->ev) (void) fr_event_timer_delete(&u->ev);
+				udp_request_timer_delete(u);
 				fr_trunk_request_signal_fail(treq);
 				continue;
 			}
-			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
 
 			/*
-			 *	Remember the authentication vector, which now has the
-			 *	packet signature.
+			 *	Packets which need signing are signed
+			 *	together, once they've all been encoded.
 			 */
-			(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+			h->coalesced[queued].sign = (h->sign[signing].packet != NULL);
+			if (h->coalesced[queued].sign) {
+				signing++;
+			} else {
+				RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+				(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+			}
 		} else {
 			RDEBUG("Retransmitting %s ID %d length %ld over connection %s",
 			       fr_packet_codes[u->code], u->id, u->packet_len, h->name);
+			h->coalesced[queued].sign = false;
 		}
 
 		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->request_pairs, NULL);
@@ -1912,6 +1675,7 @@ static void request_mux(fr_event_list_t *el,
 		fr_trunk_request_signal_sent(treq);
 		queued++;
 	}
+	if (signing) queued = request_mux_sign(h, queued, signing);
 	if (queued == 0) return;	/* No work */
 
 	/*
@@ -2016,16 +1780,16 @@ static void request_mux(fr_event_list_t *el,
 			RDEBUG("%s request.  Expecting response within %pVs", action,
 			       fr_box_time_delta(u->retry.rt));
 
-			if (fr_event_timer_at(u, el, &u->ev, u->retry.next, request_retry, treq) < 0) {
+			if (fr_timer_wheel_insert(h->tw, &u->te, u->retry.next, request_retry, treq) < 0) {
 				RERROR("Failed inserting retransmit timeout for connection");
 				fr_trunk_request_signal_fail(treq);
 				continue;
 			}
 
 		} else if (u->retry.count == 1) {
-			if (fr_event_timer_at(u, el, &u->ev,
-					      fr_time_add(u->retry.start, h->inst->parent->response_window),
-					      request_timeout, treq) < 0) {
+			if (fr_timer_wheel_insert(h->tw, &u->te,
+						  fr_time_add(u->retry.start, h->inst->parent->response_window),
+						  request_timeout, treq) < 0) {
 				RERROR("Failed inserting timeout for connection");
 				fr_trunk_request_signal_fail(treq);
 				continue;
@@ -2054,7 +1818,7 @@ static void request_mux_replicate(UNUSED fr_event_list_t *el,
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	rlm_radius_udp_t const	*inst = h->inst;
 
-	uint16_t		i = 0, queued;
+	uint16_t		i = 0, queued, signing = 0;
 	int			sent;
 	size_t			total_len = 0;
 
@@ -2076,18 +1840,22 @@ static void request_mux_replicate(UNUSED fr_event_list_t *el,
 		request = treq->request;
 		u = talloc_get_type_abort(treq->preq, udp_request_t);
 
+		h->coalesced[queued].sign = false;
 		if (!u->packet) {
 			u->id = h->last_id++;
 
-			if (encode(h->inst, request, u, u->id) < 0) {
+			if (encode(h->inst, request, u, u->id, &h->sign[signing]) < 0) {
 				fr_trunk_request_signal_fail(treq);
 				continue;
 			}
+
+			h->coalesced[queued].sign = (h->sign[signing].packet != NULL);
+			if (h->coalesced[queued].sign) signing++;
 		}
 
 		RDEBUG("Sending %s ID %d length %ld over connection %s",
 		       fr_packet_codes[u->code], u->id, u->packet_len, h->name);
-		RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+		if (!h->coalesced[queued].sign) RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
 
 		h->coalesced[queued].treq = treq;
 		h->coalesced[queued].out.iov_base = u->packet;
@@ -2105,6 +1873,7 @@ static void request_mux_replicate(UNUSED fr_event_list_t *el,
 		fr_trunk_request_signal_sent(treq);
 		queued++;
 	}
+	if (signing) queued = request_mux_sign(h, queued, signing);
 	if (queued == 0) return;	/* No work */
 
 	/*
@@ -2181,113 +1950,22 @@ static void request_mux_replicate(UNUSED fr_event_list_t *el,
  */
 static void protocol_error_reply(udp_request_t *u, udp_result_t *r, udp_handle_t *h)
 {
-	bool	  	error_601 = false;
-	uint32_t  	response_length = 0;
-	uint8_t const	*attr, *end;
-
-	end = h->buffer + ((h->buffer[2] << 8) | h->buffer[3]);
-
-	for (attr = h->buffer + RADIUS_HEADER_LENGTH;
-	     attr < end;
-	     attr += attr[1]) {
-		/*
-		 *	Error-Cause = Response-Too-Big
-		 */
-		if ((attr[0] == attr_error_cause->attr) && (attr[1] == 6)) {
-			uint32_t error;
-
-			memcpy(&error, attr + 2, 4);
-			error = ntohl(error);
-			if (error == 601) error_601 = true;
-			continue;
-		}
-
-		/*
-		 *	The other end wants us to increase our Response-Length
-		 */
-		if ((attr[0] == attr_response_length->attr) && (attr[1] == 6)) {
-			memcpy(&response_length, attr + 2, 4);
-			continue;
-		}
-
-		/*
-		 *	Protocol-Error packets MUST contain an
-		 *	Original-Packet-Code attribute.
-		 *
-		 *	The attribute containing the
-		 *	Original-Packet-Code is an extended
-		 *	attribute.
-		 */
-		if (attr[0] != attr_extended_attribute_1->attr) continue;
-
-			/*
-			 *	ATTR + LEN + EXT-Attr + uint32
-			 */
-			if (attr[1] != 7) continue;
-
-			/*
-			 *	See if there's an Original-Packet-Code.
-			 */
-			if (attr[2] != (uint8_t)attr_original_packet_code->attr) continue;
+	uint32_t	response_length;
+	rlm_rcode_t	rcode;
 
-			/*
-			 *	Has to be an 8-bit number.
-			 */
-			if ((attr[3] != 0) ||
-			    (attr[4] != 0) ||
-			    (attr[5] != 0)) {
-				if (r) r->rcode = RLM_MODULE_FAIL;
-				return;
-			}
-
-			/*
-			 *	The value has to match.  We don't
-			 *	currently multiplex different codes
-			 *	with the same IDs on connections.  So
-			 *	this check is just for RFC compliance,
-			 *	and for sanity.
-			 */
-			if (attr[6] != u->code) {
-				if (r) r->rcode = RLM_MODULE_FAIL;
-				return;
-			}
-	}
+	rcode = radius_codec_protocol_error(&response_length, u->code, h->buffer);
+	if (r) r->rcode = rcode;
 
 	/*
-	 *	Error-Cause = Response-Too-Big
-	 *
-	 *	The other end says it needs more room to send it's response
-	 *
-	 *	Limit it to reasonable values.
+	 *	The other end says it needs more room to send its
+	 *	response.  Make sure to copy the packet over!
 	 */
-	if (error_601 && response_length && (response_length > h->buflen)) {
-		if (response_length < 4096) response_length = 4096;
-		if (response_length > 65535) response_length = 65535;
-
+	if (response_length > h->buflen) {
 		DEBUG("%s - Increasing buffer size to %u for connection %s", h->module_name, response_length, h->name);
 
-		/*
-		 *	Make sure to copy the packet over!
-		 */
-		attr = h->buffer;
 		h->buflen = response_length;
-		MEM(h->buffer = talloc_array(h, uint8_t, h->buflen));
-
-		memcpy(h->buffer, attr, end - attr);
+		MEM(h->buffer = talloc_realloc(h, h->buffer, uint8_t, h->buflen));
 	}
-
-	/*
-	 *	fail - something went wrong internally, or with the connection.
-	 *	invalid - wrong response to packet
-	 *	handled - best remaining alternative :(
-	 *
-	 *	i.e. if the response is NOT accept, reject, whatever,
-	 *	then we shouldn't allow the caller to do any more
-	 *	processing of this packet.  There was a protocol
-	 *	error, and the response is valid, but not useful for
-	 *	anything.
-	 */
-	if (r) r->rcode = RLM_MODULE_HANDLED;
 }
 
 
@@ -2543,7 +2221,7 @@ static void request_cancel(UNUSED fr_connection_t *conn, void *preq_to_reset,
 		 *	queued for sendmmsg but never actually
 		 *	sent.
 		 */
-		if (u->ev) (void) fr_event_timer_delete(&u->ev);
+		udp_request_timer_delete(u);
 		if (!u->can_retransmit) udp_request_reset(u);
 	}
 
@@ -2562,7 +2240,7 @@ static void request_conn_release(fr_connection_t *conn, void *preq_to_reset, UNU
 	udp_request_t		*u = talloc_get_type_abort(preq_to_reset, udp_request_t);
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 
-	if (u->ev) (void)fr_event_timer_delete(&u->ev);
+	udp_request_timer_delete(u);
 	if (u->packet) udp_request_reset(u);
 
 	u->num_replies = 0;
@@ -2581,7 +2259,7 @@ static void request_conn_release_replicate(UNUSED fr_connection_t *conn, void *p
 {
 	udp_request_t		*u = talloc_get_type_abort(preq_to_reset, udp_request_t);
 
-	fr_assert(!u->ev);
+	fr_assert(!u->ev && !fr_timer_wheel_entry_armed(&u->te));
 
 	if (u->packet) udp_request_reset(u);
 }
@@ -2595,7 +2273,8 @@ static void request_fail(request_t *request, void *preq, void *rctx,
 	udp_result_t		*r = talloc_get_type_abort(rctx, udp_result_t);
 	udp_request_t		*u = talloc_get_type_abort(preq, udp_request_t);
 
-	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) &&
+		  !u->ev && !fr_timer_wheel_entry_armed(&u->te));	/* Dealt with by request_conn_release */
 
 	fr_assert(state != FR_TRUNK_REQUEST_STATE_INIT);
 
@@ -2615,7 +2294,8 @@ static void request_complete(request_t *request, void *preq, void *rctx, UNUSED
 	udp_result_t		*r = talloc_get_type_abort(rctx, udp_result_t);
 	udp_request_t		*u = talloc_get_type_abort(preq, udp_request_t);
 
-	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) &&
+		  !u->ev && !fr_timer_wheel_entry_armed(&u->te));	/* Dealt with by request_conn_release */
 
 	if (u->status_check) return;
 
@@ -2631,7 +2311,8 @@ static void request_free(UNUSED request_t *request, void *preq_to_free, UNUSED v
 {
 	udp_request_t		*u = talloc_get_type_abort(preq_to_free, udp_request_t);
 
-	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) && !u->ev);	/* Dealt with by request_conn_release */
+	fr_assert(!u->rr && !u->packet && fr_pair_list_empty(&u->extra) &&
+		  !u->ev && !fr_timer_wheel_entry_armed(&u->te));	/* Dealt with by request_conn_release */
 
 	/*
 	 *	Don't free status check requests.
@@ -2728,7 +2409,7 @@ static int _udp_result_free(udp_result_t *r)
 	treq = talloc_get_type_abort(r->treq, fr_trunk_request_t);
 	u = talloc_get_type_abort(treq->preq, udp_request_t);
 
-	fr_assert_msg(!u->ev, "udp_result_t freed with active timer");
+	fr_assert_msg(!u->ev && !fr_timer_wheel_entry_armed(&u->te), "udp_result_t freed with active timer");
 
 	return 0;
 }
@@ -2738,7 +2419,7 @@ static int _udp_result_free(udp_result_t *r)
  */
 static int _udp_request_free(udp_request_t *u)
 {
-	if (u->ev) (void) fr_event_timer_delete(&u->ev);
+	udp_request_timer_delete(u);
 
 	fr_assert(u->rr == NULL);
 
@@ -2948,10 +2629,25 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, <=, (1 << 30));
 	}
 
+	inst->codec = (radius_codec_t) {
+		.parent = parent,
+		.secret = inst->secret,
+		.max_packet_size = inst->max_packet_size
+	};
 
 	return 0;
 }
 
+static int mod_load(void)
+{
+	return radius_codec_init();
+}
+
+static void mod_unload(void)
+{
+	radius_codec_free();
+}
+
 extern rlm_radius_io_t rlm_radius_udp;
 rlm_radius_io_t rlm_radius_udp = {
 	.common = {
@@ -2963,6 +2659,8 @@ rlm_radius_io_t rlm_radius_udp = {
 		.thread_inst_type	= "udp_thread_t",
 
 		.config			= module_config,
+		.onload			= mod_load,
+		.unload			= mod_unload,
 		.instantiate		= mod_instantiate,
 		.thread_instantiate 	= mod_thread_instantiate,
 	},
@@ -69,7 +69,10 @@ struct radius_track_s {
 	bool		use_authenticator;	//!< whether to use the request authenticator as an ID
 	int		next_id;		//!< next ID to allocate
 
-	radius_track_entry_t	id[UINT8_MAX + 1];	//!< which ID was used
+	radius_track_entry_t	id[UINT8_MAX + 1];	//!< which ID was used.  Home servers detect
+							///< duplicates by ID and source port, so
+							///< this can't be extended past the 8-bit
+							///< ID.  More load needs more connections.
 
 	fr_rb_tree_t	*subtree[UINT8_MAX + 1];	//!< for Original-Request-Authenticator
 
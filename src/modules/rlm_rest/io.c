@@ -28,7 +28,7 @@
 /** Handle asynchronous cancellation of a request
  *
  * If we're signalled that the request has been cancelled (FR_SIGNAL_CANCEL).
- * Cleanup any pending state and release the connection handle back into the pool.
+ * Cleanup any pending state and release the handle back to the thread.
  */
 void rest_io_module_signal(module_ctx_t const *mctx, request_t *request, fr_state_signal_t action)
 {
@@ -48,13 +48,13 @@ void rest_io_module_signal(module_ctx_t const *mctx, request_t *request, fr_stat
 	t->mhandle->transfers--;
 
 	rest_request_cleanup(mctx->inst->data, randle);
-	fr_pool_connection_release(t->pool, request, randle);
+	rest_handle_release(t, randle);
 }
 
 /** Handle asynchronous cancellation of a request
  *
  * If we're signalled that the request has been cancelled (FR_SIGNAL_CANCEL).
- * Cleanup any pending state and release the connection handle back into the pool.
+ * Cleanup any pending state and release the handle back to the thread.
  */
 void rest_io_xlat_signal(xlat_ctx_t const *xctx, request_t *request, fr_state_signal_t action)
 {
@@ -32,7 +32,6 @@ RCSID("$Id$")
 #include <time.h>
 
 #include <freeradius-devel/server/base.h>
-#include <freeradius-devel/server/pool.h>
 #include <freeradius-devel/unlang/call.h>
 
 #include "rest.h"
@@ -237,29 +236,23 @@ static int _mod_conn_free(fr_curl_io_request_t *randle)
 	return 0;
 }
 
-/** Creates a new connection handle for use by the FR connection API.
- *
- * Matches the fr_pool_connection_create_t function prototype, is passed to
- * fr_pool_init, and called when a new connection is required by the
- * connection pool API.
+/** Creates a new handle for a REST request
  *
  * Creates an instances of fr_curl_io_request_t, and rlm_rest_curl_context_t
  * which hold the context data required for generating requests and parsing
  * responses.
  *
- * If instance->connect_uri is not NULL libcurl will attempt to open a
- * TCP socket to the server specified in the URI. This is done so that when the
- * socket is first used, there will already be a cached TCP connection to the
- * REST server associated with the curl handle.
+ * The handle doesn't own a connection.  Connections belong to the thread's
+ * multi-handle, and are shared by all the handles added to it.
  *
- * @see fr_pool_init
- * @see fr_pool_connection_create_t
- * @see connection.c
+ * @param[in] ctx	to allocate the handle in.
+ * @param[in] inst	rlm_rest configuration.
+ * @return
+ *	- A new handle.
+ *	- NULL on error.
  */
-void *rest_mod_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED fr_time_delta_t timeout)
+fr_curl_io_request_t *rest_handle_alloc(TALLOC_CTX *ctx, rlm_rest_t const *inst)
 {
-	rlm_rest_t const	*inst = talloc_get_type_abort_const(instance, rlm_rest_t);
-
 	fr_curl_io_request_t	*randle = NULL;
 	rlm_rest_curl_context_t	*curl_ctx = NULL;
 
@@ -281,6 +274,60 @@ void *rest_mod_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED fr_time_delta
 	return randle;
 }
 
+/** Get a handle for a request
+ *
+ * Handles are reused, so the easy handle, and its buffers, are only allocated
+ * when all of the thread's existing handles are in use.
+ *
+ * @param[in] t		Thread specific instance data.
+ * @param[in] request	The handle is for.
+ * @return
+ *	- A handle.
+ *	- NULL if the thread has reached max_handles, or on error.
+ */
+fr_curl_io_request_t *rest_handle_get(rlm_rest_thread_t *t, request_t *request)
+{
+	fr_curl_io_request_t	*randle;
+
+	if (t->inst->max_handles && (t->num_used >= t->inst->max_handles)) {
+		REDEBUG("No handles available, %u requests are already in progress", t->num_used);
+		return NULL;
+	}
+
+	if (t->num_idle > 0) {
+		randle = t->idle[--t->num_idle];
+	} else {
+		randle = rest_handle_alloc(t, t->inst);
+		if (!randle) {
+			REDEBUG("Failed allocating handle");
+			return NULL;
+		}
+	}
+	t->num_used++;
+
+	return randle;
+}
+
+/** Return a handle to the thread, once the request has finished with it
+ *
+ * The handle must have been cleaned up with #rest_request_cleanup.
+ *
+ * @param[in] t		Thread specific instance data.
+ * @param[in] randle	to release.
+ */
+void rest_handle_release(rlm_rest_thread_t *t, fr_curl_io_request_t *randle)
+{
+	fr_assert(t->num_used > 0);
+	t->num_used--;
+
+	if (t->num_idle >= t->inst->max_idle_handles) {
+		talloc_free(randle);
+		return;
+	}
+
+	t->idle[t->num_idle++] = randle;
+}
+
 /** Copies a pre-expanded xlat string to the output buffer
  *
  * @param[out] out	Char buffer to write encoded data to.
@@ -1722,10 +1769,8 @@ int rest_request_config(module_ctx_t const *mctx, rlm_rest_section_t const *sect
 			char const *uri, char const *username, char const *password)
 {
 	rlm_rest_t const	*inst = talloc_get_type_abort(mctx->inst->data, rlm_rest_t);
-	rlm_rest_thread_t const	*t = talloc_get_type_abort(mctx->thread, rlm_rest_thread_t);
 	rlm_rest_curl_context_t *ctx = talloc_get_type_abort(randle->uctx, rlm_rest_curl_context_t);
 	CURL			*candle = randle->candle;
-	fr_time_delta_t		timeout;
 
 	http_auth_type_t	auth = section->auth;
 
@@ -1778,10 +1823,9 @@ int rest_request_config(module_ctx_t const *mctx, rlm_rest_section_t const *sect
 		}
 	}
 
-	timeout = fr_pool_timeout(t->pool);
 	RDEBUG3("Connect timeout is %pVs, request timeout is %pVs",
-	        fr_box_time_delta(timeout), fr_box_time_delta(section->timeout));
-	FR_CURL_SET_OPTION(CURLOPT_CONNECTTIMEOUT_MS, fr_time_delta_to_msec(timeout));
+	        fr_box_time_delta(inst->connect_timeout), fr_box_time_delta(section->timeout));
+	FR_CURL_SET_OPTION(CURLOPT_CONNECTTIMEOUT_MS, fr_time_delta_to_msec(inst->connect_timeout));
 	FR_CURL_SET_OPTION(CURLOPT_TIMEOUT_MS, fr_time_delta_to_msec(section->timeout));
 	FR_CURL_SET_OPTION(CURLOPT_PROTOCOLS, (CURLPROTO_HTTP | CURLPROTO_HTTPS));
 
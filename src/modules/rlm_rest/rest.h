@@ -28,7 +28,6 @@ RCSIDH(rest_h, "$Id$")
 #include <freeradius-devel/curl/base.h>
 #include <freeradius-devel/curl/config.h>
 #include <freeradius-devel/server/pairmove.h>
-#include <freeradius-devel/server/pool.h>
 
 /*
  *	The common JSON library (also tells us if we have json-c)
@@ -151,10 +150,15 @@ typedef struct {
 	int			http_negotiation; //!< What HTTP version to negotiate, and how to
 						///< negotiate it.  One or the CURL_HTTP_VERSION_ macros.
 
-	bool			multiplex;	//!< Whether to perform multiple requests using a single
-						///< connection.
+	fr_curl_conn_config_t	conn_config;	//!< Whether to perform multiple requests using a single
+						///< connection, and how many connections and streams
+						///< to allow per host.
 
-	fr_pool_t		*pool;		//!< Pointer to the connection pool.
+	uint32_t		max_handles;	//!< Maximum number of requests in progress per thread.
+						///< 0 means unlimited.
+	uint32_t		max_idle_handles; //!< Maximum number of handles each thread keeps
+						///< for reuse.
+	fr_time_delta_t		connect_timeout; //!< How long to wait for a new connection.
 
 	rlm_rest_section_t	xlat;		//!< Configuration specific to xlat.
 	rlm_rest_section_t	authorize;	//!< Configuration specific to authorisation.
@@ -173,7 +177,9 @@ typedef struct {
  */
 typedef struct {
 	rlm_rest_t const	*inst;		//!< Instance of rlm_rest.
-	fr_pool_t		*pool;		//!< Thread specific connection pool.
+	fr_curl_io_request_t	**idle;		//!< Handles available for reuse.
+	uint32_t		num_idle;	//!< How many handles are in the idle array.
+	uint32_t		num_used;	//!< How many handles are in use by requests.
 	fr_curl_handle_t	*mhandle;	//!< Thread specific multi handle.  Serves as the dispatch
 						//!< and coralling structure for REST requests.
 } rlm_rest_thread_t;
@@ -273,7 +279,11 @@ typedef size_t (*rest_read_t)(void *ptr, size_t size, size_t nmemb,
 			      void *userdata);
 
 
-void *rest_mod_conn_create(TALLOC_CTX *ctx, void *instance, fr_time_delta_t timeout);
+fr_curl_io_request_t *rest_handle_alloc(TALLOC_CTX *ctx, rlm_rest_t const *inst);
+
+fr_curl_io_request_t *rest_handle_get(rlm_rest_thread_t *t, request_t *request);
+
+void rest_handle_release(rlm_rest_thread_t *t, fr_curl_io_request_t *randle);
 
 /*
  *	Request processing API
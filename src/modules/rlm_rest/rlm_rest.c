@@ -130,6 +130,16 @@ static const CONF_PARSER xlat_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Per-thread handle limits
+ */
+static const CONF_PARSER handle_config[] = {
+	{ FR_CONF_OFFSET("max", FR_TYPE_UINT32, rlm_rest_t, max_handles), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_idle", FR_TYPE_UINT32, rlm_rest_t, max_idle_handles), .dflt = "32" },
+	{ FR_CONF_OFFSET("connect_timeout", FR_TYPE_TIME_DELTA, rlm_rest_t, connect_timeout), .dflt = "3.0" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_DEPRECATED("connect_timeout", FR_TYPE_TIME_DELTA, rlm_rest_t, connect_timeout) },
 	{ FR_CONF_OFFSET("connect_proxy", FR_TYPE_STRING, rlm_rest_t, connect_proxy), .func = rest_proxy_parse },
@@ -137,8 +147,13 @@ static const CONF_PARSER module_config[] = {
 	  .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = http_negotiation_table, .len = &http_negotiation_table_len }, .dflt = "default" },
 
 #ifdef CURLPIPE_MULTIPLEX
-	{ FR_CONF_OFFSET("multiplex", FR_TYPE_BOOL, rlm_rest_t, multiplex), .dflt = "yes" },
+	{ FR_CONF_OFFSET("multiplex", FR_TYPE_BOOL, rlm_rest_t, conn_config.multiplex), .dflt = "yes" },
 #endif
+	{ FR_CONF_OFFSET("max_host_connections", FR_TYPE_UINT32, rlm_rest_t, conn_config.max_host_connections), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_concurrent_streams", FR_TYPE_UINT32, rlm_rest_t, conn_config.max_concurrent_streams), .dflt = "100" },
+	{ FR_CONF_OFFSET("max_cached_connections", FR_TYPE_UINT32, rlm_rest_t, conn_config.max_cached_connections), .dflt = "0" },
+
+	{ FR_CONF_POINTER("pool", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) handle_config },
 
 #ifndef NDEBUG
 	{ FR_CONF_OFFSET("fail_header_decode", FR_TYPE_BOOL, rlm_rest_t, fail_header_decode), .dflt = "no" },
@@ -317,7 +332,7 @@ error:
 finish:
 	rest_request_cleanup(inst, handle);
 
-	fr_pool_connection_release(t->pool, request, handle);
+	rest_handle_release(t, handle);
 
 	talloc_free(rctx);
 
@@ -446,10 +461,10 @@ static xlat_action_t rest_xlat(UNUSED TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out,
 	}
 
 	/*
-	 *	We get a connection from the pool here as the CURL object
-	 *	is needed to use curl_easy_escape() for escaping
+	 *	We get a handle here as the CURL object is needed
+	 *	to use curl_easy_escape() for escaping
 	 */
-	randle = rctx->handle = fr_pool_connection_get(t->pool, request);
+	randle = rctx->handle = rest_handle_get(t, request);
 	if (!randle) return XLAT_ACTION_FAIL;
 
 	/*
@@ -467,7 +482,7 @@ static xlat_action_t rest_xlat(UNUSED TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out,
 
 	error:
 		rest_request_cleanup(inst, randle);
-		fr_pool_connection_release(t->pool, request, randle);
+		rest_handle_release(t, randle);
 		talloc_free(section);
 
 		return XLAT_ACTION_FAIL;
@@ -603,7 +618,7 @@ static unlang_action_t mod_authorize_result(rlm_rcode_t *p_result, module_ctx_t
 finish:
 	rest_request_cleanup(inst, handle);
 
-	fr_pool_connection_release(t->pool, request, handle);
+	rest_handle_release(t, handle);
 
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -625,13 +640,13 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(rlm_rcode_t *p_result, mod
 
 	if (!section->name) RETURN_MODULE_NOOP;
 
-	handle = fr_pool_connection_get(t->pool, request);
+	handle = rest_handle_get(t, request);
 	if (!handle) RETURN_MODULE_FAIL;
 
 	ret = rlm_rest_perform(mctx, section, handle, request, NULL, NULL);
 	if (ret < 0) {
 		rest_request_cleanup(inst, handle);
-		fr_pool_connection_release(t->pool, request, handle);
+		rest_handle_release(t, handle);
 
 		RETURN_MODULE_FAIL;
 	}
@@ -718,7 +733,7 @@ static unlang_action_t mod_authenticate_result(rlm_rcode_t *p_result,
 finish:
 	rest_request_cleanup(inst, handle);
 
-	fr_pool_connection_release(t->pool, request, handle);
+	rest_handle_release(t, handle);
 
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -774,14 +789,14 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 		RDEBUG2("Login attempt with password");
 	}
 
-	handle = fr_pool_connection_get(t->pool, request);
+	handle = rest_handle_get(t, request);
 	if (!handle) RETURN_MODULE_FAIL;
 
 	ret = rlm_rest_perform(mctx, section,
 			       handle, request, username->vp_strvalue, password->vp_strvalue);
 	if (ret < 0) {
 		rest_request_cleanup(inst, handle);
-		fr_pool_connection_release(t->pool, request, handle);
+		rest_handle_release(t, handle);
 
 		RETURN_MODULE_FAIL;
 	}
@@ -835,7 +850,7 @@ static unlang_action_t mod_accounting_result(rlm_rcode_t *p_result, module_ctx_t
 finish:
 	rest_request_cleanup(inst, handle);
 
-	fr_pool_connection_release(t->pool, request, handle);
+	rest_handle_release(t, handle);
 
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -854,13 +869,13 @@ static unlang_action_t CC_HINT(nonnull) mod_accounting(rlm_rcode_t *p_result, mo
 
 	if (!section->name) RETURN_MODULE_NOOP;
 
-	handle = fr_pool_connection_get(t->pool, request);
+	handle = rest_handle_get(t, request);
 	if (!handle) RETURN_MODULE_FAIL;
 
 	ret = rlm_rest_perform(mctx, section, handle, request, NULL, NULL);
 	if (ret < 0) {
 		rest_request_cleanup(inst, handle);
-		fr_pool_connection_release(t->pool, request, handle);
+		rest_handle_release(t, handle);
 
 		RETURN_MODULE_FAIL;
 	}
@@ -914,7 +929,7 @@ static unlang_action_t mod_post_auth_result(rlm_rcode_t *p_result, module_ctx_t
 finish:
 	rest_request_cleanup(inst, handle);
 
-	fr_pool_connection_release(t->pool, request, handle);
+	rest_handle_release(t, handle);
 
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -933,14 +948,14 @@ static unlang_action_t CC_HINT(nonnull) mod_post_auth(rlm_rcode_t *p_result, mod
 
 	if (!section->name) RETURN_MODULE_NOOP;
 
-	handle = fr_pool_connection_get(t->pool, request);
+	handle = rest_handle_get(t, request);
 	if (!handle) RETURN_MODULE_FAIL;
 
 	ret = rlm_rest_perform(mctx, section, handle, request, NULL, NULL);
 	if (ret < 0) {
 		rest_request_cleanup(inst, handle);
 
-		fr_pool_connection_release(t->pool, request, handle);
+		rest_handle_release(t, handle);
 
 		RETURN_MODULE_FAIL;
 	}
@@ -1096,31 +1111,13 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_rest_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_rest_t);
 	rlm_rest_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_rest_thread_t);
-	CONF_SECTION		*conf = mctx->inst->conf;
 	fr_curl_handle_t	*mhandle;
-	CONF_SECTION		*my_conf;
 
 	t->inst = inst;
 
-	/*
-	 *	Temporary hack to make config parsing
-	 *	thread safe.
-	 */
-	my_conf = cf_section_dup(NULL, NULL, conf, cf_section_name1(conf), cf_section_name2(conf), true);
-	t->pool = fr_pool_init(NULL, my_conf, inst, rest_mod_conn_create, NULL, mctx->inst->name);
-	talloc_free(my_conf);
+	if (inst->max_idle_handles) MEM(t->idle = talloc_array(t, fr_curl_io_request_t *, inst->max_idle_handles));
 
-	if (!t->pool) {
-		ERROR("Pool instantiation failed");
-		return -1;
-	}
-
-	if (fr_pool_start(t->pool) < 0) {
-		ERROR("Starting initial connections failed");
-		return -1;
-	}
-
-	mhandle = fr_curl_io_init(t, mctx->el, inst->multiplex);
+	mhandle = fr_curl_io_init(t, mctx->el, &inst->conn_config);
 	if (!mhandle) return -1;
 
 	t->mhandle = mhandle;
@@ -1140,8 +1137,12 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_rest_thread_t *t = talloc_get_type_abort(mctx->thread, rlm_rest_thread_t);
 
-	talloc_free(t->mhandle);	/* Ensure this is shutdown before the pool */
-	fr_pool_free(t->pool);
+	DEBUG2("%s - Completed %" PRIu64 " transfer(s) using %" PRIu64 " connection(s)",
+	       mctx->inst->name, t->mhandle->completed, t->mhandle->connections);
+
+	talloc_free(t->mhandle);	/* Ensure this is shutdown before the handles */
+	while (t->num_idle > 0) talloc_free(t->idle[--t->num_idle]);
+	talloc_free(t->idle);
 
 	return 0;
 }
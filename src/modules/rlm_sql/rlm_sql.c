@@ -91,6 +91,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("radius_db", FR_TYPE_STRING, rlm_sql_config_t, sql_db), .dflt = "radius" },
 	{ FR_CONF_OFFSET("read_groups", FR_TYPE_BOOL, rlm_sql_config_t, read_groups), .dflt = "yes" },
 	{ FR_CONF_OFFSET("read_profiles", FR_TYPE_BOOL, rlm_sql_config_t, read_profiles), .dflt = "yes" },
+	{ FR_CONF_OFFSET("xlat_memoise", FR_TYPE_BOOL, rlm_sql_config_t, xlat_memoise), .dflt = "no" },
 	{ FR_CONF_OFFSET("sql_user_name", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, query_user), .dflt = "" },
 	{ FR_CONF_OFFSET("group_attribute", FR_TYPE_STRING, rlm_sql_config_t, group_attribute) },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, logfile) },
@@ -198,6 +199,24 @@ static int sql_xlat_escape(request_t *request, fr_value_box_t *vb, void *uctx)
 	return 0;
 }
 
+/** Decide whether the result of an SQL xlat call can be re-used
+ *
+ * Only SELECT queries are memoised.  Queries which modify the database
+ * must be run every time.
+ */
+static bool sql_xlat_memoise(UNUSED request_t *request, fr_value_box_list_t const *args)
+{
+	fr_value_box_t const	*arg = fr_dlist_head(args);
+	char const		*p;
+
+	if (!arg || (arg->type != FR_TYPE_STRING)) return false;
+
+	p = arg->vb_strvalue;
+	fr_skip_whitespace(p);
+
+	return (strncasecmp(p, "select", 6) == 0);
+}
+
 /** Execute an arbitrary SQL query
  *
  * For SELECTs, the values of the first column will be returned.
@@ -1073,6 +1092,7 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	sql_xlat_arg->func = sql_xlat_escape;
 	sql_xlat_arg->uctx = inst;
 	xlat_func_mono(xlat, sql_xlat_arg);
+	if (inst->config.xlat_memoise) xlat_func_memoise(xlat, sql_xlat_memoise);
 
 	/*
 	 *	Register the SQL map processor function
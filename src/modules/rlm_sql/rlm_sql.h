@@ -114,6 +114,8 @@ typedef struct {
 								//!< If false, Fall-Through = yes is required
 								//!< in the previous reply list to process
 								//!< profiles.
+	bool			xlat_memoise;			//!< Re-use the results of identical SELECT
+								//!< queries made by the xlat within a request.
 	char const		*logfile;			//!< Keep a log of all SQL queries executed
 								//!< Useful for batch insertion with the
 								//!< NULL drivers.
@@ -41,6 +41,8 @@ static CONF_PARSER submodule_config[] = {
 			 strip_permanent_identity_hint ), .dflt = "yes" },
 	{ FR_CONF_OFFSET("ephemeral_id_length", FR_TYPE_SIZE, eap_aka_sim_process_conf_t, ephemeral_id_length ), .dflt = "14" },	/* 14 for compatibility */
 	{ FR_CONF_OFFSET("protected_success", FR_TYPE_BOOL, eap_aka_sim_process_conf_t, protected_success ), .dflt = "no" },
+	{ FR_CONF_OFFSET("vector_pool", FR_TYPE_SUBSECTION, eap_aka_sim_process_conf_t, vector_pool),
+	  .subcs = (void const *) fr_aka_sim_vector_pool_config },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -260,25 +260,29 @@ invalid:
 	return packet_len;
 }
 
-/** Sign a previously encoded packet
+/** Find the Message-Authenticator in an encoded packet, and prepare the packet for the HMAC
  *
- * Calculates the request/response authenticator for packets which need it, and fills
- * in the message-authenticator value if the attribute is present in the encoded packet.
+ * The authenticator field is set to the value which has to be present
+ * when the Message-Authenticator is calculated, and the Message-Authenticator
+ * value is zeroed.
  *
+ * @param[out] ma		Where to write a pointer to the Message-Authenticator
+ *				value, or NULL if the attribute isn't present.
  * @param[in,out] packet	(request or response).
  * @param[in] original		request (only if this is a response).
- * @param[in] secret		to sign the packet with.
  * @param[in] secret_len	The length of the secret.
  * @return
  *	- <0 on error
  *	- 0 on success
  */
-int fr_radius_sign(uint8_t *packet, uint8_t const *original,
-		   uint8_t const *secret, size_t secret_len)
+static int radius_sign_message_authenticator(uint8_t **ma, uint8_t *packet, uint8_t const *original,
+					     size_t secret_len)
 {
 	uint8_t		*msg, *end;
 	size_t		packet_len = (packet[2] << 8) | packet[3];
 
+	*ma = NULL;
+
 	/*
 	 *	No real limit on secret length, this is just
 	 *	to catch uninitialised fields.
@@ -341,7 +345,11 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		case FR_RADIUS_CODE_ACCESS_REJECT:
 		case FR_RADIUS_CODE_ACCESS_CHALLENGE:
 		do_ack:
-			if (!original) goto need_original;
+			if (!original) {
+			need_original:
+				fr_strerror_const("Cannot sign response packet without a request packet");
+				return -1;
+			}
 			memcpy(packet + 4, original + 4, RADIUS_AUTH_VECTOR_LENGTH);
 			break;
 
@@ -351,19 +359,34 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			break;
 
 		default:
-			goto bad_packet;
+			fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
+			return -1;
 		}
 
 		/*
 		 *	Force Message-Authenticator to be zero,
-		 *	calculate the HMAC, and put it into the
-		 *	Message-Authenticator attribute.
+		 *	the caller calculates the HMAC, and puts
+		 *	it into the Message-Authenticator attribute.
 		 */
 		memset(msg + 2, 0, RADIUS_AUTH_VECTOR_LENGTH);
-		fr_hmac_md5(msg + 2, packet, packet_len, secret, secret_len);
+		*ma = msg + 2;
 		break;
 	}
 
+	return 0;
+}
+
+/** Prepare the authenticator field for the Request / Response Authenticator calculation
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] original		request (only if this is a response).
+ * @return
+ *	- <0 on error
+ *	- 0 if the packet is signed, and nothing more needs to be done.
+ *	- 1 if the authenticator must be set to MD5(packet + secret).
+ */
+static int radius_sign_authenticator(uint8_t *packet, uint8_t const *original)
+{
 	/*
 	 *	Initialize the request authenticator.
 	 */
@@ -384,7 +407,6 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 	case FR_RADIUS_CODE_COA_NAK:
 	case FR_RADIUS_CODE_PROTOCOL_ERROR:
 		if (!original) {
-		need_original:
 			fr_strerror_const("Cannot sign response packet without a request packet");
 			return -1;
 		}
@@ -401,11 +423,40 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 		return 0;
 
 	default:
-	bad_packet:
 		fr_strerror_printf("Cannot sign unknown packet code %u", packet[0]);
 		return -1;
 	}
 
+	return 1;
+}
+
+/** Sign a previously encoded packet
+ *
+ * Calculates the request/response authenticator for packets which need it, and fills
+ * in the message-authenticator value if the attribute is present in the encoded packet.
+ *
+ * @param[in,out] packet	(request or response).
+ * @param[in] original		request (only if this is a response).
+ * @param[in] secret		to sign the packet with.
+ * @param[in] secret_len	The length of the secret.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_radius_sign(uint8_t *packet, uint8_t const *original,
+		   uint8_t const *secret, size_t secret_len)
+{
+	uint8_t		*ma;
+	size_t		packet_len = (packet[2] << 8) | packet[3];
+	int		ret;
+
+	if (radius_sign_message_authenticator(&ma, packet, original, secret_len) < 0) return -1;
+
+	if (ma) fr_hmac_md5(ma, packet, packet_len, secret, secret_len);
+
+	ret = radius_sign_authenticator(packet, original);
+	if (ret <= 0) return ret;
+
 	/*
 	 *	Request / Response Authenticator = MD5(packet + secret)
 	 */
@@ -422,6 +473,79 @@ int fr_radius_sign(uint8_t *packet, uint8_t const *original,
 	return 0;
 }
 
+/** Number of packets to sign in one multi-buffer pass
+ *
+ * Bounds the amount of stack used for the digest jobs.
+ */
+#define RADIUS_SIGN_BATCH_CHUNK	64
+
+/** Sign many previously encoded packets at once
+ *
+ * Produces the same output as calling #fr_radius_sign for each job, but the
+ * Message-Authenticator HMACs, and the Request / Response Authenticators are
+ * calculated for many packets at a time with the multi-buffer MD5 functions.
+ *
+ * Errors are reported per job.  A failure signing one packet does not
+ * affect the others.
+ *
+ * @param[in,out] jobs		Packets to sign.  The ret field of each job is set
+ *				to the value #fr_radius_sign would have returned.
+ * @param[in] num		Number of jobs.
+ */
+void fr_radius_sign_batch(fr_radius_sign_job_t *jobs, size_t num)
+{
+	fr_hmac_md5_mb_job_t	hmac_jobs[RADIUS_SIGN_BATCH_CHUNK];
+	fr_md5_mb_job_t		md5_jobs[RADIUS_SIGN_BATCH_CHUNK];
+	size_t			base, n, i, pending;
+
+	for (base = 0; base < num; base += n) {
+		n = num - base;
+		if (n > RADIUS_SIGN_BATCH_CHUNK) n = RADIUS_SIGN_BATCH_CHUNK;
+
+		/*
+		 *	Message-Authenticators first, as they're
+		 *	included in the Response Authenticator.
+		 */
+		for (i = 0, pending = 0; i < n; i++) {
+			fr_radius_sign_job_t	*job = &jobs[base + i];
+			uint8_t			*ma;
+
+			job->ret = radius_sign_message_authenticator(&ma, job->packet, job->original, job->secret_len);
+			if ((job->ret < 0) || !ma) continue;
+
+			hmac_jobs[pending++] = (fr_hmac_md5_mb_job_t){
+				.in = job->packet,
+				.inlen = (job->packet[2] << 8) | job->packet[3],
+				.key = job->secret,
+				.key_len = job->secret_len,
+				.out = ma
+			};
+		}
+		if (pending) fr_hmac_md5_mb(hmac_jobs, pending);
+
+		/*
+		 *	Request / Response Authenticator = MD5(packet + secret)
+		 */
+		for (i = 0, pending = 0; i < n; i++) {
+			fr_radius_sign_job_t	*job = &jobs[base + i];
+
+			if (job->ret < 0) continue;
+
+			job->ret = radius_sign_authenticator(job->packet, job->original);
+			if (job->ret <= 0) continue;
+			job->ret = 0;
+
+			md5_jobs[pending++] = (fr_md5_mb_job_t){
+				.seg = {
+					{ .data = job->packet, .len = (job->packet[2] << 8) | job->packet[3] },
+					{ .data = job->secret, .len = job->secret_len }
+				},
+				.out = job->packet + 4
+			};
+		}
+		if (pending) fr_md5_mb_calc(md5_jobs, pending);
+	}
+}
 
 /** See if the data pointed to by PTR is a valid RADIUS packet.
  *
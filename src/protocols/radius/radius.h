@@ -104,11 +104,23 @@ enum {
 #define flag_long_extended(_flags)   (!(_flags)->extra && (_flags)->subtype == FLAG_LONG_EXTENDED_ATTR)
 #define flag_tunnel_password(_flags) (!(_flags)->extra && (((_flags)->subtype == FLAG_ENCRYPT_TUNNEL_PASSWORD) || ((_flags)->subtype == FLAG_TAGGED_TUNNEL_PASSWORD)))
 
+/** A packet to sign as part of a batch
+ *
+ */
+typedef struct {
+	uint8_t		*packet;			//!< Encoded request or response.
+	uint8_t const	*original;			//!< Request (only if packet is a response).
+	uint8_t const	*secret;			//!< To sign the packet with.
+	size_t		secret_len;			//!< The length of the secret.
+	int		ret;				//!< Set to <0 on error, 0 on success.
+} fr_radius_sign_job_t;
+
 /*
  *	protocols/radius/base.c
  */
 int		fr_radius_sign(uint8_t *packet, uint8_t const *original,
 			       uint8_t const *secret, size_t secret_len) CC_HINT(nonnull (1,3));
+void		fr_radius_sign_batch(fr_radius_sign_job_t *jobs, size_t num);
 int		fr_radius_verify(uint8_t *packet, uint8_t const *original,
 				 uint8_t const *secret, size_t secret_len, bool require_ma) CC_HINT(nonnull (1,3));
 bool		fr_radius_ok(uint8_t const *packet, size_t *packet_len_p,
@@ -0,0 +1,192 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for batched RADIUS packet signing
+ *
+ * @file src/protocols/radius/sign_tests.c
+ *
+ * @copyright 2022 The FreeRADIUS server project
+ */
+
+#include <freeradius-devel/util/acutest.h>
+
+#include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/util/rand.h>
+
+#define SIGN_TEST_PACKETS	200			/* More than one batch chunk */
+#define SIGN_TEST_MAX_LEN	300
+
+static uint8_t const sign_test_codes[] = {
+	FR_RADIUS_CODE_ACCESS_REQUEST,
+	FR_RADIUS_CODE_ACCESS_ACCEPT,
+	FR_RADIUS_CODE_ACCESS_REJECT,
+	FR_RADIUS_CODE_ACCOUNTING_REQUEST,
+	FR_RADIUS_CODE_ACCOUNTING_RESPONSE,
+	FR_RADIUS_CODE_ACCESS_CHALLENGE,
+	FR_RADIUS_CODE_STATUS_SERVER,
+	FR_RADIUS_CODE_DISCONNECT_REQUEST,
+	FR_RADIUS_CODE_DISCONNECT_ACK,
+	FR_RADIUS_CODE_COA_REQUEST,
+	FR_RADIUS_CODE_COA_ACK,
+	FR_RADIUS_CODE_PROTOCOL_ERROR,
+	99					/* Unknown, so signing fails */
+};
+
+static char const sign_test_secret[] = "testing123-a-secret-which-is-longer-than-one-md5-block-of-64-bytes";
+
+static uint8_t	sign_test_single[SIGN_TEST_PACKETS][SIGN_TEST_MAX_LEN];
+static uint8_t	sign_test_batch[SIGN_TEST_PACKETS][SIGN_TEST_MAX_LEN];
+static int	sign_test_ret[SIGN_TEST_PACKETS];
+
+/** Build a random packet, with a Message-Authenticator about a third of the time
+ *
+ */
+static void sign_test_packet(uint8_t *packet, fr_fast_rand_t *rand)
+{
+	size_t	len, i, attr_len;
+	uint8_t	*p, *end;
+
+	len = RADIUS_HEADER_LENGTH + (fr_fast_rand(rand) % (SIGN_TEST_MAX_LEN - RADIUS_HEADER_LENGTH));
+	for (i = 0; i < len; i++) packet[i] = fr_fast_rand(rand);
+
+	packet[0] = sign_test_codes[fr_fast_rand(rand) % NUM_ELEMENTS(sign_test_codes)];
+
+	p = packet + RADIUS_HEADER_LENGTH;
+	end = packet + len;
+	while ((end - p) >= 2) {
+		if (((fr_fast_rand(rand) % 3) == 0) && ((end - p) >= (RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2))) {
+			p[0] = FR_MESSAGE_AUTHENTICATOR;
+			attr_len = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
+		} else {
+			p[0] = FR_USER_NAME;
+			attr_len = 2 + (fr_fast_rand(rand) % 30);
+			if (attr_len > (size_t)(end - p)) attr_len = end - p;
+		}
+		p[1] = attr_len;
+		p += attr_len;
+	}
+	len = p - packet;
+
+	packet[2] = (len >> 8) & 0xff;
+	packet[3] = len & 0xff;
+}
+
+/** Batch signing must produce the same packets and return codes as signing one at a time
+ *
+ */
+static void test_sign_batch(void)
+{
+	fr_radius_sign_job_t	jobs[SIGN_TEST_PACKETS];
+	uint8_t			original[RADIUS_HEADER_LENGTH];
+	fr_fast_rand_t		rand = { .a = 1, .b = 2 };
+	size_t			i, j;
+
+	for (i = 0; i < sizeof(original); i++) original[i] = fr_fast_rand(&rand);
+
+	for (i = 0; i < SIGN_TEST_PACKETS; i++) {
+		uint8_t const	*orig = (i % 11) ? original : NULL;	/* Some responses without a request */
+		size_t		secret_len = (i % 7) ? 10 : sizeof(sign_test_secret) - 1;
+
+		sign_test_packet(sign_test_single[i], &rand);
+		memcpy(sign_test_batch[i], sign_test_single[i], SIGN_TEST_MAX_LEN);
+
+		sign_test_ret[i] = fr_radius_sign(sign_test_single[i], orig,
+						  (uint8_t const *)sign_test_secret, secret_len);
+
+		jobs[i] = (fr_radius_sign_job_t){
+			.packet = sign_test_batch[i],
+			.original = orig,
+			.secret = (uint8_t const *)sign_test_secret,
+			.secret_len = secret_len,
+			.ret = 1
+		};
+	}
+
+	for (j = 0; j < 3; j++) {
+		/*
+		 *	Different batch sizes, to exercise partial chunks
+		 */
+		size_t batch = (size_t[]){ 1, 7, SIGN_TEST_PACKETS }[j];
+
+		for (i = 0; i < SIGN_TEST_PACKETS; i += batch) {
+			size_t n = SIGN_TEST_PACKETS - i;
+
+			if (n > batch) n = batch;
+			fr_radius_sign_batch(&jobs[i], n);
+		}
+
+		TEST_CASE("Batch signing matches fr_radius_sign()");
+		for (i = 0; i < SIGN_TEST_PACKETS; i++) {
+			TEST_CHECK((jobs[i].ret < 0) == (sign_test_ret[i] < 0));
+			TEST_MSG("Packet %zu (code %u) return code differs, expected %d, got %d",
+				 i, sign_test_single[i][0], sign_test_ret[i], jobs[i].ret);
+			TEST_CHECK(memcmp(sign_test_batch[i], sign_test_single[i], SIGN_TEST_MAX_LEN) == 0);
+			TEST_MSG("Packet %zu (code %u) differs", i, sign_test_single[i][0]);
+		}
+	}
+}
+
+/** Signed packets must pass verification
+ *
+ */
+static void test_sign_batch_verify(void)
+{
+	fr_radius_sign_job_t	jobs[2];
+	uint8_t			request[RADIUS_HEADER_LENGTH + RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2] = {
+					FR_RADIUS_CODE_ACCESS_REQUEST, 1, 0, sizeof(request)
+				};
+	uint8_t			reply[RADIUS_HEADER_LENGTH + RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2] = {
+					FR_RADIUS_CODE_ACCESS_ACCEPT, 1, 0, sizeof(reply)
+				};
+	uint8_t			original[sizeof(request)];
+
+	request[RADIUS_HEADER_LENGTH] = FR_MESSAGE_AUTHENTICATOR;
+	request[RADIUS_HEADER_LENGTH + 1] = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
+	memset(request + RADIUS_AUTH_VECTOR_OFFSET, 0x42, RADIUS_AUTH_VECTOR_LENGTH);
+
+	reply[RADIUS_HEADER_LENGTH] = FR_MESSAGE_AUTHENTICATOR;
+	reply[RADIUS_HEADER_LENGTH + 1] = RADIUS_MESSAGE_AUTHENTICATOR_LENGTH + 2;
+
+	jobs[0] = (fr_radius_sign_job_t){
+		.packet = request,
+		.secret = (uint8_t const *)sign_test_secret,
+		.secret_len = sizeof(sign_test_secret) - 1
+	};
+	fr_radius_sign_batch(jobs, 1);
+	TEST_CHECK(jobs[0].ret == 0);
+
+	memcpy(original, request, sizeof(original));
+	TEST_CHECK(fr_radius_verify(request, NULL, (uint8_t const *)sign_test_secret,
+				    sizeof(sign_test_secret) - 1, true) == 0);
+
+	jobs[1] = (fr_radius_sign_job_t){
+		.packet = reply,
+		.original = original,
+		.secret = (uint8_t const *)sign_test_secret,
+		.secret_len = sizeof(sign_test_secret) - 1
+	};
+	fr_radius_sign_batch(&jobs[1], 1);
+	TEST_CHECK(jobs[1].ret == 0);
+	TEST_CHECK(fr_radius_verify(reply, original, (uint8_t const *)sign_test_secret,
+				    sizeof(sign_test_secret) - 1, true) == 0);
+}
+
+TEST_LIST = {
+	{ "sign_batch",		test_sign_batch },
+	{ "sign_batch_verify",	test_sign_batch_verify },
+
+	{ NULL }
+};
@@ -0,0 +1,6 @@
+TARGET		:= sign_tests$(E)
+SOURCES		:= sign_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-radius$(L)
@@ -75,9 +75,12 @@ $(OUTPUT)/${1}:
 endef
 
 #
-#  Setup rules to spawn a different RADIUSD instance for each EAP type
+#  Setup rules to spawn a different RADIUSD instance for each eapol_test
+#  configuration.  Usually there's one per EAP type, but a type can have
+#  more, e.g. "tls-crypto-threads" runs EAP-TLS with the handshakes
+#  offloaded to crypto threads.  Each has its own directory in config/.
 #
-$(foreach TEST,$(addprefix test., $(subst _,-,$(EAP_TYPES))),$(eval $(call RADIUSD_SERVICE,servers,$(OUTPUT)/$(TEST)))$(eval $(call ADD_TEST_EAP_OUTPUT,$(TEST))))
+$(foreach TEST,$(addprefix test.,$(patsubst $(DIR)/%.conf,%,$(EAPOL_TEST_FILES))),$(eval $(call RADIUSD_SERVICE,servers,$(OUTPUT)/$(TEST)))$(eval $(call ADD_TEST_EAP_OUTPUT,$(TEST))))
 
 #  Reset
 TEST := test.eap
@@ -1,6 +1,6 @@
 #
 #  Test the "kafka" module
 #
-
-# Don't test kafka if KAFKA_TEST_SERVER ENV is not set
-kafka_require_test_server := 1
+#  The module uses librdkafka's built-in mock cluster, so no
+#  broker is needed.
+#
@@ -0,0 +1,36 @@
+#
+#	Performance regression tests.
+#
+#	These take several minutes, and the results depend on the
+#	machine they're run on, so they're not part of "make test".
+#
+#	make test.performance
+#		Run all of the scenarios, and compare the results to
+#		src/tests/performance/baseline.json, if it exists.
+#
+#	PERFORMANCE_ARGS can be used to pass options to the
+#	"bench" script, e.g. PERFORMANCE_ARGS="-u 30 pap".
+#
+#	make test.performance.baseline
+#		Run all of the scenarios, and save the results as the
+#		new baseline.
+#
+PERFORMANCE_DIR       := $(DIR)
+PERFORMANCE_BUILD_DIR := $(BUILD_DIR)/tests/performance
+PERFORMANCE_BENCH     := BUILD_DIR=$(abspath $(BUILD_DIR)) $(PERFORMANCE_DIR)/bench -o $(PERFORMANCE_BUILD_DIR)
+
+.PHONY: test.performance
+test.performance: $(BUILD_DIR)/bin/radiusd$(E) $(BUILD_DIR)/bin/radclient$(E) | $(BUILD_DIR)/tests
+	${Q}$(PERFORMANCE_BENCH) $(PERFORMANCE_ARGS)
+
+.PHONY: test.performance.baseline
+test.performance.baseline: $(BUILD_DIR)/bin/radiusd$(E) $(BUILD_DIR)/bin/radclient$(E) | $(BUILD_DIR)/tests
+	${Q}$(PERFORMANCE_BENCH) -n $(PERFORMANCE_ARGS)
+	${Q}cp $(PERFORMANCE_BUILD_DIR)/results.json $(PERFORMANCE_DIR)/baseline.json
+	@echo "Saved baseline to $(PERFORMANCE_DIR)/baseline.json"
+
+.PHONY: clean.test.performance
+clean.test.performance:
+	${Q}rm -rf $(PERFORMANCE_BUILD_DIR)
+
+clean.test: clean.test.performance
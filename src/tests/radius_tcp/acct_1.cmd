@@ -0,0 +1,11 @@
+#!/bin/sh
+#
+#	Accounting is proxied over TCP, and the response comes back.
+#
+
+test_in="build/tests/radius_tcp/acct_1.out"
+
+if ! grep -q "Received Accounting-Response" ${test_in}; then
+	echo "ERROR: Expected 'Received Accounting-Response' in '${test_in}'"
+	exit 1
+fi
@@ -0,0 +1,20 @@
+#!/bin/sh
+#
+#	A burst of accounting packets over the one TCP connection.
+#
+
+test_in="build/tests/radius_tcp/acct_2.out"
+sent=$(grep "Sent Accounting-Request" ${test_in} | wc -l)
+recv=$(grep "Received Accounting-Response" ${test_in} | wc -l)
+
+expected=100
+
+if [ $sent -ne $expected ]; then
+	echo "ERROR: We expected ${expected} 'Sent Accounting-Request' in '${test_in}', got ${sent}"
+	exit 1
+fi
+
+if [ $recv -ne $expected ]; then
+	echo "ERROR: We expected ${expected} 'Received Accounting-Response' in '${test_in}', got ${recv}"
+	exit 1
+fi
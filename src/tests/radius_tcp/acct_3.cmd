@@ -0,0 +1,12 @@
+#!/bin/sh
+#
+#	The "test" virtual server checks that accounting replies are
+#	never cached.  It rejects the request if they are.
+#
+
+test_in="build/tests/radius_tcp/acct_3.out"
+
+if ! grep -q "Received Accounting-Response" ${test_in}; then
+	echo "ERROR: Accounting-Request was answered from the reply cache.  See '${test_in}'"
+	exit 1
+fi
@@ -0,0 +1,64 @@
+#
+#	Tests for rlm_radius proxying over TCP.
+#
+#	radclient sends packets to the "test" virtual server over UDP,
+#	which proxies them over TCP to the "home" virtual server in
+#	the same radiusd.  They also cover the reply cache.
+#
+
+#
+#	Test name
+#
+TEST  := test.radius_tcp
+FILES := $(subst $(DIR)/,,$(wildcard $(DIR)/*.txt))
+
+$(eval $(call TEST_BOOTSTRAP))
+
+#
+#	Client port
+#
+RADIUS_TCP_CLIENT_PORT = 1334
+
+#
+#  Generic rules to start / stop the radius service.
+#
+CLIENT := radclient
+include src/tests/radiusd.mk
+$(eval $(call RADIUSD_SERVICE,radiusd,$(OUTPUT)))
+
+#
+#	Run the radclient commands against the radiusd, and check
+#	the output with the matching .cmd script.
+#
+$(OUTPUT)/%: $(DIR)/% | $(TEST).radiusd_kill $(TEST).radiusd_start
+	$(eval TARGET   := $(notdir $<)$(E))
+	$(eval TYPE     := $(shell echo $(TARGET) | cut -f1 -d '_'))
+	$(eval CMD_TEST := $(patsubst %.txt,%.cmd,$<))
+	$(eval FOUND    := $(patsubst %.txt,%.out,$@))
+	$(eval ARGV     := $(shell grep "#.*ARGV:" $< | cut -f2 -d ':'))
+	$(eval RADIUS_TCP_CLIENT_PORT := $(shell echo $$(($(RADIUS_TCP_CLIENT_PORT)+1))))
+
+	$(Q)echo "RADIUS-TCP-TEST INPUT=$(TARGET) ARGV=\"$(ARGV)\""
+	$(Q)[ -f $(dir $@)/radiusd.pid ] || exit 1
+	$(Q)if ! $(TEST_BIN)/radclient $(ARGV) -C $(RADIUS_TCP_CLIENT_PORT) -f $< -d src/tests/radius_tcp/config -D share/dictionary 127.0.0.1:$(radius_tcp_port) $(TYPE) testing123 1> $(FOUND) 2>&1; then \
+		echo "FAILED";                                              \
+		cat $(FOUND);                                               \
+		rm -f $(BUILD_DIR)/tests/test.radius_tcp;		    \
+		$(MAKE) --no-print-directory test.radius_tcp.radiusd_kill;  \
+		echo "RADIUSD:   $(RADIUSD_RUN)";                           \
+		echo "RADCLIENT: $(TEST_BIN)/radclient $(ARGV) -C $(RADIUS_TCP_CLIENT_PORT) -f $< -xF -d src/tests/radius_tcp/config -D share/dictionary 127.0.0.1:$(radius_tcp_port) $(TYPE) testing123"; \
+		exit 1;                                                     \
+	fi
+	$(Q)if ! $(SHELL) $(CMD_TEST); then                                 \
+		echo "RADIUS-TCP FAILED $@";                                \
+		echo "RADIUSD:   $(RADIUSD_RUN)";                           \
+		echo "ERROR: The script $(CMD_TEST) can't validate the content of $(FOUND)"; \
+		rm -f $(BUILD_DIR)/tests/test.radius_tcp;		    \
+		$(MAKE) --no-print-directory test.radius_tcp.radiusd_kill;  \
+		exit 1;                                                     \
+	fi
+	$(Q)touch $@
+
+$(TEST):
+	$(Q)$(MAKE) --no-print-directory $@.radiusd_stop
+	@touch $(BUILD_DIR)/tests/$@
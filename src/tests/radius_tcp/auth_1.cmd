@@ -0,0 +1,16 @@
+#!/bin/sh
+#
+#	The home server accepts "bob", and the reply comes back over TCP.
+#
+
+test_in="build/tests/radius_tcp/auth_1.out"
+
+if ! grep -q "Received Access-Accept" ${test_in}; then
+	echo "ERROR: Expected 'Received Access-Accept' in '${test_in}'"
+	exit 1
+fi
+
+if ! grep -q 'Reply-Message = "Proxied over TCP"' ${test_in}; then
+	echo "ERROR: Expected the home server's Reply-Message in '${test_in}'"
+	exit 1
+fi
@@ -0,0 +1,11 @@
+#!/bin/sh
+#
+#	The home server rejects everyone other than "bob".
+#
+
+test_in="build/tests/radius_tcp/auth_2.out"
+
+if ! grep -q "Received Access-Reject" ${test_in}; then
+	echo "ERROR: Expected 'Received Access-Reject' in '${test_in}'"
+	exit 1
+fi
@@ -0,0 +1,21 @@
+#!/bin/sh
+#
+#	Many packets outstanding at once on the one TCP connection
+#	to the home server.  Every one of them has to be answered.
+#
+
+test_in="build/tests/radius_tcp/auth_3.out"
+sent=$(grep "Sent Access-Request" ${test_in} | wc -l)
+recv=$(grep "Received Access-Accept" ${test_in} | wc -l)
+
+expected=200
+
+if [ $sent -ne $expected ]; then
+	echo "ERROR: We expected ${expected} 'Sent Access-Request' in '${test_in}', got ${sent}"
+	exit 1
+fi
+
+if [ $recv -ne $expected ]; then
+	echo "ERROR: We expected ${expected} 'Received Access-Accept' in '${test_in}', got ${recv}"
+	exit 1
+fi
@@ -0,0 +1,13 @@
+#!/bin/sh
+#
+#	The "test" virtual server checks that the reply cache misses,
+#	hits, and then expires.  It rejects the request if any of
+#	those checks fail.
+#
+
+test_in="build/tests/radius_tcp/auth_4.out"
+
+if ! grep -q "Received Access-Accept" ${test_in}; then
+	echo "ERROR: The reply cache did not miss, hit, and expire as expected.  See '${test_in}'"
+	exit 1
+fi